@@ -161,6 +161,26 @@ namespace raven_2
       double grasp1_r;
 //#line 27 "cfg/MyStuff.cfg"
       double grasp2_r;
+//#line 29 "cfg/MyStuff.cfg"
+      int ravenstate_rate_hz;
+//#line 30 "cfg/MyStuff.cfg"
+      int joint_states_rate_hz;
+//#line 31 "cfg/MyStuff.cfg"
+      int marker_rate_hz;
+//#line 32 "cfg/MyStuff.cfg"
+      bool publish_on_event;
+//#line 34 "cfg/MyStuff.cfg"
+      double lpf_arm_cutoff_hz;
+//#line 35 "cfg/MyStuff.cfg"
+      int lpf_arm_order;
+//#line 36 "cfg/MyStuff.cfg"
+      bool lpf_arm_bessel;
+//#line 37 "cfg/MyStuff.cfg"
+      double lpf_tool_cutoff_hz;
+//#line 38 "cfg/MyStuff.cfg"
+      int lpf_tool_order;
+//#line 39 "cfg/MyStuff.cfg"
+      bool lpf_tool_bessel;
 //#line 138 "/opt/ros/electric/stacks/driver_common/dynamic_reconfigure/templates/ConfigType.h"
 
     bool __fromMessage__(dynamic_reconfigure::Config &msg)
@@ -373,6 +393,86 @@ namespace raven_2
       __default__.grasp2_r = 0.0;
 //#line 27 "cfg/MyStuff.cfg"
       __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<double>("grasp2_r", "double", 0, "An offet to add to the grasp2_r", "", &MyStuffConfig::grasp2_r)));
+//#line 29 "cfg/MyStuff.cfg"
+      __min__.ravenstate_rate_hz = 0;
+//#line 29 "cfg/MyStuff.cfg"
+      __max__.ravenstate_rate_hz = 4000;
+//#line 29 "cfg/MyStuff.cfg"
+      __default__.ravenstate_rate_hz = 1000;
+//#line 29 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<int>("ravenstate_rate_hz", "int", 0, "ravenstate messages per second (0: only on runlevel change, if publish_on_event)", "", &MyStuffConfig::ravenstate_rate_hz)));
+//#line 30 "cfg/MyStuff.cfg"
+      __min__.joint_states_rate_hz = 0;
+//#line 30 "cfg/MyStuff.cfg"
+      __max__.joint_states_rate_hz = 4000;
+//#line 30 "cfg/MyStuff.cfg"
+      __default__.joint_states_rate_hz = 33;
+//#line 30 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<int>("joint_states_rate_hz", "int", 0, "joint_states messages per second (0: off)", "", &MyStuffConfig::joint_states_rate_hz)));
+//#line 31 "cfg/MyStuff.cfg"
+      __min__.marker_rate_hz = 0;
+//#line 31 "cfg/MyStuff.cfg"
+      __max__.marker_rate_hz = 4000;
+//#line 31 "cfg/MyStuff.cfg"
+      __default__.marker_rate_hz = 33;
+//#line 31 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<int>("marker_rate_hz", "int", 0, "visualization marker messages per second (0: off)", "", &MyStuffConfig::marker_rate_hz)));
+//#line 32 "cfg/MyStuff.cfg"
+      __min__.publish_on_event = 0;
+//#line 32 "cfg/MyStuff.cfg"
+      __max__.publish_on_event = 1;
+//#line 32 "cfg/MyStuff.cfg"
+      __default__.publish_on_event = 1;
+//#line 32 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<bool>("publish_on_event", "bool", 0, "Also publish ravenstate when runlevel or sublevel change", "", &MyStuffConfig::publish_on_event)));
+//#line 34 "cfg/MyStuff.cfg"
+      __min__.lpf_arm_cutoff_hz = 5.0;
+//#line 34 "cfg/MyStuff.cfg"
+      __max__.lpf_arm_cutoff_hz = 1000.0;
+//#line 34 "cfg/MyStuff.cfg"
+      __default__.lpf_arm_cutoff_hz = 120.0;
+//#line 34 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<double>("lpf_arm_cutoff_hz", "double", 0, "Position filter cutoff (Hz) of the shoulder, elbow and insertion", "", &MyStuffConfig::lpf_arm_cutoff_hz)));
+//#line 35 "cfg/MyStuff.cfg"
+      __min__.lpf_arm_order = 1;
+//#line 35 "cfg/MyStuff.cfg"
+      __max__.lpf_arm_order = 3;
+//#line 35 "cfg/MyStuff.cfg"
+      __default__.lpf_arm_order = 3;
+//#line 35 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<int>("lpf_arm_order", "int", 0, "Position filter order (1-3) of the shoulder, elbow and insertion", "", &MyStuffConfig::lpf_arm_order)));
+//#line 36 "cfg/MyStuff.cfg"
+      __min__.lpf_arm_bessel = 0;
+//#line 36 "cfg/MyStuff.cfg"
+      __max__.lpf_arm_bessel = 1;
+//#line 36 "cfg/MyStuff.cfg"
+      __default__.lpf_arm_bessel = 0;
+//#line 36 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<bool>("lpf_arm_bessel", "bool", 0, "Bessel instead of butterworth position filter for the shoulder, elbow and insertion", "", &MyStuffConfig::lpf_arm_bessel)));
+//#line 37 "cfg/MyStuff.cfg"
+      __min__.lpf_tool_cutoff_hz = 5.0;
+//#line 37 "cfg/MyStuff.cfg"
+      __max__.lpf_tool_cutoff_hz = 1000.0;
+//#line 37 "cfg/MyStuff.cfg"
+      __default__.lpf_tool_cutoff_hz = 120.0;
+//#line 37 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<double>("lpf_tool_cutoff_hz", "double", 0, "Position filter cutoff (Hz) of the tool joints", "", &MyStuffConfig::lpf_tool_cutoff_hz)));
+//#line 38 "cfg/MyStuff.cfg"
+      __min__.lpf_tool_order = 1;
+//#line 38 "cfg/MyStuff.cfg"
+      __max__.lpf_tool_order = 3;
+//#line 38 "cfg/MyStuff.cfg"
+      __default__.lpf_tool_order = 3;
+//#line 38 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<int>("lpf_tool_order", "int", 0, "Position filter order (1-3) of the tool joints", "", &MyStuffConfig::lpf_tool_order)));
+//#line 39 "cfg/MyStuff.cfg"
+      __min__.lpf_tool_bessel = 0;
+//#line 39 "cfg/MyStuff.cfg"
+      __max__.lpf_tool_bessel = 1;
+//#line 39 "cfg/MyStuff.cfg"
+      __default__.lpf_tool_bessel = 0;
+//#line 39 "cfg/MyStuff.cfg"
+      __param_descriptions__.push_back(MyStuffConfig::AbstractParamDescriptionConstPtr(new MyStuffConfig::ParamDescription<bool>("lpf_tool_bessel", "bool", 0, "Bessel instead of butterworth position filter for the tool joints", "", &MyStuffConfig::lpf_tool_bessel)));
 //#line 239 "/opt/ros/electric/stacks/driver_common/dynamic_reconfigure/templates/ConfigType.h"
     
       for (std::vector<MyStuffConfig::AbstractParamDescriptionConstPtr>::const_iterator i = __param_descriptions__.begin(); i != __param_descriptions__.end(); i++)
@@ -35,9 +35,13 @@
 #ifndef DS0_H
 #define DS0_H
 //#define NUM_MECH 2
+// Mechanism capacity, set at build time (R2_MAX_MECH in CMakeLists.txt).
+// How many are in use is NUM_MECH, found at startup.
+#ifndef MAX_MECH
 #define MAX_MECH 2
+#endif
 #define MAX_DOF_PER_MECH 8
-#define MAX_MECH_PER_DEV 2
+#define MAX_MECH_PER_DEV MAX_MECH
 
 #define STATE_OFF        0
 #define STATE_UNINIT     1
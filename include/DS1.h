@@ -35,8 +35,15 @@
 #include "DS0.h"
 #endif
 
+#include <time.h>
+
 #define STOP 0    // runlevel 0 is STOP state
 
+// param_pass.dirty: fields a publication changed since the last one the RT thread took
+#define PP_DIRTY_POSE(m)   (1u << (m))    // xd[m], rd[m]
+#define PP_DIRTY_SURGEON   0x100          // surgeon_mode
+#define PP_DIRTY_ALL       0xffffffffu
+
 //* \todo Delete stuff from OLD R_I code!
 struct param_pass {
   u_08   runlevel;				  // device runlevel
@@ -56,6 +63,8 @@ struct param_pass {
   int    surgeon_mode;
   int    robotControlMode;
   int 	 last_sequence;
+  struct timespec rx_stamp;   // receive time (CLOCK_REALTIME) of packet last_sequence
+  unsigned int dirty;         // PP_DIRTY_* bits, set by publishData1()
 };
 
 #endif
@@ -55,8 +55,10 @@ delroll[2]
 buttonstate[2]
 grasp[2]        +32767 = 100% closing torque, -32768 = 100% opening
 surgeon_mode    SURGEON_ENGAGED or SURGEON_DISENGAGED  (formerly Pedal_Down or Pedal_UP)
-checksum
+checksum        if pactyp == TELEOP_PACTYP_CRC32C: CRC-32C of the struct with checksum = 0
 */
+#define TELEOP_PACTYP_CRC32C  0x43524343   // "CRCC"
+
 
 struct u_struct {
 	unsigned int sequence;
@@ -86,7 +88,9 @@ fy            Y force
 fz            Z force
 runlevel      Slave operating state
 jointflags    bit flags for each joint limit (up to 16 joints).
-checksum
+checksum      if pactyp == TELEOP_PACTYP_CRC32C: CRC-32C of the struct with checksum = 0
+
+Feedback datagrams carry one or more v_structs back to back.
 */
 struct v_struct {
 	unsigned int sequence;
@@ -101,6 +105,51 @@ struct v_struct {
 	int checksum;
 };
 
+/*
+Compact teleop protocol (version TELEOP_COMPACT_VERSION).
+
+Sent instead of u_struct by masters that support it; both are accepted.
+A datagram is a u_compact_header followed by nsamples u_compact_samples,
+oldest first.  Sample i has sequence number header.sequence + i, and all
+samples share the header's surgeon_mode.  crc is the CRC-32C of the whole
+datagram with crc = 0.
+
+delx[3]        position increment, same units as u_struct, saturated to int16
+qidx           index (0..3 = x,y,z,w) of the largest quaternion component, which is dropped
+q[3]           the other three components in x,y,z,w order, * TELEOP_QUAT_SCALE.
+               The encoder negates the quaternion so the dropped component is positive.
+grasp          as u_struct, saturated to int16
+buttonstate    as u_struct, low 8 bits
+*/
+#define TELEOP_COMPACT_MAGIC        0xC7
+#define TELEOP_COMPACT_VERSION      1
+#define TELEOP_COMPACT_MAX_SAMPLES  8
+#define TELEOP_QUAT_SCALE           46340.0   // 32767/sqrt(0.5): the three smallest components are within +-sqrt(0.5)
+
+struct u_compact_header {
+	unsigned char magic;
+	unsigned char version;
+	unsigned char nsamples;
+	unsigned char surgeon_mode;
+	unsigned int sequence;
+	unsigned int crc;
+} __attribute__((packed));
+
+struct u_compact_arm {
+	short del[3];
+	unsigned char qidx;
+	short q[3];
+	short grasp;
+	unsigned char buttonstate;
+} __attribute__((packed));
+
+struct u_compact_sample {
+	struct u_compact_arm arm[2];
+} __attribute__((packed));
+
+#define TELEOP_COMPACT_LEN(n)  (sizeof(struct u_compact_header) + (n)*sizeof(struct u_compact_sample))
+#define TELEOP_MAX_DATAGRAM    TELEOP_COMPACT_LEN(TELEOP_COMPACT_MAX_SAMPLES)
+
 #endif //teleoperation_h
 
 
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <vector>
+#include <ros/ros.h>
 
 #include "defines.h"
 #include "struct.h"
@@ -45,14 +46,21 @@
 //#include <linux/delay.h>
 //#include <rtai.h>
 
+#if MAX_MECH_PER_DEV > 10
+#define MAX_BOARD_COUNT MAX_MECH_PER_DEV ///Maximum number of usb boards
+#else
 #define MAX_BOARD_COUNT 10 ///Maximum number of usb boards
+#endif
+#define MAX_BOARD_SERIAL 99  ///Board serials are two digits (/dev/brl_usbXX)
 
 /* USB packet lengths */
 #define OUT_LENGTH      (3+MAX_DOF_PER_MECH*2) /* (3+8*2) w/ output pins */
 
+/// One entry per mechanism, in mechanism order
 typedef struct
 {
     std::vector <int>    boards;   /// Vector of serial numbers
+    std::vector <int>    master;   /// Master (ITP) arm driving each mechanism, -1: none
     int activeAtStart;    /// Number of active boards
 
 } USBStruct;
@@ -66,11 +74,27 @@ typedef struct
 #define USB_BUSY_ERROR    3
 
 #define MAX_LOOPS         10
+
+// How rt_process waits for a USB read to complete
+#define USB_WAIT_SPIN     0   /// retry every 10us while the driver reports EBUSY
+#define USB_WAIT_POLL     1   /// block in poll() on the board files until data or deadline
+
+// What answers the usb_* calls (/usb_backend)
+#define USB_BACKEND_BOARDS 0   /// the brl_usb boards
+#define USB_BACKEND_SIM    1   /// simulated boards and plant (usb_sim.h)
+#define USB_BACKEND_REPLAY 2   /// a flight recording (usb_replay.h)
 #define USB_INIT_ERROR   -1
 #define USB_RESET         1
 
 //Function Prototypes
+int init_arm_boards(ros::NodeHandle &n);
+int armBoardCount(void);
+int armBoardSerial(int k);
+int armBoardType(int serial);
+int usbAddMech(struct device *device0, int serial);
 int USBInit(struct device *device0);
+int USBInitWait(void);
+int usbBoardReopen(int id);
 void USBShutdown(void);
 
 void USBShutdown(void);
@@ -78,6 +102,8 @@ void USBShutdown(void);
 int startUSBRead( int id );
 int usb_read(int id, void *buffer, size_t len);
 int usb_write(int id, void *buffer, size_t len);
+int usb_board_fd(int id);
+int usbEmergencyZero(void);
 
 int usb_reset_encoders(int boardid);
 
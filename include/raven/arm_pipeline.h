@@ -0,0 +1,91 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * arm_pipeline.h
+ *
+ * Per-arm control pipeline.  With /control_pipeline "per_arm" the
+ * per-mechanism part of controlRaven() (coupling, kinematics, gravity, PD
+ * and DAC) runs for every mechanism at once: the RT thread takes mechanism
+ * 0 and a pinned worker thread each of the others.  The state machine,
+ * state estimate and USB I/O stay on the RT thread.
+ *
+ * Stage loops over mechanisms run from mechFirst() to mechEnd().  Off a
+ * pipeline job that is every mechanism, inside one it is the job's own.
+ *
+ * Parameters:
+ *   /control_pipeline   "serial" (default) or "per_arm"
+ *   /arm_worker_wait    "spin": workers busy-wait on their isolated cores
+ *                       (default), "sleep": they block on a semaphore
+ *   /cpus_arm_workers   cores of the workers, see cpu_affinity.h
+ */
+
+#ifndef __ARM_PIPELINE_H__
+#define __ARM_PIPELINE_H__
+
+#include <ros/ros.h>
+#include "struct.h"
+#include "DS1.h"
+
+// How the per-mechanism stages of a cycle run
+#define ARM_PIPELINE_SERIAL   0   /// every mechanism in turn on the RT thread
+#define ARM_PIPELINE_PER_ARM  1   /// one mechanism per thread, joined before the DACs go out
+
+// Work a job leaves to the RT thread, after every mechanism is done
+#define ARM_DEFER_ORIGIN      0x1 /// updateMasterRelativeOrigin()
+
+/// one mechanism's share of a cycle
+typedef int (*arm_job)(struct device *device0, struct param_pass *currParams);
+
+extern __thread int arm_worker;   // mechanism of the job running on this thread, -1 if none
+extern int NUM_MECH;
+
+/// first mechanism the calling thread works on
+static inline int mechFirst()
+{
+    return arm_worker < 0 ? 0 : arm_worker;
+}
+
+/// one past the last mechanism the calling thread works on
+static inline int mechEnd()
+{
+    return arm_worker < 0 ? NUM_MECH : arm_worker + 1;
+}
+
+/// true inside a pipeline job, where state shared by all arms is off limits
+static inline int onArmWorker()
+{
+    return arm_worker >= 0;
+}
+
+/// true where per-cycle bookkeeping (stage timing, tracepoints) is done: off a job, or in mechanism 0's
+static inline int armLeader()
+{
+    return arm_worker <= 0;
+}
+
+int init_arm_pipeline(ros::NodeHandle &n);
+int armPipelineStart(struct device *device0);
+void armPipelineStop(void);
+int armPipelineActive(void);
+int armPipelineRun(arm_job job, struct device *device0, struct param_pass *currParams);
+void armPipelineDefer(int what);
+int armPipelineTakeDeferred(void);
+
+#endif
@@ -0,0 +1,46 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file blackbox.h
+ * \brief Estop black box: the last few seconds of control data, dumped on trip.
+ *
+ * The RT thread keeps an in-memory ring of flight records (flight_format.h)
+ * with blackboxCapture().  blackboxTrigger() marks the trip; once the
+ * post-trigger records are in, the ring freezes and blackbox_process() writes
+ * it to a file that r2_flight_export reads, then re-arms.  Configured at
+ * startup:
+ *   /blackbox_seconds   ring length (0: black box off)
+ *   /blackbox_post_ms   recording kept going after the trigger
+ *   /blackbox_dir       where dumps go
+ */
+
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+int init_blackbox(ros::NodeHandle &n);
+void blackboxCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams);
+void blackboxTrigger(const char *reason);
+void blackboxFreeze(const char *reason);
+void* blackbox_process(void*);
+
+#endif // BLACKBOX_H
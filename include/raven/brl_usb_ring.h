@@ -0,0 +1,92 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * brl_usb_ring.h
+ *
+ * Layout of the packet ring a brl_usb board file can map, shared with the
+ * driver.  One page per board, mapped MAP_SHARED at offset 0:
+ *
+ *   IN  (encoder) packets: the user bumps in_req where it used to call
+ *       ioctl(BRL_START_READ); the driver fills in[h % nslots] with the
+ *       board's reply, sets its seq to h and then advances in_head to h+1.
+ *       poll() on the board file still reports POLLIN when in_head moves.
+ *   OUT (DAC) packets: the user fills out[h % nslots], sets its seq and len,
+ *       and advances out_head to h+1 where it used to call write().  The
+ *       driver advances out_done as the packets go out.
+ *
+ * The driver says in flags how it hears about in_req / out_head moving:
+ * it polls them itself, or it waits on an eventfd the user hands it with
+ * BRL_RING_SET_KICK and writes after each change.  Counters only grow; the
+ * writer of each one issues a store barrier before moving it.
+ *
+ * A driver without the ring fails BRL_RING_INFO with ENOTTY, and the board
+ * stays on ioctl / read / write.
+ */
+
+#ifndef __BRL_USB_RING_H__
+#define __BRL_USB_RING_H__
+
+#include <stdint.h>
+
+// ioctls, numbered after BRL_START_READ (4) and BRL_RESET_BOARD (10)
+#define BRL_RING_INFO       12   /// arg: struct brl_ring_info *, filled by the driver
+#define BRL_RING_SET_KICK   13   /// arg: eventfd the driver waits on (BRL_RING_KICK_EVENTFD)
+
+#define BRL_RING_MAGIC      0x52524c42   /// "BRLR"
+#define BRL_RING_VERSION    1
+#define BRL_RING_SLOT_DATA  48           /// bytes of packet per slot (IN_LENGTH, OUT_LENGTH fit)
+
+// flags: how the driver is told of a new request or packet
+#define BRL_RING_KICK_POLL     0x1   /// the driver polls in_req and out_head
+#define BRL_RING_KICK_EVENTFD  0x2   /// the user writes the BRL_RING_SET_KICK eventfd
+
+struct brl_ring_info
+{
+    uint32_t version;       // BRL_RING_VERSION the driver speaks
+    uint32_t flags;         // BRL_RING_KICK_*
+    uint32_t map_size;      // bytes to mmap()
+    uint32_t nslots;        // slots per direction, a power of two
+};
+
+struct brl_ring_slot
+{
+    uint32_t seq;           // index of the packet in the slot
+    uint32_t len;           // bytes of data
+    uint64_t stamp_ns;      // IN: CLOCK_MONOTONIC when the driver's transfer completed
+    uint8_t  data[BRL_RING_SLOT_DATA];
+} __attribute__((aligned(64)));
+
+struct brl_ring
+{
+    uint32_t magic;         // BRL_RING_MAGIC
+    uint32_t version;
+    uint32_t flags;
+    uint32_t nslots;
+
+    volatile uint32_t in_head  __attribute__((aligned(64)));   // driver: IN packets completed
+    volatile uint32_t in_req   __attribute__((aligned(64)));   // user: IN transfers requested
+    volatile uint32_t out_head;                                // user: OUT packets posted
+    volatile uint32_t out_done __attribute__((aligned(64)));   // driver: OUT packets sent
+
+    // in[nslots], then out[nslots]
+    struct brl_ring_slot slots[] __attribute__((aligned(64)));
+};
+
+#endif
@@ -0,0 +1,67 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cable_coupling.h
+ * \brief Cable coupling kernels specialised per arm and tool type.
+ *
+ * fwdMechCableCoupling() and invMechCableCoupling() used to look up the
+ * transmission ratios and walk the tool type chain on every call.  Each
+ * (arm, tool) pair now has its own instantiation with the ratios and signs
+ * as constants, picked once when the arm's tool is set and re-picked only
+ * if mech->type or mech->tool_type change.
+ *
+ * The kernels are linear apart from the tool capstans following the
+ * measured insertion, so by default (/cable_coupling_matrix) each pair's
+ * forward kernel is read off into a matrix, inverted for the other
+ * direction, and both run as one matrix-vector product plus the insertion
+ * correction.
+ *
+ * invCableCoupling() also skips a mechanism whose inputs have not changed
+ * since the last cycle (/skip_when_idle).
+ */
+
+#ifndef CABLE_COUPLING_H
+#define CABLE_COUPLING_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+typedef void (*fwd_coupling_fn)(struct mechanism *mech);
+typedef void (*inv_coupling_fn)(struct mechanism *mech, int no_use_actual);
+
+struct coupling_matrix;
+
+/// the coupling kernels of one arm and tool type
+struct coupling_kernels {
+	u_16 type;              // mech->type they were built for
+	e_tool_type tool_type;  // mech->tool_type they were built for
+	unsigned int gen;       // bumped on every selection
+	fwd_coupling_fn fwd;    // mpos -> jpos, see fwdMechCableCoupling()
+	inv_coupling_fn inv;    // jpos_d -> mpos_d, see invMechCableCoupling()
+	const struct coupling_matrix *matrix;   // matrix form in use, NULL for the scalar kernels
+};
+
+int selectCouplingKernels(struct mechanism *mech);
+const struct coupling_kernels *getCouplingKernels(struct mechanism *mech);
+
+int init_cable_coupling(ros::NodeHandle &n);
+void invCouplingIfChanged(int m, struct mechanism *mech);
+
+#endif // CABLE_COUPLING_H
@@ -0,0 +1,48 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file calibration.h
+ * \brief Encoder calibration kept across restarts of the control process.
+ *
+ * While an arm is homed, calibrationCapture() keeps its encoder offsets and
+ * the latest encoder counts; calibration_process() writes them out, with the
+ * board serial, tool type and kernel boot id, when they change.  At the next
+ * homing, calibrationRestore() gives the arm its offsets back if the boards
+ * were not power cycled since (same boot, same boards, counts where they
+ * were left).  The arm then only makes the slow move to its home pose,
+ * during which raven_homing() rejects the calibration if a joint meets a
+ * stop.  Configured at startup:
+ *   /calibration_file            where it is kept ("": warm start off)
+ *   /calibration_max_drift_revs  motor turns a joint may have moved while the process was down
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+int init_calibration(ros::NodeHandle &n);
+void calibrationCapture(struct device *dev);
+int calibrationRestore(struct mechanism *mech, int m);
+void calibrationReject(int m);
+void* calibration_process(void*);
+
+#endif // CALIBRATION_H
@@ -21,7 +21,22 @@
 *  File: console_process.h
 *
 *  Outputs data to the console periodically, so that we know our robot is alives.
+*  The state shown comes from the publisher thread's snapshots, not device0.
+*  Configured at startup:
+*    /console_rate_hz  state dumps per second while console output is on (1-30)
+*    /console_view     "compact" (poses, joint positions, torques, DAC) or "full"
+*    /console_refresh  redraw the dump in place instead of scrolling
 */
 
+#ifndef CONSOLE_PROCESS_H
+#define CONSOLE_PROCESS_H
+
+#include <ros/ros.h>
+
+int init_console(ros::NodeHandle &n);
 void *console_process(void *);
+int consoleReactorAttach(int lane);
+void consoleReactorDetach(void);
 void outputRobotState();
+
+#endif // CONSOLE_PROCESS_H
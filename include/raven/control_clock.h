@@ -0,0 +1,42 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file control_clock.h
+ * \brief The clock the control path reads: wall clock, or virtual in lockstep.
+ *
+ * In lockstep mode (/lockstep, sim and replay backends only) time is
+ * gTime control periods since the loop started: the loop does not sleep,
+ * runs as fast as the CPU allows, and everything that reads the time in
+ * the control path (trajectories, the simulated boards) sees the same
+ * values on every run.
+ */
+
+#ifndef CONTROL_CLOCK_H
+#define CONTROL_CLOCK_H
+
+#include <ros/ros.h>
+
+int init_control_clock(ros::NodeHandle &n);
+int controlClockLockstep();
+void controlClockSetLockstep(int on);
+long long controlClockNs();
+ros::Time controlTime();
+
+#endif // CONTROL_CLOCK_H
@@ -0,0 +1,63 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file control_config.h
+ * \brief Gains and joint limits, reloaded at run time without locking the control loop.
+ *
+ * A ctrl_config is a complete, versioned set of the per-joint-type PID
+ * gains and software joint limits.  configPublish() builds one on the
+ * caller's thread and hands it to the control loop with a single pointer
+ * exchange; configSwap(), at the top of each cycle, copies a new one into
+ * DOF_types[] and the joint block, so a cycle sees either the old set or
+ * the new one, never a mix.  Position filter settings go through the
+ * state estimator's own swap (setStateLPFClass()).
+ *
+ * Reloaded from dynamic_reconfigure: reload_gains re-reads /gains_* and the
+ * optional /joint_limits_{gold,green}_{min,max} from the parameter server,
+ * and kp_scale, kd_scale and ki_scale scale every joint's gains.
+ */
+
+#ifndef CONTROL_CONFIG_H
+#define CONTROL_CONFIG_H
+
+#include <ros/ros.h>
+#include "struct.h"
+#include "joint_block.h"
+
+struct ctrl_config
+{
+	u_32 version;                   // bumped by every configPublish()
+	float kp[JB_N_JOINTS];          // gains as read, before scaling
+	float kd[JB_N_JOINTS];
+	float ki[JB_N_JOINTS];
+	float kp_scale, kd_scale, ki_scale;
+	float min_limit[JB_N_JOINTS];   // NAN: keep initDOFs()'s limit
+	float max_limit[JB_N_JOINTS];
+};
+
+int init_control_config(ros::NodeHandle &n, struct device *device0);
+int configReadParams(ros::NodeHandle &n, struct ctrl_config *c);
+void configLatest(struct ctrl_config *c);
+int configPublish(const struct ctrl_config *c);
+void configSwap(void);
+void configApplyNow(void);
+u_32 configVersion(void);
+
+#endif // CONTROL_CONFIG_H
@@ -0,0 +1,81 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file controller.h
+ * \brief Registry of the control laws controlRaven() runs.
+ *
+ * A controller is a table of hooks, selected by the control mode
+ * (param_pass.robotControlMode).  The built-in modes register at startup
+ * (rt_raven.cpp); more come from shared libraries listed in
+ * /controller_plugins, each exporting
+ *
+ *   extern "C" const struct raven_controller *raven_controller_plugin(void);
+ *
+ * and may take a new mode number or replace a built-in one.  All of them
+ * are initialised at startup, so a controller allocates there and never in
+ * its update.  On a mode switch the new controller's reset hook runs in
+ * the same cycle as its first update, so the DACs never see a cycle
+ * without a command.
+ *
+ * update runs after stateEstimate(), the forward cable coupling and the
+ * forward kinematics, and ends with the torques in tau_d, the currents in
+ * current_cmd (TorqueToDAC()).  jb is the joint block bound to the device.
+ */
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <ros/ros.h>
+#include "struct.h"
+#include "DS1.h"
+#include "joint_block.h"
+
+#define RAVEN_CONTROLLER_ABI   1      // bumped when raven_controller changes
+#define MAX_CONTROL_MODES      32     // robotControlMode 0 .. MAX_CONTROL_MODES-1
+#define RAVEN_CONTROLLER_PLUGIN_SYMBOL "raven_controller_plugin"
+
+// raven_controller.flags
+#define CTRL_PER_ARM    0x1   /// update only touches mechanisms mechFirst()..mechEnd()-1: runs as a per-arm pipeline job
+#define CTRL_KEEP_INIT  0x2   /// leaves `initialized` alone; every other controller clears it
+
+struct raven_controller
+{
+	u_32 abi;                 // RAVEN_CONTROLLER_ABI
+	const char *name;
+	int mode;                 // robotControlMode that selects it
+	int flags;                // CTRL_*
+
+	/// at startup, for its parameters and state; NULL if none.  Nonzero: left out of the registry
+	int (*init)(ros::NodeHandle &n, struct device *device0);
+	/// once per cycle (per arm, with CTRL_PER_ARM and the pipeline running)
+	int (*update)(struct device *device0, struct param_pass *currParams, struct joint_block *jb);
+	/// on switching to it, just before its first update; NULL if none
+	void (*reset)(struct device *device0, struct param_pass *currParams);
+	/// CTRL_PER_ARM in the pipeline: on the RT thread after every arm's update; NULL if none
+	void (*joined)(struct device *device0, struct param_pass *currParams);
+};
+
+typedef const struct raven_controller *(*raven_controller_plugin_fn)(void);
+
+int controllerRegister(const struct raven_controller *c, int replace);
+const struct raven_controller *controllerFor(int mode);
+int init_controllers(ros::NodeHandle &n, struct device *device0);
+
+#endif // CONTROLLER_H
@@ -0,0 +1,73 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cpu_affinity.h
+ * \brief CPU affinity and isolation settings for the r2_control threads.
+ *
+ * Affinity is read from the ROS parameter server at startup:
+ *   /cpu_rt             core for the RT control thread (-1: don't pin)
+ *   /cpu_network        core for the network thread (-1: don't pin)
+ *   /cpus_housekeeping  cpu list (e.g. "0,2-3") for main, ROS spinner,
+ *                       dynamic_reconfigure and console threads ("": don't pin)
+ *   /usb_irqs           IRQ list of the USB host controller(s) to steer
+ *                       onto the housekeeping cores ("": leave alone)
+ *   /cpus_arm_workers   cpu list for the per-arm pipeline workers, one core
+ *                       each, for mechanisms 1.. in ascending order
+ *                       (see arm_pipeline.h; "": unpinned)
+ *   /cpus_usb_workers   cpu list for the parallel USB workers, one core
+ *                       each, for boards 0.. in ascending order
+ *                       (see usb_workers.h; "": unpinned)
+ */
+
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <ros/ros.h>
+
+enum thread_role {
+	ROLE_RT = 0,
+	ROLE_NETWORK,
+	ROLE_HOUSEKEEPING,
+	ROLE_LAST
+};
+
+int init_cpu_affinity(ros::NodeHandle &n);
+int set_thread_affinity(int role);
+int thread_role_pinned(int role);
+int thread_role_cpu(int role);
+int arm_worker_cpu(int k);
+int usb_worker_cpu(int k);
+int set_thread_cpu(int cpu);
+
+/**
+ * One iteration of a busy-wait loop.  A thread that spins on a flag never
+ * sleeps, so it must not share a core with the RT thread at SCHED_FIFO: it
+ * would starve it.  Spinning threads need their own core.
+ */
+static inline void spinPause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#endif // CPU_AFFINITY_H
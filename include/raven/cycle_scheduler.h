@@ -0,0 +1,56 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cycle_scheduler.h
+ * \brief Absolute-deadline scheduler for the periodic control loop.
+ *
+ * Deadlines are kept on CLOCK_MONOTONIC so NTP slews do not move the control
+ * period.  When a cycle starts late the scheduler either skips the missed
+ * periods (CYCLE_SKIP) or runs back-to-back until it is back on the grid
+ * (CYCLE_COMPRESS, bounded by max_backlog periods).
+ */
+
+#ifndef CYCLE_SCHEDULER_H
+#define CYCLE_SCHEDULER_H
+
+#include <time.h>
+#include "DS0.h"
+
+// Overrun catch-up policies
+#define CYCLE_SKIP      0   /// drop the missed periods and wait for the next slot
+#define CYCLE_COMPRESS  1   /// run immediately, catch up over the following cycles
+
+struct cycle_sched {
+	struct timespec next;    // next wakeup (CLOCK_MONOTONIC, absolute)
+	long period_ns;          // loop period
+	int  policy;             // CYCLE_SKIP or CYCLE_COMPRESS
+	int  max_backlog;        // most periods CYCLE_COMPRESS will catch up on
+	u_64 cycles;             // cycles run
+	u_64 missed;             // cycles that started after their deadline
+	u_64 skipped;            // periods dropped entirely
+	int  consecutive_missed; // missed deadlines in a row, 0 when on time
+	int  max_consecutive;    // worst run of missed deadlines
+};
+
+void cycleSchedInit(struct cycle_sched *cs, long period_ns, int policy, int max_backlog, long delay_ns);
+int cycleSchedWait(struct cycle_sched *cs);
+void outputCycleSchedStats(const struct cycle_sched *cs);
+
+#endif // CYCLE_SCHEDULER_H
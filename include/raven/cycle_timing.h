@@ -0,0 +1,90 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cycle_timing.h
+ * \brief Per-stage timing of the rt_process() control loop.
+ *
+ * Each stage of the control loop is timestamped with CLOCK_MONOTONIC and the
+ * elapsed time is binned into a preallocated log-scale histogram.  Recording
+ * does no allocation and no I/O, so it is safe to call from the RT thread.
+ * The histograms are read (and printed) from non-RT threads only.
+ */
+
+#ifndef CYCLE_TIMING_H
+#define CYCLE_TIMING_H
+
+#include <time.h>
+#include "DS0.h"
+
+/// Control loop stages that are timed every cycle.
+enum cycle_stage {
+	CT_PERIOD = 0,        // wakeup-to-wakeup interval
+	CT_USB_INITIATE,      // initiateUSBGet()
+	CT_USB_WAIT,          // EBUSY wait in getUSBPackets()
+	CT_STATE_MACHINE,     // updateAtmelInputs() and stateMachine()
+	CT_DEVICE_STATE,      // checkLocalUpdates() and updateDeviceState()
+	CT_CONTROL,           // clearDACs() and controlRaven()
+	CT_INIT_ROBOT,        //   controlRaven: initRobotData()
+	CT_STATE_ESTIMATE,    //   controlRaven: stateEstimate()
+	CT_FWD_CABLE,         //   controlRaven: fwdCableCoupling()
+	CT_FWD_KIN,           //   controlRaven: r2_fwd_kin()
+	CT_CONTROL_MODE,      //   controlRaven: control mode (IK, PD, gravity, DAC)
+	CT_OVERDRIVE,         // overdriveDetect()
+	CT_USB_PUT,           // updateAtmelOutputs() and putUSBPackets()
+	CT_PUBLISH,           // publish_ravenstate_ros()
+	CT_COMPUTE,           // wakeup to end of cycle
+	CT_TELEOP_LATENCY,    // master packet receive to DAC write
+	CT_NUM_STAGES
+};
+
+// Histogram layout: bin 0 holds everything below 2^CT_HIST_MIN_SHIFT ns,
+// then CT_HIST_SUB_BINS bins per power of two.  The last bin is overflow.
+#define CT_HIST_MIN_SHIFT  6      // 64 ns
+#define CT_HIST_MAX_SHIFT  28     // ~268 ms
+#define CT_HIST_SUB_BITS   2
+#define CT_HIST_SUB_BINS   (1<<CT_HIST_SUB_BITS)
+#define CT_HIST_BINS       ((CT_HIST_MAX_SHIFT-CT_HIST_MIN_SHIFT)*CT_HIST_SUB_BINS + 2)
+
+struct cycle_hist {
+	u_64 count;
+	u_64 total_ns;
+	u_64 max_ns;
+	u_64 bins[CT_HIST_BINS];
+};
+
+/**
+ * Get the current timing reference.
+ */
+static inline void cycleTimingStart(struct timespec *t)
+{
+	clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+void cycleTimingRecord(int stage, long long ns);
+void cycleTimingMark(int stage, struct timespec *t);
+long long cycleTimingLast(int stage);
+const char *cycleStageName(int stage);
+void outputCycleTiming();
+
+void teleopLatencyConsume(int sequence, const struct timespec *rx_stamp);
+void teleopLatencyRecord();
+double teleopLatencyAverage();
+
+#endif // CYCLE_TIMING_H
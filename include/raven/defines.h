@@ -37,7 +37,10 @@
 #define RAVEN_II_SQUARE    1
 
 // Two arm identification
-// Change this to match device ID in /dev/brl_usbXX
+// Default board serials (device ID in /dev/brl_usbXX) of the two arms.
+// Which board drives which arm is set by /arm_boards; these stay the arm
+// type (mech.type) of each mechanism: GOLD_ARM is left-handed, GREEN_ARM
+// right-handed kinematics.
 #define GREEN_ARM_SERIAL 37
 #define GOLD_ARM_SERIAL  24
 
@@ -114,6 +117,13 @@
 #define GRASP2_GREEN     15
 #define NO_CONNECTION_GREEN 11
 
+// Joint types are per mechanism: joint j of mechanism m has type
+// JOINT_TYPE(m, j).  The _GOLD and _GREEN types above are those of
+// mechanisms 0 and 1, the gold and green arm in the default /arm_boards.
+#define JOINT_TYPE(m, j)   ((m) * MAX_DOF_PER_MECH + (j))
+#define JOINT_OF_TYPE(t)   ((t) % MAX_DOF_PER_MECH)
+#define MECH_OF_TYPE(t)    ((t) / MAX_DOF_PER_MECH)
+
 //Joint Scale Factors
 #define WRIST_SCALE_FACTOR (float)(1.5) /*used in update_device_state.c on incoming param*/
 
@@ -269,9 +279,17 @@
 
 //Time Defines
 #define ONE_MS       ((float)0.001)
-#define STEP_PERIOD  ONE_MS
 #define SECOND       1000
 
+//Control rate.  Set once at startup from /control_rate_hz (see globals.cpp)
+#define DEFAULT_CONTROL_RATE 1000          // Hz
+#define MIN_CONTROL_RATE     500           // Hz
+#define MAX_CONTROL_RATE     4000          // Hz
+extern int   control_rate_hz;              // control loop rate (Hz)
+extern float step_period;                  // control loop period (s)
+#define STEP_PERIOD  step_period
+#define MS_TO_TICKS(ms) ((unsigned long)(ms) * control_rate_hz / 1000)   // milliseconds to control cycles
+
 //Speed Limits
 #define V_MAX        ((float)3.0) /* rad/s   */
 #define A_MAX        ((float)1.0) /* rad/s^2 */
@@ -284,11 +302,11 @@
 #define PEDAL_UP 0
 #define PEDAL_DN 1
 
-//Watchdog timer Period
-#define WD_PERIOD      50
+//Watchdog timer Period (50 ms)
+#define WD_PERIOD      MS_TO_TICKS(50)
 
-//Master connection timeout (time to trigger pedal up)
-#define MASTER_CONN_TIMEOUT 5000
+//Master connection timeout (time to trigger pedal up, 5 s)
+#define MASTER_CONN_TIMEOUT MS_TO_TICKS(5000)
 
 
 #endif
@@ -39,6 +39,7 @@
 
 //Function prototypes
 int processEncVal(unsigned char buffer[], int channel);
+void decodeEncPacket(const unsigned char buffer[], int enc[MAX_DOF_PER_MECH]);
 
 void encToJPos(struct DOF *joint);
 void encToMPos(struct DOF *joint);
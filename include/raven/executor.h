@@ -0,0 +1,61 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file executor.h
+ * \brief Event-loop executor for the non-RT I/O of r2_control.
+ *
+ * With /executor "reactor", network receive, console input, the ROS
+ * callbacks (automove, waypoints, services, dynamic_reconfigure), state
+ * publishing and the log drain run as handlers on one or two epoll
+ * reactor threads instead of threads of their own, each waking only when
+ * a descriptor is ready or a timer is due.  Their *_process() threads
+ * return at once, and main() waits for shutdown instead of spinning.
+ *
+ * Lanes keep the teleop input apart from the slow work when there are two
+ * reactors; with one, both lanes are the same thread.
+ *
+ *   /executor               "threads" (default): a thread per task, or "reactor"
+ *   /executor_threads       reactors, 1 or 2 (default 2)
+ *   /executor_priority      SCHED_FIFO priority of the reactors, 0: normal (default)
+ *   /executor_ros_period_ms ROS callback queue service period (default 5)
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <ros/ros.h>
+
+// Lanes: which reactor a source runs on
+#define EXEC_LANE_IO            0   /// network receive, console input
+#define EXEC_LANE_HOUSEKEEPING  1   /// ROS callbacks, publishing, log drain
+
+/// called on the reactor when its descriptor is readable or its timer expires
+typedef void (*exec_handler)(void *arg);
+
+int init_executor(ros::NodeHandle &n);
+int executorActive(void);
+int executorStart(void);
+void executorStop(void);
+
+int execWatchFd(int lane, int fd, exec_handler fn, void *arg);
+int execTimer(int lane, exec_handler fn, void *arg);
+void execTimerArm(int timer, long long first_ns, long long period_ns);
+
+#endif // EXECUTOR_H
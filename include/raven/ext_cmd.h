@@ -0,0 +1,41 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file ext_cmd.h
+ * \brief Shared-memory command channel for out-of-process controllers.
+ *
+ * r2_control creates the segment at startup (layout and writer in
+ * ext_cmd_client.h); controlRaven() reads it in external_control mode, see
+ * raven_external_control().  Configured at startup:
+ *   /ext_cmd_shm         segment name ("": channel off, the default)
+ *   /ext_cmd_timeout_ms  heartbeat age at which the command is stale
+ */
+
+#ifndef EXT_CMD_H
+#define EXT_CMD_H
+
+#include <ros/ros.h>
+#include "ext_cmd_client.h"
+
+int init_ext_cmd(ros::NodeHandle &n);
+const struct ext_cmd_data *extCmdPoll(int active);
+void extCmdClose();
+
+#endif // EXT_CMD_H
@@ -0,0 +1,197 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file ext_cmd_client.h
+ * \brief Header-only writer for the shared-memory command channel (ext_cmd.cpp).
+ *
+ * An out-of-process controller drives the robot in external_control mode
+ * by writing one ext_cmd_data per cycle into the POSIX shared-memory segment
+ * r2_control creates (/ext_cmd_shm, default "/r2_cmd").  Each arm takes
+ * joint torques, joint positions or a Cartesian pose.  r2_control reads the
+ * latest command at the start of its control stage, without waiting:
+ *  - the command is a seqlock written by a single writer, seq odd while it
+ *    changes; a torn read just keeps last cycle's command;
+ *  - every write bumps the heartbeat.  If it has not moved for the segment's
+ *    timeout_ms the command is stale and every arm falls back to gravity
+ *    compensation until it moves again.
+ * Only in pedal down; the state machine, the joint limits and the DAC
+ * checks in overdriveDetect() stay in charge.  r2_control echoes the last
+ * heartbeat it used in consumed_heartbeat.  Read the robot state from
+ * state_shm_client.h.
+ *
+ *   ExtCmdWriter w;
+ *   struct ext_cmd_data c;
+ *   memset(&c, 0, sizeof(c));
+ *   c.mech[0].mode = EXT_CMD_TORQUE;
+ *   c.mech[0].flags = EXT_CMD_ADD_GRAVITY;
+ *   if (w.open() == 0)
+ *       for (;;) { c.mech[0].tau[SHOULDER] = u(); w.write(&c); wait_a_cycle(); }
+ *
+ * Only depends on DS0.h.  Link with -lrt on older glibc.
+ */
+
+#ifndef EXT_CMD_CLIENT_H
+#define EXT_CMD_CLIENT_H
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "DS0.h"
+
+#define EXT_CMD_NAME       "/r2_cmd"
+#define EXT_CMD_MAGIC      0x52324358     // "R2CX"
+#define EXT_CMD_VERSION    1
+
+#define EXT_CMD_LIVE       0x1            // ext_cmd_shm.flags: r2_control is running
+
+// ext_cmd_mech.mode
+#define EXT_CMD_OFF        0              // gravity compensation only
+#define EXT_CMD_TORQUE     1              // tau (Nm) on each joint
+#define EXT_CMD_JOINT      2              // PD to jpos (rad, m for insertion), within the joint limits
+#define EXT_CMD_CARTESIAN  3              // PD to the IK of xd / R / grasp, as in cartesian_space_control
+
+// ext_cmd_mech.flags
+#define EXT_CMD_ADD_GRAVITY 0x1           // EXT_CMD_TORQUE: add the gravity torque to tau
+
+// ext_cmd_shm.status, r2_control's view of the command
+#define EXT_STATUS_IDLE    0              // not in external_control or not in pedal down
+#define EXT_STATUS_RUNNING 1              // applying the commands
+#define EXT_STATUS_STALE   2              // heartbeat stopped: gravity only
+
+/// One arm's command
+struct ext_cmd_mech {
+	u_32  mode;                           // EXT_CMD_*
+	u_32  flags;                          // EXT_CMD_ADD_GRAVITY
+	float tau[MAX_DOF_PER_MECH];          // EXT_CMD_TORQUE
+	float jpos[MAX_DOF_PER_MECH];         // EXT_CMD_JOINT
+	int   xd[3];                          // EXT_CMD_CARTESIAN, microns in the base frame
+	int   grasp;                          // mrad
+	float R[3][3];
+};
+
+/// A complete command, by mechanism index
+struct ext_cmd_data {
+	u_64 heartbeat;                       // bumped by every write
+	u_64 write_ns;                        // CLOCK_MONOTONIC at the write
+	struct ext_cmd_mech mech[MAX_MECH];
+};
+
+/// The whole segment
+struct ext_cmd_shm {
+	u_32 magic;                           // EXT_CMD_MAGIC
+	u_32 version;                         // EXT_CMD_VERSION
+	u_32 size;                            // sizeof(struct ext_cmd_shm)
+	u_32 timeout_ms;                      // heartbeat age at which the command is stale
+	volatile u_32 flags;                  // EXT_CMD_LIVE
+
+	// Written by the controller
+	volatile u_32 seq __attribute__((aligned(64)));   // odd while being written
+	struct ext_cmd_data cmd;
+
+	// Written by r2_control
+	volatile u_64 consumed_heartbeat __attribute__((aligned(64)));
+	volatile u_64 consumed_ns;            // CLOCK_MONOTONIC when it was used
+	volatile u_32 status;                 // EXT_STATUS_*
+};
+
+class ExtCmdWriter
+{
+public:
+	ExtCmdWriter() : shm(NULL), heartbeat(0) {}
+	~ExtCmdWriter() { close(); }
+
+	/**\fn int open(const char *name)
+	 * \brief map the segment read-write and check it was made by a matching r2_control
+	 * \return 0, negative errno, or -EINVAL on a layout mismatch
+	 */
+	int open(const char *name = EXT_CMD_NAME)
+	{
+		struct stat st;
+
+		close();
+		int fd = shm_open(name, O_RDWR, 0);
+		if (fd < 0)
+			return -errno;
+		if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct ext_cmd_shm))
+		{
+			::close(fd);
+			return -EINVAL;
+		}
+		void *p = mmap(NULL, sizeof(struct ext_cmd_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return -errno;
+		struct ext_cmd_shm *s = (struct ext_cmd_shm *)p;
+		if (s->magic != EXT_CMD_MAGIC || s->version != EXT_CMD_VERSION || s->size != sizeof(struct ext_cmd_shm))
+		{
+			munmap(p, sizeof(struct ext_cmd_shm));
+			return -EINVAL;
+		}
+		shm = s;
+		heartbeat = s->cmd.heartbeat;
+		return 0;
+	}
+
+	void close()
+	{
+		if (shm)
+			munmap((void *)shm, sizeof(struct ext_cmd_shm));
+		shm = NULL;
+	}
+
+	/// nonzero while r2_control is reading the segment
+	int live() const { return shm && (shm->flags & EXT_CMD_LIVE); }
+
+	/// last heartbeat r2_control used, and its EXT_STATUS_*
+	u_64 consumed() const { return shm ? shm->consumed_heartbeat : 0; }
+	u_32 status() const { return shm ? shm->status : EXT_STATUS_IDLE; }
+
+	/**\fn int write(const struct ext_cmd_data *c)
+	 * \brief publish a command; heartbeat and write_ns are filled in.  Call at least every timeout_ms.
+	 * \return 0, -EBADF if not open
+	 */
+	int write(const struct ext_cmd_data *c)
+	{
+		struct timespec now;
+
+		if (!shm)
+			return -EBADF;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		shm->seq++;                    // odd: r2_control keeps its last copy
+		__sync_synchronize();
+		memcpy((void *)&shm->cmd, c, sizeof(*c));
+		shm->cmd.heartbeat = ++heartbeat;
+		shm->cmd.write_ns = (u_64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+		__sync_synchronize();
+		shm->seq++;
+		return 0;
+	}
+
+private:
+	struct ext_cmd_shm *shm;
+	u_64 heartbeat;
+};
+
+#endif // EXT_CMD_CLIENT_H
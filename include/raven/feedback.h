@@ -0,0 +1,48 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file feedback.h
+ * \brief Slave-to-master feedback stream (v_struct).
+ *
+ * The RT thread drops a small sample into a lock-free ring at the feedback
+ * rate (feedbackCapture(), from publish_ravenstate_ros()).  feedback_process()
+ * drains it on its own thread and sends v_structs to the master, several
+ * per datagram.  Configured at startup:
+ *   /feedback_host               master address ("": feedback off)
+ *   /feedback_port               master UDP port
+ *   /feedback_rate_hz            samples per second sent (<= control rate)
+ *   /feedback_samples_per_packet v_structs per datagram (1-FEEDBACK_MAX_BATCH)
+ *   /feedback_force              send the tool force instead of the position error
+ */
+
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+#define FEEDBACK_MAX_BATCH  8
+#define FEEDBACK_RING_SIZE  256   // samples of backlog
+
+int init_feedback(ros::NodeHandle &n);
+void feedbackCapture(struct robot_device *dev, struct param_pass *currParams);
+void* feedback_process(void*);
+
+#endif // FEEDBACK_H
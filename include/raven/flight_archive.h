@@ -0,0 +1,44 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_archive.h
+ * \brief Compressed long-term archive of the flight recorder.
+ *
+ * flight_archive_process() takes the records from the recorder's ring
+ * (flightRecorderFetch()) on the housekeeping cpu at SCHED_IDLE, and
+ * appends them to archive files in chunks: columns of delta and XOR coded
+ * words, LZ4 compressed, each chunk with its tick range (format in
+ * flight_format.h).  Memory is three chunk-sized buffers, allocated at
+ * startup.  r2_flight_export and the replay backend read archives like
+ * recordings.  Configured at startup:
+ *   /flight_archive_dir       where archive-<date>-<time>.r2fa files go ("": archive off)
+ *   /flight_archive_chunk_ms  records per chunk, in control time
+ *   /flight_archive_file_s    start a new file this often (0: one per run)
+ */
+
+#ifndef FLIGHT_ARCHIVE_H
+#define FLIGHT_ARCHIVE_H
+
+#include <ros/ros.h>
+
+int init_flight_archive(ros::NodeHandle &n);
+void* flight_archive_process(void*);
+
+#endif // FLIGHT_ARCHIVE_H
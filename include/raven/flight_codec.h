@@ -0,0 +1,40 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_codec.h
+ * \brief Chunk coding of the flight archive (layout in flight_format.h).
+ *
+ * No ROS: the archiver and the offline readers share it.
+ */
+
+#ifndef FLIGHT_CODEC_H
+#define FLIGHT_CODEC_H
+
+#include <stddef.h>
+#include "flight_format.h"
+
+void faDefaultCoding(u_08 *coding);
+size_t faPackBound(u_32 records);
+int faPackChunk(const struct fa_header *h, const struct fr_record *recs, u_32 n, unsigned char *planes,
+				unsigned char *out, size_t cap);
+int faUnpackChunk(const struct fa_header *h, const unsigned char *in, size_t len, u_32 n, unsigned char *planes,
+				  struct fr_record *out);
+
+#endif // FLIGHT_CODEC_H
@@ -0,0 +1,153 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_format.h
+ * \brief On-disk layout of the flight recorder file (flight_recorder.cpp).
+ *
+ * The file is a FR_HEADER_SIZE byte header followed by nslots fixed-size
+ * records used as a ring.  header.count is the number of records ever
+ * written; the newest is in slot (count-1) % nslots.  Each record's seq is
+ * written last, as its index + 1, so a reader can tell a complete record from
+ * one being overwritten.  All values are host byte order.
+ *
+ * The archive (flight_archive.cpp) keeps the recording for the long term:
+ * an FA_HEADER_SIZE byte header, then chunks of up to chunk_records
+ * consecutive records, each an fa_chunk followed by its payload.  The
+ * payload is the chunk's records as columns of 32-bit words, each column
+ * coded against the previous record's word as the header's coding[] says,
+ * split into its four byte planes, then compressed as one LZ4 block.  Each
+ * chunk decodes on its own; a reader finds a tick range from the chunk
+ * headers alone.  A chunk cut short by a crash fails its crc and ends the
+ * archive.
+ *
+ * Only depends on DS0.h so that offline tools can use it without ROS.
+ */
+
+#ifndef FLIGHT_FORMAT_H
+#define FLIGHT_FORMAT_H
+
+#include "DS0.h"
+
+#define FR_MAGIC        "R2FLIGHT"
+#define FR_VERSION      2
+#define FR_HEADER_SIZE  4096
+#define FR_SCHEMA_LEN   2048
+#define FR_IN_LEN       27                        // IN_LENGTH (get_USB_packet.h)
+#define FR_OUT_LEN      (3+MAX_DOF_PER_MECH*2)    // OUT_LENGTH (USB_init.h)
+
+struct fr_dof {
+	int   enc_val;
+	float jpos, jpos_d;
+	float mpos, mpos_d;
+	float tau_d;
+	short current_cmd;
+	short state;
+};
+
+// Master input the RT thread took this cycle (see FR_MASTER_FRESH)
+struct fr_master {
+	int   xd[3];          // desired end-point position (microns)
+	float R[3][3];        // desired end-point orientation
+	int   yaw, pitch, roll;
+	int   grasp;
+};
+
+struct fr_mech {
+	int pos[3];
+	int pos_d[3];
+	struct fr_dof dof[MAX_DOF_PER_MECH];
+	unsigned char enc_packet[FR_IN_LEN];          // last ENC packet read from the board
+	unsigned char dac_packet[FR_OUT_LEN];         // DAC packet written this cycle
+	unsigned char pad[2];
+	struct fr_master master;
+};
+
+#define FR_MASTER_FRESH  0x1  // fr_record.flags: updateDeviceState() ran with mech[].master
+
+struct fr_record {
+	u_64 seq;             // record index + 1, written last (0: slot never written)
+	u_64 tick;            // gTime
+	u_64 stamp_ns;        // CLOCK_MONOTONIC at capture
+	u_08 runlevel;
+	u_08 sublevel;
+	u_08 surgeon_mode;
+	u_08 estop;           // soft_estopped
+	int  last_sequence;   // last master packet applied
+	u_32 period_ns;       // cycle_timing: CT_PERIOD
+	u_32 usb_wait_ns;     //               CT_USB_WAIT
+	u_32 control_ns;      //               CT_CONTROL
+	u_32 compute_ns;      //               CT_COMPUTE
+	u_32 flags;           // FR_MASTER_FRESH
+	u_32 reserved;
+	struct fr_mech mech[MAX_MECH_PER_DEV];
+};
+
+struct fr_header {
+	char magic[8];        // FR_MAGIC, not terminated
+	u_32 version;         // FR_VERSION
+	u_32 header_size;     // FR_HEADER_SIZE
+	u_32 record_size;     // sizeof(struct fr_record)
+	u_32 nslots;
+	u_32 num_mech;        // mechanisms in use
+	u_32 mech_per_dev;    // MAX_MECH_PER_DEV
+	u_32 dof_per_mech;    // MAX_DOF_PER_MECH
+	u_32 control_rate_hz;
+	u_32 board_serial[MAX_MECH_PER_DEV];   // USB board of each mechanism
+	u_64 start_realtime_ns;    // CLOCK_REALTIME and CLOCK_MONOTONIC when the
+	u_64 start_monotonic_ns;   // file was created, to put stamp_ns on the wall clock
+	volatile u_64 count;       // records written
+	char schema[FR_SCHEMA_LEN];    // human readable description of fr_record
+};
+
+#define FA_MAGIC        "R2ARCHIV"
+#define FA_VERSION      1
+#define FA_HEADER_SIZE  8192
+#define FA_CHUNK_MAGIC  0x4b4e4843        // "CHNK"
+#define FA_MAX_WORDS    2048              // 32-bit words per record the header can describe
+
+// fa_header.coding[]: how a word is coded against the same word of the previous record
+#define FA_DELTA        0     // difference: counts, positions
+#define FA_DELTA2       1     // difference of differences: ticks, times
+#define FA_XOR          2     // exclusive or: floats, packed bytes
+
+struct fa_header {
+	char magic[8];        // FA_MAGIC, not terminated
+	u_32 version;         // FA_VERSION
+	u_32 header_size;     // FA_HEADER_SIZE
+	u_32 record_size;     // sizeof(struct fr_record)
+	u_32 chunk_records;   // records in a full chunk
+	u_32 words;           // record_size / 4
+	u_32 reserved;
+	struct fr_header recording;    // the recorder's header, count 0
+	u_08 coding[FA_MAX_WORDS];     // FA_DELTA, FA_DELTA2 or FA_XOR for each word
+};
+
+struct fa_chunk {
+	u_32 magic;           // FA_CHUNK_MAGIC
+	u_32 records;
+	u_64 first_tick, last_tick;
+	u_64 first_stamp_ns, last_stamp_ns;
+	u_32 packed_size;     // payload bytes after this header
+	u_32 payload_crc;     // crc32c of the payload
+	u_32 reserved;
+	u_32 header_crc;      // crc32c of this header up to here
+};
+
+#endif // FLIGHT_FORMAT_H
@@ -0,0 +1,86 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_reader.h
+ * \brief Reader for flight recorder files (flight_format.h).
+ *
+ * Maps a recording read-only; works on a file that is still being written.
+ * Records are addressed by their index since the recording started; only the
+ * last nslots of them are still in the file.
+ *
+ * Also reads flight archives (r2fa, flight_archive.h) through the same calls:
+ * every archived record is in the "file", header() is the recorder's with
+ * nslots = count = the records archived, and a read decodes the record's
+ * chunk unless it is the one decoded last.  Chunks past the end of the file
+ * at open() are not seen.
+ */
+
+#ifndef FLIGHT_READER_H
+#define FLIGHT_READER_H
+
+#include <stddef.h>
+#include <vector>
+#include "flight_format.h"
+
+class FlightReader
+{
+public:
+	FlightReader();
+	~FlightReader();
+
+	int open(const char *path);
+	void close();
+
+	const struct fr_header *header() const { return hdr; }
+	u_64 first() const;         // index of the oldest record still in the file
+	u_64 end() const;           // one past the newest
+	int read(u_64 index, struct fr_record *out) const;
+	int findTick(u_64 tick, u_64 *index) const;
+	int isArchive() const { return arch != NULL; }
+	const void *mapping() const { return map; }
+	size_t mappedLength() const { return len; }
+
+private:
+	struct chunk_ref
+	{
+		u_64 first;             // index of its first record
+		u_64 first_tick, last_tick;
+		const struct fa_chunk *chunk;
+	};
+
+	int openArchive();
+	int loadChunk(size_t c) const;
+	size_t findChunk(u_64 index) const;
+
+	void *map;
+	size_t len;
+	const struct fr_header *hdr;
+	const struct fr_record *slots;
+
+	// Archive: the chunks found at open(), and the one decoded last
+	const struct fa_header *arch;
+	struct fr_header arch_hdr;
+	std::vector<struct chunk_ref> chunks;
+	mutable std::vector<struct fr_record> decoded;
+	mutable std::vector<unsigned char> planes;
+	mutable size_t loaded;          // chunk in decoded, chunks.size() if none
+};
+
+#endif // FLIGHT_READER_H
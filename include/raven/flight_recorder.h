@@ -0,0 +1,50 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_recorder.h
+ * \brief Memory-mapped ring file of the full control state, every cycle.
+ *
+ * flightRecorderCapture() copies the cycle's state into the next slot of a
+ * preallocated, locked file mapping (format in flight_format.h).
+ * flight_recorder_process() msyncs the file in the background and starts a
+ * new file when rotation is enabled.  Read the files with flight_reader.h or
+ * r2_flight_export; flightRecorderFetch() hands the records on to the
+ * archive (flight_archive.h).  Configured at startup:
+ *   /flight_recorder_file      file name ("": recorder off)
+ *   /flight_recorder_seconds   length of the ring
+ *   /flight_recorder_rotate_s  start a new file this often (0: never)
+ *   /flight_recorder_keep      older files kept (file.1 ... file.N)
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <ros/ros.h>
+#include "struct.h"
+#include "flight_format.h"
+
+int init_flight_recorder(ros::NodeHandle &n);
+void flightRecorderCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams);
+void fillFlightRecord(struct fr_record *r, struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams);
+void initFlightHeader(struct fr_header *h, u_32 nslots);
+int flightRecorderFetch(u_64 *next_tick, struct fr_record *out, int max);
+void* flight_recorder_process(void*);
+
+#endif // FLIGHT_RECORDER_H
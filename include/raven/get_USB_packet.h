@@ -31,6 +31,7 @@
 //#include <rtai.h>
 
 //Include files
+#include <time.h>
 #include "struct.h" /*Includes DS0, DS1, DOF_type*/
 #include "dof.h"
 #include "USB_init.h"
@@ -38,8 +39,21 @@
 /* USB packet lengths */
 #define IN_LENGTH          27 /* 27 with input pins */
 
+/// When a board's encoder packets arrived, see encPacketInfo()
+struct enc_packet_info
+{
+    long long rx_ns;            // controlClockNs() time of the last packet: the driver's completion time with a mapped ring, else when read
+    unsigned int seq;           // packets received from the board so far
+    unsigned long rx_cycle;     // gTime of the last packet
+};
+
 //Function prototypes
 void initiateUSBGet(struct device *device0);
 int getUSBPackets(struct device *device0);
+int getUSBPacketsWait(struct device *device0, const struct timespec *deadline);
+int getUSBPacketWait(int id, struct mechanism *mech, const struct timespec *deadline);
 int getUSBPacket(int id, struct mechanism *mech);
+const unsigned char *encPacket(int m);
+const struct enc_packet_info *encPacketInfo(int m);
+unsigned long encPacketAge(int m);
 void processEncoderPacket(struct mechanism *mech, unsigned char buffer[]);
@@ -29,6 +29,7 @@
 #define GRAV_COMP_H
 
 #include <math.h>
+#include <ros/ros.h>
 #include <tf/transform_datatypes.h>
 
 #include "struct.h"
@@ -39,5 +40,24 @@
  * Calculate gravity load on joints 1,2,3 on both arms
  */
 void getGravityTorque(struct device &d0, struct param_pass &params);
+void gravityPostCycle(struct device &d0);
+
+/*
+ * How getGravityTorque() gets the torques: the exact model every cycle,
+ * interpolated from a table over shoulder, elbow and insertion, or the
+ * exact model on a helper thread at a lower rate with a first-order hold
+ */
+enum grav_mode { GRAV_EXACT = 0, GRAV_TABLE = 1, GRAV_THREAD = 2 };
+
+int init_grav_comp(ros::NodeHandle &n);
+int initGravityTable();
+int setGravityMode(int mode);
+void* gravity_process(void*);
+
+/*
+ * Map between motor torque and joint torque on joints 1,2,3
+ */
+void getMotorTorqueFromJointTorque(int arm, double in_GZ1, double in_GZ2, double in_GZ3, double &out_MT1, double &out_MT2, double &out_MT3);
+void getJointTorqueFromMotorTorque(int arm, double in_MT1, double in_MT2, double in_MT3, double &out_GZ1, double &out_GZ2, double &out_GZ3);
 
 #endif
@@ -26,6 +26,7 @@
 *      Based on concept by UCSC, I implement a procedure for joint position discovery from relative encoders.
 *
 */
+#include <ros/ros.h>
 #include "DS0.h"
 
 /** prototype for homing()
@@ -35,3 +36,7 @@ void homing(struct DOF*);
 /** prototype for check_homing_condition()
  */
 int check_homing_condition(struct DOF*);
+
+/** prototype for init_homing()
+ */
+int init_homing(ros::NodeHandle &n);
@@ -0,0 +1,120 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file joint_block.h
+ * \brief Structure-of-arrays copy of the joints' control-path state.
+ *
+ * stateEstimate(), mpos_PD_control_all() and TorqueToDAC() gather what they
+ * need from robot_device into jblock, run one vector loop over all
+ * MAX_MECH*MAX_DOF_PER_MECH joints, and scatter the results back.  Lanes are
+ * indexed by joint type, like DOF_types[].  robot_device stays the state the
+ * rest of the code reads and writes; dof[] is each lane's view of it.
+ * Inside a per-arm pipeline job the loops only cover the job's mechanism's
+ * lanes (JB_MECH_LANE(), see arm_pipeline.h).
+ *
+ * Per-type constants the loops need are copied out of DOF_types[] by
+ * jointBlockLoadConstants(), so a change to DOF_types[] gains or motor
+ * constants has to be followed by a call to it.
+ */
+
+#ifndef JOINT_BLOCK_H
+#define JOINT_BLOCK_H
+
+#include "struct.h"
+
+#define JB_N_JOINTS (MAX_MECH * MAX_DOF_PER_MECH)
+
+// Lanes per vector, from the instruction set the tree is built for
+#if defined(__AVX__)
+#define JB_VEC_WIDTH 8
+#elif defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define JB_VEC_WIDTH 4
+#else
+#define JB_VEC_WIDTH 1
+#endif
+#define JB_NV (JB_N_JOINTS / JB_VEC_WIDTH)
+
+// First lane and first vector of mechanism m.  A mechanism's lanes fill whole
+// vectors, so a loop over one mechanism never shares a vector with another.
+#define JB_MECH_LANE(m) ((m) * MAX_DOF_PER_MECH)
+#define JB_MECH_VEC(m)  (JB_MECH_LANE(m) / JB_VEC_WIDTH)
+
+// Highest state filter order, and its history ring (a power of two above it)
+#define LPF_MAX_ORDER 3
+#define JB_LPF_RING   4
+
+typedef float jb_vf __attribute__ ((vector_size (4 * JB_VEC_WIDTH)));
+typedef int   jb_vi __attribute__ ((vector_size (4 * JB_VEC_WIDTH)));   // lane masks, what comparing jb_vf gives
+
+/// one value per joint type; v[] for arithmetic, s[] lane by lane
+union jb_lanes
+{
+	jb_vf v[JB_NV];
+	float s[JB_N_JOINTS];
+};
+
+struct joint_block {
+	// hot state
+	union jb_lanes mpos_raw;      // unfiltered motor angle (rad), from the encoder
+	union jb_lanes mpos, mvel;    // filtered motor angle and velocity
+	union jb_lanes mpos_d, mvel_d;
+	union jb_lanes tau_d;
+	union jb_lanes tau_ff;        // feedforward torque added by jointPIDBatch()
+	union jb_lanes err_int;       // integral of the motor position error
+	union jb_lanes jvel_int;      // integral of the velocity error, jvel_PI_control()
+	union jb_lanes dac;           // tau_d in DAC counts, before truncation
+
+	// position filter history: rings of input and output, slot lpf_pos is the newest
+	union jb_lanes lpf_x[JB_LPF_RING];
+	union jb_lanes lpf_y[JB_LPF_RING];
+	unsigned int lpf_pos;
+	int filter_rdy[JB_N_JOINTS];
+
+	// constants, copied from DOF_types[]
+	union jb_lanes kp, kd, ki;
+	union jb_lanes tf_motor;      // amps per unit torque, 1/tau_per_amp
+	union jb_lanes tf_amp;        // DAC counts per amp
+	union jb_lanes tau_max;       // |torque| that saturates the DAC, 0 if there is no limit
+	int dac_max[JB_N_JOINTS];
+
+	// robot_device view of each lane, NULL if no mechanism has that joint type
+	struct DOF *dof[JB_N_JOINTS];
+};
+
+extern struct joint_block jblock;
+
+void jointBlockBind(struct robot_device *device0);
+void jointBlockLoadConstants();
+
+static inline jb_vf jbSplat(float x)
+{
+	jb_vf r;
+	for (int i=0; i<JB_VEC_WIDTH; i++)
+		r[i] = x;
+	return r;
+}
+
+/// a where mask is set, b elsewhere
+static inline jb_vf jbSelect(jb_vi mask, jb_vf a, jb_vf b)
+{
+	return (jb_vf)(((jb_vi)a & mask) | ((jb_vi)b & ~mask));
+}
+
+#endif // JOINT_BLOCK_H
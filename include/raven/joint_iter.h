@@ -0,0 +1,56 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * joint_iter.h
+ *
+ * Loops over the joints of the mechanisms, in place of the old
+ * loop_over_joints() iterator.  The joints a loop visits are a
+ * compile-time mask, every joint but NO_CONNECTION, so
+ *
+ *   for (int m = mechFirst(); m < mechEnd(); m++)
+ *       for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+ *       {
+ *           if (!jointActive(j))
+ *               continue;
+ *           ...
+ *       }
+ *
+ * has a constant trip count and a skip the compiler folds away: the body
+ * is inlined, and can be unrolled and vectorised.  mechFirst() and
+ * mechEnd() keep a per-arm pipeline job to its own mechanism.
+ */
+
+#ifndef __JOINT_ITER_H__
+#define __JOINT_ITER_H__
+
+#include "DS0.h"
+#include "defines.h"
+#include "arm_pipeline.h"
+
+/// Joints of every mechanism the joint loops visit, bit j for joint j
+#define JOINTS_ACTIVE  (((1u << MAX_DOF_PER_MECH) - 1) & ~(1u << NO_CONNECTION))
+
+/// true if joint j of a mechanism is visited
+static inline int jointActive(int j)
+{
+    return (JOINTS_ACTIVE >> j) & 1;
+}
+
+#endif
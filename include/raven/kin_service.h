@@ -0,0 +1,55 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file kin_service.h
+ * \brief Batch IK / FK for planners, outside the control loop.
+ *
+ * The raven_kin_batch service takes thousands of poses or joint vectors
+ * for one arm and solves them on a small pool of housekeeping threads with
+ * the controller's own kinematics: inv_kin(), check_solutions() against
+ * a seed, apply_joint_limits() and fwd_kin(), with this process's DH
+ * constants and tool limits.  The RT thread is not involved; a request
+ * without seeds takes the arm's joints from the newest published snapshot.
+ * kinBatchIK() / kinBatchFK() are the same solver for callers in this
+ * process.
+ *
+ *   /kin_service_threads  threads solving a batch, the calling one
+ *                         included (default 2, 0: no service)
+ */
+
+#ifndef KIN_SERVICE_H
+#define KIN_SERVICE_H
+
+#include <ros/ros.h>
+#include "r2_kinematics.h"
+
+// Per item result of a batch
+#define KIN_OK           0   /// solved
+#define KIN_LIMITED      1   /// solved, then clipped to the joint limits
+#define KIN_NO_SOLUTION -1   /// no IK solution near the seed
+
+int init_kin_service(ros::NodeHandle &n);
+void kinServiceStop(void);
+
+int kinBatchIK(l_r arm, const btTransform *poses, int count, const double *seeds, int seed_stride,
+			   double *out_joints, btTransform *out_poses, signed char *out_status);
+int kinBatchFK(l_r arm, const double *joints, int count, btTransform *out_poses);
+
+#endif // KIN_SERVICE_H
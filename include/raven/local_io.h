@@ -38,19 +38,46 @@ int initLocalioData(void);
 
 // update controller state w/ toolkit input
 void teleopIntoDS1(struct u_struct*);
+void teleopIntoDS1Batch(struct u_struct*, const struct timespec *rx_stamp, int count);
 
 // fifo handler to recv command data
 int recieveUserspace(void *u,int size);
+int receiveUserspaceBatch(struct u_struct *u, const struct timespec *rx_stamp, int count);
 
 // Check: have any command updates happened?
 int checkLocalUpdates(void);
 
 // Return current parameter-update set
 struct param_pass * getRcvdParams(struct param_pass*);
+unsigned int getRcvdParamsVersion(void);
 
 void updateMasterRelativeOrigin(struct device *device0);
+void reconcileMasterOrigin(void);
+
+// ROS output streams, each with its own rate
+#define PUB_RAVENSTATE  0
+#define PUB_JOINTS      1
+#define PUB_MARKER      2
+#define PUB_STATE_SHM   3   // shared-memory mirror (state_shm.h)
+#define PUB_CONSOLE     4   // console state dump (console_process.cpp)
+#define PUB_NSTREAMS    5
 
 int init_ravenstate_publishing(ros::NodeHandle &n);
+void setPublishRate(int stream, int rate_hz);
+void setPublishOnEvent(int on);
 void publish_ravenstate_ros(struct robot_device*, struct param_pass*);
+void* ros_publish_process(void*);
+int publishReactorAttach(int lane, long long period_ns);
+
+/// The newest snapshot the publisher thread took off the ring
+struct robot_state_view
+{
+    unsigned long cycle;         // gTime at capture
+    u_08 runlevel;
+    u_08 sublevel;
+    struct robot_device dev;
+};
+
+int latestRobotState(struct robot_state_view *view);
 
 #endif
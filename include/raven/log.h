@@ -21,6 +21,17 @@
 #define LOG_H
 
 int log_msg(const char* fmt,...);
+int log_msg_later(const char* fmt,...);
 int err_msg(const char* fmt,...);
 
+// Allocate the log ring (from the RT arena)
+int log_init();
+
+// Logging thread: formats queued messages and forwards them to rosout
+void* log_process(void*);
+
+// Executor mode (executor.h): drained by a reactor timer in place of log_process()
+int logReactorAttach(int lane);
+void logReactorDetach(void);
+
 #endif // LOG_H
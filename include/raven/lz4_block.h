@@ -0,0 +1,42 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * lz4_block.h
+ *
+ * LZ4 block format compression (one block, no frame), so the flight
+ * archive needs no library.  Blocks decode with liblz4's
+ * LZ4_decompress_safe() too.
+ */
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <stddef.h>
+
+/// worst case compressed size of n bytes
+static inline size_t lz4Bound(size_t n)
+{
+	return n + n / 255 + 16;
+}
+
+int lz4Compress(const void *src, size_t len, void *dst, size_t cap);
+int lz4Decompress(const void *src, size_t len, void *dst, size_t cap);
+
+#endif
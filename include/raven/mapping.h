@@ -35,7 +35,7 @@
 #endif*/
 
 #include <math.h>
-#include <tf/transform_datatypes.h>
+#include "rigid_math.h"
 
 #include "struct.h"
 #include "defines.h"
@@ -45,5 +45,17 @@
 #define Y_ROT_GREEN_ARM -1.5707
 #define Y_ROT_GOLD_ARM 1.5707
 
+struct u_struct;
+
+/// Rotation from the ITP master frame into one arm's base frame
+struct itp_map
+{
+    int R[3][3];          // a signed permutation: robot = R * ITP, exact on the integer increments
+    rm_quat q;            // the same rotation
+};
+
 void masterToSlave(struct position*, int);
-void fromITP(struct position*, btQuaternion&, int);
+void fromITP(struct position*, rm_quat&, int);
+const struct itp_map *itpMap(int armserial);
+void itpMapIncrements(const struct itp_map *map, const struct u_struct *us, int count, int arm,
+                      struct position *dpos, rm_quat &drot);
@@ -0,0 +1,137 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file metrics.h
+ * \brief Loop health counters, gauges and histograms, exported as /diagnostics and as text.
+ *
+ * Every metric is a fixed slot, named in metrics.cpp, so updating one from
+ * the RT thread is a single relaxed atomic add or store: no lock, no
+ * allocation, no lookup.  metrics_process() reads them once a second for
+ * a diagnostic_msgs/DiagnosticArray on /diagnostics and answers scrapes of
+ * the Prometheus text format on a TCP port.  Configured at startup:
+ *   /metrics_port           scrape port (0: off)
+ *   /metrics_diag_period_s  /diagnostics period
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+/// Counters: only ever go up
+enum metric_counter {
+	MC_DEADLINE_MISSED = 0,     // control cycles started after their deadline
+	MC_USB_EBUSY_RETRIES,       // 10us retries of the spin-mode USB read
+	MC_USB_WAIT_TIMEOUTS,       // cycles the boards' packets did not arrive in time
+	MC_USB_READ_ERRORS,         // cycles with a failed USB read
+	MC_USB_WRITE_ERRORS,        // failed board writes
+	MC_TELEOP_PACKETS,          // teleop datagrams received
+	MC_TELEOP_LOST,             // teleop samples missing from the sequence numbering
+	MC_TELEOP_REJECTED,         // duplicate or late teleop samples
+	MC_MASTER_TIMEOUTS,         // surgeon disengaged for want of master packets
+	MC_IK_FAILURES,             // cycles with no closed-form IK solution near the joints
+	MC_JOINT_LIMIT_SATURATIONS, // IK solutions clipped to the joint limits
+	MC_CURRENT_CLIPS,           // joint commands clipped to the DAC limit
+	MC_ENC_STALE,               // mechanism-cycles run on an encoder packet from an earlier cycle
+	MC_WAYPOINTS_DROPPED,       // raven_waypoints late, out of order, too far ahead or over the queue
+	MC_EXT_CMD_STALE,           // external commands whose heartbeat stopped in external_control
+	MC_KIN_BATCH_ITEMS,         // poses and joint vectors solved by the batch kinematics service
+	MC_WATCHDOG_TRIPS,          // RT loop stalls stopped by the deadline watchdog
+	MC_PREDICT_CLAMPS,          // master targets whose predicted lead was cut to /teleop_predict_max_*
+	MC_USB_BOARDS_LOST,         // boards given up by the USB health check
+	MC_USB_BOARDS_REOPENED,     // lost boards reopened and back in use
+	MC_ARCHIVE_LOST,            // records overwritten in the recorder's ring before the archive took them
+	MC_USB_WORKER_OVERRUNS,     // parallel USB jobs that missed their cycle deadline
+	MC_NUM_COUNTERS
+};
+
+/// Gauges: the latest value
+enum metric_gauge {
+	MG_RUNLEVEL = 0,
+	MG_MISSED_IN_A_ROW,         // deadlines missed back to back, 0 when on time
+	MG_NUM_GAUGES
+};
+
+/// Histograms: counts in power-of-two buckets, 1 .. 2^(METRIC_HIST_BUCKETS-2), the last unbounded
+enum metric_hist {
+	MH_CYCLE_COMPUTE_US = 0,    // wakeup to end of the control cycle
+	MH_USB_WAIT_US,             // waiting for the boards' packets
+	MH_ENC_INTERVAL_US,         // between a board's encoder packets
+	MH_EXT_CMD_AGE_US,          // external command write to its first use
+	MH_KIN_BATCH_US,            // one batch kinematics request, off the RT thread
+	MH_NET_HANDOFF_US,          // teleop sample kernel receive to its handoff into data1
+	MH_NUM_HISTS
+};
+
+#define METRIC_HIST_BUCKETS 18
+
+struct metric_hist_data {
+	u_64 count;
+	u_64 sum;
+	u_64 bins[METRIC_HIST_BUCKETS];
+};
+
+struct metric_store {
+	u_64 counters[MC_NUM_COUNTERS];
+	double gauges[MG_NUM_GAUGES];
+	struct metric_hist_data hists[MH_NUM_HISTS];
+};
+
+extern struct metric_store metrics;
+
+// Relaxed where the compiler has it; the __sync builtins otherwise
+#ifdef __ATOMIC_RELAXED
+#define METRIC_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#else
+#define METRIC_ADD(p, n) __sync_fetch_and_add((p), (n))
+#endif
+
+static inline void metricAdd(int c, u_64 n)
+{
+	METRIC_ADD(&metrics.counters[c], n);
+}
+
+static inline void metricInc(int c)
+{
+	METRIC_ADD(&metrics.counters[c], 1);
+}
+
+/// Gauges have one writer each; an aligned double store is atomic.
+static inline void metricSet(int g, double v)
+{
+	*(volatile double *)&metrics.gauges[g] = v;
+}
+
+static inline void metricObserve(int h, u_64 v)
+{
+	struct metric_hist_data *d = &metrics.hists[h];
+	int b = (v <= 1) ? 0 : 64 - __builtin_clzll(v - 1);
+	if (b > METRIC_HIST_BUCKETS - 1)
+		b = METRIC_HIST_BUCKETS - 1;
+	METRIC_ADD(&d->bins[b], 1);
+	METRIC_ADD(&d->sum, v);
+	METRIC_ADD(&d->count, 1);
+}
+
+int init_metrics(ros::NodeHandle &n);
+void* metrics_process(void*);
+
+#endif // METRICS_H
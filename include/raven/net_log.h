@@ -0,0 +1,47 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file net_log.h
+ * \brief Buffered background writer for err_network.log.
+ *
+ * net_log() formats a line on the caller (the network thread) and queues it
+ * on a bounded lock-free ring; it never touches the file.  net_log_process()
+ * writes queued lines out from a housekeeping thread and rotates the file.
+ * Lines that find the ring full are dropped and counted.  Configured at
+ * startup:
+ *   /net_log_file       log file name
+ *   /net_log_max_bytes  rotate once the file reaches this size (0: never)
+ *   /net_log_keep       rotated files kept (file.1 ... file.N)
+ */
+
+#ifndef NET_LOG_H
+#define NET_LOG_H
+
+#include <ros/ros.h>
+
+#define NET_LOG_RING_SIZE  256   // lines, power of two
+#define NET_LOG_LINE_LEN   160   // bytes per line, including the newline
+
+int init_net_log(ros::NodeHandle &n);
+int net_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void* net_log_process(void*);
+void outputNetLogStats();
+
+#endif // NET_LOG_H
@@ -6,5 +6,12 @@
  *
  *********************************************/
 
+ #include <ros/ros.h>
+
+ int init_network(ros::NodeHandle &n);
  extern void* network_process(void* );
 
+ // Executor mode (executor.h): receive on a reactor in place of network_process()
+ int networkReactorAttach(int lane);
+ void networkReactorDetach(void);
+
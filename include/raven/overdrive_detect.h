@@ -27,10 +27,14 @@
 #include "defines.h"
 #include "utils.h"
 #include "log.h"
+#include "put_USB_packet.h"
 #include <stdlib.h>
+#include <ros/ros.h>
 
 #define TIME_WINDOW  10000
 #define MAX_OVERDRIVE_TIME 50000
 
 //Function prototypes
 int overdriveDetect(struct device *device0);
+int init_thermal_model(ros::NodeHandle &n);
+float thermalLoad(int type);
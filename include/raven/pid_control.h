@@ -39,8 +39,16 @@
 #define MOTOR_PD_CTRL  2
 #define MOTOR_VEL_CTRL  2
 
+//jointPIDBatch() flags
+#define PID_RESET_I     1
+#define PID_FEEDFORWARD 2
+
+struct joint_block;
+
 //Function Prototypes
 void mpos_PD_control(struct DOF *joint, int reset_I=0);
+void jointPIDBatch(struct joint_block *jb, int flags);
+void mpos_PD_control_all(struct device *device0, int reset_I=0, int add_gravity=0);
 float jvel_PI_control(struct DOF*, int);
 
 #endif // PD_CONTROL_H
@@ -36,4 +36,5 @@
 
 //Function prototypes
 void putUSBPackets(struct device *device0);
-int putUSBPacket(int id, struct mechanism *mech);
+int putUSBPacket(int id, struct mechanism *mech, unsigned char *packet);
+unsigned char *dacPacket(int m);
@@ -8,6 +8,7 @@
 #ifndef R2_KINEMATICS_H_
 #define R2_KINEMATICS_H_
 
+#include <ros/ros.h>
 #include <tf/transform_datatypes.h>
 #include "DS0.h"
 
@@ -46,6 +47,35 @@ const double GM1 = sin(La12), GM2 = cos(La12), GM3 = sin(La23), GM4 = cos(La23);
 
 
 
+int init_kinematics(ros::NodeHandle &n);
+
+/** kin_precision
+ *   Arithmetic of fwd_kin() and inv_kin_simd().  init_kinematics() picks it
+ *   from /kin_precision after validateKinPrecision(); KIN_DOUBLE until then.
+ */
+enum kin_precision {
+	KIN_DOUBLE = 0,
+	KIN_FLOAT  = 1,
+};
+
+/** kin_precision_report
+ *   Worst case of the float kernels against the double ones over the joint
+ *   limits, from validateKinPrecision().
+ */
+struct kin_precision_report
+{
+	int samples;            // joint positions x arms
+	int ik_mismatch;        // float IK failed or chose another branch where double did not
+	double fk_pos_err;      // m,   float fwd_kin() vs double
+	double fk_rot_err;      // rad, likewise
+	double ik_pos_err;      // m,   (double) FK of the float IK solution vs of the double one
+	double ik_rot_err;      // rad, likewise
+};
+
+int validateKinPrecision(int grid, kin_precision_report &out);
+kin_precision kinPrecision();
+const char *kinPrecisionName(kin_precision prec);
+
 void print_btTransform(btTransform);
 void print_btVector(btVector3 vv);
 btTransform getFKTransform(int a, int b);
@@ -53,6 +83,50 @@ btTransform getFKTransform(int a, int b);
 
 void showInverseKinematicsSolutions(struct device *d0, int runlevel);
 
+/** fk_frames
+ *   Every frame of one FK pass.  link[i] is ^{i}_{i+1}T, base[i] is ^0_iT
+ *   in the tilted base frame (base[0] is the 25 degree tilt, base[6] is the
+ *   tool frame fwd_kin() returns).
+ */
+struct fk_frames
+{
+	l_r arm;
+	double thetas[6];       // DH thetas (d3 in element 2) the frames were built from
+	btTransform link[6];
+	btTransform base[7];
+};
+
+void computeFKFrames(const double in_thetas[6], l_r in_arm, fk_frames &out);
+
+/** kin_context
+ *   Kinematic state of one arm for the current joint positions, shared by
+ *   r2_fwd_kin(), r2_inv_kin() and gravity compensation.  getKinContext()
+ *   refreshes the joints and thetas; the other parts are computed on first
+ *   use and flagged in valid until the joints change.
+ */
+#define KC_THETAS    0x01    // joints[], thetas[]
+#define KC_TRIG      0x02    // cth[], sth[]
+#define KC_FRAMES    0x04    // fk
+#define KC_JACOBIAN  0x08    // J
+
+struct kin_context
+{
+	unsigned int valid;
+	l_r arm;
+	double joints[6];       // jpos of shoulder, elbow, insertion, roll, wrist, and the grasp half-difference
+	double thetas[6];       // the same in the DH convention, d3 in element 2
+	double cth[6], sth[6];  // cos/sin of each link's theta
+	fk_frames fk;
+	double J[6][6];         // tool velocity (m/s, rad/s) per DH variable rate, see kinJacobian()
+};
+
+struct kin_context* getKinContext(struct mechanism &in_mch);
+const fk_frames& kinFrames(struct kin_context *kc);
+const double (*kinJacobian(struct kin_context *kc))[6];
+void kinJacobianTranspose(struct kin_context *kc, const double in_w[6], double out_tau[6]);
+int kinDampedInverse(struct kin_context *kc, const double in_dx[6], double lambda, double out_dq[6]);
+int kinWrenchFromTorque(struct kin_context *kc, const double in_tau[6], double lambda, double out_w[6]);
+
 int r2_fwd_kin(struct device *d0, int runlevel);
 int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA, int frameB);
 
@@ -63,7 +137,7 @@ int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA,
  *   Outputs: cartesian transform as 4x4 transformation matrix ( bullit transform.  WHAT'S THE SYNTAX FOR THAT???)
  *   Return: 0 on success, -1 on failure
  */
-int __attribute__((optimize("0"))) fwd_kin( double in_j[6], l_r in_armtype, btTransform &out_xform);
+int fwd_kin( double in_j[6], l_r in_armtype, btTransform &out_xform);
 
 
 
@@ -78,6 +152,15 @@ int r2_inv_kin(struct device *d0, int runlevel);
  *   Return: 0 on success, -1 on failure
  */
 int inv_kin (btTransform in_xf, l_r in_arm, ik_solution iksol[8]);
+int inv_kin_reference(btTransform in_xf, l_r in_arm, ik_solution iksol[8]);
+int inv_kin_branch(btTransform in_xf, l_r in_arm, int branch, ik_solution &sol);
+int inv_kin_simd(btTransform in_xf, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err);
+int inv_kin_simd_prec(kin_precision prec, btTransform in_xf, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err);
+const char *invKinSIMDName();
+int diff_inv_kin(struct kin_context *kc, btTransform in_xf, double lambda, ik_solution &out_sol);
+int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx, double &out_err);
+extern __thread int ik_quiet;   // nonzero: check_solutions() does not report failures on this thread
+int apply_joint_limits(double *Js, double *Js_sat);
 
 
 
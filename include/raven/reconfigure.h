@@ -32,4 +32,5 @@ struct offsets{
 };
 
 void reconfigure_callback(raven_2::MyStuffConfig &config, uint32_t level);
+void getVisualOffsets(struct offsets *l, struct offsets *r);
  
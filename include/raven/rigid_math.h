@@ -0,0 +1,387 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * rigid_math.h
+ *
+ * Fixed-size vectors, rotations, rigid transforms and quaternions for the
+ * control path, header only.  A 3-vector is four doubles (x, y, z, 0)
+ * held as two 2-lane vectors, one SSE2 / NEON register each; AVX builds
+ * may fuse the halves.  Matrices are stored by column, so R v is three
+ * multiply-adds and R A is three of those.
+ *
+ * The types ask for 16-byte alignment only, so they are safe in memory
+ * from new and malloc.  Being a struct of two 16-byte halves rather than
+ * one 32-byte vector, rm_vec4 is passed and returned in memory whatever
+ * the ISA, so r2_kinematics.cpp built for AVX and the rest built without
+ * agree on the calling convention.
+ *
+ * Bullet / tf types are for the ROS boundary: rmFromBt(), btFromRm() and
+ * btQuatFromRm() convert there.  rm_quat is the same vector type as
+ * rm_vec3, so the rm* quaternion functions carry Quat in their names.
+ */
+
+#ifndef __RIGID_MATH_H__
+#define __RIGID_MATH_H__
+
+#include <math.h>
+#include <tf/transform_datatypes.h>
+
+typedef double rm_lanes __attribute__ ((vector_size (16)));   // two doubles, one SSE2 / NEON register
+
+/// four doubles, element i of lo then hi
+struct rm_vec4
+{
+    rm_lanes lo, hi;
+
+    double operator[](int i) const { return ((const double *)this)[i]; }
+    double &operator[](int i) { return ((double *)this)[i]; }
+};
+
+typedef rm_vec4 rm_vec3;   // x, y, z, 0
+typedef rm_vec4 rm_quat;   // x, y, z, w
+
+static inline rm_vec4 operator+(const rm_vec4 &a, const rm_vec4 &b)
+{
+    rm_vec4 r;
+    r.lo = a.lo + b.lo;
+    r.hi = a.hi + b.hi;
+    return r;
+}
+
+static inline rm_vec4 operator-(const rm_vec4 &a, const rm_vec4 &b)
+{
+    rm_vec4 r;
+    r.lo = a.lo - b.lo;
+    r.hi = a.hi - b.hi;
+    return r;
+}
+
+/// element by element
+static inline rm_vec4 operator*(const rm_vec4 &a, const rm_vec4 &b)
+{
+    rm_vec4 r;
+    r.lo = a.lo * b.lo;
+    r.hi = a.hi * b.hi;
+    return r;
+}
+
+/// rotation, columns c[0..2]: element (i, j) is c[j][i]
+struct rm_mat3
+{
+    rm_vec3 c[3];
+};
+
+/// rigid transform: x -> R x + p
+struct rm_xform
+{
+    rm_mat3 R;
+    rm_vec3 p;
+};
+
+//--------------------------------------------------------------------------------
+//  Vectors
+//--------------------------------------------------------------------------------
+
+static inline rm_vec3 rmVec(double x, double y, double z)
+{
+    rm_vec3 v = { { x, y }, { z, 0 } };
+    return v;
+}
+
+static inline rm_vec3 rmSplat(double s)
+{
+    rm_vec3 v = { { s, s }, { s, s } };
+    return v;
+}
+
+static inline double rmDot(const rm_vec3 &a, const rm_vec3 &b)
+{
+    rm_vec3 m = a * b;
+    return m[0] + m[1] + m[2];
+}
+
+static inline rm_vec3 rmCross(const rm_vec3 &a, const rm_vec3 &b)
+{
+    return rmVec(a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0]);
+}
+
+static inline double rmNorm(const rm_vec3 &a)
+{
+    return sqrt(rmDot(a, a));
+}
+
+//--------------------------------------------------------------------------------
+//  Rotations
+//--------------------------------------------------------------------------------
+
+/**\fn static inline rm_mat3 rmMat(...)
+ * \brief a matrix from its elements, row by row
+ */
+static inline rm_mat3 rmMat(double r00, double r01, double r02,
+                            double r10, double r11, double r12,
+                            double r20, double r21, double r22)
+{
+    rm_mat3 m;
+    m.c[0] = rmVec(r00, r10, r20);
+    m.c[1] = rmVec(r01, r11, r21);
+    m.c[2] = rmVec(r02, r12, r22);
+    return m;
+}
+
+static inline rm_mat3 rmIdentity()
+{
+    return rmMat(1, 0, 0,  0, 1, 0,  0, 0, 1);
+}
+
+/// rotation by a about z
+static inline rm_mat3 rmRotZ(double a)
+{
+    double c = cos(a), s = sin(a);
+    return rmMat(c, -s, 0,  s, c, 0,  0, 0, 1);
+}
+
+/// R v
+static inline rm_vec3 rmMul(const rm_mat3 &R, const rm_vec3 &v)
+{
+    return R.c[0] * rmSplat(v[0]) + R.c[1] * rmSplat(v[1]) + R.c[2] * rmSplat(v[2]);
+}
+
+/// R^T v, v in a rotation's own frame
+static inline rm_vec3 rmMulT(const rm_mat3 &R, const rm_vec3 &v)
+{
+    return rmVec(rmDot(R.c[0], v), rmDot(R.c[1], v), rmDot(R.c[2], v));
+}
+
+/// A B
+static inline rm_mat3 rmMul(const rm_mat3 &A, const rm_mat3 &B)
+{
+    rm_mat3 m;
+    for (int j = 0; j < 3; j++)
+        m.c[j] = rmMul(A, B.c[j]);
+    return m;
+}
+
+static inline rm_mat3 rmTranspose(const rm_mat3 &A)
+{
+    return rmMat(A.c[0][0], A.c[0][1], A.c[0][2],
+                 A.c[1][0], A.c[1][1], A.c[1][2],
+                 A.c[2][0], A.c[2][1], A.c[2][2]);
+}
+
+/// A^T B, one rotation expressed in the other's frame
+static inline rm_mat3 rmMulT(const rm_mat3 &A, const rm_mat3 &B)
+{
+    rm_mat3 m;
+    for (int j = 0; j < 3; j++)
+        m.c[j] = rmMulT(A, B.c[j]);
+    return m;
+}
+
+/**\fn static inline rm_mat3 rmAxisAngle(const rm_vec3 &n, double phi)
+ * \brief rotation by phi about n, which need not be unit length
+ */
+static inline rm_mat3 rmAxisAngle(const rm_vec3 &n, double phi)
+{
+    rm_vec3 u = n * rmSplat(1 / rmNorm(n));
+    double c = cos(phi), s = sin(phi), t = 1 - c;
+    double x = u[0], y = u[1], z = u[2];
+    return rmMat(t*x*x + c,    t*x*y - s*z,  t*x*z + s*y,
+                 t*x*y + s*z,  t*y*y + c,    t*y*z - s*x,
+                 t*x*z - s*y,  t*y*z + s*x,  t*z*z + c);
+}
+
+/// element (i, j) of the matrices kept as float R[3][3] in DS0 / DS1
+template <typename T>
+static inline rm_mat3 rmFromRows(const T R[3][3])
+{
+    return rmMat(R[0][0], R[0][1], R[0][2],  R[1][0], R[1][1], R[1][2],  R[2][0], R[2][1], R[2][2]);
+}
+
+template <typename T>
+static inline void rmToRows(const rm_mat3 &m, T R[3][3])
+{
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            R[i][j] = (T)m.c[j][i];
+}
+
+//--------------------------------------------------------------------------------
+//  Rigid transforms
+//--------------------------------------------------------------------------------
+
+static inline rm_xform rmXform(const rm_mat3 &R, const rm_vec3 &p)
+{
+    rm_xform x;
+    x.R = R;
+    x.p = p;
+    return x;
+}
+
+/// A B
+static inline rm_xform rmMul(const rm_xform &A, const rm_xform &B)
+{
+    return rmXform(rmMul(A.R, B.R), rmMul(A.R, B.p) + A.p);
+}
+
+/// T x
+static inline rm_vec3 rmApply(const rm_xform &T, const rm_vec3 &x)
+{
+    return rmMul(T.R, x) + T.p;
+}
+
+/// T^-1, for orthonormal R
+static inline rm_xform rmInverse(const rm_xform &T)
+{
+    return rmXform(rmTranspose(T.R), rmSplat(0) - rmMulT(T.R, T.p));
+}
+
+/// A^-1 B, without forming the inverse
+static inline rm_xform rmMulInv(const rm_xform &A, const rm_xform &B)
+{
+    return rmXform(rmMulT(A.R, B.R), rmMulT(A.R, B.p - A.p));
+}
+
+//--------------------------------------------------------------------------------
+//  Quaternions
+//--------------------------------------------------------------------------------
+
+static inline rm_quat rmQuat(double x, double y, double z, double w)
+{
+    rm_quat q = { { x, y }, { z, w } };
+    return q;
+}
+
+static inline rm_quat rmQuatIdentity()
+{
+    return rmQuat(0, 0, 0, 1);
+}
+
+/// a b: b first, then a
+static inline rm_quat rmQuatMul(const rm_quat &a, const rm_quat &b)
+{
+    return rmQuat(a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1],
+                  a[3]*b[1] + a[1]*b[3] + a[2]*b[0] - a[0]*b[2],
+                  a[3]*b[2] + a[2]*b[3] + a[0]*b[1] - a[1]*b[0],
+                  a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2]);
+}
+
+static inline rm_quat rmQuatConj(const rm_quat &q)
+{
+    return rmQuat(-q[0], -q[1], -q[2], q[3]);
+}
+
+static inline double rmQuatNorm2(const rm_quat &q)
+{
+    rm_quat m = q * q;
+    return m[0] + m[1] + m[2] + m[3];
+}
+
+/**\fn static inline rm_mat3 rmQuatToMat(const rm_quat &q)
+ * \brief rotation of q, which need not be normalised (as btMatrix3x3::setRotation())
+ */
+static inline rm_mat3 rmQuatToMat(const rm_quat &q)
+{
+    double s = 2.0 / rmQuatNorm2(q);
+    double xs = q[0] * s,   ys = q[1] * s,   zs = q[2] * s;
+    double wx = q[3] * xs,  wy = q[3] * ys,  wz = q[3] * zs;
+    double xx = q[0] * xs,  xy = q[0] * ys,  xz = q[0] * zs;
+    double yy = q[1] * ys,  yz = q[1] * zs,  zz = q[2] * zs;
+
+    return rmMat(1.0 - (yy + zz),  xy - wz,          xz + wy,
+                 xy + wz,          1.0 - (xx + zz),  yz - wx,
+                 xz - wy,          yz + wx,          1.0 - (xx + yy));
+}
+
+/**\fn static inline rm_quat rmQuatFromMat(const rm_mat3 &m)
+ * \brief unit quaternion of a rotation, largest term first (as btMatrix3x3::getRotation())
+ */
+static inline rm_quat rmQuatFromMat(const rm_mat3 &m)
+{
+#define RM_AT(i, j) m.c[j][i]
+    double t = RM_AT(0,0) + RM_AT(1,1) + RM_AT(2,2);
+    rm_quat q;
+    if (t > 0)
+    {
+        double s = sqrt(t + 1.0);
+        double r = 0.5 / s;
+        q = rmQuat((RM_AT(2,1) - RM_AT(1,2)) * r, (RM_AT(0,2) - RM_AT(2,0)) * r, (RM_AT(1,0) - RM_AT(0,1)) * r, 0.5 * s);
+    }
+    else
+    {
+        int i = RM_AT(0,0) < RM_AT(1,1) ? (RM_AT(1,1) < RM_AT(2,2) ? 2 : 1) : (RM_AT(0,0) < RM_AT(2,2) ? 2 : 0);
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        double s = sqrt(RM_AT(i,i) - RM_AT(j,j) - RM_AT(k,k) + 1.0);
+        double r = 0.5 / s;
+        q[i] = 0.5 * s;
+        q[j] = (RM_AT(j,i) + RM_AT(i,j)) * r;
+        q[k] = (RM_AT(k,i) + RM_AT(i,k)) * r;
+        q[3] = (RM_AT(k,j) - RM_AT(j,k)) * r;
+    }
+#undef RM_AT
+    return q;
+}
+
+//--------------------------------------------------------------------------------
+//  Bullet / tf, at the ROS boundary
+//--------------------------------------------------------------------------------
+
+static inline rm_vec3 rmFromBt(const btVector3 &v)
+{
+    return rmVec(v[0], v[1], v[2]);
+}
+
+static inline rm_mat3 rmFromBt(const btMatrix3x3 &m)
+{
+    return rmMat(m[0][0], m[0][1], m[0][2],  m[1][0], m[1][1], m[1][2],  m[2][0], m[2][1], m[2][2]);
+}
+
+static inline rm_xform rmFromBt(const btTransform &x)
+{
+    return rmXform(rmFromBt(x.getBasis()), rmFromBt(x.getOrigin()));
+}
+
+static inline rm_quat rmFromBt(const btQuaternion &q)
+{
+    return rmQuat(q.x(), q.y(), q.z(), q.w());
+}
+
+static inline btVector3 btFromRm(const rm_vec3 &v)
+{
+    return btVector3(v[0], v[1], v[2]);
+}
+
+static inline btMatrix3x3 btFromRm(const rm_mat3 &m)
+{
+    return btMatrix3x3(m.c[0][0], m.c[1][0], m.c[2][0],
+                       m.c[0][1], m.c[1][1], m.c[2][1],
+                       m.c[0][2], m.c[1][2], m.c[2][2]);
+}
+
+static inline btTransform btFromRm(const rm_xform &x)
+{
+    return btTransform(btFromRm(x.R), btFromRm(x.p));
+}
+
+static inline btQuaternion btQuatFromRm(const rm_quat &q)
+{
+    return btQuaternion(q[0], q[1], q[2], q[3]);
+}
+
+#endif
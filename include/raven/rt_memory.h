@@ -0,0 +1,49 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file rt_memory.h
+ * \brief Locked, prefaulted memory for the RT path.
+ *
+ * Everything the control loop touches either lives in the RT arena (a small
+ * bump allocator over one locked, prefaulted block) or is a static that gets
+ * prefaulted with rt_prefault() at startup.  A modest heap reserve is still
+ * prefaulted for library code that mallocs, instead of the old 200 MB pool.
+ */
+
+#ifndef RT_MEMORY_H
+#define RT_MEMORY_H
+
+#include <stddef.h>
+
+#define RT_ARENA_SIZE      (1*1024*1024)    // 1 MB   preallocated RT objects
+#define RT_HEAP_RESERVE    (16*1024*1024)   // 16 MB  prefaulted malloc reserve
+#define RT_STACK_SIZE      (512*1024)       // 512 KB RT thread stack
+#define RT_STACK_PREFAULT  (256*1024)       // 256 KB of it touched at thread start
+
+int rt_arena_init(size_t size);
+void* rt_arena_alloc(size_t size, size_t align=64);
+size_t rt_arena_used();
+
+void rt_prefault(void *mem, size_t size);
+void rt_prefault_stack();
+int initialize_rt_memory_pool();
+void rt_memory_report(const char *when);
+
+#endif // RT_MEMORY_H
@@ -32,3 +32,5 @@
 /** prototype for controlRaven()
  */
 int controlRaven(struct robot_device*, struct param_pass*);
+/// registers the built-in control modes, see controller.h
+int registerBuiltinControllers(void);
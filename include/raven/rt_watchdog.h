@@ -0,0 +1,57 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file rt_watchdog.h
+ * \brief Deadline watchdog for rt_process().
+ *
+ * The RT thread bumps a heartbeat at the end of every control cycle, one
+ * store.  rt_watchdog_process(), at SCHED_FIFO 99 on a housekeeping core,
+ * wakes every control period on an absolute hrtimer deadline and checks
+ * that the heartbeat moved.  After /rt_watchdog_cycles periods without a
+ * beat (a hung USB call, a runaway EBUSY loop) it writes zero DAC packets
+ * to the boards itself, sets soft_estopped and has the black box dumped as
+ * it stands; it trips again only after the loop has come back.
+ *
+ *   /rt_watchdog_cycles   missed periods before the safe-stop (default 5, 0: off)
+ */
+
+#ifndef RT_WATCHDOG_H
+#define RT_WATCHDOG_H
+
+#include <ros/ros.h>
+
+extern volatile unsigned long rt_heartbeat;   // control cycles completed, 0: loop not running
+
+int init_rt_watchdog(ros::NodeHandle &n);
+void* rt_watchdog_process(void*);
+
+/// end of a control cycle.  RT thread only.
+static inline void rtWatchdogBeat()
+{
+	rt_heartbeat = rt_heartbeat + 1;
+}
+
+/// the control loop has left: the silence that follows is not a stall
+static inline void rtWatchdogIdle()
+{
+	rt_heartbeat = 0;
+}
+
+#endif // RT_WATCHDOG_H
@@ -0,0 +1,58 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file setpoint_interp.h
+ * \brief Upsampling of master setpoints to the servo rate.
+ *
+ * Each master update becomes a target that pos_d / ori_d move to over the
+ * interpolation horizon: linear in position and grasp, slerp in orientation.
+ * Configured at startup:
+ *   /setpoint_interp_ms  horizon in ms (0: off, setpoints jump as before;
+ *                        -1: track the measured master update interval)
+ *   /teleop_predict_ms   latency compensation: delay the setpoint leads by, in ms
+ *                        (0: off; -1: the measured delay plus /teleop_predict_link_ms)
+ *   /teleop_predict_gain, /teleop_predict_max_um, /teleop_predict_max_deg,
+ *   /teleop_predict_fade_ms  velocity smoothing, lead bounds, fade-out when
+ *                        the master's targets stop
+ *
+ * Used by the RT thread only.
+ */
+
+#ifndef SETPOINT_INTERP_H
+#define SETPOINT_INTERP_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+#define SI_OFF   0
+#define SI_AUTO  -1
+#define SI_AUTO_MAX_MS  20    // longest horizon used by SI_AUTO
+
+#define SP_OFF       0
+#define SP_MEASURED  -1
+#define SP_MAX_MS    250       // longest delay the lead makes up
+
+int init_setpoint_interp(ros::NodeHandle &n);
+void setpointInterpTarget(struct device *device0, int m, const struct position *xd, const float R[3][3], int grasp);
+void setpointInterpWaypoint(struct device *device0, int m, const struct position *xd, const double q[4], int grasp, unsigned long ticks);
+int setpointInterpBusy(int m);
+void setpointInterpStep(struct device *device0, int runlevel);
+
+#endif // SETPOINT_INTERP_H
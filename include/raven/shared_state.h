@@ -0,0 +1,105 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * shared_state.h
+ *
+ * Flags the control loop shares with the network, console, ROS and
+ * housekeeping threads.  Each field of r2_shared has a cache line of its
+ * own and one kind of writer, so a store from another thread never
+ * invalidates a line the RT thread is reading for something else.  Stores
+ * go through the functions below, which are full barriers: whatever the
+ * writer stored before is visible to a thread that sees the flag.
+ *
+ * Handoffs owned by one subsystem keep their lines in their own file:
+ * data1's triple buffer (local_io.cpp), the visualisation offsets
+ * (reconfigure.cpp).  gTime is written by the RT thread only.
+ */
+
+#ifndef __SHARED_STATE_H__
+#define __SHARED_STATE_H__
+
+#define CACHE_LINE 64
+
+/// Console commands for the RT thread: a seqlock, the console thread is the only writer
+struct console_request
+{
+    volatile unsigned int seq;      // odd while the console writes
+    unsigned int mode_count;        // control mode requests so far
+    int control_mode;               // t_controlmode
+    unsigned int torque_count;      // DOF torque commands so far
+    unsigned int torque_mech;
+    unsigned int torque_dof;
+    int torque;                     // mNm
+};
+
+struct shared_state
+{
+    volatile int soft_estopped __attribute__((aligned(CACHE_LINE)));      // any thread sets, the RT thread's state machine clears
+    volatile int r2_kill __attribute__((aligned(CACHE_LINE)));            // set once, to stop every loop
+    volatile unsigned int param_updates __attribute__((aligned(CACHE_LINE)));  // DS1 producers add, the RT thread reads
+    struct console_request console __attribute__((aligned(CACHE_LINE)));  // console thread
+};
+
+extern struct shared_state r2_shared;   // globals.cpp
+
+/// true while a software e-stop is wanted
+static inline int softEstopped()
+{
+    return r2_shared.soft_estopped;
+}
+
+/// ask for a software e-stop: the watchdog stops and the PLC drops to E-STOP
+static inline void softEstop()
+{
+    __sync_fetch_and_or(&r2_shared.soft_estopped, 1);
+}
+
+/// withdraw the software e-stop request
+/// \return true if one was set
+static inline int softEstopClear()
+{
+    return __sync_fetch_and_and(&r2_shared.soft_estopped, 0) != 0;
+}
+
+/// true once shutdown started
+static inline int r2Killed()
+{
+    return r2_shared.r2_kill;
+}
+
+/// stop every loop.  Async signal safe.
+static inline void r2Kill()
+{
+    __sync_fetch_and_or(&r2_shared.r2_kill, 1);
+}
+
+/// count an update from the master, the toolkit or the console
+static inline void noteParamUpdate()
+{
+    __sync_fetch_and_add(&r2_shared.param_updates, 1);
+}
+
+/// updates counted so far, see checkLocalUpdates()
+static inline unsigned int paramUpdates()
+{
+    return r2_shared.param_updates;
+}
+
+#endif
@@ -0,0 +1,116 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file spsc_ring.h
+ * \brief Lock-free single-producer / single-consumer ring buffer.
+ *
+ * Storage is a fixed array inside the object, so nothing is allocated after
+ * construction.  One thread may push() (or reserve() and commit()) and one
+ * other thread may pop(); neither side ever blocks.  Full and empty are detected with free-running counters,
+ * so N must be a power of two.
+ *
+ * Uses the gcc __sync builtins for the memory barriers.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <string.h>
+
+template <class T, unsigned int N>
+class spsc_ring
+{
+public:
+	spsc_ring() : head(0), tail(0), dropped(0) {}
+
+	/**
+	 * Copy an item into the ring.  Producer side only.
+	 * \return 1 on success, 0 if the ring is full (the item is dropped)
+	 */
+	int push(const T &item)
+	{
+		unsigned int h = head;
+		if (h - tail >= N)
+		{
+			dropped++;
+			return 0;
+		}
+		memcpy(&buf[h & (N-1)], &item, sizeof(T));
+		__sync_synchronize();    // item visible before the new head
+		head = h + 1;
+		return 1;
+	}
+
+	/**
+	 * The next free slot, to be filled in place and then commit()ted.
+	 * Producer side only; until commit() the consumer does not see it.
+	 * \return the slot, or NULL if the ring is full (counted as a drop)
+	 */
+	T *reserve()
+	{
+		unsigned int h = head;
+		if (h - tail >= N)
+		{
+			dropped++;
+			return NULL;
+		}
+		return &buf[h & (N-1)];
+	}
+
+	/// Publish the slot returned by the last reserve().  Producer side only.
+	void commit()
+	{
+		__sync_synchronize();    // item visible before the new head
+		head = head + 1;
+	}
+
+	/**
+	 * Copy the oldest item out of the ring.  Consumer side only.
+	 * \return 1 if an item was read, 0 if the ring is empty
+	 */
+	int pop(T &item)
+	{
+		unsigned int t = tail;
+		if (t == head)
+			return 0;
+		__sync_synchronize();    // read head before the item
+		memcpy(&item, &buf[t & (N-1)], sizeof(T));
+		__sync_synchronize();    // item read before the slot is released
+		tail = t + 1;
+		return 1;
+	}
+
+	/// Number of items waiting.  Approximate when called from a third thread.
+	unsigned int size() const { return head - tail; }
+
+	/// Number of pushes rejected because the ring was full.
+	unsigned int droppedCount() const { return dropped; }
+
+private:
+	// N a power of two
+	typedef char n_is_power_of_two[(N != 0 && (N & (N-1)) == 0) ? 1 : -1];
+
+	T buf[N];
+	volatile unsigned int head;    // written by producer
+	volatile unsigned int tail;    // written by consumer
+	volatile unsigned int dropped; // written by producer
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,41 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file startup_profile.h
+ * \brief Timed startup phases, reported once the control loop is ready.
+ *
+ * startupProfileStart() marks launch.  Each step between launch and "Ready
+ * to teleoperate" is bracketed by startupPhaseBegin() / startupPhaseEnd(),
+ * from any thread, so steps that overlap show as overlapping.
+ * startupProfileReport() logs every phase's start and length and the total.
+ * Not for the control loop: phases take a mutex.
+ */
+
+#ifndef STARTUP_PROFILE_H
+#define STARTUP_PROFILE_H
+
+#define STARTUP_MAX_PHASES 32
+
+void startupProfileStart(void);
+int startupPhaseBegin(const char *name);
+void startupPhaseEnd(int phase);
+void startupProfileReport(void);
+
+#endif // STARTUP_PROFILE_H
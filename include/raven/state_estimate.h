@@ -30,8 +30,28 @@
 #include "struct.h"
 #include "defines.h"
 #include "dof.h"
+#include <ros/ros.h>
 
+// Position filter designs
+enum lpf_design { LPF_BUTTERWORTH = 0, LPF_BESSEL = 1 };
+
+// Joint classes with a filter setting each: shoulder, elbow, insertion / the tool joints
+#define LPF_CLASS_ARM  0
+#define LPF_CLASS_TOOL 1
+
+struct lpf_setting {
+    int   design;       // lpf_design
+    float cutoff_hz;    // -3 dB point
+    int   order;        // 1 to LPF_MAX_ORDER
+};
+
+void designStateLPF(float rate_hz);
+int  setStateLPF(int type, int design, float cutoff_hz, int order);
+int  setStateLPFClass(int joint_class, int design, float cutoff_hz, int order);
+int  lpfDesignByName(const std::string &name);
+int  init_state_lpf(ros::NodeHandle &n);
 void stateEstimate(struct robot_device *device0);
 void getStateLPF(struct DOF* joint);
 void resetFilter(struct DOF* _joint);
+void resetStateFromEncoder(struct DOF *joint);
 
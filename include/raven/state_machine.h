@@ -34,4 +34,4 @@
 #include "update_atmel_io.h"
 
 //Function prototypes
-void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams);
+void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams, int missedDeadlines=0);
@@ -0,0 +1,45 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file state_shm.h
+ * \brief Shared-memory mirror of the robot state for co-located readers.
+ *
+ * The ROS publisher thread copies each snapshot it takes off the publish
+ * ring into a seqlock-protected POSIX shared-memory segment, so local
+ * processes get the state without ROS serialisation.  The RT thread is not
+ * involved.  Readers use state_shm_client.h.  Configured at startup:
+ *   /state_shm          segment name ("": mirror off)
+ *   /state_shm_rate_hz  snapshots per second (at most the control rate)
+ */
+
+#ifndef STATE_SHM_H
+#define STATE_SHM_H
+
+#include <time.h>
+#include <ros/ros.h>
+#include "DS0.h"
+
+int init_state_shm(ros::NodeHandle &n);
+int stateShmActive();
+void stateShmWrite(struct robot_device *dev, const struct timespec *stamp, unsigned long cycle,
+				   int runlevel, int sublevel, int last_sequence);
+void stateShmClose();
+
+#endif // STATE_SHM_H
@@ -0,0 +1,164 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file state_shm_client.h
+ * \brief Header-only reader for the shared-memory robot state (state_shm.cpp).
+ *
+ * r2_control mirrors the robot_device of every published cycle into a POSIX
+ * shared-memory segment (/state_shm, default "/r2_state").  The mirror is a
+ * seqlock: seq is odd while the publisher thread writes, and a read is good
+ * only if seq was even and unchanged across the copy.  Readers never block
+ * the writer, and the RT thread never sees them.
+ *
+ *   StateShmReader r;
+ *   struct state_shm_snapshot s;
+ *   if (r.open() == 0 && r.read(&s) == 0)
+ *       use(s.dev.mech[0].pos);
+ *
+ * Only depends on DS0.h, so that other processes can use it without ROS.
+ * Link with -lrt on older glibc.
+ */
+
+#ifndef STATE_SHM_CLIENT_H
+#define STATE_SHM_CLIENT_H
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "DS0.h"
+
+#define STATE_SHM_NAME     "/r2_state"
+#define STATE_SHM_MAGIC    0x52325354     // "R2ST"
+#define STATE_SHM_VERSION  1
+
+#define STATE_SHM_LIVE     0x1            // state_shm.flags: r2_control is running
+
+/// One published cycle
+struct state_shm_snapshot {
+	u_64 cycle;           // gTime at capture
+	u_64 stamp_ns;        // CLOCK_REALTIME at capture (the ravenstate header stamp)
+	u_64 write_ns;        // CLOCK_MONOTONIC when the mirror was written
+	u_08 runlevel;
+	u_08 sublevel;
+	u_08 pad[2];
+	int  last_sequence;   // last master packet applied
+	struct robot_device dev;
+};
+
+/// The whole segment
+struct state_shm {
+	u_32 magic;           // STATE_SHM_MAGIC
+	u_32 version;         // STATE_SHM_VERSION
+	u_32 size;            // sizeof(struct state_shm)
+	u_32 device_size;     // sizeof(struct robot_device) of the writer
+	volatile u_32 flags;  // STATE_SHM_LIVE
+	volatile u_32 seq;    // odd while being written
+	volatile u_64 writes; // snapshots written
+	struct state_shm_snapshot snap;
+};
+
+class StateShmReader
+{
+public:
+	StateShmReader() : shm(NULL) {}
+	~StateShmReader() { close(); }
+
+	/**\fn int open(const char *name)
+	 * \brief map the segment read-only and check it was written by a matching r2_control
+	 * \return 0, negative errno, or -EINVAL on a layout mismatch
+	 */
+	int open(const char *name = STATE_SHM_NAME)
+	{
+		struct stat st;
+
+		close();
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return -errno;
+		if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct state_shm))
+		{
+			::close(fd);
+			return -EINVAL;
+		}
+		void *p = mmap(NULL, sizeof(struct state_shm), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return -errno;
+		const struct state_shm *s = (const struct state_shm *)p;
+		if (s->magic != STATE_SHM_MAGIC || s->version != STATE_SHM_VERSION ||
+			s->size != sizeof(struct state_shm) || s->device_size != sizeof(struct robot_device))
+		{
+			munmap(p, sizeof(struct state_shm));
+			return -EINVAL;
+		}
+		shm = s;
+		return 0;
+	}
+
+	void close()
+	{
+		if (shm)
+			munmap((void *)shm, sizeof(struct state_shm));
+		shm = NULL;
+	}
+
+	/// nonzero while r2_control is publishing into the segment
+	int live() const { return shm && (shm->flags & STATE_SHM_LIVE); }
+
+	/// snapshots written so far: poll this to wait for a new one
+	u_64 writes() const { return shm ? shm->writes : 0; }
+
+	/**\fn int read(struct state_shm_snapshot *out, int tries)
+	 * \brief copy out the latest snapshot
+	 * \param tries attempts before giving up on a writer that keeps overtaking the copy
+	 * \return 0, -ENODATA if nothing was written yet, -EAGAIN if no consistent copy was made
+	 */
+	int read(struct state_shm_snapshot *out, int tries = 100) const
+	{
+		if (!shm)
+			return -EBADF;
+		for (int i = 0; i < tries; i++)
+		{
+			u_32 s0 = shm->seq;
+			__sync_synchronize();      // seq read before the data
+			if (s0 & 1)
+			{
+				sched_yield();
+				continue;
+			}
+			if (s0 == 0)
+				return -ENODATA;
+			memcpy(out, (const void *)&shm->snap, sizeof(*out));
+			__sync_synchronize();      // data read before seq is checked again
+			if (shm->seq == s0)
+				return 0;
+		}
+		return -EAGAIN;
+	}
+
+private:
+	const struct state_shm *shm;
+};
+
+#endif // STATE_SHM_CLIENT_H
@@ -60,6 +60,7 @@ enum t_controlmode{
     motor_pd_control       = 5,
     cartesian_space_control =6,
     multi_dof_sinusoid     = 7,
+    external_control       = 8,
     LAST_TYPE
     } ;
 
@@ -0,0 +1,57 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file teleop_jitter.h
+ * \brief Reorder window and optional playout buffer for incoming teleop samples.
+ *
+ * Configured from the ROS parameter server at startup:
+ *   /teleop_reorder_window      samples held while waiting for a missing one (1-64, 1: no reordering)
+ *   /teleop_reorder_timeout_us  how long a gap is waited for before it is skipped
+ *   /teleop_playout_delay_us    fixed playout delay (0: release samples as soon as they are in order)
+ *   /teleop_playout_period_us   master sample period used to pace the playout
+ *
+ * Used by the network thread only.
+ */
+
+#ifndef TELEOP_JITTER_H
+#define TELEOP_JITTER_H
+
+#include <time.h>
+#include <ros/ros.h>
+#include "itp_teleoperation.h"
+
+#define TJ_MAX_WINDOW    64     // reorder slots
+#define TJ_PLAYOUT_SIZE  256    // in-order samples awaiting playout
+
+// teleopJitterInsert() results
+#define TJ_ACCEPTED   0
+#define TJ_DUPLICATE  1
+#define TJ_LATE       2         // already released or skipped
+#define TJ_RESET      3         // sequence numbering restarted; window flushed
+
+int init_teleop_jitter(ros::NodeHandle &n);
+int teleopJitterInsert(const struct u_struct *u, const struct timespec *rx_stamp, const struct timespec *now);
+void teleopJitterReset();
+void teleopJitterPoll(const struct timespec *now);
+int teleopJitterRelease(struct u_struct *out, struct timespec *rx_stamps, int maxout, const struct timespec *now);
+int teleopJitterNextEvent(const struct timespec *now, struct timespec *wait);
+void outputTeleopJitterStats();
+
+#endif // TELEOP_JITTER_H
@@ -0,0 +1,44 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * teleop_protocol.h
+ *
+ * Decoding (and reference encoding) of the teleop wire formats in
+ * itp_teleoperation.h.
+ */
+
+#ifndef TELEOP_PROTOCOL_H
+#define TELEOP_PROTOCOL_H
+
+#include <ros/ros.h>
+#include "itp_teleoperation.h"
+
+// decodeTeleopPacket() errors
+#define TELEOP_BAD_PACKET  -1     // wrong size / magic / version
+#define TELEOP_BAD_CRC     -2     // integrity check failed, or missing when required
+
+int init_teleop_protocol(ros::NodeHandle &n);
+int decodeTeleopPacket(const void *buf, int len, struct u_struct *out, int maxout);
+int encodeTeleopCompact(const struct u_struct *in, int count, void *buf, int len);
+void sealTeleopPacket(struct u_struct *u);
+void sealFeedbackPacket(struct v_struct *v);
+void outputTeleopProtocolStats();
+
+#endif
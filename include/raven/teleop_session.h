@@ -0,0 +1,59 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file teleop_session.h
+ * \brief Teleop sessions: one per master (source address and port).
+ *
+ * Every session has its own input ring, sequence and rate statistics.  Only
+ * the session that owns the robot feeds the reorder window and data1; the
+ * others are tracked and their samples discarded.  Configured at startup:
+ *   /teleop_arbitration        "priority": the highest priority live session
+ *                              owns the robot; "first": the owner keeps it until
+ *                              it goes quiet
+ *   /teleop_session_priority   "addr[:port]=prio,..." (unlisted sources: 0)
+ *   /teleop_session_timeout_ms a session with no packets for this long is closed
+ *
+ * Used by the network thread; the statistics may be printed from any thread.
+ */
+
+#ifndef TELEOP_SESSION_H
+#define TELEOP_SESSION_H
+
+#include <time.h>
+#include <netinet/in.h>
+#include <ros/ros.h>
+#include "itp_teleoperation.h"
+
+#define TS_MAX_SESSIONS  4
+#define TS_INPUT_SIZE    256    // samples per session between arbitration passes, power of two
+#define TS_MAX_RULES     8      // /teleop_session_priority entries
+
+// /teleop_arbitration
+#define TS_ARB_PRIORITY  0
+#define TS_ARB_FIRST     1
+
+int init_teleop_sessions(ros::NodeHandle &n);
+int teleopSessionInput(const struct sockaddr_in *from, const struct u_struct *samples, int count,
+					   const struct timespec *rx_stamp, const struct timespec *now);
+int teleopSessionArbitrate(const struct timespec *now);
+int teleopSessionDrain(int id, struct u_struct *out, struct timespec *rx_stamps, int maxout);
+void outputTeleopSessionStats();
+
+#endif // TELEOP_SESSION_H
@@ -0,0 +1,83 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file tracepoint.h
+ * \brief Named begin/end spans around the stages of the control loop.
+ *
+ * traceBegin() / traceEnd() mark a span on every enabled backend:
+ *   parport  one byte on the parallel port, for a scope or logic analyser
+ *   marker   a line in the ftrace trace_marker, so trace-cmd, perf or
+ *            kernelshark show the spans next to sched_switch, irq and usb
+ *            events from the same run
+ *   ring     an in-memory ring of CLOCK_MONOTONIC stamps, written to
+ *            /trace_ring_file at shutdown
+ * With no backend enabled a tracepoint is one load and a not-taken branch.
+ * Configured at startup:
+ *   /trace_backends     comma separated subset of "parport,marker,ring" ("": off)
+ *   /trace_ring_entries ring size (power of two)
+ *   /trace_ring_file    where the ring is written at shutdown
+ */
+
+#ifndef TRACEPOINT_H
+#define TRACEPOINT_H
+
+#include <ros/ros.h>
+
+/// Traced spans.  Stages of rt_process() follow each other; TS_CARTESIAN nests in TS_CONTROL.
+enum trace_span {
+	TS_USB_INITIATE = 0,  // initiateUSBGet()
+	TS_SLEEP,             // waiting for the next deadline
+	TS_USB_WAIT,          // waiting for the boards' packets
+	TS_STATE_MACHINE,     // updateAtmelInputs() and stateMachine()
+	TS_DEVICE_STATE,      // checkLocalUpdates() and updateDeviceState()
+	TS_CONTROL,           // clearDACs() and controlRaven()
+	TS_CARTESIAN,         //   raven_cartesian_space_command(): IK to DAC
+	TS_OVERDRIVE,         // overdriveDetect()
+	TS_USB_PUT,           // updateAtmelOutputs() and putUSBPackets()
+	TS_PUBLISH,           // publish_ravenstate_ros()
+	TS_RECORD,            // flight recorder, blackbox and calibration capture
+	TS_NUM_SPANS
+};
+
+/// Backend bits of trace_backends
+#define TRACE_PARPORT  0x1
+#define TRACE_MARKER   0x2
+#define TRACE_RING     0x4
+
+extern unsigned int trace_backends;
+
+void traceEmit(int span, int begin);
+
+static inline void traceBegin(int span)
+{
+	if (__builtin_expect(trace_backends != 0, 0))
+		traceEmit(span, 1);
+}
+
+static inline void traceEnd(int span)
+{
+	if (__builtin_expect(trace_backends != 0, 0))
+		traceEmit(span, 0);
+}
+
+int init_tracepoints(ros::NodeHandle &n);
+void traceRingDump(void);
+
+#endif // TRACEPOINT_H
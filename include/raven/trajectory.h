@@ -41,3 +41,11 @@ int update_linear_sinusoid_velocity_trajectory(struct DOF*);
 int update_sinusoid_position_trajectory(struct DOF*);
 int update_linear_sinusoid_position_trajectory(struct DOF*);
 int update_position_trajectory(struct DOF*);
+
+// Profiles built at start, held at their end
+int startMinJerkTrajectory(struct DOF*, float _endPos, float _duration);
+int startTrapezoidTrajectory(struct DOF*, float _endPos, float _vmax, float _amax);
+int startSplineTrajectory(struct DOF*, int _n, const float *_t, const float *_pos);
+
+// Update every joint with a trajectory
+int trajectoryStep(struct device*);
@@ -63,4 +63,5 @@
 
 //Function Prototypes
 void updateAtmelOutputs(struct device *device0, int runlevel);
-void updateAtmelInputs(struct device device0, int runlevel);
+unsigned char updateAtmelInputs(struct device *device0);
+u_08 atmelPlcRunlevel(void);
@@ -0,0 +1,60 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * usb_health.h
+ *
+ * Board disconnects, caught in a few cycles and recovered without a
+ * restart.  Every read, write and read request of a board counts towards
+ * its health: a run of failures, a gone device (ENODEV) or a run of cycles
+ * without an encoder packet gives the board up.  From then on it gets no
+ * I/O, the robot is held in software e-stop and the board's arm is marked
+ * unhomed.  A housekeeping thread looks for the board's /dev/brl_usbXX
+ * again, as USBInit() does, and reopens and resets it when it comes back.
+ * At the next homing the arm gets its offsets back from the calibration
+ * store (calibration.h) if the board kept counting, so it only moves home.
+ *   /usb_health_max_errors   failed USB calls in a row before a board is given up (0: off)
+ *   /usb_health_stale_ms     time without an encoder packet before a board is given up (0: no limit)
+ *   /usb_reattach_period_ms  how often a lost board is looked for
+ */
+
+#ifndef __USB_HEALTH_H__
+#define __USB_HEALTH_H__
+
+#include <ros/ros.h>
+#include "struct.h"
+
+#define USB_BOARD_UP    0   /// in use
+#define USB_BOARD_LOST  1   /// given up by the RT thread: no I/O until reopened
+#define USB_BOARD_BACK  2   /// reopened, for the RT thread to take back
+
+int init_usb_health(ros::NodeHandle &n);
+void usbHealthIo(int id, int ret);
+int usbHealthCheck(struct device *dev);
+void* usb_reattach_process(void*);
+
+extern volatile unsigned char usb_board_state[];   // by board serial, see usbBoardUp()
+
+/// true if board id may be read and written
+static inline int usbBoardUp(int id)
+{
+    return usb_board_state[id] == USB_BOARD_UP;
+}
+
+#endif
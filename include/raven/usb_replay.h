@@ -0,0 +1,55 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_replay.h
+ * \brief Replay USB backend: drive the controller from a flight recording.
+ *
+ * With /usb_backend: replay, USBInit() opens no boards.  Each control cycle
+ * usbReplayNext() steps to the next record of the recording:
+ * usb_read() returns the ENC packets the boards sent in that cycle,
+ * usbReplayMaster() supplies the master input the RT thread took, and
+ * usb_write() compares the DAC packet the controller produces against the
+ * one that was sent.  The node shuts down at the end of the recording after
+ * logging the differences.  An archive (flight_archive.h) replays too; its
+ * chunks are decoded on the RT thread as the replay reaches them, a
+ * millisecond or so each, so replay archives in lockstep.  Configured at startup:
+ *   /usb_replay_file           recording to replay
+ *   /usb_replay_dac_tolerance  DAC counts a channel may differ without counting as a mismatch
+ */
+
+#ifndef USB_REPLAY_H
+#define USB_REPLAY_H
+
+#include <stddef.h>
+#include <ros/ros.h>
+#include "struct.h"
+
+int init_usb_replay(ros::NodeHandle &n);
+int usbReplayOpen(const char *path, int dac_tolerance);
+int usbReplayActive();
+int usbReplayInit(struct device *device0);
+int usbReplayNext();
+struct param_pass *usbReplayMaster(struct param_pass *rcvdParams);
+int usbReplayRead(int id, void *buffer, size_t len);
+int usbReplayWrite(int id, const void *buffer, size_t len);
+void usbReplaySummary();
+void outputUsbReplayStats();
+
+#endif // USB_REPLAY_H
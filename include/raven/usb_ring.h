@@ -0,0 +1,53 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * usb_ring.h
+ *
+ * Memory-mapped packet rings to the brl_usb boards (layout in
+ * brl_usb_ring.h).  With /usb_ring "on", every board whose driver offers
+ * the ring is mapped at USBInit(): startUSBRead() and usb_write() become a
+ * counter store (plus an eventfd write if the driver can't poll), and
+ * getUSBPacket() decodes the encoder packet where the driver left it,
+ * without a read().  Boards whose driver has no ring keep the syscalls.
+ */
+
+#ifndef __USB_RING_H__
+#define __USB_RING_H__
+
+#include <stdint.h>
+#include <ros/ros.h>
+
+int init_usb_ring(ros::NodeHandle &n);
+int usbRingAttach(int id, int fd);
+void usbRingDetach(int id);
+
+int usbRingRequest(int id);
+int usbRingRead(int id, unsigned char **packet, uint64_t *stamp_ns);
+int usbRingWrite(int id, const void *buffer, size_t len);
+
+extern unsigned char usb_ring_mapped[];   // by board serial, see usbRingActive()
+
+/// true if board id's packets go through its mapped ring
+static inline int usbRingActive(int id)
+{
+    return usb_ring_mapped[id];
+}
+
+#endif
@@ -0,0 +1,61 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_sim.h
+ * \brief Simulated BRL USB boards with a motor plant (/usb_backend: sim).
+ *
+ * Each simulated board answers the driver protocol the way the hardware
+ * does: startUSBRead() (BRL_START_READ) starts a read that completes after
+ * a configurable latency, usb_read() returns -EBUSY until then and an
+ * IN_LENGTH ENC packet after, and usb_write() takes OUT_LENGTH DAC packets.
+ * usb_board_fd() is a timerfd that turns readable at completion, so the
+ * poll wait mode works unchanged (in lockstep, time is virtual and a
+ * read is complete if its latency fits in the control period).  The DAC channels drive one motor each
+ * (motor constants from DOF_types, inertia, viscous damping and hard stops
+ * from the parameters) and the motor angles come back as encoder counts.
+ * A simulated PLC sets the runlevel pins from the Linux outputs.
+ * Configured at startup:
+ *   /usb_sim_boards         boards to simulate (gold first, then green)
+ *   /usb_sim_latency_us     read completion latency after BRL_START_READ
+ *   /usb_sim_jitter_us      added uniformly random latency
+ *   /usb_sim_runlevel       runlevel the simulated operator asks the PLC for
+ *   /usb_sim_inertia        motor + reflected load inertia (kg m^2)
+ *   /usb_sim_damping        viscous damping at the motor (Nm s/rad)
+ *   /usb_sim_travel         joint travel each side of the start pose (joint units)
+ */
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#include <stddef.h>
+#include <ros/ros.h>
+#include "struct.h"
+
+int init_usb_sim(ros::NodeHandle &n);
+int usbSimInit(struct device *device0);
+void usbSimShutdown();
+int usbSimStartRead(int id);
+int usbSimRead(int id, void *buffer, size_t len);
+int usbSimWrite(int id, const void *buffer, size_t len);
+int usbSimBoardFd(int id);
+int usbSimResetEncoders(int id);
+void outputUsbSimStats();
+
+#endif // USB_SIM_H
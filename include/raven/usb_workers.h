@@ -0,0 +1,49 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * usb_workers.h
+ *
+ * Per-board USB I/O helper threads.  With /usb_io_mode "parallel" every
+ * board gets its own thread, so the blocking ioctl/read/write calls of all
+ * boards overlap and a cycle's USB time is the slowest board, not the sum.
+ */
+
+#ifndef __USB_WORKERS_H__
+#define __USB_WORKERS_H__
+
+#include <time.h>
+#include "struct.h"
+
+// How the per-cycle USB calls are issued
+#define USB_IO_SERIAL     0   /// one board after another on the RT thread
+#define USB_IO_PARALLEL   1   /// all boards at once on per-board helper threads
+
+// Jobs run on every board per cycle
+#define USB_JOB_START_READ 0
+#define USB_JOB_READ       1
+#define USB_JOB_WRITE      2
+
+int usbWorkersStart(struct device *device0);
+void usbWorkersStop(void);
+int usbWorkersActive(void);
+int usbWorkersRun(int job, const struct timespec *deadline);
+int usbWorkerIdle(int board);
+
+#endif
@@ -43,9 +43,6 @@
 #define SHORT_OVERFLOW    1
 #define SHORT_UNDERFLOW  -1
 
-int loop_over_joints(struct robot_device*, struct mechanism*&, struct DOF*&, int&, int&);
-int loop_over_joints(struct mechanism* _mech, struct DOF*& _joint, int& jnum);
-
 int toShort(int value, short int *target);
 void strtoken(char *str, char *result, char delim);
 void strcopy(const char *src, char *dest);
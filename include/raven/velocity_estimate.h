@@ -0,0 +1,53 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file velocity_estimate.h
+ * \brief Motor velocity estimators that use the encoders' sample times.
+ *
+ * stateEstimate() differences the filtered position over the nominal
+ * period; with cycle jitter that shows up as velocity noise in the PD's
+ * derivative term.  Each joint type can instead take mvel from
+ *  - VEL_KALMAN: a constant-velocity Kalman filter on the raw motor angle,
+ *    stepped over the measured time between samples, or
+ *  - VEL_MT: the mixed M/T encoder method: counts moved over at least
+ *    vel_mt_window_ms at speed (M), the time between count changes at low
+ *    speed (1/T), decaying while no count arrives.
+ * The position filter and mpos are the same for every method.
+ *
+ * The control loop stamps each mechanism's encoder sample with the arrival
+ * time of its board's packet, velEstimateStamp(); without stamps (offline
+ * tools) the nominal period is used.
+ */
+
+#ifndef VELOCITY_ESTIMATE_H
+#define VELOCITY_ESTIMATE_H
+
+#include <ros/ros.h>
+#include "joint_block.h"
+
+enum vel_estimator { VEL_DIFF = 0, VEL_KALMAN = 1, VEL_MT = 2 };
+
+void velEstimateStamp(int m, long long ns, int fresh);
+void velEstimate(struct joint_block *jb);
+void velEstimateReset(int type, float mpos);
+int  setVelEstimator(int type, int method);
+int  init_velocity_estimate(ros::NodeHandle &n);
+
+#endif // VELOCITY_ESTIMATE_H
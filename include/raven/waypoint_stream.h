@@ -0,0 +1,46 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file waypoint_stream.h
+ * \brief Timed Cartesian waypoints for autonomous motion.
+ *
+ * An autonomy client publishes raven_waypoints at its own rate (50-100 Hz),
+ * each message a time-stamped look-ahead of waypoints for one arm.  The
+ * ROS callback queues them per mechanism; in pedal down the control loop
+ * takes them one segment at a time and hands each to the setpoint
+ * interpolator to reach by its due time, so the setpoint moves every servo
+ * cycle.  While a stream plays the arm ignores master and raven_automove
+ * targets; when its queue runs dry the master origin is reset to where the
+ * arm stopped.  Leaving pedal down drops the queue.
+ *
+ *   /waypoint_max_lead_s  waypoints due further ahead are dropped (default 10)
+ */
+
+#ifndef WAYPOINT_STREAM_H
+#define WAYPOINT_STREAM_H
+
+#include <ros/ros.h>
+#include "struct.h"
+
+int init_waypoint_stream(ros::NodeHandle &n);
+void waypointStreamStep(struct device *device0, int runlevel);
+int waypointStreamActive(int m);
+
+#endif // WAYPOINT_STREAM_H
@@ -0,0 +1,51 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file workspace_map.h
+ * \brief Precomputed reachable workspace of each arm.
+ *
+ * The shoulder and elbow limits bound the directions the insertion axis can
+ * point in, the insertion limits bound how far along it the wrist gets.  At
+ * startup the direction sphere of each arm (tilted base frame, RCM at the
+ * origin) is cut into WS_CELL_DEG cells, every cell the in-limit shoulder and
+ * elbow angles reach is marked, and every other cell is pointed at its
+ * nearest reachable one.  Reachability and the nearest reachable wrist point
+ * are then one table lookup.
+ *
+ * Built from the kinematics (computeFKFrames()), not the DOF_types[] limits
+ * in use, so only valid for the SHOULDER_* / ELBOW_* limits in defines.h.
+ */
+
+#ifndef WORKSPACE_MAP_H
+#define WORKSPACE_MAP_H
+
+#include "r2_kinematics.h"
+
+#define WS_CELL_DEG   1                     // cell size, deg
+#define WS_N_POLAR    (180 / WS_CELL_DEG)
+#define WS_N_AZIMUTH  (360 / WS_CELL_DEG)
+#define WS_N_CELLS    (WS_N_POLAR * WS_N_AZIMUTH)
+
+int initWorkspaceMap();
+int workspaceMapReady();
+int workspaceReachable(l_r in_arm, const btVector3 &in_p05);
+int workspaceClip(l_r in_arm, const btVector3 &in_p05, btVector3 &out_p05);
+
+#endif // WORKSPACE_MAP_H
@@ -26,14 +26,19 @@
  
 #include <string.h>
 #include <vector>
-#include <map>
 #include <dirent.h>
 #include <iostream>
 #include <stdio.h>
+#include <pthread.h>
 #include <ros/console.h>
 
 #include "USB_init.h"
 #include "parallel.h"
+#include "usb_replay.h"
+#include "usb_sim.h"
+#include "usb_ring.h"
+#include "usb_health.h"
+#include "startup_profile.h"
 
 //Four device files for connection to four boards
 #define BRL_USB_DEV_DIR     "/dev/"
@@ -45,13 +50,189 @@
 
 // Keep board information
 std::vector<int> boardFile;
-std::map<int,int> boardFPs;
+static int boardFPs[MAX_BOARD_SERIAL+1];   // file handle by board serial, -1: not open
+
+// The arm boards (/arm_boards), in mechanism order
+struct arm_board
+{
+    int serial;
+    int type;       // GOLD_ARM or GREEN_ARM
+    int master;     // master arm driving it, -1: none
+};
+static struct arm_board armBoards[MAX_MECH_PER_DEV] = {
+    { GOLD_ARM_SERIAL,  GOLD_ARM,  0 },
+    { GREEN_ARM_SERIAL, GREEN_ARM, 1 },
+};
+static int numArmBoards = (MAX_MECH_PER_DEV < 2) ? MAX_MECH_PER_DEV : 2;
+
+// A board reset USBInit() leaves running, see USBInitWait()
+struct board_reset
+{
+    pthread_t thread;
+    int boardid;
+    int fd;
+    int ioctl_err;      // errno of the reset ioctl, 0 if it worked
+    int zero_err;       // write_zeros_to_board()'s
+};
+static struct board_reset boardResets[MAX_BOARD_COUNT];
+static int numBoardResets = 0;
+static int resetPhase = -1;
 
 extern USBStruct USBBoards;
 extern int NUM_MECH;
+extern int usb_backend;       // Defined in globals.cpp
 
 using namespace std;
 
+/**\fn int init_arm_boards(ros::NodeHandle &n)
+ * \brief read /arm_boards: which board drives which arm, in mechanism order
+ *
+ * "serial=gold|green[:master],...", e.g. "24=gold,37=green" (the default).
+ * master is the master (ITP) arm that teleoperates the mechanism, 0 or 1;
+ * without it the first gold arm follows master arm 0, the first green arm
+ * master arm 1, and any others hold still under teleoperation.
+ *
+ * \param n the node handle
+ * \return number of arm boards, 0 if the list held none (the default is kept)
+ */
+int init_arm_boards(ros::NodeHandle &n)
+{
+    std::string spec;
+    char buf[512];
+    char *save = NULL;
+    struct arm_board list[MAX_MECH_PER_DEV];
+    int count = 0, gold_master = 0, green_master = 0;
+
+    n.param<std::string>("/arm_boards", spec, "");
+    if (spec.empty())
+        return numArmBoards;
+
+    strncpy(buf, spec.c_str(), sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save))
+    {
+        char *eq = strchr(tok, '=');
+        if (eq == NULL)
+        {
+            err_msg("arm_boards: missing '=gold' or '=green' in %s", tok);
+            continue;
+        }
+        if (count >= MAX_MECH_PER_DEV)
+        {
+            err_msg("arm_boards: more than %d arms (R2_MAX_MECH), %s and after ignored", MAX_MECH_PER_DEV, tok);
+            break;
+        }
+        *eq = '\0';
+        char *colon = strchr(eq+1, ':');
+        if (colon)
+            *colon = '\0';
+
+        struct arm_board *b = &list[count];
+        b->serial = atoi(tok);
+        b->master = colon ? atoi(colon+1) : -2;
+        if (strcmp(eq+1, "gold") == 0)
+            b->type = GOLD_ARM;
+        else if (strcmp(eq+1, "green") == 0)
+            b->type = GREEN_ARM;
+        else
+        {
+            err_msg("arm_boards: arm type %s is not gold or green", eq+1);
+            continue;
+        }
+        if (b->serial <= 0 || b->serial > MAX_BOARD_SERIAL)
+        {
+            err_msg("arm_boards: bad board serial %s", tok);
+            continue;
+        }
+        // Default master arm: the first of each type
+        if (b->master == -2)
+        {
+            int *first = (b->type == GOLD_ARM) ? &gold_master : &green_master;
+            b->master = (*first == 0) ? (b->type == GOLD_ARM ? 0 : 1) : -1;
+            *first = 1;
+        }
+        else if (b->master < -1 || b->master > 1)
+        {
+            err_msg("arm_boards: master arm %d of board %d is not 0 or 1", b->master, b->serial);
+            b->master = -1;
+        }
+        count++;
+    }
+    if (count == 0)
+    {
+        err_msg("arm_boards: no arms in \"%s\", using board %d as gold, %d as green", spec.c_str(), GOLD_ARM_SERIAL, GREEN_ARM_SERIAL);
+        return 0;
+    }
+
+    memcpy(armBoards, list, sizeof(struct arm_board) * count);
+    numArmBoards = count;
+    for (int k = 0; k < numArmBoards; k++)
+        log_msg("  Mechanism %d: %s arm on board #%d, master arm %d", k,
+                armBoards[k].type == GOLD_ARM ? "gold" : "green", armBoards[k].serial, armBoards[k].master);
+    return numArmBoards;
+}
+
+/**\fn int armBoardCount(void)
+ * \return number of arm boards in /arm_boards
+ */
+int armBoardCount(void)
+{
+    return numArmBoards;
+}
+
+/**\fn int armBoardSerial(int k)
+ * \return serial of the k-th arm board in /arm_boards
+ */
+int armBoardSerial(int k)
+{
+    return armBoards[k].serial;
+}
+
+/**\fn static const struct arm_board *findArmBoard(int serial)
+ * \return the /arm_boards entry of a board, NULL if it is not an arm board
+ */
+static const struct arm_board *findArmBoard(int serial)
+{
+    for (int k = 0; k < numArmBoards; k++)
+        if (armBoards[k].serial == serial)
+            return &armBoards[k];
+    return NULL;
+}
+
+/**\fn int armBoardType(int serial)
+ * \return GOLD_ARM or GREEN_ARM for an arm board, 0 for any other board
+ */
+int armBoardType(int serial)
+{
+    const struct arm_board *b = findArmBoard(serial);
+    return b ? b->type : 0;
+}
+
+/**\fn int usbAddMech(struct device *device0, int serial)
+ * \brief make a board the next mechanism: USBBoards, NUM_MECH and the mechanism's arm type.
+ *        Used by every USB backend.
+ * \param device0 pointer to device struct
+ * \param serial the board's serial
+ * \return the mechanism index, -1 if there is no room for another (MAX_MECH_PER_DEV)
+ */
+int usbAddMech(struct device *device0, int serial)
+{
+    int m = USBBoards.activeAtStart;
+    if (m >= MAX_MECH_PER_DEV)
+    {
+        ROS_ERROR("Board #%d left out: already %d mechanisms (R2_MAX_MECH)", serial, m);
+        return -1;
+    }
+
+    const struct arm_board *b = findArmBoard(serial);
+    device0->mech[m].type = b ? b->type : 0;
+    USBBoards.boards.push_back(serial);
+    USBBoards.master.push_back(b ? b->master : -1);
+    USBBoards.activeAtStart++;
+    NUM_MECH = USBBoards.activeAtStart;
+    return m;
+}
+
 
 /**\fn int getdir(string dir, vector<string> &files)
  * \brief List directory contents matching BOARD_FILE_STR
@@ -96,10 +277,9 @@ int get_board_id_from_filename(string s)
  * \param boardid - 
  * \return 0 on success, 
  */
-int write_zeros_to_board(int boardid)
+static void zeroDacPacket(unsigned char *buffer_out)
 {
     short int tmp = DAC_OFFSET;
-    unsigned char buffer_out[MAX_OUT_LENGTH];
 
     buffer_out[0]= DAC;        //Type of USB packet
     buffer_out[1]= MAX_DOF_PER_MECH; //Number of DAC channels
@@ -108,6 +288,13 @@ int write_zeros_to_board(int boardid)
         buffer_out[2*i+3] = (char)tmp>>8;
     }
     buffer_out[OUT_LENGTH-1] = 0x00;
+}
+
+int write_zeros_to_board(int boardid)
+{
+    unsigned char buffer_out[MAX_OUT_LENGTH];
+
+    zeroDacPacket(buffer_out);
 
     //Write the packet to the USB Driver
     if(usb_write(boardid, &buffer_out, OUT_LENGTH )!= OUT_LENGTH){
@@ -119,18 +306,94 @@ int write_zeros_to_board(int boardid)
 }
 
 
+/**\fn int usbEmergencyZero(void)
+ * \brief zero DACs and output pins on every open board, from any thread
+ *
+ * Straight to the board files with write(): never through a packet ring or
+ * a USB worker, whose one producer may be the thread that hung.
+ *
+ * \return boards written
+ */
+int usbEmergencyZero(void)
+{
+    unsigned char buffer_out[MAX_OUT_LENGTH];
+    int written = 0;
+
+    if (usb_backend != USB_BACKEND_BOARDS)
+        return 0;
+
+    zeroDacPacket(buffer_out);
+    for (int s = 0; s <= MAX_BOARD_SERIAL; s++)
+        if (boardFPs[s] >= 0 && usbBoardUp(s) && write(boardFPs[s], buffer_out, OUT_LENGTH) == OUT_LENGTH)
+            written++;
+    return written;
+}
+
+
+ /**\fn static void* resetBoard(void *arg)
+ * \brief one board's reset, on its own thread: the driver's reset ioctl, then zero DACs
+ * \param arg the board_reset
+ */
+static void* resetBoard(void *arg)
+{
+    struct board_reset *r = (struct board_reset *)arg;
+
+    // Setup usb dev.  ioctl() performs an initialization in driver.
+    r->ioctl_err = (ioctl(r->fd, BRL_RESET_BOARD) != 0) ? errno : 0;
+    r->zero_err = write_zeros_to_board(r->boardid);
+    if (r->ioctl_err)
+        ROS_ERROR("ERROR: ioctl error resetting board #%d (%d)", r->boardid, r->ioctl_err);
+    if (r->zero_err)
+        ROS_ERROR("Warning: failed initial board reset (set-to-zero) on board #%d", r->boardid);
+    return NULL;
+}
+
+ /**\fn int USBInitWait(void)
+ * \brief wait for the board resets USBInit() started.  Call before the first USB read or write.
+ * \return number of boards whose reset failed
+ */
+int USBInitWait(void)
+{
+    int failed = 0;
+
+    for (int i = 0; i < numBoardResets; i++)
+    {
+        pthread_join(boardResets[i].thread, NULL);
+        if (boardResets[i].ioctl_err || boardResets[i].zero_err)
+            failed++;
+    }
+    numBoardResets = 0;
+    if (resetPhase >= 0)
+        startupPhaseEnd(resetPhase);
+    resetPhase = -1;
+    return failed;
+}
+
  /**\fn int USBInit(struct device *device0)
  * \brief initialize the USB modules
  * \struct device
  * \param device0 - pointer to device struct
  * \return 0 if no USB board found, USB_INIT_ERROR if error was encountered, or # of boards if initialized successfully 
+ *
+ * The boards are open and their arms known on return; their resets may
+ * still be running, see USBInitWait().
  */
 int USBInit(struct device *device0)
 {
   //DELETEME    char buf[10]; //buffer to be used for clearing usb read buffers
     string boardStr;
-    int boardid = 0;
-    int okboards = 0;
+    vector<int> boardIds;     // serial of each boardFile[]
+
+    USBBoards.boards.clear();
+    USBBoards.master.clear();
+    USBBoards.activeAtStart=0;
+    for (int s = 0; s <= MAX_BOARD_SERIAL; s++)
+        boardFPs[s] = -1;
+
+    if (usb_backend == USB_BACKEND_REPLAY)
+        return usbReplayInit(device0);
+    if (usb_backend == USB_BACKEND_SIM)
+        return usbSimInit(device0);
 
     // Get list of files in dev dir
     vector<string> files = vector<string>();
@@ -141,14 +404,17 @@ int USBInit(struct device *device0)
         log_msg("    %s", files[i].c_str());
     }
 
-    //Initialize all active USB Boards
     //Open and reset available boards
-    USBBoards.activeAtStart=0;
     for (uint i=0;i<files.size();i++)
     {
         boardStr = BRL_USB_DEV_DIR;
         boardStr += files[i];
-        boardid = get_board_id_from_filename(files[i]);
+        int boardid = get_board_id_from_filename(files[i]);
+        if (boardid <= 0 || boardid > MAX_BOARD_SERIAL)
+        {
+            log_msg("*** WARNING: %s is not a board (serial out of range).", files[i].c_str());
+            continue;
+        }
 
         // Open usb dev
         int tmp_fileHandle = open(boardStr.c_str(), O_RDWR|O_NONBLOCK);    //Is NONBLOCK mode required??// open board chardev
@@ -158,54 +424,124 @@ int USBInit(struct device *device0)
             errno=0;
             continue; //Failed to open board, move to next one
         }
+        if (armBoardType(boardid) == 0)
+            log_msg("*** WARNING: USB BOARD #%d NOT CONNECTED TO MECH (update /arm_boards?).",boardid);
 
-        // Setup usb dev.  ioctl() performs an initialization in driver.
-        if ( ioctl(tmp_fileHandle, BRL_RESET_BOARD) != 0)
-        {
-            ROS_ERROR("ERROR: ioctl error opening board %s", boardStr.c_str());
-            errno = 0;
-        }
+        // Store usb dev parameters
+        boardFile.push_back(tmp_fileHandle);  // Store file handle
+        boardIds.push_back(boardid);
+        boardFPs[boardid] = tmp_fileHandle;   // Map serial to fileHandle
+        usbRingAttach(boardid, tmp_fileHandle);
+    }
 
-        device0->mech[i].type = 0;
-        // Set mechanism type Green or Gold surgical robot
-        if (boardid == GREEN_ARM_SERIAL)
-        {
-            okboards++;
-            log_msg("  Green Arm on board #%d.",boardid);
-            device0->mech[i].type = GREEN_ARM;
-        }
-        else if (boardid == GOLD_ARM_SERIAL)
+    //The arm boards found become the mechanisms, in /arm_boards order
+    for (int k = 0; k < armBoardCount(); k++)
+    {
+        int boardid = armBoardSerial(k);
+        if (boardFPs[boardid] < 0)
         {
-            okboards++;
-            log_msg("  Gold Arm on board #%d.",boardid);
-            device0->mech[i].type = GOLD_ARM;
+            ROS_ERROR("Error: board #%d of /arm_boards not found", boardid);
+            continue;
         }
+        int m = usbAddMech(device0, boardid);
+        if (m >= 0)
+            log_msg("  %s Arm on board #%d is mechanism %d.", device0->mech[m].type == GOLD_ARM ? "Gold" : "Green", boardid, m);
+    }
+
+    // Reset every board at once: each one's ioctl and zero write take a
+    // while and none depends on another.  The caller goes on with what does
+    // not touch the boards and meets them in USBInitWait().
+    resetPhase = startupPhaseBegin("board resets");
+    numBoardResets = 0;
+    for (uint i = 0; i < boardFile.size() && i < MAX_BOARD_COUNT; i++)
+    {
+        struct board_reset *r = &boardResets[numBoardResets];
+        r->boardid = boardIds[i];
+        r->fd = boardFile[i];
+        if (pthread_create(&r->thread, NULL, resetBoard, r) != 0)
+            resetBoard(r);      // no thread: do it here
         else
-        {
-            log_msg("*** WARNING: USB BOARD #%d NOT CONNECTED TO MECH (update defines?).",boardid);
-        }
+            numBoardResets++;
+    }
+    if (numBoardResets == 0)
+    {
+        startupPhaseEnd(resetPhase);
+        resetPhase = -1;
+    }
 
-        // Store usb dev parameters
-        boardFile.push_back(tmp_fileHandle);  // Store file handle
-        USBBoards.boards.push_back(boardid);  // Store board array index
-        boardFPs[boardid] = tmp_fileHandle;   // Map serial (i) to fileHandle (tmp_fileHandle)
-        USBBoards.activeAtStart++;            // Increment board count
+    if (USBBoards.activeAtStart < armBoardCount()){
+        ROS_ERROR("Error: found %d of the %d arm boards!  Behavior is henceforce undetermined...",
+                  USBBoards.activeAtStart, armBoardCount());
+//        return 0;
+    }
 
+    return USBBoards.activeAtStart;
+}
 
 
-        if ( write_zeros_to_board(boardid) != 0){
-            ROS_ERROR("Warning: failed initial board reset (set-to-zero)");
-        }
+ /**\fn int usbBoardReopen(int id)
+ * \brief close a lost board's file and, if the board is back in /dev, open and reset it as USBInit() does
+ *
+ * On the housekeeping thread, while the board is USB_BOARD_LOST: nothing
+ * else touches its file or ring then (usb_health.h).
+ *
+ * \param id - serial number of the board
+ * \return 0 if the board is open again, -ENODEV if it is not there yet, other negative errno on failure
+ */
+int usbBoardReopen(int id)
+{
+    unsigned char buffer_out[MAX_OUT_LENGTH];
+    vector<string> files;
+    string boardStr;
+
+    if (usb_backend != USB_BACKEND_BOARDS || id <= 0 || id > MAX_BOARD_SERIAL)
+        return -ENODEV;
+
+    // Let go of the old file: the driver frees a gone device on its last close
+    if (boardFPs[id] >= 0)
+    {
+        usbRingDetach(id);
+        for (uint i = 0; i < boardFile.size(); i++)
+            if (boardFile[i] == boardFPs[id])
+                boardFile[i] = -1;
+        close(boardFPs[id]);
+        boardFPs[id] = -1;
     }
 
-    if (okboards < 2){
-        ROS_ERROR("Error: failed to init two boards!  Behavior is henceforce undetermined...");
-//        return 0;
+    getdir(BRL_USB_DEV_DIR, files);
+    for (uint i = 0; i < files.size(); i++)
+        if (get_board_id_from_filename(files[i]) == id)
+            boardStr = string(BRL_USB_DEV_DIR) + files[i];
+    if (boardStr.empty())
+        return -ENODEV;
+
+    int fd = open(boardStr.c_str(), O_RDWR|O_NONBLOCK);
+    if (fd < 0)
+        return -errno;
+
+    // Same reset as at startup; it leaves the encoder counters alone
+    int err = 0;
+    zeroDacPacket(buffer_out);
+    if (ioctl(fd, BRL_RESET_BOARD) != 0)
+        err = -errno;
+    else if (write(fd, buffer_out, OUT_LENGTH) != OUT_LENGTH)
+        err = -USB_WRITE_ERROR;
+    if (err)
+    {
+        close(fd);
+        return err;
     }
-    //Only now we have info about number of boards and set it to number of mechanisms
-    NUM_MECH = USBBoards.activeAtStart;
 
-    return USBBoards.activeAtStart;
+    boardFPs[id] = fd;
+    uint k = 0;
+    while (k < boardFile.size() && boardFile[k] >= 0)
+        k++;
+    if (k < boardFile.size())
+        boardFile[k] = fd;
+    else
+        boardFile.push_back(fd);
+    usbRingAttach(id, fd);
+    return 0;
 }
 
 
@@ -217,9 +553,17 @@ void USBShutdown(void)
 {
     uint i;
 
+    USBInitWait();
+    if (usb_backend == USB_BACKEND_SIM)
+        usbSimShutdown();
+
     //Reset USB driver
+    for (int s = 0; s <= MAX_BOARD_SERIAL; s++)
+        usbRingDetach(s);
     for (i=0;i<boardFile.size();i++)
     {
+        if (boardFile[i] < 0) //Closed when its board was lost
+            continue;
         if (boardFile[i]) //Shutdown configured boards
         {
             if ( ioctl(boardFile[i], BRL_RESET_BOARD) != 0)
@@ -242,6 +586,16 @@ void USBShutdown(void)
  */
 int startUSBRead(int id)
 {
+  if (usb_backend == USB_BACKEND_SIM)
+    return usbSimStartRead(id);
+  if (usb_backend == USB_BACKEND_REPLAY)
+    return 0;
+  if (!usbBoardUp(id))
+    return -ENODEV;
+
+  if (usbRingActive(id))
+    return usbRingRequest(id);
+
   // Initiate read
   int ret = ioctl(boardFPs[id], BRL_START_READ, MAX_IN_LENGTH);
   
@@ -249,6 +603,7 @@ int startUSBRead(int id)
     {
       ret = -errno;
     }
+  usbHealthIo(id, ret);
   return ret;
 }
 
@@ -262,12 +617,20 @@ int startUSBRead(int id)
  */
 int usb_read(int id, void *buffer, size_t len)
 {
+  if (usb_backend == USB_BACKEND_SIM)
+    return usbSimRead(id, buffer, len);
+  if (usb_backend == USB_BACKEND_REPLAY)
+    return usbReplayRead(id, buffer, len);
+  if (!usbBoardUp(id))
+    return -ENODEV;
+
   int fp = boardFPs[id]; // file pointer
   int ret = read(fp, buffer, len);
   if (ret<0)
     {
       ret = -errno;
     }
+  usbHealthIo(id, ret);
   return ret;
 }
 
@@ -281,15 +644,44 @@ int usb_read(int id, void *buffer, size_t len)
  */
 int usb_write(int id, void *buffer, size_t len)
 {
-    // write to board
-    int ret = write(boardFPs[id], buffer, len);
-
-    if (ret < 0)
-      ret = -errno;
+    if (usb_backend == USB_BACKEND_SIM)
+        return usbSimWrite(id, buffer, len);
+    if (usb_backend == USB_BACKEND_REPLAY)
+        return usbReplayWrite(id, buffer, len);
+    if (!usbBoardUp(id))
+        return -ENODEV;
+
+    int ret;
+    if (usbRingActive(id))
+        ret = usbRingWrite(id, buffer, len);
+    else
+    {
+        // write to board
+        ret = write(boardFPs[id], buffer, len);
+        if (ret < 0)
+            ret = -errno;
+    }
+    usbHealthIo(id, ret);
     return ret;
 }
 
 
+/**\fn int usb_board_fd(int id)
+ * \brief get the file descriptor of usb board with serial number id
+ * \param id - serial number of board
+ * \return file descriptor, or -1 if the board was not opened or is lost
+ */
+int usb_board_fd(int id)
+{
+    if (usb_backend == USB_BACKEND_SIM)
+        return usbSimBoardFd(id);
+
+    if (id <= 0 || id > MAX_BOARD_SERIAL || !usbBoardUp(id))
+        return -1;
+    return boardFPs[id];
+}
+
+
  /**\fn int usb_reset_encoders(int boardid)
  * \brief reset the encoder chips on the board
  * \param boardid - serial number of board to reset
@@ -298,6 +690,10 @@ int usb_write(int id, void *buffer, size_t len)
 int usb_reset_encoders(int boardid)
 {
     log_msg("Resetting encoders on board %d", boardid);
+    if (usb_backend == USB_BACKEND_SIM)
+        return usbSimResetEncoders(boardid);
+    if (usb_backend == USB_BACKEND_REPLAY)
+        return 0;
 
     int fp = boardFPs[boardid]; // get file pointer from serial number
     //const size_t USB_MAX_OUT_LEN = 512;
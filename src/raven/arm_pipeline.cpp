@@ -0,0 +1,339 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file arm_pipeline.cpp
+ * \brief Per-arm control pipeline workers.
+ *
+ * One worker thread per mechanism after the first, created at startup and
+ * pinned to its own core.  Each cycle the RT thread publishes the job,
+ * releases the workers, runs mechanism 0 itself and then waits for the
+ * rest.  A job only touches its own mechanism and jblock lanes; anything
+ * shared by all arms is left for the RT thread after the join (see
+ * armPipelineDefer()).
+ *
+ * In spin mode the release is a generation counter and the join a count
+ * of unfinished workers, both polled, so a cycle's handoff costs a few
+ * cache line transfers.  A spinning SCHED_FIFO worker never sleeps, so
+ * its core has to be isolated and RT throttling
+ * (/proc/sys/kernel/sched_rt_runtime_us) off.  Sleep mode uses semaphores,
+ * like the USB workers.
+ *
+ * Each job is claimed once, by its worker or by the RT thread.  A spin mode
+ * join that waits longer than ARM_JOIN_SPIN_NS takes back the jobs no worker
+ * has started, runs them itself, and the pipeline runs serial from then on.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+
+#include "arm_pipeline.h"
+#include "cpu_affinity.h"
+#include "rt_memory.h"
+#include "log.h"
+
+#define ARM_WORKER_PRIORITY 98   // just below rt_process
+#define ARM_JOIN_SPIN_NS 500000  // spin mode: longest join before the RT thread runs the late jobs itself
+
+// arm_worker_slot.claim
+#define ARM_JOB_IDLE     0
+#define ARM_JOB_PENDING  1      // released, not started
+#define ARM_JOB_RUNNING  2      // started by the worker
+
+__thread int arm_worker = -1;
+
+struct arm_worker_slot
+{
+    pthread_t thread;
+    sem_t go;                    // sleep mode: posted by armPipelineRun() to start a job
+    int mech;                    // mechanism run by this worker
+    int cpu;                     // core it is pinned to, -1 if none
+    int result;                  // result of the last job
+    unsigned int start_gen;      // spin mode: job_gen when the worker was created
+    volatile int claim;          // ARM_JOB_*
+};
+
+static struct arm_worker_slot workers[MAX_MECH];
+static int num_workers = 0;
+static int pipeline_mode = ARM_PIPELINE_SERIAL;
+static int wait_spin = 1;
+static volatile int workers_quit = 0;
+static volatile unsigned int job_gen = 0;    // spin mode: bumped to start a job
+static volatile int workers_remaining = 0;
+static sem_t workers_done;                   // sleep mode: posted by the last worker to finish
+static volatile int deferred = 0;            // ARM_DEFER_* bits set by this cycle's jobs
+static int pipeline_failed = 0;              // a join timed out, run serial (RT thread)
+
+// Current job.  Written by the RT thread before the workers are released.
+static arm_job cur_job = NULL;
+static struct device *cur_device = NULL;
+static struct param_pass *cur_params = NULL;
+
+/**\fn int init_arm_pipeline(ros::NodeHandle &n)
+ * \brief read the pipeline parameters.  Call after init_cpu_affinity(), once NUM_MECH is known.
+ * \param n ROS node handle
+ * \return 0
+ */
+int init_arm_pipeline(ros::NodeHandle &n)
+{
+    std::string mode, wait;
+
+    n.param<std::string>("/control_pipeline", mode, "serial");
+    n.param<std::string>("/arm_worker_wait", wait, "spin");
+    pipeline_mode = (mode == "per_arm") ? ARM_PIPELINE_PER_ARM : ARM_PIPELINE_SERIAL;
+    wait_spin = (wait != "sleep");
+
+    if (pipeline_mode == ARM_PIPELINE_PER_ARM && NUM_MECH < 2)
+    {
+        log_msg("Control pipeline: one mechanism, per_arm runs serial");
+        pipeline_mode = ARM_PIPELINE_SERIAL;
+    }
+    if (pipeline_mode == ARM_PIPELINE_PER_ARM && wait_spin)
+    {
+        // Spinning workers need cores of their own, see spinPause()
+        for (int k = 0; k < NUM_MECH-1; k++)
+            if (arm_worker_cpu(k) < 0)
+            {
+                err_msg("ERROR: control_pipeline per_arm with arm_worker_wait spin needs %d cpus_arm_workers.  Running serial.", NUM_MECH-1);
+                pipeline_mode = ARM_PIPELINE_SERIAL;
+                break;
+            }
+    }
+
+    if (pipeline_mode == ARM_PIPELINE_PER_ARM)
+        log_msg("Control pipeline: per_arm, %d workers, %s", NUM_MECH-1, wait_spin ? "spin" : "sleep");
+    else
+        log_msg("Control pipeline: serial");
+    return 0;
+}
+
+/**\fn static void *arm_worker_process(void *arg)
+ * \brief worker thread for one mechanism
+ */
+static void *arm_worker_process(void *arg)
+{
+    struct arm_worker_slot *w = (struct arm_worker_slot *)arg;
+    unsigned int seen = w->start_gen;
+
+    rt_prefault_stack();
+    if (w->cpu >= 0)
+        set_thread_cpu(w->cpu);
+    else
+        set_thread_affinity(ROLE_RT);
+
+    struct sched_param param;
+    param.sched_priority = ARM_WORKER_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        err_msg("Arm worker %d: could not set realtime priority", w->mech);
+
+    arm_worker = w->mech;
+    while (1)
+    {
+        if (wait_spin)
+        {
+            while (job_gen == seen && !workers_quit)
+                spinPause();
+            seen = job_gen;
+            __sync_synchronize();
+        }
+        else
+        {
+            while (sem_wait(&w->go) != 0 && errno == EINTR)
+                ;
+        }
+        if (workers_quit)
+            break;
+
+        if (!__sync_bool_compare_and_swap(&w->claim, ARM_JOB_PENDING, ARM_JOB_RUNNING))
+            continue;           // taken back by a timed out join
+        w->result = cur_job(cur_device, cur_params);
+        w->claim = ARM_JOB_IDLE;
+
+        if (__sync_sub_and_fetch(&workers_remaining, 1) == 0 && !wait_spin)
+            sem_post(&workers_done);
+    }
+
+    return 0;
+}
+
+/**\fn int armPipelineStart(struct device *device0)
+ * \brief start one worker per mechanism after the first, if /control_pipeline is per_arm.  Call after USBInit().
+ * \param device0 pointer to device struct
+ * \return 0 on success (or nothing to start), -1 on failure
+ */
+int armPipelineStart(struct device *device0)
+{
+    if (pipeline_mode != ARM_PIPELINE_PER_ARM)
+        return 0;
+
+    sem_init(&workers_done, 0, 0);
+    workers_quit = 0;
+    cur_device = device0;
+
+    for (int m = 1; m < NUM_MECH && m < MAX_MECH; m++)
+    {
+        struct arm_worker_slot *w = &workers[m-1];
+        w->mech = m;
+        w->cpu = arm_worker_cpu(m-1);
+        w->result = 0;
+        w->claim = ARM_JOB_IDLE;
+        w->start_gen = job_gen;     // before the thread exists, so it cannot miss the first job
+        sem_init(&w->go, 0, 0);
+        if (pthread_create(&w->thread, NULL, arm_worker_process, w) != 0)
+        {
+            err_msg("Could not start the arm worker for mechanism %d", m);
+            armPipelineStop();
+            return -1;
+        }
+        num_workers = m;
+    }
+
+    log_msg("Control pipeline: %d arm workers started", num_workers);
+    return 0;
+}
+
+/**\fn void armPipelineStop(void)
+ * \brief stop and join the workers.  The RT thread must not be in armPipelineRun().
+ */
+void armPipelineStop(void)
+{
+    int count = num_workers;
+
+    num_workers = 0;
+    pipeline_failed = 0;
+    workers_quit = 1;
+    __sync_synchronize();
+    job_gen = job_gen + 1;
+    for (int i = 0; i < count; i++)
+        sem_post(&workers[i].go);
+    for (int i = 0; i < count; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        sem_destroy(&workers[i].go);
+    }
+}
+
+/**\fn int armPipelineActive(void)
+ * \brief true if the workers are running and keeping up
+ */
+int armPipelineActive(void)
+{
+    return num_workers > 0 && !pipeline_failed;
+}
+
+/**\fn static void joinTimedOut(void)
+ * \brief spin mode join past ARM_JOIN_SPIN_NS: run the unstarted jobs here.  RT thread.
+ */
+static void joinTimedOut(void)
+{
+    for (int i = 0; i < num_workers; i++)
+    {
+        struct arm_worker_slot *w = &workers[i];
+        if (!__sync_bool_compare_and_swap(&w->claim, ARM_JOB_PENDING, ARM_JOB_IDLE))
+            continue;
+        err_msg("Arm worker %d did not start its job.  Control pipeline runs serial.", w->mech);
+        arm_worker = w->mech;
+        w->result = cur_job(cur_device, cur_params);
+        arm_worker = -1;
+        __sync_sub_and_fetch(&workers_remaining, 1);
+    }
+    pipeline_failed = 1;
+}
+
+/**\fn int armPipelineRun(arm_job job, struct device *device0, struct param_pass *currParams)
+ * \brief run a job for every mechanism at once, mechanism 0 on the calling RT thread, and wait for all of them
+ * \param job the per-mechanism work; mechFirst() / mechEnd() select its mechanism
+ * \param device0 pointer to device struct
+ * \param currParams the cycle's parameters
+ * \return the first negative job result, else mechanism 0's
+ */
+int armPipelineRun(arm_job job, struct device *device0, struct param_pass *currParams)
+{
+    cur_job = job;
+    cur_device = device0;
+    cur_params = currParams;
+    workers_remaining = num_workers;
+    for (int i = 0; i < num_workers; i++)
+        workers[i].claim = ARM_JOB_PENDING;
+
+    if (wait_spin)
+    {
+        __sync_synchronize();
+        job_gen = job_gen + 1;
+    }
+    else
+        for (int i = 0; i < num_workers; i++)
+            sem_post(&workers[i].go);
+
+    arm_worker = 0;
+    int ret = job(device0, currParams);
+    arm_worker = -1;
+
+    if (wait_spin)
+    {
+        struct timespec t0, t;
+        int timed_out = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (unsigned int spins = 1; workers_remaining != 0; spins++)
+        {
+            spinPause();
+            if (timed_out || (spins & 63) != 0)
+                continue;
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            if ((t.tv_sec - t0.tv_sec) * 1000000000LL + (t.tv_nsec - t0.tv_nsec) > ARM_JOIN_SPIN_NS)
+            {
+                joinTimedOut();     // the jobs already started are left to finish
+                timed_out = 1;
+            }
+        }
+        __sync_synchronize();
+    }
+    else
+        while (sem_wait(&workers_done) != 0 && errno == EINTR)
+            ;
+
+    for (int i = 0; i < num_workers; i++)
+        if (workers[i].result < 0 && ret >= 0)
+            ret = workers[i].result;
+
+    return ret;
+}
+
+/**\fn void armPipelineDefer(int what)
+ * \brief from a job: leave work on every arm's state to the RT thread, after the join
+ * \param what ARM_DEFER_* bits
+ */
+void armPipelineDefer(int what)
+{
+    __sync_fetch_and_or(&deferred, what);
+}
+
+/**\fn int armPipelineTakeDeferred(void)
+ * \brief RT thread, after armPipelineRun(): the work this cycle's jobs left, and clear it
+ * \return ARM_DEFER_* bits
+ */
+int armPipelineTakeDeferred(void)
+{
+    return __sync_fetch_and_and(&deferred, 0);
+}
@@ -0,0 +1,235 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file blackbox.cpp
+ * \brief Estop black box: the last few seconds of control data, dumped on trip.
+ *
+ * States: ARMED (RT records, waiting for a trigger), TRIGGERED (RT records
+ * the post-trigger tail), FROZEN (RT leaves the ring alone, the black box
+ * thread is writing it out).  Only the RT thread moves ARMED -> TRIGGERED ->
+ * FROZEN; only the black box thread moves FROZEN -> ARMED.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <string>
+
+#include "blackbox.h"
+#include "flight_recorder.h"
+#include "console_process.h"
+#include "rt_memory.h"
+#include "cpu_affinity.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern unsigned long int gTime;
+
+#define BB_ARMED      0
+#define BB_TRIGGERED  1
+#define BB_FROZEN     2
+
+static std::string bb_dir;
+static struct fr_record *bb_ring = NULL;
+static u_32 bb_nslots = 0;
+static u_32 bb_post = 0;                 // records after the trigger
+
+static volatile int bb_state = BB_ARMED;
+static u_64 bb_count = 0;                // records in the ring since re-arming
+static u_64 bb_trigger_count = 0;
+static unsigned long bb_trigger_tick = 0;
+static const char *bb_reason = "";
+static sem_t bb_sem;
+
+/**\fn int init_blackbox(ros::NodeHandle &n)
+ * \brief read the black box parameters and allocate the ring
+ * \param n the node handle
+ * \return 0 on success or when the black box is off, -1 if the ring could not be allocated
+ */
+int init_blackbox(ros::NodeHandle &n)
+{
+	int seconds, post_ms;
+
+	n.param("/blackbox_seconds", seconds, 5);
+	n.param("/blackbox_post_ms", post_ms, 500);
+	n.param<std::string>("/blackbox_dir", bb_dir, ".");
+
+	if (seconds <= 0)
+	{
+		log_msg("Estop black box: off");
+		return 0;
+	}
+	bb_nslots = (u_32)seconds * control_rate_hz;
+	bb_post = post_ms > 0 ? MS_TO_TICKS(post_ms) : 0;
+	if (bb_post >= bb_nslots)
+		bb_post = bb_nslots / 2;
+
+	size_t len = (size_t)bb_nslots * sizeof(struct fr_record);
+	bb_ring = (struct fr_record *)malloc(len);
+	if (bb_ring == NULL)
+		return -1;
+	memset(bb_ring, 0, len);
+	rt_prefault(bb_ring, len);
+	sem_init(&bb_sem, 0, 0);
+
+	log_msg("Estop black box: %d s before and %d ms after a trip (%lu MB), dumps in %s",
+			seconds, post_ms, (unsigned long)(len >> 20), bb_dir.c_str());
+	return 0;
+}
+
+/**\fn void blackboxCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+ * \brief record this cycle.  RT safe.
+ * \param dev the robot state, after the DAC packets have been written
+ * \param currParams current parameters
+ * \param rcvdParams master input taken this cycle, or NULL
+ */
+void blackboxCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+{
+	if (bb_ring == NULL || bb_state == BB_FROZEN)
+		return;
+
+	struct fr_record *r = &bb_ring[bb_count % bb_nslots];
+	fillFlightRecord(r, dev, currParams, rcvdParams);
+	r->seq = ++bb_count;
+
+	if (bb_state == BB_TRIGGERED && bb_count - bb_trigger_count >= bb_post)
+	{
+		// blackboxFreeze() may have got there first
+		if (__sync_bool_compare_and_swap(&bb_state, BB_TRIGGERED, BB_FROZEN))
+			sem_post(&bb_sem);
+	}
+}
+
+/**\fn void blackboxTrigger(const char *reason)
+ * \brief an estop tripped: keep the ring.  RT safe.  Ignored while a dump is pending.
+ * \param reason what tripped, a string literal
+ */
+void blackboxTrigger(const char *reason)
+{
+	if (bb_ring == NULL || bb_state != BB_ARMED)
+		return;
+	bb_reason = reason;
+	bb_trigger_tick = gTime;
+	bb_trigger_count = bb_count;
+	__sync_synchronize();
+	bb_state = BB_TRIGGERED;
+}
+
+/**\fn void blackboxFreeze(const char *reason)
+ * \brief the RT thread has stopped: dump the ring as it is, without post-trigger records.  Not for the RT thread.
+ * \param reason what tripped, a string literal (kept if a trigger is already pending)
+ */
+void blackboxFreeze(const char *reason)
+{
+	if (bb_ring == NULL)
+		return;
+	if (__sync_bool_compare_and_swap(&bb_state, BB_ARMED, BB_FROZEN))
+	{
+		bb_reason = reason;
+		bb_trigger_tick = gTime;
+		bb_trigger_count = bb_count;
+	}
+	else if (!__sync_bool_compare_and_swap(&bb_state, BB_TRIGGERED, BB_FROZEN))
+		return;      // a dump is already on its way
+	__sync_synchronize();
+	sem_post(&bb_sem);
+}
+
+/**\fn static int dumpRing(const char *path)
+ * \brief write the frozen ring, oldest record first, as a flight recorder file
+ * \return number of records written, or negative errno
+ */
+static int dumpRing(const char *path)
+{
+	static struct fr_header hdr;
+	static char pad[FR_HEADER_SIZE];
+	u_64 n = bb_count < bb_nslots ? bb_count : bb_nslots;
+	u_64 first = bb_count - n;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0)
+		return -errno;
+
+	initFlightHeader(&hdr, n);
+	hdr.count = n;
+	memset(pad, 0, sizeof(pad));
+	memcpy(pad, &hdr, sizeof(hdr));
+	int ok = write(fd, pad, FR_HEADER_SIZE) == FR_HEADER_SIZE;
+
+	for (u_64 i = 0; ok && i < n; i++)
+	{
+		struct fr_record r = bb_ring[(first + i) % bb_nslots];
+		r.seq = i + 1;        // renumbered: slot i of an n slot file
+		ok = write(fd, &r, sizeof(r)) == sizeof(r);
+	}
+	int err = ok ? 0 : -errno;
+	if (close(fd) < 0 && ok)
+		err = -errno;
+	return err < 0 ? err : (int)n;
+}
+
+/**\fn void* blackbox_process(void*)
+ * \brief Black box thread: writes out the ring after a trip and re-arms.
+ */
+void* blackbox_process(void*)
+{
+	struct timespec timeout;
+	char path[512], stamp[32];
+
+	if (bb_ring == NULL)
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+
+	while (ros::ok() && !r2Killed())
+	{
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += 100000000L;
+		tsnorm(&timeout);
+		sem_timedwait(&bb_sem, &timeout);
+
+		if (bb_state != BB_FROZEN)
+			continue;
+		__sync_synchronize();
+
+		time_t now = time(NULL);
+		strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+		snprintf(path, sizeof(path), "%s/blackbox-%s.r2fr", bb_dir.c_str(), stamp);
+
+		err_msg("Estop (%s) at tick %lu: writing black box to %s", bb_reason, bb_trigger_tick, path);
+		outputRobotState();
+		int n = dumpRing(path);
+		if (n < 0)
+			err_msg("Black box dump failed (%d)", -n);
+		else
+			log_msg("Black box: %d records written", n);
+
+		bb_count = 0;
+		__sync_synchronize();
+		bb_state = BB_ARMED;
+	}
+	return NULL;
+}
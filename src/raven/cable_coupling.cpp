@@ -0,0 +1,669 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cable_coupling.cpp
+ * \brief Forward and inverse cable coupling, one kernel per arm and tool type
+ *
+ * The equations are those fwdMechCableCoupling() and invMechCableCoupling()
+ * always evaluated; here the arm and tool are template parameters, so the
+ * transmission ratios and signs are constants and the tool branches fold
+ * away.  A table of instantiations is indexed once per arm.  By default
+ * the control path runs them as matrix products instead, the matrices read
+ * off the kernels when the tool is set (see buildCouplingMatrix()).
+ */
+
+#include <string.h>
+#include <math.h>
+#include "cable_coupling.h"
+#include "inv_cable_coupling.h"
+#include "log.h"
+#include "tool.h"
+
+/// coupling laws between the insertion axis and the tool capstans
+enum coupling_law {
+	CC_PLAIN = 0,       // no tool / tool adapter pulleys only
+	CC_RII_SQUARE,
+	CC_DAVINCI_SQUARE,
+	CC_GRASPER_8MM,
+	CC_NUM_LAWS
+};
+
+/// transmission ratios of an arm, the values initDOFs() puts in DOF_types[].TR
+template <u_16 ARM> struct arm_tr;
+
+template <> struct arm_tr<GOLD_ARM>
+{
+	static float tr1() { return SHOULDER_TR_GOLD_ARM; }
+	static float tr2() { return ELBOW_TR_GOLD_ARM; }
+	static float tr3() { return TOOL_ROT_TR_GOLD_ARM; }
+	static float tr4() { return Z_INS_TR_GOLD_ARM; }
+	static float tr5() { return WRIST_TR_GOLD_ARM; }
+	static float tr6() { return GRASP1_TR_GOLD_ARM; }
+	static float tr7() { return GRASP2_TR_GOLD_ARM; }
+};
+
+template <> struct arm_tr<GREEN_ARM>
+{
+	static float tr1() { return SHOULDER_TR_GREEN_ARM; }
+	static float tr2() { return ELBOW_TR_GREEN_ARM; }
+	static float tr3() { return TOOL_ROT_TR_GREEN_ARM; }
+	static float tr4() { return Z_INS_TR_GREEN_ARM; }
+	static float tr5() { return WRIST_TR_GREEN_ARM; }
+	static float tr6() { return GRASP1_TR_GOLD_ARM; }    // as initDOFs() sets it
+	static float tr7() { return GRASP2_TR_GREEN_ARM; }
+};
+
+/**\fn template <u_16 ARM, int LAW> static void fwdCouplingKernel(struct mechanism *mech)
+ * \brief motor positions to joint positions for one arm and coupling law
+ */
+template <u_16 ARM, int LAW>
+static void fwdCouplingKernel(struct mechanism *mech)
+{
+	typedef arm_tr<ARM> tr;
+	float th1, th2, th3, th5, th6, th7;
+	float th1_dot, th2_dot;
+	float d4;
+	float d4_dot;
+
+	float m1 = mech->joint[SHOULDER].mpos;
+	float m2 = mech->joint[ELBOW].mpos;
+	float m3 = mech->joint[TOOL_ROT].mpos;
+	float m4 = mech->joint[Z_INS].mpos;
+	float m5 = mech->joint[WRIST].mpos;
+	float m6 = mech->joint[GRASP1].mpos;
+	float m7 = mech->joint[GRASP2].mpos;
+
+	float m1_dot = mech->joint[SHOULDER].mvel;
+	float m2_dot = mech->joint[ELBOW].mvel;
+	float m4_dot = mech->joint[Z_INS].mvel;
+
+	// Forward Cable Coupling equations
+	//   Originally based on 11/7/2005, Mitch notebook pg. 169
+	//   Updated from UCSC code.  Code simplified by HK 8/11
+	th1 = (1.0/tr::tr1()) * m1;
+	th2 = (1.0/tr::tr2()) * m2 - CABLE_COUPLING_01 * th1;
+	d4  = (1.0/tr::tr4()) * m4 - CABLE_COUPLING_02 * th1 - CABLE_COUPLING_12 * th2;
+
+	// TODO:: Update with new cable coupling terms
+	th1_dot = (1.0/tr::tr1()) * m1_dot;
+	th2_dot = (1.0/tr::tr2()) * m2_dot;
+	d4_dot  = (1.0/tr::tr4()) * m4_dot;
+
+	// Tool degrees of freedom ===========================================
+	if (LAW == CC_RII_SQUARE)
+	{
+		int sgn = -1;
+		th3 = (1.0/tr::tr3()) * (m3 - sgn*m4/GB_RATIO);
+		th5 = (1.0/tr::tr5()) * (m5 - sgn*m4/GB_RATIO);
+		th6 = (1.0/tr::tr6()) * (m6 - sgn*m4/GB_RATIO);
+		th7 = (1.0/tr::tr7()) * (m7 - sgn*m4/GB_RATIO);
+	}
+	else if (LAW == CC_DAVINCI_SQUARE)
+	{
+		int sgn = -1;
+		th3 = (1.0/tr::tr3()) * (m3 - sgn*m4/GB_RATIO);
+		th5 = (1.0/tr::tr5()) * (m5 - sgn*m4/GB_RATIO);
+		th6 = (1.0/tr::tr6()) * (m6 - sgn*m4/GB_RATIO) - th5/2;
+		th7 = (1.0/tr::tr7()) * (m7 - sgn*m4/GB_RATIO) + th5/2;
+	}
+	else if (LAW == CC_GRASPER_8MM)
+	{
+		// Note: sign of the last term changes for GOLD vs GREEN arm
+		int sgn = (ARM == GOLD_ARM) ? 1 : -1;
+		float tr5 = tr::tr5(), tr6 = tr::tr6();
+		th3 = (1.0/tr::tr3()) * (m3 - m4/GB_RATIO);
+		th5 = (1.0/tr5) * (m5 - m4/GB_RATIO);
+		th6 = (1.0/tr6) * (m6 - m4/GB_RATIO - sgn * (tr5*th5) * (tr5/tr6));
+		th7 = (1.0/tr::tr7()) * (m7 - m4/GB_RATIO + sgn *(tr5*th5) * (tr5/tr6));
+	}
+	else
+	{
+		// coupling goes until the tool adapter pulleys
+		th3 = (1.0/tr::tr3()) * (m3 - m4/GB_RATIO);
+		th5 = (1.0/tr::tr5()) * (m5 - m4/GB_RATIO);
+		th6 = (1.0/tr::tr6()) * (m6 - m4/GB_RATIO);
+		th7 = (1.0/tr::tr7()) * (m7 - m4/GB_RATIO);
+	}
+
+	// Now have solved for th1, th2, d3, th4, th5, th6
+	mech->joint[SHOULDER].jpos = th1;
+	mech->joint[ELBOW].jpos    = th2;
+	mech->joint[TOOL_ROT].jpos = th3;
+	mech->joint[Z_INS].jpos    = d4;
+	mech->joint[WRIST].jpos    = th5;
+	mech->joint[GRASP1].jpos   = th6;
+	mech->joint[GRASP2].jpos   = th7;
+
+	mech->joint[SHOULDER].jvel = th1_dot;
+	mech->joint[ELBOW].jvel    = th2_dot;
+	mech->joint[Z_INS].jvel    = d4_dot;
+}
+
+/**\fn template <u_16 ARM, int LAW> static void invCouplingKernel(struct mechanism *mech, int no_use_actual)
+ * \brief desired joint positions to desired motor positions for one arm and coupling law
+ */
+template <u_16 ARM, int LAW>
+static void invCouplingKernel(struct mechanism *mech, int no_use_actual)
+{
+	typedef arm_tr<ARM> tr;
+	float m1, m2, m3, m4, m5, m6, m7;
+
+	float th1 = mech->joint[SHOULDER].jpos_d;
+	float th2 = mech->joint[ELBOW].jpos_d;
+	float th3 = mech->joint[TOOL_ROT].jpos_d;
+	float d4  = mech->joint[Z_INS].jpos_d;
+	float th5 = mech->joint[WRIST].jpos_d;
+	float th6 = mech->joint[GRASP1].jpos_d;
+	float th7 = mech->joint[GRASP2].jpos_d;
+
+	m1 = tr::tr1() * th1;
+	m2 = tr::tr2() * (th2 + CABLE_COUPLING_01*th1);
+	m4 = tr::tr4() * (d4 + CABLE_COUPLING_02*th1 + CABLE_COUPLING_12*th2);
+
+	// Use the current joint position for cable coupling
+	float m4_actual = mech->joint[Z_INS].mpos;
+
+	if (no_use_actual)
+		m4_actual = m4;
+
+	if (LAW == CC_RII_SQUARE)
+	{
+		int sgn = -1;
+		m3 = tr::tr3() * th3 + sgn * m4_actual/GB_RATIO;
+		m5 = tr::tr5() * th5 + sgn * m4_actual/GB_RATIO;
+		m6 = tr::tr6() * th6 + sgn * m4_actual/GB_RATIO;
+		m7 = tr::tr7() * th7 + sgn * m4_actual/GB_RATIO;
+	}
+	else if (LAW == CC_DAVINCI_SQUARE)
+	{
+		int sgn = -1;
+		m3 = tr::tr3() * th3 + sgn * m4_actual/GB_RATIO;
+		m5 = tr::tr5() * th5 + sgn * m4_actual/GB_RATIO;
+		m6 = tr::tr6() * (th6 + th5/2) + sgn * m4_actual/GB_RATIO;
+		m7 = tr::tr7() * (th7 - th5/2) + sgn * m4_actual/GB_RATIO;
+	}
+	else if (LAW == CC_GRASPER_8MM)
+	{
+		// Note: sign of the last term changes for GOLD vs GREEN arm
+		int sgn = (ARM == GOLD_ARM) ? 1 : -1;
+		float tr5 = tr::tr5(), tr6 = tr::tr6();
+		m3 = tr::tr3() * th3 + m4_actual/GB_RATIO;
+		m5 = tr5 * th5 + m4_actual/GB_RATIO;
+		m6 = tr6 * th6 + m4/GB_RATIO + sgn * (tr5 * th5) * (tr5/tr6);
+		m7 = tr::tr7() * th7 + m4/GB_RATIO - sgn * (tr5 * th5) * (tr5/tr6);
+	}
+	else
+	{
+		// coupling goes until the tool adapter pulleys
+		m3 = tr::tr3() * th3 + m4_actual/GB_RATIO;
+		m5 = tr::tr5() * th5 + m4_actual/GB_RATIO;
+		m6 = tr::tr6() * th6 + m4/GB_RATIO;
+		m7 = tr::tr7() * th7 + m4/GB_RATIO;
+	}
+
+	/*Now have solved for desired motor positions mpos_d*/
+	mech->joint[SHOULDER].mpos_d = m1;
+	mech->joint[ELBOW].mpos_d    = m2;
+	mech->joint[TOOL_ROT].mpos_d = m3;
+	mech->joint[Z_INS].mpos_d    = m4;
+	mech->joint[WRIST].mpos_d    = m5;
+	mech->joint[GRASP1].mpos_d   = m6;
+	mech->joint[GRASP2].mpos_d   = m7;
+}
+
+#define CC_ARM_KERNELS(ARM, K) \
+	{ K<ARM, CC_PLAIN>, K<ARM, CC_RII_SQUARE>, K<ARM, CC_DAVINCI_SQUARE>, K<ARM, CC_GRASPER_8MM> }
+
+static const fwd_coupling_fn fwd_kernels[2][CC_NUM_LAWS] = {
+	CC_ARM_KERNELS(GOLD_ARM, fwdCouplingKernel),
+	CC_ARM_KERNELS(GREEN_ARM, fwdCouplingKernel)
+};
+
+static const inv_coupling_fn inv_kernels[2][CC_NUM_LAWS] = {
+	CC_ARM_KERNELS(GOLD_ARM, invCouplingKernel),
+	CC_ARM_KERNELS(GREEN_ARM, invCouplingKernel)
+};
+
+// Kernels in use, per arm slot (see armSlot())
+static struct coupling_kernels coupling_sel[2];
+
+// Use the matrix form of the coupling, see buildCouplingMatrix()
+static bool cc_use_matrix = true;
+
+/**\fn static int armSlot(u_16 type)
+ * \return 0 for the gold arm, 1 for the green arm, -1 for anything else
+ */
+static inline int armSlot(u_16 type)
+{
+	if (type == GOLD_ARM)
+		return 0;
+	if (type == GREEN_ARM)
+		return 1;
+	return -1;
+}
+
+/**\fn static int couplingLaw(e_tool_type tool)
+ * \brief the coupling law a tool type gets
+ *
+ * TOOL_GRASPER_10MM and ricks_tools_type get the plain law: the old if/else
+ * chain ended in it for both (the 10 mm branch was always overwritten).
+ */
+static int couplingLaw(e_tool_type tool)
+{
+	switch (tool)
+	{
+	case RII_square_type:
+		return CC_RII_SQUARE;
+	case davinci_square_type:
+		return CC_DAVINCI_SQUARE;
+	case TOOL_GRASPER_8MM:
+		return CC_GRASPER_8MM;
+	default:
+		return CC_PLAIN;
+	}
+}
+
+/*
+ * Matrix form.  Every law above is linear, and has the same shape: the
+ * shoulder, elbow and insertion are a 3x3 block of their motors, and each
+ * tool joint follows its own capstan, the insertion motor and the wrist:
+ *
+ *   jpos[0..2] = A mpos[0..2]
+ *   jpos[t]    = own[t] (mpos[t] + ins[t] mpos[Z_INS]) + wrist[t] jpos[WRIST]
+ *
+ * The coefficients are read off the forward kernel one unit motor angle at
+ * a time, and the inverse is solved from them, so the two directions agree
+ * by construction.  With the desired insertion motor angle m4 in place of
+ * the measured one that gives mpos_d; the tool capstans that follow the
+ * measured insertion add act[t] (m4_actual - m4).  The inverse kernel is
+ * only used to find act and to check the solved inverse.  The four tool
+ * joints are one vector.
+ */
+
+#define CC_TOOL0  TOOL_ROT          // first of the four tool joints, TOOL_ROT..GRASP2
+#define CC_NTOOL  4
+
+typedef float cc_vf __attribute__ ((vector_size (4 * CC_NTOOL)));
+
+/// one value per tool joint; v for arithmetic, s[] joint by joint
+union cc_tool
+{
+	cc_vf v;
+	float s[CC_NTOOL];
+};
+
+/// linear coupling of one arm and law, see above
+struct coupling_matrix
+{
+	int valid;
+	float fwd_arm[3][3];        // jpos of SHOULDER, ELBOW, Z_INS per unit motor angle
+	float fwd_vel[3][3];        // their jvel per unit motor velocity
+	union cc_tool fwd_own;      // tool jpos per unit of its own capstan
+	union cc_tool fwd_ins;      // per unit of the insertion motor, relative to fwd_own
+	union cc_tool fwd_wrist;    // per unit of the wrist's jpos
+	float inv_arm[3][3];        // mpos_d of SHOULDER, ELBOW, Z_INS per unit jpos_d
+	union cc_tool inv_own;      // per unit of the tool joint's jpos_d
+	union cc_tool inv_ins;      // per unit of the desired insertion motor angle
+	union cc_tool inv_wrist;    // per unit of the wrist's jpos_d
+	union cc_tool act;          // per unit of (measured - desired) insertion motor angle
+};
+
+static struct coupling_matrix cc_matrix[2][CC_NUM_LAWS];
+
+#define CC_MATRIX_ZERO_TOL  1e-9    // a probed coefficient this small is a structural zero
+#define CC_MATRIX_CHECK_TOL 1e-5    // relative disagreement of the solved inverse and the inverse kernel
+
+/**\fn static inline void fwdCouplingMatrixApply(const struct coupling_matrix *cm, struct mechanism *mech)
+ * \brief jpos (and jvel of the positioning joints) from the motors, as fwdCouplingKernel()
+ */
+static inline void fwdCouplingMatrixApply(const struct coupling_matrix *cm, struct mechanism *mech)
+{
+	float m[3], mv[3];
+	for (int c = 0; c <= Z_INS; c++)
+	{
+		m[c]  = mech->joint[c].mpos;
+		mv[c] = mech->joint[c].mvel;
+	}
+	for (int r = 0; r <= Z_INS; r++)
+	{
+		mech->joint[r].jpos = cm->fwd_arm[r][0]*m[0] + cm->fwd_arm[r][1]*m[1] + cm->fwd_arm[r][2]*m[2];
+		mech->joint[r].jvel = cm->fwd_vel[r][0]*mv[0] + cm->fwd_vel[r][1]*mv[1] + cm->fwd_vel[r][2]*mv[2];
+	}
+
+	union cc_tool mt, th;
+	for (int i = 0; i < CC_NTOOL; i++)
+		mt.s[i] = mech->joint[CC_TOOL0 + i].mpos;
+	th.v = cm->fwd_own.v * (mt.v + cm->fwd_ins.v * m[Z_INS]);
+	th.v += cm->fwd_wrist.v * th.s[WRIST - CC_TOOL0];
+	for (int i = 0; i < CC_NTOOL; i++)
+		mech->joint[CC_TOOL0 + i].jpos = th.s[i];
+}
+
+/**\fn static inline void invCouplingMatrixApply(const struct coupling_matrix *cm, struct mechanism *mech, int no_use_actual)
+ * \brief mpos_d from jpos_d, as invCouplingKernel()
+ */
+static inline void invCouplingMatrixApply(const struct coupling_matrix *cm, struct mechanism *mech, int no_use_actual)
+{
+	float th[3];
+	for (int c = 0; c <= Z_INS; c++)
+		th[c] = mech->joint[c].jpos_d;
+	for (int r = 0; r <= Z_INS; r++)
+		mech->joint[r].mpos_d = cm->inv_arm[r][0]*th[0] + cm->inv_arm[r][1]*th[1] + cm->inv_arm[r][2]*th[2];
+	float m4 = mech->joint[Z_INS].mpos_d;
+
+	union cc_tool tt, mt;
+	for (int i = 0; i < CC_NTOOL; i++)
+		tt.s[i] = mech->joint[CC_TOOL0 + i].jpos_d;
+	mt.v = cm->inv_own.v * tt.v + cm->inv_ins.v * m4 + cm->inv_wrist.v * mech->joint[WRIST].jpos_d;
+
+	// Use the current joint position for cable coupling
+	if (!no_use_actual)
+		mt.v += cm->act.v * (mech->joint[Z_INS].mpos - m4);
+
+	/*Now have solved for desired motor positions mpos_d*/
+	for (int i = 0; i < CC_NTOOL; i++)
+		mech->joint[CC_TOOL0 + i].mpos_d = mt.s[i];
+}
+
+/**\fn static int invert3(const float A[3][3], float B[3][3])
+ * \brief B = A^-1 for a 3x3, in double
+ * \return 0, or -1 if A is singular
+ */
+static int invert3(const float A[3][3], float B[3][3])
+{
+	double c[3][3];
+	for (int r = 0; r < 3; r++)
+		for (int k = 0; k < 3; k++)
+			c[r][k] = (double)A[(k+1)%3][(r+1)%3] * A[(k+2)%3][(r+2)%3] -
+					  (double)A[(k+1)%3][(r+2)%3] * A[(k+2)%3][(r+1)%3];
+	double det = A[0][0]*c[0][0] + A[0][1]*c[1][0] + A[0][2]*c[2][0];
+	if (fabs(det) < 1e-12)
+		return -1;
+	for (int r = 0; r < 3; r++)
+		for (int k = 0; k < 3; k++)
+			B[r][k] = c[r][k] / det;
+	return 0;
+}
+
+/**\fn static int buildCouplingMatrix(int slot, int law, u_16 type)
+ * \brief fill cc_matrix[slot][law] from that arm and law's kernels
+ * \return 0, or -1 if the kernels do not have the shape above or cannot be inverted
+ */
+static int buildCouplingMatrix(int slot, int law, u_16 type)
+{
+	struct coupling_matrix *cm = &cc_matrix[slot][law];
+	struct mechanism probe;
+	float F[MAX_DOF_PER_MECH][MAX_DOF_PER_MECH];    // F[r][c]: jpos r per unit mpos c
+	float V[3][3];
+
+	// Forward: one motor at a time
+	cm->valid = 0;
+	for (int c = 0; c < MAX_DOF_PER_MECH; c++)
+	{
+		memset(&probe, 0, sizeof(probe));
+		probe.type = type;
+		probe.joint[c].mpos = 1;
+		probe.joint[c].mvel = 1;
+		if (c != NO_CONNECTION)
+			fwd_kernels[slot][law](&probe);
+		for (int r = 0; r < MAX_DOF_PER_MECH; r++)
+			F[r][c] = (c != NO_CONNECTION) ? probe.joint[r].jpos : 0;
+		for (int r = 0; c <= Z_INS && r <= Z_INS; r++)
+			V[r][c] = probe.joint[r].jvel;
+	}
+
+	// The shape: anything outside it has to be zero
+	for (int r = 0; r < MAX_DOF_PER_MECH; r++)
+		for (int c = 0; c < MAX_DOF_PER_MECH; c++)
+		{
+			bool in_shape = (r <= Z_INS) ? (c <= Z_INS) :
+							(r == NO_CONNECTION) ? false : (c == r || c == Z_INS || c == WRIST);
+			if (!in_shape && fabs(F[r][c]) > CC_MATRIX_ZERO_TOL)
+			{
+				err_msg("Cable coupling: arm %d law %d: joint %d follows motor %d, using the scalar kernels", type, law, r, c);
+				return -1;
+			}
+		}
+
+	for (int r = 0; r <= Z_INS; r++)
+		for (int c = 0; c <= Z_INS; c++)
+		{
+			cm->fwd_arm[r][c] = F[r][c];
+			cm->fwd_vel[r][c] = V[r][c];
+		}
+	for (int i = 0; i < CC_NTOOL; i++)
+	{
+		int t = CC_TOOL0 + i;
+		double w = (t == WRIST || F[WRIST][WRIST] == 0) ? 0 : (double)F[t][WRIST] / F[WRIST][WRIST];
+		cm->fwd_own.s[i]   = F[t][t];
+		cm->fwd_wrist.s[i] = w;
+		cm->fwd_ins.s[i]   = (F[t][t] != 0) ? (F[t][Z_INS] - w * F[WRIST][Z_INS]) / F[t][t] : 0;
+	}
+
+	// Inverse: the 3x3 block, then the wrist, then the tool joints that lean on it
+	if (invert3(cm->fwd_arm, cm->inv_arm) < 0)
+	{
+		err_msg("Cable coupling: arm %d law %d is singular, using the scalar kernels", type, law);
+		return -1;
+	}
+	double a5 = F[WRIST][WRIST], b5 = F[WRIST][Z_INS];
+	for (int i = 0; i < CC_NTOOL; i++)
+	{
+		int t = CC_TOOL0 + i;
+		double a = F[t][t], b = F[t][Z_INS];
+		double c = (t == WRIST) ? 0 : F[t][WRIST];
+		if (fabs(a) < 1e-12 || fabs(a5) < 1e-12)
+		{
+			err_msg("Cable coupling: arm %d law %d is singular, using the scalar kernels", type, law);
+			return -1;
+		}
+		cm->inv_own.s[i]   = 1 / a;
+		cm->inv_wrist.s[i] = -c / (a * a5);
+		cm->inv_ins.s[i]   = -b / a + c * b5 / (a * a5);
+	}
+
+	// Measured insertion: what the tool capstans get for one radian of it with nothing desired
+	memset(&probe, 0, sizeof(probe));
+	probe.type = type;
+	probe.joint[Z_INS].mpos = 1;
+	inv_kernels[slot][law](&probe, 0);
+	for (int i = 0; i < CC_NTOOL; i++)
+		cm->act.s[i] = probe.joint[CC_TOOL0 + i].mpos_d;
+
+	cm->valid = 1;
+
+	// The solved inverse should be what the inverse kernel computes
+	double worst = 0;
+	for (int c = 0; c < MAX_DOF_PER_MECH; c++)
+	{
+		if (c == NO_CONNECTION)
+			continue;
+		struct mechanism k, m;
+		memset(&k, 0, sizeof(k));
+		k.type = type;
+		k.joint[c].jpos_d = 1;
+		m = k;
+		inv_kernels[slot][law](&k, 1);
+		invCouplingMatrixApply(cm, &m, 1);
+		for (int r = 0; r < MAX_DOF_PER_MECH; r++)
+			if (r != NO_CONNECTION)
+				worst = fmax(worst, fabs(k.joint[r].mpos_d - m.joint[r].mpos_d) / (fabs(k.joint[r].mpos_d) + 1));
+	}
+	if (worst > CC_MATRIX_CHECK_TOL)
+		err_msg("Cable coupling: arm %d law %d: inverse kernel differs from the solved inverse by %g", type, law, worst);
+
+	return 0;
+}
+
+/**\fn static inline const struct coupling_matrix *mechMatrix(struct mechanism *mech)
+ * \brief the matrices selectCouplingKernels() picked for the mechanism's arm
+ */
+static inline const struct coupling_matrix *mechMatrix(struct mechanism *mech)
+{
+	return coupling_sel[armSlot(mech->type)].matrix;
+}
+
+/**\fn static void fwdCouplingMatrix(struct mechanism *mech)
+ * \brief fwd_coupling_fn of the matrix form
+ */
+static void fwdCouplingMatrix(struct mechanism *mech)
+{
+	fwdCouplingMatrixApply(mechMatrix(mech), mech);
+}
+
+/**\fn static void invCouplingMatrix(struct mechanism *mech, int no_use_actual)
+ * \brief inv_coupling_fn of the matrix form
+ */
+static void invCouplingMatrix(struct mechanism *mech, int no_use_actual)
+{
+	invCouplingMatrixApply(mechMatrix(mech), mech, no_use_actual);
+}
+
+/**\fn int selectCouplingKernels(struct mechanism *mech)
+ * \brief pick the coupling kernels for the mechanism's arm and tool type
+ *
+ * Called once the tool type is known (initDOFs()); getCouplingKernels()
+ * calls it again if the type or tool changes afterwards.  With
+ * /cable_coupling_matrix (the default) the kernels are the matrix products,
+ * the arm and law's matrices built the first time they are picked.
+ *
+ * \param mech - the arm
+ * \return 0 on success, -1 for an unknown arm type
+ */
+int selectCouplingKernels(struct mechanism *mech)
+{
+	int slot = armSlot(mech->type);
+	if (slot < 0)
+		return -1;
+
+	int law = couplingLaw(mech->tool_type);
+	struct coupling_kernels *cc = &coupling_sel[slot];
+	cc->type      = mech->type;
+	cc->tool_type = mech->tool_type;
+	cc->gen++;
+
+	struct coupling_matrix *cm = &cc_matrix[slot][law];
+	if (cc_use_matrix && (cm->valid || buildCouplingMatrix(slot, law, mech->type) == 0))
+	{
+		cc->matrix = cm;
+		cc->fwd    = fwdCouplingMatrix;
+		cc->inv    = invCouplingMatrix;
+	}
+	else
+	{
+		cc->matrix = NULL;
+		cc->fwd    = fwd_kernels[slot][law];
+		cc->inv    = inv_kernels[slot][law];
+	}
+	return 0;
+}
+
+/**\fn const struct coupling_kernels *getCouplingKernels(struct mechanism *mech)
+ * \brief the coupling kernels of a mechanism
+ * \param mech - the arm
+ * \return the kernels, or NULL for an unknown arm type
+ */
+const struct coupling_kernels *getCouplingKernels(struct mechanism *mech)
+{
+	int slot = armSlot(mech->type);
+	if (slot < 0)
+		return NULL;
+
+	struct coupling_kernels *cc = &coupling_sel[slot];
+	if (cc->fwd == NULL || cc->tool_type != mech->tool_type)
+		selectCouplingKernels(mech);
+	return cc;
+}
+
+// Skip the inverse coupling while its inputs hold still (see invCouplingIfChanged())
+static bool cc_skip_idle = true;
+#define CC_IDLE_EPS 1e-7    // rad, m; in jpos_d and the measured insertion
+
+/// inputs and outputs of one mechanism's last inverse coupling
+struct inv_coupling_cache
+{
+	int valid;
+	unsigned int gen;       // coupling_kernels::gen it was computed with
+	float jpos_d[MAX_DOF_PER_MECH];
+	float mpos_ins;
+	float mpos_d[MAX_DOF_PER_MECH];
+};
+
+static struct inv_coupling_cache inv_last[MAX_MECH];
+
+/**\fn int init_cable_coupling(ros::NodeHandle &n)
+ * \brief read the coupling parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_cable_coupling(ros::NodeHandle &n)
+{
+	n.param("/skip_when_idle", cc_skip_idle, true);
+	n.param("/cable_coupling_matrix", cc_use_matrix, true);
+	log_msg("Cable coupling: skip when idle %s, %s", cc_skip_idle ? "on" : "off",
+			cc_use_matrix ? "matrix form" : "scalar kernels");
+
+	// Re-pick on next use, with the form just read
+	for (int i = 0; i < 2; i++)
+		coupling_sel[i].fwd = NULL;
+	return 0;
+}
+
+/**\fn void invCouplingIfChanged(int m, struct mechanism *mech)
+ * \brief invMechCableCoupling(), unless jpos_d, the measured insertion and the kernel selection are as last cycle
+ *
+ * In that case last cycle's mpos_d are put back instead.
+ *
+ * \param m - index of the mechanism in the device
+ * \param mech - the mechanism
+ */
+void invCouplingIfChanged(int m, struct mechanism *mech)
+{
+	const struct coupling_kernels *cc = getCouplingKernels(mech);
+	if (!cc_skip_idle || cc == NULL || m < 0 || m >= MAX_MECH)
+	{
+		invMechCableCoupling(mech);
+		return;
+	}
+
+	struct inv_coupling_cache *c = &inv_last[m];
+	bool same = c->valid && c->gen == cc->gen &&
+				fabs(c->mpos_ins - mech->joint[Z_INS].mpos) <= CC_IDLE_EPS;
+	for (int i = 0; same && i < MAX_DOF_PER_MECH; i++)
+		same = fabs(c->jpos_d[i] - mech->joint[i].jpos_d) <= CC_IDLE_EPS;
+
+	if (same)
+	{
+		for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+			mech->joint[i].mpos_d = c->mpos_d[i];
+		return;
+	}
+
+	cc->inv(mech, 0);
+
+	c->valid = 1;
+	c->gen = cc->gen;
+	c->mpos_ins = mech->joint[Z_INS].mpos;
+	for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+	{
+		c->jpos_d[i] = mech->joint[i].jpos_d;
+		c->mpos_d[i] = mech->joint[i].mpos_d;
+	}
+}
@@ -0,0 +1,373 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file calibration.cpp
+ * \brief Encoder calibration kept across restarts of the control process.
+ *
+ * The RT thread owns cal_live: it fills it in while an arm is homed, reads
+ * it back at the next homing, and publishes a copy through a sequence
+ * counter once a second.  The calibration thread compares that copy with
+ * what it last wrote and rewrites the file (write to a temporary, rename)
+ * only when an offset changed or a count moved an eighth of a motor turn.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <string>
+
+#include "calibration.h"
+#include "USB_init.h"
+#include "state_estimate.h"
+#include "fwd_cable_coupling.h"
+#include "crc32c.h"
+#include "cpu_affinity.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern int NUM_MECH;
+extern unsigned long int gTime;
+extern USBStruct USBBoards;
+extern struct DOF_type DOF_types[];
+
+#define CAL_MAGIC    "R2CALIB"
+#define CAL_VERSION  1
+#define CAL_BOOT_ID  40
+
+struct cal_mech
+{
+	int valid;                      // homed, and not rejected since
+	int board_serial;
+	int mech_type;
+	int tool_type;
+	int enc_offset[MAX_DOF_PER_MECH];
+	int enc_val[MAX_DOF_PER_MECH];  // last counts seen
+};
+
+struct cal_file
+{
+	char magic[8];
+	u_32 version;
+	u_32 num_mech;
+	char boot_id[CAL_BOOT_ID];
+	u_64 saved_realtime_ns;
+	struct cal_mech mech[MAX_MECH];
+	u_32 crc;                       // crc32c of everything before
+};
+
+static std::string cal_name;
+static int cal_max_drift = 2 * ENC_CNTS_PER_REV;
+static char cal_boot_id[CAL_BOOT_ID];
+
+static struct cal_mech cal_live[MAX_MECH];      // RT thread only
+static unsigned long cal_last_capture = 0;
+
+static volatile unsigned int cal_seq = 0;       // odd while cal_shared is being written
+static struct cal_mech cal_shared[MAX_MECH];
+static sem_t cal_sem;
+
+/**\fn static void readBootId(char *out)
+ * \brief the kernel's boot id: the boards are USB powered, so a reboot resets their counters
+ */
+static void readBootId(char *out)
+{
+	memset(out, 0, CAL_BOOT_ID);
+	FILE *f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (f == NULL)
+		return;
+	if (fgets(out, CAL_BOOT_ID, f) == NULL)
+		out[0] = 0;
+	fclose(f);
+	out[strcspn(out, "\n")] = 0;
+}
+
+/**\fn static u_32 calCrc(const struct cal_file *c)
+ */
+static u_32 calCrc(const struct cal_file *c)
+{
+	return crc32c(0, c, offsetof(struct cal_file, crc));
+}
+
+/**\fn int init_calibration(ros::NodeHandle &n)
+ * \brief read the parameters and load the last calibration, if it is from this boot
+ * \param n the node handle
+ * \return 0
+ */
+int init_calibration(ros::NodeHandle &n)
+{
+	double drift;
+	n.param<std::string>("/calibration_file", cal_name, "raven_calibration.dat");
+	n.param("/calibration_max_drift_revs", drift, 2.0);
+
+	cal_max_drift = (int)(drift * ENC_CNTS_PER_REV);
+	memset(cal_live, 0, sizeof(cal_live));
+	sem_init(&cal_sem, 0, 0);
+	readBootId(cal_boot_id);
+
+	if (cal_name.empty())
+	{
+		log_msg("Calibration store: off, every start homes");
+		return 0;
+	}
+
+	struct cal_file c;
+	int fd = open(cal_name.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		log_msg("Calibration store: no %s, homing", cal_name.c_str());
+		return 0;
+	}
+	int ok = read(fd, &c, sizeof(c)) == sizeof(c);
+	close(fd);
+
+	if (!ok || memcmp(c.magic, CAL_MAGIC, 8) != 0 || c.version != CAL_VERSION || c.crc != calCrc(&c))
+		err_msg("Calibration store: %s is not a calibration file, ignored", cal_name.c_str());
+	else if (cal_boot_id[0] == 0 || strncmp(c.boot_id, cal_boot_id, CAL_BOOT_ID) != 0)
+		log_msg("Calibration store: %s is from before a reboot, homing", cal_name.c_str());
+	else
+	{
+		for (int m = 0; m < MAX_MECH && m < (int)c.num_mech; m++)
+			cal_live[m] = c.mech[m];
+		log_msg("Calibration store: loaded %s (max drift %.1f motor turns)", cal_name.c_str(), drift);
+	}
+	return 0;
+}
+
+/**\fn static int mechHomed(struct mechanism *mech)
+ * \return 1 if every joint of the arm is ready
+ */
+static int mechHomed(struct mechanism *mech)
+{
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		if (mech->joint[j].state != jstate_ready)
+			return 0;
+	return 1;
+}
+
+/**\fn static void publishCalibration()
+ * \brief hand cal_live to the calibration thread.  RT safe.
+ */
+static void publishCalibration()
+{
+	cal_seq++;
+	__sync_synchronize();
+	memcpy(cal_shared, cal_live, sizeof(cal_shared));
+	__sync_synchronize();
+	cal_seq++;
+	sem_post(&cal_sem);
+}
+
+/**\fn void calibrationCapture(struct device *dev)
+ * \brief once a second, take the offsets and counts of every homed arm.  RT safe.
+ * \param dev the robot state
+ */
+void calibrationCapture(struct device *dev)
+{
+	if (cal_name.empty() || gTime - cal_last_capture < MS_TO_TICKS(1000))
+		return;
+	cal_last_capture = gTime;
+
+	for (int m = 0; m < NUM_MECH && m < MAX_MECH; m++)
+	{
+		struct mechanism *mech = &dev->mech[m];
+		struct cal_mech *c = &cal_live[m];
+
+		if (!mechHomed(mech))
+			continue;
+		c->valid = 1;
+		c->board_serial = (m < (int)USBBoards.boards.size()) ? USBBoards.boards[m] : -1;
+		c->mech_type = mech->type;
+		c->tool_type = mech->tool_type;
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			c->enc_offset[j] = mech->joint[j].enc_offset;
+			c->enc_val[j] = mech->joint[j].enc_val;
+		}
+	}
+	publishCalibration();
+}
+
+/**\fn int calibrationRestore(struct mechanism *mech, int m)
+ * \brief give an arm back its kept calibration, if the boards kept counting since.  RT safe.
+ *
+ * On success the joints have their offsets, positions and filters set as
+ * set_joints_known_pos() would leave them, and jpos_d = jpos.
+ *
+ * \param mech the arm
+ * \param m its index
+ * \return 0 if restored, -1 if the arm has to home
+ */
+int calibrationRestore(struct mechanism *mech, int m)
+{
+	struct cal_mech *c = &cal_live[m];
+
+	if (cal_name.empty() || m >= MAX_MECH || !c->valid)
+		return -1;
+	if (m >= (int)USBBoards.boards.size() || c->board_serial != USBBoards.boards[m] ||
+		c->mech_type != mech->type || c->tool_type != mech->tool_type)
+	{
+		log_msg("Arm %d: different board or tool since calibration, homing", m);
+		return -1;
+	}
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		if (abs(mech->joint[j].enc_val - c->enc_val[j]) > cal_max_drift)
+		{
+			log_msg("Arm %d: encoder %d moved %d counts since calibration, homing", m, j,
+					mech->joint[j].enc_val - c->enc_val[j]);
+			return -1;
+		}
+
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+	{
+		struct DOF *_joint = &mech->joint[j];
+		_joint->enc_offset = c->enc_offset[j];
+		resetStateFromEncoder(_joint);
+	}
+	fwdMechCableCoupling(mech);
+
+	// somewhere the arm cannot be: the offsets are stale
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+	{
+		struct DOF *_joint = &mech->joint[j];
+		const struct DOF_type *t = &DOF_types[_joint->type];
+		float lo = t->min_limit, hi = (t->max_position > t->max_limit) ? t->max_position : t->max_limit;
+		float margin = 0.1 * (hi - lo);
+		if (hi > lo && (_joint->jpos < lo - margin || _joint->jpos > hi + margin))
+		{
+			log_msg("Arm %d: joint %d at %.3f is out of its range with the kept calibration, homing", m, j, _joint->jpos);
+			calibrationReject(m);
+			return -1;
+		}
+	}
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		mech->joint[j].jpos_d = mech->joint[j].jpos;
+	return 0;
+}
+
+/**\fn void calibrationReject(int m)
+ * \brief forget an arm's calibration, here and in the file.  RT safe.
+ */
+void calibrationReject(int m)
+{
+	if (m < 0 || m >= MAX_MECH)
+		return;
+	cal_live[m].valid = 0;
+	publishCalibration();
+}
+
+/**\fn static int writeCalibration(const struct cal_mech *mech)
+ * \brief write the file: to a temporary, then renamed over the old one
+ * \return 0 on success, negative errno on failure
+ */
+static int writeCalibration(const struct cal_mech *mech)
+{
+	struct cal_file c;
+	struct timespec treal;
+	std::string tmp = cal_name + ".tmp";
+
+	memset(&c, 0, sizeof(c));
+	memcpy(c.magic, CAL_MAGIC, 8);
+	c.version = CAL_VERSION;
+	c.num_mech = MAX_MECH;
+	memcpy(c.boot_id, cal_boot_id, CAL_BOOT_ID);
+	clock_gettime(CLOCK_REALTIME, &treal);
+	c.saved_realtime_ns = (u_64)treal.tv_sec * 1000000000ULL + treal.tv_nsec;
+	memcpy(c.mech, mech, sizeof(c.mech));
+	c.crc = calCrc(&c);
+
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0)
+		return -errno;
+	int ok = write(fd, &c, sizeof(c)) == sizeof(c) && fsync(fd) == 0;
+	int err = ok ? 0 : -errno;
+	if (close(fd) < 0 && ok)
+		err = -errno;
+	if (err == 0 && rename(tmp.c_str(), cal_name.c_str()) < 0)
+		err = -errno;
+	return err;
+}
+
+/**\fn static int calibrationChanged(const struct cal_mech *a, const struct cal_mech *b)
+ * \return 1 if a should be written over b
+ */
+static int calibrationChanged(const struct cal_mech *a, const struct cal_mech *b)
+{
+	for (int m = 0; m < MAX_MECH; m++)
+	{
+		if (a[m].valid != b[m].valid || a[m].board_serial != b[m].board_serial ||
+			a[m].mech_type != b[m].mech_type || a[m].tool_type != b[m].tool_type)
+			return 1;
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			if (a[m].enc_offset[j] != b[m].enc_offset[j] ||
+				abs(a[m].enc_val[j] - b[m].enc_val[j]) > ENC_CNTS_PER_REV / 8)
+				return 1;
+	}
+	return 0;
+}
+
+/**\fn void* calibration_process(void*)
+ * \brief Calibration thread: keeps the file up to date with the RT thread's calibration.
+ */
+void* calibration_process(void*)
+{
+	static struct cal_mech snap[MAX_MECH], written[MAX_MECH];
+	struct timespec timeout;
+	unsigned int seen = 0;
+
+	if (cal_name.empty())
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	memcpy(written, cal_live, sizeof(written));     // what init_calibration() loaded
+
+	while (ros::ok() && !r2Killed())
+	{
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += 500000000L;
+		tsnorm(&timeout);
+		sem_timedwait(&cal_sem, &timeout);
+
+		unsigned int s = cal_seq;
+		if (s == seen || (s & 1))
+			continue;
+		__sync_synchronize();
+		memcpy(snap, cal_shared, sizeof(snap));
+		__sync_synchronize();
+		if (cal_seq != s)
+			continue;           // torn: take the next one
+		seen = s;
+
+		if (!calibrationChanged(snap, written))
+			continue;
+		int err = writeCalibration(snap);
+		if (err < 0)
+			err_msg("Calibration store: writing %s failed (%d)", cal_name.c_str(), -err);
+		else
+			memcpy(written, snap, sizeof(written));
+	}
+	return NULL;
+}
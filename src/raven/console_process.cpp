@@ -28,25 +28,226 @@
 
 #include <stdio.h>
 #include <iomanip>
+#include <sstream>
 #include <termios.h>   // needed for terminal settings in getkey()
-#include <queue>
+#include <ctype.h>
+#include <unistd.h>
 
 #include "rt_process_preempt.h"
 #include "rt_raven.h"
+#include "cycle_timing.h"
+#include "cpu_affinity.h"
+#include "cycle_scheduler.h"
+#include "teleop_jitter.h"
+#include "teleop_protocol.h"
+#include "net_log.h"
+#include "usb_replay.h"
+#include "usb_sim.h"
+#include "teleop_session.h"
+#include "console_process.h"
+#include "control_config.h"
+#include "local_io.h"
+#include "executor.h"
+#include "shared_state.h"
 
 using namespace std;
 
-// from rt_process.cpp
-extern struct device device0;//robot_device struct defined in DS0.h 
+extern unsigned long int gTime;//Defined in globals.cpp
+extern struct cycle_sched rt_sched;//Defined in globals.cpp
+extern int NUM_MECH;//Defined in globals.cpp
 
-extern unsigned long int gTime;//Defined in rt_process_preempt.cpp
-extern int soft_estopped;//Defined in rt_process_preempt.cpp
-extern struct DOF_type DOF_types[];//Defined in globals.cpp
-extern std::queue<char*> msgqueue; 
+// Console state dump, set up by init_console()
+static int console_rate_hz = 1;       // dumps per second while console output is on
+static int console_compact = 1;       // compact view, else every field
+static int console_refresh = 0;       // redraw in place instead of scrolling
 
-void outputRobotState();
 int getkey();
 
+/**\fn int init_console(ros::NodeHandle &n)
+ * \brief read the console state dump parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_console(ros::NodeHandle &n)
+{
+    std::string view;
+    bool refresh;
+    n.param("/console_rate_hz", console_rate_hz, 1);
+    n.param<std::string>("/console_view", view, "compact");
+    n.param("/console_refresh", refresh, false);
+    if (console_rate_hz < 1)
+        console_rate_hz = 1;
+    if (console_rate_hz > 30)
+        console_rate_hz = 30;     // the console loop runs at 30 Hz
+    console_compact = (view != "full");
+    console_refresh = refresh;
+    return 0;
+}
+
+// Console input.  A command key either acts at once or starts a prompt,
+// whose answers come a line at a time (consoleLine()).
+enum console_prompt { PROMPT_NONE, PROMPT_MECH, PROMPT_JOINT, PROMPT_TORQUE, PROMPT_MODE };
+
+static int prompt = PROMPT_NONE;
+static int output_robot = false;
+static int print_msg = 1;
+static unsigned int prompt_mech, prompt_joint;
+
+/**\fn static void consoleHints()
+ * \brief the UI hints, once after each command
+ */
+static void consoleHints()
+{
+    if ( !print_msg || prompt != PROMPT_NONE )
+        return;
+    log_msg("[[\t'C'  : toggle console messages ]]");
+    log_msg("[[\t'T'  : specify joint torque    ]]");
+    log_msg("[[\t'M'  : set control mode        ]]");
+    log_msg("[[\t'P'  : print cycle timing      ]]");
+    log_msg("[[\t'V'  : compact / full state    ]]");
+    log_msg("[[\t'^C' : Quit                    ]]");
+    print_msg=0;
+}
+
+/**\fn static void consoleKey(int theKey)
+ * \brief one command key
+ */
+static void consoleKey(int theKey)
+{
+    switch (theKey){
+        case 'z':
+        {
+            output_robot = 0;
+            setDofTorque(0,0,0);
+            log_msg("Torque zero'd");
+            print_msg=1;
+            break;
+        }
+
+        case 'e':
+        case 'E':
+        case '0':
+        {
+            output_robot = 0;
+            softEstop();
+            print_msg=1;
+            log_msg("Soft estopped");
+            break;
+        }
+        case '+':
+        case '=':
+        {
+            softEstopClear();
+            print_msg=1;
+            log_msg("Soft estop off");
+            break;
+        }
+        case 'c':
+        case 'C':
+        {
+            log_msg("Console output on:%d", output_robot);
+            output_robot = !output_robot;
+            // Snapshots for the dump only while it is on
+            setPublishRate(PUB_CONSOLE, output_robot ? console_rate_hz : 0);
+            print_msg=1;
+            break;
+        }
+        case 't':
+        case 'T':
+        {
+            print_msg=1;
+            // Get user-input mechanism #
+            printf("\n\nEnter a mechanism number: 0-Gold, 1-Green:\t");
+            fflush(stdout);
+            prompt = PROMPT_MECH;
+            break;
+        }
+        case 'm':
+        case 'M':
+        {
+            // Get user-input DAC value #
+            printf("\n\nEnter new control mode: 0=NULL, 1=NULL, 2=joint_velocity, 3=apply_torque, 4=homing, 5=motor_pd, 6=cartesian_space_motion, 7=multi_dof_sinusoid, 8=external_control \t");
+            fflush(stdout);
+            prompt = PROMPT_MODE;
+            break;
+        }
+        case 'v':
+        case 'V':
+        {
+            console_compact = !console_compact;
+            log_msg("Console view: %s", console_compact ? "compact" : "full");
+            print_msg=1;
+            break;
+        }
+        case 'p':
+        case 'P':
+        {
+            outputCycleSchedStats(&rt_sched);
+            outputCycleTiming();
+            outputTeleopJitterStats();
+            outputTeleopProtocolStats();
+            outputTeleopSessionStats();
+            outputNetLogStats();
+            outputUsbReplayStats();
+            outputUsbSimStats();
+            print_msg=1;
+            break;
+        }
+    }
+}
+
+/**\fn static void consoleLine(const char *inputbuffer)
+ * \brief the answer to the pending prompt
+ */
+static void consoleLine(const char *inputbuffer)
+{
+    switch (prompt)
+    {
+        case PROMPT_MECH:
+        {
+            prompt = PROMPT_NONE;
+            prompt_mech = atoi(inputbuffer);
+            if ( prompt_mech > 1 ) break;
+
+            // Get user-input joint #
+            printf("\nEnter a joint number: 0-shoulder, 1-elbow, 2-zins, 4-tool_rot, 5-wrist, 6/7- grasp 1/2:\t");
+            fflush(stdout);
+            prompt = PROMPT_JOINT;
+            break;
+        }
+        case PROMPT_JOINT:
+        {
+            prompt = PROMPT_NONE;
+            prompt_joint = atoi(inputbuffer);
+            if ( prompt_joint > MAX_DOF_PER_MECH ) break;
+
+            // Get user-input DAC value #
+            printf("\nEnter a torque value in miliNewton-meters:\t");
+            fflush(stdout);
+            prompt = PROMPT_TORQUE;
+            break;
+        }
+        case PROMPT_TORQUE:
+        {
+            prompt = PROMPT_NONE;
+            int _torqueval = atoi(inputbuffer);
+
+            log_msg("Commanded mech.joint (tau):%d.%d (%d))\n",prompt_mech, prompt_joint, _torqueval);
+            setDofTorque(prompt_mech, prompt_joint, _torqueval);
+            break;
+        }
+        case PROMPT_MODE:
+        {
+            prompt = PROMPT_NONE;
+            t_controlmode _cmode = (t_controlmode)(atoi(inputbuffer));
+            log_msg("recieved control mode:%d\n\n",_cmode);
+            setRobotControlMode(_cmode);
+            print_msg=1;
+            break;
+        }
+    }
+}
+
 /**\fn void *console_process(void *)
  * \brief this thread dedicated to console io
  * \param a pointer to void
@@ -58,6 +259,9 @@ void *console_process(void *)
     t1=t1.now();
     t2=t2.now();
 
+    if (executorActive())
+        return NULL;        // consoleReactorAttach()
+
     //Low priority non realtime thread
     struct sched_param param;                    // priority settings
     param.sched_priority = 0;
@@ -66,121 +270,128 @@ void *console_process(void *)
         perror("sched_setscheduler failed for console process");
         exit(-1);
     }
+    set_thread_affinity(ROLE_HOUSEKEEPING);
 
-    int output_robot=false;
-    int theKey,print_msg=1;
     char inputbuffer[100];
     sleep(1);
     // Run shell interaction
     while (ros::ok())
     {
         // Output UI hints
-        if ( print_msg ){
-            log_msg("[[\t'C'  : toggle console messages ]]");
-            log_msg("[[\t'T'  : specify joint torque    ]]");
-            log_msg("[[\t'M'  : set control mode        ]]");
-            log_msg("[[\t'^C' : Quit                    ]]");
-            print_msg=0;
-        }
-        // Get UI command
-        theKey = getkey();
-        switch (theKey){
-            case 'z':
-            {
-                output_robot = 0;
-                setDofTorque(0,0,0);
-                log_msg("Torque zero'd");
-                print_msg=1;
-                break;
-            }
-
-            case 'e':
-            case 'E':
-            case '0':
-            {
-                output_robot = 0;
-                soft_estopped=TRUE;
-                print_msg=1;
-                log_msg("Soft estopped");
-                break;
-            }
-            case '+':
-            case '=':
-            {
-                soft_estopped=FALSE;
-                print_msg=1;
-                log_msg("Soft estop off");
-                break;
-            }
-            case 'c':
-            case 'C':
-            {
-                log_msg("Console output on:%d", output_robot);
-                output_robot = !output_robot;
-                print_msg=1;
-                break;
-            }
-            case 't':
-            case 'T':
-            {
-                print_msg=1;
-                // Get user-input mechanism #
-                printf("\n\nEnter a mechanism number: 0-Gold, 1-Green:\t");
-                cin.getline (inputbuffer,100);
-                unsigned int _mech = atoi(inputbuffer);
-                if ( _mech > 1 ) break;
-
-                // Get user-input joint #
-                printf("\nEnter a joint number: 0-shoulder, 1-elbow, 2-zins, 4-tool_rot, 5-wrist, 6/7- grasp 1/2:\t");
-                cin.getline (inputbuffer,100);
-                unsigned int _joint = atoi(inputbuffer);
-                if ( _joint > MAX_DOF_PER_MECH ) break;
-
-                // Get user-input DAC value #
-                printf("\nEnter a torque value in miliNewton-meters:\t");
-                cin.getline (inputbuffer,100);
-                int _torqueval = atoi(inputbuffer);
-
-                log_msg("Commanded mech.joint (tau):%d.%d (%d))\n",_mech, _joint, _torqueval);
-                setDofTorque(_mech, _joint, _torqueval);
-                break;
-            }
-            case 'm':
-            case 'M':
-            {
-                // Get user-input DAC value #
-                printf("\n\nEnter new control mode: 0=NULL, 1=NULL, 2=joint_velocity, 3=apply_torque, 4=homing, 5=motor_pd, 6=cartesian_space_motion, 7=multi_dof_sinusoid \t");
-                cin.getline (inputbuffer,100);
-                t_controlmode _cmode = (t_controlmode)(atoi(inputbuffer));
-                log_msg("recieved control mode:%d\n\n",_cmode);
-                setRobotControlMode(_cmode);
-                print_msg=1;
-                break;
-            }
+        consoleHints();
+
+        // Get UI command, and the answers to its prompts
+        consoleKey(getkey());
+        while (prompt != PROMPT_NONE)
+        {
+            cin.getline (inputbuffer,100);
+            consoleLine(inputbuffer);
         }
 
-        // Output the robot state once/sec
+        // Output the robot state console_rate_hz times a second
         if ( output_robot        &&
-             (t1.now()-t1).toSec() > 1 )
+             (t1.now()-t1).toSec() >= 1.0 / console_rate_hz )
         {
             outputRobotState();
             t1=t1.now();
         }
 
         usleep(33*1e3); //Sleep for 1/30 seconds
+    }
+
+    return(NULL);
+}
+
+// Executor mode: stdin stays in raw mode, prompts are echoed here
+static struct termios console_saved_term;
+static int console_raw = 0;
+static char console_line[100];
+static int console_line_len = 0;
 
-	// Output log messages
-	while (msgqueue.size() > 0){
-	  char* buf = msgqueue.front();
-	  //std::cout << "buf\n" << buf << std::endl;
-	  ROS_INFO("%s", buf);
-	  msgqueue.pop();
-	  free(buf);
-	}
+/**\fn static void consoleReadable(void *)
+ * \brief executor mode: keys on stdin
+ */
+static void consoleReadable(void *)
+{
+    char keys[64];
+    ssize_t n = read(fileno(stdin), keys, sizeof(keys));
 
+    for (ssize_t i = 0; i < n; i++)
+    {
+        int ch = (unsigned char)keys[i];
+        if (prompt == PROMPT_NONE)
+        {
+            consoleKey(ch);
+            continue;
+        }
+
+        if (ch == '\n' || ch == '\r')
+        {
+            putchar('\n');
+            console_line[console_line_len] = 0;
+            console_line_len = 0;
+            consoleLine(console_line);
+        }
+        else if ((ch == 0x7f || ch == '\b') && console_line_len > 0)
+        {
+            console_line_len--;
+            fputs("\b \b", stdout);
+        }
+        else if (isprint(ch) && console_line_len < (int)sizeof(console_line) - 1)
+        {
+            console_line[console_line_len++] = ch;
+            putchar(ch);
+        }
+        fflush(stdout);
     }
+    consoleHints();
+}
 
-    return(NULL);
+/**\fn static void consoleDump(void *)
+ * \brief executor mode: the state dump, console_rate_hz times a second while it is on
+ */
+static void consoleDump(void *)
+{
+    if (output_robot)
+        outputRobotState();
+}
+
+/**\fn int consoleReactorAttach(int lane)
+ * \brief executor mode: read keys on a reactor instead of console_process()
+ * \param lane executor lane
+ * \return 0, -1 on failure
+ */
+int consoleReactorAttach(int lane)
+{
+    int fd = fileno(stdin);
+
+    if (isatty(fd) && tcgetattr(fd, &console_saved_term) == 0)
+    {
+        struct termios raw = console_saved_term;
+        raw.c_lflag &= ~(ECHO|ICANON);
+        raw.c_cc[VTIME] = 0;
+        raw.c_cc[VMIN] = 0;
+        tcsetattr(fd, TCSANOW, &raw);
+        console_raw = 1;
+    }
+
+    // No terminal (roslaunch): no keys to wait for
+    int timer = execTimer(lane, consoleDump, NULL);
+    if (timer < 0 || (console_raw && execWatchFd(lane, fd, consoleReadable, NULL) < 0))
+        return -1;
+    execTimerArm(timer, 1000000000LL / console_rate_hz, 1000000000LL / console_rate_hz);
+    consoleHints();
+    return 0;
+}
+
+/**\fn void consoleReactorDetach(void)
+ * \brief executor mode, once the reactors have stopped: give the terminal back
+ */
+void consoleReactorDetach(void)
+{
+    if (console_raw)
+        tcsetattr(fileno(stdin), TCSANOW, &console_saved_term);
+    console_raw = 0;
 }
 
 /**\fn int getkey()
@@ -210,138 +421,126 @@ int getkey() {
     return character;
 }
 
+// Per-joint rows of the state dump
+enum joint_field { JF_TYPE, JF_ENC_VAL, JF_ENC_OFF, JF_MPOS, JF_MPOS_D, JF_MVEL, JF_MVEL_D,
+                   JF_JPOS, JF_JPOS_D, JF_JVEL, JF_JVEL_D, JF_TAU_D, JF_TAU_G, JF_DAC };
+
+/**\fn static void outputJoints(std::ostream &out, const char *label, const struct mechanism *mech, int field, int precision)
+ * \brief one row of a per-joint field
+ */
+static void outputJoints(std::ostream &out, const char *label, const struct mechanism *mech, int field, int precision)
+{
+    out << label;
+    for (int i=0;i<MAX_DOF_PER_MECH;i++)
+    {
+        const struct DOF *_joint = &mech->joint[i];
+        out << fixed << setprecision(precision);
+        switch (field)
+        {
+        case JF_TYPE:    out << _joint->type; break;
+        case JF_ENC_VAL: out << _joint->enc_val; break;
+        case JF_ENC_OFF: out << _joint->enc_offset; break;
+        case JF_MPOS:    out << _joint->mpos; break;
+        case JF_MPOS_D:  out << _joint->mpos_d; break;
+        case JF_MVEL:    out << _joint->mvel; break;
+        case JF_MVEL_D:  out << _joint->mvel_d; break;
+        case JF_JPOS:    out << _joint->jpos; break;
+        case JF_JPOS_D:  out << _joint->jpos_d; break;
+        case JF_JVEL:    out << _joint->jvel; break;
+        case JF_JVEL_D:  out << _joint->jvel_d; break;
+        case JF_TAU_D:   out << _joint->tau_d; break;
+        case JF_TAU_G:   out << _joint->tau_g; break;
+        case JF_DAC:     out << _joint->current_cmd; break;
+        }
+        out << "\t";
+    }
+    out << "\n";
+}
+
 /**\fn void outputRobotState()
- * \brief prints out all the robots states on the console window
+ * \brief prints out the robot state on the console window
+ *
+ * Reads the newest snapshot the publisher thread took off the ravenstate
+ * ring (latestRobotState()), never device0, so it costs the RT thread
+ * nothing and shows one cycle's state, not a mix.  The dump is built in
+ * one buffer and written at once.
+ *
  * \return void
  */
 void outputRobotState(){
-    cout<<"Runevel: "<< static_cast<unsigned short int>(device0.runlevel)<<"\n";
-    for (int j = 0; j < 2; j++)
+    static struct robot_state_view view;
+    struct ctrl_config cfg;
+    std::ostringstream out;
+
+    if (!latestRobotState(&view))
+    {
+        log_msg("No robot state snapshot yet");
+        return;
+    }
+    configLatest(&cfg);
+
+    if (console_refresh)
+        out << "\033[H\033[2J";     // home, clear screen
+    out << "Cycle " << view.cycle << " (" << gTime - view.cycle << " old), runlevel: "
+        << static_cast<unsigned short int>(view.runlevel) << "." << static_cast<unsigned short int>(view.sublevel)
+        << (softEstopped() ? ", soft estopped" : "") << "\n";
+
+    for (int j = 0; j < NUM_MECH; j++)
     {
-        if (device0.mech[j].type == GOLD_ARM)
-            cout << "Gold arm:\t";
-        else if (device0.mech[j].type == GREEN_ARM)
-            cout << "Green arm:\t";
+        const struct mechanism *mech = &view.dev.mech[j];
+
+        if (mech->type == GOLD_ARM)
+            out << "Gold arm:\t";
+        else if (mech->type == GREEN_ARM)
+            out << "Green arm:\t";
         else
-            cout << "Unknown arm:\t";
-
-        cout<<"Board "<<j<<", type "<<device0.mech[j].type << ":\n";
-        cout<<"P: (x,y,z) : ("<< device0.mech[j].pos.x / (1000.0*1000.0) << "\t" << device0.mech[j].pos.y / (1000.0*1000.0);
-        cout << "\t" << device0.mech[j].pos.z / (1000.0*1000.0);
-        cout << ") :\t";
-        cout<<"PD: (x,y,z) : ("<< device0.mech[j].pos_d.x / (1000.0*1000.0) << "\t" << device0.mech[j].pos_d.y / (1000.0*1000.0);
-        cout << "\t" << device0.mech[j].pos_d.z / (1000.0*1000.0);
-        cout << ") :\t";
-        cout << " Grasp/d:" << (double)device0.mech[j].ori.grasp/1000.0 << "/" << (double)device0.mech[j].ori_d.grasp / 1000.0 << "\n";
-//
-//        cout<<"pos:\t";
-//        cout<<device0.mech[j].pos.x<<"\t";
-//        cout<<device0.mech[j].pos.y<<"\t";
-//        cout<<device0.mech[j].pos.z<<"\n";
-//
-//        cout<<"pos_d:\t";
-//        cout<<device0.mech[j].pos_d.x<<"\t";
-//        cout<<device0.mech[j].pos_d.y<<"\t";
-//        cout<<device0.mech[j].pos_d.z<<"\n";
-
-        cout<<"type:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<device0.mech[j].joint[i].type<<"\t";
-        cout<<"\n";
-
-        cout<<"enc_val:\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<device0.mech[j].joint[i].enc_val<<"\t";
-        cout<<"\n";
-
-        cout<<"enc_off:\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<device0.mech[j].joint[i].enc_offset<<"\t";
-        cout<<"\n";
-
-        cout<<"mpos:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(2)<<device0.mech[j].joint[i].mpos <<"\t";
-        cout<<"\n";
-
-        cout<<"mpos_d:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(2)<<device0.mech[j].joint[i].mpos_d <<"\t";
-        cout<<"\n";
-
-        cout<<"mvel:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(0)<<device0.mech[j].joint[i].mvel <<"\t";
-        cout<<"\n";
-
-        cout<<"mvel_d:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(0)<<device0.mech[j].joint[i].mvel_d <<"\t";
-        cout<<"\n";
-
-        cout<<"jpos:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            if (i!=2)
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jpos <<"\t";
-            else
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jpos<<"\t";
-        cout<<"\n";
-
-        cout<<"jpos_d:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            if (i!=2)
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jpos_d <<"\t";
-            else
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jpos_d<<"\t";
-        cout<<"\n";
-
-        cout<<"jvel:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            if (i!=2)
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jvel <<"\t";
-            else
-                cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].jvel<<"\t";
-        cout<<"\n";
-
-        cout<<"jvel_d:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            if (i!=2)
-                cout<<fixed<<setprecision(2)<<device0.mech[j].joint[i].jvel_d <<"\t";
-            else
-                cout<<fixed<<setprecision(2)<<device0.mech[j].joint[i].jvel_d<<"\t";
-        cout<<"\n";
-
-        cout<<"tau_d:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].tau_d<<"\t";
-        cout<<"\n";
-
-        cout<<"tau_g:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].tau_g<<"\t";
-        cout<<"\n";
-
-        cout<<"DAC:\t\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(3)<<device0.mech[j].joint[i].current_cmd<<"\t";
-        cout<<"\n";
-
-        cout<<"KP gains:\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(3)<<DOF_types[j*MAX_DOF_PER_MECH+i].KP<<"\t";
-        cout<<"\n";
-
-        cout<<"KD gains:\t";
-        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-            cout<<fixed<<setprecision(3)<<DOF_types[j*MAX_DOF_PER_MECH+i].KD<<"\t";
-        cout<<"\n";
-//
-//        cout<<"enc_offset:\t";
-//        for (int i=0;i<MAX_DOF_PER_MECH;i++)
-//            cout<<device0.mech[j].joint[i].enc_offset<<"\t";
-//        cout<<"\n";
-
-        cout<<"\n";
+            out << "Unknown arm:\t";
+
+        out << "Board " << j << ", type " << mech->type << ":\n";
+        out << fixed << setprecision(6);
+        out << "P: (x,y,z) : (" << mech->pos.x / (1000.0*1000.0) << "\t" << mech->pos.y / (1000.0*1000.0)
+            << "\t" << mech->pos.z / (1000.0*1000.0) << ") :\t";
+        out << "PD: (x,y,z) : (" << mech->pos_d.x / (1000.0*1000.0) << "\t" << mech->pos_d.y / (1000.0*1000.0)
+            << "\t" << mech->pos_d.z / (1000.0*1000.0) << ") :\t";
+        out << " Grasp/d:" << (double)mech->ori.grasp/1000.0 << "/" << (double)mech->ori_d.grasp / 1000.0 << "\n";
+
+        if (!console_compact)
+        {
+            outputJoints(out, "type:\t\t", mech, JF_TYPE, 0);
+            outputJoints(out, "enc_val:\t", mech, JF_ENC_VAL, 0);
+            outputJoints(out, "enc_off:\t", mech, JF_ENC_OFF, 0);
+            outputJoints(out, "mpos:\t\t", mech, JF_MPOS, 2);
+            outputJoints(out, "mpos_d:\t\t", mech, JF_MPOS_D, 2);
+            outputJoints(out, "mvel:\t\t", mech, JF_MVEL, 0);
+            outputJoints(out, "mvel_d:\t\t", mech, JF_MVEL_D, 0);
+        }
+        outputJoints(out, "jpos:\t\t", mech, JF_JPOS, 3);
+        outputJoints(out, "jpos_d:\t\t", mech, JF_JPOS_D, 3);
+        if (!console_compact)
+        {
+            outputJoints(out, "jvel:\t\t", mech, JF_JVEL, 3);
+            outputJoints(out, "jvel_d:\t\t", mech, JF_JVEL_D, 2);
+        }
+        outputJoints(out, "tau_d:\t\t", mech, JF_TAU_D, 3);
+        if (!console_compact)
+            outputJoints(out, "tau_g:\t\t", mech, JF_TAU_G, 3);
+        outputJoints(out, "DAC:\t\t", mech, JF_DAC, 3);
+
+        if (!console_compact)
+        {
+            // Gains as the control loop has them: the published config, scaled
+            out << "KP gains:\t";
+            for (int i=0;i<MAX_DOF_PER_MECH;i++)
+                out << fixed << setprecision(3) << cfg.kp[j*MAX_DOF_PER_MECH+i] * cfg.kp_scale << "\t";
+            out << "\n";
+
+            out << "KD gains:\t";
+            for (int i=0;i<MAX_DOF_PER_MECH;i++)
+                out << fixed << setprecision(3) << cfg.kd[j*MAX_DOF_PER_MECH+i] * cfg.kd_scale << "\t";
+            out << "\n";
+        }
+
+        out << "\n";
     }
+    cout << out.str() << flush;
 }
-
@@ -0,0 +1,366 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * r2_control_bench: run the control cycle with no boards and no clock and
+ * report what it costs.
+ *
+ *   r2_control_bench [-n cycles] [-w warmup] [-m mode,...] [-r recording.r2fr]
+ *
+ * The boards are the simulated ones (usb_sim), or the boards of a flight
+ * recording (usb_replay) with -r.  The loop runs in lockstep, so every cycle
+ * is back to back: the numbers are pure compute.  Each mode is forced into
+ * currParams after the warmup and timed around controlRaven(), the same
+ * span as CT_CONTROL in the running node.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+
+#include <ros/ros.h>
+
+#include "rt_process_preempt.h"
+#include "rt_raven.h"
+#include "cycle_timing.h"
+#include "control_clock.h"
+#include "velocity_estimate.h"
+#include "setpoint_interp.h"
+#include "cable_coupling.h"
+#include "usb_sim.h"
+#include "usb_replay.h"
+#include "cpu_affinity.h"
+#include "arm_pipeline.h"
+#include "controller.h"
+#include "shared_state.h"
+
+extern unsigned long int gTime;        // Defined in globals.cpp
+extern struct device device0;          // Defined in globals.cpp
+extern int NUM_MECH;                   // Defined in globals.cpp
+extern int usb_backend;                // Defined in globals.cpp
+
+static struct param_pass currParams;
+static struct param_pass rcvdParams;
+
+struct bench_mode {
+	const char *name;
+	t_controlmode mode;
+};
+
+static const struct bench_mode bench_modes[] = {
+	{ "cartesian",  cartesian_space_control },
+	{ "motor_pd",   motor_pd_control },
+	{ "homing",     homing_mode },
+	{ "sinusoid",   multi_dof_sinusoid },
+};
+#define NUM_BENCH_MODES (int)(sizeof(bench_modes)/sizeof(bench_modes[0]))
+
+// controlRaven() sub-stages reported per mode
+static const int bench_stages[] = { CT_INIT_ROBOT, CT_STATE_ESTIMATE, CT_FWD_CABLE, CT_FWD_KIN, CT_CONTROL_MODE };
+#define NUM_BENCH_STAGES (int)(sizeof(bench_stages)/sizeof(bench_stages[0]))
+
+/// Hardware counters for one cycle (a group: instructions leads, cache misses follow)
+struct bench_perf {
+	int fd_insn;
+	int fd_miss;
+};
+
+static int perfOpen(__u64 config, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/**\fn static int perfInit(struct bench_perf *p)
+ * \brief open the counters.  Not fatal: containers and paranoid kernels refuse them.
+ * \return 0, or -1 if no counters are available
+ */
+static int perfInit(struct bench_perf *p)
+{
+	p->fd_miss = -1;
+	p->fd_insn = perfOpen(PERF_COUNT_HW_INSTRUCTIONS, -1);
+	if (p->fd_insn < 0)
+		return -1;
+	p->fd_miss = perfOpen(PERF_COUNT_HW_CACHE_MISSES, p->fd_insn);
+	return 0;
+}
+
+static inline void perfStart(struct bench_perf *p)
+{
+	if (p->fd_insn < 0)
+		return;
+	ioctl(p->fd_insn, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(p->fd_insn, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/**\fn static inline void perfStop(struct bench_perf *p, u_64 *insn, u_64 *miss)
+ * \brief stop the counters and add this cycle's counts
+ */
+static inline void perfStop(struct bench_perf *p, u_64 *insn, u_64 *miss)
+{
+	if (p->fd_insn < 0)
+		return;
+	ioctl(p->fd_insn, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	u_64 v[3] = { 0, 0, 0 };      // nr, instructions, cache misses
+	if (read(p->fd_insn, v, sizeof(v)) < (ssize_t)(2 * sizeof(u_64)))
+		return;
+	*insn += v[1];
+	if (v[0] > 1)
+		*miss += v[2];
+}
+
+/**\fn static int benchCycle(long long *control_ns, struct bench_perf *perf, u_64 *insn, u_64 *miss, int force_mode)
+ * \brief one pass of the rt_process() loop body, less the sleep and the publishing
+ * \param control_ns time spent in controlRaven()
+ * \param force_mode control mode to run, or -1 to leave it to the state machine
+ * \return 0, or -ENOENT when a replayed recording runs out
+ */
+static int benchCycle(long long *control_ns, struct bench_perf *perf, u_64 *insn, u_64 *miss, int force_mode)
+{
+	struct timespec t0, t1;
+
+	if (usbReplayActive() && usbReplayNext() < 0)
+		return -ENOENT;
+
+	initiateUSBGet(&device0);
+	gTime++;
+	int loops = 0;
+	while (getUSBPackets(&device0) == -EBUSY && loops++ < 1000)
+		;
+
+	updateAtmelInputs(&device0);
+	stateMachine(&device0, &currParams, &rcvdParams, 0);
+
+	struct param_pass *update = NULL;
+	if (usbReplayActive())
+		update = usbReplayMaster(&rcvdParams);
+	if (update)
+		updateDeviceState(&currParams, update, &device0);
+	else
+		rcvdParams.runlevel = currParams.runlevel;
+
+	if (force_mode >= 0)
+		currParams.robotControlMode = force_mode;
+
+	clearDACs(&device0);
+	perfStart(perf);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	controlRaven(&device0, &currParams);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	perfStop(perf, insn, miss);
+	*control_ns = (long long)(t1.tv_sec - t0.tv_sec) * NSEC_PER_SEC + (t1.tv_nsec - t0.tv_nsec);
+
+	if (overdriveDetect(&device0))
+		softEstop();
+	updateAtmelOutputs(&device0, currParams.runlevel);
+	putUSBPackets(&device0);
+	return 0;
+}
+
+/**\fn static int benchMode(const struct bench_mode *bm, int cycles, int warmup, const char *recording, struct bench_perf *perf)
+ * \brief run and report one control mode, from a freshly initialised device
+ * \return 0, or -1 if the recording cannot be replayed
+ */
+static int benchMode(const struct bench_mode *bm, int cycles, int warmup, const char *recording, struct bench_perf *perf)
+{
+	if (recording && usbReplayOpen(recording, 0) < 0)
+		return -1;
+	r2_shared.r2_kill = 0;       // the last recording's end stopped the loops
+	softEstopClear();
+	memset(&currParams, 0, sizeof(currParams));
+	memset(&rcvdParams, 0, sizeof(rcvdParams));
+	currParams.runlevel = STOP;
+	currParams.sublevel = 0;
+	initDOFs(&device0);
+
+	long long ns;
+	u_64 insn = 0, miss = 0;
+	for (int i = 0; i < warmup; i++)
+		if (benchCycle(&ns, perf, &insn, &miss, -1) < 0)
+		{
+			err_msg("%s: recording ended during the warmup", bm->name);
+			return 0;
+		}
+
+	std::vector<long long> samples;
+	samples.reserve(cycles);
+	double stage_ns[NUM_BENCH_STAGES] = { 0 };
+	insn = miss = 0;
+	int runlevel = currParams.runlevel;
+	for (int i = 0; i < cycles; i++)
+	{
+		if (benchCycle(&ns, perf, &insn, &miss, bm->mode) < 0)
+			break;
+		samples.push_back(ns);
+		for (int s = 0; s < NUM_BENCH_STAGES; s++)
+			stage_ns[s] += cycleTimingLast(bench_stages[s]);
+	}
+	if (samples.empty())
+	{
+		err_msg("%s: no cycles run", bm->name);
+		return 0;
+	}
+
+	size_t n = samples.size();
+	double total = 0;
+	for (size_t i = 0; i < n; i++)
+		total += samples[i];
+	std::sort(samples.begin(), samples.end());
+
+	printf("%-10s %7lu cycles (runlevel %d%s)  mean %7.0f  p50 %7lld  p99 %7lld  max %7lld ns\n",
+		   bm->name, (unsigned long)n, runlevel, softEstopped() ? ", soft e-stop" : "", total / n,
+		   samples[n / 2], samples[(n * 99) / 100], samples[n - 1]);
+	for (int s = 0; s < NUM_BENCH_STAGES; s++)
+		printf("    %-22s %9.0f ns\n", cycleStageName(bench_stages[s]), stage_ns[s] / n);
+	if (perf->fd_insn >= 0)
+	{
+		printf("    %-22s %9.0f /cycle\n", "instructions", (double)insn / n);
+		if (perf->fd_miss >= 0)
+			printf("    %-22s %9.1f /cycle\n", "cache misses", (double)miss / n);
+		else
+			printf("    %-22s %9s\n", "cache misses", "n/a");
+	}
+	else
+		printf("    %-22s %9s\n", "perf counters", "n/a");
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n cycles] [-w warmup] [-m mode,...] [-r recording.r2fr]\n  modes:", prog);
+	for (int i = 0; i < NUM_BENCH_MODES; i++)
+		fprintf(stderr, " %s", bench_modes[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	int cycles = 10000, warmup = 3000;
+	const char *recording = NULL;
+	std::string modes = "cartesian,motor_pd,homing,sinusoid";
+
+	ros::init(argc, argv, "r2_control_bench", ros::init_options::NoSigintHandler | ros::init_options::AnonymousName);
+	int opt;
+	while ((opt = getopt(argc, argv, "n:w:m:r:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': cycles = atoi(optarg); break;
+		case 'w': warmup = atoi(optarg); break;
+		case 'm': modes = optarg; break;
+		case 'r': recording = optarg; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if (cycles <= 0 || warmup < 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<const struct bench_mode *> run;
+	for (size_t pos = 0; pos <= modes.size(); )
+	{
+		size_t end = modes.find(',', pos);
+		if (end == std::string::npos)
+			end = modes.size();
+		std::string name = modes.substr(pos, end - pos);
+		int i;
+		for (i = 0; i < NUM_BENCH_MODES && name != bench_modes[i].name; i++)
+			;
+		if (i == NUM_BENCH_MODES)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		run.push_back(&bench_modes[i]);
+		pos = end + 1;
+	}
+
+	// Same setup as init_ros(), with the backend fixed and no threads behind it
+	ros::NodeHandle n;
+	step_period = 1.0 / control_rate_hz;
+	designStateLPF(control_rate_hz);
+	init_arm_boards(n);
+	if (recording)
+	{
+		usb_backend = USB_BACKEND_REPLAY;
+		if (usbReplayOpen(recording, 0) < 0)
+			return 1;
+	}
+	else
+	{
+		usb_backend = USB_BACKEND_SIM;
+		if (!n.hasParam("/usb_sim_runlevel"))
+			n.setParam("/usb_sim_runlevel", (int)RL_PEDAL_DN);   // run the controllers, not just the state machine
+		init_usb_sim(n);
+	}
+	controlClockSetLockstep(1);
+	if (USBInit(&device0) == FALSE)
+	{
+		err_msg("Could not init the %s boards", recording ? "replayed" : "simulated");
+		return 1;
+	}
+	USBInitWait();
+	initLocalioData();
+	init_state_lpf(n);
+	init_velocity_estimate(n);
+	init_setpoint_interp(n);
+	init_kinematics(n);
+	init_cable_coupling(n);
+	init_thermal_model(n);
+	init_ravengains(n, &device0);
+	init_controllers(n, &device0);
+
+	// /control_pipeline per_arm times the per-arm jobs instead of the serial path
+	if (init_cpu_affinity(n) || init_arm_pipeline(n) || armPipelineStart(&device0))
+		return 1;
+
+	struct bench_perf perf;
+	if (perfInit(&perf) < 0)
+		log_msg("perf counters unavailable (%d), timing only", errno);
+
+	printf("r2_control_bench: %d Hz, %d mechs, %d cycles after %d warmup, %s\n", control_rate_hz, NUM_MECH,
+		   cycles, warmup, recording ? recording : "simulated boards");
+	for (size_t i = 0; i < run.size(); i++)
+		if (benchMode(run[i], cycles, warmup, recording, &perf) < 0)
+			return 1;
+
+	armPipelineStop();
+	if (usb_backend == USB_BACKEND_SIM)
+		usbSimShutdown();
+	return 0;
+}
@@ -0,0 +1,98 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file control_clock.cpp
+ * \brief The clock the control path reads: wall clock, or virtual in lockstep.
+ */
+
+#include <time.h>
+
+#include "control_clock.h"
+#include "USB_init.h"
+#include "defines.h"
+#include "utils.h"
+#include "log.h"
+
+extern unsigned long int gTime;
+extern int usb_backend;             // Defined in globals.cpp
+
+static int cc_lockstep = 0;
+
+/**\fn int init_control_clock(ros::NodeHandle &n)
+ * \brief read /lockstep.  Call after the USB backend is chosen.
+ * \param n the node handle
+ * \return 0
+ */
+int init_control_clock(ros::NodeHandle &n)
+{
+	bool lockstep;
+	n.param("/lockstep", lockstep, false);
+
+	cc_lockstep = 0;
+	if (lockstep && usb_backend == USB_BACKEND_BOARDS)
+		err_msg("Lockstep needs the sim or replay USB backend.  Running in real time.");
+	else if (lockstep)
+	{
+		cc_lockstep = 1;
+		log_msg("Lockstep: virtual clock, %d Hz control periods, no sleeping", control_rate_hz);
+	}
+	return 0;
+}
+
+/**\fn int controlClockLockstep()
+ * \return nonzero when the loop runs on the virtual clock
+ */
+int controlClockLockstep()
+{
+	return cc_lockstep;
+}
+
+/**\fn void controlClockSetLockstep(int on)
+ * \brief switch lockstep on or off without the parameter server (offline tools)
+ */
+void controlClockSetLockstep(int on)
+{
+	cc_lockstep = on;
+}
+
+/**\fn long long controlClockNs()
+ * \brief control path time in nanoseconds: CLOCK_MONOTONIC, or gTime periods in lockstep
+ */
+long long controlClockNs()
+{
+	if (cc_lockstep)
+		return (long long)gTime * (NSEC_PER_SEC / control_rate_hz);
+
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * NSEC_PER_SEC + t.tv_nsec;
+}
+
+/**\fn ros::Time controlTime()
+ * \brief control path time as ros::Time: ros::Time::now(), or gTime periods in lockstep
+ */
+ros::Time controlTime()
+{
+	if (!cc_lockstep)
+		return ros::Time::now();
+
+	long long ns = controlClockNs();
+	return ros::Time(ns / NSEC_PER_SEC, ns % NSEC_PER_SEC);
+}
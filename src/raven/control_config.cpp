@@ -0,0 +1,313 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file control_config.cpp
+ * \brief Gains and joint limits, reloaded at run time without locking the control loop.
+ *
+ * Two slots, as the state estimator's filter banks: writers (under
+ * cfg_mutex) fill the slot the control loop is not using and exchange it
+ * into cfg_active; configSwap() notices the new pointer at the next cycle,
+ * copies it out and acknowledges it in cfg_in_use.  A slot is only
+ * rewritten once the loop has acknowledged the other one, so the loop
+ * never reads a slot that is being written and never waits on a writer.
+ */
+
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "control_config.h"
+#include "log.h"
+
+extern int NUM_MECH;
+extern struct DOF_type DOF_types[];
+
+static struct ctrl_config cfg_slots[2];
+static struct ctrl_config * volatile cfg_active = NULL;   // newest published
+static struct ctrl_config * volatile cfg_in_use = NULL;   // last one the control loop applied
+static volatile u_32 cfg_applied_version = 0;
+
+// Writer side: the last published config and the device it was read for
+static struct ctrl_config cfg_latest;
+static struct device *cfg_device = NULL;
+static pthread_mutex_t cfg_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define CFG_SWAP_WAIT_MS 100
+
+/**\fn static int readJointLists(ros::NodeHandle &n, const char *gold, const char *green, XmlRpc::XmlRpcValue &v_gold, XmlRpc::XmlRpcValue &v_green)
+ * \brief fetch a gold and a green per-joint list from the parameter server
+ * \return 0 if both are there with MAX_DOF_PER_MECH entries, -1 otherwise
+ */
+static int readJointLists(ros::NodeHandle &n, const char *gold, const char *green,
+                          XmlRpc::XmlRpcValue &v_gold, XmlRpc::XmlRpcValue &v_green)
+{
+	if (!n.getParam(gold, v_gold) || !n.getParam(green, v_green) ||
+	    v_gold.getType() != XmlRpc::XmlRpcValue::TypeArray ||
+	    v_green.getType() != XmlRpc::XmlRpcValue::TypeArray ||
+	    v_gold.size() != MAX_DOF_PER_MECH || v_green.size() != MAX_DOF_PER_MECH)
+		return -1;
+	return 0;
+}
+
+/**\fn static double xmlNumber(XmlRpc::XmlRpcValue &v)
+ * \brief an XmlRpc int or double as a double, NAN for anything else
+ */
+static double xmlNumber(XmlRpc::XmlRpcValue &v)
+{
+	if (v.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+		return (double)v;
+	if (v.getType() == XmlRpc::XmlRpcValue::TypeInt)
+		return (int)v;
+	return NAN;
+}
+
+/**\fn static int readLimits(ros::NodeHandle &n, struct ctrl_config *c)
+ * \brief take the optional /joint_limits_{gold,green}_{min,max} lists into c
+ * \return 0, or -1 if the lists are there but malformed (c unchanged)
+ */
+static int readLimits(ros::NodeHandle &n, struct ctrl_config *c)
+{
+	XmlRpc::XmlRpcValue min_gold, min_green, max_gold, max_green;
+
+	if (!n.hasParam("/joint_limits_gold_min") && !n.hasParam("/joint_limits_green_min") &&
+	    !n.hasParam("/joint_limits_gold_max") && !n.hasParam("/joint_limits_green_max"))
+		return 0;
+	if (readJointLists(n, "/joint_limits_gold_min", "/joint_limits_green_min", min_gold, min_green) < 0 ||
+	    readJointLists(n, "/joint_limits_gold_max", "/joint_limits_green_max", max_gold, max_green) < 0)
+	{
+		ROS_ERROR("Joint limits need all four of /joint_limits_{gold,green}_{min,max}, %d entries each", MAX_DOF_PER_MECH);
+		return -1;
+	}
+
+	// by each mechanism's arm type, as the gains are
+	for (int i = 0; i < NUM_MECH && cfg_device != NULL; i++)
+	{
+		int gold = cfg_device->mech[i].type == GOLD_ARM;
+		if (!gold && cfg_device->mech[i].type != GREEN_ARM)
+			continue;
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			int t = JOINT_TYPE(i, j);
+			c->min_limit[t] = xmlNumber(gold ? min_gold[j] : min_green[j]);
+			c->max_limit[t] = xmlNumber(gold ? max_gold[j] : max_green[j]);
+		}
+	}
+	return 0;
+}
+
+/**\fn int configReadParams(ros::NodeHandle &n, struct ctrl_config *c)
+ * \brief re-read the gains and joint limits from the parameter server into c
+ *
+ * Gains map onto the joint types as init_ravengains() maps them.  Scales
+ * are left as they are.
+ *
+ * \return 0, or -1 if a list is missing or malformed (c unchanged)
+ */
+int configReadParams(ros::NodeHandle &n, struct ctrl_config *c)
+{
+	XmlRpc::XmlRpcValue kp_gold, kp_green, kd_gold, kd_green, ki_gold, ki_green;
+	struct ctrl_config r = *c;
+
+	if (cfg_device == NULL ||
+	    readJointLists(n, "/gains_gold_kp", "/gains_green_kp", kp_gold, kp_green) < 0 ||
+	    readJointLists(n, "/gains_gold_kd", "/gains_green_kd", kd_gold, kd_green) < 0 ||
+	    readJointLists(n, "/gains_gold_ki", "/gains_green_ki", ki_gold, ki_green) < 0)
+	{
+		ROS_ERROR("Gains reload: /gains_{gold,green}_{kp,kd,ki} need %d entries each", MAX_DOF_PER_MECH);
+		return -1;
+	}
+
+	for (int i = 0; i < NUM_MECH; i++)
+	{
+		int gold = cfg_device->mech[i].type == GOLD_ARM;
+		if (!gold && cfg_device->mech[i].type != GREEN_ARM)
+			continue;
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			int t = JOINT_TYPE(i, j);
+			r.kp[t] = xmlNumber(gold ? kp_gold[j] : kp_green[j]);
+			r.kd[t] = xmlNumber(gold ? kd_gold[j] : kd_green[j]);
+			r.ki[t] = xmlNumber(gold ? ki_gold[j] : ki_green[j]);
+		}
+	}
+	if (readLimits(n, &r) < 0)
+		return -1;
+
+	*c = r;
+	return 0;
+}
+
+/**\fn static int configValid(const struct ctrl_config *c)
+ * \brief finite gains, non-negative scales, and no limit above its other end
+ */
+static int configValid(const struct ctrl_config *c)
+{
+	if (!(c->kp_scale >= 0 && c->kd_scale >= 0 && c->ki_scale >= 0))
+		return 0;
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		if (!isfinite(c->kp[t]) || !isfinite(c->kd[t]) || !isfinite(c->ki[t]))
+			return 0;
+		float lo = isnan(c->min_limit[t]) ? DOF_types[t].min_limit : c->min_limit[t];
+		float hi = isnan(c->max_limit[t]) ? DOF_types[t].max_limit : c->max_limit[t];
+		if (!(lo <= hi) && !(isnan(c->min_limit[t]) && isnan(c->max_limit[t])))
+			return 0;
+	}
+	return 1;
+}
+
+/**\fn void configLatest(struct ctrl_config *c)
+ * \brief copy of the last published config, to edit and hand to configPublish()
+ */
+void configLatest(struct ctrl_config *c)
+{
+	pthread_mutex_lock(&cfg_mutex);
+	*c = cfg_latest;
+	pthread_mutex_unlock(&cfg_mutex);
+}
+
+/**\fn int configPublish(const struct ctrl_config *c)
+ * \brief make c the config the control loop switches to at its next cycle
+ *
+ * May wait up to CFG_SWAP_WAIT_MS for the loop to pick up the previous
+ * one; if the loop is not running it stops waiting, the loop picks up the
+ * new one when it starts.  Not for the control thread.
+ *
+ * \return 0, or -1 (nothing published) before init_control_config() or if c is out of range
+ */
+int configPublish(const struct ctrl_config *c)
+{
+	if (cfg_device == NULL || !configValid(c))
+		return -1;
+
+	pthread_mutex_lock(&cfg_mutex);
+	struct ctrl_config *cur = cfg_active;
+	for (int i = 0; cur != NULL && cfg_in_use != cur && i < CFG_SWAP_WAIT_MS * 10; i++)
+		usleep(100);
+
+	struct ctrl_config *next = (cur == &cfg_slots[0]) ? &cfg_slots[1] : &cfg_slots[0];
+	*next = *c;
+	next->version = cfg_latest.version + 1;
+	cfg_latest = *next;
+	__sync_synchronize();
+	(void)__sync_lock_test_and_set(&cfg_active, next);
+	pthread_mutex_unlock(&cfg_mutex);
+
+	log_msg("Control config v%u published (gain scales %.2f/%.2f/%.2f)", next->version,
+	        next->kp_scale, next->kd_scale, next->ki_scale);
+	return 0;
+}
+
+/**\fn static void configToDOFTypes(const struct ctrl_config *c)
+ * \brief write a config's scaled gains and its limits into DOF_types[]
+ */
+static void configToDOFTypes(const struct ctrl_config *c)
+{
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		DOF_types[t].KP = c->kp[t] * c->kp_scale;
+		DOF_types[t].KD = c->kd[t] * c->kd_scale;
+		DOF_types[t].KI = c->ki[t] * c->ki_scale;
+		if (!isnan(c->min_limit[t]))
+			DOF_types[t].min_limit = c->min_limit[t];
+		if (!isnan(c->max_limit[t]))
+			DOF_types[t].max_limit = c->max_limit[t];
+	}
+}
+
+/**\fn void configSwap(void)
+ * \brief control thread, once per cycle before control: switch to a newly published config
+ *
+ * Costs one pointer compare when there is nothing new.
+ */
+void configSwap(void)
+{
+	struct ctrl_config *c = cfg_active;
+	if (c == cfg_in_use)
+		return;
+
+	configToDOFTypes(c);
+	jointBlockLoadConstants();
+	cfg_applied_version = c->version;
+	__sync_synchronize();
+	cfg_in_use = c;
+}
+
+/**\fn void configApplyNow(void)
+ * \brief control thread: put the newest config into DOF_types[]
+ *
+ * For initDOFs(), which resets the limits to the built-in ones and then
+ * has the joint block load its constants.  Does nothing before
+ * init_control_config().
+ */
+void configApplyNow(void)
+{
+	struct ctrl_config *c = cfg_active;
+	if (c == NULL)
+		return;
+
+	configToDOFTypes(c);
+	cfg_applied_version = c->version;
+	__sync_synchronize();
+	cfg_in_use = c;
+}
+
+/**\fn u_32 configVersion(void)
+ * \brief version of the config the control loop is running with, 0 before the first
+ */
+u_32 configVersion(void)
+{
+	return cfg_applied_version;
+}
+
+/**\fn int init_control_config(ros::NodeHandle &n, struct device *device0)
+ * \brief publish the first config: the gains init_ravengains() set, unscaled, and any limits on the parameter server
+ *
+ * Call after init_ravengains().
+ *
+ * \return 0, or -1 if the limits on the parameter server are malformed (built-in limits kept)
+ */
+int init_control_config(ros::NodeHandle &n, struct device *device0)
+{
+	struct ctrl_config c;
+	int ret = 0;
+
+	cfg_device = device0;
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		c.kp[t] = DOF_types[t].KP;
+		c.kd[t] = DOF_types[t].KD;
+		c.ki[t] = DOF_types[t].KI;
+		c.min_limit[t] = c.max_limit[t] = NAN;
+	}
+	c.kp_scale = c.kd_scale = c.ki_scale = 1;
+	if (readLimits(n, &c) < 0)
+		ret = -1;
+
+	if (configPublish(&c) < 0)
+	{
+		ROS_ERROR("Control config: joint limits out of range, keeping the built-in ones");
+		for (int t = 0; t < JB_N_JOINTS; t++)
+			c.min_limit[t] = c.max_limit[t] = NAN;
+		configPublish(&c);
+		ret = -1;
+	}
+	return ret;
+}
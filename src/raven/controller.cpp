@@ -0,0 +1,121 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file controller.cpp
+ * \brief Registry of the control laws, see controller.h
+ *
+ * A fixed table by mode, filled before the RT thread starts and only read
+ * afterwards.
+ */
+
+#include <dlfcn.h>
+#include <string>
+
+#include "controller.h"
+#include "rt_raven.h"
+#include "log.h"
+
+static const struct raven_controller *by_mode[MAX_CONTROL_MODES];
+
+/**\fn int controllerRegister(const struct raven_controller *c, int replace)
+ * \brief add a controller for its mode.  Startup only.
+ * \param c the controller; must outlive the program
+ * \param replace nonzero to take the mode over from a controller already registered
+ * \return 0, or -1 for a bad controller or a mode taken
+ */
+int controllerRegister(const struct raven_controller *c, int replace)
+{
+	if (c == NULL || c->abi != RAVEN_CONTROLLER_ABI || c->update == NULL ||
+	    c->mode < 0 || c->mode >= MAX_CONTROL_MODES)
+		return -1;
+	if (by_mode[c->mode] != NULL && !replace)
+		return -1;
+	if (by_mode[c->mode] != NULL)
+		log_msg("Controller %s replaces %s for mode %d", c->name, by_mode[c->mode]->name, c->mode);
+	by_mode[c->mode] = c;
+	return 0;
+}
+
+/**\fn const struct raven_controller *controllerFor(int mode)
+ * \brief the controller of a control mode, NULL if none
+ */
+const struct raven_controller *controllerFor(int mode)
+{
+	if (mode < 0 || mode >= MAX_CONTROL_MODES)
+		return NULL;
+	return by_mode[mode];
+}
+
+/**\fn static void loadPlugin(const std::string &path)
+ * \brief register the controller of one shared library
+ */
+static void loadPlugin(const std::string &path)
+{
+	void *lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (lib == NULL)
+	{
+		err_msg("Controller plugin %s: %s", path.c_str(), dlerror());
+		return;
+	}
+	raven_controller_plugin_fn fn = (raven_controller_plugin_fn)dlsym(lib, RAVEN_CONTROLLER_PLUGIN_SYMBOL);
+	const struct raven_controller *c = fn ? fn() : NULL;
+	if (c == NULL || controllerRegister(c, 1) < 0)
+	{
+		err_msg("Controller plugin %s: no %s, ABI other than %d, or bad mode",
+		        path.c_str(), RAVEN_CONTROLLER_PLUGIN_SYMBOL, RAVEN_CONTROLLER_ABI);
+		dlclose(lib);
+		return;
+	}
+	log_msg("Controller plugin %s: %s, mode %d", path.c_str(), c->name, c->mode);
+	// The library stays loaded for the life of the process
+}
+
+/**\fn int init_controllers(ros::NodeHandle &n, struct device *device0)
+ * \brief register the built-in controllers and /controller_plugins, then initialise them all.  Before the RT thread starts.
+ * \return 0
+ */
+int init_controllers(ros::NodeHandle &n, struct device *device0)
+{
+	registerBuiltinControllers();
+
+	XmlRpc::XmlRpcValue v;
+	if (n.hasParam("/controller_plugins") && n.getParam("/controller_plugins", v))
+	{
+		if (v.getType() == XmlRpc::XmlRpcValue::TypeArray)
+		{
+			for (int i = 0; i < v.size(); i++)
+				if (v[i].getType() == XmlRpc::XmlRpcValue::TypeString)
+					loadPlugin((std::string)v[i]);
+		}
+		else
+			err_msg("/controller_plugins: need a list of shared library paths");
+	}
+
+	for (int m = 0; m < MAX_CONTROL_MODES; m++)
+	{
+		const struct raven_controller *c = by_mode[m];
+		if (c != NULL && c->init != NULL && c->init(n, device0) != 0)
+		{
+			err_msg("Controller %s failed to initialise, mode %d unavailable", c->name, m);
+			by_mode[m] = NULL;
+		}
+	}
+	return 0;
+}
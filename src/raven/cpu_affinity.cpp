@@ -0,0 +1,351 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cpu_affinity.cpp
+ * \brief Pin the r2_control threads to configured cores.
+ *
+ * On multi-core control PCs the worst jitter comes from the ROS spinner and
+ * network thread landing on the RT core.  init_cpu_affinity() moves every
+ * thread that exists at startup (main and the ROS internals) onto the
+ * housekeeping cores, so threads created later inherit that mask.  Each of our
+ * own threads then calls set_thread_affinity() with its role.
+ */
+
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "cpu_affinity.h"
+#include "DS0.h"
+#include "USB_init.h"
+#include "log.h"
+
+static cpu_set_t role_cpus[ROLE_LAST];
+static int role_pinned[ROLE_LAST] = {0};
+static int role_cpu[ROLE_LAST] = {-1, -1, -1};   // the single core of ROLE_RT / ROLE_NETWORK
+static int arm_cpus[MAX_MECH];
+static int num_arm_cpus = 0;
+static int usb_cpus[MAX_BOARD_COUNT];
+static int num_usb_cpus = 0;
+
+/**\fn static int parse_cpu_list(const char *str, cpu_set_t *set)
+ * \brief parse a kernel-style cpu list ("0,2-3") into a cpu set
+ * \param str  the cpu list
+ * \param set  the resulting cpu set
+ * \return number of cpus in the set, -1 on a malformed list
+ */
+static int parse_cpu_list(const char *str, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	const char *p = str;
+	while (*p != '\0' && *p != '\n')
+	{
+		char *end;
+		long lo = strtol(p, &end, 10);
+		if (end == p || lo < 0 || lo >= CPU_SETSIZE)
+			return -1;
+		long hi = lo;
+		p = end;
+		if (*p == '-')
+		{
+			hi = strtol(p+1, &end, 10);
+			if (end == p+1 || hi < lo || hi >= CPU_SETSIZE)
+				return -1;
+			p = end;
+		}
+		for (long c = lo; c <= hi; c++)
+			CPU_SET(c, set);
+		if (*p == ',')
+			p++;
+	}
+	return CPU_COUNT(set);
+}
+
+/**\fn static int read_sys_cpu_list(const char *path, cpu_set_t *set)
+ * \brief read a cpu list from sysfs
+ * \param path  sysfs file
+ * \param set   the resulting cpu set
+ * \return number of cpus in the set, -1 if the file can't be read
+ */
+static int read_sys_cpu_list(const char *path, cpu_set_t *set)
+{
+	char buf[256] = {0};
+	FILE *f = fopen(path, "r");
+	CPU_ZERO(set);
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, sizeof(buf), f) == NULL)
+		buf[0] = '\0';
+	fclose(f);
+	return parse_cpu_list(buf, set);
+}
+
+/**\fn static void check_isolation(int rt_cpu)
+ * \brief warn if the RT core is not isolated from the scheduler and tick
+ * \param rt_cpu the RT core
+ */
+static void check_isolation(int rt_cpu)
+{
+	cpu_set_t isolated, nohz;
+
+	if (read_sys_cpu_list("/sys/devices/system/cpu/isolated", &isolated) <= 0 ||
+	    !CPU_ISSET(rt_cpu, &isolated))
+		err_msg("WARNING: RT cpu %d is not in isolcpus.  Other tasks may run on it.", rt_cpu);
+
+	if (read_sys_cpu_list("/sys/devices/system/cpu/nohz_full", &nohz) <= 0 ||
+	    !CPU_ISSET(rt_cpu, &nohz))
+		log_msg("  RT cpu %d is not in nohz_full (scheduler tick stays on).", rt_cpu);
+}
+
+/**\fn static void pin_existing_threads(const cpu_set_t *set)
+ * \brief set the affinity of every thread currently in the process
+ * \param set the cpu set to apply
+ */
+static void pin_existing_threads(const cpu_set_t *set)
+{
+	DIR *dp = opendir("/proc/self/task");
+	struct dirent *dirp;
+	if (dp == NULL)
+	{
+		perror("opendir /proc/self/task");
+		return;
+	}
+	while ((dirp = readdir(dp)) != NULL)
+	{
+		if (dirp->d_name[0] == '.')
+			continue;
+		pid_t tid = atoi(dirp->d_name);
+		if (sched_setaffinity(tid, sizeof(cpu_set_t), set) < 0)
+			err_msg("sched_setaffinity failed for thread %d", tid);
+	}
+	closedir(dp);
+}
+
+/**\fn static void set_irq_affinity(const std::string &irqs, const std::string &cpus)
+ * \brief steer interrupts onto a cpu list via /proc/irq/N/smp_affinity_list
+ * \param irqs  comma separated IRQ numbers
+ * \param cpus  cpu list to allow for those IRQs
+ */
+static void set_irq_affinity(const std::string &irqs, const std::string &cpus)
+{
+	const char *p = irqs.c_str();
+	while (*p != '\0')
+	{
+		char *end;
+		long irq = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		p = (*end == ',') ? end+1 : end;
+
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/irq/%ld/smp_affinity_list", irq);
+		FILE *f = fopen(path, "w");
+		if (f == NULL || fprintf(f, "%s\n", cpus.c_str()) < 0)
+			err_msg("WARNING: could not set affinity of IRQ %ld (need root?)", irq);
+		else
+			log_msg("  IRQ %ld -> cpus %s", irq, cpus.c_str());
+		if (f != NULL)
+			fclose(f);
+	}
+}
+
+/**\fn static int parse_worker_cpus(const char *name, const std::string &list, int *cpus, int max, int cpu_rt, int cpu_net)
+ * \brief a worker cpu list, one core per worker in ascending order
+ * \param name  parameter name, for the messages
+ * \param list  the cpu list ("": none)
+ * \param cpus  the cores, at most max of them
+ * \return number of cores, -1 on a malformed list
+ */
+static int parse_worker_cpus(const char *name, const std::string &list, int *cpus, int max, int cpu_rt, int cpu_net)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+	int count = 0;
+
+	if (list.empty())
+		return 0;
+	if (parse_cpu_list(list.c_str(), &set) <= 0)
+	{
+		err_msg("ERROR: bad %s list \"%s\"", name, list.c_str());
+		return -1;
+	}
+	for (int c = 0; c < ncpus && count < max; c++)
+	{
+		if (!CPU_ISSET(c, &set))
+			continue;
+		if (c == cpu_rt || c == cpu_net ||
+		    (role_pinned[ROLE_HOUSEKEEPING] && CPU_ISSET(c, &role_cpus[ROLE_HOUSEKEEPING])))
+			err_msg("WARNING: %s cpu %d is shared with another thread role", name, c);
+		check_isolation(c);
+		cpus[count++] = c;
+	}
+	return count;
+}
+
+/**\fn int init_cpu_affinity(ros::NodeHandle &n)
+ * \brief read affinity parameters, check core isolation, and pin the threads that already exist
+ * \param n ROS node handle
+ * \return 0 on success, -1 on bad parameters
+ */
+int init_cpu_affinity(ros::NodeHandle &n)
+{
+	int cpu_rt, cpu_net;
+	std::string housekeeping, irqs, arm_workers, usb_workers;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	n.param("/cpu_rt", cpu_rt, -1);
+	n.param("/cpu_network", cpu_net, -1);
+	n.param<std::string>("/cpus_housekeeping", housekeeping, "");
+	n.param<std::string>("/usb_irqs", irqs, "");
+	n.param<std::string>("/cpus_arm_workers", arm_workers, "");
+	n.param<std::string>("/cpus_usb_workers", usb_workers, "");
+
+	if (cpu_rt >= ncpus || cpu_net >= ncpus)
+	{
+		err_msg("ERROR: cpu_rt (%d) / cpu_network (%d) out of range, %ld cpus online", cpu_rt, cpu_net, ncpus);
+		return -1;
+	}
+
+	if (cpu_rt >= 0)
+	{
+		CPU_ZERO(&role_cpus[ROLE_RT]);
+		CPU_SET(cpu_rt, &role_cpus[ROLE_RT]);
+		role_pinned[ROLE_RT] = 1;
+		role_cpu[ROLE_RT] = cpu_rt;
+		check_isolation(cpu_rt);
+	}
+	if (cpu_net >= 0)
+	{
+		CPU_ZERO(&role_cpus[ROLE_NETWORK]);
+		CPU_SET(cpu_net, &role_cpus[ROLE_NETWORK]);
+		role_pinned[ROLE_NETWORK] = 1;
+		role_cpu[ROLE_NETWORK] = cpu_net;
+		if (cpu_net == cpu_rt)
+			err_msg("WARNING: network thread shares the RT cpu %d", cpu_rt);
+	}
+	if (!housekeeping.empty())
+	{
+		if (parse_cpu_list(housekeeping.c_str(), &role_cpus[ROLE_HOUSEKEEPING]) <= 0)
+		{
+			err_msg("ERROR: bad cpus_housekeeping list \"%s\"", housekeeping.c_str());
+			return -1;
+		}
+		role_pinned[ROLE_HOUSEKEEPING] = 1;
+		if (cpu_rt >= 0 && CPU_ISSET(cpu_rt, &role_cpus[ROLE_HOUSEKEEPING]))
+			err_msg("WARNING: housekeeping cpus \"%s\" include the RT cpu %d", housekeeping.c_str(), cpu_rt);
+
+		// main, ROS spinner and ROS internal threads.  Threads created later inherit this.
+		pin_existing_threads(&role_cpus[ROLE_HOUSEKEEPING]);
+
+		if (!irqs.empty())
+			set_irq_affinity(irqs, housekeeping);
+	}
+
+	num_arm_cpus = parse_worker_cpus("cpus_arm_workers", arm_workers, arm_cpus, MAX_MECH, cpu_rt, cpu_net);
+	num_usb_cpus = parse_worker_cpus("cpus_usb_workers", usb_workers, usb_cpus, MAX_BOARD_COUNT, cpu_rt, cpu_net);
+	if (num_arm_cpus < 0 || num_usb_cpus < 0)
+	{
+		num_arm_cpus = num_usb_cpus = 0;
+		return -1;
+	}
+
+	log_msg("CPU affinity: rt %d, network %d, housekeeping \"%s\", arm workers \"%s\", usb workers \"%s\"", cpu_rt,
+	        cpu_net, housekeeping.c_str(), arm_workers.c_str(), usb_workers.c_str());
+	return 0;
+}
+
+/**\fn int set_thread_affinity(int role)
+ * \brief pin the calling thread to the cores configured for its role
+ * \param role the thread_role of the caller
+ * \return 0 on success (or nothing configured), negative errno on failure
+ */
+int set_thread_affinity(int role)
+{
+	if (role < 0 || role >= ROLE_LAST || !role_pinned[role])
+		return 0;
+
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &role_cpus[role]);
+	if (ret != 0)
+	{
+		err_msg("pthread_setaffinity_np failed for thread role %d", role);
+		return -ret;
+	}
+	return 0;
+}
+
+/**\fn int thread_role_pinned(int role)
+ * \brief true if a core is configured for the thread role
+ */
+int thread_role_pinned(int role)
+{
+	return role >= 0 && role < ROLE_LAST && role_pinned[role];
+}
+
+/**\fn int thread_role_cpu(int role)
+ * \brief the core of a single-core role (ROLE_RT, ROLE_NETWORK)
+ * \return the cpu, or -1 if the role is not pinned or has a cpu list
+ */
+int thread_role_cpu(int role)
+{
+	return (role >= 0 && role < ROLE_LAST) ? role_cpu[role] : -1;
+}
+
+/**\fn int arm_worker_cpu(int k)
+ * \brief core of arm worker k, the k-th cpu of /cpus_arm_workers in ascending order
+ * \return the cpu, or -1 if the list has no k-th entry
+ */
+int arm_worker_cpu(int k)
+{
+	return (k >= 0 && k < num_arm_cpus) ? arm_cpus[k] : -1;
+}
+
+/**\fn int usb_worker_cpu(int k)
+ * \brief core of the USB worker of board index k, the k-th cpu of /cpus_usb_workers in ascending order
+ * \return the cpu, or -1 if the list has no k-th entry
+ */
+int usb_worker_cpu(int k)
+{
+	return (k >= 0 && k < num_usb_cpus) ? usb_cpus[k] : -1;
+}
+
+/**\fn int set_thread_cpu(int cpu)
+ * \brief pin the calling thread to a single core
+ * \param cpu the core
+ * \return 0 on success, negative errno on failure
+ */
+int set_thread_cpu(int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+	if (ret != 0)
+	{
+		err_msg("pthread_setaffinity_np failed for cpu %d", cpu);
+		return -ret;
+	}
+	return 0;
+}
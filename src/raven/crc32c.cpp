@@ -0,0 +1,149 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file crc32c.cpp
+ * \brief CRC-32C with hardware acceleration.
+ *
+ * x86-64: the SSE4.2 crc32 instruction, detected with cpuid at first use.
+ * ARMv8: the CRC32C instructions when built with the crc extension.
+ * Anything else: a byte-wise table.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78   // reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[256];
+static int crc32c_hw = -1;        // -1: not yet probed
+
+/**\fn static void crc32cInit()
+ * \brief build the software table and probe for the instructions
+ */
+static void crc32cInit()
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c >> 1) ^ (CRC32C_POLY & (0 - (c & 1)));
+		crc32c_table[i] = c;
+	}
+
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	crc32c_hw = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2)) ? 1 : 0;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	crc32c_hw = 1;
+#else
+	crc32c_hw = 0;
+#endif
+}
+
+/**\fn static uint32_t crc32cSoft(uint32_t crc, const unsigned char *p, size_t len)
+ * \brief table driven CRC-32C
+ */
+static uint32_t crc32cSoft(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len--)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__)
+/**\fn static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len)
+ * \brief CRC-32C with the SSE4.2 crc32 instruction, 8 bytes at a time
+ */
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t c = crc;
+	while (len >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		__asm__("crc32q %1, %0" : "+r"(c) : "rm"(v));
+		p += 8;
+		len -= 8;
+	}
+	uint32_t c32 = (uint32_t)c;
+	while (len--)
+		__asm__("crc32b %1, %0" : "+r"(c32) : "rm"(*p++));
+	return c32;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/**\fn static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len)
+ * \brief CRC-32C with the ARMv8 crc32c instructions, 8 bytes at a time
+ */
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		crc = __crc32cd(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = __crc32cb(crc, *p++);
+	return crc;
+}
+#else
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	return crc32cSoft(crc, p, len);
+}
+#endif
+
+/**\fn unsigned int crc32c(unsigned int crc, const void *buf, size_t len)
+ * \brief CRC-32C of a buffer
+ * \param crc 0 to start, or the result of a previous call to continue
+ * \param buf the data
+ * \param len its length in bytes
+ * \return the CRC
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, size_t len)
+{
+	if (crc32c_hw < 0)
+		crc32cInit();
+
+	const unsigned char *p = (const unsigned char *)buf;
+	uint32_t c = ~crc;
+	c = crc32c_hw ? crc32cHw(c, p, len) : crc32cSoft(c, p, len);
+	return ~c;
+}
+
+/**\fn int crc32cHardware(void)
+ * \brief true if crc32c() uses CPU instructions
+ */
+int crc32cHardware(void)
+{
+	if (crc32c_hw < 0)
+		crc32cInit();
+	return crc32c_hw;
+}
@@ -0,0 +1,136 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cycle_scheduler.cpp
+ * \brief Absolute-deadline scheduler with overrun accounting for rt_process().
+ */
+
+#include "cycle_scheduler.h"
+#include "utils.h"
+#include "control_clock.h"
+#include "log.h"
+#include "metrics.h"
+
+/**\fn static inline long long tsToNs(const struct timespec *t)
+ * \brief convert a timespec to nanoseconds
+ */
+static inline long long tsToNs(const struct timespec *t)
+{
+	return (long long)t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+}
+
+/**\fn static inline void tsAddNs(struct timespec *t, long long ns)
+ * \brief add nanoseconds to a timespec
+ */
+static inline void tsAddNs(struct timespec *t, long long ns)
+{
+	t->tv_sec  += ns / NSEC_PER_SEC;
+	t->tv_nsec += ns % NSEC_PER_SEC;
+	tsnorm(t);
+}
+
+/**\fn void cycleSchedInit(struct cycle_sched *cs, long period_ns, int policy, int max_backlog, long delay_ns)
+ * \brief initialize the scheduler.  The first wakeup is delay_ns from now.
+ * \param cs          scheduler state
+ * \param period_ns   loop period in nanoseconds
+ * \param policy      CYCLE_SKIP or CYCLE_COMPRESS
+ * \param max_backlog most periods to catch up on with CYCLE_COMPRESS before skipping
+ * \param delay_ns    delay before the first cycle
+ */
+void cycleSchedInit(struct cycle_sched *cs, long period_ns, int policy, int max_backlog, long delay_ns)
+{
+	cs->period_ns = period_ns;
+	cs->policy = policy;
+	cs->max_backlog = max_backlog < 1 ? 1 : max_backlog;
+	cs->cycles = cs->missed = cs->skipped = 0;
+	cs->consecutive_missed = cs->max_consecutive = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &cs->next);
+	tsAddNs(&cs->next, delay_ns);
+}
+
+/**\fn int cycleSchedWait(struct cycle_sched *cs)
+ * \brief sleep until the next cycle deadline, accounting for overruns.  RT safe.
+ * \param cs scheduler state
+ * \return number of periods this cycle is late (0 if it started on time)
+ */
+int cycleSchedWait(struct cycle_sched *cs)
+{
+	struct timespec tnow;
+	int late = 0;
+
+	// Lockstep: the next cycle starts now, on the virtual clock
+	if (controlClockLockstep())
+	{
+		cs->cycles++;
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &tnow);
+	if ( !isbefore(tnow, cs->next) )
+	{
+		// Deadline already passed
+		late = (int)((tsToNs(&tnow) - tsToNs(&cs->next)) / cs->period_ns) + 1;
+		cs->missed++;
+		cs->consecutive_missed++;
+		metricInc(MC_DEADLINE_MISSED);
+		if (cs->consecutive_missed > cs->max_consecutive)
+			cs->max_consecutive = cs->consecutive_missed;
+
+		if (cs->policy == CYCLE_COMPRESS && late <= cs->max_backlog)
+		{
+			// Run now and stay on the original grid
+			tsAddNs(&cs->next, cs->period_ns);
+			cs->cycles++;
+			return late;
+		}
+
+		// Drop the missed periods and wait for the next slot
+		tsAddNs(&cs->next, (long long)late * cs->period_ns);
+		cs->skipped += late;
+	}
+	else
+	{
+		cs->consecutive_missed = 0;
+	}
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &cs->next, NULL);
+	tsAddNs(&cs->next, cs->period_ns);
+	cs->cycles++;
+	return late;
+}
+
+/**\fn void outputCycleSchedStats(const struct cycle_sched *cs)
+ * \brief print missed deadline counters.  Not RT safe.
+ * \param cs scheduler state
+ */
+void outputCycleSchedStats(const struct cycle_sched *cs)
+{
+	unsigned long long cycles = cs->cycles;
+	unsigned long long missed = cs->missed;
+
+	log_msg("Cycle scheduler: period %ld ns, policy %s, %llu cycles, %llu missed (%.4f%%), %llu skipped, worst run %d",
+			cs->period_ns,
+			cs->policy == CYCLE_COMPRESS ? "compress" : "skip",
+			cycles, missed,
+			cycles ? 100.0 * missed / cycles : 0.0,
+			(unsigned long long)cs->skipped,
+			cs->max_consecutive);
+}
@@ -0,0 +1,251 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file cycle_timing.cpp
+ * \brief Per-stage cycle-time histograms for the rt_process() control loop.
+ *
+ * The RT thread is the only writer.  Readers copy the histogram without
+ * locking; a count read mid-update is off by at most one sample, which is
+ * fine for latency statistics and keeps the RT side lock free.
+ */
+
+#include <string.h>
+
+#include "cycle_timing.h"
+#include "log.h"
+
+static struct cycle_hist cycle_hists[CT_NUM_STAGES];
+static long long cycle_last_ns[CT_NUM_STAGES];   // most recent sample of each stage
+
+static const char* cycle_stage_names[CT_NUM_STAGES] = {
+	"period",
+	"usb_initiate",
+	"usb_wait",
+	"state_machine",
+	"device_state",
+	"control",
+	" init_robot",
+	" state_estimate",
+	" fwd_cable",
+	" fwd_kin",
+	" control_mode",
+	"overdrive",
+	"usb_put",
+	"publish",
+	"compute_total",
+	"teleop_latency",
+};
+
+// Master packet consumed by this cycle's control, waiting for the DAC write
+static struct timespec teleop_rx_stamp;
+static int teleop_pending = 0;
+static int teleop_last_sequence = -1;
+static double teleop_latency_avg_ns = 0;        // running average of CT_TELEOP_LATENCY, 0: none yet
+
+/**\fn static inline int ctBin(u_64 ns)
+ * \brief get the log-scale histogram bin for a duration
+ * \param ns duration in nanoseconds
+ * \return bin index
+ */
+static inline int ctBin(u_64 ns)
+{
+	if (ns < (1ULL<<CT_HIST_MIN_SHIFT))
+		return 0;
+
+	int msb = 63 - __builtin_clzll(ns);
+	if (msb >= CT_HIST_MAX_SHIFT)
+		return CT_HIST_BINS-1;
+
+	int sub = (ns >> (msb - CT_HIST_SUB_BITS)) & (CT_HIST_SUB_BINS-1);
+	return (msb - CT_HIST_MIN_SHIFT) * CT_HIST_SUB_BINS + sub + 1;
+}
+
+/**\fn static u_64 ctBinUpper(int bin)
+ * \brief get the upper edge of a histogram bin
+ * \param bin histogram bin index
+ * \return upper edge of the bin in nanoseconds
+ */
+static u_64 ctBinUpper(int bin)
+{
+	if (bin == 0)
+		return 1ULL<<CT_HIST_MIN_SHIFT;
+	if (bin >= CT_HIST_BINS-1)
+		return 1ULL<<CT_HIST_MAX_SHIFT;
+
+	int msb = (bin-1) / CT_HIST_SUB_BINS + CT_HIST_MIN_SHIFT;
+	int sub = (bin-1) % CT_HIST_SUB_BINS;
+	return (u_64)(CT_HIST_SUB_BINS + sub + 1) << (msb - CT_HIST_SUB_BITS);
+}
+
+/**\fn void cycleTimingRecord(int stage, long long ns)
+ * \brief add one sample to a stage histogram.  RT safe.
+ * \param stage the cycle_stage being recorded
+ * \param ns    duration of the stage in nanoseconds
+ */
+void cycleTimingRecord(int stage, long long ns)
+{
+	if (stage < 0 || stage >= CT_NUM_STAGES)
+		return;
+	if (ns < 0)
+		ns = 0;
+
+	struct cycle_hist *h = &cycle_hists[stage];
+	cycle_last_ns[stage] = ns;
+	h->bins[ctBin(ns)]++;
+	h->total_ns += ns;
+	if ((u_64)ns > h->max_ns)
+		h->max_ns = ns;
+	h->count++;
+}
+
+/**\fn long long cycleTimingLast(int stage)
+ * \brief the most recent duration recorded for a stage (RT thread, for the flight recorder)
+ */
+long long cycleTimingLast(int stage)
+{
+	if (stage < 0 || stage >= CT_NUM_STAGES)
+		return 0;
+	return cycle_last_ns[stage];
+}
+
+/**\fn const char *cycleStageName(int stage)
+ * \brief printable name of a cycle_stage
+ */
+const char *cycleStageName(int stage)
+{
+	if (stage < 0 || stage >= CT_NUM_STAGES)
+		return "?";
+	return cycle_stage_names[stage];
+}
+
+/**\fn void cycleTimingMark(int stage, struct timespec *t)
+ * \brief record the time elapsed since *t for a stage and move *t up to now.  RT safe.
+ * \param stage the cycle_stage that just finished
+ * \param t     start time of the stage, updated to the current time
+ */
+void cycleTimingMark(int stage, struct timespec *t)
+{
+	struct timespec tnow;
+	clock_gettime(CLOCK_MONOTONIC, &tnow);
+
+	long long ns = (long long)(tnow.tv_sec - t->tv_sec) * 1000000000LL + (tnow.tv_nsec - t->tv_nsec);
+	cycleTimingRecord(stage, ns);
+	*t = tnow;
+}
+
+/**\fn void teleopLatencyConsume(int sequence, const struct timespec *rx_stamp)
+ * \brief note that this cycle's command comes from master packet sequence.  RT safe.
+ *
+ * Only the first cycle that uses a packet counts; later cycles reusing the
+ * same command are not new latency samples.
+ * \param sequence the packet's sequence number (param_pass last_sequence)
+ * \param rx_stamp its receive time, CLOCK_REALTIME
+ */
+void teleopLatencyConsume(int sequence, const struct timespec *rx_stamp)
+{
+	if (sequence == teleop_last_sequence || rx_stamp->tv_sec == 0)
+		return;
+	teleop_last_sequence = sequence;
+	teleop_rx_stamp = *rx_stamp;
+	teleop_pending = 1;
+}
+
+/**\fn void teleopLatencyRecord()
+ * \brief record receive-to-DAC latency once the consumed command is written out.  RT safe.
+ */
+void teleopLatencyRecord()
+{
+	struct timespec tnow;
+
+	if (!teleop_pending)
+		return;
+	teleop_pending = 0;
+
+	clock_gettime(CLOCK_REALTIME, &tnow);
+	long long ns = (long long)(tnow.tv_sec - teleop_rx_stamp.tv_sec) * 1000000000LL + (tnow.tv_nsec - teleop_rx_stamp.tv_nsec);
+	cycleTimingRecord(CT_TELEOP_LATENCY, ns);
+
+	if (ns < 0)
+		ns = 0;
+	teleop_latency_avg_ns = teleop_latency_avg_ns > 0 ? teleop_latency_avg_ns + (ns - teleop_latency_avg_ns) / 16 : ns;
+}
+
+/**\fn double teleopLatencyAverage()
+ * \brief running average of the receive-to-DAC latency, ns (0 before the first sample).  RT thread.
+ */
+double teleopLatencyAverage()
+{
+	return teleop_latency_avg_ns;
+}
+
+/**\fn static u_64 ctPercentile(const struct cycle_hist *h, double pct)
+ * \brief estimate a percentile from a histogram
+ * \param h   histogram snapshot
+ * \param pct percentile, 0..1
+ * \return upper edge of the bin containing the percentile, in nanoseconds
+ */
+static u_64 ctPercentile(const struct cycle_hist *h, double pct)
+{
+	u_64 total = 0;
+	for (int i=0; i<CT_HIST_BINS; i++)
+		total += h->bins[i];
+	if (total == 0)
+		return 0;
+
+	u_64 target = (u_64)(pct * total);
+	if (target >= total)
+		target = total-1;
+
+	u_64 seen = 0;
+	for (int i=0; i<CT_HIST_BINS; i++)
+	{
+		seen += h->bins[i];
+		if (seen > target)
+		{
+			u_64 upper = ctBinUpper(i);
+			return upper < h->max_ns ? upper : h->max_ns;
+		}
+	}
+	return h->max_ns;
+}
+
+/**\fn void outputCycleTiming()
+ * \brief print p50/p99/max for every stage.  Not RT safe: call from a non-RT thread.
+ */
+void outputCycleTiming()
+{
+	struct cycle_hist h;
+
+	log_msg("Cycle timing (us):   %-16s %10s %8s %8s %8s %8s", "stage", "count", "mean", "p50", "p99", "max");
+	for (int s=0; s<CT_NUM_STAGES; s++)
+	{
+		memcpy(&h, &cycle_hists[s], sizeof(h));
+		if (h.count == 0)
+			continue;
+
+		log_msg("Cycle timing (us):   %-16s %10llu %8.1f %8.1f %8.1f %8.1f",
+				cycle_stage_names[s],
+				(unsigned long long)h.count,
+				(double)h.total_ns / h.count / 1000.0,
+				ctPercentile(&h, 0.50) / 1000.0,
+				ctPercentile(&h, 0.99) / 1000.0,
+				h.max_ns / 1000.0);
+	}
+}
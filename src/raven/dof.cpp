@@ -20,6 +20,7 @@
 /*
  * dof.c - functions that fill in the DOF structure
  *     processEncVal - process an encoder value from a USB packet
+ *     decodeEncPacket - every encoder value of a USB packet at once
  *     encToJPos - go from an encoder value to a Joint position
  *
  * Kenneth Fodero
@@ -28,10 +29,18 @@
  *
  */
 
+#include <string.h>
 #include "dof.h"
 
 extern struct DOF_type DOF_types[];
 
+// Sign of the boards' counts, see processEncVal()
+#ifdef RAVEN_I
+#define ENC_SIGN 1
+#else
+#define ENC_SIGN -1
+#endif
+
 /**
  * processEncVal - reads an encoder value from a USB packet buffer
  *   and returns the integer result
@@ -61,6 +70,53 @@ int processEncVal(unsigned char buffer[], int channel)
 #endif
 }
 
+typedef unsigned char enc_v16u8 __attribute__ ((vector_size (16)));
+typedef int           enc_v4i   __attribute__ ((vector_size (16)));
+
+#if defined(__clang__)
+#define ENC_SHUFFLE(v, ...) __builtin_shufflevector((v), (v), __VA_ARGS__)
+#else
+#define ENC_SHUFFLE(v, ...) __builtin_shuffle((v), (enc_v16u8){ __VA_ARGS__ })
+#endif
+
+/**
+ * decodeEncPacket - processEncVal() for all channels of a USB in-packet, in one pass
+ *
+ *   Each 3-byte count is shuffled into the top of a 32-bit lane, and an
+ * arithmetic shift right by 8 sign-extends it: no branches, four channels
+ * per vector.  All MAX_DOF_PER_MECH slots are decoded whatever the
+ * packet's channel count; the caller takes the ones it has.
+ *
+ * \param buffer[] - the USB packet buffer, IN_LENGTH bytes
+ * \param enc[] - the encoder values, by channel
+ */
+void decodeEncPacket(const unsigned char buffer[], int enc[MAX_DOF_PER_MECH])
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && MAX_DOF_PER_MECH == 8
+  const enc_v4i shift = { 8, 8, 8, 8 };
+  const enc_v4i sign  = { ENC_SIGN, ENC_SIGN, ENC_SIGN, ENC_SIGN };
+  enc_v16u8 lo, hi;
+
+  // channels 0-3 start at byte 3, channels 4-7 at byte 15 (loaded from 11, so the load ends with the packet)
+  memcpy(&lo, buffer + 3, sizeof(lo));
+  memcpy(&hi, buffer + 11, sizeof(hi));
+  lo = ENC_SHUFFLE(lo, 0,0,1,2,  3,3,4,5,  6,6,7,8,  9,9,10,11);
+  hi = ENC_SHUFFLE(hi, 4,4,5,6,  7,7,8,9,  10,10,11,12,  13,13,14,15);
+
+  enc_v4i a = ((enc_v4i)lo >> shift) * sign;
+  enc_v4i b = ((enc_v4i)hi >> shift) * sign;
+  memcpy(enc, &a, sizeof(a));
+  memcpy(enc + 4, &b, sizeof(b));
+#else
+  for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+  {
+    int c = (int)(((unsigned int)buffer[3*i+5] << 24) | ((unsigned int)buffer[3*i+4] << 16) |
+                  ((unsigned int)buffer[3*i+3] << 8)) >> 8;
+    enc[i] = ENC_SIGN * c;
+  }
+#endif
+}
+
 /**
  * encToMPos - converts an encoder count to motor position. This function sets the mpos parameter of the joint structure
  *
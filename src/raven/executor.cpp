@@ -0,0 +1,347 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file executor.cpp
+ * \brief Epoll reactors for the non-RT I/O, see executor.h
+ *
+ * Sources are registered before the reactors start (executorStart()) and
+ * stay until they stop; timers are timerfds read by the reactor before
+ * their handler runs, so a handler only re-arms them.  Each reactor also
+ * watches an eventfd that executorStop() writes.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <string>
+#include <ros/callback_queue.h>
+
+#include "executor.h"
+#include "console_process.h"
+#include "network_layer.h"
+#include "local_io.h"
+#include "cpu_affinity.h"
+#include "log.h"
+
+#define EXEC_MAX_REACTORS   2
+#define EXEC_MAX_SOURCES    16
+#define EXEC_MAX_PRIORITY   90   // below the RT thread and its helpers
+#define EXEC_EVENTS         8    // epoll events taken per wakeup
+
+struct exec_source
+{
+	int fd;
+	int timer;               // fd is a timerfd: read it before fn
+	exec_handler fn;
+	void *arg;
+};
+
+struct exec_reactor
+{
+	pthread_t thread;
+	int epfd;
+	int stop_fd;             // eventfd, written by executorStop()
+	int running;
+};
+
+static struct exec_source sources[EXEC_MAX_SOURCES];
+static int num_sources = 0;
+static struct exec_reactor reactors[EXEC_MAX_REACTORS];
+static int num_reactors = 0;     // started
+static int exec_enabled = 0;
+static int exec_threads = 2;
+static int exec_priority = 0;
+static int ros_period_ms = 5;
+static int ros_timer = -1;
+
+/**\fn int init_executor(ros::NodeHandle &n)
+ * \brief read the executor parameters.  Call before the helper threads are created.
+ * \param n ROS node handle
+ * \return 0
+ */
+int init_executor(ros::NodeHandle &n)
+{
+	std::string mode;
+
+	n.param<std::string>("/executor", mode, "threads");
+	n.param("/executor_threads", exec_threads, 2);
+	n.param("/executor_priority", exec_priority, 0);
+	n.param("/executor_ros_period_ms", ros_period_ms, 5);
+	exec_enabled = (mode == "reactor");
+	if (exec_threads < 1)
+		exec_threads = 1;
+	if (exec_threads > EXEC_MAX_REACTORS)
+		exec_threads = EXEC_MAX_REACTORS;
+	if (exec_priority < 0)
+		exec_priority = 0;
+	if (exec_priority > EXEC_MAX_PRIORITY)
+		exec_priority = EXEC_MAX_PRIORITY;
+	if (ros_period_ms < 1)
+		ros_period_ms = 1;
+
+	if (exec_enabled)
+		log_msg("Executor: reactor, %d thread%s, %s, ROS callbacks every %d ms", exec_threads,
+				exec_threads > 1 ? "s" : "", exec_priority ? "SCHED_FIFO" : "normal priority", ros_period_ms);
+	else
+		log_msg("Executor: a thread per task");
+	return 0;
+}
+
+/**\fn int executorActive(void)
+ * \brief true if /executor is "reactor": the *_process() threads it replaces return at once
+ */
+int executorActive(void)
+{
+	return exec_enabled;
+}
+
+/**\fn static struct exec_reactor *laneReactor(int lane)
+ * \brief the reactor serving a lane
+ */
+static struct exec_reactor *laneReactor(int lane)
+{
+	return &reactors[(lane >= 0 && lane < exec_threads) ? lane : 0];
+}
+
+/**\fn static int execAdd(int lane, int fd, int timer, exec_handler fn, void *arg)
+ * \brief register a source with its lane's reactor
+ * \return the source's index, -1 on failure
+ */
+static int execAdd(int lane, int fd, int timer, exec_handler fn, void *arg)
+{
+	if (num_sources >= EXEC_MAX_SOURCES)
+	{
+		err_msg("Executor: more than %d sources", EXEC_MAX_SOURCES);
+		return -1;
+	}
+
+	struct exec_source *s = &sources[num_sources];
+	s->fd = fd;
+	s->timer = timer;
+	s->fn = fn;
+	s->arg = arg;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = s;
+	if (epoll_ctl(laneReactor(lane)->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		err_msg("Executor: cannot watch fd %d (%s)", fd, strerror(errno));
+		return -1;
+	}
+	return num_sources++;
+}
+
+/**\fn int execWatchFd(int lane, int fd, exec_handler fn, void *arg)
+ * \brief call fn on lane's reactor whenever fd is readable.  fn reads it.
+ * \return 0, -1 on failure
+ */
+int execWatchFd(int lane, int fd, exec_handler fn, void *arg)
+{
+	return execAdd(lane, fd, 0, fn, arg) < 0 ? -1 : 0;
+}
+
+/**\fn int execTimer(int lane, exec_handler fn, void *arg)
+ * \brief a timer whose expiries call fn on lane's reactor.  Disarmed until execTimerArm().
+ * \return timer handle, -1 on failure
+ */
+int execTimer(int lane, exec_handler fn, void *arg)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		err_msg("Executor: cannot create a timer (%s)", strerror(errno));
+		return -1;
+	}
+	int id = execAdd(lane, fd, 1, fn, arg);
+	if (id < 0)
+		close(fd);
+	return id;
+}
+
+/**\fn void execTimerArm(int timer, long long first_ns, long long period_ns)
+ * \brief (re)arm a timer
+ * \param timer handle from execTimer()
+ * \param first_ns first expiry from now (0: disarm)
+ * \param period_ns then every period_ns (0: once)
+ */
+void execTimerArm(int timer, long long first_ns, long long period_ns)
+{
+	struct itimerspec its;
+
+	if (timer < 0 || timer >= num_sources)
+		return;
+	its.it_value.tv_sec = first_ns / 1000000000LL;
+	its.it_value.tv_nsec = first_ns % 1000000000LL;
+	its.it_interval.tv_sec = period_ns / 1000000000LL;
+	its.it_interval.tv_nsec = period_ns % 1000000000LL;
+	timerfd_settime(sources[timer].fd, 0, &its, NULL);
+}
+
+/**\fn static void rosCallbacks(void *)
+ * \brief ROS callbacks due on the global queue: subscriptions, services, dynamic_reconfigure
+ */
+static void rosCallbacks(void *)
+{
+	ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration());
+}
+
+/**\fn static void *exec_reactor_process(void *arg)
+ * \brief one reactor: wait for sources, run their handlers
+ */
+static void *exec_reactor_process(void *arg)
+{
+	struct exec_reactor *r = (struct exec_reactor *)arg;
+	struct epoll_event evs[EXEC_EVENTS];
+
+	// Teleop input keeps the network core when there is a reactor for it
+	set_thread_affinity((exec_threads > 1 && r == &reactors[EXEC_LANE_IO]) ? ROLE_NETWORK : ROLE_HOUSEKEEPING);
+	if (exec_priority > 0)
+	{
+		struct sched_param param;
+		param.sched_priority = exec_priority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			err_msg("Executor: could not set priority %d", exec_priority);
+	}
+
+	while (1)
+	{
+		int n = epoll_wait(r->epfd, evs, EXEC_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			err_msg("Executor: epoll_wait failed (%s)", strerror(errno));
+			break;
+		}
+
+		int quit = 0;
+		for (int i = 0; i < n; i++)
+		{
+			struct exec_source *s = (struct exec_source *)evs[i].data.ptr;
+			if (s == NULL)
+			{
+				quit = 1;
+				continue;
+			}
+			if (s->timer)
+			{
+				uint64_t expiries;
+				if (read(s->fd, &expiries, sizeof(expiries)) != sizeof(expiries))
+					continue;   // re-armed or disarmed since it fired
+			}
+			s->fn(s->arg);
+		}
+		if (quit)
+			break;
+	}
+	return 0;
+}
+
+/**\fn int executorStart(void)
+ * \brief attach the sources and start the reactors, if /executor is "reactor".  Call after init_ros().
+ * \return 0 on success (or nothing to start), -1 on failure
+ */
+int executorStart(void)
+{
+	if (!exec_enabled)
+		return 0;
+
+	for (int i = 0; i < exec_threads; i++)
+	{
+		struct exec_reactor *r = &reactors[i];
+		r->epfd = epoll_create1(EPOLL_CLOEXEC);
+		r->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (r->epfd < 0 || r->stop_fd < 0)
+		{
+			err_msg("Executor: cannot create reactor %d (%s)", i, strerror(errno));
+			return -1;
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->stop_fd, &ev);
+	}
+
+	if (logReactorAttach(EXEC_LANE_HOUSEKEEPING) < 0 ||
+		networkReactorAttach(EXEC_LANE_IO) < 0 ||
+		consoleReactorAttach(EXEC_LANE_IO) < 0 ||
+		publishReactorAttach(EXEC_LANE_HOUSEKEEPING, ros_period_ms * 1000000LL) < 0)
+		return -1;
+	ros_timer = execTimer(EXEC_LANE_HOUSEKEEPING, rosCallbacks, NULL);
+	if (ros_timer < 0)
+		return -1;
+	execTimerArm(ros_timer, ros_period_ms * 1000000LL, ros_period_ms * 1000000LL);
+
+	for (int i = 0; i < exec_threads; i++)
+	{
+		if (pthread_create(&reactors[i].thread, NULL, exec_reactor_process, &reactors[i]) != 0)
+		{
+			err_msg("Executor: cannot start reactor %d", i);
+			return -1;
+		}
+		reactors[i].running = 1;
+		num_reactors = i + 1;
+	}
+	log_msg("Executor: %d sources on %d reactor%s", num_sources, num_reactors, num_reactors > 1 ? "s" : "");
+	return 0;
+}
+
+/**\fn void executorStop(void)
+ * \brief stop and join the reactors, then detach the sources.  After ros::ok() turns false.
+ */
+void executorStop(void)
+{
+	if (!exec_enabled)
+		return;
+
+	for (int i = 0; i < exec_threads; i++)
+	{
+		uint64_t one = 1;
+		if (reactors[i].stop_fd >= 0 && write(reactors[i].stop_fd, &one, sizeof(one)) < 0)
+			err_msg("Executor: cannot stop reactor %d", i);
+	}
+	for (int i = 0; i < num_reactors; i++)
+		if (reactors[i].running)
+		{
+			pthread_join(reactors[i].thread, NULL);
+			reactors[i].running = 0;
+		}
+	num_reactors = 0;
+
+	consoleReactorDetach();
+	networkReactorDetach();
+	logReactorDetach();      // log_msg() prints directly from here on
+
+	for (int i = 0; i < num_sources; i++)
+		if (sources[i].timer)
+			close(sources[i].fd);
+	num_sources = 0;
+	for (int i = 0; i < exec_threads; i++)
+	{
+		close(reactors[i].stop_fd);
+		close(reactors[i].epfd);
+	}
+}
@@ -0,0 +1,185 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file ext_cmd.cpp
+ * \brief Shared-memory command channel (layout in ext_cmd_client.h).
+ *
+ * extCmdPoll() runs on the RT thread: one seq check and a copy of the
+ * command, never a wait on the writer.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+
+#include "ext_cmd.h"
+#include "defines.h"
+#include "metrics.h"
+#include "utils.h"
+#include "log.h"
+
+extern unsigned long int gTime;
+
+static std::string cmd_name;
+static struct ext_cmd_shm *shm = NULL;
+static struct ext_cmd_data cmd_last;         // last consistent copy
+static u_64 hb_seen = 0;                     // heartbeat of cmd_last
+static unsigned long hb_tick = 0;            // gTime when it last moved
+static int cmd_timeout_ms = 20;
+static u_32 status_last = EXT_STATUS_IDLE;
+
+/**\fn int init_ext_cmd(ros::NodeHandle &n)
+ * \brief create the segment named by /ext_cmd_shm
+ * \return 0, also when the channel is off or cannot be created (it is not needed to run)
+ */
+int init_ext_cmd(ros::NodeHandle &n)
+{
+	n.param<std::string>("/ext_cmd_shm", cmd_name, "");
+	n.param("/ext_cmd_timeout_ms", cmd_timeout_ms, cmd_timeout_ms);
+	if (cmd_timeout_ms < 1)
+		cmd_timeout_ms = 1;
+	if (cmd_name.empty())
+		return 0;
+
+	int fd = shm_open(cmd_name.c_str(), O_CREAT | O_RDWR, 0660);
+	if (fd < 0)
+	{
+		err_msg("External command shm: cannot create %s (%d)", cmd_name.c_str(), errno);
+		return 0;
+	}
+	if (ftruncate(fd, sizeof(struct ext_cmd_shm)) < 0)
+	{
+		err_msg("External command shm: cannot size %s (%d)", cmd_name.c_str(), errno);
+		close(fd);
+		return 0;
+	}
+	void *p = mmap(NULL, sizeof(struct ext_cmd_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		err_msg("External command shm: cannot map %s (%d)", cmd_name.c_str(), errno);
+		return 0;
+	}
+	mlock(p, sizeof(struct ext_cmd_shm));
+
+	// Writers of an older segment see a bad magic until this one is set up
+	struct ext_cmd_shm *s = (struct ext_cmd_shm *)p;
+	s->magic = 0;
+	__sync_synchronize();
+	memset(s, 0, sizeof(*s));
+	s->version = EXT_CMD_VERSION;
+	s->size = sizeof(struct ext_cmd_shm);
+	s->timeout_ms = cmd_timeout_ms;
+	s->flags = EXT_CMD_LIVE;
+	__sync_synchronize();
+	s->magic = EXT_CMD_MAGIC;
+	shm = s;
+	memset(&cmd_last, 0, sizeof(cmd_last));
+
+	log_msg("External command shm: %s, %lu bytes, stale after %d ms", cmd_name.c_str(),
+	        (unsigned long)sizeof(struct ext_cmd_shm), cmd_timeout_ms);
+	return 0;
+}
+
+/**\fn static int finiteCommand(const struct ext_cmd_data *c)
+ * \brief false if any field a mode uses is NaN or infinite
+ */
+static int finiteCommand(const struct ext_cmd_data *c)
+{
+	for (int m = 0; m < MAX_MECH; m++)
+	{
+		const struct ext_cmd_mech *e = &c->mech[m];
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			if (!isfinite(e->tau[j]) || !isfinite(e->jpos[j]))
+				return 0;
+		for (int j = 0; j < 3; j++)
+			for (int k = 0; k < 3; k++)
+				if (!isfinite(e->R[j][k]))
+					return 0;
+	}
+	return 1;
+}
+
+/**\fn const struct ext_cmd_data *extCmdPoll(int active)
+ * \brief the controller's latest command.  RT thread, once per cycle.
+ * \param active nonzero if the command will be applied this cycle (for the status)
+ * \return the command, or NULL if the channel is off, nothing was written yet, or the heartbeat is stale
+ */
+const struct ext_cmd_data *extCmdPoll(int active)
+{
+	if (!shm)
+		return NULL;
+
+	u_32 s0 = shm->seq;
+	__sync_synchronize();         // seq read before the data
+	if (!(s0 & 1) && s0 != 0)
+	{
+		struct ext_cmd_data c;
+		memcpy(&c, (const void *)&shm->cmd, sizeof(c));
+		__sync_synchronize();     // data read before seq is checked again
+		if (shm->seq == s0 && c.heartbeat != hb_seen && finiteCommand(&c))
+		{
+			cmd_last = c;
+			hb_seen = c.heartbeat;
+			hb_tick = gTime;
+
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			u_64 now_ns = (u_64)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+			if (now_ns > c.write_ns)
+				metricObserve(MH_EXT_CMD_AGE_US, (now_ns - c.write_ns) / 1000);
+			shm->consumed_heartbeat = hb_seen;
+			shm->consumed_ns = now_ns;
+		}
+	}
+
+	int stale = (hb_seen == 0 || gTime - hb_tick > MS_TO_TICKS(cmd_timeout_ms));
+	u_32 status = !active ? EXT_STATUS_IDLE : (stale ? EXT_STATUS_STALE : EXT_STATUS_RUNNING);
+	if (status != status_last)
+	{
+		if (status == EXT_STATUS_STALE)
+		{
+			err_msg("External command: no heartbeat for %d ms, gravity only", cmd_timeout_ms);
+			metricInc(MC_EXT_CMD_STALE);
+		}
+		else if (status == EXT_STATUS_RUNNING)
+			log_msg("External command: running");
+		shm->status = status;
+		status_last = status;
+	}
+	return stale ? NULL : &cmd_last;
+}
+
+/**\fn void extCmdClose()
+ * \brief mark the segment stale and remove its name.  Writers keep their mapping.
+ */
+void extCmdClose()
+{
+	if (!shm)
+		return;
+	shm->flags &= ~EXT_CMD_LIVE;
+	munmap(shm, sizeof(struct ext_cmd_shm));
+	shm = NULL;
+	shm_unlink(cmd_name.c_str());
+}
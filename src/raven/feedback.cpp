@@ -0,0 +1,259 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file feedback.cpp
+ * \brief Slave-to-master feedback stream (v_struct).
+ *
+ * v_struct fields:
+ *   fx/fy/fz    position tracking error pos - pos_d (microns) per arm.  The
+ *               robot has no force sensing; the master scales this into a
+ *               display force.  With /feedback_force instead the force (mN)
+ *               the arm exerts at the tool: the shoulder, elbow and insertion
+ *               effort above gravity compensation, mapped through the
+ *               Jacobian (kinWrenchFromTorque()).
+ *   runlevel    current runlevel
+ *   jointflags  bit (8*arm + joint) set when that joint's DAC command is at
+ *               its limit (DOF_type DAC_max)
+ *   last_sequence  the latest master packet applied
+ * Each v_struct is sealed with CRC-32C (see sealFeedbackPacket()).
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <new>
+#include <string>
+
+#include "feedback.h"
+#include "itp_teleoperation.h"
+#include "teleop_protocol.h"
+#include "spsc_ring.h"
+#include "rt_memory.h"
+#include "cpu_affinity.h"
+#include "r2_kinematics.h"
+#include "grav_comp.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern int NUM_MECH;
+extern unsigned long int gTime;
+extern struct DOF_type DOF_types[];
+
+/**
+ * \brief What the RT thread hands to the feedback thread each cycle
+ */
+struct feedback_sample
+{
+	unsigned long tick;                       // gTime
+	int runlevel;
+	int last_sequence;
+	int f[MAX_MECH_PER_DEV][3];               // fx/fy/fz: pos - pos_d, or tool force
+	unsigned int jointflags;
+};
+
+typedef spsc_ring<struct feedback_sample, FEEDBACK_RING_SIZE> feedback_ring_t;
+static feedback_ring_t *feedback_ring = NULL;   // in the RT arena; NULL: feedback off
+
+static std::string feedback_host;
+static int feedback_port = 36001;
+static int feedback_rate_hz = 100;
+static int feedback_batch = 1;
+static bool feedback_force = false;
+static unsigned long feedback_decimation = 1;   // control cycles per sample
+
+/**\fn int init_feedback(ros::NodeHandle &n)
+ * \brief read the feedback parameters and allocate the sample ring
+ * \param n the node handle
+ * \return 0 on success, -1 if the ring could not be allocated
+ */
+int init_feedback(ros::NodeHandle &n)
+{
+	n.param<std::string>("/feedback_host", feedback_host, "");
+	n.param("/feedback_port", feedback_port, 36001);
+	n.param("/feedback_rate_hz", feedback_rate_hz, 100);
+	n.param("/feedback_samples_per_packet", feedback_batch, 1);
+	n.param("/feedback_force", feedback_force, false);
+
+	if (feedback_host.empty())
+	{
+		log_msg("Master feedback: off");
+		return 0;
+	}
+	if (feedback_rate_hz < 1 || feedback_rate_hz > control_rate_hz)
+		feedback_rate_hz = control_rate_hz;
+	if (feedback_batch < 1 || feedback_batch > FEEDBACK_MAX_BATCH)
+		feedback_batch = 1;
+
+	feedback_decimation = control_rate_hz / feedback_rate_hz;
+
+	void *mem = rt_arena_alloc(sizeof(feedback_ring_t));
+	if (mem == NULL)
+		return -1;
+	feedback_ring = new (mem) feedback_ring_t();
+
+	log_msg("Master feedback: %s:%d, %d Hz, %d samples per packet, %s",
+			feedback_host.c_str(), feedback_port, feedback_rate_hz, feedback_batch,
+			feedback_force ? "tool force" : "position error");
+	return 0;
+}
+
+#define FEEDBACK_FORCE_DAMPING 0.01   // see kinDampedInverse()
+
+/**\fn static void toolForce(struct mechanism *m, int out_f[3])
+ * \brief force (mN) the arm exerts at the tool, from the effort of its first three joints
+ */
+static void toolForce(struct mechanism *m, int out_f[3])
+{
+	double tau[6] = {0, 0, 0, 0, 0, 0};
+	double w[6];
+
+	// effort beyond holding the arm up, as joint torque (force on the insertion axis)
+	getJointTorqueFromMotorTorque(m->type,
+			m->joint[SHOULDER].tau_d - m->joint[SHOULDER].tau_g,
+			m->joint[ELBOW   ].tau_d - m->joint[ELBOW   ].tau_g,
+			m->joint[Z_INS   ].tau_d - m->joint[Z_INS   ].tau_g,
+			tau[0], tau[1], tau[2]);
+
+	if (kinWrenchFromTorque(getKinContext(*m), tau, FEEDBACK_FORCE_DAMPING, w) < 0)
+		w[0] = w[1] = w[2] = 0;
+	for (int k = 0; k < 3; k++)
+		out_f[k] = (int)(w[k] * 1000);
+}
+
+/**\fn void feedbackCapture(struct robot_device *dev, struct param_pass *currParams)
+ * \brief queue this cycle's feedback sample.  RT safe, never blocks.
+ * \param dev the robot state
+ * \param currParams current parameters
+ */
+void feedbackCapture(struct robot_device *dev, struct param_pass *currParams)
+{
+	struct feedback_sample s;
+
+	if (feedback_ring == NULL || gTime % feedback_decimation != 0)
+		return;
+
+	s.tick = gTime;
+	s.runlevel = currParams->runlevel;
+	s.last_sequence = currParams->last_sequence;
+	s.jointflags = 0;
+	for (int i = 0; i < NUM_MECH && i < MAX_MECH_PER_DEV; i++)
+	{
+		struct mechanism *m = &dev->mech[i];
+		if (feedback_force)
+			toolForce(m, s.f[i]);
+		else
+		{
+			s.f[i][0] = m->pos.x - m->pos_d.x;
+			s.f[i][1] = m->pos.y - m->pos_d.y;
+			s.f[i][2] = m->pos.z - m->pos_d.z;
+		}
+		for (int j = 0; j < MAX_DOF_PER_MECH && 8*i+j < 32; j++)
+			if (abs(m->joint[j].current_cmd) >= DOF_types[m->joint[j].type].DAC_max)
+				s.jointflags |= 1u << (8*i + j);
+	}
+
+	feedback_ring->push(s);
+}
+
+/**\fn static void fillFeedback(struct v_struct *v, const struct feedback_sample *s, unsigned int seq)
+ * \brief turn a sample into a sealed v_struct
+ */
+static void fillFeedback(struct v_struct *v, const struct feedback_sample *s, unsigned int seq)
+{
+	memset(v, 0, sizeof(*v));
+	v->sequence = seq;
+	v->last_sequence = s->last_sequence;
+	v->version = 1;
+	for (int i = 0; i < 2 && i < MAX_MECH_PER_DEV; i++)
+	{
+		v->fx[i] = s->f[i][0];
+		v->fy[i] = s->f[i][1];
+		v->fz[i] = s->f[i][2];
+	}
+	v->runlevel = s->runlevel;
+	v->jointflags = s->jointflags;
+	sealFeedbackPacket(v);
+}
+
+/**\fn void* feedback_process(void*)
+ * \brief Feedback thread.  Sends the sampled robot state to the master.
+ */
+void* feedback_process(void*)
+{
+	struct sockaddr_in master;
+	struct v_struct batch[FEEDBACK_MAX_BATCH];
+	struct feedback_sample s;
+	struct timespec tnext;
+	unsigned int seq = 1;
+	int nbatch = 0;
+
+	if (feedback_ring == NULL)
+		return NULL;
+
+	set_thread_affinity(ROLE_NETWORK);
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0)
+	{
+		err_msg("Master feedback: could not open socket");
+		return NULL;
+	}
+	memset(&master, 0, sizeof(master));
+	master.sin_family = AF_INET;
+	master.sin_port = htons(feedback_port);
+	if (inet_aton(feedback_host.c_str(), &master.sin_addr) == 0)
+	{
+		err_msg("Master feedback: bad address %s", feedback_host.c_str());
+		close(sock);
+		return NULL;
+	}
+
+	// Wake once per datagram's worth of samples
+	const long period_ns = 1000000000L / feedback_rate_hz * feedback_batch;
+	unsigned long send_errors = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &tnext);
+	while (ros::ok() && !r2Killed())
+	{
+		tnext.tv_nsec += period_ns;
+		tsnorm(&tnext);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tnext, NULL);
+
+		while (feedback_ring->pop(s))
+		{
+			fillFeedback(&batch[nbatch++], &s, seq++);
+			if (nbatch == feedback_batch)
+			{
+				if (sendto(sock, batch, nbatch*sizeof(struct v_struct), MSG_DONTWAIT,
+						   (struct sockaddr *)&master, sizeof(master)) < 0 && send_errors++ % 1000 == 0)
+					err_msg("Master feedback: send failed (%lu)", send_errors);
+				nbatch = 0;
+			}
+		}
+	}
+
+	close(sock);
+	return NULL;
+}
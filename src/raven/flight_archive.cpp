@@ -0,0 +1,268 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_archive.cpp
+ * \brief Compressed long-term archive of the flight recorder.
+ *
+ * The archiver follows the recorder's ring by tick, a chunk at a time, well
+ * within the ring's length; if it falls so far behind that records are
+ * overwritten first, the gap is counted and the archive goes on from the
+ * oldest record left.  Each chunk is one write() to a file opened with
+ * O_APPEND: a crash leaves at most the last chunk cut short, which readers
+ * stop at.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+
+#include "flight_archive.h"
+#include "flight_recorder.h"
+#include "flight_codec.h"
+#include "crc32c.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "log.h"
+#include "shared_state.h"
+
+
+static std::string fa_dir;
+static int fa_chunk_ms = 1000;
+static int fa_file_s = 3600;
+static u_32 fa_chunk_records = 0;
+
+static struct fa_header fa_hdr;
+static struct fr_record *fa_recs = NULL;       // the chunk being filled
+static unsigned char *fa_planes = NULL;        // its byte planes
+static unsigned char *fa_out = NULL;           // chunk header, payload, padding
+static size_t fa_out_size = 0;
+
+struct fa_file
+{
+	int fd;
+	char path[512];
+	time_t opened;
+	u_64 records;
+	u_64 bytes;
+};
+
+/**\fn int init_flight_archive(ros::NodeHandle &n)
+ * \brief read the parameters and allocate the chunk buffers
+ * \param n the node handle
+ * \return 0 on success or when the archive is off, -ENOMEM
+ */
+int init_flight_archive(ros::NodeHandle &n)
+{
+	n.param<std::string>("/flight_archive_dir", fa_dir, "");
+	n.param("/flight_archive_chunk_ms", fa_chunk_ms, 1000);
+	n.param("/flight_archive_file_s", fa_file_s, 3600);
+
+	if (fa_dir.empty())
+	{
+		log_msg("Flight archive: off");
+		return 0;
+	}
+	if (fa_chunk_ms < 100)
+		fa_chunk_ms = 100;
+	if (fa_chunk_ms > 10000)
+		fa_chunk_ms = 10000;
+	if (fa_file_s < 0)
+		fa_file_s = 0;
+	fa_chunk_records = (u_32)MS_TO_TICKS(fa_chunk_ms);
+
+	memset(&fa_hdr, 0, sizeof(fa_hdr));
+	memcpy(fa_hdr.magic, FA_MAGIC, 8);
+	fa_hdr.version = FA_VERSION;
+	fa_hdr.header_size = FA_HEADER_SIZE;
+	fa_hdr.record_size = sizeof(struct fr_record);
+	fa_hdr.chunk_records = fa_chunk_records;
+	fa_hdr.words = sizeof(struct fr_record) / 4;
+	faDefaultCoding(fa_hdr.coding);
+
+	fa_out_size = sizeof(struct fa_chunk) + faPackBound(fa_chunk_records) + 8;
+	fa_recs = (struct fr_record *)malloc((size_t)fa_chunk_records * sizeof(struct fr_record));
+	fa_planes = (unsigned char *)malloc((size_t)fa_chunk_records * sizeof(struct fr_record));
+	fa_out = (unsigned char *)malloc(fa_out_size);
+	if (fa_recs == NULL || fa_planes == NULL || fa_out == NULL)
+	{
+		err_msg("Flight archive: no memory for %u record chunks, archive off", fa_chunk_records);
+		free(fa_recs);
+		free(fa_planes);
+		free(fa_out);
+		fa_recs = NULL;
+		return -ENOMEM;
+	}
+
+	log_msg("Flight archive: %s, %d ms chunks (%lu kB of buffers), new file every %d s", fa_dir.c_str(), fa_chunk_ms,
+			(unsigned long)((2 * (size_t)fa_chunk_records * sizeof(struct fr_record) + fa_out_size) >> 10), fa_file_s);
+	return 0;
+}
+
+/**\fn static int openArchiveFile(struct fa_file *f)
+ * \brief create the next archive file and write its header
+ * \return 0 on success, negative errno on failure
+ */
+static int openArchiveFile(struct fa_file *f)
+{
+	static unsigned char header[FA_HEADER_SIZE];
+	char stamp[32];
+
+	f->opened = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&f->opened));
+	snprintf(f->path, sizeof(f->path), "%s/archive-%s.r2fa", fa_dir.c_str(), stamp);
+	f->records = 0;
+	f->bytes = FA_HEADER_SIZE;
+
+	f->fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0664);
+	if (f->fd < 0)
+		return -errno;
+
+	initFlightHeader(&fa_hdr.recording, 0);
+	memset(header, 0, sizeof(header));
+	memcpy(header, &fa_hdr, sizeof(fa_hdr));
+	if (write(f->fd, header, sizeof(header)) != (ssize_t)sizeof(header))
+	{
+		int err = errno ? -errno : -EIO;
+		close(f->fd);
+		f->fd = -1;
+		return err;
+	}
+	log_msg("Flight archive: writing %s", f->path);
+	return 0;
+}
+
+/**\fn static void closeArchiveFile(struct fa_file *f)
+ * \brief flush and close the archive file, if one is open
+ */
+static void closeArchiveFile(struct fa_file *f)
+{
+	if (f->fd < 0)
+		return;
+	fsync(f->fd);
+	close(f->fd);
+	f->fd = -1;
+	log_msg("Flight archive: %s closed, %llu records in %llu kB (%.1fx)", f->path, (unsigned long long)f->records,
+			(unsigned long long)(f->bytes >> 10), f->bytes ? (double)f->records * sizeof(struct fr_record) / f->bytes : 0.0);
+}
+
+/**\fn static int writeChunk(struct fa_file *f, u_32 n)
+ * \brief code and append the first n records of fa_recs as one chunk
+ * \return 0 on success, negative errno on failure
+ */
+static int writeChunk(struct fa_file *f, u_32 n)
+{
+	struct fa_chunk *c = (struct fa_chunk *)fa_out;
+	unsigned char *payload = fa_out + sizeof(struct fa_chunk);
+
+	int packed = faPackChunk(&fa_hdr, fa_recs, n, fa_planes, payload, fa_out_size - sizeof(struct fa_chunk) - 8);
+	if (packed < 0)
+		return -EOVERFLOW;
+	size_t padded = ((size_t)packed + 7) & ~(size_t)7;
+	memset(payload + packed, 0, padded - packed);
+
+	memset(c, 0, sizeof(*c));
+	c->magic = FA_CHUNK_MAGIC;
+	c->records = n;
+	c->first_tick = fa_recs[0].tick;
+	c->last_tick = fa_recs[n-1].tick;
+	c->first_stamp_ns = fa_recs[0].stamp_ns;
+	c->last_stamp_ns = fa_recs[n-1].stamp_ns;
+	c->packed_size = packed;
+	c->payload_crc = crc32c(0, payload, packed);
+	c->header_crc = crc32c(0, c, offsetof(struct fa_chunk, header_crc));
+
+	size_t len = sizeof(struct fa_chunk) + padded;
+	if (write(f->fd, fa_out, len) != (ssize_t)len)
+		return errno ? -errno : -ENOSPC;
+	f->records += n;
+	f->bytes += len;
+	return 0;
+}
+
+/**\fn void* flight_archive_process(void*)
+ * \brief Archive thread: a chunk of records from the recorder, coded and appended, at a time.
+ */
+void* flight_archive_process(void*)
+{
+	struct fa_file f;
+	struct timespec nap;
+	u_64 next_tick = 0;
+	u_32 have = 0;
+	int done = 0;
+
+	if (fa_recs == NULL)
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	struct sched_param param;
+	param.sched_priority = 0;
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+		err_msg("Flight archive: could not set SCHED_IDLE, running at normal priority");
+
+	f.fd = -1;
+	nap.tv_sec = fa_chunk_ms / 4000;
+	nap.tv_nsec = (fa_chunk_ms / 4 % 1000) * 1000000L;
+
+	while (!done)
+	{
+		done = !ros::ok() || r2Killed();       // one last fetch after shutdown
+		if (!done)
+			nanosleep(&nap, NULL);
+
+		u_64 want = next_tick;
+		int n = flightRecorderFetch(&next_tick, fa_recs + have, fa_chunk_records - have);
+		if (n < 0)
+		{
+			n = 0;              // recorder closed: write what there is
+			done = 1;
+		}
+		if (n > 0 && want > 0 && fa_recs[have].tick > want)
+		{
+			metricAdd(MC_ARCHIVE_LOST, fa_recs[have].tick - want);
+			err_msg("Flight archive: fell behind, ticks %llu - %llu lost", (unsigned long long)want,
+					(unsigned long long)fa_recs[have].tick - 1);
+		}
+		have += n;
+		if (have < fa_chunk_records && !(done && have > 0))
+			continue;
+
+		if (f.fd >= 0 && fa_file_s > 0 && time(NULL) - f.opened >= fa_file_s)
+			closeArchiveFile(&f);
+		int err = (f.fd < 0) ? openArchiveFile(&f) : 0;
+		if (err == 0)
+			err = writeChunk(&f, have);
+		have = 0;
+		if (err < 0)
+		{
+			err_msg("Flight archive: writing %s failed (%d), archive off", f.path, -err);
+			break;
+		}
+	}
+
+	closeArchiveFile(&f);
+	return NULL;
+}
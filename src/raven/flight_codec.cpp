@@ -0,0 +1,171 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_codec.cpp
+ * \brief Chunk coding of the flight archive (flight_format.h).
+ *
+ * Most words of a record change little from one cycle to the next: after
+ * the delta or XOR coding their high bytes are zero, and with the words
+ * split into byte planes those zeros line up into long runs for LZ4.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flight_codec.h"
+#include "lz4_block.h"
+
+typedef char fa_record_is_words[sizeof(struct fr_record) % 4 == 0 ? 1 : -1];
+typedef char fa_coding_fits[sizeof(struct fr_record) / 4 <= FA_MAX_WORDS ? 1 : -1];
+typedef char fa_header_fits[sizeof(struct fa_header) <= FA_HEADER_SIZE ? 1 : -1];
+
+/**\fn static void setCoding(u_08 *coding, size_t offset, size_t bytes, u_08 how)
+ * \brief code the words of a field (byte offset and size in fr_record)
+ */
+static void setCoding(u_08 *coding, size_t offset, size_t bytes, u_08 how)
+{
+	for (size_t w = offset / 4; w < (offset + bytes + 3) / 4; w++)
+		coding[w] = how;
+}
+
+/**\fn void faDefaultCoding(u_08 *coding)
+ * \brief the coding of each word of fr_record: differences for counts and
+ *        positions, second differences for the clocks, XOR for floats and bytes
+ * \param coding sizeof(struct fr_record) / 4 entries
+ */
+void faDefaultCoding(u_08 *coding)
+{
+	struct fr_record r;
+
+	memset(coding, FA_DELTA, sizeof(r) / 4);
+	setCoding(coding, offsetof(struct fr_record, seq), 3 * sizeof(u_64), FA_DELTA2);
+	setCoding(coding, offsetof(struct fr_record, runlevel), 4, FA_XOR);
+	setCoding(coding, offsetof(struct fr_record, flags), 2 * sizeof(u_32), FA_XOR);
+	for (int m = 0; m < MAX_MECH_PER_DEV; m++)
+	{
+		size_t mech = offsetof(struct fr_record, mech) + m * sizeof(struct fr_mech);
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			size_t dof = mech + offsetof(struct fr_mech, dof) + j * sizeof(struct fr_dof);
+			setCoding(coding, dof + offsetof(struct fr_dof, jpos), 5 * sizeof(float), FA_XOR);
+			setCoding(coding, dof + offsetof(struct fr_dof, current_cmd), 2 * sizeof(short), FA_XOR);
+		}
+		setCoding(coding, mech + offsetof(struct fr_mech, enc_packet), FR_IN_LEN + FR_OUT_LEN + 2, FA_XOR);
+		setCoding(coding, mech + offsetof(struct fr_mech, master) + offsetof(struct fr_master, R),
+				  sizeof(r.mech[0].master.R), FA_XOR);
+	}
+}
+
+/**\fn size_t faPackBound(u_32 records)
+ * \return room faPackChunk() may need for a chunk of this many records
+ */
+size_t faPackBound(u_32 records)
+{
+	return lz4Bound((size_t)records * sizeof(struct fr_record));
+}
+
+/**\fn int faPackChunk(const struct fa_header *h, const struct fr_record *recs, u_32 n, unsigned char *planes, unsigned char *out, size_t cap)
+ * \brief code and compress n consecutive records
+ * \param h the archive header (coding)
+ * \param planes n * record_size bytes of scratch
+ * \param out the payload, cap bytes (faPackBound(n) is enough)
+ * \return payload size, -1 if it does not fit
+ */
+int faPackChunk(const struct fa_header *h, const struct fr_record *recs, u_32 n, unsigned char *planes,
+				unsigned char *out, size_t cap)
+{
+	const unsigned char *base = (const unsigned char *)recs;
+
+	for (u_32 w = 0; w < h->words; w++)
+	{
+		unsigned char *p = planes + (size_t)w * 4 * n;
+		uint32_t prev = 0, prevd = 0;
+		for (u_32 i = 0; i < n; i++)
+		{
+			uint32_t v, e;
+			memcpy(&v, base + (size_t)i * h->record_size + w * 4, 4);
+			switch (h->coding[w])
+			{
+			case FA_DELTA2:
+				e = (v - prev) - prevd;
+				prevd = v - prev;
+				break;
+			case FA_XOR:
+				e = v ^ prev;
+				break;
+			default:
+				e = v - prev;
+				break;
+			}
+			prev = v;
+			p[i] = (unsigned char)e;
+			p[n + i] = (unsigned char)(e >> 8);
+			p[2 * n + i] = (unsigned char)(e >> 16);
+			p[3 * n + i] = (unsigned char)(e >> 24);
+		}
+	}
+	return lz4Compress(planes, (size_t)n * h->record_size, out, cap);
+}
+
+/**\fn int faUnpackChunk(const struct fa_header *h, const unsigned char *in, size_t len, u_32 n, unsigned char *planes, struct fr_record *out)
+ * \brief decompress and decode a chunk of n records
+ * \param h the archive header (coding)
+ * \param in the payload, len bytes
+ * \param planes n * record_size bytes of scratch
+ * \param out n records
+ * \return 0, -1 if the payload does not decode to n records
+ */
+int faUnpackChunk(const struct fa_header *h, const unsigned char *in, size_t len, u_32 n, unsigned char *planes,
+				  struct fr_record *out)
+{
+	unsigned char *base = (unsigned char *)out;
+	size_t raw = (size_t)n * h->record_size;
+
+	if (lz4Decompress(in, len, planes, raw) != (int)raw)
+		return -1;
+
+	for (u_32 w = 0; w < h->words; w++)
+	{
+		const unsigned char *p = planes + (size_t)w * 4 * n;
+		uint32_t prev = 0, prevd = 0;
+		for (u_32 i = 0; i < n; i++)
+		{
+			uint32_t e = p[i] | (p[n + i] << 8) | ((uint32_t)p[2 * n + i] << 16) | ((uint32_t)p[3 * n + i] << 24);
+			uint32_t v;
+			switch (h->coding[w])
+			{
+			case FA_DELTA2:
+				prevd += e;
+				v = prev + prevd;
+				break;
+			case FA_XOR:
+				v = prev ^ e;
+				break;
+			default:
+				v = prev + e;
+				break;
+			}
+			prev = v;
+			memcpy(base + (size_t)i * h->record_size + w * 4, &v, 4);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_export.cpp
+ * \brief r2_flight_export: dump a flight recorder file or archive as CSV.
+ *
+ *   r2_flight_export [-i] [-f first_tick] [-l last_tick] recording.r2fr|archive.r2fa > out.csv
+ *
+ *   -i  print the header and the range of ticks in the file instead
+ *
+ * Of an archive, only the chunks in the tick range are decompressed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flight_reader.h"
+
+/**\fn static void printHeader(const struct fr_header *h, const FlightReader &rd)
+ * \brief -i: describe the recording
+ */
+static void printHeader(const struct fr_header *h, const FlightReader &rd)
+{
+	struct fr_record r;
+
+	if (rd.isArchive())
+		printf("archive, ");
+	printf("version %u, %u slots of %u bytes, %u mechanisms, %u Hz\n",
+		   h->version, h->nslots, h->record_size, h->num_mech, h->control_rate_hz);
+	printf("records %llu - %llu\n", (unsigned long long)rd.first(), (unsigned long long)rd.end());
+	if (rd.end() > rd.first() &&
+		rd.read(rd.first(), &r) == 0)
+		printf("first tick %llu\n", (unsigned long long)r.tick);
+	if (rd.end() > 0 && rd.read(rd.end()-1, &r) == 0)
+		printf("last tick  %llu\n", (unsigned long long)r.tick);
+	printf("%s", h->schema);
+}
+
+/**\fn static void printColumns(unsigned int nmech)
+ * \brief the CSV header line
+ */
+static void printColumns(unsigned int nmech)
+{
+	printf("tick,time_s,runlevel,sublevel,surgeon_mode,estop,last_sequence,period_ns,usb_wait_ns,control_ns,compute_ns,master");
+	for (unsigned int m = 0; m < nmech; m++)
+	{
+		printf(",m%u_x,m%u_y,m%u_z,m%u_xd,m%u_yd,m%u_zd", m, m, m, m, m, m);
+		printf(",m%u_master_x,m%u_master_y,m%u_master_z,m%u_master_grasp", m, m, m, m);
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			printf(",m%u_j%d_enc,m%u_j%d_jpos,m%u_j%d_jpos_d,m%u_j%d_mpos,m%u_j%d_mpos_d,m%u_j%d_tau_d,m%u_j%d_dac,m%u_j%d_state",
+				   m, j, m, j, m, j, m, j, m, j, m, j, m, j, m, j);
+	}
+	printf("\n");
+}
+
+/**\fn static void printRecord(const struct fr_header *h, const struct fr_record *r)
+ * \brief one CSV line
+ */
+static void printRecord(const struct fr_header *h, const struct fr_record *r)
+{
+	double t = (double)(r->stamp_ns - h->start_monotonic_ns) * 1e-9 + h->start_realtime_ns * 1e-9;
+
+	printf("%llu,%.6f,%u,%u,%u,%u,%d,%u,%u,%u,%u,%u", (unsigned long long)r->tick, t,
+		   r->runlevel, r->sublevel, r->surgeon_mode, r->estop, r->last_sequence,
+		   r->period_ns, r->usb_wait_ns, r->control_ns, r->compute_ns, r->flags & FR_MASTER_FRESH ? 1 : 0);
+	for (unsigned int m = 0; m < h->num_mech && m < MAX_MECH_PER_DEV; m++)
+	{
+		const struct fr_mech *fm = &r->mech[m];
+		printf(",%d,%d,%d,%d,%d,%d", fm->pos[0], fm->pos[1], fm->pos[2], fm->pos_d[0], fm->pos_d[1], fm->pos_d[2]);
+		printf(",%d,%d,%d,%d", fm->master.xd[0], fm->master.xd[1], fm->master.xd[2], fm->master.grasp);
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			const struct fr_dof *d = &fm->dof[j];
+			printf(",%d,%g,%g,%g,%g,%g,%d,%d", d->enc_val, d->jpos, d->jpos_d, d->mpos, d->mpos_d,
+				   d->tau_d, d->current_cmd, d->state);
+		}
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long first_tick = 0, last_tick = ~0ULL;
+	int info = 0, opt;
+
+	while ((opt = getopt(argc, argv, "if:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i': info = 1; break;
+		case 'f': first_tick = strtoull(optarg, NULL, 0); break;
+		case 'l': last_tick = strtoull(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-i] [-f first_tick] [-l last_tick] recording.r2fr\n", argv[0]);
+			return 2;
+		}
+	}
+	if (optind >= argc)
+	{
+		fprintf(stderr, "usage: %s [-i] [-f first_tick] [-l last_tick] recording.r2fr\n", argv[0]);
+		return 2;
+	}
+
+	FlightReader rd;
+	int err = rd.open(argv[optind]);
+	if (err < 0)
+	{
+		fprintf(stderr, "%s: cannot read %s (%s)\n", argv[0], argv[optind], strerror(-err));
+		return 1;
+	}
+	const struct fr_header *h = rd.header();
+	if (info)
+	{
+		printHeader(h, rd);
+		return 0;
+	}
+
+	u_64 i;
+	if (rd.findTick(first_tick, &i) < 0)
+		return 0;
+
+	printColumns(h->num_mech < MAX_MECH_PER_DEV ? h->num_mech : MAX_MECH_PER_DEV);
+	unsigned long skipped = 0;
+	for (; i < rd.end(); i++)
+	{
+		struct fr_record r;
+		if (rd.read(i, &r) < 0)
+		{
+			skipped++;
+			continue;
+		}
+		if (r.tick > last_tick)
+			break;
+		printRecord(h, &r);
+	}
+	if (skipped)
+		fprintf(stderr, "%lu records overwritten while reading\n", skipped);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_reader.cpp
+ * \brief Reader for flight recorder files and archives (flight_format.h).
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flight_reader.h"
+#include "flight_codec.h"
+#include "crc32c.h"
+
+FlightReader::FlightReader() : map(NULL), len(0), hdr(NULL), slots(NULL), arch(NULL), loaded(0)
+{
+}
+
+FlightReader::~FlightReader()
+{
+	close();
+}
+
+/**\fn int FlightReader::open(const char *path)
+ * \brief map a recording or an archive and check its header
+ * \return 0, negative errno, or -EINVAL if it is not a recording this reader understands
+ */
+int FlightReader::open(const char *path)
+{
+	struct stat st;
+
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < FR_HEADER_SIZE)
+	{
+		::close(fd);
+		return -EINVAL;
+	}
+	len = st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+	{
+		map = NULL;
+		return -errno;
+	}
+
+	if (memcmp(map, FA_MAGIC, 8) == 0)
+	{
+		int err = openArchive();
+		if (err < 0)
+			close();
+		return err;
+	}
+
+	hdr = (const struct fr_header *)map;
+	if (memcmp(hdr->magic, FR_MAGIC, 8) != 0 || hdr->version != FR_VERSION ||
+		hdr->record_size != sizeof(struct fr_record) || hdr->nslots == 0 ||
+		hdr->mech_per_dev != MAX_MECH_PER_DEV || hdr->dof_per_mech != MAX_DOF_PER_MECH ||
+		hdr->header_size + (size_t)hdr->nslots * hdr->record_size > len)
+	{
+		close();
+		return -EINVAL;
+	}
+	slots = (const struct fr_record *)((const char *)map + hdr->header_size);
+	return 0;
+}
+
+/**\fn int FlightReader::openArchive()
+ * \brief check an archive's header and index its chunks, from their headers alone
+ * \return 0, or -EINVAL if it is not an archive this reader understands
+ */
+int FlightReader::openArchive()
+{
+	const struct fa_header *a = (const struct fa_header *)map;
+
+	if (len < FA_HEADER_SIZE || a->version != FA_VERSION || a->header_size != FA_HEADER_SIZE ||
+		a->record_size != sizeof(struct fr_record) || a->words != a->record_size / 4 ||
+		a->chunk_records == 0 || a->recording.mech_per_dev != MAX_MECH_PER_DEV ||
+		a->recording.dof_per_mech != MAX_DOF_PER_MECH)
+		return -EINVAL;
+
+	u_64 count = 0;
+	size_t off = a->header_size;
+	while (off + sizeof(struct fa_chunk) <= len)
+	{
+		const struct fa_chunk *c = (const struct fa_chunk *)((const char *)map + off);
+		if (c->magic != FA_CHUNK_MAGIC || c->header_crc != crc32c(0, c, offsetof(struct fa_chunk, header_crc)) ||
+			c->records == 0 || c->records > a->chunk_records || c->packed_size > len - off - sizeof(*c))
+			break;          // the end, or a chunk cut short
+		struct chunk_ref r = { count, c->first_tick, c->last_tick, c };
+		chunks.push_back(r);
+		count += c->records;
+		off += sizeof(*c) + ((c->packed_size + 7) & ~7U);
+	}
+
+	arch = a;
+	memcpy(&arch_hdr, &a->recording, sizeof(arch_hdr));
+	arch_hdr.nslots = (u_32)count;
+	arch_hdr.count = count;
+	hdr = &arch_hdr;
+	decoded.resize(a->chunk_records);
+	planes.resize((size_t)a->chunk_records * a->record_size);
+	loaded = chunks.size();
+	return 0;
+}
+
+/**\fn size_t FlightReader::findChunk(u_64 index) const
+ * \return the archive chunk holding record index (index < end())
+ */
+size_t FlightReader::findChunk(u_64 index) const
+{
+	size_t lo = 0, hi = chunks.size();
+
+	while (hi - lo > 1)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (chunks[mid].first <= index)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**\fn int FlightReader::loadChunk(size_t c) const
+ * \brief decode archive chunk c, unless it is the one decoded last
+ * \return 0, or -EIO if it fails its crc or does not decode
+ */
+int FlightReader::loadChunk(size_t c) const
+{
+	if (c == loaded)
+		return 0;
+
+	const struct fa_chunk *ch = chunks[c].chunk;
+	const unsigned char *payload = (const unsigned char *)(ch + 1);
+	loaded = chunks.size();
+	if (crc32c(0, payload, ch->packed_size) != ch->payload_crc ||
+		faUnpackChunk(arch, payload, ch->packed_size, ch->records, &planes[0], &decoded[0]) < 0)
+		return -EIO;
+	loaded = c;
+	return 0;
+}
+
+/**\fn void FlightReader::close()
+ * \brief unmap the recording
+ */
+void FlightReader::close()
+{
+	if (map)
+		munmap(map, len);
+	map = NULL;
+	hdr = NULL;
+	slots = NULL;
+	arch = NULL;
+	chunks.clear();
+	std::vector<struct fr_record>().swap(decoded);
+	std::vector<unsigned char>().swap(planes);
+	loaded = 0;
+}
+
+u_64 FlightReader::first() const
+{
+	if (hdr == NULL)
+		return 0;
+	u_64 n = hdr->count;
+	return n > hdr->nslots ? n - hdr->nslots : 0;
+}
+
+u_64 FlightReader::end() const
+{
+	return hdr ? hdr->count : 0;
+}
+
+/**\fn int FlightReader::read(u_64 index, struct fr_record *out) const
+ * \brief copy out one record
+ * \return 0, -ENOENT if the record is not in the file (overwritten or not yet
+ *         written), -EAGAIN if it was being rewritten while it was read,
+ *         -EIO if its archive chunk is damaged
+ */
+int FlightReader::read(u_64 index, struct fr_record *out) const
+{
+	if (hdr == NULL)
+		return -ENOENT;
+	if (arch)
+	{
+		if (index >= hdr->count)
+			return -ENOENT;
+		size_t c = findChunk(index);
+		int err = loadChunk(c);
+		if (err < 0)
+			return err;
+		memcpy(out, &decoded[index - chunks[c].first], sizeof(*out));
+		return 0;
+	}
+
+	const struct fr_record *r = &slots[index % hdr->nslots];
+	if (r->seq != index + 1)
+		return -ENOENT;
+	__sync_synchronize();
+	memcpy(out, r, sizeof(*out));
+	__sync_synchronize();
+	if (r->seq != index + 1 || out->seq != index + 1)
+		return -EAGAIN;
+	return 0;
+}
+
+/**\fn int FlightReader::findTick(u_64 tick, u_64 *index) const
+ * \brief find the first record at or after a control tick
+ * \return 0, or -ENOENT if every record is older
+ */
+int FlightReader::findTick(u_64 tick, u_64 *index) const
+{
+	u_64 lo = first(), hi = end();
+	struct fr_record r;
+
+	// Archive: the chunk from the index, then the record in it
+	if (arch)
+	{
+		size_t clo = 0, chi = chunks.size();
+		while (clo < chi)
+		{
+			size_t mid = clo + (chi - clo) / 2;
+			if (chunks[mid].last_tick < tick)
+				clo = mid + 1;
+			else
+				chi = mid;
+		}
+		if (clo >= chunks.size())
+			return -ENOENT;
+		lo = chunks[clo].first;
+		hi = (clo + 1 < chunks.size()) ? chunks[clo + 1].first : end();
+	}
+
+	// ticks increase with the index
+	while (lo < hi)
+	{
+		u_64 mid = lo + (hi - lo) / 2;
+		if (read(mid, &r) == 0 && r.tick < tick)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo >= end())
+		return -ENOENT;
+	*index = lo;
+	return 0;
+}
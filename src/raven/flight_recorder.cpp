@@ -0,0 +1,439 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file flight_recorder.cpp
+ * \brief Memory-mapped ring file of the full control state, every cycle.
+ *
+ * The whole file is created, zero-filled and locked at startup, so the RT
+ * thread only ever does a ~640 byte copy into memory that is already mapped.
+ * Writing the pages back is left to msync(MS_ASYNC) on the recorder thread.
+ *
+ * Rotation maps the next file on the recorder thread and swaps the pointer
+ * the RT thread writes through; the old mapping is unmapped a second later,
+ * long after any capture that could still be using it has finished.
+ * fr_files_lock keeps flightRecorderFetch() (the archiver) off a file
+ * while it is being created or unmapped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <string>
+
+#include "flight_recorder.h"
+#include "flight_format.h"
+#include "get_USB_packet.h"
+#include "put_USB_packet.h"
+#include "cycle_timing.h"
+#include "cpu_affinity.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern int NUM_MECH;
+extern unsigned long int gTime;
+extern USBStruct USBBoards;
+
+typedef char fr_in_len_matches[FR_IN_LEN == IN_LENGTH ? 1 : -1];
+typedef char fr_out_len_matches[FR_OUT_LEN == OUT_LENGTH ? 1 : -1];
+typedef char fr_header_fits[sizeof(struct fr_header) <= FR_HEADER_SIZE ? 1 : -1];
+
+struct fr_file
+{
+	void *map;
+	size_t len;
+	struct fr_header *hdr;
+	struct fr_record *slots;
+	u_64 count;                  // records written (RT thread only)
+};
+
+static std::string fr_name;
+static int fr_seconds = 30;
+static int fr_rotate_s = 0;
+static int fr_keep = 3;
+static u_32 fr_nslots = 0;
+
+static struct fr_file fr_files[2];                 // active and next / retiring
+static struct fr_file * volatile fr_active = NULL; // what the RT thread writes to
+static pthread_mutex_t fr_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char fr_schema[] =
+	"fr_record v2, little endian, packed by the C ABI:\n"
+	"u64 seq; u64 tick; u64 stamp_ns (CLOCK_MONOTONIC);\n"
+	"u8 runlevel; u8 sublevel; u8 surgeon_mode; u8 estop; i32 last_sequence;\n"
+	"u32 period_ns; u32 usb_wait_ns; u32 control_ns; u32 compute_ns;\n"
+	"u32 flags (1: master input taken); u32 reserved;\n"
+	"mech[mech_per_dev] { i32 pos[3]; i32 pos_d[3] (microns);\n"
+	"  dof[dof_per_mech] { i32 enc_val; f32 jpos; f32 jpos_d; f32 mpos; f32 mpos_d (rad);\n"
+	"    f32 tau_d; i16 current_cmd; i16 state }\n"
+	"  u8 enc_packet[27]; u8 dac_packet[19]; u8 pad[2];\n"
+	"  master { i32 xd[3]; f32 R[3][3]; i32 yaw; i32 pitch; i32 roll; i32 grasp } }\n";
+
+/**\fn static void rotateFiles()
+ * \brief shift file -> file.1 -> ... -> file.keep
+ */
+static void rotateFiles()
+{
+	char from[512], to[512];
+
+	for (int i = fr_keep - 1; i >= 0; i--)
+	{
+		if (i == 0)
+			snprintf(from, sizeof(from), "%s", fr_name.c_str());
+		else
+			snprintf(from, sizeof(from), "%s.%d", fr_name.c_str(), i);
+		snprintf(to, sizeof(to), "%s.%d", fr_name.c_str(), i+1);
+		rename(from, to);     // missing files are fine
+	}
+}
+
+/**\fn void initFlightHeader(struct fr_header *h, u_32 nslots)
+ * \brief fill in a file header for nslots records
+ */
+void initFlightHeader(struct fr_header *h, u_32 nslots)
+{
+	struct timespec treal, tmono;
+
+	clock_gettime(CLOCK_REALTIME, &treal);
+	clock_gettime(CLOCK_MONOTONIC, &tmono);
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, FR_MAGIC, 8);
+	h->version = FR_VERSION;
+	h->header_size = FR_HEADER_SIZE;
+	h->record_size = sizeof(struct fr_record);
+	h->nslots = nslots;
+	h->num_mech = NUM_MECH;
+	h->mech_per_dev = MAX_MECH_PER_DEV;
+	h->dof_per_mech = MAX_DOF_PER_MECH;
+	h->control_rate_hz = control_rate_hz;
+	for (int m = 0; m < NUM_MECH && m < MAX_MECH_PER_DEV; m++)
+		h->board_serial[m] = USBBoards.boards[m];
+	h->start_realtime_ns = (u_64)treal.tv_sec * 1000000000ULL + treal.tv_nsec;
+	h->start_monotonic_ns = (u_64)tmono.tv_sec * 1000000000ULL + tmono.tv_nsec;
+	h->count = 0;
+	strncpy(h->schema, fr_schema, FR_SCHEMA_LEN-1);
+}
+
+/**\fn static int openRecording(struct fr_file *f)
+ * \brief create, size, map, zero and lock a new recording file
+ * \return 0 on success, negative errno on failure
+ */
+static int openRecording(struct fr_file *f)
+{
+	rotateFiles();
+
+	int fd = open(fr_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0)
+		return -errno;
+
+	f->len = FR_HEADER_SIZE + (size_t)fr_nslots * sizeof(struct fr_record);
+	if (ftruncate(fd, f->len) < 0)
+	{
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+	f->map = mmap(NULL, f->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED)
+		return -errno;
+
+	memset(f->map, 0, f->len);        // allocate every page now, not on the RT thread
+	if (mlock(f->map, f->len) < 0)
+		err_msg("Flight recorder: could not lock %lu bytes (%d)", (unsigned long)f->len, errno);
+
+	f->hdr = (struct fr_header *)f->map;
+	f->slots = (struct fr_record *)((char *)f->map + FR_HEADER_SIZE);
+
+	initFlightHeader(f->hdr, fr_nslots);
+	f->count = 0;
+	msync(f->map, FR_HEADER_SIZE, MS_ASYNC);
+	return 0;
+}
+
+/**\fn static void closeRecording(struct fr_file *f)
+ * \brief flush and unmap a recording
+ */
+static void closeRecording(struct fr_file *f)
+{
+	if (f->map == NULL)
+		return;
+	msync(f->map, f->len, MS_SYNC);
+	munmap(f->map, f->len);
+	f->map = NULL;
+}
+
+/**\fn int init_flight_recorder(ros::NodeHandle &n)
+ * \brief read the recorder parameters and create the first recording
+ * \param n the node handle
+ * \return 0 on success or when the recorder is off, negative errno on failure
+ */
+int init_flight_recorder(ros::NodeHandle &n)
+{
+	n.param<std::string>("/flight_recorder_file", fr_name, "raven_flight.r2fr");
+	n.param("/flight_recorder_seconds", fr_seconds, 30);
+	n.param("/flight_recorder_rotate_s", fr_rotate_s, 0);
+	n.param("/flight_recorder_keep", fr_keep, 3);
+
+	if (fr_name.empty())
+	{
+		log_msg("Flight recorder: off");
+		return 0;
+	}
+	if (fr_seconds < 1)
+		fr_seconds = 1;
+	if (fr_keep < 1)
+		fr_keep = 1;
+	fr_nslots = (u_32)fr_seconds * control_rate_hz;
+
+	int err = openRecording(&fr_files[0]);
+	if (err < 0)
+	{
+		err_msg("Flight recorder: could not create %s (%d)", fr_name.c_str(), -err);
+		return err;
+	}
+	fr_active = &fr_files[0];
+
+	log_msg("Flight recorder: %s, %d s (%lu MB) ring, rotate every %d s", fr_name.c_str(), fr_seconds,
+			(unsigned long)(fr_files[0].len >> 20), fr_rotate_s);
+	return 0;
+}
+
+/**\fn void fillFlightRecord(struct fr_record *r, struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+ * \brief fill everything in a record except seq.  RT safe.
+ * \param r the record
+ * \param dev the robot state, after the DAC packets have been written
+ * \param currParams current parameters
+ * \param rcvdParams master input taken this cycle, or NULL
+ */
+void fillFlightRecord(struct fr_record *r, struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+{
+	struct timespec tnow;
+
+	clock_gettime(CLOCK_MONOTONIC, &tnow);
+	r->tick = gTime;
+	r->stamp_ns = (u_64)tnow.tv_sec * 1000000000ULL + tnow.tv_nsec;
+	r->runlevel = currParams->runlevel;
+	r->sublevel = currParams->sublevel;
+	r->surgeon_mode = dev->surgeon_mode;
+	r->estop = softEstopped() ? 1 : 0;
+	r->last_sequence = currParams->last_sequence;
+	r->period_ns = cycleTimingLast(CT_PERIOD);
+	r->usb_wait_ns = cycleTimingLast(CT_USB_WAIT);
+	r->control_ns = cycleTimingLast(CT_CONTROL);
+	r->compute_ns = cycleTimingLast(CT_COMPUTE);
+	r->flags = rcvdParams ? FR_MASTER_FRESH : 0;
+	r->reserved = 0;
+
+	for (int m = 0; m < MAX_MECH_PER_DEV; m++)
+	{
+		struct mechanism *mech = &dev->mech[m];
+		struct fr_mech *fm = &r->mech[m];
+
+		fm->pos[0] = mech->pos.x;     fm->pos[1] = mech->pos.y;     fm->pos[2] = mech->pos.z;
+		fm->pos_d[0] = mech->pos_d.x; fm->pos_d[1] = mech->pos_d.y; fm->pos_d[2] = mech->pos_d.z;
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			struct DOF *d = &mech->joint[j];
+			struct fr_dof *fd = &fm->dof[j];
+			fd->enc_val = d->enc_val;
+			fd->jpos = d->jpos;
+			fd->jpos_d = d->jpos_d;
+			fd->mpos = d->mpos;
+			fd->mpos_d = d->mpos_d;
+			fd->tau_d = d->tau_d;
+			fd->current_cmd = d->current_cmd;
+			fd->state = d->state;
+		}
+		memcpy(fm->enc_packet, encPacket(m), FR_IN_LEN);
+		memcpy(fm->dac_packet, dacPacket(m), FR_OUT_LEN);
+
+		struct fr_master *fmm = &fm->master;
+		if (rcvdParams == NULL)
+		{
+			memset(fmm, 0, sizeof(*fmm));
+			continue;
+		}
+		fmm->xd[0] = rcvdParams->xd[m].x; fmm->xd[1] = rcvdParams->xd[m].y; fmm->xd[2] = rcvdParams->xd[m].z;
+		memcpy(fmm->R, rcvdParams->rd[m].R, sizeof(fmm->R));
+		fmm->yaw = rcvdParams->rd[m].yaw;
+		fmm->pitch = rcvdParams->rd[m].pitch;
+		fmm->roll = rcvdParams->rd[m].roll;
+		fmm->grasp = rcvdParams->rd[m].grasp;
+	}
+}
+
+/**\fn void flightRecorderCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+ * \brief copy this cycle's state into the next record.  RT safe: no syscalls, no faults.
+ * \param dev the robot state, after the DAC packets have been written
+ * \param currParams current parameters
+ * \param rcvdParams master input taken this cycle, or NULL
+ */
+void flightRecorderCapture(struct device *dev, struct param_pass *currParams, struct param_pass *rcvdParams)
+{
+	struct fr_file *f = fr_active;
+
+	if (f == NULL)
+		return;
+
+	struct fr_record *r = &f->slots[f->count % fr_nslots];
+
+	r->seq = 0;                 // invalidate while the slot is rewritten
+	__sync_synchronize();
+	fillFlightRecord(r, dev, currParams, rcvdParams);
+
+	f->count++;
+	__sync_synchronize();
+	r->seq = f->count;
+	f->hdr->count = f->count;
+}
+
+/**\fn static int fetchFile(struct fr_file *f, u_64 *next_tick, struct fr_record *out, int max)
+ * \brief copy up to max complete records of f from tick *next_tick on, oldest first
+ * \return records copied
+ */
+static int fetchFile(struct fr_file *f, u_64 *next_tick, struct fr_record *out, int max)
+{
+	u_64 end = f->hdr->count;
+	u_64 lo = end > fr_nslots ? end - fr_nslots : 0, hi = end;
+	int n = 0;
+
+	// A slot being overwritten holds the oldest record: count it as older
+	while (lo < hi)
+	{
+		u_64 mid = lo + (hi - lo) / 2;
+		const struct fr_record *r = &f->slots[mid % fr_nslots];
+		if (r->seq != mid + 1 || r->tick < *next_tick)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (u_64 i = lo; i < end && n < max; i++)
+	{
+		const struct fr_record *r = &f->slots[i % fr_nslots];
+		if (r->seq != i + 1)
+			continue;
+		__sync_synchronize();
+		memcpy(&out[n], r, sizeof(*r));
+		__sync_synchronize();
+		if (r->seq != i + 1 || out[n].seq != i + 1 || out[n].tick < *next_tick)
+			continue;           // overwritten while it was copied
+		*next_tick = out[n].tick + 1;
+		n++;
+	}
+	return n;
+}
+
+/**\fn int flightRecorderFetch(u_64 *next_tick, struct fr_record *out, int max)
+ * \brief copy up to max records from tick *next_tick on, oldest first, across rotations.
+ *        Not for the RT thread: it waits out a rotation.
+ * \param next_tick first tick wanted; moved past the last record copied
+ * \param out room for max records
+ * \return records copied, -ENOENT if the recorder is off or closed
+ */
+int flightRecorderFetch(u_64 *next_tick, struct fr_record *out, int max)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&fr_files_lock);
+	struct fr_file *f = fr_active;
+	if (f == NULL)
+	{
+		pthread_mutex_unlock(&fr_files_lock);
+		return -ENOENT;
+	}
+	// The file rotated out is mapped until it retires: its last records first
+	struct fr_file *older = (f == &fr_files[0]) ? &fr_files[1] : &fr_files[0];
+	if (older->map)
+		n = fetchFile(older, next_tick, out, max);
+	n += fetchFile(f, next_tick, out + n, max - n);
+	pthread_mutex_unlock(&fr_files_lock);
+	return n;
+}
+
+/**\fn void* flight_recorder_process(void*)
+ * \brief Flight recorder thread: msync once a second, rotate when due.
+ */
+void* flight_recorder_process(void*)
+{
+	struct timespec tnext;
+	struct fr_file *retiring = NULL;
+	int since_rotate = 0;
+
+	if (fr_active == NULL)
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+
+	clock_gettime(CLOCK_MONOTONIC, &tnext);
+	while (ros::ok() && !r2Killed())
+	{
+		tnext.tv_sec += 1;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tnext, NULL);
+
+		// Unmapped one period after the swap: no capture can still be using it
+		if (retiring)
+		{
+			pthread_mutex_lock(&fr_files_lock);
+			closeRecording(retiring);
+			pthread_mutex_unlock(&fr_files_lock);
+			retiring = NULL;
+		}
+
+		struct fr_file *f = fr_active;
+		msync(f->map, f->len, MS_ASYNC);
+
+		if (fr_rotate_s > 0 && ++since_rotate >= fr_rotate_s)
+		{
+			// The current file is renamed to .1 but stays mapped until it retires
+			struct fr_file *next = (f == &fr_files[0]) ? &fr_files[1] : &fr_files[0];
+			pthread_mutex_lock(&fr_files_lock);
+			int err = openRecording(next);
+			if (err < 0)
+			{
+				pthread_mutex_unlock(&fr_files_lock);
+				err_msg("Flight recorder: rotation failed (%d), keeping %s.1", -err, fr_name.c_str());
+				fr_rotate_s = 0;
+				continue;
+			}
+			fr_active = next;
+			pthread_mutex_unlock(&fr_files_lock);
+			retiring = f;
+			since_rotate = 0;
+		}
+	}
+
+	pthread_mutex_lock(&fr_files_lock);
+	struct fr_file *f = fr_active;
+	fr_active = NULL;
+	if (retiring)
+		closeRecording(retiring);
+	if (f)
+	{
+		usleep(10000);         // let a capture in flight finish
+		closeRecording(f);
+	}
+	pthread_mutex_unlock(&fr_files_lock);
+	return NULL;
+}
@@ -25,10 +25,11 @@
 */
 
 #include "fwd_cable_coupling.h"
+#include "cable_coupling.h"
 #include "log.h"
 #include "tool.h"
+#include "arm_pipeline.h"
 
-extern struct DOF_type DOF_types[];
 extern int NUM_MECH;
 
 /**
@@ -44,142 +45,26 @@ void fwdCableCoupling(struct device *device0, int runlevel)
 {
 	//Run fwd cable coupling for each mechanism.
 	// This should be run in all runlevels.
-	for (int i = 0; i < NUM_MECH; i++)
+	for (int i = mechFirst(); i < mechEnd(); i++)
 		fwdMechCableCoupling(&(device0->mech[i]));
 }
 
 /**
 * \fn void fwdMechCableCoupling(struct mechanism *mech)
+* \brief motor positions to joint positions, through the kernel for the arm and tool (see cable_coupling.cpp)
 * \param mech
 * \return void
 */
 
 void fwdMechCableCoupling(struct mechanism *mech)
 {
-	float th1, th2, th3, th5, th6, th7;
-	float th1_dot, th2_dot;
-	float d4;
-	float d4_dot;
-	float m1, m2, m3, m4, m5, m6, m7;
-	float m1_dot, m2_dot, m4_dot;
-	float tr1=0, tr2=0, tr3=0, tr4=0, tr5=0, tr6=0, tr7=0;
-
-	m1 = mech->joint[SHOULDER].mpos;
-	m2 = mech->joint[ELBOW].mpos;
-	m3 = mech->joint[TOOL_ROT].mpos;
-	m4 = mech->joint[Z_INS].mpos;
-	m5 = mech->joint[WRIST].mpos;
-	m6 = mech->joint[GRASP1].mpos;
-	m7 = mech->joint[GRASP2].mpos;
-
-	m1_dot = mech->joint[SHOULDER].mvel;
-	m2_dot = mech->joint[ELBOW].mvel;
-	m4_dot = mech->joint[Z_INS].mvel;
-
-	if (mech->type == GOLD_ARM){
-		tr1=DOF_types[SHOULDER_GOLD].TR;
-		tr2=DOF_types[ELBOW_GOLD].TR;
-		tr3=DOF_types[TOOL_ROT_GOLD].TR;
-		tr4=DOF_types[Z_INS_GOLD].TR;
-		tr5=DOF_types[WRIST_GOLD].TR;
-		tr6=DOF_types[GRASP1_GOLD].TR;
-		tr7=DOF_types[GRASP2_GOLD].TR;
-
-	} else if (mech->type == GREEN_ARM){
-		tr1=DOF_types[SHOULDER_GREEN].TR;
-		tr2=DOF_types[ELBOW_GREEN].TR;
-		tr3=DOF_types[TOOL_ROT_GREEN].TR;
-		tr4=DOF_types[Z_INS_GREEN].TR;
-		tr5=DOF_types[WRIST_GREEN].TR;
-		tr6=DOF_types[GRASP1_GREEN].TR;
-		tr7=DOF_types[GRASP2_GREEN].TR;
-	}
-	else {
+	const struct coupling_kernels *cc = getCouplingKernels(mech);
+	if (cc == NULL)
+	{
 		log_msg("ERROR: incorrect device type in fwdMechCableCoupling");
 		return;
 	}
-
-	// Forward Cable Coupling equations
-	//   Originally based on 11/7/2005, Mitch notebook pg. 169
-	//   Updated from UCSC code.  Code simplified by HK 8/11
-	th1 = (1.0/tr1) * m1;
-
-	// DELETEME
-	//	th2 = (1.0/tr2) * m2; // additional CC terms added 3/13
-	//	d4  = (1.0/tr4) * m4;
-
-	th2 = (1.0/tr2) * m2 - CABLE_COUPLING_01 * th1;
-	d4  = (1.0/tr4) * m4 - CABLE_COUPLING_02 * th1 - CABLE_COUPLING_12 * th2;
-
-
-	// TODO:: Update with new cable coupling terms
-	th1_dot = (1.0/tr1) * m1_dot;
-	th2_dot = (1.0/tr2) * m2_dot;
-	d4_dot  = (1.0/tr4) * m4_dot;
-
-
-	// Tool degrees of freedom ===========================================
-	if (mech->tool_type == TOOL_GRASPER_10MM)
-	{
-		int sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-		th3 = (1.0/tr3) * (m3 - sgn*m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - sgn*m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - sgn*m4/GB_RATIO);
-		th7 = (1.0/tr7) * (m7 - sgn*m4/GB_RATIO);
-	}
-
-	if (mech->tool_type == RII_square_type)
-	{
-		int sgn = -1;
-		th3 = (1.0/tr3) * (m3 - sgn*m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - sgn*m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - sgn*m4/GB_RATIO);
-		th7 = (1.0/tr7) * (m7 - sgn*m4/GB_RATIO);
-	}
-
-
-	else if (mech->tool_type == davinci_square_type)
-	{
-		int sgn = -1;
-		th3 = (1.0/tr3) * (m3 - sgn*m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - sgn*m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - sgn*m4/GB_RATIO) - th5/2;
-		th7 = (1.0/tr7) * (m7 - sgn*m4/GB_RATIO) + th5/2;
-	}
-
-
-	else if (mech->tool_type == TOOL_GRASPER_8MM)
-	{
-		log_msg("8mm");
-		// Note: sign of the last term changes for GOLD vs GREEN arm
-		int sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-		th3 = (1.0/tr3) * (m3 - m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - m4/GB_RATIO - sgn * (tr5*th5) * (tr5/tr6));
-		th7 = (1.0/tr7) * (m7 - m4/GB_RATIO + sgn *(tr5*th5) * (tr5/tr6));
-	}
-	else // (mech->tool_type == TOOL_NONE) // there's tool in the robot
-	{
-		// coupling goes until the tool adapter pulleys
-		th3 = (1.0/tr3) * (m3 - m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - m4/GB_RATIO);
-		th7 = (1.0/tr7) * (m7 - m4/GB_RATIO);
-	}
-	// Now have solved for th1, th2, d3, th4, th5, th6
-	mech->joint[SHOULDER].jpos 	= th1;// - mech->joint[SHOULDER].jpos_off;
-	mech->joint[ELBOW].jpos 		= th2;// - mech->joint[ELBOW].jpos_off;
-	mech->joint[TOOL_ROT].jpos 	= th3;// - mech->joint[TOOL_ROT].jpos_off;
-	mech->joint[Z_INS].jpos 		= d4;//  - mech->joint[Z_INS].jpos_off;
-	mech->joint[WRIST].jpos 		= th5;// - mech->joint[WRIST].jpos_off;
-	mech->joint[GRASP1].jpos 		= th6;// - mech->joint[GRASP1].jpos_off;
-	mech->joint[GRASP2].jpos 		= th7;// - mech->joint[GRASP2].jpos_off;
-
-	mech->joint[SHOULDER].jvel 	= th1_dot;// - mech->joint[SHOULDER].jpos_off;
-	mech->joint[ELBOW].jvel 		= th2_dot;// - mech->joint[ELBOW].jpos_off;
-	mech->joint[Z_INS].jvel 		= d4_dot;//  - mech->joint[Z_INS].jpos_off;
-
-	return;
+	cc->fwd(mech);
 }
 
 
@@ -204,98 +89,15 @@ void fwdTorqueCoupling(struct device *device0, int runlevel)
 
 /**
 * \fn void fwdMechTorqueCoupling(struct mechanism *mech)
+* \brief motor positions to joint positions; the same map as fwdMechCableCoupling()
+*
+* This used to be a copy of the forward equations with only the 10 mm
+* grasper's tool terms, leaving the tool joints unset for the others.
 * \param mech
 * \return void
 */
 
 void fwdMechTorqueCoupling(struct mechanism *mech)
 {
-	float th1, th2, th3, th5, th6, th7;
-	float th1_dot, th2_dot;
-	float d4;
-	float d4_dot;
-	float m1, m2, m3, m4, m5, m6, m7;
-	float m1_dot, m2_dot, m4_dot;
-	float tr1=0, tr2=0, tr3=0, tr4=0, tr5=0, tr6=0, tr7=0;
-
-	m1 = mech->joint[SHOULDER].mpos;
-	m2 = mech->joint[ELBOW].mpos;
-	m3 = mech->joint[TOOL_ROT].mpos;
-	m4 = mech->joint[Z_INS].mpos;
-	m5 = mech->joint[WRIST].mpos;
-	m6 = mech->joint[GRASP1].mpos;
-	m7 = mech->joint[GRASP2].mpos;
-
-	m1_dot = mech->joint[SHOULDER].mvel;
-	m2_dot = mech->joint[ELBOW].mvel;
-	m4_dot = mech->joint[Z_INS].mvel;
-
-	if (mech->type == GOLD_ARM){
-		tr1=DOF_types[SHOULDER_GOLD].TR;
-		tr2=DOF_types[ELBOW_GOLD].TR;
-		tr3=DOF_types[TOOL_ROT_GOLD].TR;
-		tr4=DOF_types[Z_INS_GOLD].TR;
-		tr5=DOF_types[WRIST_GOLD].TR;
-		tr6=DOF_types[GRASP1_GOLD].TR;
-		tr7=DOF_types[GRASP2_GOLD].TR;
-
-	} else if (mech->type == GREEN_ARM){
-		tr1=DOF_types[SHOULDER_GREEN].TR;
-		tr2=DOF_types[ELBOW_GREEN].TR;
-		tr3=DOF_types[TOOL_ROT_GREEN].TR;
-		tr4=DOF_types[Z_INS_GREEN].TR;
-		tr5=DOF_types[WRIST_GREEN].TR;
-		tr6=DOF_types[GRASP1_GREEN].TR;
-		tr7=DOF_types[GRASP2_GREEN].TR;
-	}
-	else {
-		log_msg("ERROR: incorrect device type in fwdMechCableCoupling");
-		return;
-	}
-
-	// Forward Cable Coupling equations
-	//   Originally based on 11/7/2005, Mitch notebook pg. 169
-	//   Updated from UCSC code.  Code simplified by HK 8/11
-	th1 = (1.0/tr1) * m1;
-
-	// DELETEME
-	//	th2 = (1.0/tr2) * m2; // additional CC terms added 3/13
-	//	d4  = (1.0/tr4) * m4;
-
-	th2 = (1.0/tr2) * m2 - CABLE_COUPLING_01 * th1;
-	d4  = (1.0/tr4) * m4 - CABLE_COUPLING_02 * th1 -CABLE_COUPLING_12 * th2;
-
-
-	// TODO:: Update with new cable coupling terms
-	th1_dot = (1.0/tr1) * m1_dot;
-	th2_dot = (1.0/tr2) * m2_dot;
-	d4_dot  = (1.0/tr4) * m4_dot;
-
-
-	// Tool degrees of freedom ===========================================
-	if (mech->tool_type == TOOL_GRASPER_10MM)
-	{
-		int sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-		th3 = (1.0/tr3) * (m3 - sgn*m4/GB_RATIO);
-		th5 = (1.0/tr5) * (m5 - sgn*m4/GB_RATIO);
-		th6 = (1.0/tr6) * (m6 - sgn*m4/GB_RATIO);
-		th7 = (1.0/tr7) * (m7 - sgn*m4/GB_RATIO);
-	}
-
-	// Now have solved for th1, th2, d3, th4, th5, th6
-	mech->joint[SHOULDER].jpos 	= th1;// - mech->joint[SHOULDER].jpos_off;
-	mech->joint[ELBOW].jpos 		= th2;// - mech->joint[ELBOW].jpos_off;
-	mech->joint[TOOL_ROT].jpos 	= th3;// - mech->joint[TOOL_ROT].jpos_off;
-	mech->joint[Z_INS].jpos 		= d4;//  - mech->joint[Z_INS].jpos_off;
-	mech->joint[WRIST].jpos 		= th5;// - mech->joint[WRIST].jpos_off;
-	mech->joint[GRASP1].jpos 		= th6;// - mech->joint[GRASP1].jpos_off;
-	mech->joint[GRASP2].jpos 		= th7;// - mech->joint[GRASP2].jpos_off;
-
-	mech->joint[SHOULDER].jvel 	= th1_dot;// - mech->joint[SHOULDER].jpos_off;
-	mech->joint[ELBOW].jvel 		= th2_dot;// - mech->joint[ELBOW].jpos_off;
-	mech->joint[Z_INS].jvel 		= d4_dot;//  - mech->joint[Z_INS].jpos_off;
-
-	return;
+	fwdMechCableCoupling(mech);
 }
-
-
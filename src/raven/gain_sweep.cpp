@@ -0,0 +1,447 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * r2_gain_sweep: score candidate PD gains and position filters on the
+ * simulated boards, many at once, and rank them.
+ *
+ *   r2_gain_sweep [-n cycles] [-s settle] [-p kp,...] [-d kd,...] [-f filter,...]
+ *                 [-j jobs] [-a weight] [-b weight] [-o report]
+ *
+ * A candidate is a scale on every /gains_*_kp, one on every /gains_*_kd,
+ * and a position filter for all joints ("design:cutoff_hz:order", or
+ * "default" for the state_lpf_* parameters).  Every combination of the
+ * -p, -d and -f lists is run; scale 1, 1 with the default filter, the
+ * gains as configured, always is.
+ *
+ * The stack is set up once, like r2_control_bench with /usb_sim_runlevel
+ * at init, and each candidate runs in a forked copy of it, -j at a time
+ * (default: one per core), in lockstep on the simulated plant.  The
+ * trajectory is multi_dof_sinusoid.  After the settle cycles each run
+ * measures, over the joints the sinusoid drives:
+ *
+ *   err   RMS motor position error mpos_d - mpos (rad)
+ *   cur   RMS DAC command current_cmd, before its limits (DAC counts)
+ *   clip  current clips per second (MC_CURRENT_CLIPS)
+ *
+ * score = err / err0 + a * cur / cur0 + b * clip, relative to the
+ * configured gains (a 0.25, b 1 by default); lower is better, and a run
+ * that soft e-stops is ranked last.  The report goes to stdout, or to -o.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+
+#include <ros/ros.h>
+
+#include "rt_process_preempt.h"
+#include "rt_raven.h"
+#include "control_clock.h"
+#include "velocity_estimate.h"
+#include "setpoint_interp.h"
+#include "cable_coupling.h"
+#include "usb_sim.h"
+#include "controller.h"
+#include "metrics.h"
+#include "shared_state.h"
+
+extern unsigned long int gTime;        // Defined in globals.cpp
+extern struct device device0;          // Defined in globals.cpp
+extern int NUM_MECH;                   // Defined in globals.cpp
+extern int usb_backend;                // Defined in globals.cpp
+extern struct DOF_type DOF_types[];
+
+static struct param_pass currParams;
+static struct param_pass rcvdParams;
+
+/// Position filter of a candidate.  design < 0: as configured.
+struct sweep_filter {
+	int design;
+	float cutoff_hz;
+	int order;
+	std::string name;
+};
+
+struct sweep_candidate {
+	double kp_scale, kd_scale;
+	int filter;             // index into the filter list
+};
+
+/// What a run sends back up its pipe
+struct sweep_result {
+	int ok;                 // 0: the run did not finish
+	int estopped;           // the run ended in a soft e-stop
+	double err_rms;         // rad at the motor
+	double cur_rms;         // DAC counts
+	double clips_per_s;
+};
+
+/**\fn static void sweepCycle(void)
+ * \brief one pass of the rt_process() loop body on the simulated boards, as benchCycle() in control_bench.cpp
+ */
+static void sweepCycle(void)
+{
+	initiateUSBGet(&device0);
+	gTime++;
+	int loops = 0;
+	while (getUSBPackets(&device0) == -EBUSY && loops++ < 1000)
+		;
+
+	updateAtmelInputs(&device0);
+	stateMachine(&device0, &currParams, &rcvdParams, 0);
+	rcvdParams.runlevel = currParams.runlevel;
+	currParams.robotControlMode = multi_dof_sinusoid;
+
+	clearDACs(&device0);
+	controlRaven(&device0, &currParams);
+	if (overdriveDetect(&device0))
+		softEstop();
+	updateAtmelOutputs(&device0, currParams.runlevel);
+	putUSBPackets(&device0);
+}
+
+/**\fn static void sweepRun(const struct sweep_candidate *c, const struct sweep_filter *f, int cycles, int settle, struct sweep_result *r)
+ * \brief run one candidate from the state the parent set up.  In a forked child only.
+ */
+static void sweepRun(const struct sweep_candidate *c, const struct sweep_filter *f, int cycles, int settle, struct sweep_result *r)
+{
+	for (int i = 0; i < MAX_MECH * MAX_DOF_PER_MECH; i++)
+	{
+		DOF_types[i].KP *= c->kp_scale;
+		DOF_types[i].KD *= c->kd_scale;
+	}
+	if (f->design >= 0)
+	{
+		setStateLPFClass(LPF_CLASS_ARM, f->design, f->cutoff_hz, f->order);
+		setStateLPFClass(LPF_CLASS_TOOL, f->design, f->cutoff_hz, f->order);
+	}
+
+	softEstopClear();
+	memset(&currParams, 0, sizeof(currParams));
+	memset(&rcvdParams, 0, sizeof(rcvdParams));
+	currParams.runlevel = STOP;
+	currParams.sublevel = 0;
+	initDOFs(&device0);
+
+	for (int i = 0; i < settle; i++)
+		sweepCycle();
+
+	u_64 clips0 = metrics.counters[MC_CURRENT_CLIPS];
+	double err2 = 0, cur2 = 0;
+	long samples = 0;
+	for (int i = 0; i < cycles && !softEstopped(); i++)
+	{
+		sweepCycle();
+		for (int m = 0; m < NUM_MECH; m++)
+			for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			{
+				if (j == NO_CONNECTION)
+					continue;
+				struct DOF *_joint = &device0.mech[m].joint[j];
+				double e = _joint->mpos_d - _joint->mpos;
+				err2 += e * e;
+				cur2 += (double)_joint->current_cmd * _joint->current_cmd;
+				samples++;
+			}
+	}
+
+	r->ok = samples > 0;
+	r->estopped = softEstopped();
+	if (samples > 0)
+	{
+		r->err_rms = sqrt(err2 / samples);
+		r->cur_rms = sqrt(cur2 / samples);
+		r->clips_per_s = (double)(metrics.counters[MC_CURRENT_CLIPS] - clips0) * control_rate_hz / cycles;
+	}
+}
+
+/**\fn static void parseList(const std::string &s, std::vector<std::string> &out)
+ * \brief split a comma separated option
+ */
+static void parseList(const std::string &s, std::vector<std::string> &out)
+{
+	for (size_t pos = 0; pos <= s.size(); )
+	{
+		size_t end = s.find(',', pos);
+		if (end == std::string::npos)
+			end = s.size();
+		if (end > pos)
+			out.push_back(s.substr(pos, end - pos));
+		pos = end + 1;
+	}
+}
+
+/**\fn static int parseFilter(const std::string &s, struct sweep_filter *f)
+ * \brief "design:cutoff_hz:order" or "default"
+ * \return 0, or -1 if it does not parse
+ */
+static int parseFilter(const std::string &s, struct sweep_filter *f)
+{
+	f->name = s;
+	f->design = -1;
+	if (s == "default")
+		return 0;
+
+	size_t a = s.find(':'), b = (a == std::string::npos) ? a : s.find(':', a + 1);
+	if (b == std::string::npos)
+		return -1;
+	f->design = lpfDesignByName(s.substr(0, a));
+	f->cutoff_hz = atof(s.substr(a + 1, b - a - 1).c_str());
+	f->order = atoi(s.substr(b + 1).c_str());
+	return (f->design < 0 || f->cutoff_hz <= 0 || f->order < 1) ? -1 : 0;
+}
+
+/// orders candidate indices by score
+struct byScore {
+	const std::vector<double> &score;
+	byScore(const std::vector<double> &s) : score(s) {}
+	bool operator()(size_t a, size_t b) const { return score[a] < score[b]; }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n cycles] [-s settle] [-p kp,...] [-d kd,...] [-f filter,...]\n"
+			"       [-j jobs] [-a weight] [-b weight] [-o report]\n"
+			"  filter: default, or design:cutoff_hz:order (butterworth, bessel)\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int cycles = 10000, settle = 2000;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	double w_cur = 0.25, w_clip = 1.0;
+	const char *report = NULL;
+	std::string kp_opt = "0.5,0.75,1,1.5,2", kd_opt = "0.5,0.75,1,1.5,2", f_opt = "default";
+
+	ros::init(argc, argv, "r2_gain_sweep", ros::init_options::NoSigintHandler | ros::init_options::AnonymousName);
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:p:d:f:j:a:b:o:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': cycles = atoi(optarg); break;
+		case 's': settle = atoi(optarg); break;
+		case 'p': kp_opt = optarg; break;
+		case 'd': kd_opt = optarg; break;
+		case 'f': f_opt = optarg; break;
+		case 'j': jobs = atoi(optarg); break;
+		case 'a': w_cur = atof(optarg); break;
+		case 'b': w_clip = atof(optarg); break;
+		case 'o': report = optarg; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if (cycles <= 0 || settle < 0 || jobs < 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Candidates: the configured gains first, then every combination
+	std::vector<std::string> kp_list, kd_list, f_list;
+	std::vector<struct sweep_filter> filters(1);
+	parseFilter("default", &filters[0]);
+	parseList(kp_opt, kp_list);
+	parseList(kd_opt, kd_list);
+	parseList(f_opt, f_list);
+	for (size_t i = 0; i < f_list.size(); i++)
+	{
+		struct sweep_filter f;
+		if (parseFilter(f_list[i], &f) < 0)
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		if (f.name != "default")
+			filters.push_back(f);
+	}
+
+	std::vector<struct sweep_candidate> cand;
+	struct sweep_candidate base = { 1.0, 1.0, 0 };
+	cand.push_back(base);
+	for (size_t f = 0; f < filters.size(); f++)
+		for (size_t p = 0; p < kp_list.size(); p++)
+			for (size_t d = 0; d < kd_list.size(); d++)
+			{
+				struct sweep_candidate c = { atof(kp_list[p].c_str()), atof(kd_list[d].c_str()), (int)f };
+				if (c.kp_scale <= 0 || c.kd_scale < 0)
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				if (c.kp_scale != 1.0 || c.kd_scale != 1.0 || f != 0)
+					cand.push_back(c);
+			}
+
+	// Same setup as r2_control_bench on simulated boards, serial pipeline
+	ros::NodeHandle n;
+	step_period = 1.0 / control_rate_hz;
+	designStateLPF(control_rate_hz);
+	init_arm_boards(n);
+	usb_backend = USB_BACKEND_SIM;
+	if (!n.hasParam("/usb_sim_runlevel"))
+		n.setParam("/usb_sim_runlevel", (int)RL_INIT);   // init.init: where multi_dof_sinusoid runs
+	init_usb_sim(n);
+	controlClockSetLockstep(1);
+	if (USBInit(&device0) == FALSE)
+	{
+		err_msg("Could not init the simulated boards");
+		return 1;
+	}
+	USBInitWait();
+	initLocalioData();
+	init_state_lpf(n);
+	init_velocity_estimate(n);
+	init_setpoint_interp(n);
+	init_kinematics(n);
+	init_cable_coupling(n);
+	init_thermal_model(n);
+	init_ravengains(n, &device0);
+	init_controllers(n, &device0);
+
+	// Nothing below talks to the master; no ROS threads to lose across fork()
+	ros::shutdown();
+
+	fprintf(stderr, "r2_gain_sweep: %d Hz, %d mechs, %lu candidates of %d cycles after %d settle, %d at a time\n",
+			control_rate_hz, NUM_MECH, (unsigned long)cand.size(), cycles, settle, jobs);
+
+	std::vector<struct sweep_result> res(cand.size());
+	std::vector<pid_t> pid(cand.size(), -1);
+	std::vector<int> fd(cand.size(), -1);
+	size_t next = 0, done = 0;
+	int running = 0;
+	fflush(NULL);
+	while (done < cand.size())
+	{
+		while (running < jobs && next < cand.size())
+		{
+			int p[2];
+			if (pipe(p) != 0)
+			{
+				err_msg("pipe failed (%s)", strerror(errno));
+				return 1;
+			}
+			pid_t c = fork();
+			if (c < 0)
+			{
+				err_msg("fork failed (%s)", strerror(errno));
+				return 1;
+			}
+			if (c == 0)
+			{
+				// The run's own messages (clipping, e-stop) would bury the report
+				int devnull = open("/dev/null", O_WRONLY);
+				if (devnull >= 0)
+				{
+					dup2(devnull, STDOUT_FILENO);
+					dup2(devnull, STDERR_FILENO);
+				}
+				close(p[0]);
+				struct sweep_result r;
+				memset(&r, 0, sizeof(r));
+				sweepRun(&cand[next], &filters[cand[next].filter], cycles, settle, &r);
+				ssize_t w = write(p[1], &r, sizeof(r));
+				_exit(w == (ssize_t)sizeof(r) ? 0 : 1);
+			}
+			close(p[1]);
+			pid[next] = c;
+			fd[next] = p[0];
+			next++;
+			running++;
+		}
+
+		int status;
+		pid_t c = wait(&status);
+		if (c < 0)
+			break;
+		for (size_t i = 0; i < cand.size(); i++)
+			if (pid[i] == c)
+			{
+				memset(&res[i], 0, sizeof(res[i]));
+				if (read(fd[i], &res[i], sizeof(res[i])) != (ssize_t)sizeof(res[i]))
+					res[i].ok = 0;
+				close(fd[i]);
+				pid[i] = -1;
+				running--;
+				done++;
+				fprintf(stderr, "\r  %lu / %lu", (unsigned long)done, (unsigned long)cand.size());
+			}
+	}
+	fprintf(stderr, "\n");
+
+	usbSimShutdown();
+	const struct sweep_result &r0 = res[0];
+	if (!r0.ok || r0.err_rms <= 0)
+	{
+		err_msg("The configured gains did not run: nothing to score against");
+		return 1;
+	}
+
+	// Rank
+	std::vector<double> score(cand.size());
+	std::vector<size_t> order(cand.size());
+	for (size_t i = 0; i < cand.size(); i++)
+	{
+		const struct sweep_result &r = res[i];
+		order[i] = i;
+		if (!r.ok || r.estopped)
+			score[i] = HUGE_VAL;
+		else
+			score[i] = r.err_rms / r0.err_rms + w_cur * (r0.cur_rms > 0 ? r.cur_rms / r0.cur_rms : 0) +
+					   w_clip * r.clips_per_s;
+	}
+	std::stable_sort(order.begin(), order.end(), byScore(score));
+
+	FILE *out = report ? fopen(report, "w") : stdout;
+	if (out == NULL)
+	{
+		err_msg("Cannot write %s (%s)", report, strerror(errno));
+		return 1;
+	}
+	fprintf(out, "# r2_gain_sweep: multi_dof_sinusoid, %d cycles at %d Hz after %d settle\n", cycles, control_rate_hz, settle);
+	fprintf(out, "# score = err/err0 + %.3g cur/cur0 + %.3g clips/s; configured gains: err %.3g rad, cur %.0f DAC\n",
+			w_cur, w_clip, r0.err_rms, r0.cur_rms);
+	fprintf(out, "%4s %8s %6s %6s %-24s %10s %8s %8s\n", "rank", "score", "kp", "kd", "filter", "err_rad", "cur_dac", "clips/s");
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		size_t i = order[k];
+		const struct sweep_candidate &c = cand[i];
+		const struct sweep_result &r = res[i];
+		if (!r.ok)
+			fprintf(out, "%4lu %8s %6.3g %6.3g %-24s  (run failed)\n", (unsigned long)k + 1, "-",
+					c.kp_scale, c.kd_scale, filters[c.filter].name.c_str());
+		else
+			fprintf(out, "%4lu %8.3f %6.3g %6.3g %-24s %10.3g %8.0f %8.1f%s%s\n", (unsigned long)k + 1, score[i],
+					c.kp_scale, c.kd_scale, filters[c.filter].name.c_str(), r.err_rms, r.cur_rms, r.clips_per_s,
+					r.estopped ? "  soft e-stop" : "", i == 0 ? "  (configured)" : "");
+	}
+	if (report)
+		fclose(out);
+	return 0;
+}
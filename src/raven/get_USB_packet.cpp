@@ -25,11 +25,75 @@
 */
 
 
+#include <poll.h>
+#include <time.h>
+#include <string.h>
+
 #include "get_USB_packet.h"
+#include "usb_workers.h"
+#include "usb_ring.h"
+#include "usb_health.h"
+#include "control_clock.h"
+#include "metrics.h"
 #include "parallel.h"
+#include "utils.h"
 
 extern unsigned long int gTime;
 extern USBStruct USBBoards;
+extern struct device device0;
+
+struct enc_packet
+{
+    unsigned char buf[IN_LENGTH];
+} __attribute__((aligned(64)));
+
+static struct enc_packet enc_packets[MAX_MECH];   // last ENC packet from each board
+static struct enc_packet_info enc_info[MAX_MECH];
+
+/**\fn const unsigned char *encPacket(int m)
+  \brief the last encoder packet read for mechanism / board index m (flight recorder)
+  \param m mechanism index
+  \return pointer to IN_LENGTH bytes
+*/
+const unsigned char *encPacket(int m)
+{
+    return enc_packets[m].buf;
+}
+
+/**\fn const struct enc_packet_info *encPacketInfo(int m)
+  \brief arrival time and count of mechanism / board index m's encoder packets
+  \param m mechanism index
+*/
+const struct enc_packet_info *encPacketInfo(int m)
+{
+    return &enc_info[m];
+}
+
+/**\fn unsigned long encPacketAge(int m)
+  \brief cycles since mechanism m's last encoder packet: 0 if this cycle's arrived
+  \param m mechanism index
+*/
+unsigned long encPacketAge(int m)
+{
+    return gTime - enc_info[m].rx_cycle;
+}
+
+/**\fn static void stampEncPacket(int m, uint64_t ring_ns)
+  \brief record the arrival of an encoder packet for mechanism m
+  \param m mechanism index
+  \param ring_ns the driver's completion time (CLOCK_MONOTONIC), 0 if none
+*/
+static void stampEncPacket(int m, uint64_t ring_ns)
+{
+    struct enc_packet_info *e = &enc_info[m];
+    long long ns = (ring_ns != 0 && !controlClockLockstep()) ? (long long)ring_ns : controlClockNs();
+
+    if (e->seq > 0 && ns > e->rx_ns)
+        metricObserve(MH_ENC_INTERVAL_US, (ns - e->rx_ns) / 1000);
+    e->rx_ns = ns;
+    e->rx_cycle = gTime;
+    e->seq++;
+}
 
 /**\fn void initiateUSBGet(struct device *device0)
   \brief Initiate data request from USB Board. Must be called before read
@@ -41,11 +105,17 @@ void initiateUSBGet(struct device *device0)
 {
   int i;
   int err=0;
+
+  if (usbWorkersActive())
+    {
+      usbWorkersRun(USB_JOB_START_READ, NULL);
+      return;
+    }
   
   //Loop through all USB Boards
   for (i = 0; i < USBBoards.activeAtStart; i++)
     {
-      err = startUSBRead( USBBoards.boards[1-i] );
+      err = startUSBRead( USBBoards.boards[i] );
       if ( err < 0)
         {
 	  //	  log_msg("Error (%d) initiating USB read %d on loop %d!", err, USBBoards.boards[i], gTime);
@@ -65,6 +135,9 @@ int getUSBPackets(struct device *device0)
 {
     int ret = 0;
 
+    if (usbWorkersActive())
+        return usbWorkersRun(USB_JOB_READ, NULL);
+
     //Loop through all USB Boards
     for (int i = 0; i < USBBoards.activeAtStart; i++)
     {
@@ -84,6 +157,141 @@ int getUSBPackets(struct device *device0)
     return ret;
 }
 
+/**\fn static void usbBusyBackoff(const struct timespec *deadline)
+  \brief sleep 10us (or until the deadline, if sooner)
+*/
+static void usbBusyBackoff(const struct timespec *deadline)
+{
+    struct timespec tbz;
+    clock_gettime(CLOCK_MONOTONIC, &tbz);
+    tbz.tv_nsec += 10*1000;
+    tsnorm(&tbz);
+    if ( isbefore((*deadline), tbz) )
+        tbz = *deadline;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tbz, NULL);
+}
+
+/**\fn int getUSBPacketsWait(struct device *device0, const struct timespec *deadline)
+  \brief Wait for the initiated USB reads to complete and process each board
+ *   as soon as its packet arrives.
+ *
+ *   Boards that are still busy are waited on with ppoll() until the deadline
+ *   (CLOCK_MONOTONIC, absolute).  If the driver reports the file readable but
+ *   the read is still busy (no poll support in the driver), back off 10us so
+ *   we do not spin.
+  \struct device
+  \param device0 pointer to device struct
+  \param deadline absolute CLOCK_MONOTONIC time to give up waiting
+  \return zero on success, -EBUSY if a board missed the deadline, negative on other failure
+*/
+int getUSBPacketsWait(struct device *device0, const struct timespec *deadline)
+{
+    struct pollfd fds[MAX_BOARD_COUNT];
+    int pending[MAX_BOARD_COUNT];
+    int npending = 0;
+    int ret = 0;
+    struct timespec tnow, timeout;
+
+    if (usbWorkersActive())
+        return usbWorkersRun(USB_JOB_READ, deadline);
+
+    // Read every board that is already complete
+    for (int i = 0; i < USBBoards.activeAtStart && i < MAX_BOARD_COUNT; i++)
+    {
+        int err = getUSBPacket( USBBoards.boards[i], &(device0->mech[i]) );
+        if (err == -EBUSY)
+            pending[npending++] = i;
+        else if (err < 0)
+            ret = err;
+    }
+
+    while (npending > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &tnow);
+        if ( !isbefore(tnow, (*deadline)) )
+            return -EBUSY;
+        timeout = tsSubtract(*deadline, tnow);
+
+        for (int k = 0; k < npending; k++)
+        {
+            fds[k].fd = usb_board_fd( USBBoards.boards[pending[k]] );
+            fds[k].events = POLLIN;
+            fds[k].revents = 0;
+        }
+
+        int nready = ppoll(fds, npending, &timeout, NULL);
+        if (nready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (nready == 0)
+            return -EBUSY;
+
+        // Process the boards that became ready, keep the rest pending
+        int stillpending = 0;
+        for (int k = 0; k < npending; k++)
+        {
+            int err = -EBUSY;
+            if (fds[k].revents & (POLLIN|POLLERR|POLLHUP))
+                err = getUSBPacket( USBBoards.boards[pending[k]], &(device0->mech[pending[k]]) );
+
+            if (err == -EBUSY)
+                pending[stillpending++] = pending[k];
+            else if (err < 0)
+                ret = err;
+        }
+
+        if (stillpending == npending)
+            usbBusyBackoff(deadline);
+        npending = stillpending;
+    }
+
+    return ret;
+}
+
+/**\fn int getUSBPacketWait(int id, struct mechanism *mech, const struct timespec *deadline)
+  \brief Single-board getUSBPacketsWait(), used by the parallel USB workers.
+  \param id the USB board to read from
+  \param mech pointer to mechanism struct
+  \param deadline absolute CLOCK_MONOTONIC time to give up waiting
+  \return zero on success, -EBUSY if the board missed the deadline, negative on other failure
+*/
+int getUSBPacketWait(int id, struct mechanism *mech, const struct timespec *deadline)
+{
+    struct pollfd fd;
+    struct timespec tnow, timeout;
+    int err = getUSBPacket(id, mech);
+
+    while (err == -EBUSY)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &tnow);
+        if ( !isbefore(tnow, (*deadline)) )
+            return -EBUSY;
+        timeout = tsSubtract(*deadline, tnow);
+
+        fd.fd = usb_board_fd(id);
+        fd.events = POLLIN;
+        fd.revents = 0;
+        int nready = ppoll(&fd, 1, &timeout, NULL);
+        if (nready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (nready == 0)
+            return -EBUSY;
+
+        err = getUSBPacket(id, mech);
+        if (err == -EBUSY)
+            usbBusyBackoff(deadline);
+    }
+
+    return err;
+}
+
 /**\fn int getUSBPacket(int id, struct mechanism *mech)
   \brief Takes data from a USB packet and uses it to fill the
  *   DS0 data structure
@@ -97,9 +305,16 @@ int getUSBPacket(int id, struct mechanism *mech)
 {
     int result, type;
     unsigned char buffer[MAX_IN_LENGTH];
+    unsigned char *packet = buffer;
+    uint64_t ring_ns = 0;
 
-    //Read USB Packet
-    result = usb_read(id,buffer,IN_LENGTH);
+    //Read USB Packet: decoded where the driver left it, if the board's ring is mapped
+    if (!usbBoardUp(id))
+        result = -ENODEV;       // given up until it is reopened (usb_health.h)
+    else if (usbRingActive(id))
+        result = usbRingRead(id, &packet, &ring_ns);
+    else
+        result = usb_read(id,buffer,IN_LENGTH);
 
     // -- Check for read errors --
     if (result < 0){
@@ -111,14 +326,19 @@ int getUSBPacket(int id, struct mechanism *mech)
       return -EIO;
 
     // -- Good packet so process it --
-    type = buffer[0];
+    type = packet[0];
 
     //Load in the data from the USB packet
     switch (type)
       {
         //Handle and Encoder USB packet
       case ENC:
-        processEncoderPacket(mech, buffer);
+        processEncoderPacket(mech, packet);
+        if (mech >= device0.mech && mech < device0.mech + MAX_MECH)
+        {
+            memcpy(enc_packets[mech - device0.mech].buf, packet, IN_LENGTH);
+            stampEncPacket(mech - device0.mech, ring_ns);
+        }
         break;
       }
 
@@ -133,10 +353,12 @@ int getUSBPacket(int id, struct mechanism *mech)
 void processEncoderPacket(struct mechanism* mech, unsigned char buffer[])
 {
     int i, numChannels;
-    int encVal;
+    int encVal[MAX_DOF_PER_MECH];
 
     //Determine channels of data received
     numChannels = buffer[1];
+    if (numChannels > MAX_DOF_PER_MECH)
+        numChannels = MAX_DOF_PER_MECH;
 
     //Get the input pin status
 #ifdef RAVEN_I
@@ -145,11 +367,8 @@ void processEncoderPacket(struct mechanism* mech, unsigned char buffer[])
     mech->inputs = buffer[2];
 #endif
 
-    //Loop through and read data for each channel
+    //Decode every channel at once, then load the ones the board sent
+    decodeEncPacket(buffer, encVal);
     for (i = 0; i < numChannels; i++)
-    {
-        //Load encoder values
-        encVal = processEncVal(buffer, i);
-        mech->joint[i].enc_val = encVal;
-    }
+        mech->joint[i].enc_val = encVal[i];
 }
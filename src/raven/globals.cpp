@@ -26,9 +26,37 @@
 
 #include "struct.h"  // DS0, DS1, DOF_types defines
 #include "USB_init.h"
+#include "usb_workers.h"
+#include "cycle_scheduler.h"
+#include "shared_state.h"
 
-//unsigned long int gTime = 0;
+// Control loop state.  Here rather than in rt_process_preempt.cpp so that
+// other mains (r2_control_bench) can link the control code.
+unsigned long int gTime;
+int initialized=0;     // State initialized flag
+
+// Soft estop and kill flags, DS1 update count, console requests: a line each
+struct shared_state r2_shared;
+
+int    deviceType = SURGICAL_ROBOT;//PULLEY_BOARD;
+struct device device0 ={0};  //Declaration Moved outside rt loop for access from console thread
+int    mech_gravcomp_done[2]={0};
+
+int NUM_MECH=0;   // Define NUM_MECH as a C variable, not a c++ variable
+
+struct cycle_sched rt_sched;         // Control loop deadlines and overrun counters
+int cycle_overrun_policy = CYCLE_SKIP;
+int cycle_max_backlog = 3;           // Periods CYCLE_COMPRESS may catch up on
+int cycle_max_consecutive_missed = 10; // Missed deadlines in a row before soft e-stop (0: never)
+
+int usb_wait_mode = USB_WAIT_POLL;   // How to wait for USB read completion (see USB_init.h)
+int usb_wait_timeout_us = 100;       // Deadline for USB read completion after wakeup
+int usb_io_mode = USB_IO_SERIAL;      // Per-cycle USB calls serial or on per-board workers
+int usb_backend = USB_BACKEND_BOARDS; // Boards, simulated boards or a replayed recording
 
 struct DOF_type DOF_types[MAX_MECH*MAX_DOF_PER_MECH];
 //struct traj trajectory[MAX_MECH*MAX_DOF_PER_MECH];
 USBStruct USBBoards;
+
+int   control_rate_hz = DEFAULT_CONTROL_RATE;
+float step_period     = 1.0 / DEFAULT_CONTROL_RATE;
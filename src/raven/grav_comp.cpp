@@ -34,9 +34,19 @@
  *
  */
 
+#include <time.h>
+#include <string.h>
+#include <algorithm>
 #include "grav_comp.h"
 #include "r2_kinematics.h"
+#include "rigid_math.h"
+#include "tool.h"
+#include "rt_memory.h"
+#include "cpu_affinity.h"
+#include "utils.h"
+#include "arm_pipeline.h"
 #include "log.h"
+#include "shared_state.h"
 
 extern int NUM_MECH;
 extern struct DOF_type DOF_types[];
@@ -44,14 +54,14 @@ extern unsigned long int gTime;
 
 // Define COM's (units: meters)
 // Left arm values ???
-const static btVector3 COM1_1_GL( 0.0065,   0.09775,	-0.13771); //meters
-const static btVector3 COM2_2_GL( -0.002,	-0.18274,	-0.23053); //meters
-const static btVector3 COM3_3_GL( 0,		0,			0		);//meters
+const static rm_vec3 COM1_1_GL = { { 0.0065,   0.09775},	{-0.13771, 0 } }; //meters
+const static rm_vec3 COM2_2_GL = { { -0.002,	-0.18274},	{-0.23053, 0 } }; //meters
+const static rm_vec3 COM3_3_GL = { { 0,		0},			{0,		  0 } };//meters
 
 //// Right arm values::
-const static btVector3 COM1_1_GR( -0.0065,	-0.09775,	0.13771 ); //meters
-const static btVector3 COM2_2_GR( -0.002,	-0.18274, 	0.23053 ); //meters
-const static btVector3 COM3_3_GR( 0,		0,			0		); //meters
+const static rm_vec3 COM1_1_GR = { { -0.0065,	-0.09775},	{0.13771, 0 } }; //meters
+const static rm_vec3 COM2_2_GR = { { -0.002,	-0.18274}, 	{0.23053, 0 } }; //meters
+const static rm_vec3 COM3_3_GR = { { 0,		0},			{0,		 0 } }; //meters
 
 // Define masses
 //const static double M1 = 0.2395 * 2.7; // 0.6465 kg --> 1.42 lb		From Ji's code
@@ -64,14 +74,11 @@ const static double M3 = 0.231; // kg --> ? lb
 // masses updated using fresh links from raven 2.1 build 6/13
 
 
-btVector3 getCurrentG(struct device *d0, int m);
-void getMotorTorqueFromJointTorque(int, double, double, double, double&, double&, double&);
-
 /*
  * getCurrentG()
  * \brief Return the current gravity vector from whatever power knows it.
  */
-btVector3 getCurrentG(struct device *d0, int m)
+static rm_vec3 getCurrentG(struct device *d0, int m)
 {
 	struct mechanism *_mech;
 	_mech = &(d0->mech[m]);
@@ -92,20 +99,19 @@ btVector3 getCurrentG(struct device *d0, int m)
 	}
 
 
-	//return as a bt vector
-	return btVector3(xG0, yG0, zG0);
+	return rmVec(xG0, yG0, zG0);
 }
 
 /*
- * getGravityTorque()
- * \brief Calculate and set the gravity torque for each of the first three joints on both arms
+ * gravityJointTorque()
+ * \brief Gravity load on joints 1,2,3 of one arm at the given link frames
  *
- * Using the current gravity vector in the input parameter struct and predefined COM information,
- * this function calculates the desired gravity compensation torque and sets the corresponding value in the
- * device struct.
+ * Pure: touches nothing but its arguments, so it is safe off the RT thread.
  *
- * \param &d0		the robot device
- * \param &params	the current robot parameters struct
+ * \param fk		link frames of the arm; only ^0_1T, ^1_2T and ^2_3T are used
+ * \param type		GOLD_ARM_SERIAL or GREEN_ARM_SERIAL
+ * \param G0		gravity in frame 0 (m/s^2)
+ * \param GZ		joint torque (Nm; N on the insertion axis) on each of the first three joints
  *
  * 	 Calculate Torque: T_i = sum( j=i..3 , (M_j * G_i) x ^iCOM_j )
 		GT1 = (M1*G1) x ^1COM_1 + (M2*G1) x ^1COM_2 + (M3*G1) x ^1COM_3
@@ -120,96 +126,394 @@ btVector3 getCurrentG(struct device *d0, int m)
  *    GTx    - 3-vector of gravitational torque at joint x (z-component represents torque around joint)
  *    Mx     - mass of link x
  */
-void getGravityTorque(struct device &d0, struct param_pass &params)
+static void gravityJointTorque(const fk_frames &fk, int type, const rm_vec3 &G0, double GZ[3])
 {
+	rm_vec3 COM1_1, COM2_2, COM3_3;
+
+	if (type == GOLD_ARM_SERIAL)
+	{
+		COM1_1 =COM1_1_GL;
+		COM2_2 =COM2_2_GL;
+		COM3_3 =COM3_3_GL;
 
+	}
+	else
+	{
+		COM1_1 =COM1_1_GR;
+		COM2_2 =COM2_2_GR;
+		COM3_3 =COM3_3_GR;
+
+	}
 
+	///// Get the transforms: ^0_1T, ^1_2T, ^2_3T
+	const rm_xform T01 = rmFromBt(fk.base[1]);
+	const rm_xform T12 = rmFromBt(fk.link[1]);
+	const rm_xform T23 = rmFromBt(fk.link[2]);
 
-	struct mechanism *_mech;
-	btVector3 G0;
-	static btVector3 G0Static = btVector3(-9.8, 0, 0);
-	btVector3 COM1_1, COM2_2, COM3_3;
+	///// Calculate COM in lower ink frames (closer to base)
+	// Get COM3
+	rm_vec3 COM3_2 = rmApply(T23, COM3_3);
+	rm_vec3 COM3_1 = rmApply(T12, COM3_2);
+
+	// Get COM2
+	rm_vec3 COM2_1 = rmApply(T12, COM2_2);
+
+	///// Get gravity vector in each link frame (inverse rotation = transpose)
+	// Map G into Frame1
+	rm_vec3 G1 = rmMulT(T01.R, G0);
+
+	// Map G into Frame2
+	rm_vec3 G2 = rmMulT(T12.R, G1);
+
+	// Map G into Frame3
+	rm_vec3 G3 = rmMulT(T23.R, G2);
+
+
+	///// Calculate Torque: T_i = sum( j=i..3 , (M_j * G_i) x ^iCOM_j )
+	// T1 = (M1*G1) x ^1COM_1 + (M2*G1) x ^1COM_2 + (M3*G1) x ^1COM_3
+	// T2 = (M2*G2) x ^2COM_2 + (M3*G2) x ^2COM_3
+
+	rm_vec3 GT1  = rmCross(COM1_1, rmSplat(M1)*G1) + rmCross(COM2_1, rmSplat(M2)*G1) + rmCross(COM3_1, rmSplat(M3)*G1);
+
+	rm_vec3 GT2  = rmCross(COM2_2, rmSplat(M2)*G2) + rmCross(COM3_2, rmSplat(M3)*G2);
+
+	rm_vec3 GT3  = rmSplat(M3)*G3;
+
+	// Set joint g-torque from -Z-axis projection:
+	GZ[0] = -GT1[2];
+	GZ[1] = -GT2[2];
+	GZ[2] = -GT3[2];
+}
+
+/*
+ * gravityFrames()
+ * \brief link frames of an arm at a shoulder, elbow and insertion, for the table and the helper thread
+ */
+static void gravityFrames(int type, double sh, double el, double ins, fk_frames &fk)
+{
+	l_r arm = (type == GOLD_ARM_SERIAL) ? dh_left : dh_right;
+	double J[6] = { sh, el, ins, 0, 0, 0 };
+	double thetas[6];
+
+	joint2theta(thetas, J, arm);
+	computeFKFrames(thetas, arm, fk);
+}
+
+/*
+ * The gravity table.  The torques are linear in G0, GZ = C(q) G0, so each
+ * node holds C at one shoulder, elbow and insertion and the gravity vector
+ * can change freely.  C is affine in the insertion (the only link it moves
+ * is the one at ^2_3T's origin), so two insertion planes are exact and the
+ * insertion may run past them; shoulder and elbow are interpolated
+ * bilinearly between nodes GRAV_STEP_DEG apart.  Outside the node range
+ * getGravityTorque() uses the exact model.
+ */
+#define GRAV_STEP_DEG    2          // shoulder / elbow node spacing
+#define GRAV_SH_LO_DEG   -10        // SHOULDER_MIN_LIMIT .. SHOULDER_MAX_LIMIT, 10 deg either side
+#define GRAV_SH_HI_DEG   100
+#define GRAV_EL_LO_DEG   35         // ELBOW_MIN_LIMIT .. ELBOW_MAX_LIMIT, 10 deg either side
+#define GRAV_EL_HI_DEG   145
+#define GRAV_N_SH        ((GRAV_SH_HI_DEG - GRAV_SH_LO_DEG) / GRAV_STEP_DEG + 1)
+#define GRAV_N_EL        ((GRAV_EL_HI_DEG - GRAV_EL_LO_DEG) / GRAV_STEP_DEG + 1)
+
+struct grav_node
+{
+	float c[3][3];                  // GZ[r] = sum c[r][k] G0[k]
+};
+
+// [0] gold, [1] green
+static struct grav_node grav_table[2][GRAV_N_SH][GRAV_N_EL][2];
+static bool grav_table_ready = false;
+
+static int grav_mode = GRAV_EXACT;
+
+/*
+ * initGravityTable()
+ * \brief fill the gravity table of both arms from the exact model
+ * \return 0
+ */
+int initGravityTable()
+{
+	fk_frames fk;
+	double GZ[3];
 
-	/// Do FK for each mechanism
-	for (int m=0; m<NUM_MECH; m++)
+	for (int a = 0; a < 2; a++)
 	{
-		_mech = &(d0.mech[m]);
-		G0 = getCurrentG(&d0, m);
+		int type = a ? GREEN_ARM_SERIAL : GOLD_ARM_SERIAL;
+		for (int i = 0; i < GRAV_N_SH; i++)
+			for (int k = 0; k < GRAV_N_EL; k++)
+				for (int n = 0; n < 2; n++)
+				{
+					gravityFrames(type, (GRAV_SH_LO_DEG + i * GRAV_STEP_DEG) DEG2RAD,
+								  (GRAV_EL_LO_DEG + k * GRAV_STEP_DEG) DEG2RAD,
+								  n ? Z_INS_MAX_LIMIT : Z_INS_MIN_LIMIT, fk);
+					struct grav_node *g = &grav_table[a][i][k][n];
+					for (int c = 0; c < 3; c++)
+					{
+						rm_vec3 G = rmVec(c == 0, c == 1, c == 2);
+						gravityJointTorque(fk, type, G, GZ);
+						for (int r = 0; r < 3; r++)
+							g->c[r][c] = GZ[r];
+					}
+				}
+	}
+	rt_prefault(grav_table, sizeof(grav_table));
+	grav_table_ready = true;
+	log_msg("Gravity table: %d x %d nodes per arm, %d kB", GRAV_N_SH, GRAV_N_EL, (int)(sizeof(grav_table) / 1024));
+	return 0;
+}
 
-		if (_mech->type == GOLD_ARM_SERIAL)
+/*
+ * gravityTableJointTorque()
+ * \brief joint gravity torques of one arm from the table
+ * \return 0, or -1 if the shoulder or elbow is outside the table
+ */
+static int gravityTableJointTorque(struct mechanism *_mech, const rm_vec3 &G0, double GZ[3])
+{
+	const float per_step = 1 / (GRAV_STEP_DEG DEG2RAD), per_ins = 1 / (Z_INS_MAX_LIMIT - Z_INS_MIN_LIMIT);
+	float fs = (_mech->joint[SHOULDER].jpos - (float)(GRAV_SH_LO_DEG DEG2RAD)) * per_step;
+	float fe = (_mech->joint[ELBOW].jpos - (float)(GRAV_EL_LO_DEG DEG2RAD)) * per_step;
+	float fi = (_mech->joint[Z_INS].jpos - Z_INS_MIN_LIMIT) * per_ins;
+
+	if (!(fs >= 0 && fs <= GRAV_N_SH - 1 && fe >= 0 && fe <= GRAV_N_EL - 1))    // also NaN
+		return -1;
+	int is = std::min((int)fs, GRAV_N_SH - 2);
+	int ie = std::min((int)fe, GRAV_N_EL - 2);
+	fs -= is;
+	fe -= ie;
+
+	// the eight corners' weights, then C at the point, then C G0
+	const struct grav_node (*g)[GRAV_N_EL][2] = &grav_table[_mech->type == GOLD_ARM_SERIAL ? 0 : 1][is];
+	const struct grav_node *n[8] = { &g[0][ie][0], &g[0][ie][1], &g[0][ie+1][0], &g[0][ie+1][1],
+									 &g[1][ie][0], &g[1][ie][1], &g[1][ie+1][0], &g[1][ie+1][1] };
+	float w[8];
+	for (int a = 0; a < 2; a++)
+		for (int b = 0; b < 2; b++)
 		{
-			COM1_1 =COM1_1_GL;
-			COM2_2 =COM2_2_GL;
-			COM3_3 =COM3_3_GL;
-
+			float wab = (a ? fs : 1 - fs) * (b ? fe : 1 - fe);
+			w[4*a + 2*b]     = wab * (1 - fi);
+			w[4*a + 2*b + 1] = wab * fi;
 		}
-		else
+	for (int r = 0; r < 3; r++)
+	{
+		float c0 = 0, c1 = 0, c2 = 0;
+		for (int k = 0; k < 8; k++)
 		{
-			COM1_1 =COM1_1_GR;
-			COM2_2 =COM2_2_GR;
-			COM3_3 =COM3_3_GR;
-
+			c0 += w[k] * n[k]->c[r][0];
+			c1 += w[k] * n[k]->c[r][1];
+			c2 += w[k] * n[k]->c[r][2];
 		}
+		GZ[r] = c0 * G0[0] + c1 * G0[1] + c2 * G0[2];
+	}
+	return 0;
+}
 
-		///// Get the transforms: ^0_1T, ^1_2T, ^2_3T
-		btTransform T01, T12, T23;
-		btMatrix3x3 R01, R12, R23;
-		btMatrix3x3 iR01, iR12, iR23;
+/*
+ * The helper thread (GRAV_THREAD).  The RT thread posts its joints every
+ * cycle; gravity_process() takes the latest at gravity_rate_hz, runs the
+ * exact model and posts the result with the last one.  getGravityTorque()
+ * extrapolates from those two (first-order hold, at most one helper period
+ * ahead) and uses the exact model itself once the result is older than
+ * GRAV_STALE_PERIODS helper periods.  Both slots are seqlocks; the RT
+ * thread is the only writer of the joints and never retries a read.
+ */
+#define GRAV_STALE_PERIODS  5
 
-		getATransform (*_mech, T01, 0, 1);
-		getATransform (*_mech, T12, 1, 2);
-		getATransform (*_mech, T23, 2, 3);
+struct grav_joints
+{
+	unsigned long tick;                     // gTime when posted
+	int n;
+	int type[MAX_MECH_PER_DEV];
+	float jpos[MAX_MECH_PER_DEV][3];        // shoulder, elbow, insertion
+	rm_vec3 G0[MAX_MECH_PER_DEV];
+};
+
+struct grav_sample
+{
+	unsigned long tick[2];                  // gTime of the joints used: previous, latest
+	int n;
+	int type[MAX_MECH_PER_DEV];
+	double GZ[2][MAX_MECH_PER_DEV][3];
+};
 
-		R01 = T01.getBasis();
-		R12 = T12.getBasis();
-		R23 = T23.getBasis();
+static struct grav_joints grav_joints_slot;
+static volatile unsigned int grav_joints_seq = 0;      // odd while the RT thread writes
+static struct grav_sample grav_sample_slot;
+static volatile unsigned int grav_sample_seq = 0;      // odd while the helper writes
+static struct grav_sample grav_held;                   // RT thread's copy of the last whole sample
+static unsigned int grav_held_seq = 0;                 // 0: none yet
 
-		///// Calculate COM in lower ink frames (closer to base)
-		// Get COM3
-		btVector3 COM3_2 = T23 * COM3_3;
-		btVector3 COM3_1 = T12 * COM3_2;
-		btVector3 COM3_0 = T01 * COM3_1;
+static int grav_rate_hz = 100;
 
-		// Get COM2
-		btVector3 COM2_1 = T12 * COM2_2;
-		btVector3 COM2_0 = T01 * COM2_1;
+/*
+ * gravityPostJoints()
+ * \brief hand this cycle's joints to the helper thread, and pick up its latest result
+ */
+static void gravityPostJoints(struct device &d0)
+{
+	unsigned int seq = grav_joints_seq;
 
-		// Get COM1
-		btVector3 COM1_0 = T01 * COM1_1;
+	grav_joints_seq = seq + 1;
+	__sync_synchronize();
+	grav_joints_slot.tick = gTime;
+	grav_joints_slot.n = NUM_MECH;
+	for (int m = 0; m < NUM_MECH && m < MAX_MECH_PER_DEV; m++)
+	{
+		grav_joints_slot.type[m] = d0.mech[m].type;
+		grav_joints_slot.jpos[m][0] = d0.mech[m].joint[SHOULDER].jpos;
+		grav_joints_slot.jpos[m][1] = d0.mech[m].joint[ELBOW].jpos;
+		grav_joints_slot.jpos[m][2] = d0.mech[m].joint[Z_INS].jpos;
+		grav_joints_slot.G0[m] = getCurrentG(&d0, m);
+	}
+	__sync_synchronize();
+	grav_joints_seq = seq + 2;
+
+	// One try: a torn copy just keeps last cycle's sample
+	seq = grav_sample_seq;
+	if ((seq & 1) || seq == grav_held_seq)
+		return;
+	__sync_synchronize();
+	struct grav_sample s = grav_sample_slot;
+	__sync_synchronize();
+	if (grav_sample_seq != seq)
+		return;
+	grav_held = s;
+	grav_held_seq = seq;
+}
 
-		///// Get gravity vector in each link frame
-		// Map G into Frame1
-		iR01 = R01.inverse();
-		btVector3 G1 = iR01 * G0;
+/*
+ * gravityHeldJointTorque()
+ * \brief joint gravity torques of mechanism m from the helper thread's samples
+ * \return 0, or -1 if there is no sample recent enough for this arm
+ */
+static int gravityHeldJointTorque(int m, int type, double GZ[3])
+{
+	const struct grav_sample &s = grav_held;
+
+	if (grav_held_seq == 0 || m >= s.n || s.type[m] != type)
+		return -1;
+	long span = (long)(s.tick[1] - s.tick[0]);
+	long age  = (long)(gTime - s.tick[1]);
+	long stale = GRAV_STALE_PERIODS * (long)control_rate_hz / grav_rate_hz;
+	if (age < 0 || age > stale)
+		return -1;
+
+	// the slope is only good while the samples are a helper period or so apart
+	double h = (span > 0 && span <= stale) ? (double)std::min(age, span) / span : 0;
+	for (int r = 0; r < 3; r++)
+		GZ[r] = s.GZ[1][m][r] + h * (s.GZ[1][m][r] - s.GZ[0][m][r]);
+	return 0;
+}
+
+/*
+ * gravity_process()
+ * \brief Helper thread for GRAV_THREAD: the exact model at gravity_rate_hz.
+ */
+void* gravity_process(void*)
+{
+	struct grav_joints j;
+	struct grav_sample out;
+	unsigned int seq, last_seq = 0;
+	struct timespec next;
+	fk_frames fk;
 
-		// Map G into Frame2
-		iR12 = R12.inverse();
-		btVector3 G2 = iR12 * G1;
+	if (grav_mode != GRAV_THREAD)
+		return NULL;
 
-		// Map G into Frame3
-		iR23 = R23.inverse();
-		btVector3 G3 = iR23 * G2;
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	memset(&out, 0, sizeof(out));
+	clock_gettime(CLOCK_MONOTONIC, &next);
 
+	while (ros::ok() && !r2Killed())
+	{
+		next.tv_nsec += NSEC_PER_SEC / grav_rate_hz;
+		tsnorm(&next);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
 
-		///// Calculate Torque: T_i = sum( j=i..3 , (M_j * G_i) x ^iCOM_j )
-		// T1 = (M1*G1) x ^1COM_1 + (M2*G1) x ^1COM_2 + (M3*G1) x ^1COM_3
-		// T2 = (M2*G2) x ^2COM_2 + (M3*G2) x ^2COM_3
+		for (;;)
+		{
+			seq = grav_joints_seq;
+			__sync_synchronize();
+			if (seq & 1)
+				continue;
+			j = grav_joints_slot;
+			__sync_synchronize();
+			if (grav_joints_seq == seq)
+				break;
+		}
+		if (seq == 0 || seq == last_seq)
+			continue;       // nothing new posted
+		last_seq = seq;
+
+		// Keep the last result as the previous sample if it is for the same arms, earlier
+		bool cont = (out.n == j.n && (long)(j.tick - out.tick[1]) > 0);
+		for (int m = 0; cont && m < j.n && m < MAX_MECH_PER_DEV; m++)
+			cont = (out.type[m] == j.type[m]);
+
+		out.n = j.n;
+		out.tick[0] = cont ? out.tick[1] : j.tick;
+		out.tick[1] = j.tick;
+		for (int m = 0; m < j.n && m < MAX_MECH_PER_DEV; m++)
+		{
+			out.type[m] = j.type[m];
+			gravityFrames(j.type[m], j.jpos[m][0], j.jpos[m][1], j.jpos[m][2], fk);
+			for (int r = 0; r < 3 && cont; r++)
+				out.GZ[0][m][r] = out.GZ[1][m][r];
+			gravityJointTorque(fk, j.type[m], j.G0[m], out.GZ[1][m]);
+			for (int r = 0; r < 3 && !cont; r++)
+				out.GZ[0][m][r] = out.GZ[1][m][r];
+		}
 
-		btVector3 GT1  = COM1_1.cross(M1*G1) + COM2_1.cross(M2*G1) + COM3_1.cross(M3*G1);
+		seq = grav_sample_seq;
+		grav_sample_seq = seq + 1;
+		__sync_synchronize();
+		grav_sample_slot = out;
+		__sync_synchronize();
+		grav_sample_seq = seq + 2;
+	}
+	return NULL;
+}
 
-		btVector3 GT2  = COM2_2.cross(M2*G2) + COM3_2.cross(M3*G2);
+/*
+ * getGravityTorque()
+ * \brief Calculate and set the gravity torque for each of the first three joints on both arms
+ *
+ * Using the current gravity vector and predefined COM information, this
+ * function calculates the desired gravity compensation torque and sets the
+ * corresponding value in the device struct.  How depends on the gravity
+ * mode (see init_grav_comp()): the exact model on this cycle's kinematic
+ * context, the gravity table, or the helper thread's samples.  The last two
+ * fall back to the exact model where they have nothing.
+ *
+ * \param &d0		the robot device
+ * \param &params	the current robot parameters struct
+ */
+void getGravityTorque(struct device &d0, struct param_pass &params)
+{
+	struct mechanism *_mech;
+	rm_vec3 G0;
+	double GZ[3];
 
-		btVector3 GT3  = M3*G3;
+	// Inside a per-arm job the slot is posted after the join, gravityPostCycle()
+	if (grav_mode == GRAV_THREAD && !onArmWorker())
+		gravityPostJoints(d0);
 
-		// Set joint g-torque from -Z-axis projection:
-		double GZ1 = btVector3(0,0,-1).dot(GT1);
-		double GZ2 = btVector3(0,0,-1).dot(GT2);
-		double GZ3 = btVector3(0,0,-1).dot(GT3);
+	for (int m=mechFirst(); m<mechEnd(); m++)
+	{
+		_mech = &(d0.mech[m]);
+		G0 = getCurrentG(&d0, m);
 
+		int ret = -1;
+		if (grav_mode == GRAV_TABLE && grav_table_ready)
+			ret = gravityTableJointTorque(_mech, G0, GZ);
+		else if (grav_mode == GRAV_THREAD)
+			ret = gravityHeldJointTorque(m, _mech->type, GZ);
+		if (ret < 0)
+			gravityJointTorque(kinFrames(getKinContext(*_mech)), _mech->type, G0, GZ);
 
 		// Get motor torque from joint torque
 		double MT1, MT2, MT3;
-		getMotorTorqueFromJointTorque(_mech->type, GZ1, GZ2, GZ3, MT1, MT2, MT3);
+		getMotorTorqueFromJointTorque(_mech->type, GZ[0], GZ[1], GZ[2], MT1, MT2, MT3);
 
 		// Set motor g-torque
 		_mech->joint[SHOULDER].tau = MT1; 
@@ -218,10 +522,77 @@ void getGravityTorque(struct device &d0, struct param_pass &params)
 
 	}
 
+	return;
+}
 
+/*
+ * gravityPostCycle()
+ * \brief after a cycle whose getGravityTorque() ran as per-arm jobs: hand the joints to the helper thread
+ *
+ * The jobs read the held sample but leave the shared slots alone, so in
+ * thread mode the helper gets each cycle's joints here instead, and its
+ * result is used from the next cycle on.
+ */
+void gravityPostCycle(struct device &d0)
+{
+	if (grav_mode == GRAV_THREAD)
+		gravityPostJoints(d0);
+}
+
+/*
+ * setGravityMode()
+ * \brief switch getGravityTorque() between GRAV_EXACT and GRAV_TABLE (the table is built if needed)
+ *
+ * GRAV_THREAD is only taken at startup, from init_grav_comp(), which
+ * starts the helper's loop.
+ */
+int setGravityMode(int mode)
+{
+	if (mode != GRAV_EXACT && mode != GRAV_TABLE)
+		return -1;
+	if (mode == GRAV_TABLE && !grav_table_ready)
+		initGravityTable();
+	grav_mode = mode;
+	return 0;
+}
 
+/*
+ * init_grav_comp()
+ * \brief read the gravity compensation parameters
+ *
+ *   /gravity_mode     exact, table (default) or thread
+ *   /gravity_rate_hz  helper thread rate in thread mode (default 100)
+ *
+ * \return 0
+ */
+int init_grav_comp(ros::NodeHandle &n)
+{
+	std::string mode;
+	n.param<std::string>("/gravity_mode", mode, "table");
+	n.param("/gravity_rate_hz", grav_rate_hz, 100);
 
-	return;
+	if (grav_rate_hz <= 0 || grav_rate_hz > control_rate_hz)
+	{
+		err_msg("Invalid gravity_rate_hz %d.  Using 100 Hz.", grav_rate_hz);
+		grav_rate_hz = 100;
+	}
+	if (mode == "exact")
+		grav_mode = GRAV_EXACT;
+	else if (mode == "thread")
+		grav_mode = GRAV_THREAD;
+	else
+	{
+		if (mode != "table")
+			err_msg("Unknown gravity_mode %s.  Using the table.", mode.c_str());
+		mode = "table";
+		setGravityMode(GRAV_TABLE);
+	}
+
+	if (grav_mode == GRAV_THREAD)
+		log_msg("Gravity compensation: exact model on a helper thread at %d Hz", grav_rate_hz);
+	else
+		log_msg("Gravity compensation: %s", mode.c_str());
+	return 0;
 }
 
 /**
@@ -248,3 +619,24 @@ void getMotorTorqueFromJointTorque(int arm, double in_GZ1, double in_GZ2, double
 
 	return;
 }
+
+/**
+ * \brief Joint torque delivered by a motor torque: the inverse of getMotorTorqueFromJointTorque()
+ *
+ * \param	arm 		the type of mechanism
+ * \param 	in_MT1		motor torque 1
+ * \param  	in_MT2 		motor torque 2
+ * \param  	in_MT3 		motor torque 3
+ * \param 	&out_GZ1	joint torque at DOF1
+ * \param 	&out_GZ2	joint torque at DOF2
+ * \param 	&out_GZ3	joint torque at DOF3
+ *
+ */
+void getJointTorqueFromMotorTorque(int arm, double in_MT1, double in_MT2, double in_MT3, double &out_GZ1, double &out_GZ2, double &out_GZ3)
+{
+	out_GZ1 = in_MT1 * GEAR_BOX_GP42_TR;
+	out_GZ2 = in_MT2 * GEAR_BOX_GP42_TR;
+	out_GZ3 = in_MT3 * GEAR_BOX_GP42_TR;
+
+	return;
+}
@@ -26,6 +26,17 @@
 *
 *      Based on concept by UCSC, I implement a procedure for joint position discovery from incremental encoders.
 *
+*      Each joint finds its stop twice: a fast approach (homing_fast_scale
+*      times the speed in homing()) to the first contact, a short back-off,
+*      then the original slow approach, which is the one that sets the
+*      encoder offset.  With homing_parallel the positioning joints start
+*      their search as soon as the tool joints are calibrated, while the
+*      tools are still moving to their home angles, instead of after.
+*
+*      An arm whose calibration was kept since the last run (calibration.h)
+*      skips the search: it only makes the move to its home angles, and
+*      homes from scratch if a joint meets a stop on the way.
+*
 */
 #include <stdlib.h>
 
@@ -37,15 +48,98 @@
 #include "t_to_DAC_val.h"
 #include "homing.h"
 #include "state_estimate.h"
+#include "calibration.h"
+#include "joint_iter.h"
 #include "log.h"
 
 
 int set_joints_known_pos(struct mechanism* _mech, int tool_only);
+static int homing_found_stop(struct DOF *_joint);
+static int homing_met_stop(struct DOF *_joint);
 
 extern int NUM_MECH;
 extern unsigned long int gTime;
 extern struct DOF_type DOF_types[];
-extern unsigned int soft_estopped;
+
+// duration for homing of each joint, the same on every mechanism
+static const float homing_period[MAX_DOF_PER_MECH] = {1, 1, 1, 9999999, 1, 1, 30, 30};
+// degrees for homing of each joint
+static const float homing_magnitude[MAX_DOF_PER_MECH] = {-10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
+
+/// Which approach to the hard stop a joint is on
+enum homing_pass { HOME_FAST, HOME_BACKOFF, HOME_SLOW };
+
+struct homing_joint
+{
+    int pass;               // homing_pass
+    unsigned long start;    // gTime the joint started homing
+};
+static struct homing_joint homing_plan[MAX_MECH*MAX_DOF_PER_MECH];
+static int homing_warm[MAX_MECH];       // arm restored from the calibration store, not yet home
+
+static int homing_parallel = 1;
+static float homing_fast_scale = 2.0;   // speed of the first approach, 1 for the slow one only
+static float homing_backoff_s = 0.5;    // back off what the slow approach covers in this time (s)
+
+/**
+*  init_homing()
+*
+*     /homing_parallel     start the positioning joints once the tools are calibrated, default true
+*     /homing_fast_scale   speed of the first approach to the stop, relative to the second, default 2
+*     /homing_backoff_s    back-off between the two, in seconds of the second approach, default 0.5
+*
+*  \return 0
+*/
+int init_homing(ros::NodeHandle &n)
+{
+    bool parallel;
+    double scale, backoff;
+    n.param("/homing_parallel", parallel, true);
+    n.param("/homing_fast_scale", scale, 2.0);
+    n.param("/homing_backoff_s", backoff, 0.5);
+
+    if (scale < 1 || backoff <= 0)
+    {
+        err_msg("Invalid homing_fast_scale %g / homing_backoff_s %g.  Homing with the slow approach only.", scale, backoff);
+        scale = 1;
+    }
+    homing_parallel = parallel;
+    homing_fast_scale = scale;
+    homing_backoff_s = backoff;
+
+    log_msg("Homing: %s, fast approach x%.1f, back-off %.2f s",
+            parallel ? "tools and positioning joints overlapped" : "tools first", scale, backoff);
+    return 0;
+}
+
+/**
+*  tools_calibrated()
+*
+*   \param mech   which mechanism
+*
+*   \return 1 once every tool joint has its encoder offset (moving home or ready), else 0
+*/
+static int tools_calibrated(struct mechanism *mech)
+{
+    const int tools[4] = {TOOL_ROT, WRIST, GRASP1, GRASP2};
+    for (int k = 0; k < 4; k++)
+    {
+        int state = mech->joint[tools[k]].state;
+        if (state != jstate_homing1 && state != jstate_homing2 && state != jstate_ready)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+*  homing_seconds()
+*
+*  \return time since the joint started homing (s)
+*/
+static float homing_seconds(struct DOF *_joint)
+{
+    return (gTime - homing_plan[_joint->type].start) * STEP_PERIOD;
+}
 
 /**
 *  raven_homing()
@@ -66,18 +160,24 @@ extern unsigned int soft_estopped;
 int raven_homing(struct device *device0, struct param_pass *currParams, int begin_homing)
 {
     static int homing_inited = 0;
-    static unsigned long int delay, delay2;
+    static unsigned long int delay, delay2[MAX_MECH];
     struct DOF *_joint = NULL;
     struct mechanism* _mech = NULL;
     int i=0,j=0;
 
 
 #ifdef RICKS_TOOLS
-    _mech = NULL;  _joint = NULL;
-    while (loop_over_joints(device0, _mech, _joint, i,j) )
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-       if (is_toolDOF(_joint))
-         _joint->state = jstate_ready;
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+           if (is_toolDOF(_joint))
+             _joint->state = jstate_ready;
+        }
     }
 #endif
 
@@ -94,7 +194,7 @@ int raven_homing(struct device *device0, struct param_pass *currParams, int begi
     }
 
     // Wait a short time for amps to turn on
-    if (gTime - delay < 1000)
+    if (gTime - delay < MS_TO_TICKS(1000))
     {
         return 0;
     }
@@ -102,29 +202,57 @@ int raven_homing(struct device *device0, struct param_pass *currParams, int begi
     if (begin_homing || !homing_inited)     // only do this the first time through
     {
         // Zero out joint torques, and control inputs. Set joint.state=not_ready.
-        _mech = NULL;  _joint = NULL;
-        while (loop_over_joints(device0, _mech, _joint, i,j) )  // foreach (joint)
+        for (i = mechFirst(); i < mechEnd(); i++)  // foreach (joint)
         {
-            _joint->tau_d  = 0;
-            _joint->mpos_d = _joint->mpos;
-            _joint->jpos_d = _joint->jpos;
-            _joint->jvel_d = 0;
-            _joint->state  = jstate_not_ready;
+            _mech = &device0->mech[i];
+            for (j = 0; j < MAX_DOF_PER_MECH; j++)
+            {
+                if (!jointActive(j))
+                    continue;
+                _joint = &_mech->joint[j];
+                _joint->tau_d  = 0;
+                _joint->mpos_d = _joint->mpos;
+                _joint->jpos_d = _joint->jpos;
+                _joint->jvel_d = 0;
+                _joint->state  = jstate_not_ready;
+
+                if (is_toolDOF(_joint))
+                    jvel_PI_control(_joint, 1);  // reset PI control integral term
+                homing_inited = 1;
+            }
+        }
 
-            if (is_toolDOF(_joint))
-                jvel_PI_control(_joint, 1);  // reset PI control integral term
-            homing_inited = 1;
+        // Arms with a kept calibration go straight to the move home
+        for (int m = 0; m < NUM_MECH; m++)
+        {
+            homing_warm[m] = 0;
+            if (calibrationRestore(&device0->mech[m], m) < 0)
+                continue;
+            homing_warm[m] = 1;
+            for (int k = 0; k < MAX_DOF_PER_MECH; k++)
+            {
+                device0->mech[m].joint[k].state = jstate_homing1;
+                homing_plan[device0->mech[m].joint[k].type].start = gTime;
+            }
+            log_msg("Arm %d: calibration kept from the last run, moving home", m);
         }
     }
 
     // Specify motion commands
-    _mech = NULL;  _joint = NULL;
-    while ( loop_over_joints(device0, _mech, _joint, i,j) )
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-        // Initialize tools first.
-        if ( is_toolDOF(_joint) || tools_ready( &(device0->mech[i]) ) )
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
         {
-            homing(_joint);
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+            // Initialize tools first.
+            if ( is_toolDOF(_joint) ||
+                 ( homing_parallel ? tools_calibrated( &(device0->mech[i]) ) : tools_ready( &(device0->mech[i]) ) ) )
+            {
+                homing(_joint);
+            }
         }
     }
 
@@ -132,56 +260,79 @@ int raven_homing(struct device *device0, struct param_pass *currParams, int begi
     invCableCoupling(device0, currParams->runlevel);
 
     // Do PD control on all joints
-    _mech = NULL;  _joint = NULL;
-    while ( loop_over_joints(device0, _mech, _joint, i,j) )
-    {
-        mpos_PD_control( _joint );
-    }
+    mpos_PD_control_all(device0);
 
     // Calculate output DAC values
     TorqueToDAC(device0);
 
     // Check homing conditions and set joint angles appropriately.
-    _mech = NULL;  _joint = NULL;
-    while ( loop_over_joints(device0, _mech, _joint, i,j) )
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-        struct DOF * _joint =  &(_mech->joint[j]);
-
-        // Check to see if we've reached the joint limit.
-        if( check_homing_condition(_joint) )
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
         {
-            log_msg("Found limit on joint %d cmd: %d \t", _joint->type, _joint->current_cmd, DOF_types[_joint->type].DAC_max);
-            _joint->state = jstate_hard_stop;
-            _joint->current_cmd = 0;
-            stop_trajectory(_joint);
-            log_msg("joint %d checked ",j);
-        }
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
 
-        // For each mechanism, check to see if the mech is finished homing.
-        if ( j == (MAX_DOF_PER_MECH-1) )
-        {
-            /// if we're homing tools, wait for tools to be finished
-            if ((  !tools_ready(_mech) &&
-                   _mech->joint[TOOL_ROT].state==jstate_hard_stop &&
-                   _mech->joint[WRIST   ].state==jstate_hard_stop &&
-                   _mech->joint[GRASP1  ].state==jstate_hard_stop )
-                    ||
-                (  tools_ready( _mech ) &&
-                   _mech->joint[SHOULDER].state==jstate_hard_stop &&
-                   _mech->joint[ELBOW   ].state==jstate_hard_stop &&
-                   _mech->joint[Z_INS   ].state==jstate_hard_stop ))
-              {
-                if (delay2==0)
-                    delay2=gTime;
-
-                if (gTime > delay2 + 200)   // wait 200 ticks for cables to settle down
+            // A restored arm meeting a stop on its way home: the kept calibration is wrong
+            if ( homing_warm[i] && _joint->state == jstate_homing2 && homing_met_stop(_joint) )
+            {
+                err_msg("Arm %d: joint %d met a stop with the kept calibration.  Homing.", i, _joint->type);
+                calibrationReject(i);
+                homing_warm[i] = 0;
+                for (int k = 0; k < MAX_DOF_PER_MECH; k++)
                 {
-                    set_joints_known_pos(_mech, !tools_ready(_mech) );   // perform second phase
-                    delay2 = 0;
+                    stop_trajectory(&_mech->joint[k]);
+                    _mech->joint[k].state = jstate_not_ready;
                 }
             }
-        }
 
+            // Check to see if we've reached the joint limit.
+            if( check_homing_condition(_joint) && homing_found_stop(_joint) )
+            {
+                log_msg("Found limit on joint %d cmd: %d \t", _joint->type, _joint->current_cmd, DOF_types[_joint->type].DAC_max);
+                log_msg("Joint %d found its limit in %.2f s", _joint->type, homing_seconds(_joint));
+                _joint->state = jstate_hard_stop;
+                _joint->current_cmd = 0;
+                stop_trajectory(_joint);
+                log_msg("joint %d checked ",j);
+            }
+
+            // For each mechanism, check to see if the mech is finished homing.
+            if ( j == (MAX_DOF_PER_MECH-1) )
+            {
+                if ( homing_warm[i] && tools_ready(_mech) &&
+                     _mech->joint[SHOULDER].state==jstate_ready &&
+                     _mech->joint[ELBOW   ].state==jstate_ready &&
+                     _mech->joint[Z_INS   ].state==jstate_ready )
+                {
+                    log_msg("Arm %d: kept calibration verified, ready in %.2f s", i, homing_seconds(&_mech->joint[SHOULDER]));
+                    homing_warm[i] = 0;
+                }
+
+                /// if we're homing tools, wait for tools to be finished
+                if ((  !tools_ready(_mech) &&
+                       _mech->joint[TOOL_ROT].state==jstate_hard_stop &&
+                       _mech->joint[WRIST   ].state==jstate_hard_stop &&
+                       _mech->joint[GRASP1  ].state==jstate_hard_stop )
+                        ||
+                    (  tools_ready( _mech ) &&
+                       _mech->joint[SHOULDER].state==jstate_hard_stop &&
+                       _mech->joint[ELBOW   ].state==jstate_hard_stop &&
+                       _mech->joint[Z_INS   ].state==jstate_hard_stop ))
+                  {
+                    if (delay2[i]==0)
+                        delay2[i]=gTime;
+
+                    if (gTime > delay2[i] + MS_TO_TICKS(200))   // wait 200 ms for cables to settle down
+                    {
+                        set_joints_known_pos(_mech, !tools_ready(_mech) );   // perform second phase
+                        delay2[i] = 0;
+                    }
+                }
+            }
+        }
     }
 
     return 0;
@@ -206,9 +357,11 @@ int set_joints_known_pos(struct mechanism* _mech, int tool_only)
     int j=0;
 
     /// Set joint position reference for just tools, or all DOFS
-    _joint = NULL;
-    while ( loop_over_joints(_mech, _joint ,j) )
+    for (j = 0; j < MAX_DOF_PER_MECH; j++)
     {
+        if (!jointActive(j))
+            continue;
+        _joint = &_mech->joint[j];
     	// when tool joints finish, set positioning joints to neutral
         if ( tool_only  && ! is_toolDOF( _joint->type))
         {
@@ -234,9 +387,11 @@ int set_joints_known_pos(struct mechanism* _mech, int tool_only)
     /// Inverse cable coupling: jpos_d  ---> mpos_d
     invMechCableCoupling(_mech, 1);
 
-    _joint = NULL;
-    while ( loop_over_joints(_mech, _joint ,j) )
+    for (j = 0; j < MAX_DOF_PER_MECH; j++)
     {
+        if (!jointActive(j))
+            continue;
+        _joint = &_mech->joint[j];
         // Reset the state-estimate filter
         _joint->mpos = _joint->mpos_d;
         resetFilter( _joint );
@@ -280,12 +435,9 @@ int set_joints_known_pos(struct mechanism* _mech, int tool_only)
 */
 void homing(struct DOF* _joint)
 {
-    // duration for homing of each joint
-    const float f_period[MAX_MECH*MAX_DOF_PER_MECH] = {1, 1, 1, 9999999, 1, 1, 30, 30,
-                                                        1, 1, 1, 9999999, 1, 1, 30, 30};
-    // degrees for homing of each joint
-    const float f_magnitude[MAX_MECH*MAX_DOF_PER_MECH] = {-10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-                                                          -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
+    struct homing_joint *h = &homing_plan[_joint->type];
+    float f_period = homing_period[JOINT_OF_TYPE(_joint->type)];
+    float f_magnitude = homing_magnitude[JOINT_OF_TYPE(_joint->type)];
 
     switch (_joint->state)
     {
@@ -295,12 +447,31 @@ void homing(struct DOF* _joint)
             // Initialize velocity trajectory
             //log_msg("Starting homing on joint %d", _joint->type);
             _joint->state = jstate_pos_unknown;
-            start_trajectory_mag(_joint, f_magnitude[_joint->type], f_period[_joint->type]);
+            h->start = gTime;
+            if (homing_fast_scale > 1)
+            {
+                // same profile, homing_fast_scale times faster all through
+                h->pass = HOME_FAST;
+                start_trajectory_mag(_joint, homing_fast_scale * f_magnitude, f_period / homing_fast_scale);
+            }
+            else
+            {
+                h->pass = HOME_SLOW;
+                start_trajectory_mag(_joint, f_magnitude, f_period);
+            }
             break;
 
         case jstate_pos_unknown:
             // Set desired joint trajectory
-            update_linear_sinusoid_position_trajectory(_joint);
+            if (h->pass != HOME_BACKOFF)
+                update_linear_sinusoid_position_trajectory(_joint);
+
+            // Backed off from the first contact: approach again, slowly
+            else if ( !update_position_trajectory(_joint) )
+            {
+                h->pass = HOME_SLOW;
+                start_trajectory_mag(_joint, f_magnitude, f_period);
+            }
             break;
 
         case jstate_hard_stop:
@@ -317,7 +488,7 @@ void homing(struct DOF* _joint)
             if ( !update_position_trajectory(_joint) )
             {
                 _joint->state = jstate_ready;
-                log_msg("Joint %d ready", _joint->type);
+                log_msg("Joint %d ready, homed in %.2f s", _joint->type, homing_seconds(_joint));
             }
             break;
 
@@ -364,7 +535,7 @@ const int homing_max_dac[8] = {2500,  //shoulder
  */
 int check_homing_condition(struct DOF *_joint)
 {
-    if ( _joint->state != jstate_pos_unknown)
+    if ( _joint->state != jstate_pos_unknown || homing_plan[_joint->type].pass == HOME_BACKOFF )
         return 0;
 
     // check if the DAC output is greater than the maximum allowable.
@@ -377,6 +548,42 @@ int check_homing_condition(struct DOF *_joint)
    return 0;
 }
 
+/**
+ *   homing_found_stop()
+ *
+ *   \param _joint    A joint that meets check_homing_condition()
+ *
+ *  On the fast approach, stop pushing and start backing off for the slow one.
+ *
+ *  \return 1 if this is the stop the encoder offset is taken at, 0 if the joint backs off
+ */
+static int homing_found_stop(struct DOF *_joint)
+{
+    struct homing_joint *h = &homing_plan[_joint->type];
+
+    // no fast approach, or no joint (limit 0 trips at once)
+    if ( h->pass != HOME_FAST || homing_max_dac[_joint->type%8] == 0 )
+        return 1;
+
+    h->pass = HOME_BACKOFF;
+    _joint->current_cmd = 0;
+    start_trajectory(_joint, _joint->jpos - homing_magnitude[JOINT_OF_TYPE(_joint->type)] * homing_backoff_s, homing_backoff_s);
+    return 0;
+}
+
+/**
+ *   homing_met_stop()
+ *
+ *   \param _joint    A joint struct
+ *
+ *  \return 1 if the joint pushes as hard as check_homing_condition() takes for a stop, whatever its state
+ */
+static int homing_met_stop(struct DOF *_joint)
+{
+    int limit = homing_max_dac[_joint->type%8];
+    return limit > 0 && abs(_joint->current_cmd) >= limit;
+}
+
 
 
 
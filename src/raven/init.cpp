@@ -30,9 +30,14 @@
 #include "init.h"
 #include "USB_init.h"
 #include "local_io.h"
+#include "cable_coupling.h"
+#include "joint_block.h"
+#include "control_config.h"
+#include "joint_iter.h"
 
 // TOOLS defines
 #include "tool.h"
+#include "shared_state.h"
 
 const e_tool_type use_tool = davinci_square_type;
 
@@ -44,7 +49,6 @@ extern struct DOF_type DOF_types[];
 extern char usb_board_count;
 extern USBStruct USBBoards;
 extern int NUM_MECH;
-extern int soft_estopped;
 
 
 /**\fn void initRobotData (struct device *device0, int runlevel, struct param_pass *currParams)
@@ -73,7 +77,7 @@ void initRobotData(struct device *device0, int runlevel, struct param_pass *curr
     if (runlevel == RL_E_STOP)
         initialized = FALSE;
 
-    if (soft_estopped)
+    if (softEstopped())
         device0->mech[0].joint[0].state=jstate_pos_unknown;
 
     //Do nothing if we are not in the init runlevel
@@ -131,72 +135,48 @@ void initDOFs(struct device *device0)
     static int dofs_inited=0;
     if (dofs_inited)
         return;
-    /// Set transmission ratios
-    //    Yes, the numbering is wierd (TOOL_ROT and Z_INS are physically 4th & 3rd respectively
-    //    See defines.h for explaination
-    DOF_types[SHOULDER_GOLD].TR   = SHOULDER_TR_GOLD_ARM;
-    DOF_types[ELBOW_GOLD].TR      = ELBOW_TR_GOLD_ARM;
-    DOF_types[Z_INS_GOLD].TR      = Z_INS_TR_GOLD_ARM;
-    DOF_types[TOOL_ROT_GOLD].TR   = TOOL_ROT_TR_GOLD_ARM;
-    DOF_types[WRIST_GOLD].TR      = WRIST_TR_GOLD_ARM;
-    DOF_types[GRASP1_GOLD].TR     = GRASP1_TR_GOLD_ARM;
-    DOF_types[GRASP2_GOLD].TR     = GRASP2_TR_GOLD_ARM;
-
-    DOF_types[SHOULDER_GREEN].TR  = SHOULDER_TR_GREEN_ARM;
-    DOF_types[ELBOW_GREEN].TR     = ELBOW_TR_GREEN_ARM;
-    DOF_types[Z_INS_GREEN].TR     = Z_INS_TR_GREEN_ARM;
-    DOF_types[TOOL_ROT_GREEN].TR  = TOOL_ROT_TR_GREEN_ARM;
-    DOF_types[WRIST_GREEN].TR     = WRIST_TR_GREEN_ARM;
-    DOF_types[GRASP1_GREEN].TR    = GRASP1_TR_GOLD_ARM;
-    DOF_types[GRASP2_GREEN].TR    = GRASP2_TR_GREEN_ARM;
-
-    /// Initialize current limits
-    DOF_types[SHOULDER_GOLD].DAC_max  = SHOULDER_MAX_DAC;
-    DOF_types[SHOULDER_GREEN].DAC_max = SHOULDER_MAX_DAC;
-    DOF_types[ELBOW_GOLD].DAC_max     = ELBOW_MAX_DAC;
-    DOF_types[ELBOW_GREEN].DAC_max    = ELBOW_MAX_DAC;
-    DOF_types[TOOL_ROT_GOLD].DAC_max  = TOOL_ROT_MAX_DAC;
-    DOF_types[TOOL_ROT_GREEN].DAC_max = TOOL_ROT_MAX_DAC;
-    DOF_types[Z_INS_GOLD].DAC_max     = Z_INS_MAX_DAC;
-    DOF_types[Z_INS_GREEN].DAC_max    = Z_INS_MAX_DAC;
-    DOF_types[WRIST_GOLD].DAC_max     = WRIST_MAX_DAC;
-    DOF_types[WRIST_GREEN].DAC_max    = WRIST_MAX_DAC;
-    DOF_types[GRASP1_GOLD].DAC_max    = GRASP1_MAX_DAC;
-    DOF_types[GRASP1_GREEN].DAC_max   = GRASP1_MAX_DAC;
-    DOF_types[GRASP2_GOLD].DAC_max    = GRASP2_MAX_DAC;
-    DOF_types[GRASP2_GREEN].DAC_max   = GRASP2_MAX_DAC;
-
     /// Initialize values of joint and DOF structures
     for (int i = 0; i < NUM_MECH; i++)
     {
+        // Joint types are unique per mechanism: mechanism i owns DOF_types[i*MAX_DOF_PER_MECH ...]
+        int base = JOINT_TYPE(i, 0);
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+            device0->mech[i].joint[j].type = JOINT_TYPE(i, j);
 
-        /// Initialize joint types
+        /// Set transmission ratios
+        //    Yes, the numbering is wierd (TOOL_ROT and Z_INS are physically 4th & 3rd respectively
+        //    See defines.h for explaination
         if ( device0->mech[i].type == GOLD_ARM)
         {
-            log_msg("    Initing gold arm");
-            //Set DOF type to unique index
-            device0->mech[i].joint[SHOULDER].type = SHOULDER_GOLD;
-            device0->mech[i].joint[ELBOW].type    = ELBOW_GOLD;
-            device0->mech[i].joint[Z_INS].type    = Z_INS_GOLD;
-            device0->mech[i].joint[TOOL_ROT].type = TOOL_ROT_GOLD;
-            device0->mech[i].joint[WRIST].type    = WRIST_GOLD;
-            device0->mech[i].joint[GRASP1].type   = GRASP1_GOLD;
-            device0->mech[i].joint[GRASP2].type   = GRASP2_GOLD;
-            device0->mech[i].joint[NO_CONNECTION].type   = NO_CONNECTION_GOLD;
+            log_msg("    Initing gold arm (mechanism %d)", i);
+            DOF_types[base + SHOULDER].TR   = SHOULDER_TR_GOLD_ARM;
+            DOF_types[base + ELBOW].TR      = ELBOW_TR_GOLD_ARM;
+            DOF_types[base + Z_INS].TR      = Z_INS_TR_GOLD_ARM;
+            DOF_types[base + TOOL_ROT].TR   = TOOL_ROT_TR_GOLD_ARM;
+            DOF_types[base + WRIST].TR      = WRIST_TR_GOLD_ARM;
+            DOF_types[base + GRASP1].TR     = GRASP1_TR_GOLD_ARM;
+            DOF_types[base + GRASP2].TR     = GRASP2_TR_GOLD_ARM;
         }
         else if (device0->mech[i].type == GREEN_ARM)
         {
-            log_msg("    Initing green arm");
-            device0->mech[i].joint[SHOULDER].type = SHOULDER_GREEN;
-            device0->mech[i].joint[ELBOW].type    = ELBOW_GREEN;
-            device0->mech[i].joint[Z_INS].type    = Z_INS_GREEN;
-            device0->mech[i].joint[TOOL_ROT].type = TOOL_ROT_GREEN;
-            device0->mech[i].joint[WRIST].type    = WRIST_GREEN;
-            device0->mech[i].joint[GRASP1].type   = GRASP1_GREEN;
-            device0->mech[i].joint[GRASP2].type   = GRASP2_GREEN;
-            device0->mech[i].joint[NO_CONNECTION].type   = NO_CONNECTION_GREEN;
+            log_msg("    Initing green arm (mechanism %d)", i);
+            DOF_types[base + SHOULDER].TR   = SHOULDER_TR_GREEN_ARM;
+            DOF_types[base + ELBOW].TR      = ELBOW_TR_GREEN_ARM;
+            DOF_types[base + Z_INS].TR      = Z_INS_TR_GREEN_ARM;
+            DOF_types[base + TOOL_ROT].TR   = TOOL_ROT_TR_GREEN_ARM;
+            DOF_types[base + WRIST].TR      = WRIST_TR_GREEN_ARM;
+            DOF_types[base + GRASP1].TR     = GRASP1_TR_GOLD_ARM;
+            DOF_types[base + GRASP2].TR     = GRASP2_TR_GREEN_ARM;
         }
 
+        /// Initialize current limits
+        DOF_types[base + SHOULDER].DAC_max  = SHOULDER_MAX_DAC;
+        DOF_types[base + ELBOW].DAC_max     = ELBOW_MAX_DAC;
+        DOF_types[base + TOOL_ROT].DAC_max  = TOOL_ROT_MAX_DAC;
+        DOF_types[base + Z_INS].DAC_max     = Z_INS_MAX_DAC;
+        DOF_types[base + WRIST].DAC_max     = WRIST_MAX_DAC;
+        DOF_types[base + GRASP1].DAC_max    = GRASP1_MAX_DAC;
+        DOF_types[base + GRASP2].DAC_max    = GRASP2_MAX_DAC;
 
         for (int j = 0; j < MAX_DOF_PER_MECH; j++)
         {
@@ -218,15 +198,7 @@ void initDOFs(struct device *device0)
             _joint->mvel_d = 0;
             _joint->mvel = 0;
 
-            //Initialize the position and velocity history for filter
-            for (int k = 0; k < HISTORY_SIZE; k++)
-            {
-                _dof->old_mpos[k] = 0;
-                _dof->old_mpos_d[k] = 0;
-                _dof->old_mvel[k] = 0;
-                _dof->old_mvel_d[k] = 0;
-            }
-            _dof->filterRdy=0;
+            // The filter history is reset by jointBlockBind() below
 
             //Set inital current command to zero
             _joint->current_cmd = 0;
@@ -272,15 +244,15 @@ void initDOFs(struct device *device0)
         //   Note: enc_offset initialized first above
         if ( device0->mech[i].type == GOLD_ARM)
         {
-            device0->mech[i].joint[SHOULDER].enc_offset += SHOULDER_GOLD_KIN_OFFSET * ENC_CNT_PER_DEG * DOF_types[SHOULDER_GOLD].TR; // Degrees * enc/degree *
-            device0->mech[i].joint[ELBOW].enc_offset    += ELBOW_GOLD_KIN_OFFSET    * ENC_CNT_PER_DEG * DOF_types[ELBOW_GOLD].TR;
-            device0->mech[i].joint[Z_INS].enc_offset    += Z_INS_GOLD_KIN_OFFSET    * DOF_types[Z_INS_GOLD].TR * ENC_CNT_PER_RAD;  // use enc/rad because conversion from meters to revolutions is in radians
+            device0->mech[i].joint[SHOULDER].enc_offset += SHOULDER_GOLD_KIN_OFFSET * ENC_CNT_PER_DEG * DOF_types[base + SHOULDER].TR; // Degrees * enc/degree *
+            device0->mech[i].joint[ELBOW].enc_offset    += ELBOW_GOLD_KIN_OFFSET    * ENC_CNT_PER_DEG * DOF_types[base + ELBOW].TR;
+            device0->mech[i].joint[Z_INS].enc_offset    += Z_INS_GOLD_KIN_OFFSET    * DOF_types[base + Z_INS].TR * ENC_CNT_PER_RAD;  // use enc/rad because conversion from meters to revolutions is in radians
         }
         else if (device0->mech[i].type == GREEN_ARM)
         {
-            device0->mech[i].joint[SHOULDER].enc_offset += SHOULDER_GREEN_KIN_OFFSET * ENC_CNT_PER_DEG * DOF_types[SHOULDER_GREEN].TR;
-            device0->mech[i].joint[ELBOW].enc_offset    += ELBOW_GREEN_KIN_OFFSET    * ENC_CNT_PER_DEG * DOF_types[ELBOW_GREEN].TR;
-            device0->mech[i].joint[Z_INS].enc_offset    += Z_INS_GREEN_KIN_OFFSET    * DOF_types[Z_INS_GREEN].TR * ENC_CNT_PER_RAD;  // use enc/rad because conversion from meters to revolutions is in radians
+            device0->mech[i].joint[SHOULDER].enc_offset += SHOULDER_GREEN_KIN_OFFSET * ENC_CNT_PER_DEG * DOF_types[base + SHOULDER].TR;
+            device0->mech[i].joint[ELBOW].enc_offset    += ELBOW_GREEN_KIN_OFFSET    * ENC_CNT_PER_DEG * DOF_types[base + ELBOW].TR;
+            device0->mech[i].joint[Z_INS].enc_offset    += Z_INS_GREEN_KIN_OFFSET    * DOF_types[base + Z_INS].TR * ENC_CNT_PER_RAD;  // use enc/rad because conversion from meters to revolutions is in radians
         }
 
         /// Initialize some more mechanism stuff
@@ -295,90 +267,90 @@ void initDOFs(struct device *device0)
         // set tool specific values
         // TODO: add home angles????
         device0->mech[i].tool_type = use_tool;
-        int offset = (device0->mech[i].type == GREEN_ARM) ? 8 : 0;
+        selectCouplingKernels(&device0->mech[i]);
 
-        DOF_types[Z_INS    + offset].max_limit    = Z_INS_MAX_LIMIT;
-		DOF_types[Z_INS    + offset].min_limit    = Z_INS_MIN_LIMIT;
+        DOF_types[Z_INS    + base].max_limit    = Z_INS_MAX_LIMIT;
+		DOF_types[Z_INS    + base].min_limit    = Z_INS_MIN_LIMIT;
 
-	    DOF_types[SHOULDER + offset].max_position = SHOULDER_MAX_ANGLE;
-        DOF_types[SHOULDER + offset].max_limit    = SHOULDER_MAX_LIMIT;
-		DOF_types[SHOULDER + offset].min_limit    = SHOULDER_MIN_LIMIT;
-	    DOF_types[SHOULDER + offset].home_position  = SHOULDER_HOME_ANGLE;
+	    DOF_types[SHOULDER + base].max_position = SHOULDER_MAX_ANGLE;
+        DOF_types[SHOULDER + base].max_limit    = SHOULDER_MAX_LIMIT;
+		DOF_types[SHOULDER + base].min_limit    = SHOULDER_MIN_LIMIT;
+	    DOF_types[SHOULDER + base].home_position  = SHOULDER_HOME_ANGLE;
 
-		DOF_types[ELBOW    + offset].max_position = ELBOW_MAX_ANGLE;
-        DOF_types[ELBOW    + offset].max_limit    = ELBOW_MAX_LIMIT;
-		DOF_types[ELBOW    + offset].min_limit    = ELBOW_MIN_LIMIT;
-		DOF_types[ELBOW    + offset].home_position     = ELBOW_HOME_ANGLE;
+		DOF_types[ELBOW    + base].max_position = ELBOW_MAX_ANGLE;
+        DOF_types[ELBOW    + base].max_limit    = ELBOW_MAX_LIMIT;
+		DOF_types[ELBOW    + base].min_limit    = ELBOW_MIN_LIMIT;
+		DOF_types[ELBOW    + base].home_position     = ELBOW_HOME_ANGLE;
 
-        DOF_types[Z_INS    + offset].max_limit    = Z_INS_MAX_LIMIT;
-		DOF_types[Z_INS    + offset].min_limit    = Z_INS_MIN_LIMIT;
-		DOF_types[Z_INS    + offset].home_position = Z_INS_HOME_ANGLE;
+        DOF_types[Z_INS    + base].max_limit    = Z_INS_MAX_LIMIT;
+		DOF_types[Z_INS    + base].min_limit    = Z_INS_MIN_LIMIT;
+		DOF_types[Z_INS    + base].home_position = Z_INS_HOME_ANGLE;
 
-        DOF_types[TOOL_ROT + offset].max_limit    = TOOL_ROT_MAX_LIMIT;
-		DOF_types[TOOL_ROT + offset].min_limit    = TOOL_ROT_MIN_LIMIT;
-		DOF_types[TOOL_ROT + offset].home_position  = TOOL_ROT_HOME_ANGLE;
+        DOF_types[TOOL_ROT + base].max_limit    = TOOL_ROT_MAX_LIMIT;
+		DOF_types[TOOL_ROT + base].min_limit    = TOOL_ROT_MIN_LIMIT;
+		DOF_types[TOOL_ROT + base].home_position  = TOOL_ROT_HOME_ANGLE;
 
-        DOF_types[WRIST    + offset].max_limit     = WRIST_MAX_LIMIT;
-		DOF_types[WRIST    + offset].min_limit     = WRIST_MIN_LIMIT;
-	    DOF_types[WRIST    + offset].home_position = WRIST_HOME_ANGLE;
+        DOF_types[WRIST    + base].max_limit     = WRIST_MAX_LIMIT;
+		DOF_types[WRIST    + base].min_limit     = WRIST_MIN_LIMIT;
+	    DOF_types[WRIST    + base].home_position = WRIST_HOME_ANGLE;
 
-        DOF_types[GRASP1   + offset].max_limit     = GRASP1_MAX_LIMIT;
-		DOF_types[GRASP1   + offset].min_limit     = GRASP1_MIN_LIMIT;
-	    DOF_types[GRASP1   + offset].home_position = GRASP1_HOME_ANGLE;
+        DOF_types[GRASP1   + base].max_limit     = GRASP1_MAX_LIMIT;
+		DOF_types[GRASP1   + base].min_limit     = GRASP1_MIN_LIMIT;
+	    DOF_types[GRASP1   + base].home_position = GRASP1_HOME_ANGLE;
 
-        DOF_types[GRASP2   + offset].max_limit     = GRASP2_MAX_LIMIT;
-		DOF_types[GRASP2   + offset].min_limit     = GRASP2_MIN_LIMIT;
-	    DOF_types[GRASP2   + offset].home_position = GRASP2_HOME_ANGLE;
+        DOF_types[GRASP2   + base].max_limit     = GRASP2_MAX_LIMIT;
+		DOF_types[GRASP2   + base].min_limit     = GRASP2_MIN_LIMIT;
+	    DOF_types[GRASP2   + base].home_position = GRASP2_HOME_ANGLE;
 
 		switch (use_tool){
         case davinci_square_type:
     	{
-    		DOF_types[Z_INS    + offset].max_limit       = Z_INS_MAX_LIMIT_DAVINCI_SQUARE;
-    		DOF_types[Z_INS    + offset].min_limit       = Z_INS_MIN_LIMIT_DAVINCI_SQUARE;
-    		DOF_types[Z_INS    + offset].max_position    = Z_INS_MAX_ANGLE_DAVINCI_SQUARE;
-    	    DOF_types[TOOL_ROT + offset].max_position    = TOOL_ROT_MAX_ANGLE_DAVINCI_SQUARE;
-    	    DOF_types[WRIST    + offset].max_position    = WRIST_MAX_ANGLE_DAVINCI_SQUARE;
-    	    DOF_types[GRASP1   + offset].max_position    = GRASP1_MAX_ANGLE_DAVINCI_SQUARE;
-    	    DOF_types[GRASP2   + offset].max_position    = GRASP2_MAX_ANGLE_DAVINCI_SQUARE;
+    		DOF_types[Z_INS    + base].max_limit       = Z_INS_MAX_LIMIT_DAVINCI_SQUARE;
+    		DOF_types[Z_INS    + base].min_limit       = Z_INS_MIN_LIMIT_DAVINCI_SQUARE;
+    		DOF_types[Z_INS    + base].max_position    = Z_INS_MAX_ANGLE_DAVINCI_SQUARE;
+    	    DOF_types[TOOL_ROT + base].max_position    = TOOL_ROT_MAX_ANGLE_DAVINCI_SQUARE;
+    	    DOF_types[WRIST    + base].max_position    = WRIST_MAX_ANGLE_DAVINCI_SQUARE;
+    	    DOF_types[GRASP1   + base].max_position    = GRASP1_MAX_ANGLE_DAVINCI_SQUARE;
+    	    DOF_types[GRASP2   + base].max_position    = GRASP2_MAX_ANGLE_DAVINCI_SQUARE;
     	    break;
     	}
 
         case TOOL_GRASPER_10MM:
     	{
-    	    DOF_types[Z_INS    + offset].max_position    = Z_INS_MAX_ANGLE;
-    	    DOF_types[TOOL_ROT + offset].max_position    = TOOL_ROT_MAX_ANGLE;
-    	    DOF_types[WRIST    + offset].max_position    = WRIST_MAX_ANGLE;
-    	    DOF_types[GRASP1   + offset].max_position    = GRASP1_MAX_ANGLE;
-    	    DOF_types[GRASP2   + offset].max_position    = GRASP2_MAX_ANGLE;
+    	    DOF_types[Z_INS    + base].max_position    = Z_INS_MAX_ANGLE;
+    	    DOF_types[TOOL_ROT + base].max_position    = TOOL_ROT_MAX_ANGLE;
+    	    DOF_types[WRIST    + base].max_position    = WRIST_MAX_ANGLE;
+    	    DOF_types[GRASP1   + base].max_position    = GRASP1_MAX_ANGLE;
+    	    DOF_types[GRASP2   + base].max_position    = GRASP2_MAX_ANGLE;
     	    break;
     	}
 
         case RII_square_type:
     	{
-    	    DOF_types[Z_INS    + offset].max_position    = Z_INS_MAX_ANGLE_RII_SQUARE;
-    	    DOF_types[TOOL_ROT + offset].max_position    = TOOL_ROT_MAX_ANGLE_RII_SQUARE;
-    	    DOF_types[WRIST    + offset].max_position    = WRIST_MAX_ANGLE_RII_SQUARE;
-    	    DOF_types[GRASP1   + offset].max_position    = GRASP1_MAX_ANGLE_RII_SQUARE;
-    	    DOF_types[GRASP2   + offset].max_position    = GRASP2_MAX_ANGLE_RII_SQUARE;
+    	    DOF_types[Z_INS    + base].max_position    = Z_INS_MAX_ANGLE_RII_SQUARE;
+    	    DOF_types[TOOL_ROT + base].max_position    = TOOL_ROT_MAX_ANGLE_RII_SQUARE;
+    	    DOF_types[WRIST    + base].max_position    = WRIST_MAX_ANGLE_RII_SQUARE;
+    	    DOF_types[GRASP1   + base].max_position    = GRASP1_MAX_ANGLE_RII_SQUARE;
+    	    DOF_types[GRASP2   + base].max_position    = GRASP2_MAX_ANGLE_RII_SQUARE;
     	    break;
     	}
 
         case ricks_tools_type:
         {
-            DOF_types[Z_INS    + offset].max_position    = Z_INS_MAX_ANGLE_GOLD_RICK;
-            DOF_types[TOOL_ROT + offset].max_position    = TOOL_ROT_MAX_ANGLE;
-            DOF_types[WRIST    + offset].max_position    = WRIST_MAX_ANGLE_RICK;
-            DOF_types[GRASP1   + offset].max_position    = GRASP1_MAX_ANGLE_RICK;
-            DOF_types[GRASP2   + offset].max_position    = GRASP2_MAX_ANGLE_RICK;
+            DOF_types[Z_INS    + base].max_position    = Z_INS_MAX_ANGLE_GOLD_RICK;
+            DOF_types[TOOL_ROT + base].max_position    = TOOL_ROT_MAX_ANGLE;
+            DOF_types[WRIST    + base].max_position    = WRIST_MAX_ANGLE_RICK;
+            DOF_types[GRASP1   + base].max_position    = GRASP1_MAX_ANGLE_RICK;
+            DOF_types[GRASP2   + base].max_position    = GRASP2_MAX_ANGLE_RICK;
             break;
         }
         default:
         {
-            DOF_types[Z_INS    + offset].max_position    = Z_INS_MAX_ANGLE;
-            DOF_types[TOOL_ROT + offset].max_position    = TOOL_ROT_MAX_ANGLE;
-            DOF_types[WRIST    + offset].max_position    = WRIST_MAX_ANGLE;
-            DOF_types[GRASP1   + offset].max_position    = GRASP1_MAX_ANGLE;
-            DOF_types[GRASP2   + offset].max_position    = GRASP2_MAX_ANGLE;
+            DOF_types[Z_INS    + base].max_position    = Z_INS_MAX_ANGLE;
+            DOF_types[TOOL_ROT + base].max_position    = TOOL_ROT_MAX_ANGLE;
+            DOF_types[WRIST    + base].max_position    = WRIST_MAX_ANGLE;
+            DOF_types[GRASP1   + base].max_position    = GRASP1_MAX_ANGLE;
+            DOF_types[GRASP2   + base].max_position    = GRASP2_MAX_ANGLE;
             break;
         }
         } // switch
@@ -386,6 +358,12 @@ void initDOFs(struct device *device0)
 
     }
 
+    // Reloaded gains and limits replace the ones set above
+    configApplyNow();
+
+    // Control-path copy of the joints, now that types and constants are set
+    jointBlockBind(device0);
+
     dofs_inited=1;
 }
 
@@ -468,31 +446,24 @@ int init_ravengains(ros::NodeHandle n, struct device *device0)
                 }
             }
         }
-        if (!initgold){
-            ROS_ERROR("Failed to set gains for gold arm (ser:%d not %d).  Set to zero", device0->mech[0].type, GOLD_ARM);
-        }
-        if (!initgreen){
-            ROS_ERROR("Failed to set gains for green arm (ser:%d not %d).  Set to zero", device0->mech[1].type, GREEN_ARM);
+        if (!initgold && !initgreen){
+            ROS_ERROR("Failed to set gains: no gold (%d) or green (%d) arm.  Set to zero", GOLD_ARM, GREEN_ARM);
         }
         log_msg("  PD gains set to");
-        log_msg("    green: %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf",
-            DOF_types[0].KP, DOF_types[0].KD, DOF_types[0].KI,
-            DOF_types[1].KP, DOF_types[1].KD, DOF_types[1].KI,
-            DOF_types[2].KP, DOF_types[2].KD, DOF_types[2].KI,
-            DOF_types[3].KP, DOF_types[3].KD, DOF_types[3].KI,
-            DOF_types[4].KP, DOF_types[4].KD, DOF_types[4].KI,
-            DOF_types[5].KP, DOF_types[5].KD, DOF_types[5].KI,
-            DOF_types[6].KP, DOF_types[6].KD, DOF_types[6].KI,
-            DOF_types[7].KP, DOF_types[7].KD, DOF_types[7].KI);
-        log_msg("    gold: %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf",
-            DOF_types[8].KP, DOF_types[8].KD, DOF_types[8].KI,
-            DOF_types[9].KP, DOF_types[9].KD, DOF_types[9].KI,
-            DOF_types[10].KP, DOF_types[10].KD, DOF_types[10].KI,
-            DOF_types[11].KP, DOF_types[11].KD, DOF_types[11].KI,
-            DOF_types[12].KP, DOF_types[12].KD, DOF_types[12].KI,
-            DOF_types[13].KP, DOF_types[13].KD, DOF_types[13].KI,
-            DOF_types[14].KP, DOF_types[14].KD, DOF_types[14].KI,
-            DOF_types[15].KP, DOF_types[15].KD, DOF_types[15].KI);
+        for (int i = 0; i < NUM_MECH; i++)
+        {
+            const struct DOF_type *g = &DOF_types[JOINT_TYPE(i, 0)];
+            log_msg("    %d %s: %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf",
+                i, device0->mech[i].type == GOLD_ARM ? "gold" : "green",
+                g[0].KP, g[0].KD, g[0].KI,
+                g[1].KP, g[1].KD, g[1].KI,
+                g[2].KP, g[2].KD, g[2].KI,
+                g[3].KP, g[3].KD, g[3].KI,
+                g[4].KP, g[4].KD, g[4].KI,
+                g[5].KP, g[5].KD, g[5].KI,
+                g[6].KP, g[6].KD, g[6].KI,
+                g[7].KP, g[7].KD, g[7].KI);
+        }
     }
     return 0;
 }
@@ -570,10 +541,17 @@ void setStartXYZ(struct device *device0)
         // wait for motor amplifiers to turn on
         if (d.toSec() < amps_on_wait)
         {
-            _mech=NULL;
-            _joint=NULL;
-            while(loop_over_joints(device0, _mech, _joint, i, j))
-                _joint->current_cmd = 0;
+            for (i = mechFirst(); i < mechEnd(); i++)
+            {
+                _mech = &device0->mech[i];
+                for (j = 0; j < MAX_DOF_PER_MECH; j++)
+                {
+                    if (!jointActive(j))
+                        continue;
+                    _joint = &_mech->joint[j];
+                    _joint->current_cmd = 0;
+                }
+            }
         }
 
         // apply displacement current for short time
@@ -583,27 +561,39 @@ void setStartXYZ(struct device *device0)
             // apply first one direction, then the other.
             int sign = d.toSec() < ((bump_encoder_wait - amps_on_wait)/2) ? 1:-1;
 
-            _mech=NULL;
-            _joint=NULL;
-            while(loop_over_joints(device0, _mech, _joint, i, j))
+            for (i = mechFirst(); i < mechEnd(); i++)
             {
-                if (is_toolDOF(_joint->type))
-                    _joint->current_cmd = sign * TOOL_ROT_MAX_DAC;
-                else
-                    _joint->current_cmd = sign * -1499;
+                _mech = &device0->mech[i];
+                for (j = 0; j < MAX_DOF_PER_MECH; j++)
+                {
+                    if (!jointActive(j))
+                        continue;
+                    _joint = &_mech->joint[j];
+                    if (is_toolDOF(_joint->type))
+                        _joint->current_cmd = sign * TOOL_ROT_MAX_DAC;
+                    else
+                        _joint->current_cmd = sign * -1499;
+                }
             }
         }
         // finished bumping encoders.  Continue initialization
         else
         {
             log_msg("    Encoders bumped.");
-            _mech=NULL;
-            _joint=NULL;
-            while(loop_over_joints(device0, _mech, _joint, i, j))
-                _joint->current_cmd = 0;
+            for (i = mechFirst(); i < mechEnd(); i++)
+            {
+                _mech = &device0->mech[i];
+                for (j = 0; j < MAX_DOF_PER_MECH; j++)
+                {
+                    if (!jointActive(j))
+                        continue;
+                    _joint = &_mech->joint[j];
+                    _joint->current_cmd = 0;
+                }
+            }
 
-            usb_reset_encoders(GOLD_ARM_SERIAL);
-            usb_reset_encoders(GREEN_ARM_SERIAL);
+            for (uint b = 0; b < USBBoards.boards.size(); b++)
+                usb_reset_encoders(USBBoards.boards[b]);
             init_wait_loop=0;
             currParams->sublevel = 1;
             startflag=0;
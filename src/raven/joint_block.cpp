@@ -0,0 +1,83 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file joint_block.cpp
+ * \brief The control path's structure-of-arrays joint state, see joint_block.h
+ */
+
+#include <string.h>
+#include <math.h>
+#include "joint_block.h"
+#include "log.h"
+
+extern struct DOF_type DOF_types[];
+extern int NUM_MECH;
+
+struct joint_block jblock;
+
+/**\fn void jointBlockLoadConstants()
+ * \brief copy the gains and motor constants of every joint type out of DOF_types[]
+ */
+void jointBlockLoadConstants()
+{
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		struct DOF_type *_dof = &DOF_types[t];
+
+		jblock.kp.s[t] = _dof->KP;
+		jblock.kd.s[t] = _dof->KD;
+		jblock.ki.s[t] = _dof->KI;
+		jblock.tf_motor.s[t] = (_dof->tau_per_amp != 0) ? 1 / _dof->tau_per_amp : 0;
+		jblock.tf_amp.s[t]   = _dof->DAC_per_amp;
+		jblock.dac_max[t]    = _dof->DAC_max;
+
+		float dac_per_tau = fabs(jblock.tf_motor.s[t] * jblock.tf_amp.s[t]);
+		jblock.tau_max.s[t] = (_dof->DAC_max > 0 && dac_per_tau > 0) ? _dof->DAC_max / dac_per_tau : 0;
+	}
+}
+
+/**\fn void jointBlockBind(struct robot_device *device0)
+ * \brief point each lane at its joint in device0, clear the lanes' state and load the constants
+ *
+ * Call once the joint types and DOF_types[] are set up, i.e. from initDOFs().
+ *
+ * \param device0 pointer to robot_device struct
+ */
+void jointBlockBind(struct robot_device *device0)
+{
+	memset(&jblock, 0, sizeof(jblock));
+
+	int n = 0;
+	for (int i = 0; i < NUM_MECH; i++)
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			struct DOF *_joint = &device0->mech[i].joint[j];
+			if (_joint->type >= JB_N_JOINTS || jblock.dof[_joint->type])
+			{
+				err_msg("Joint block: mech %d joint %d has type %d, left unbound", i, j, _joint->type);
+				continue;
+			}
+			jblock.dof[_joint->type] = _joint;
+			n++;
+		}
+
+	jointBlockLoadConstants();
+	log_msg("Joint block: %d joints bound, %d lanes per vector", n, JB_VEC_WIDTH);
+}
@@ -0,0 +1,395 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file kin_service.cpp
+ * \brief Batch IK / FK service and its solver pool, see kin_service.h
+ *
+ * A batch is cut into chunks of KIN_CHUNK items that the calling thread
+ * and the pool workers take from a shared counter until none are left, so
+ * a slow chunk (poses near the RCM) does not hold up the others.  One
+ * batch runs at a time.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+#include <vector>
+#include <raven_2/raven_kin_batch.h>
+
+#include "kin_service.h"
+#include "local_io.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "log.h"
+
+extern int NUM_MECH;
+
+#define KIN_MAX_THREADS 16
+#define KIN_CHUNK       64       // items taken from the batch at a time
+
+const static double d2r = M_PI/180;
+
+// The batch being solved.  Written by the caller before the workers are released.
+struct kin_batch
+{
+	int fk;
+	l_r arm;
+	const btTransform *poses;
+	const double *in_joints;     // FK: the joints.  IK: seeds
+	int seed_stride;             // IK: doubles between one pose's seed and the next (0: one seed for all)
+	double *out_joints;
+	btTransform *out_poses;
+	signed char *out_status;
+	int count;
+	volatile int next;           // first item nobody has taken yet
+};
+
+static struct kin_batch batch;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t kin_workers[KIN_MAX_THREADS];
+static int num_kin_workers = 0;
+static sem_t kin_go;             // one post per worker per batch
+static sem_t kin_done;           // one post per worker when it runs out of items
+static volatile int kin_quit = 0;
+static ros::ServiceServer kin_srv;
+
+// rotate to match "tilted" base, as r2_inv_kin()
+static const btTransform kin_zrot_inv[2] = {
+	btTransform( btMatrix3x3 (cos(25*d2r), -sin(25*d2r), 0,  sin(25*d2r), cos(25*d2r), 0,  0,0,1), btVector3 (0,0,0) ).inverse(),
+	btTransform( btMatrix3x3 (cos(-25*d2r),-sin(-25*d2r),0,  sin(-25*d2r),cos(-25*d2r),0,  0,0,1), btVector3 (0,0,0) ).inverse()
+};
+
+/**\fn static signed char kinSolveIK(l_r arm, const btTransform &pose, const double *seed, double out_J[6], btTransform &out_xf)
+ * \brief one pose through the path r2_inv_kin() takes: IK, nearest solution to the seed, joint limits, FK of the result
+ * \param arm - arm type
+ * \param pose - target in the base frame, metres
+ * \param seed - joints the solution should be near, as out_J
+ * \param out_J - shoulder, elbow, insertion, roll, wrist, grasp half-difference
+ * \param out_xf - tool frame the limited joints reach
+ * \return KIN_OK, KIN_LIMITED or KIN_NO_SOLUTION
+ */
+static signed char kinSolveIK(l_r arm, const btTransform &pose, const double *seed, double out_J[6], btTransform &out_xf)
+{
+	ik_solution iksol[8];
+	double seed_J[6], seed_th[6], Js[6], th[6];
+	int idx;
+	double err;
+
+	for (int i=0; i<6; i++)
+		seed_J[i] = seed[i];
+	joint2theta(seed_th, seed_J, arm);
+
+	if (inv_kin(kin_zrot_inv[arm] * pose, arm, iksol) < 0 ||
+		check_solutions(seed_th, iksol, idx, err) < 0)
+	{
+		for (int i=0; i<6; i++)
+			out_J[i] = 0;
+		out_xf.setIdentity();
+		return KIN_NO_SOLUTION;
+	}
+
+	theta2joint(iksol[idx], Js);
+	int limited = apply_joint_limits(Js, out_J);
+	joint2theta(th, out_J, arm);
+	fwd_kin(th, arm, out_xf);
+	return limited ? KIN_LIMITED : KIN_OK;
+}
+
+/**\fn static void kinRunBatch(void)
+ * \brief solve chunks of the current batch until there are none left
+ */
+static void kinRunBatch(void)
+{
+	int first;
+	double th[6], J[6];
+
+	while ((first = __sync_fetch_and_add(&batch.next, KIN_CHUNK)) < batch.count)
+	{
+		int last = first + KIN_CHUNK < batch.count ? first + KIN_CHUNK : batch.count;
+		for (int k = first; k < last; k++)
+		{
+			if (batch.fk)
+			{
+				for (int i=0; i<6; i++)
+					J[i] = batch.in_joints[6*k + i];
+				joint2theta(th, J, batch.arm);
+				fwd_kin(th, batch.arm, batch.out_poses[k]);
+			}
+			else
+				batch.out_status[k] = kinSolveIK(batch.arm, batch.poses[k], batch.in_joints + k * batch.seed_stride,
+												 batch.out_joints + 6*k, batch.out_poses[k]);
+		}
+	}
+}
+
+/**\fn static void *kin_worker_process(void *)
+ * \brief pool worker: a share of each batch
+ */
+static void *kin_worker_process(void *)
+{
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	ik_quiet = 1;
+
+	while (1)
+	{
+		while (sem_wait(&kin_go) != 0 && errno == EINTR)
+			;
+		if (kin_quit)
+			break;
+		kinRunBatch();
+		sem_post(&kin_done);
+	}
+	return 0;
+}
+
+/**\fn static int kinBatchRun(void)
+ * \brief solve the batch set up in batch, on this thread and the pool
+ * \return the batch size
+ */
+static int kinBatchRun(void)
+{
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	batch.next = 0;
+	__sync_synchronize();
+	for (int i = 0; i < num_kin_workers; i++)
+		sem_post(&kin_go);
+
+	int quiet = ik_quiet;
+	ik_quiet = 1;
+	kinRunBatch();
+	ik_quiet = quiet;
+
+	for (int i = 0; i < num_kin_workers; i++)
+		while (sem_wait(&kin_done) != 0 && errno == EINTR)
+			;
+	__sync_synchronize();
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	metricAdd(MC_KIN_BATCH_ITEMS, batch.count);
+	metricObserve(MH_KIN_BATCH_US, (t1.tv_sec - t0.tv_sec) * 1000000LL + (t1.tv_nsec - t0.tv_nsec) / 1000);
+	return batch.count;
+}
+
+/**\fn int kinBatchIK(l_r arm, const btTransform *poses, int count, const double *seeds, int seed_stride, double *out_joints, btTransform *out_poses, signed char *out_status)
+ * \brief inverse kinematics for many poses of one arm, across the solver pool
+ * \param arm - arm type
+ * \param poses - targets in the base frame, metres
+ * \param count - number of poses
+ * \param seeds - joints (6 each) the solutions should be near
+ * \param seed_stride - doubles from one pose's seed to the next: 6, or 0 for one seed for all
+ * \param out_joints - 6 joints per pose, see kinSolveIK()
+ * \param out_poses - tool frame each solution reaches, one per pose
+ * \param out_status - KIN_OK, KIN_LIMITED or KIN_NO_SOLUTION per pose
+ * \return count
+ */
+int kinBatchIK(l_r arm, const btTransform *poses, int count, const double *seeds, int seed_stride,
+			   double *out_joints, btTransform *out_poses, signed char *out_status)
+{
+	pthread_mutex_lock(&batch_lock);
+	batch.fk = 0;
+	batch.arm = arm;
+	batch.poses = poses;
+	batch.in_joints = seeds;
+	batch.seed_stride = seed_stride;
+	batch.out_joints = out_joints;
+	batch.out_poses = out_poses;
+	batch.out_status = out_status;
+	batch.count = count;
+	int ret = kinBatchRun();
+	pthread_mutex_unlock(&batch_lock);
+	return ret;
+}
+
+/**\fn int kinBatchFK(l_r arm, const double *joints, int count, btTransform *out_poses)
+ * \brief forward kinematics for many joint vectors of one arm, across the solver pool
+ * \param arm - arm type
+ * \param joints - 6 per vector, as kinBatchIK()'s output
+ * \param count - number of vectors
+ * \param out_poses - tool frame in the base frame, metres, one per vector
+ * \return count
+ */
+int kinBatchFK(l_r arm, const double *joints, int count, btTransform *out_poses)
+{
+	pthread_mutex_lock(&batch_lock);
+	batch.fk = 1;
+	batch.arm = arm;
+	batch.in_joints = joints;
+	batch.out_poses = out_poses;
+	batch.count = count;
+	int ret = kinBatchRun();
+	pthread_mutex_unlock(&batch_lock);
+	return ret;
+}
+
+/**\fn static bool kinBatchCallback(raven_2::raven_kin_batch::Request &req, raven_2::raven_kin_batch::Response &res)
+ * \brief raven_kin_batch service
+ */
+static bool kinBatchCallback(raven_2::raven_kin_batch::Request &req, raven_2::raven_kin_batch::Response &res)
+{
+	struct robot_state_view view;
+	const double um = 1000.0 * 1000.0;
+
+	if (req.arm < 0 || req.arm >= NUM_MECH)
+	{
+		res.error = "no such arm";
+		return true;
+	}
+	if (!latestRobotState(&view))
+	{
+		res.error = "no robot state published yet";
+		return true;
+	}
+	struct mechanism &mech = view.dev.mech[req.arm];
+	l_r arm = (mech.type == GOLD_ARM_SERIAL) ? dh_left : dh_right;
+
+	if (req.mode == raven_2::raven_kin_batch::Request::FK)
+	{
+		if (req.joints.size() % 6 != 0)
+		{
+			res.error = "joints is not a whole number of 6-vectors";
+			return true;
+		}
+		int count = req.joints.size() / 6;
+		std::vector<btTransform> xf(count);
+		if (count > 0)
+			kinBatchFK(arm, &req.joints[0], count, &xf[0]);
+
+		res.status.assign(count, KIN_OK);
+		res.poses.resize(count);
+		for (int k = 0; k < count; k++)
+		{
+			tf::transformTFToMsg(xf[k], res.poses[k]);
+			res.poses[k].translation.x *= um;
+			res.poses[k].translation.y *= um;
+			res.poses[k].translation.z *= um;
+		}
+		return true;
+	}
+
+	int count = req.poses.size();
+	const double *seeds;
+	int stride;
+	double current[6] = {
+		mech.joint[SHOULDER].jpos,
+		mech.joint[ELBOW].jpos,
+		mech.joint[Z_INS].jpos,
+		mech.joint[TOOL_ROT].jpos,
+		mech.joint[WRIST].jpos,
+		(mech.joint[GRASP2].jpos - mech.joint[GRASP1].jpos) / 2.0
+	};
+	if (req.joints.empty())
+	{
+		seeds = current;
+		stride = 0;
+	}
+	else if (req.joints.size() == 6)
+	{
+		seeds = &req.joints[0];
+		stride = 0;
+	}
+	else if ((int)req.joints.size() == 6 * count)
+	{
+		seeds = &req.joints[0];
+		stride = 6;
+	}
+	else
+	{
+		res.error = "joints must hold no seed, one, or one per pose";
+		return true;
+	}
+
+	std::vector<btTransform> in(count), out(count);
+	std::vector<signed char> status(count);
+	res.joints.resize(6 * count);
+	for (int k = 0; k < count; k++)
+	{
+		tf::transformMsgToTF(req.poses[k], in[k]);
+		in[k].setOrigin(in[k].getOrigin() / um);
+	}
+	if (count > 0)
+		kinBatchIK(arm, &in[0], count, seeds, stride, &res.joints[0], &out[0], &status[0]);
+
+	res.status.assign(status.begin(), status.end());
+	res.poses.resize(count);
+	for (int k = 0; k < count; k++)
+	{
+		tf::transformTFToMsg(out[k], res.poses[k]);
+		res.poses[k].translation.x *= um;
+		res.poses[k].translation.y *= um;
+		res.poses[k].translation.z *= um;
+	}
+	return true;
+}
+
+/**\fn int init_kin_service(ros::NodeHandle &n)
+ * \brief start the solver pool and advertise raven_kin_batch.  Call after init_cpu_affinity().
+ * \param n ROS node handle
+ * \return 0
+ */
+int init_kin_service(ros::NodeHandle &n)
+{
+	int threads;
+	n.param("/kin_service_threads", threads, 2);
+	if (threads <= 0)
+	{
+		log_msg("Batch kinematics service: off");
+		return 0;
+	}
+	if (threads > KIN_MAX_THREADS)
+		threads = KIN_MAX_THREADS;
+
+	sem_init(&kin_go, 0, 0);
+	sem_init(&kin_done, 0, 0);
+	kin_quit = 0;
+	for (int i = 0; i < threads - 1; i++)
+	{
+		if (pthread_create(&kin_workers[i], NULL, kin_worker_process, NULL) != 0)
+		{
+			err_msg("Batch kinematics service: could not start worker %d, %d threads", i, i + 1);
+			break;
+		}
+		num_kin_workers = i + 1;
+	}
+
+	kin_srv = n.advertiseService("raven_kin_batch", kinBatchCallback);
+	log_msg("Batch kinematics service: raven_kin_batch, %d threads", num_kin_workers + 1);
+	return 0;
+}
+
+/**\fn void kinServiceStop(void)
+ * \brief stop and join the pool.  After ros::spin() returns.
+ */
+void kinServiceStop(void)
+{
+	int count = num_kin_workers;
+
+	pthread_mutex_lock(&batch_lock);
+	num_kin_workers = 0;
+	kin_quit = 1;
+	__sync_synchronize();
+	for (int i = 0; i < count; i++)
+		sem_post(&kin_go);
+	for (int i = 0; i < count; i++)
+		pthread_join(kin_workers[i], NULL);
+	pthread_mutex_unlock(&batch_lock);
+}
@@ -0,0 +1,487 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * r2_kinematics_bench: per-call latency of the numerical kernels under the
+ * control loop, across a grid of joint positions that spans the workspace.
+ *
+ *   r2_kinematics_bench [-g grid] [-r reps] [-v]
+ *
+ * Shoulder, elbow and insertion take grid steps each between their joint
+ * limits, tool roll, wrist and grasp three steps each, on both arms.  Every
+ * kernel runs reps times back to back at each grid point; that span over
+ * reps is one sample.  Samples are reported as ns per call: mean, min, p50,
+ * p90, p99 and max.
+ *
+ * -v validates inv_kin() against inv_kin_reference() over the same grid
+ * instead, and exits nonzero if they disagree.  It also reports the float
+ * kernels' worst error against double (validateKinPrecision()).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include "rt_process_preempt.h"
+#include "r2_kinematics.h"
+#include "workspace_map.h"
+#include "mapping.h"
+#include "grav_comp.h"
+
+extern struct device device0;          // Defined in globals.cpp
+extern int NUM_MECH;                   // Defined in globals.cpp
+extern struct DOF_type DOF_types[];    // Defined in globals.cpp
+
+enum bench_kernel {
+	KB_FWD_KIN = 0,
+	KB_FK_FRAMES,
+	KB_JACOBIAN,
+	KB_DIFF_IK,
+	KB_INV_KIN,
+	KB_INV_KIN_SIMD,
+	KB_INV_KIN_SIMD_F,
+	KB_INV_KIN_BRANCH,
+	KB_INV_KIN_REF,
+	KB_CHECK_SOLUTIONS,
+	KB_JOINT_LIMITS,
+	KB_GRAVITY,
+	KB_GRAVITY_TABLE,
+	KB_INV_CABLE,
+	KB_FWD_CABLE,
+	KB_STATE_LPF,
+	KB_FROM_ITP,
+	KB_WORKSPACE_CLIP,
+	KB_NUM_KERNELS
+};
+
+static const char *kernel_names[KB_NUM_KERNELS] = {
+	"fwd_kin", "computeFKFrames", "kinJacobian", "diff_inv_kin (1 step)",
+	"inv_kin (8 solutions)", "inv_kin_simd (8 + check)", "inv_kin_simd float",
+	"inv_kin_branch (1)", "inv_kin_reference", "check_solutions", "apply_joint_limits",
+	"getGravityTorque (2 arms)", "gravity table (2 arms)", "invMechCableCoupling", "fwdMechCableCoupling",
+	"getStateLPF", "fromITP", "workspaceClip",
+};
+
+static std::vector<double> samples[KB_NUM_KERNELS];
+static volatile double sink;            // keeps results live
+
+static inline long long nowNs()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * NSEC_PER_SEC + t.tv_nsec;
+}
+
+// Time reps calls of an expression as one sample of the kernel
+#define BENCH(kernel, reps, expr)                                \
+	do {                                                         \
+		long long t0_ = nowNs();                                 \
+		for (int r_ = 0; r_ < (reps); r_++)                      \
+			{ expr; }                                            \
+		samples[kernel].push_back((double)(nowNs() - t0_) / (reps)); \
+	} while (0)
+
+static double gridValue(float lo, float hi, int i, int n)
+{
+	return n > 1 ? lo + (hi - lo) * i / (n - 1) : (lo + hi) / 2;
+}
+
+/**\fn static btTransform ikPose(const btTransform &xf, l_r arm)
+ * \brief undo the 25 degree base tilt fwd_kin() applies, as r2_inv_kin() does before inv_kin()
+ */
+static btTransform ikPose(const btTransform &xf, l_r arm)
+{
+	double a = (arm == dh_left ? 25 : -25) DEG2RAD;
+	btTransform zrot(btMatrix3x3(cos(a), -sin(a), 0,  sin(a), cos(a), 0,  0, 0, 1), btVector3(0, 0, 0));
+	return zrot.inverse() * xf;
+}
+
+/**\fn static void setJoints(struct mechanism *mech, const double *J)
+ * \brief put a joint vector (shoulder, elbow, ins, roll, wrist, wrist2) into the mechanism
+ */
+static void setJoints(struct mechanism *mech, const double *J)
+{
+	mech->joint[SHOULDER].jpos = mech->joint[SHOULDER].jpos_d = J[0];
+	mech->joint[ELBOW   ].jpos = mech->joint[ELBOW   ].jpos_d = J[1];
+	mech->joint[Z_INS   ].jpos = mech->joint[Z_INS   ].jpos_d = J[2];
+	mech->joint[TOOL_ROT].jpos = mech->joint[TOOL_ROT].jpos_d = J[3];
+	mech->joint[WRIST   ].jpos = mech->joint[WRIST   ].jpos_d = J[4];
+	mech->joint[GRASP1  ].jpos = mech->joint[GRASP1  ].jpos_d = -J[5];
+	mech->joint[GRASP2  ].jpos = mech->joint[GRASP2  ].jpos_d =  J[5];
+}
+
+/**\fn static void benchPoint(const double *J, int reps, int *ik_fail, double *ik_err)
+ * \brief run every kernel at one joint position, on both arms
+ */
+static void benchPoint(const double *J, int reps, int *ik_fail, double *ik_err)
+{
+	static struct param_pass params;
+
+	for (int m = 0; m < NUM_MECH; m++)
+	{
+		struct mechanism *mech = &device0.mech[m];
+		l_r arm = (mech->type == GOLD_ARM_SERIAL) ? dh_left : dh_right;
+		double thetas[6];
+		btTransform xf;
+		ik_solution iksol[8];
+
+		setJoints(mech, J);
+		joint2theta(thetas, (double *)J, arm);
+
+		BENCH(KB_FWD_KIN, reps, fwd_kin(thetas, arm, xf));
+		btTransform xf_ik = ikPose(xf, arm);
+		BENCH(KB_INV_KIN_REF, reps, inv_kin_reference(xf_ik, arm, iksol));
+		BENCH(KB_INV_KIN, reps, inv_kin(xf_ik, arm, iksol));
+		ik_solution bsol;
+		BENCH(KB_INV_KIN_BRANCH, reps, inv_kin_branch(xf_ik, arm, 0, bsol));
+		sink = bsol.th1;
+
+		int idx = 0;
+		double err = 0;
+		int ret = 0;
+		BENCH(KB_CHECK_SOLUTIONS, reps, ret = check_solutions(thetas, iksol, idx, err));
+		ik_solution simd[8];
+		int simd_idx = 0;
+		double simd_err = 0;
+		BENCH(KB_INV_KIN_SIMD, reps, inv_kin_simd_prec(KIN_DOUBLE, xf_ik, arm, thetas, simd, simd_idx, simd_err));
+		sink = simd_err;
+		BENCH(KB_INV_KIN_SIMD_F, reps, inv_kin_simd_prec(KIN_FLOAT, xf_ik, arm, thetas, simd, simd_idx, simd_err));
+		sink = simd_err;
+		if (ret < 0)
+			(*ik_fail)++;
+		else if (err > *ik_err)
+			*ik_err = err;
+
+		// Half again the joint vector: roughly half the grid lands outside a limit
+		double Js[6], Js_sat[6];
+		for (int i = 0; i < 6; i++)
+			Js[i] = J[i] * 1.5;
+		BENCH(KB_JOINT_LIMITS, reps, sink = apply_joint_limits(Js, Js_sat));
+
+		BENCH(KB_INV_CABLE, reps, invMechCableCoupling(mech, 1));
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			mech->joint[j].mpos = mech->joint[j].mpos_d;
+		BENCH(KB_FWD_CABLE, reps, fwdMechCableCoupling(mech));
+
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+			mech->joint[j].enc_val = (s_24)(mech->joint[j].mpos_d * ENC_CNT_PER_RAD);
+		BENCH(KB_STATE_LPF, reps, getStateLPF(&mech->joint[SHOULDER]));
+
+		rm_quat q = rmFromBt(xf.getRotation());
+		struct position p;
+		BENCH(KB_FROM_ITP, reps,
+			  p.x = (int)(xf.getOrigin()[0] * 1e6); p.y = (int)(xf.getOrigin()[1] * 1e6);
+			  p.z = (int)(xf.getOrigin()[2] * 1e6); fromITP(&p, q, mech->type));
+		sink = p.x + mech->joint[SHOULDER].jpos + mech->joint[SHOULDER].mpos;
+
+		// the cable coupling kernels above leave jpos behind; put the grid point back
+		setJoints(mech, J);
+		fk_frames fk;
+		BENCH(KB_FK_FRAMES, reps, computeFKFrames(thetas, arm, fk));
+		sink = fk.base[6].getOrigin()[0];
+
+		// a wrist point pushed past the insertion limit
+		btVector3 p05 = fk.base[5].getOrigin() * 1.5, p05_clip;
+		BENCH(KB_WORKSPACE_CLIP, reps, workspaceClip(arm, p05, p05_clip));
+		sink = p05_clip[0];
+
+		// as after r2_fwd_kin(): this cycle's frames are already in the context
+		struct kin_context *kc = getKinContext(*mech);
+		kinFrames(kc);
+		BENCH(KB_JACOBIAN, reps, kc->valid &= ~KC_JACOBIAN; sink = kinJacobian(kc)[0][0]);
+		ik_solution dsol;
+		BENCH(KB_DIFF_IK, reps, kc->valid &= ~KC_JACOBIAN; diff_inv_kin(kc, xf, 0.01, dsol));
+		sink = dsol.th1;
+	}
+	setGravityMode(GRAV_EXACT);
+	BENCH(KB_GRAVITY, reps, getGravityTorque(device0, params));
+	sink = device0.mech[0].joint[SHOULDER].tau;
+	setGravityMode(GRAV_TABLE);
+	BENCH(KB_GRAVITY_TABLE, reps, getGravityTorque(device0, params));
+	sink = device0.mech[0].joint[SHOULDER].tau;
+}
+
+// inv_kin() against inv_kin_reference()
+#define IK_VALIDATE_TOL  1e-9    // rad, m
+#define IK_ROUNDTRIP_TOL 1e-6    // m
+#define GRAV_TABLE_TOL   1e-4    // Nm motor torque, gravity table vs the exact model (about a DAC count)
+
+struct ik_validation {
+	int solves;
+	int ret_mismatch;        // different return codes
+	int ref_singular;        // reference returned -2 (and left zeros marked valid)
+	int valid_mismatch;      // a solution valid in one and not the other
+	double max_diff;         // largest joint difference between matching solutions
+	int roundtrip_fail;      // no solution reproduced the input joints
+	double max_pos_err;      // FK of the chosen solution vs the input pose
+	int branch_mismatch;     // inv_kin_branch() differs from inv_kin()'s entry
+	int ws_unreachable;      // the workspace map rejects an in-limit wrist point
+	int simd_mismatch;       // inv_kin_simd() validity or choice differs from inv_kin() + check_solutions()
+	double simd_max_diff;    // largest joint difference between inv_kin_simd() and inv_kin()
+	double grav_max_diff;    // largest motor torque difference between the gravity table and the exact model
+};
+
+static double angleDiff(double a, double b)
+{
+	double d = fmod(a - b, 2 * M_PI);
+	if (d > M_PI)
+		d -= 2 * M_PI;
+	else if (d < -M_PI)
+		d += 2 * M_PI;
+	return fabs(d);
+}
+
+/**\fn static void validatePoint(const double *J, struct ik_validation *v)
+ * \brief solve the pose of one joint position both ways, on both arms, and compare
+ */
+static void validatePoint(const double *J, struct ik_validation *v)
+{
+	for (int arm_i = 0; arm_i < 2; arm_i++)
+	{
+		l_r arm = arm_i ? dh_right : dh_left;
+		double thetas[6];
+		btTransform xf;
+		ik_solution ik[8], ref[8];
+
+		joint2theta(thetas, (double *)J, arm);
+		fwd_kin(thetas, arm, xf);
+
+		// every in-limit wrist point is on the map, and left alone by workspaceClip()
+		fk_frames fk;
+		btVector3 p05_clip;
+		computeFKFrames(thetas, arm, fk);
+		if (!workspaceReachable(arm, fk.base[5].getOrigin()) || workspaceClip(arm, fk.base[5].getOrigin(), p05_clip))
+			v->ws_unreachable++;
+
+		int ret = inv_kin(ikPose(xf, arm), arm, ik);
+		int ret_ref = inv_kin_reference(ikPose(xf, arm), arm, ref);
+		v->solves++;
+
+		if (ret_ref == -2)
+			v->ref_singular++;
+		if (ret != ret_ref)
+		{
+			v->ret_mismatch++;
+			continue;
+		}
+		if (ret < 0)
+			continue;
+		for (int i = 0; i < 8; i++)
+		{
+			if (ik[i].invalid != ref[i].invalid)
+			{
+				v->valid_mismatch++;
+				continue;
+			}
+			if (ik[i].invalid == ik_invalid)
+				continue;
+			double d = std::max(std::max(angleDiff(ik[i].th1, ref[i].th1), angleDiff(ik[i].th2, ref[i].th2)),
+								std::max(angleDiff(ik[i].th4, ref[i].th4), angleDiff(ik[i].th5, ref[i].th5)));
+			d = std::max(d, std::max(angleDiff(ik[i].th6, ref[i].th6), fabs(ik[i].d3 - ref[i].d3)));
+			v->max_diff = std::max(v->max_diff, d);
+		}
+
+		// each branch alone must give exactly what inv_kin() put at its index
+		for (int b = 0; b < 8; b++)
+		{
+			ik_solution sol;
+			inv_kin_branch(ikPose(xf, arm), arm, b, sol);
+			if (sol.invalid != ik[b].invalid ||
+				(sol.invalid != ik_invalid && (sol.th1 != ik[b].th1 || sol.th2 != ik[b].th2 || sol.d3 != ik[b].d3 ||
+											   sol.th4 != ik[b].th4 || sol.th5 != ik[b].th5 || sol.th6 != ik[b].th6)))
+				v->branch_mismatch++;
+		}
+
+		int idx = 0;
+		double err = 0;
+		int ret_cs = check_solutions(thetas, ik, idx, err);
+
+		// the vector kernel: same solutions, same pick (either of a near tie)
+		ik_solution simd[8];
+		int simd_idx = 0;
+		double simd_err = 0;
+		if (inv_kin_simd_prec(KIN_DOUBLE, ikPose(xf, arm), arm, thetas, simd, simd_idx, simd_err) != ret)
+			v->simd_mismatch++;
+		for (int i = 0; i < 8; i++)
+		{
+			if (simd[i].invalid != ik[i].invalid)
+			{
+				v->simd_mismatch++;
+				continue;
+			}
+			if (ik[i].invalid == ik_invalid)
+				continue;
+			double d = std::max(std::max(angleDiff(simd[i].th1, ik[i].th1), angleDiff(simd[i].th2, ik[i].th2)),
+								std::max(angleDiff(simd[i].th4, ik[i].th4), angleDiff(simd[i].th5, ik[i].th5)));
+			d = std::max(d, std::max(angleDiff(simd[i].th6, ik[i].th6), fabs(simd[i].d3 - ik[i].d3)));
+			v->simd_max_diff = std::max(v->simd_max_diff, d);
+		}
+		if ((simd_idx < 0) != (ret_cs < 0) ||
+			(ret_cs >= 0 && simd_idx != idx && fabs(simd_err - err) > IK_VALIDATE_TOL))
+			v->simd_mismatch++;
+
+		if (ret_cs < 0)
+		{
+			v->roundtrip_fail++;
+			continue;
+		}
+		double th[6] = { ik[idx].th1, ik[idx].th2, ik[idx].d3, ik[idx].th4, ik[idx].th5, ik[idx].th6 };
+		btTransform xf_ik;
+		fwd_kin(th, arm, xf_ik);
+		v->max_pos_err = std::max(v->max_pos_err, (double)(xf_ik.getOrigin() - xf.getOrigin()).length());
+	}
+
+	// the gravity table against the exact model, both arms
+	static struct param_pass params;
+	float exact[MAX_MECH_PER_DEV][3];
+	for (int m = 0; m < NUM_MECH; m++)
+		setJoints(&device0.mech[m], J);
+	setGravityMode(GRAV_EXACT);
+	getGravityTorque(device0, params);
+	for (int m = 0; m < NUM_MECH; m++)
+		for (int j = 0; j < 3; j++)
+			exact[m][j] = device0.mech[m].joint[j].tau;
+	setGravityMode(GRAV_TABLE);
+	getGravityTorque(device0, params);
+	for (int m = 0; m < NUM_MECH; m++)
+		for (int j = 0; j < 3; j++)
+			v->grav_max_diff = std::max(v->grav_max_diff, (double)fabs(device0.mech[m].joint[j].tau - exact[m][j]));
+}
+
+static void report(int k)
+{
+	std::vector<double> &s = samples[k];
+	if (s.empty())
+		return;
+	size_t n = s.size();
+	double total = 0;
+	for (size_t i = 0; i < n; i++)
+		total += s[i];
+	std::sort(s.begin(), s.end());
+	printf("%-26s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", kernel_names[k], total / n,
+		   s[0], s[n / 2], s[(n * 90) / 100], s[(n * 99) / 100], s[n - 1]);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-g grid] [-r reps] [-v]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int grid = 8, reps = 16, validate = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "g:r:vh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'g': grid = atoi(optarg); break;
+		case 'r': reps = atoi(optarg); break;
+		case 'v': validate = 1; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if (grid < 1 || reps < 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	// A gold and a green arm, set up as USBInit() and initDOFs() would
+	NUM_MECH = 2;
+	device0.mech[0].type = GOLD_ARM_SERIAL;
+	device0.mech[1].type = GREEN_ARM_SERIAL;
+	initDOFs(&device0);
+	designStateLPF(control_rate_hz);
+	initWorkspaceMap();
+	initGravityTable();
+	device0.grav_dir.x = 0;
+	device0.grav_dir.y = 0;
+	device0.grav_dir.z = -980;
+
+	const struct DOF_type *sh = &DOF_types[SHOULDER_GOLD], *el = &DOF_types[ELBOW_GOLD];
+	const struct DOF_type *zi = &DOF_types[Z_INS_GOLD], *tr = &DOF_types[TOOL_ROT_GOLD];
+	const struct DOF_type *wr = &DOF_types[WRIST_GOLD];
+	int points = 0, ik_fail = 0;
+	double ik_err = 0;
+	struct ik_validation v;
+	memset(&v, 0, sizeof(v));
+
+	for (int i0 = 0; i0 < grid; i0++)
+		for (int i1 = 0; i1 < grid; i1++)
+			for (int i2 = 0; i2 < grid; i2++)
+				for (int i3 = 0; i3 < 27; i3++)
+				{
+					double J[6] = {
+						gridValue(sh->min_limit, sh->max_limit, i0, grid),
+						gridValue(el->min_limit, el->max_limit, i1, grid),
+						gridValue(zi->min_limit, zi->max_limit, i2, grid),
+						gridValue(tr->min_limit * 0.8, tr->max_limit * 0.8, i3 % 3, 3),
+						gridValue(wr->min_limit * 0.8, wr->max_limit * 0.8, (i3 / 3) % 3, 3),
+						gridValue(0, 30 DEG2RAD, i3 / 9, 3),
+					};
+					if (validate)
+						validatePoint(J, &v);
+					else
+						benchPoint(J, reps, &ik_fail, &ik_err);
+					points++;
+				}
+
+	if (validate)
+	{
+		int bad = v.ret_mismatch + v.valid_mismatch + v.roundtrip_fail + v.branch_mismatch + v.simd_mismatch + v.ws_unreachable;
+		bad += v.max_diff > IK_VALIDATE_TOL || v.max_pos_err > IK_ROUNDTRIP_TOL || v.simd_max_diff > IK_VALIDATE_TOL;
+		bad += v.grav_max_diff > GRAV_TABLE_TOL;
+		printf("inv_kin vs inv_kin_reference: %d poses at %d grid points\n", v.solves, points);
+		printf("  return code mismatches   %d (reference singular %d)\n", v.ret_mismatch, v.ref_singular);
+		printf("  validity mismatches      %d\n", v.valid_mismatch);
+		printf("  max joint difference     %.3g (tolerance %.0e)\n", v.max_diff, IK_VALIDATE_TOL);
+		printf("  round trip failures      %d\n", v.roundtrip_fail);
+		printf("  max round trip position  %.3g m (tolerance %.0e)\n", v.max_pos_err, IK_ROUNDTRIP_TOL);
+		printf("  inv_kin_branch mismatches %d\n", v.branch_mismatch);
+		printf("  workspace map misses     %d\n", v.ws_unreachable);
+		printf("  inv_kin_simd (%s) mismatches %d, max joint difference %.3g\n",
+			   invKinSIMDName(), v.simd_mismatch, v.simd_max_diff);
+		printf("  gravity table max difference %.3g Nm (tolerance %.0e)\n", v.grav_max_diff, GRAV_TABLE_TOL);
+		kin_precision_report pr;
+		validateKinPrecision(grid, pr);
+		printf("  float vs double over %d joint positions: FK %.3f um %.2e rad, IK %.3f um %.2e rad, %d IK mismatches\n",
+			   pr.samples, pr.fk_pos_err * 1e6, pr.fk_rot_err, pr.ik_pos_err * 1e6, pr.ik_rot_err, pr.ik_mismatch);
+		printf("%s\n", bad ? "FAILED" : "OK");
+		return bad ? 1 : 0;
+	}
+
+	long long t0 = nowNs();
+	for (int i = 0; i < 1000; i++)
+		sink = nowNs();
+	double timer_ns = (double)(nowNs() - t0) / 1000;
+
+	printf("r2_kinematics_bench: %d grid points x %d arms, %d calls per sample, clock_gettime %.1f ns\n",
+		   points, NUM_MECH, reps, timer_ns);
+	printf("IK round trip: %d failures, worst joint error %.3g\n\n", ik_fail, ik_err);
+	printf("%-26s %8s %8s %8s %8s %8s %8s   (ns/call)\n", "kernel", "mean", "min", "p50", "p90", "p99", "max");
+	for (int k = 0; k < KB_NUM_KERNELS; k++)
+		report(k);
+	return 0;
+}
@@ -45,7 +45,12 @@ ROS publishing is at the bottom half of this file.
 #endif
 
 #include <string.h>
+#include <stddef.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <new>
+#include <time.h>
+#include <unistd.h>
 #include <ros/ros.h>
 #include <ros/transport_hints.h>
 #include <tf/transform_datatypes.h>
@@ -57,6 +62,15 @@ ROS publishing is at the bottom half of this file.
 #include "itp_teleoperation.h"
 #include "r2_kinematics.h"
 #include "reconfigure.h"
+#include "spsc_ring.h"
+#include "cpu_affinity.h"
+#include "rt_memory.h"
+#include "feedback.h"
+#include "state_shm.h"
+#include "metrics.h"
+#include "arm_pipeline.h"
+#include "executor.h"
+#include "shared_state.h"
 
 extern int NUM_MECH;
 extern USBStruct USBBoards;
@@ -65,15 +79,103 @@ extern unsigned long int gTime;
 const static double d2r = M_PI/180; //degrees to radians
 const static double r2d = 180/M_PI; //radians to degrees
 
+// Writers' side: the network, toolkit, console and ROS threads, all under data1Mutex
 static struct param_pass data1;		//local data structure that needs mutex protection
-btQuaternion Q_ori[2];
+static rm_quat Q_ori[MAX_MECH];           // orientation command of each mechanism
 pthread_mutexattr_t data1MutexAttr;
 pthread_mutex_t data1Mutex;
 
-volatile int isUpdated; //TODO: HK volatile int instead of atomic_t ///Should we use atomic builtins? http://gcc.gnu.org/onlinedocs/gcc-4.1.2/gcc/Atomic-Builtins.html
 
-extern struct offsets offsets_l;
-extern struct offsets offsets_r;
+// Triple buffer handing data1 to the RT thread without a lock.  Writers (all
+// holding data1Mutex) fill the back slot and swap it with the middle one; the
+// RT thread swaps the middle slot into the front when it is marked fresh.
+#define D1_SLOT_MASK  0x3
+#define D1_FRESH      0x4
+
+struct data1_slot
+{
+    struct param_pass params;
+    unsigned int version;
+} __attribute__((aligned(CACHE_LINE)));
+
+// Master-relative origin posted by the RT thread (updateMasterRelativeOrigin())
+// and folded into data1 by the next holder of data1Mutex (applyMasterOrigin()).
+// A seqlock: the RT thread is the only writer and never waits, readers retry
+// a copy the writer overlapped.
+struct master_origin
+{
+    struct position xd[MAX_MECH_PER_DEV];
+    struct orientation rd[MAX_MECH_PER_DEV];
+};
+
+// What the RT thread touches every cycle, off the writers' lines.  The
+// middle index is the one word both sides store to, once a publication.
+struct data1_handoff
+{
+    volatile int middle __attribute__((aligned(CACHE_LINE)));           // middle slot index | D1_FRESH
+    int front __attribute__((aligned(CACHE_LINE)));                     // RT thread's slot
+    unsigned int updates_seen;                                          // paramUpdates() at the last getRcvdParams()
+    volatile unsigned int origin_seq __attribute__((aligned(CACHE_LINE)));  // odd while the RT thread writes
+    volatile unsigned int timeout_seq;                                  // master timeouts posted by checkLocalUpdates()
+    struct master_origin origin;
+};
+
+static struct data1_slot data1_slots[3];
+static struct data1_handoff handoff = { 1, 0, 0, 0 };
+static int data1_back = 2;                   // writers' slot (data1Mutex)
+static unsigned int data1_version = 0;       // publications so far (data1Mutex)
+static int data1_last = -1;                  // slot of the last publication, -1: none yet (data1Mutex)
+static unsigned int origin_applied = 0;      // last origin_seq folded in (data1Mutex)
+static unsigned int timeout_applied = 0;     // last timeout_seq folded in (data1Mutex)
+
+static int applyMasterOrigin();
+
+/**
+ * \brief atomically replace *p with v
+ * \return the old value
+ */
+static inline int swapSlot(volatile int *p, int v)
+{
+    int old;
+    do {
+        old = *p;
+    } while (!__sync_bool_compare_and_swap(p, old, v));   // full barrier
+    return old;
+}
+
+/**
+ * \brief Publish data1 to the RT thread.  Call with data1Mutex held, after changing data1.
+ */
+static void publishData1()
+{
+    static unsigned int pending = PP_DIRTY_ALL;   // changes the RT thread may not have taken yet
+    unsigned int dirty = PP_DIRTY_ALL;
+
+    // Fields changed since the last publication.  That slot is the middle or
+    // the RT thread's front one; neither is written until it comes back here.
+    if (data1_last >= 0)
+    {
+        const struct param_pass *last = &data1_slots[data1_last].params;
+        dirty = 0;
+        for (int i = 0; i < NUM_MECH; i++)
+            if (memcmp(&data1.xd[i], &last->xd[i], sizeof(data1.xd[i])) ||
+                memcmp(&data1.rd[i], &last->rd[i], sizeof(data1.rd[i])))
+                dirty |= PP_DIRTY_POSE(i);
+        if (data1.surgeon_mode != last->surgeon_mode)
+            dirty |= PP_DIRTY_SURGEON;
+    }
+
+    data1_slots[data1_back].params = data1;
+    data1_slots[data1_back].params.dirty = pending | dirty;
+    data1_slots[data1_back].version = ++data1_version;
+    data1_last = data1_back;
+    int old = swapSlot(&handoff.middle, data1_back | D1_FRESH);
+    data1_back = old & D1_SLOT_MASK;
+
+    // If the RT thread took the publication this one replaced, only this
+    // one's changes are outstanding
+    pending = (old & D1_FRESH) ? (pending | dirty) : dirty;
+}
 
 
 /**
@@ -99,10 +201,11 @@ int initLocalioData(void)
         data1.rd[i].pitch = 0;
         data1.rd[i].roll = 0;
         data1.rd[i].grasp = 0;
-        Q_ori[i] = Q_ori[i].getIdentity();
+        Q_ori[i] = rmQuatIdentity();
     }
     data1.surgeon_mode=0;
     data1.last_sequence = 111;
+    publishData1();
     pthread_mutex_unlock(&data1Mutex);
     return 0;
 }
@@ -121,12 +224,29 @@ int receiveUserspace(void *u,int size)
 {
     if (size==sizeof(struct u_struct))
     {
-        isUpdated = TRUE;
+        noteParamUpdate();
         teleopIntoDS1((struct u_struct*)u);
     }
     return 0;
 }
 
+/**
+ * \brief Initiates update of data1 from a batch of valid teleop packets
+ *
+ * \param u array of packets, oldest first
+ * \param rx_stamp receive time of each packet (CLOCK_REALTIME)
+ * \param count number of packets
+ */
+int receiveUserspaceBatch(struct u_struct *u, const struct timespec *rx_stamp, int count)
+{
+    if (count > 0)
+    {
+        noteParamUpdate();
+        teleopIntoDS1Batch(u, rx_stamp, count);
+    }
+    return 0;
+}
+
 
 /**
  * \brief Puts the master data into protected structure
@@ -139,68 +259,79 @@ int receiveUserspace(void *u,int size)
  */
 void teleopIntoDS1(struct u_struct *us_t)
 {
-    struct position p;
-    int i, armidx, armserial;
-    pthread_mutex_lock(&data1Mutex);
-    btQuaternion q_temp;
-    btMatrix3x3 rot_mx_temp;
+    teleopIntoDS1Batch(us_t, NULL, 1);
+}
 
+/**
+ * \brief Puts a batch of master packets into the protected structure
+ *
+ * The increments of all packets are summed (positions) or composed in
+ * order (orientations) and mapped to the robot frame once, by
+ * itpMapIncrements(), before data1Mutex is taken, so a burst of packets
+ * costs one lock acquisition.  Absolute fields (surgeon_mode, sequence)
+ * take the latest packet's value.
+ *
+ * \param us_t array of packets, oldest first
+ * \param rx_stamp receive time of each packet (CLOCK_REALTIME), or NULL for now
+ * \param count number of packets
+ */
+void teleopIntoDS1Batch(struct u_struct *us_t, const struct timespec *rx_stamp, int count)
+{
+    struct position psum[MAX_MECH];
+    rm_quat qsum[MAX_MECH];
+    int i, n, armidx[MAX_MECH];
 
     // TODO:: APPLY TRANSFORM TO INCOMING DATA
 
-
-
+    // Map and accumulate the increments outside the lock
     for (i=0;i<NUM_MECH;i++)
     {
-        armserial = USBBoards.boards[i]==GREEN_ARM_SERIAL ? GREEN_ARM_SERIAL : GOLD_ARM_SERIAL;
-        armidx    = USBBoards.boards[i]==GREEN_ARM_SERIAL ? 1 : 0;
-
-        // apply mapping to teleop data
-        p.x = us_t->delx[armidx];
-        p.y = us_t->dely[armidx];
-        p.z = us_t->delz[armidx];
-
-        //set local quaternion from teleop quaternion data
-        q_temp.setX( us_t->Qx[armidx] );
-        q_temp.setY( us_t->Qy[armidx] );
-        q_temp.setZ( us_t->Qz[armidx] );
-        q_temp.setW( us_t->Qw[armidx] );
-
-        fromITP(&p, q_temp, armserial);
-
-        data1.xd[i].x += p.x;
-        data1.xd[i].y += p.y;
-        data1.xd[i].z += p.z;
+        // The master arm driving this mechanism (/arm_boards), -1 for none
+        armidx[i] = USBBoards.master[i];
+        if (armidx[i] >= 0)
+            itpMapIncrements(itpMap(armBoardType(USBBoards.boards[i])), us_t, count, armidx[i], &psum[i], qsum[i]);
+    }
 
-        //Add quaternion increment
-        Q_ori[armidx]= q_temp*Q_ori[armidx];
-        rot_mx_temp.setRotation(Q_ori[armidx]);
+    pthread_mutex_lock(&data1Mutex);
+    applyMasterOrigin();
+    for (i=0;i<NUM_MECH;i++)
+    {
+        if (armidx[i] < 0)
+            continue;
+        data1.xd[i].x += psum[i].x;
+        data1.xd[i].y += psum[i].y;
+        data1.xd[i].z += psum[i].z;
 
-        // Set rotation command
-        for (int j=0;j<3;j++)
-            for (int k=0;k<3;k++)
-                data1.rd[i].R[j][k] = rot_mx_temp[j][k];
+        //Add quaternion increment, and set rotation command
+        Q_ori[i] = rmQuatMul(qsum[i], Q_ori[i]);
+        rmToRows(rmQuatToMat(Q_ori[i]), data1.rd[i].R);
 
+        // Grasp saturates per packet, as if they had arrived one by one
         const int graspmax = (M_PI/2 * 1000);
         const int graspmin = (-30.0 * 1000.0 DEG2RAD);
-		data1.rd[i].grasp -= us_t->grasp[armidx];
-		if (data1.rd[i].grasp>graspmax) data1.rd[i].grasp=graspmax;
-		else if(data1.rd[i].grasp<graspmin) data1.rd[i].grasp=graspmin;
+        for (n=0;n<count;n++)
+        {
+            data1.rd[i].grasp -= us_t[n].grasp[armidx[i]];
+            if (data1.rd[i].grasp>graspmax) data1.rd[i].grasp=graspmax;
+            else if(data1.rd[i].grasp<graspmin) data1.rd[i].grasp=graspmin;
+        }
     }
 
     /// \question HK: why is this a hack?
     // HACK HACK HACK
-    // HACK HACK HACK
-    // HACK HACK HACK
-    // HACK HACK HACK
-    data1.last_sequence = us_t->sequence;
+    data1.last_sequence = us_t[count-1].sequence;
+    if (rx_stamp)
+        data1.rx_stamp = rx_stamp[count-1];
+    else
+        clock_gettime(CLOCK_REALTIME, &data1.rx_stamp);
 
     // commented debug output
     //    log_msg("updated d1.xd to: (%d,%d,%d)/(%d,%d,%d)",
     //           data1.xd[0].x, data1.xd[0].y, data1.xd[0].z,
     //           data1.xd[1].x, data1.xd[1].y, data1.xd[1].z);
 
-    data1.surgeon_mode = us_t->surgeon_mode;
+    data1.surgeon_mode = us_t[count-1].surgeon_mode;
+    publishData1();
     pthread_mutex_unlock(&data1Mutex);
 }
 
@@ -218,22 +349,24 @@ int checkLocalUpdates()
 {
     static unsigned long int lastUpdated;
 
-    if (isUpdated || lastUpdated == 0)
+    if (paramUpdates() != handoff.updates_seen || lastUpdated == 0)
     {
         lastUpdated = gTime;
     }
-    else if (((gTime-lastUpdated) > MASTER_CONN_TIMEOUT) && ( data1.surgeon_mode ))
+    else if (((gTime-lastUpdated) > MASTER_CONN_TIMEOUT) && ( data1_slots[handoff.front].params.surgeon_mode ))
     {
-        // if timeout period is expired, set surgeon_mode "DISENGAGED" if currently "ENGAGED"
+        // if timeout period is expired, set surgeon_mode "DISENGAGED" if currently "ENGAGED".
+        // Posted like the origin: the next holder of data1Mutex, at the latest
+        // reconcileMasterOrigin() within a publishing period, publishes it.
         log_msg("Master connection timeout.  surgeon_mode -> up.\n");
-        data1.surgeon_mode = SURGEON_DISENGAGED;
- //       data1.surgeon_mode = 1;
+        metricInc(MC_MASTER_TIMEOUTS);
+        handoff.timeout_seq = handoff.timeout_seq + 1;
 
         lastUpdated = gTime;
-        isUpdated = TRUE;
     }
 
-    return isUpdated;
+    // A publication can land just after getRcvdParams() took the count and found nothing new
+    return paramUpdates() != handoff.updates_seen || (handoff.middle & D1_FRESH);
 }
 
 /** \brief Give the latest updated DS1 to the caller.
@@ -241,23 +374,44 @@ int checkLocalUpdates()
 *   \pre d1 is a pointer to allocated memory
 *   \post memory location of d1 contains latest DS1 Data from network/toolkit.
 *
+*   Wait-free: takes the newest published slot of the triple buffer.  If
+*   nothing was published since the last call, d1 is left untouched.
+*   cmdStr is not copied (nothing on the RT side reads it).
+*
 *   \param d1 pointer to the protected data structure
 *   \return a copy of the data as a param_pass structure
-*
-*   \todo HK Check performance of trylock / default priority inversion scheme
 */
+// The copy skips [cmdStr, surgeon_mode): that must be cmdStr and its padding only
+typedef char d1_cmdstr_precedes_surgeon_mode[offsetof(struct param_pass, cmdStr) < offsetof(struct param_pass, surgeon_mode) ? 1 : -1];
+typedef char d1_skip_is_cmdstr_only[offsetof(struct param_pass, surgeon_mode) - offsetof(struct param_pass, cmdStr)
+                                    - sizeof(((struct param_pass *)0)->cmdStr) < sizeof(int) ? 1 : -1];
+
 struct param_pass * getRcvdParams(struct param_pass* d1)
 {
-    // \TODO Check performance of trylock / default priority inversion scheme
-    if (pthread_mutex_trylock(&data1Mutex)!=0)   //Use trylock since this function is called form rt-thread. return immediately with old values if unable to lock
-        return d1;
-    //pthread_mutex_lock(&data1Mutex); //Priority inversion enabled. Should force completion of other parts and enter into this section.
-    memcpy(d1, &data1, sizeof(struct param_pass));
-    isUpdated = 0;
-    pthread_mutex_unlock(&data1Mutex);
+    handoff.updates_seen = paramUpdates();
+    if ( !(handoff.middle & D1_FRESH) )
+    {
+        d1->dirty = 0;
+        return d1;   // nothing new: skip the copy
+    }
+
+    handoff.front = swapSlot(&handoff.middle, handoff.front) & D1_SLOT_MASK;
+
+    const struct param_pass *src = &(data1_slots[handoff.front].params);
+    const size_t head = offsetof(struct param_pass, cmdStr);
+    const size_t tail = offsetof(struct param_pass, surgeon_mode);
+    memcpy(d1, src, head);
+    memcpy((char*)d1 + tail, (const char*)src + tail, sizeof(struct param_pass) - tail);
     return d1;
 }
 
+/** \brief Version of the params last returned by getRcvdParams() (RT thread only)
+*/
+unsigned int getRcvdParamsVersion()
+{
+    return data1_slots[handoff.front].version;
+}
+
 /**
  * \brief Resets the desired position to the robot's current position
  *
@@ -265,45 +419,106 @@ struct param_pass * getRcvdParams(struct param_pass* d1)
  * This function is particularly useful to prevent the grasp position from changing too much
  * while the robot is moving
  *
- * Reset writable copy of DS1
+ * RT safe: only posts pos_d / ori_d to the origin slot.  data1 (and Q_ori)
+ * take it when a teleop packet, automove message or reconcileMasterOrigin()
+ * next takes data1Mutex, before any delta is added to it.
+ * The slot has one writer: inside a per-arm pipeline job the post is left
+ * to the RT thread, after the join.
 */
 void updateMasterRelativeOrigin(struct device *device0)
 {
-	int armidx;
-    struct orientation *_ori;
-    btMatrix3x3 tmpmx;
+    if (onArmWorker())
+    {
+        armPipelineDefer(ARM_DEFER_ORIGIN);
+        return;
+    }
+
+    unsigned int seq = handoff.origin_seq;
+
+    handoff.origin_seq = seq + 1;
+    __sync_synchronize();
+    for (int i=0;i<NUM_MECH;i++)
+    {
+        handoff.origin.xd[i] = device0->mech[i].pos_d;
+        handoff.origin.rd[i] = device0->mech[i].ori_d;
+    }
+    __sync_synchronize();
+    handoff.origin_seq = seq + 2;
+
+    return;
+}
+
+/**
+ * \brief Fold the last posted origin, and a master timeout, into data1.  Call with data1Mutex held.
+ * \return 1 if data1 changed, 0 if nothing new was posted
+ */
+static int applyMasterOrigin()
+{
+    struct master_origin o;
+    unsigned int seq;
+    int changed = 0;
+
+    if (handoff.timeout_seq != timeout_applied)
+    {
+        timeout_applied = handoff.timeout_seq;
+        data1.surgeon_mode = SURGEON_DISENGAGED;
+        changed = 1;
+    }
+
+    for (;;)
+    {
+        seq = handoff.origin_seq;
+        __sync_synchronize();
+        if (seq & 1)
+            continue;
+        o = handoff.origin;
+        __sync_synchronize();
+        if (handoff.origin_seq == seq)
+            break;
+    }
+    if (seq == origin_applied)
+        return changed;
+    origin_applied = seq;
 
     // update data1 (network position desired) to device0.position_desired (device position desired)
     //   This eliminates accumulation of deltas from network while robot is idle.
-    pthread_mutex_lock(&data1Mutex);
     for (int i=0;i<NUM_MECH;i++)
     {
-        data1.xd[i].x = device0->mech[i].pos_d.x;
-        data1.xd[i].y = device0->mech[i].pos_d.y;
-        data1.xd[i].z = device0->mech[i].pos_d.z;
-        _ori = &(device0->mech[i].ori_d);
+        data1.xd[i] = o.xd[i];
 
         // CHECK GRASP SKIPPING CONDITION
         // Grasp angle should not be updated unless the angle change is "large"
-        if (      fabs( data1.rd[i].grasp - _ori->grasp ) / 1000    >    45*d2r )
-        	data1.rd[i].grasp = _ori->grasp;
+        if (      fabs( data1.rd[i].grasp - o.rd[i].grasp ) / 1000    >    45*d2r )
+        	data1.rd[i].grasp = o.rd[i].grasp;
 
         for (int j=0;j<3;j++)
             for (int k=0;k<3;k++)
-                data1.rd[i].R[j][k] = _ori->R[j][k];
+                data1.rd[i].R[j][k] = o.rd[i].R[j][k];
 
         // Set the local quaternion orientation rep.
-        armidx = USBBoards.boards[i]==GREEN_ARM_SERIAL ? 1 : 0;
-        tmpmx.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                        _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                        _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        tmpmx.getRotation(Q_ori[armidx]);
-
+        Q_ori[i] = rmQuatFromMat(rmFromRows(o.rd[i].R));
     }
-    pthread_mutex_unlock(&data1Mutex);
-    isUpdated = TRUE;
+    return 1;
+}
 
-    return;
+/**
+ * \brief Publish the last posted origin or master timeout to the RT thread even if no master data arrives.  Not RT safe.
+ *
+ * Called by the ROS publisher thread, so the RT thread sees its own origin
+ * come back within a publishing period, as it used to within a cycle.
+*/
+void reconcileMasterOrigin()
+{
+    if (handoff.origin_seq == origin_applied && handoff.timeout_seq == timeout_applied)
+        return;
+
+    pthread_mutex_lock(&data1Mutex);
+    int changed = applyMasterOrigin();
+    if (changed)
+        publishData1();
+    pthread_mutex_unlock(&data1Mutex);
+    if (changed)
+        noteParamUpdate();
 }
 
 ///
@@ -314,12 +529,49 @@ void updateMasterRelativeOrigin(struct device *device0)
 #include <raven_2/raven_automove.h>
 #include <visualization_msgs/Marker.h>
 #include <sensor_msgs/JointState.h>
+#include <boost/make_shared.hpp>
 
 
 void publish_joints(struct robot_device*);
 void publish_marker(struct robot_device*);
 void autoincrCallback(raven_2::raven_automove);
 
+/**
+ * \brief Robot state captured by the RT thread for the publisher thread
+ */
+struct ravenstate_snapshot
+{
+    struct timespec stamp;       // CLOCK_REALTIME at capture
+    int streams;                 // 1 << PUB_x for each stream due this cycle
+    struct robot_device dev;
+    unsigned long cycle;         // gTime at capture
+    u_08 runlevel;
+    u_08 sublevel;
+    int last_sequence;
+};
+
+#define RAVENSTATE_RING_SIZE 64  // 64 cycles of backlog before snapshots are dropped
+
+typedef spsc_ring<struct ravenstate_snapshot, RAVENSTATE_RING_SIZE> ravenstate_ring_t;
+static ravenstate_ring_t *ravenstate_ring = NULL;   // in the RT arena
+static sem_t ravenstate_sem;
+static int ravenstate_wake = 1;          // post ravenstate_sem per snapshot; 0: drained by a reactor timer
+
+static void publish_ravenstate_snapshot(struct ravenstate_snapshot*);
+static void initVisualizationCache();
+
+// Publish rates as control cycles per message (0: stream off).  Written by
+// setPublishRate() from the reconfigure thread, read by the RT thread.
+static volatile int pub_decimation[PUB_NSTREAMS] = {1, 30, 30, 0, 0};
+static volatile int pub_on_event = 1;    // also publish ravenstate when runlevel / sublevel change
+static const char *pub_names[PUB_NSTREAMS] = {"ravenstate", "joint_states", "markers", "state_shm", "console"};
+
+// Newest snapshot off the ring, for the console and the black box.  A
+// seqlock: the publisher thread is the only writer, readers retry a copy
+// the writer overlapped.  Nobody reads device0 behind the RT thread's back.
+static struct robot_state_view latest_state;
+static volatile unsigned int latest_seq = 0;     // odd while the publisher writes; 0: nothing yet
+
 using namespace raven_2;
 // Global publisher for raven data
 ros::Publisher pub_ravenstate;
@@ -347,10 +599,60 @@ int init_ravenstate_publishing(ros::NodeHandle &n){
 
 	sub_automove = n.subscribe<raven_automove>("raven_automove", 1, autoincrCallback, ros::TransportHints().unreliable() );
 
+    int rate;
+    bool on_event;
+    n.param("/ravenstate_rate_hz", rate, control_rate_hz);
+    setPublishRate(PUB_RAVENSTATE, rate);
+    n.param("/joint_states_rate_hz", rate, 33);
+    setPublishRate(PUB_JOINTS, rate);
+    n.param("/marker_rate_hz", rate, 33);
+    setPublishRate(PUB_MARKER, rate);
+    n.param("/state_shm_rate_hz", rate, control_rate_hz);
+    if (stateShmActive())
+        setPublishRate(PUB_STATE_SHM, rate);
+    n.param("/publish_on_event", on_event, true);
+    setPublishOnEvent(on_event);
+
+    sem_init(&ravenstate_sem, 0, 0);
+    void *ringmem = rt_arena_alloc(sizeof(ravenstate_ring_t));
+    if (ringmem == NULL)
+        return -1;
+    ravenstate_ring = new (ringmem) ravenstate_ring_t();
+    initVisualizationCache();
+
     return 0;
 }
 
 
+/**
+*  \brief Set the rate of one ROS output stream
+*
+*  The RT thread queues a state snapshot every control_rate_hz / rate_hz cycles.
+*
+*  \param stream PUB_RAVENSTATE, PUB_JOINTS, PUB_MARKER or PUB_STATE_SHM
+*  \param rate_hz messages per second, limited to the control rate (0: off)
+*/
+void setPublishRate(int stream, int rate_hz)
+{
+    if (stream < 0 || stream >= PUB_NSTREAMS)
+        return;
+    if (rate_hz > control_rate_hz)
+        rate_hz = control_rate_hz;
+    pub_decimation[stream] = rate_hz > 0 ? control_rate_hz / rate_hz : 0;
+    log_msg("Publishing %s at %d Hz", pub_names[stream],
+            rate_hz > 0 ? control_rate_hz / pub_decimation[stream] : 0);
+}
+
+/**
+*  \brief Also publish ravenstate as soon as runlevel or sublevel change
+*
+*  With ravenstate at a low rate (or 0) consumers still see every transition.
+*/
+void setPublishOnEvent(int on)
+{
+    pub_on_event = on;
+}
+
 /*
  *\brief Callback for the automove topic - Updates the data1 structure
  *
@@ -367,8 +669,10 @@ void autoincrCallback(raven_2::raven_automove msg)
   tf::transformMsgToTF(msg.tf_incr[1], in_incr[1]);
 
   pthread_mutex_lock(&data1Mutex);
+  applyMasterOrigin();
 
-  for (int i=0;i<2;i++)
+  // The message carries two arms, for mechanisms 0 and 1
+  for (int i=0;i<2 && i<NUM_MECH;i++)
     {
       //add position increment
       btVector3 tmpvec = in_incr[i].getOrigin();
@@ -380,40 +684,216 @@ void autoincrCallback(raven_2::raven_automove msg)
       btQuaternion q_temp(in_incr[i].getRotation());
       if (q_temp != btQuaternion::getIdentity())
 	{
-	  int armidx    = USBBoards.boards[i]==GREEN_ARM_SERIAL ? 1 : 0;
-	  Q_ori[armidx] = q_temp*Q_ori[armidx];
-	  btMatrix3x3 rot_mx_temp(Q_ori[armidx]);
-	  for (int j=0;j<3;j++)
-	    for (int k=0;k<3;k++)
-	      data1.rd[i].R[j][k] = rot_mx_temp[j][k];
+	  Q_ori[i] = rmQuatMul(rmFromBt(q_temp), Q_ori[i]);
+	  rmToRows(rmQuatToMat(Q_ori[i]), data1.rd[i].R);
 	}
     }
 
+  publishData1();
   pthread_mutex_unlock(&data1Mutex);
 }
 
 
 
 /*
-* \brief Publishes the raven_state message from the robot and currParams structures
+* \brief Queue the robot state for publishing.  Called from the RT thread.
+*
+*   Only copies the state into a preallocated ring, and only on cycles where
+*   some stream is due (see setPublishRate()); the messages are built and
+*   published by ros_publish_process().  If the publisher falls behind by
+*   more than RAVENSTATE_RING_SIZE snapshots the snapshot is dropped.
 *
 *   \param dev robot device structure with the current state of the robot
 *   \param currParams the parameters being passed from the interfaces
 */
 void publish_ravenstate_ros(struct robot_device *dev,struct param_pass *currParams){
+    static int last_runlevel = -1, last_sublevel = -1;
+    int streams = 0;
+
+    for (int s = 0; s < PUB_NSTREAMS; s++)
+    {
+        int dec = pub_decimation[s];
+        if (dec > 0 && gTime % dec == 0)
+            streams |= 1 << s;
+    }
+    if (currParams->runlevel != last_runlevel || currParams->sublevel != last_sublevel)
+    {
+        last_runlevel = currParams->runlevel;
+        last_sublevel = currParams->sublevel;
+        if (pub_on_event)
+            streams |= 1 << PUB_RAVENSTATE;
+    }
+
+    feedbackCapture(dev, currParams);
+    if (!streams)
+        return;
+
+    // Filled in the ring slot itself: one copy of the device per snapshot
+    struct ravenstate_snapshot *snap = ravenstate_ring->reserve();
+    if (!snap)
+        return;
+    snap->streams = streams;
+    clock_gettime(CLOCK_REALTIME, &snap->stamp);
+    memcpy(&snap->dev, dev, sizeof(struct robot_device));
+    snap->cycle = gTime;
+    snap->runlevel = currParams->runlevel;
+    snap->sublevel = currParams->sublevel;
+    snap->last_sequence = currParams->last_sequence;
+    ravenstate_ring->commit();
+
+    if (ravenstate_wake)
+        sem_post(&ravenstate_sem);
+}
+
+/**
+* \brief Publish every queued snapshot, and keep the newest for latestRobotState()
+*
+*   The publisher thread (or reactor) only.
+*/
+static void publishDrain(void *)
+{
+    static struct ravenstate_snapshot snap;
+    static unsigned int reported_drops = 0;
+
+    reconcileMasterOrigin();
+
+    int popped = 0;
+    while (ravenstate_ring->pop(snap))
+    {
+        popped = 1;
+        if (snap.streams & (1 << PUB_RAVENSTATE))
+            publish_ravenstate_snapshot(&snap);
+        if (snap.streams & (1 << PUB_JOINTS))
+            publish_joints(&snap.dev);
+        if (snap.streams & (1 << PUB_MARKER))
+            publish_marker(&snap.dev);
+        if (snap.streams & (1 << PUB_STATE_SHM))
+            stateShmWrite(&snap.dev, &snap.stamp, snap.cycle, snap.runlevel, snap.sublevel, snap.last_sequence);
+    }
+
+    // Only the last one of a burst: nobody reads them in between
+    if (popped)
+    {
+        latest_seq++;
+        __sync_synchronize();
+        latest_state.cycle = snap.cycle;
+        latest_state.runlevel = snap.runlevel;
+        latest_state.sublevel = snap.sublevel;
+        memcpy(&latest_state.dev, &snap.dev, sizeof(struct robot_device));
+        __sync_synchronize();
+        latest_seq++;
+    }
+
+    if (ravenstate_ring->droppedCount() != reported_drops)
+    {
+        reported_drops = ravenstate_ring->droppedCount();
+        ROS_ERROR("ROS publisher falling behind: %u robot states dropped", reported_drops);
+    }
+}
+
+/**
+* \brief Publisher thread.  Turns robot state snapshots into ROS messages.
+*
+*   Runs at normal priority, off the RT core when affinity is configured.
+*   Returns at once in executor mode (publishReactorAttach()).
+*/
+void* ros_publish_process(void*)
+{
+    struct timespec timeout;
+
+    if (executorActive())
+        return NULL;
+
+    set_thread_affinity(ROLE_HOUSEKEEPING);
+    log_msg("Starting ROS publisher thread...");
+
+    while (ros::ok() && !r2Killed())
+    {
+        // Wake on new snapshots, check for shutdown at least every 100ms
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += 100*1000*1000;
+        tsnorm(&timeout);
+        sem_timedwait(&ravenstate_sem, &timeout);
+
+        publishDrain(NULL);
+    }
+
+    return NULL;
+}
+
+/**
+* \brief Executor mode: drain the snapshot ring from a reactor timer instead of the publisher thread
+*
+*   The RT thread stops posting the semaphore, so a cycle's snapshot costs
+*   it no syscall; the ring holds RAVENSTATE_RING_SIZE cycles, more than
+*   any sensible period.  Call before the RT thread starts.
+*
+*   \param lane executor lane
+*   \param period_ns how often the ring is drained
+*   \return 0, -1 on failure
+*/
+int publishReactorAttach(int lane, long long period_ns)
+{
+    int timer = execTimer(lane, publishDrain, NULL);
+    if (timer < 0)
+        return -1;
+    ravenstate_wake = 0;
+    execTimerArm(timer, period_ns, period_ns);
+    log_msg("ROS publisher: drained every %lld us by the executor", period_ns / 1000);
+    return 0;
+}
+
+/**
+* \brief Copy of the newest robot state snapshot.  Not for the RT thread.
+*
+*   The state is whatever the RT thread last queued for any stream (see
+*   setPublishRate(); PUB_CONSOLE keeps it coming when the others are slow
+*   or off), copied whole, never a mix of two cycles.
+*
+*   \param view where the snapshot is copied
+*   \return 1, or 0 if there is no snapshot yet or the publisher kept overlapping the copy
+*/
+int latestRobotState(struct robot_state_view *view)
+{
+    for (int tries = 0; tries < 8; tries++)
+    {
+        unsigned int seq = latest_seq;
+        __sync_synchronize();
+        if (seq == 0)
+            return 0;
+        if (seq & 1)
+        {
+            usleep(10);
+            continue;
+        }
+        memcpy(view, &latest_state, sizeof(*view));
+        __sync_synchronize();
+        if (latest_seq == seq)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+* \brief Publishes the raven_state message from a robot state snapshot
+*
+*   \param snap robot state captured by publish_ravenstate_ros()
+*/
+static void publish_ravenstate_snapshot(struct ravenstate_snapshot *snap){
     static int count=0;
     static raven_state msg_ravenstate;  // satic variables to minimize memory allocation calls
     static ros::Time t1;
     static ros::Time t2;
     static ros::Duration d;
+    struct robot_device *dev = &snap->dev;
 
-    msg_ravenstate.last_seq = currParams->last_sequence;
+    msg_ravenstate.last_seq = snap->last_sequence;
 
+    t2 = ros::Time(snap->stamp.tv_sec, snap->stamp.tv_nsec);
     if (count == 0){
-        t1 = t1.now();
+        t1 = t2;
     }
     count ++;
-    t2 = t2.now();
     d = t2-t1;
 
 //    if (d.toSec()<0.01)
@@ -422,11 +902,10 @@ void publish_ravenstate_ros(struct robot_device *dev,struct param_pass *currPara
     msg_ravenstate.dt=d;
     t1=t2;
 
-    publish_joints(dev);
-
-    // Copy the robot state to the output datastructure.
+    // Copy the robot state to the output datastructure.  raven_state has
+    // room for two arms; state_shm and the flight recorder carry them all.
     int numdof=8;
-    for (int j=0; j<NUM_MECH; j++){
+    for (int j=0; j<NUM_MECH && j<2; j++){
         msg_ravenstate.type[j]    = dev->mech[j].type;
         msg_ravenstate.pos[j*3]   = dev->mech[j].pos.x;
         msg_ravenstate.pos[j*3+1] = dev->mech[j].pos.y;
@@ -460,14 +939,158 @@ void publish_ravenstate_ros(struct robot_device *dev,struct param_pass *currPara
         }
     }
 //    msg_ravenstate.f_secs = d.toSec();
-    msg_ravenstate.hdr.stamp = msg_ravenstate.hdr.stamp.now();
-    msg_ravenstate.runlevel=currParams->runlevel;
-    msg_ravenstate.sublevel=currParams->sublevel;
+    msg_ravenstate.hdr.stamp = t2;
+    msg_ravenstate.runlevel=snap->runlevel;
+    msg_ravenstate.sublevel=snap->sublevel;
 
     // Publish the raven data to ROS
     pub_ravenstate.publish(msg_ravenstate);
 }
 
+//
+// Visualization messages.  Names, frame ids and marker geometry are set up
+// once by initVisualizationCache(); each publish only fills in positions,
+// orientations and stamps.  Messages go out by shared_ptr so an intraprocess
+// subscriber gets the message itself rather than a copy.
+//
+
+#define NUM_VIS_JOINTS 28      // 7 joints x (left, right) x (actual, desired)
+
+static const char *vis_joint_names[NUM_VIS_JOINTS] = {
+    "shoulder_L",  "elbow_L",  "insertion_L",  "tool_roll_L",  "wrist_joint_L",  "grasper_joint_1_L",  "grasper_joint_2_L",
+    "shoulder_R",  "elbow_R",  "insertion_R",  "tool_roll_R",  "wrist_joint_R",  "grasper_joint_1_R",  "grasper_joint_2_R",
+    "shoulder_L2", "elbow_L2", "insertion_L2", "tool_roll_L2", "wrist_joint_L2", "grasper_joint_1_L2", "grasper_joint_2_L2",
+    "shoulder_R2", "elbow_R2", "insertion_R2", "tool_roll_R2", "wrist_joint_R2", "grasper_joint_1_R2", "grasper_joint_2_R2",
+};
+
+/// One sphere or set of axes drawn at an arm's end point (or fixed in its frame)
+struct vis_marker_set
+{
+    int enabled;
+    int axes;               // three arrows, else one sphere
+    const char *frame_id;
+    int id;                 // sphere id, or first of the three arrow ids
+    int right;              // right arm, else left
+    int desired;            // pos_d / ori_d, else pos / ori
+    int fixed;              // at the frame origin, unrotated
+    float r, g, b;          // sphere color
+    int publisher;          // 1: visualization_marker1, 2: visualization_marker2
+};
+
+static const struct vis_marker_set vis_marker_sets[] = {
+    // on  axes frame             id  right des fixed  color          pub
+    {  0,  0,   "/base_link_L",    0,  0,   0,  0,     1.0, 0.0, 0.0,  1 },
+    {  0,  1,   "/base_link_L",   10,  0,   0,  0,     0,   0,   0,    1 },
+    {  0,  0,   "/base_link_R",    1,  1,   0,  0,     0.0, 1.0, 0.0,  1 },
+    {  0,  1,   "/base_link_R",   30,  1,   0,  0,     0,   0,   0,    1 },
+    {  0,  0,   "/base_link_L2",   2,  0,   1,  0,     1.0, 0.5, 0.0,  2 },
+    {  1,  1,   "/base_link_L2",  50,  0,   1,  0,     0,   0,   0,    2 },
+    {  0,  0,   "/base_link_R2",   3,  1,   1,  0,     0.5, 1.0, 0.0,  2 },
+    {  1,  1,   "/base_link_R2",  40,  1,   1,  0,     0,   0,   0,    2 },
+    {  0,  1,   "/link3_L2",      20,  0,   0,  1,     0,   0,   0,    2 },
+    {  0,  1,   "/link3_R2",      20,  0,   0,  1,     0,   0,   0,    2 },
+};
+#define NUM_VIS_MARKER_SETS (int)(sizeof(vis_marker_sets)/sizeof(vis_marker_sets[0]))
+
+static sensor_msgs::JointStatePtr vis_joint_msg;
+static visualization_msgs::MarkerPtr vis_marker_msgs[NUM_VIS_MARKER_SETS][3];
+static btQuaternion vis_axis_rot[3];     // x, y, z arrows from the arrow's own +x
+
+/**
+*  \brief The message to fill in for this publish
+*
+*  Reused in place unless an intraprocess subscriber still holds the last
+*  one, in which case it is copied (names and geometry included) first.
+*/
+template <class M>
+static M &reusableMsg(boost::shared_ptr<M> &p)
+{
+    if (!p.unique())
+        p = boost::make_shared<M>(*p);
+    return *p;
+}
+
+/**
+*  \brief Build the persistent visualization messages.  Called from init_ravenstate_publishing().
+*/
+static void initVisualizationCache()
+{
+    vis_joint_msg = boost::make_shared<sensor_msgs::JointState>();
+    vis_joint_msg->name.resize(NUM_VIS_JOINTS);
+    vis_joint_msg->position.resize(NUM_VIS_JOINTS);
+    for (int i = 0; i < NUM_VIS_JOINTS; i++)
+        vis_joint_msg->name[i] = vis_joint_names[i];
+
+    btMatrix3x3 xform;
+    xform.setValue(1,0,0,   0,1,0,    0,0,1);
+    xform.getRotation(vis_axis_rot[0]);
+    xform.setValue(0,-1,0,  1,0,0,    0,0,1);
+    xform.getRotation(vis_axis_rot[1]);
+    xform.setValue(0,0,-1,  0,1,0,    1,0,0);
+    xform.getRotation(vis_axis_rot[2]);
+
+    for (int s = 0; s < NUM_VIS_MARKER_SETS; s++)
+    {
+        const struct vis_marker_set *set = &vis_marker_sets[s];
+        for (int i = 0; i < (set->axes ? 3 : 1); i++)
+        {
+            visualization_msgs::MarkerPtr m = boost::make_shared<visualization_msgs::Marker>();
+            m->type = set->axes ? visualization_msgs::Marker::ARROW : visualization_msgs::Marker::SPHERE;
+            m->action = visualization_msgs::Marker::ADD;
+            m->ns = "RCM_marker";
+            m->lifetime = ros::Duration();
+            // 1x1x1 means 1m on a side
+            m->scale.x = 0.020;
+            m->scale.y = 0.020;
+            m->scale.z = 0.020;
+            m->header.frame_id = set->frame_id;
+            m->id = set->id + i;
+            if (set->axes)
+            {
+                m->color.r = (i == 0) ? 1.0f : 0.0f;
+                m->color.g = (i == 1) ? 1.0f : 0.0f;
+                m->color.b = (i == 2) ? 1.0f : 0.0f;
+                if (set->fixed)
+                {
+                    m->pose.orientation.x = vis_axis_rot[i].getX();
+                    m->pose.orientation.y = vis_axis_rot[i].getY();
+                    m->pose.orientation.z = vis_axis_rot[i].getZ();
+                    m->pose.orientation.w = vis_axis_rot[i].getW();
+                }
+            }
+            else
+            {
+                m->color.r = set->r;
+                m->color.g = set->g;
+                m->color.b = set->b;
+            }
+            m->color.a = 1.0;
+            vis_marker_msgs[s][i] = m;
+        }
+    }
+}
+
+/**
+*  \brief Visualization joint angles of one arm
+*
+*  \param pos the arm's 7 entries of the JointState
+*  \param desired use jpos_d, else jpos
+*/
+static void fillArmJoints(double *pos, struct mechanism *mech, const struct offsets *off, int right, int desired)
+{
+    float j[MAX_DOF_PER_MECH];
+    for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+        j[i] = desired ? mech->joint[i].jpos_d : mech->joint[i].jpos;
+
+    pos[0] = j[SHOULDER] + off->shoulder_off;
+    pos[1] = j[ELBOW] + off->elbow_off;
+    pos[2] = j[Z_INS] + d4 + off->insertion_off;
+    pos[3] = j[TOOL_ROT] + (right ? 45 : -45) * d2r + off->roll_off;
+    pos[4] = (right ? -j[WRIST] : j[WRIST]) + off->wrist_off;
+    pos[5] = j[GRASP1] + off->grasp1_off;
+    pos[6] = j[GRASP2] * -1 + off->grasp2_off;
+}
+
 /**
 *  \brief Publishes the joint angles for the visualization
 *
@@ -477,115 +1100,30 @@ void publish_ravenstate_ros(struct robot_device *dev,struct param_pass *currPara
 */
 void publish_joints(struct robot_device* device0){
 
-    static int count=0;
-    static ros::Time t1;
-    static ros::Time t2;
-    static ros::Duration d;
+    sensor_msgs::JointState &joint_state = reusableMsg(vis_joint_msg);
+    int left = (NUM_MECH > 1 && device0->mech[0].type != GOLD_ARM) ? 1 : 0;
+    int right = (NUM_MECH > 1) ? 1 - left : left;
 
-    if (count == 0){
-        t1 = t1.now();
-    }
-    count ++;
-    t2 = t2.now();
-    d = t2-t1;
-
-    if (d.toSec()<0.030)
-        return;
-    t1=t2;
+    struct offsets offsets_l, offsets_r;
+    getVisualOffsets(&offsets_l, &offsets_r);
 
-    publish_marker(device0);
-
-    sensor_msgs::JointState joint_state;
-    //update joint_state
     joint_state.header.stamp = ros::Time::now();
-    joint_state.name.resize(28);
-    joint_state.position.resize(28);
-//    joint_state.name.resize(14);
-//    joint_state.position.resize(14);
-    int left, right;
-    if (device0->mech[0].type == GOLD_ARM)
-    {
-        left = 0;
-        right = 1;
-    }
-    else
-    {
-        left = 1;
-        right = 0;
-    }
-    //======================LEFT ARM===========================
-    joint_state.name[0] ="shoulder_L";
-    joint_state.position[0] = device0->mech[left].joint[0].jpos + offsets_l.shoulder_off;
-    joint_state.name[1] ="elbow_L";
-    joint_state.position[1] = device0->mech[left].joint[1].jpos + offsets_l.elbow_off;
-    joint_state.name[2] ="insertion_L";
-    joint_state.position[2] = device0->mech[left].joint[2].jpos + d4 + offsets_l.insertion_off;
-    joint_state.name[3] ="tool_roll_L";
-    joint_state.position[3] = device0->mech[left].joint[4].jpos - 45 * d2r + offsets_l.roll_off;
-    joint_state.name[4] ="wrist_joint_L";
-    joint_state.position[4] = device0->mech[left].joint[5].jpos + offsets_l.wrist_off;
-    joint_state.name[5] ="grasper_joint_1_L";
-    joint_state.position[5] = device0->mech[left].joint[6].jpos + offsets_l.grasp1_off;
-    joint_state.name[6] ="grasper_joint_2_L";
-    joint_state.position[6] = device0->mech[left].joint[7].jpos * -1 + offsets_l.grasp2_off;
-
-    //======================RIGHT ARM===========================
-    joint_state.name[7] ="shoulder_R";
-    joint_state.position[7] = device0->mech[right].joint[0].jpos + offsets_r.shoulder_off;
-    joint_state.name[8] ="elbow_R";
-    joint_state.position[8] = device0->mech[right].joint[1].jpos + offsets_r.elbow_off;
-    joint_state.name[9] ="insertion_R";
-    joint_state.position[9] = device0->mech[right].joint[2].jpos + d4 + offsets_r.insertion_off;
-    joint_state.name[10] ="tool_roll_R";
-    joint_state.position[10] = device0->mech[right].joint[4].jpos + 45 * d2r + offsets_r.roll_off;
-    joint_state.name[11] ="wrist_joint_R";
-    joint_state.position[11] = device0->mech[right].joint[5].jpos * -1 + offsets_r.wrist_off;
-    joint_state.name[12] ="grasper_joint_1_R";
-    joint_state.position[12] = device0->mech[right].joint[6].jpos + offsets_r.grasp1_off;
-    joint_state.name[13] ="grasper_joint_2_R";
-    joint_state.position[13] = device0->mech[right].joint[7].jpos * -1 + offsets_r.grasp2_off;
-    
-    //======================LEFT ARM===========================
-
-    joint_state.name[14] ="shoulder_L2";
-    joint_state.position[14] = device0->mech[left].joint[0].jpos_d + offsets_l.shoulder_off;
-    joint_state.name[15] ="elbow_L2";
-    joint_state.position[15] = device0->mech[left].joint[1].jpos_d + offsets_l.elbow_off;
-    joint_state.name[16] ="insertion_L2";
-    joint_state.position[16] = device0->mech[left].joint[2].jpos_d + d4 + offsets_l.insertion_off;
-    joint_state.name[17] ="tool_roll_L2";
-    joint_state.position[17] = device0->mech[left].joint[4].jpos_d - 45 * d2r + offsets_l.roll_off;
-    joint_state.name[18] ="wrist_joint_L2";
-    joint_state.position[18] = device0->mech[left].joint[5].jpos_d + offsets_l.wrist_off;
-    joint_state.name[19] ="grasper_joint_1_L2";
-    joint_state.position[19] = device0->mech[left].joint[6].jpos_d + offsets_l.grasp1_off;
-    joint_state.name[20] ="grasper_joint_2_L2";
-    joint_state.position[20] = device0->mech[left].joint[7].jpos_d * -1 + offsets_l.grasp2_off;
-    
-    //======================RIGHT ARM===========================
-    joint_state.name[21] ="shoulder_R2";
-    joint_state.position[21] = device0->mech[right].joint[0].jpos_d + offsets_r.shoulder_off;
-    joint_state.name[22] ="elbow_R2";
-    joint_state.position[22] = device0->mech[right].joint[1].jpos_d + offsets_r.elbow_off;
-    joint_state.name[23] ="insertion_R2";
-    joint_state.position[23] = device0->mech[right].joint[2].jpos_d + d4 + offsets_r.insertion_off;
-    joint_state.name[24] ="tool_roll_R2";
-    joint_state.position[24] = device0->mech[right].joint[4].jpos_d + 45 * d2r + offsets_r.roll_off;
-    joint_state.name[25] ="wrist_joint_R2";
-    joint_state.position[25] = device0->mech[right].joint[5].jpos_d * -1 + offsets_r.wrist_off;
-    joint_state.name[26] ="grasper_joint_1_R2";
-    joint_state.position[26] = device0->mech[right].joint[6].jpos_d + offsets_r.grasp1_off;
-    joint_state.name[27] ="grasper_joint_2_R2";
-    joint_state.position[27] = device0->mech[right].joint[7].jpos_d * -1 + offsets_r.grasp2_off;
+    fillArmJoints(&joint_state.position[0],  &device0->mech[left],  &offsets_l, 0, 0);
+    fillArmJoints(&joint_state.position[7],  &device0->mech[right], &offsets_r, 1, 0);
+    fillArmJoints(&joint_state.position[14], &device0->mech[left],  &offsets_l, 0, 1);
+    fillArmJoints(&joint_state.position[21], &device0->mech[right], &offsets_r, 1, 1);
 
     //Publish the joint states
-    joint_publisher.publish(joint_state);
+    joint_publisher.publish(vis_joint_msg);
 
 }
 
 /**
  * \brief Publish the visualization marker for the robot visualization
  *
+ * Draws the enabled entries of vis_marker_sets[]: by default the desired
+ * end-point axes of both arms.
+ *
  * \param device0 the robot device and all of its ins and outs
  *
  * \author Sina?
@@ -593,594 +1131,47 @@ void publish_joints(struct robot_device* device0){
  */
 void publish_marker(struct robot_device* device0)
 {
-    visualization_msgs::Marker marker1, marker2;
-    geometry_msgs::Point p, px,py,pz;
-    btQuaternion bq;
-    struct orientation* _ori;
     btMatrix3x3 xform;
+    btQuaternion bq, oriq;
+    ros::Time now = ros::Time::now();
+    int left = (NUM_MECH > 1 && device0->mech[0].type != GOLD_ARM) ? 1 : 0;
+    int right = (NUM_MECH > 1) ? 1 - left : left;
 
-    visualization_msgs::Marker axes[3];
-    btQuaternion axq, oriq;
-
-    int left,right;
-
-    if (device0->mech[0].type == GOLD_ARM)
+    for (int s = 0; s < NUM_VIS_MARKER_SETS; s++)
     {
-        left = 0;
-        right = 1;
-    }
-    else
-    {
-        left = 1;
-        right = 0;
-    }
-
-    // setup marker
-    marker1.type = visualization_msgs::Marker::SPHERE;
-    marker1.action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-    marker1.header.stamp = ros::Time::now();
-    marker1.ns = "RCM_marker";
-    marker1.lifetime = ros::Duration();
-    // Set the scale of the marker -- 1x1x1 here means 1m on a side
-    marker1.scale.x = 0.020;
-    marker1.scale.y = 0.020;
-    marker1.scale.z = 0.020;
-
-
-    // DRAW TEH SPHERE
-    int draw_L_sphere=0;
-    if (draw_L_sphere)
-    {
-        marker1.type = visualization_msgs::Marker::SPHERE;
-        // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-        marker1.header.frame_id = "/base_link_L";
-        marker1.id = 0;
-        // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-        p.x = device0->mech[left].pos.x/1e6;
-        p.y = device0->mech[left].pos.y/1e6;
-        p.z = device0->mech[left].pos.z/1e6;
-        marker1.pose.position.x = device0->mech[left].pos.x/1e6;
-        marker1.pose.position.y = device0->mech[left].pos.y/1e6;
-        marker1.pose.position.z = device0->mech[left].pos.z/1e6;
-
-        // Get quaternion representation of rotation
-        _ori = &(device0->mech[left].ori);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        marker1.pose.orientation.x = bq.getX();
-        marker1.pose.orientation.y = bq.getY();
-        marker1.pose.orientation.z = bq.getZ();
-        marker1.pose.orientation.w = bq.getW();
-
-        // Set the color -- be sure to set alpha to something non-zero!
-        marker1.color.r = 1.0f;
-        marker1.color.g = 0.0f;
-        marker1.color.b = 0.0f;
-        marker1.color.a = 1.0;
-        // Publish the marker
-        vis_pub1.publish(marker1);
-    }
-
-
-    int draw_L_axes=0;
-    if (draw_L_axes)
-    {
-        for (int i=0;i<3;i++)
-        {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/base_link_L";
-            axes[i].id = 10+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = device0->mech[left].pos.x/1e6;
-            axes[i].pose.position.y = device0->mech[left].pos.y/1e6;
-            axes[i].pose.position.z = device0->mech[left].pos.z/1e6;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
-        }
-
-        // get the transform rotation
-        _ori = &(device0->mech[left].ori);
-//        xform.setValue(_ori->R[0][0], _ori->R[1][0], _ori->R[2][0],
-//                            _ori->R[0][1], _ori->R[1][1], _ori->R[2][1],
-//                            _ori->R[0][2], _ori->R[1][2], _ori->R[2][2]);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-
-        // draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.0f;
-
-        // Publish the marker
-        vis_pub1.publish(axes[0]);
-        vis_pub1.publish(axes[1]);
-        vis_pub1.publish(axes[2]);
-    }
-
-    int draw_R_sphere=0;
-    if (draw_R_sphere)
-    {
-        marker1.type = visualization_msgs::Marker::SPHERE;
-
-        // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-        marker1.header.frame_id = "/base_link_R";
-        marker1.id = 1;
-        // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-        marker1.pose.position.x = device0->mech[right].pos.x/1e6;
-        marker1.pose.position.y = device0->mech[right].pos.y/1e6;
-        marker1.pose.position.z = device0->mech[right].pos.z/1e6;
+        const struct vis_marker_set *set = &vis_marker_sets[s];
+        if (!set->enabled)
+            continue;
+        ros::Publisher &pub = (set->publisher == 1) ? vis_pub1 : vis_pub2;
+        struct mechanism *mech = &device0->mech[set->right ? right : left];
+        struct position *pos = set->desired ? &mech->pos_d : &mech->pos;
+        struct orientation *ori = set->desired ? &mech->ori_d : &mech->ori;
 
         // Get quaternion representation of rotation
-        _ori = &(device0->mech[right].ori);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        marker1.pose.orientation.x = bq.getX();
-        marker1.pose.orientation.y = bq.getY();
-        marker1.pose.orientation.z = bq.getZ();
-        marker1.pose.orientation.w = bq.getW();
-
-        // Set the color -- be sure to set alpha to something non-zero!
-        marker1.color.r = 0.0f;
-        marker1.color.g = 1.0f;
-        marker1.color.b = 0.0f;
-        marker1.color.a = 1.0;
-        // Publish the marker
-        vis_pub1.publish(marker1);
-    }
-
-
-
-    int draw_R_axes=0;
-    if (draw_R_axes)
-    {
-        for (int i=0;i<3;i++)
+        if (!set->fixed)
         {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/base_link_R";
-            axes[i].id = 30+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = device0->mech[right].pos.x/1e6;
-            axes[i].pose.position.y = device0->mech[right].pos.y/1e6;
-            axes[i].pose.position.z = device0->mech[right].pos.z/1e6;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
+            xform.setValue(ori->R[0][0], ori->R[0][1], ori->R[0][2],
+                           ori->R[1][0], ori->R[1][1], ori->R[1][2],
+                           ori->R[2][0], ori->R[2][1], ori->R[2][2]);
+            xform.getRotation(bq);
         }
 
-        // get the transform rotation
-        _ori = &(device0->mech[right].ori);
-//        xform.setValue(_ori->R[0][0], _ori->R[1][0], _ori->R[2][0],
-//                            _ori->R[0][1], _ori->R[1][1], _ori->R[2][1],
-//                            _ori->R[0][2], _ori->R[1][2], _ori->R[2][2]);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-
-        // draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.0f;
-
-        // Publish the marker
-        vis_pub1.publish(axes[0]);
-        vis_pub1.publish(axes[1]);
-        vis_pub1.publish(axes[2]);
-    }
-
-    int draw_L2_sphere = 0;
-    if (draw_L2_sphere)
-    {
-        // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-        marker1.header.frame_id = "/base_link_L2";
-        marker1.id = 2;
-        // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-        marker1.pose.position.x = device0->mech[left].pos_d.x/1e6;
-        marker1.pose.position.y = device0->mech[left].pos_d.y/1e6;
-        marker1.pose.position.z = device0->mech[left].pos_d.z/1e6;
-        _ori = &(device0->mech[left].ori_d);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        marker1.pose.orientation.x = bq.getX();
-        marker1.pose.orientation.y = bq.getY();
-        marker1.pose.orientation.z = bq.getZ();
-        marker1.pose.orientation.w = bq.getW();
-
-        // Set the color -- be sure to set alpha to something non-zero!
-        marker1.color.r = 1.0f;
-        marker1.color.g = 0.5f;
-        marker1.color.b = 0.0f;
-        marker1.color.a = 1.0;
-        // Publish the marker
-        vis_pub2.publish(marker1);
-    }
-
-    int draw_L2_axes = 1;
-    if (draw_L2_axes)
-    {
-        for (int i=0;i<3;i++)
+        for (int i = 0; i < (set->axes ? 3 : 1); i++)
         {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/base_link_L2";
-            axes[i].id = 50+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = device0->mech[left].pos_d.x/1e6;
-            axes[i].pose.position.y = device0->mech[left].pos_d.y/1e6;
-            axes[i].pose.position.z = device0->mech[left].pos_d.z/1e6;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
-        }
-        // Get the device transform
-        _ori = &(device0->mech[left].ori_d);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        // Draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.0f;
-
-        // Publish the marker
-        vis_pub2.publish(axes[0]);
-        vis_pub2.publish(axes[1]);
-        vis_pub2.publish(axes[2]);
-    }
-
-    int draw_R2_sphere = 0;
-    if (draw_R2_sphere)
-    {
-        // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-        marker1.header.frame_id = "/base_link_R2";
-        marker1.id = 3;
-        // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-        marker1.pose.position.x = device0->mech[right].pos_d.x/1e6;
-        marker1.pose.position.y = device0->mech[right].pos_d.y/1e6;
-        marker1.pose.position.z = device0->mech[right].pos_d.z/1e6;
-        _ori = &(device0->mech[right].ori_d);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        marker1.pose.orientation.x = bq.getX();
-        marker1.pose.orientation.y = bq.getY();
-        marker1.pose.orientation.z = bq.getZ();
-        marker1.pose.orientation.w = bq.getW();
-        // Set the color -- be sure to set alpha to something non-zero!
-        marker1.color.r = 0.5f;
-        marker1.color.g = 1.0f;
-        marker1.color.b = 0.0f;
-        marker1.color.a = 1.0;
-        // Publish the marker
-        vis_pub2.publish(marker1);
-    }
-
-    int draw_R2_axes = 1;
-    if (draw_R2_axes)
-    {
-        for (int i=0;i<3;i++)
-        {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/base_link_R2";
-            axes[i].id = 40+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = device0->mech[right].pos_d.x/1e6;
-            axes[i].pose.position.y = device0->mech[right].pos_d.y/1e6;
-            axes[i].pose.position.z = device0->mech[right].pos_d.z/1e6;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
-        }
-        // Get the device transform
-        _ori = &(device0->mech[right].ori_d);
-        xform.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2],
-                       _ori->R[1][0], _ori->R[1][1], _ori->R[1][2],
-                       _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-        xform.getRotation(bq);
-        // Draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = bq * axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.03f;
-
-        // Publish the marker
-        vis_pub2.publish(axes[0]);
-        vis_pub2.publish(axes[1]);
-        vis_pub2.publish(axes[2]);
-    }
-
-    int draw_xx_axes=0;
-    if (draw_xx_axes)
-    {
-        for (int i=0;i<3;i++)
-        {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/link3_L2";
-            axes[i].id = 20+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = 0;
-            axes[i].pose.position.y = 0;
-            axes[i].pose.position.z = 0;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
-        }
-
-        // get the transform rotation
-        _ori = &(device0->mech[left].ori);
-
-        // draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.0f;
-
-        // Publish the marker
-        vis_pub2.publish(axes[0]);
-        vis_pub2.publish(axes[1]);
-        vis_pub2.publish(axes[2]);
-    }
-
-
-
-    int draw_xxx_axes=0;
-    if (draw_xxx_axes)
-    {
-        for (int i=0;i<3;i++)
-        {
-            axes[i].type = visualization_msgs::Marker::ARROW;
-            axes[i].action = visualization_msgs::Marker::ADD;   // Set the marker action.  Options are ADD and DELETE
-            axes[i].header.stamp = ros::Time::now();
-            axes[i].ns = "RCM_marker";
-            axes[i].lifetime = ros::Duration();
-            // Set the scale of the marker -- 1x1x1 here means 1m on a side
-            axes[i].scale.x = 0.020;
-            axes[i].scale.y = 0.020;
-            axes[i].scale.z = 0.020;
-
-            // Set the frame ID and timestamp.  See the TF tutorials for information on these.
-            axes[i].header.frame_id = "/link3_R2";
-            axes[i].id = 20+i;
-            // Set the pose of the marker.  This is a full 6DOF pose relative to the frame/time specified in the header
-            axes[i].pose.position.x = 0;
-            axes[i].pose.position.y = 0;
-            axes[i].pose.position.z = 0;
-
-            // Set the color -- be sure to set alpha to something non-zero!
-            axes[i].color.r = 0.0f;
-            axes[i].color.g = 0.0f;
-            axes[i].color.b = 0.0f;
-            axes[i].color.a = 1.0;
-
+            visualization_msgs::Marker &m = reusableMsg(vis_marker_msgs[s][i]);
+            m.header.stamp = now;
+            if (!set->fixed)
+            {
+                m.pose.position.x = pos->x/1e6;
+                m.pose.position.y = pos->y/1e6;
+                m.pose.position.z = pos->z/1e6;
+                oriq = set->axes ? bq * vis_axis_rot[i] : bq;
+                m.pose.orientation.x = oriq.getX();
+                m.pose.orientation.y = oriq.getY();
+                m.pose.orientation.z = oriq.getZ();
+                m.pose.orientation.w = oriq.getW();
+            }
+            pub.publish(vis_marker_msgs[s][i]);
         }
-
-        // get the transform rotation
-        _ori = &(device0->mech[left].ori);
-
-        // draw the axes
-        xform.setValue(1,0,0,   0,1,0,    0,0,1);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[0].pose.orientation.x = oriq.getX();
-        axes[0].pose.orientation.y = oriq.getY();
-        axes[0].pose.orientation.z = oriq.getZ();
-        axes[0].pose.orientation.w = oriq.getW();
-        axes[0].color.r = 1.0f;
-
-        xform.setValue(0,-1,0,    1,0,0,     0,0,1);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[1].pose.orientation.x = oriq.getX();
-        axes[1].pose.orientation.y = oriq.getY();
-        axes[1].pose.orientation.z = oriq.getZ();
-        axes[1].pose.orientation.w = oriq.getW();
-        axes[1].color.g = 1.0f;
-
-        xform.setValue(0,0,-1,   0,1,0,    1,0,0);
-        xform.getRotation(axq);
-        oriq = axq;
-        axes[2].pose.orientation.x = oriq.getX();
-        axes[2].pose.orientation.y = oriq.getY();
-        axes[2].pose.orientation.z = oriq.getZ();
-        axes[2].pose.orientation.w = oriq.getW();
-        axes[2].color.b = 1.0f;
-
-        // Publish the marker
-        vis_pub2.publish(axes[0]);
-        vis_pub2.publish(axes[1]);
-        vis_pub2.publish(axes[2]);
     }
 }
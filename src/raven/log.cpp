@@ -22,40 +22,414 @@
 * \file log.cpp
 * \brief Generic logging function
 *
+* log_msg() and err_msg() never format, lock or allocate on the calling
+* thread.  They record the format string pointer plus the raw arguments in a
+* multi-producer ring preallocated in the RT arena (log_init()), and log_process() formats the records and
+* forwards them to rosout.  The format string must be a string literal (or
+* otherwise outlive the call); %s arguments are copied into the record.
+*
+* Until log_process() is running (startup) and after it exits (shutdown)
+* messages are formatted and printed directly on the calling thread.
 */
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <ros/ros.h>
 #include <ros/console.h>
-#include <queue>
 
-std::queue<char*> msgqueue;
+#include "log.h"
+#include "rt_memory.h"
+#include "executor.h"
+#include "shared_state.h"
+
 const static size_t MAX_MSG_LEN =1024;
 
+#define LOG_RING_SIZE  256    // records, power of two
+#define LOG_MAX_ARGS   12     // conversions per message
+#define LOG_STR_LEN    256    // bytes of %s data per message
+
+#define LOG_INFO  0
+#define LOG_ERR   1
+
+enum log_arg_type { ARG_INT, ARG_LONG, ARG_DOUBLE, ARG_PTR, ARG_STR, ARG_NONE };
+
+struct log_arg {
+    int type;
+    union {
+        int i;
+        long long l;
+        double d;
+        void *p;
+        unsigned short str_off;
+    };
+};
+
+struct log_record {
+    volatile unsigned int seq;      // stored relative to the slot index, see log_push()
+    int level;
+    const char *fmt;
+    int nargs;
+    struct log_arg args[LOG_MAX_ARGS];
+    char strs[LOG_STR_LEN];
+};
+
+static struct log_record *log_ring = NULL;     // LOG_RING_SIZE records in the RT arena
+static volatile unsigned int log_head = 0;      // next position to claim (producers)
+static unsigned int log_tail = 0;               // next position to read (log_process only)
+static volatile unsigned int log_dropped = 0;
+static volatile int log_thread_running = 0;
+
+
+/**\fn static const char* next_conversion(const char *p, const char **end, char *conv, int *islong)
+*  \brief find the next printf conversion in a format string
+*  \param p       position in the format string
+*  \param end     set to just past the conversion
+*  \param conv    set to the conversion character, or 0 if there are no more
+*  \param islong  set if the conversion has an l/ll/z/j/t length modifier
+*  \return pointer to the '%' that starts the conversion
+*/
+static const char* next_conversion(const char *p, const char **end, char *conv, int *islong)
+{
+    *conv = 0;
+    *islong = 0;
+    *end = p;
+    while (*p)
+    {
+        if (*p != '%')
+        {
+            p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            p += 2;
+            continue;
+        }
+        const char *start = p++;
+        while (*p && strchr("-+ #0123456789.", *p))
+            p++;
+        while (*p && strchr("hlLqjzt", *p))
+        {
+            if (strchr("lqjzt", *p))
+                *islong = 1;
+            p++;
+        }
+        *conv = *p;
+        *end = *p ? p+1 : p;
+        return start;
+    }
+    *end = p;
+    return p;
+}
+
+/**\fn static void log_capture(struct log_record *rec, const char *fmt, va_list args)
+*  \brief copy the arguments of a printf-style call into a log record
+*/
+static void log_capture(struct log_record *rec, const char *fmt, va_list args)
+{
+    const char *p = fmt;
+    char conv;
+    int islong;
+    size_t stroff = 0;
+
+    rec->fmt = fmt;
+    rec->nargs = 0;
+    while (rec->nargs < LOG_MAX_ARGS)
+    {
+        next_conversion(p, &p, &conv, &islong);
+        if (!conv)
+            break;
+
+        struct log_arg *a = &rec->args[rec->nargs++];
+        switch (conv)
+        {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            if (islong)
+            {
+                a->type = ARG_LONG;
+                a->l = va_arg(args, long long);
+            }
+            else
+            {
+                a->type = ARG_INT;
+                a->i = va_arg(args, int);
+            }
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            a->type = ARG_DOUBLE;
+            a->d = va_arg(args, double);
+            break;
+        case 'p':
+            a->type = ARG_PTR;
+            a->p = va_arg(args, void*);
+            break;
+        case 's':
+        {
+            const char *s = va_arg(args, const char*);
+            if (s == NULL)
+                s = "(null)";
+            a->type = ARG_STR;
+            if (stroff >= LOG_STR_LEN - 1)
+            {
+                // strs is full: later strings are the empty one in its last byte
+                rec->strs[LOG_STR_LEN-1] = '\0';
+                a->str_off = LOG_STR_LEN - 1;
+                break;
+            }
+            size_t n = strlen(s);
+            if (n > LOG_STR_LEN - stroff - 1)
+                n = LOG_STR_LEN - stroff - 1;
+            memcpy(&rec->strs[stroff], s, n);
+            rec->strs[stroff+n] = '\0';
+            a->str_off = stroff;
+            stroff += n + 1;
+            break;
+        }
+        default:
+            // unsupported conversion (%n, %*d, ...): stop capturing
+            a->type = ARG_NONE;
+            return;
+        }
+    }
+}
+
+/**\fn static void log_format(const struct log_record *rec, char *out, size_t len)
+*  \brief format a log record, one conversion at a time
+*/
+static void log_format(const struct log_record *rec, char *out, size_t len)
+{
+    const char *p = rec->fmt;
+    size_t pos = 0;
+    char spec[32];
+    char conv;
+    int islong;
+
+    out[0] = '\0';
+    for (int n = 0; pos < len-1; n++)
+    {
+        const char *end;
+        const char *start = next_conversion(p, &end, &conv, &islong);
+
+        // literal text up to the conversion, collapsing "%%"
+        for (const char *q = p; q < start && pos < len-1; q++)
+        {
+            out[pos++] = *q;
+            if (q[0] == '%' && q[1] == '%')
+                q++;
+        }
+        out[pos] = '\0';
+        if (!conv || n >= rec->nargs || rec->args[n].type == ARG_NONE)
+            break;
+
+        size_t speclen = end - start;
+        if (speclen >= sizeof(spec))
+            speclen = sizeof(spec) - 1;
+        memcpy(spec, start, speclen);
+        spec[speclen] = '\0';
+        p = end;
+
+        const struct log_arg *a = &rec->args[n];
+        int w = 0;
+        switch (a->type)
+        {
+        case ARG_INT:    w = snprintf(out+pos, len-pos, spec, a->i); break;
+        case ARG_LONG:   w = snprintf(out+pos, len-pos, spec, a->l); break;
+        case ARG_DOUBLE: w = snprintf(out+pos, len-pos, spec, a->d); break;
+        case ARG_PTR:    w = snprintf(out+pos, len-pos, spec, a->p); break;
+        case ARG_STR:    w = snprintf(out+pos, len-pos, spec, &rec->strs[a->str_off]); break;
+        }
+        if (w > 0)
+            pos += ((size_t)w < len-pos) ? (size_t)w : len-pos-1;
+    }
+}
+
+/**\fn static int log_push(int level, const char *fmt, va_list args)
+*  \brief claim a ring slot and record a message.  Lock free, safe from any thread.
+*  \return 0 on success -1 if the ring is full
+*
+*  Bounded MPMC queue after D. Vyukov.  Each slot's sequence number is stored
+*  minus its index so that the zero-initialized ring starts out empty.
+*/
+static int log_push(int level, const char *fmt, va_list args)
+{
+    struct log_record *rec;
+    unsigned int pos = log_head;
+
+    for (;;)
+    {
+        unsigned int idx = pos & (LOG_RING_SIZE-1);
+        rec = &log_ring[idx];
+        int dif = (int)(rec->seq + idx - pos);
+        if (dif == 0)
+        {
+            if (__sync_bool_compare_and_swap(&log_head, pos, pos+1))
+                break;
+        }
+        else if (dif < 0)
+        {
+            __sync_fetch_and_add(&log_dropped, 1);
+            return -1;
+        }
+        pos = log_head;
+    }
+
+    rec->level = level;
+    log_capture(rec, fmt, args);
+    __sync_synchronize();
+    rec->seq = pos + 1 - (pos & (LOG_RING_SIZE-1));
+    return 0;
+}
+
+/**\fn static int log_pop(char *out, size_t len, int *level)
+*  \brief format the oldest record, if any.  log_process() only.
+*  \return 1 if a message was read, 0 if the ring is empty
+*/
+static int log_pop(char *out, size_t len, int *level)
+{
+    unsigned int idx = log_tail & (LOG_RING_SIZE-1);
+    struct log_record *rec = &log_ring[idx];
+
+    if (rec->seq + idx != log_tail + 1)
+        return 0;
+    __sync_synchronize();
+
+    *level = rec->level;
+    log_format(rec, out, len);
+
+    __sync_synchronize();
+    rec->seq = log_tail + LOG_RING_SIZE - idx;
+    log_tail++;
+    return 1;
+}
+
+/**\fn static void log_emit(int level, const char *msg)
+*  \brief forward a formatted message to rosout
+*/
+static void log_emit(int level, const char *msg)
+{
+    if (level == LOG_ERR)
+        ROS_ERROR("%s", msg);
+    else
+        ROS_INFO("%s", msg);
+}
+
+/**\fn static int log_write(int level, const char* fmt, va_list args)
+*  \brief queue a message, or print it directly when no log thread is running
+*/
+static int log_write(int level, const char* fmt, va_list args)
+{
+    if (log_thread_running)
+        return log_push(level, fmt, args);
+
+    char buf[MAX_MSG_LEN];
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    log_emit(level, buf);
+    return 0;
+}
+
+/**\fn int log_init()
+*  \brief allocate the log ring.  Until this is called (and log_process() runs) messages print directly.
+*  \return 0 on success -1 on failure
+*/
+int log_init()
+{
+    log_ring = (struct log_record*)rt_arena_alloc(sizeof(struct log_record) * LOG_RING_SIZE);
+    return log_ring ? 0 : -1;
+}
+
+/**\fn static void logDrain(void *)
+*  \brief forward every queued message, and report drops.  The drain thread (or reactor) only.
+*/
+static void logDrain(void *)
+{
+    static char buf[MAX_MSG_LEN];
+    static unsigned int reported_drops = 0;
+    int level;
+
+    while (log_pop(buf, sizeof(buf), &level))
+        log_emit(level, buf);
+
+    if (log_dropped != reported_drops)
+    {
+        reported_drops = log_dropped;
+        ROS_ERROR("log ring full: %u messages dropped", reported_drops);
+    }
+}
+
+/**\fn static void logFinish(void)
+*  \brief print directly from here on, then flush what is left
+*/
+static void logFinish(void)
+{
+    char buf[MAX_MSG_LEN];
+    int level;
+
+    log_thread_running = 0;
+    usleep(1000);
+    while (log_pop(buf, sizeof(buf), &level))
+        log_emit(level, buf);
+}
+
+/**\fn void* log_process(void*)
+*  \brief Logging thread.  Formats queued messages and forwards them to rosout.
+*/
+void* log_process(void*)
+{
+    if (log_ring == NULL || executorActive())
+        return NULL;
+
+    log_thread_running = 1;
+    while (ros::ok() && !r2Killed())
+    {
+        logDrain(NULL);
+        usleep(10*1000);
+    }
+
+    logFinish();
+    return NULL;
+}
+
+/**\fn int logReactorAttach(int lane)
+*  \brief executor mode: drain the ring from a reactor timer, every 10ms as log_process()
+*  \return 0, -1 on failure
+*/
+int logReactorAttach(int lane)
+{
+    if (log_ring == NULL)
+        return 0;
+
+    int timer = execTimer(lane, logDrain, NULL);
+    if (timer < 0)
+        return -1;
+    execTimerArm(timer, 10*1000*1000, 10*1000*1000);
+    log_thread_running = 1;
+    return 0;
+}
+
+/**\fn void logReactorDetach(void)
+*  \brief executor mode, once the reactors have stopped: print directly from here on
+*/
+void logReactorDetach(void)
+{
+    if (log_thread_running)
+        logFinish();
+}
 
 /**\fn int log_msg_later(const char* fmt,...)
-*  \brief 
+*  \brief Same as log_msg(): every message is now deferred to log_process().
 *  \param fmt
 *  \return 0 on success -1 on failure
 */
 
 int log_msg_later(const char* fmt,...)
 {
-  static char buf[MAX_MSG_LEN];
-  char* msgbuf;
-  va_list args;
-  va_start (args, fmt);
-
-  //Do somethin
-  vsprintf(buf,fmt,args);
-  va_end(args);
-//    printf("%s",buf);
-  msgbuf = (char*)malloc(strlen(buf)+1);
-  strcpy(msgbuf, buf);
-  msgqueue.push(msgbuf);
-  //  ROS_INFO("%s",buf);
-  //std::cout << "qsiz:" << msgqueue.size() << std::endl;
-  return 0;
+    va_list args;
+    va_start (args, fmt);
+    int ret = log_write(LOG_INFO, fmt, args);
+    va_end(args);
+    return ret;
 }
 
 /**\fn int log_msg(const char* fmt,...)
@@ -66,15 +440,11 @@ int log_msg_later(const char* fmt,...)
 
 int log_msg(const char* fmt,...)
 {
-  static char buf[MAX_MSG_LEN];
     va_list args;
     va_start (args, fmt);
-    //Do somethinh
-    vsprintf(buf,fmt,args);
+    int ret = log_write(LOG_INFO, fmt, args);
     va_end(args);
-//    printf("%s",buf);
-    ROS_INFO("%s",buf);
-    return 0;
+    return ret;
 }
 
 /**\fn int err_msg(const char* fmt,...)
@@ -85,13 +455,9 @@ int log_msg(const char* fmt,...)
 
 int err_msg(const char* fmt,...)
 {
-  static char buf[MAX_MSG_LEN];
     va_list args;
     va_start (args, fmt);
-    //Do somethinh
-    vsprintf(buf,fmt,args);
+    int ret = log_write(LOG_ERR, fmt, args);
     va_end(args);
-//    printf("%s",buf);
-    ROS_ERROR("%s",buf);
-    return 0;
+    return ret;
 }
@@ -0,0 +1,201 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file lz4_block.cpp
+ * \brief LZ4 block format: greedy compressor, bounds-checked decompressor.
+ *
+ * One hash probe per position, like LZ4's fast mode; the flight archive's
+ * columns are mostly runs of zero bytes after the delta and XOR coding, so
+ * a better parse gains little.  Inputs are limited to 2 GB.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4_block.h"
+
+#define LZ4_MINMATCH     4
+#define LZ4_LASTLITERALS 5       // the block ends with at least this many literals
+#define LZ4_MFLIMIT      12      // no match starts closer than this to the end
+#define LZ4_MAX_OFFSET   65535
+#define LZ4_HASH_LOG     12
+
+static inline uint32_t lz4Read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t lz4Hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/**\fn static unsigned char *lz4Length(unsigned char *op, size_t len)
+ * \brief the 255-byte continuation of a literal or match length of 15 or more
+ */
+static unsigned char *lz4Length(unsigned char *op, size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+/**\fn int lz4Compress(const void *src, size_t len, void *dst, size_t cap)
+ * \brief compress len bytes into one LZ4 block
+ * \param cap room at dst, lz4Bound(len) is always enough
+ * \return compressed size, -1 if it does not fit in cap
+ */
+int lz4Compress(const void *src, size_t len, void *dst, size_t cap)
+{
+	const unsigned char *base = (const unsigned char *)src;
+	const unsigned char *ip = base, *anchor = base, *end = base + len;
+	unsigned char *op = (unsigned char *)dst, *oend = op + cap;
+	int32_t table[1 << LZ4_HASH_LOG];
+
+	if (len > 0x7fffffff)
+		return -1;
+	memset(table, 0xff, sizeof(table));
+
+	if (len > LZ4_MFLIMIT)
+	{
+		const unsigned char *mflimit = end - LZ4_MFLIMIT, *matchlimit = end - LZ4_LASTLITERALS;
+		while (ip < mflimit)
+		{
+			uint32_t seq = lz4Read32(ip);
+			uint32_t h = lz4Hash(seq);
+			int32_t ref = table[h];
+			table[h] = (int32_t)(ip - base);
+			if (ref < 0 || (ip - base) - ref > LZ4_MAX_OFFSET || lz4Read32(base + ref) != seq)
+			{
+				ip++;
+				continue;
+			}
+
+			const unsigned char *match = base + ref;
+			while (ip > anchor && match > base && ip[-1] == match[-1])
+			{
+				ip--;
+				match--;
+			}
+			const unsigned char *p = ip + LZ4_MINMATCH, *m = match + LZ4_MINMATCH;
+			while (p < matchlimit && *p == *m)
+			{
+				p++;
+				m++;
+			}
+
+			size_t lit = ip - anchor, mlen = p - ip - LZ4_MINMATCH;
+			if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1)
+				return -1;
+			unsigned char *token = op++;
+			*token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+			if (lit >= 15)
+				op = lz4Length(op, lit);
+			memcpy(op, anchor, lit);
+			op += lit;
+			size_t offset = ip - match;
+			*op++ = (unsigned char)offset;
+			*op++ = (unsigned char)(offset >> 8);
+			*token |= (unsigned char)(mlen >= 15 ? 15 : mlen);
+			if (mlen >= 15)
+				op = lz4Length(op, mlen);
+
+			ip = anchor = p;
+		}
+	}
+
+	// The rest as literals
+	size_t lit = end - anchor;
+	if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1)
+		return -1;
+	*op++ = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+	if (lit >= 15)
+		op = lz4Length(op, lit);
+	memcpy(op, anchor, lit);
+	op += lit;
+	return (int)(op - (unsigned char *)dst);
+}
+
+/**\fn int lz4Decompress(const void *src, size_t len, void *dst, size_t cap)
+ * \brief decode one LZ4 block; never reads or writes out of bounds
+ * \param cap room at dst
+ * \return decoded size, -1 if the block is corrupt or decodes to more than cap
+ */
+int lz4Decompress(const void *src, size_t len, void *dst, size_t cap)
+{
+	const unsigned char *ip = (const unsigned char *)src, *iend = ip + len;
+	unsigned char *base = (unsigned char *)dst, *op = base, *oend = base + cap;
+
+	if (cap > 0x7fffffff)
+		return -1;
+
+	while (ip < iend)
+	{
+		unsigned int token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit)
+			return -1;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend)
+			break;              // the last sequence has no match
+
+		if (iend - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - base))
+			return -1;
+		size_t mlen = token & 15;
+		if (mlen == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += LZ4_MINMATCH;
+		if ((size_t)(oend - op) < mlen)
+			return -1;
+		const unsigned char *m = op - offset;
+		while (mlen--)
+			*op++ = *m++;   // may overlap: byte by byte
+	}
+	return (int)(op - base);
+}
@@ -27,36 +27,112 @@
 
 #include "mapping.h"
 #include "log.h"
+#include "itp_teleoperation.h"
 #include <iostream>
 
 
 const int USE_ITP = 1;
 
-/** \fn void fromITP(struct position *delpos, btQuaternion &delrot, int armserial)
+// ITP frame axes in each arm's base frame
+static const int ITP2GOLD[3][3]  = { {0,0,-1},  {-1,0,0},  {0,1,0} };
+static const int ITP2GREEN[3][3] = { {0,0,-1},  {1,0,0},   {0,-1,0} };
+
+/** \fn static struct itp_map makeItpMap(const int R[3][3])
+ * \brief the mapping of one arm, its rotation as a matrix and a quaternion
+ */
+static struct itp_map makeItpMap(const int R[3][3])
+{
+    struct itp_map map;
+    for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++)
+            map.R[j][k] = R[j][k];
+
+    map.q = rmQuatFromMat(rmFromRows(R));
+    return map;
+}
+
+static const struct itp_map itp_gold  = makeItpMap(ITP2GOLD);
+static const struct itp_map itp_green = makeItpMap(ITP2GREEN);
+
+/** \fn const struct itp_map *itpMap(int armserial)
+ * \brief the ITP mapping of an arm type
+ * \param armserial GOLD_ARM_SERIAL, else the green arm's
+ */
+const struct itp_map *itpMap(int armserial)
+{
+    return (armserial == GOLD_ARM_SERIAL) ? &itp_gold : &itp_green;
+}
+
+/** \fn static inline void mapPosition(const struct itp_map *map, int x, int y, int z, struct position *p)
+ * \brief p = R * (x, y, z)
+ */
+static inline void mapPosition(const struct itp_map *map, int x, int y, int z, struct position *p)
+{
+    p->x = map->R[0][0] * x + map->R[0][1] * y + map->R[0][2] * z;
+    p->y = map->R[1][0] * x + map->R[1][1] * y + map->R[1][2] * z;
+    p->z = map->R[2][0] * x + map->R[2][1] * y + map->R[2][2] * z;
+}
+
+/** \fn static inline rm_quat mapRotation(const struct itp_map *map, const rm_quat &q)
+ * \brief the ITP rotation q in the arm's frame, q_R * q * inv(q_R), normalised; identity if q is zero
+ */
+static inline rm_quat mapRotation(const struct itp_map *map, const rm_quat &q)
+{
+    double d = rmQuatNorm2(q);
+    if (d <= 0)
+        return rmQuatIdentity();
+    return rmQuatMul(rmQuatMul(map->q, q), rmQuatConj(map->q)) * rmSplat(1 / sqrt(d));
+}
+
+/** \fn void fromITP(struct position *delpos, rm_quat &delrot, int armserial)
  * \brief Transform a position increment and an orientation increment from ITP coordinate frame into local robot coordinate frame.
- *        Do this using inv(R)*C*R : R= transform, C= increment
+ *        Do this using R*C*inv(R) : R= transform, C= increment
  * \param delpos - a pointer points to a position struct
- * \param delrot - a reference of a btQuanternion class
+ * \param delrot - a reference of a quaternion (x, y, z, w)
  * \param armserial - an integer number of of mechanisam id
- * \question why post multiply with R inverse?
 */
-void fromITP(struct position *delpos, btQuaternion &delrot, int armserial)
+void fromITP(struct position *delpos, rm_quat &delrot, int armserial)
 {
-    const btTransform ITP2Gold ( btMatrix3x3 (0,0,-1,  -1,0,0,  0,1,0), btVector3 (0,0,0) );
-    const btTransform ITP2Green( btMatrix3x3 (0,0,-1,  1,0,0,  0,-1,0), btVector3 (0,0,0) );
-    btTransform incr (delrot, btVector3(delpos->x, delpos->y, delpos->z));
+    const struct itp_map *map = itpMap(armserial);
 
-    if (armserial == GOLD_ARM_SERIAL)
-    {
-        incr = ITP2Gold  * incr * ITP2Gold.inverse();
-    }
-    else
+    mapPosition(map, delpos->x, delpos->y, delpos->z, delpos);
+    delrot = mapRotation(map, delrot);
+}
+
+/** \fn void itpMapIncrements(const struct itp_map *map, const struct u_struct *us, int count, int arm, struct position *dpos, rm_quat &drot)
+ * \brief Sum of a batch of one master arm's increments, mapped into the robot frame.
+ *
+ * Mapping is linear in the positions and a conjugation of the rotations,
+ * so the batch is accumulated in the ITP frame and mapped once:
+ * R*C2*inv(R) * R*C1*inv(R) = R*(C2*C1)*inv(R).  Gives the same result as
+ * fromITP() on each packet, positions summed and rotations composed.
+ *
+ * \param map the arm's mapping, itpMap()
+ * \param us packets, oldest first
+ * \param count number of packets
+ * \param arm master arm in the packets
+ * \param dpos summed position increment
+ * \param drot composed rotation increment, newest leftmost
+ */
+void itpMapIncrements(const struct itp_map *map, const struct u_struct *us, int count, int arm,
+                      struct position *dpos, rm_quat &drot)
+{
+    int x = 0, y = 0, z = 0;
+    rm_quat q = rmQuatIdentity();
+
+    for (int n = 0; n < count; n++)
     {
-        incr = ITP2Green * incr * ITP2Green.inverse();
+        x += us[n].delx[arm];
+        y += us[n].dely[arm];
+        z += us[n].delz[arm];
+
+        // q = q_n * q, skipping zero (invalid) increments; normalised once at the end
+        rm_quat b = rmQuat(us[n].Qx[arm], us[n].Qy[arm], us[n].Qz[arm], us[n].Qw[arm]);
+        if (rmQuatNorm2(b) == 0)
+            continue;
+        q = rmQuatMul(b, q);
     }
 
-    delrot = incr.getRotation();
-    delpos->x = (int)(incr.getOrigin()[0]);
-    delpos->y = (int)(incr.getOrigin()[1]);
-    delpos->z = (int)(incr.getOrigin()[2]);
+    mapPosition(map, x, y, z, dpos);
+    drot = mapRotation(map, q);
 }
@@ -0,0 +1,331 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file metrics.cpp
+ * \brief Loop health counters, gauges and histograms, exported as /diagnostics and as text.
+ *
+ * Writers touch only their slot of the metric_store; the metrics thread
+ * reads the slots without stopping them, so an export may be a cycle's
+ * worth of updates behind on one metric relative to another, which is
+ * all a health dashboard needs.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include "metrics.h"
+#include "cpu_affinity.h"
+#include "log.h"
+#include "shared_state.h"
+
+struct metric_store metrics;
+
+struct metric_def {
+	const char *name;
+	const char *help;
+};
+
+static const struct metric_def counter_defs[MC_NUM_COUNTERS] = {
+	{ "deadline_missed",          "Control cycles started after their deadline" },
+	{ "usb_ebusy_retries",        "10us retries of the spin-mode USB read" },
+	{ "usb_wait_timeouts",        "Cycles the boards' packets did not arrive in time" },
+	{ "usb_read_errors",          "Cycles with a failed USB read" },
+	{ "usb_write_errors",         "Failed USB board writes" },
+	{ "teleop_packets",           "Teleop datagrams received" },
+	{ "teleop_lost",              "Teleop samples missing from the sequence numbering" },
+	{ "teleop_rejected",          "Duplicate or late teleop samples" },
+	{ "master_timeouts",          "Surgeon disengaged for want of master packets" },
+	{ "ik_failures",              "Cycles with no closed-form IK solution near the current joints" },
+	{ "joint_limit_saturations",  "IK solutions clipped to the joint limits" },
+	{ "current_clips",            "Joint commands clipped to the DAC limit" },
+	{ "enc_stale",                "Mechanism-cycles run on an encoder packet from an earlier cycle" },
+	{ "waypoints_dropped",        "Streamed waypoints late, out of order, too far ahead or over the queue" },
+	{ "ext_cmd_stale",            "External command heartbeat stopped in external_control" },
+	{ "kin_batch_items",          "Poses and joint vectors solved by the batch kinematics service" },
+	{ "rt_watchdog_trips",        "Control loop stalls stopped by the deadline watchdog" },
+	{ "teleop_predict_clamps",    "Master targets whose predicted lead was cut to the extrapolation bound" },
+	{ "usb_boards_lost",          "USB boards given up after failed calls or missing packets" },
+	{ "usb_boards_reopened",      "Lost USB boards reopened and back in use" },
+	{ "archive_records_lost",     "Records overwritten in the flight recorder before the archive took them" },
+	{ "usb_worker_overruns",      "Parallel USB jobs that missed their cycle deadline, each a soft e-stop" },
+};
+
+static const struct metric_def gauge_defs[MG_NUM_GAUGES] = {
+	{ "runlevel",                 "Current runlevel" },
+	{ "deadline_missed_in_a_row", "Deadlines missed back to back" },
+};
+
+static const struct metric_def hist_defs[MH_NUM_HISTS] = {
+	{ "cycle_compute_us",         "Wakeup to end of the control cycle (us)" },
+	{ "usb_wait_us",              "Wait for the boards' packets (us)" },
+	{ "enc_interval_us",          "Between a board's encoder packets (us)" },
+	{ "ext_cmd_age_us",           "External command write to its first use (us)" },
+	{ "kin_batch_us",             "One batch kinematics service request (us)" },
+	{ "net_handoff_us",           "Teleop sample kernel receive to its handoff into data1 (us)" },
+};
+
+static ros::Publisher diag_pub;
+static int metrics_fd = -1;
+static double diag_period_s = 1.0;
+
+/**\fn static u_64 metricLoad(const u_64 *p)
+ * \brief one relaxed read of a slot
+ */
+static inline u_64 metricLoad(const u_64 *p)
+{
+	return *(const volatile u_64 *)p;
+}
+
+/**\fn static void metricsText(std::string &out)
+ * \brief every metric in the Prometheus text exposition format, names prefixed raven_
+ */
+static void metricsText(std::string &out)
+{
+	char line[256];
+
+	out.clear();
+	for (int c = 0; c < MC_NUM_COUNTERS; c++)
+	{
+		snprintf(line, sizeof(line), "# HELP raven_%s_total %s\n# TYPE raven_%s_total counter\nraven_%s_total %llu\n",
+		         counter_defs[c].name, counter_defs[c].help, counter_defs[c].name, counter_defs[c].name,
+		         metricLoad(&metrics.counters[c]));
+		out += line;
+	}
+	for (int g = 0; g < MG_NUM_GAUGES; g++)
+	{
+		snprintf(line, sizeof(line), "# HELP raven_%s %s\n# TYPE raven_%s gauge\nraven_%s %g\n",
+		         gauge_defs[g].name, gauge_defs[g].help, gauge_defs[g].name, gauge_defs[g].name,
+		         *(const volatile double *)&metrics.gauges[g]);
+		out += line;
+	}
+	for (int h = 0; h < MH_NUM_HISTS; h++)
+	{
+		const struct metric_hist_data *d = &metrics.hists[h];
+		u_64 cum = 0;
+
+		snprintf(line, sizeof(line), "# HELP raven_%s %s\n# TYPE raven_%s histogram\n",
+		         hist_defs[h].name, hist_defs[h].help, hist_defs[h].name);
+		out += line;
+		for (int b = 0; b < METRIC_HIST_BUCKETS - 1; b++)
+		{
+			cum += metricLoad(&d->bins[b]);
+			snprintf(line, sizeof(line), "raven_%s_bucket{le=\"%llu\"} %llu\n", hist_defs[h].name, 1ULL << b, cum);
+			out += line;
+		}
+		cum += metricLoad(&d->bins[METRIC_HIST_BUCKETS - 1]);
+		snprintf(line, sizeof(line), "raven_%s_bucket{le=\"+Inf\"} %llu\nraven_%s_sum %llu\nraven_%s_count %llu\n",
+		         hist_defs[h].name, cum, hist_defs[h].name, metricLoad(&d->sum), hist_defs[h].name, cum);
+		out += line;
+	}
+}
+
+/**\fn static void serveScrape(int fd)
+ * \brief answer one scrape connection with the text format and close it
+ */
+static void serveScrape(int fd)
+{
+	struct pollfd p = { fd, POLLIN, 0 };
+	char req[1024];
+	std::string body, head;
+
+	// Whatever was asked for, once the request is in (or after 100 ms)
+	if (poll(&p, 1, 100) > 0)
+		recv(fd, req, sizeof(req), MSG_DONTWAIT);
+
+	metricsText(body);
+	char line[128];
+	snprintf(line, sizeof(line), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+	         body.size());
+	head = line;
+	head += body;
+
+	size_t sent = 0;
+	while (sent < head.size())
+	{
+		ssize_t w = send(fd, head.data() + sent, head.size() - sent, MSG_NOSIGNAL);
+		if (w <= 0)
+			break;
+		sent += w;
+	}
+	close(fd);
+}
+
+/**\fn static void publishDiagnostics(u_64 last[MC_NUM_COUNTERS], double dt)
+ * \brief /diagnostics: every metric as a key, and a level from what went wrong since the last one
+ * \param last counters at the last publish, updated
+ * \param dt seconds since then
+ */
+static void publishDiagnostics(u_64 last[MC_NUM_COUNTERS], double dt)
+{
+	diagnostic_msgs::DiagnosticArray msg;
+	diagnostic_msgs::DiagnosticStatus st;
+	u_64 now[MC_NUM_COUNTERS];
+	char v[64];
+
+	for (int c = 0; c < MC_NUM_COUNTERS; c++)
+		now[c] = metricLoad(&metrics.counters[c]);
+	u_64 d_missed = now[MC_DEADLINE_MISSED] - last[MC_DEADLINE_MISSED];
+	u_64 d_usb    = now[MC_USB_READ_ERRORS] - last[MC_USB_READ_ERRORS] +
+	                now[MC_USB_WRITE_ERRORS] - last[MC_USB_WRITE_ERRORS];
+	u_64 d_clips  = now[MC_CURRENT_CLIPS] - last[MC_CURRENT_CLIPS];
+	u_64 d_lost   = now[MC_TELEOP_LOST] - last[MC_TELEOP_LOST];
+
+	st.name = "raven_2: control loop";
+	st.hardware_id = "raven_2";
+	if (d_usb > 0)
+	{
+		st.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+		st.message = "USB errors";
+	}
+	else if (d_missed > 0 || d_clips > 0 || d_lost > 0)
+	{
+		st.level = diagnostic_msgs::DiagnosticStatus::WARN;
+		st.message = d_missed > 0 ? "Missed deadlines" : (d_clips > 0 ? "Current clipping" : "Teleop packet loss");
+	}
+	else
+	{
+		st.level = diagnostic_msgs::DiagnosticStatus::OK;
+		st.message = "OK";
+	}
+
+	diagnostic_msgs::KeyValue kv;
+	for (int c = 0; c < MC_NUM_COUNTERS; c++)
+	{
+		kv.key = counter_defs[c].name;
+		snprintf(v, sizeof(v), "%llu", now[c]);
+		kv.value = v;
+		st.values.push_back(kv);
+	}
+	kv.key = "teleop_packet_rate_hz";
+	snprintf(v, sizeof(v), "%.1f", dt > 0 ? (now[MC_TELEOP_PACKETS] - last[MC_TELEOP_PACKETS]) / dt : 0.0);
+	kv.value = v;
+	st.values.push_back(kv);
+	for (int g = 0; g < MG_NUM_GAUGES; g++)
+	{
+		kv.key = gauge_defs[g].name;
+		snprintf(v, sizeof(v), "%g", *(const volatile double *)&metrics.gauges[g]);
+		kv.value = v;
+		st.values.push_back(kv);
+	}
+	for (int h = 0; h < MH_NUM_HISTS; h++)
+	{
+		u_64 n = metricLoad(&metrics.hists[h].count);
+		kv.key = std::string(hist_defs[h].name) + "_mean";
+		snprintf(v, sizeof(v), "%.1f", n ? (double)metricLoad(&metrics.hists[h].sum) / n : 0.0);
+		kv.value = v;
+		st.values.push_back(kv);
+	}
+
+	msg.header.stamp = ros::Time::now();
+	msg.status.push_back(st);
+	diag_pub.publish(msg);
+	memcpy(last, now, sizeof(now));
+}
+
+/**\fn int init_metrics(ros::NodeHandle &n)
+ * \brief advertise /diagnostics and open the scrape port
+ * \param n the node handle
+ * \return 0, or -1 if the scrape port was asked for and could not be opened
+ */
+int init_metrics(ros::NodeHandle &n)
+{
+	int port;
+	n.param("/metrics_port", port, 9180);
+	n.param("/metrics_diag_period_s", diag_period_s, 1.0);
+	if (diag_period_s < 0.1)
+		diag_period_s = 0.1;
+
+	diag_pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+
+	if (port <= 0)
+	{
+		log_msg("Metrics: /diagnostics every %.1f s, no scrape port", diag_period_s);
+		return 0;
+	}
+
+	struct sockaddr_in addr;
+	int one = 1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (metrics_fd < 0 ||
+	    setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(metrics_fd, 4) < 0)
+	{
+		err_msg("Metrics: cannot listen on port %d (%s)", port, strerror(errno));
+		if (metrics_fd >= 0)
+			close(metrics_fd);
+		metrics_fd = -1;
+		return -1;
+	}
+	log_msg("Metrics: /diagnostics every %.1f s, text on TCP port %d", diag_period_s, port);
+	return 0;
+}
+
+/**\fn void* metrics_process(void*)
+ * \brief Metrics thread: publishes /diagnostics and answers scrapes.
+ */
+void* metrics_process(void*)
+{
+	static u_64 last[MC_NUM_COUNTERS];
+	struct timespec t_last, t_now;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	clock_gettime(CLOCK_MONOTONIC, &t_last);
+
+	while (ros::ok() && !r2Killed())
+	{
+		struct pollfd p = { metrics_fd, POLLIN, 0 };
+		int wait_ms = 100;      // to notice r2Killed()
+
+		if (metrics_fd >= 0 && poll(&p, 1, wait_ms) > 0 && (p.revents & POLLIN))
+		{
+			int fd = accept(metrics_fd, NULL, NULL);
+			if (fd >= 0)
+				serveScrape(fd);
+		}
+		else if (metrics_fd < 0)
+			usleep(wait_ms * 1000);
+
+		clock_gettime(CLOCK_MONOTONIC, &t_now);
+		double dt = (t_now.tv_sec - t_last.tv_sec) + (t_now.tv_nsec - t_last.tv_nsec) * 1e-9;
+		if (dt >= diag_period_s)
+		{
+			publishDiagnostics(last, dt);
+			t_last = t_now;
+		}
+	}
+	if (metrics_fd >= 0)
+		close(metrics_fd);
+	return NULL;
+}
@@ -0,0 +1,235 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file net_log.cpp
+ * \brief Buffered background writer for err_network.log.
+ *
+ * Only the network thread calls net_log(), so a single-producer ring is
+ * enough.  The writer thread wakes on a semaphore (or every 100 ms), writes
+ * everything queued with one write() per line and rotates by renaming
+ * file -> file.1 -> ... -> file.N.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <new>
+#include <string>
+
+#include "net_log.h"
+#include "spsc_ring.h"
+#include "rt_memory.h"
+#include "cpu_affinity.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+
+struct net_log_line
+{
+	unsigned short len;
+	char text[NET_LOG_LINE_LEN];
+};
+
+typedef spsc_ring<struct net_log_line, NET_LOG_RING_SIZE> net_log_ring_t;
+static net_log_ring_t *net_log_ring = NULL;    // in the RT arena
+static sem_t net_log_sem;
+
+static std::string net_log_file = "err_network.log";
+static int net_log_max_bytes = 1048576;
+static int net_log_keep = 3;
+
+static unsigned long net_log_written = 0;      // lines written (writer thread)
+static unsigned long net_log_rotations = 0;
+static unsigned long net_log_write_errors = 0;
+
+/**\fn int init_net_log(ros::NodeHandle &n)
+ * \brief read the network log parameters and allocate the line ring
+ * \param n the node handle
+ * \return 0 on success, -1 if the ring could not be allocated
+ */
+int init_net_log(ros::NodeHandle &n)
+{
+	n.param<std::string>("/net_log_file", net_log_file, "err_network.log");
+	n.param("/net_log_max_bytes", net_log_max_bytes, 1048576);
+	n.param("/net_log_keep", net_log_keep, 3);
+	if (net_log_max_bytes < 0)
+		net_log_max_bytes = 0;
+	if (net_log_keep < 1)
+		net_log_keep = 1;
+
+	void *mem = rt_arena_alloc(sizeof(net_log_ring_t));
+	if (mem == NULL)
+		return -1;
+	net_log_ring = new (mem) net_log_ring_t();
+	sem_init(&net_log_sem, 0, 0);
+
+	log_msg("Network log: %s, rotate at %d bytes, keep %d",
+			net_log_file.c_str(), net_log_max_bytes, net_log_keep);
+	return 0;
+}
+
+/**\fn int net_log(const char *fmt, ...)
+ * \brief queue a line for err_network.log.  Never blocks or does I/O.
+ * \param fmt printf format; a newline is appended if missing
+ * \return 1 if the line was queued, 0 if it was dropped
+ */
+int net_log(const char *fmt, ...)
+{
+	struct net_log_line line;
+	va_list args;
+
+	if (net_log_ring == NULL)
+		return 0;
+
+	va_start(args, fmt);
+	int n = vsnprintf(line.text, NET_LOG_LINE_LEN - 1, fmt, args);
+	va_end(args);
+	if (n < 0)
+		return 0;
+	if (n > NET_LOG_LINE_LEN - 2)
+		n = NET_LOG_LINE_LEN - 2;
+	if (n == 0 || line.text[n-1] != '\n')
+		line.text[n++] = '\n';
+	line.len = n;
+
+	if (!net_log_ring->push(line))
+		return 0;
+	sem_post(&net_log_sem);
+	return 1;
+}
+
+/**\fn static int openLog()
+ * \brief open the log file for appending
+ * \return the descriptor, or -1
+ */
+static int openLog()
+{
+	return open(net_log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0664);
+}
+
+/**\fn static int rotateLog(int fd)
+ * \brief close the current file, shift file.i to file.i+1 and reopen
+ * \return the new descriptor, or -1
+ */
+static int rotateLog(int fd)
+{
+	char from[512], to[512];
+
+	close(fd);
+	for (int i = net_log_keep - 1; i >= 0; i--)
+	{
+		if (i == 0)
+			snprintf(from, sizeof(from), "%s", net_log_file.c_str());
+		else
+			snprintf(from, sizeof(from), "%s.%d", net_log_file.c_str(), i);
+		snprintf(to, sizeof(to), "%s.%d", net_log_file.c_str(), i+1);
+		rename(from, to);     // missing files are fine
+	}
+	net_log_rotations++;
+	return openLog();
+}
+
+/**\fn void* net_log_process(void*)
+ * \brief Network log writer thread.  Drains the line ring into the log file.
+ */
+void* net_log_process(void*)
+{
+	struct net_log_line line;
+	struct stat st;
+	struct timespec timeout;
+	off_t size = 0;
+
+	if (net_log_ring == NULL)
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+
+	int fd = openLog();
+	if (fd < 0)
+	{
+		err_msg("Network log: could not open %s (%d)", net_log_file.c_str(), errno);
+		return NULL;
+	}
+	if (fstat(fd, &st) == 0)
+		size = st.st_size;
+
+	char opened[100];
+	time_t now = time(NULL);
+	snprintf(opened, sizeof(opened), "\n\nOpened log file at %s", ctime(&now));
+	if (write(fd, opened, strlen(opened)) > 0)
+		size += strlen(opened);
+
+	for (;;)
+	{
+		int done = !ros::ok() || r2Killed();
+
+		while (net_log_ring->pop(line))
+		{
+			if (net_log_max_bytes && size + line.len > net_log_max_bytes)
+			{
+				fd = rotateLog(fd);
+				size = 0;
+				if (fd < 0)
+				{
+					err_msg("Network log: could not reopen %s (%d)", net_log_file.c_str(), errno);
+					return NULL;
+				}
+			}
+			ssize_t w = write(fd, line.text, line.len);
+			if (w < 0)
+				net_log_write_errors++;
+			else
+			{
+				size += w;
+				net_log_written++;
+			}
+		}
+
+		if (done)     // the ring was drained after the last producer stopped
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += 100000000L;
+		tsnorm(&timeout);
+		sem_timedwait(&net_log_sem, &timeout);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+/**\fn void outputNetLogStats()
+ * \brief print the network log counters
+ */
+void outputNetLogStats()
+{
+	if (net_log_ring == NULL)
+		return;
+	log_msg("net log: %lu lines written, %u dropped, %u queued, %lu rotations, %lu write errors",
+			net_log_written, net_log_ring->droppedCount(), net_log_ring->size(),
+			net_log_rotations, net_log_write_errors);
+}
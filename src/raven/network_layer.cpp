@@ -49,21 +49,105 @@
 #include <ros/ros.h>    // Use ROS
 #include <ros/console.h>// ROS console output header for ROS_DEBUG, unused  
 
+#include <sched.h>      // POSIX library: SCHED_FIFO
+#include <pthread.h>    // POSIX library: threads
+#include <string>
+#include <algorithm>
+
 #include <stdlib.h>     // C Standard library: General Utilities Library
 #include <string.h>     // C Standard library: String operations
 #include <unistd.h>     // POSIX library: standard symbolic constants and types
 //#include <rtai_fifos.h>
 
 #include "itp_teleoperation.h"
+#include "teleop_protocol.h"
+#include "teleop_jitter.h"
+#include "net_log.h"
+#include "teleop_session.h"
 #include "DS0.h"
 #include "DS1.h"
 #include "log.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "executor.h"
+#include "network_layer.h"
 
 #define SERVER_PORT  "36000"             // used if the robot needs to send data to the server
 //#define SERVER_ADDR  "192.168.0.102"
 #define SERVER_ADDR  "128.95.205.206"    // used only if the robot needs to send data to the server
 
+#define NET_RECV_BATCH 32                 // max packets drained per wakeup
+#define NET_BACKOFF_MIN_NS 1000           // poll mode: first sleep once the spin window has passed
+#define NET_MAX_PRIORITY   90             // poll mode: below the RT thread and its helpers
+
+// Receive mode, see init_network()
+static int net_rx_poll = 0;               // busy-poll the socket instead of select()
+static int net_rx_priority = 0;           // poll mode SCHED_FIFO priority, 0: normal
+static int net_busy_poll_us = 0;          // SO_BUSY_POLL, 0: leave alone
+static int net_rcvbuf_kb = 0;             // SO_RCVBUF, 0: leave alone
+static long long net_spin_ns = 200000;    // poll mode: spin this long after the last datagram
+static long long net_backoff_max_ns = 500000;
+
 extern int receiveUserspace(void *u,int size);  // Defined in the local_io.cpp
+extern int receiveUserspaceBatch(struct u_struct *u, const struct timespec *rx_stamp, int count);  // Defined in the local_io.cpp
+
+/**\fn int init_network(ros::NodeHandle &n)
+  \brief read the receive mode parameters.  Call after init_cpu_affinity(), before the network thread starts.
+  \param n ROS node handle
+  \return 0
+*/
+int init_network(ros::NodeHandle &n)
+{
+    std::string mode;
+    int spin_us, backoff_max_us;
+
+    n.param<std::string>("/net_rx_mode", mode, "select");
+    n.param("/net_rx_priority", net_rx_priority, 0);
+    n.param("/net_busy_poll_us", net_busy_poll_us, 0);
+    n.param("/net_rcvbuf_kb", net_rcvbuf_kb, 0);
+    n.param("/net_spin_us", spin_us, 200);
+    n.param("/net_backoff_max_us", backoff_max_us, 500);
+
+    if (mode != "select" && mode != "poll")
+    {
+        err_msg("net_rx_mode \"%s\" unknown, using \"select\"", mode.c_str());
+        mode = "select";
+    }
+    net_rx_poll = (mode == "poll");
+    if (net_rx_priority < 0)
+    {
+        err_msg("net_rx_priority %d out of range, using normal priority", net_rx_priority);
+        net_rx_priority = 0;
+    }
+    if (net_rx_priority > NET_MAX_PRIORITY)
+    {
+        err_msg("net_rx_priority %d would compete with the RT thread, using %d", net_rx_priority, NET_MAX_PRIORITY);
+        net_rx_priority = NET_MAX_PRIORITY;
+    }
+    if (net_rx_poll && !executorActive())
+    {
+        // The poll loop spins, and needs a core of its own, see spinPause()
+        int cpu = thread_role_cpu(ROLE_NETWORK);
+        if (cpu < 0 || cpu == thread_role_cpu(ROLE_RT))
+        {
+            err_msg("ERROR: net_rx_mode \"poll\" needs cpu_network on a core other than cpu_rt.  Using \"select\".");
+            net_rx_poll = 0;
+        }
+    }
+    net_spin_ns = (long long)std::max(spin_us, 0) * 1000;
+    net_backoff_max_ns = std::max((long long)backoff_max_us * 1000, (long long)NET_BACKOFF_MIN_NS);
+
+    if (!net_rx_poll)
+        log_msg("Network receive: select()");
+    else
+    {
+        log_msg("Network receive: busy poll, %d us spin, %d us longest backoff, %s",
+                spin_us, backoff_max_us, net_rx_priority ? "SCHED_FIFO" : "normal priority");
+        if (executorActive())
+            log_msg("  (reactor executor: receive stays on its epoll lane, only the socket options apply)");
+    }
+    return 0;
+}
 
 /**\fn int initSock (const char* port )
   \brief This function initializes a socket
@@ -110,6 +194,23 @@ int initSock (const char* port )
         return 0;
     }
 
+    // kernel receive timestamps, for teleop latency measurement
+    int on = 1;
+    if (setsockopt(request_sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        perror("setsockopt(SO_TIMESTAMPNS)");
+
+    // Low-latency receive: poll the NIC queue from recv() (needs CAP_NET_ADMIN above
+    // net.core.busy_read), and room for a burst while the thread is backed off
+    if (net_busy_poll_us > 0 &&
+        setsockopt(request_sock, SOL_SOCKET, SO_BUSY_POLL, &net_busy_poll_us, sizeof(net_busy_poll_us)) < 0)
+        err_msg("net_busy_poll_us: setsockopt(SO_BUSY_POLL) failed (%s)", strerror(errno));
+    if (net_rcvbuf_kb > 0)
+    {
+        int bytes = net_rcvbuf_kb * 1024;
+        if (setsockopt(request_sock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0)
+            err_msg("net_rcvbuf_kb: setsockopt(SO_RCVBUF) failed (%s)", strerror(errno));
+    }
+
     //----------- end init -------------//
 
 
@@ -144,79 +245,321 @@ int UDPChecksum(struct u_struct *u)
 volatile struct v_struct v;
 
 
-/**\fn void* network_process(void*)
-  \brief This function receives and reads the udp package from the network in realtime, executed as an rt thread in rt_process_preempt.cpp 
-  \param param1 void pointer
-  \return void 
+/**\fn static void getRxStamp(struct msghdr *msg, struct timespec *stamp)
+  \brief Get a datagram's kernel receive time (SO_TIMESTAMPNS), or the current time if the kernel did not supply one
+  \param msg the received message header
+  \param stamp filled with the receive time, CLOCK_REALTIME
 */
-void* network_process(void* param1)
+static void getRxStamp(struct msghdr *msg, struct timespec *stamp)
 {
-    int sock;              // sockets.
-    int nfound, maxfd;
-    const char *port = SERVER_PORT;
-    fd_set rmask, mask;
-    static struct timeval timeout = { 0, 500000 }; // .5 sec //
-    struct u_struct u;
-
-    int uSize=sizeof(struct u_struct);
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(stamp, CMSG_DATA(c), sizeof(struct timespec));
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, stamp);
+}
 
-    struct sockaddr_in clientName;
-    int clientLength=sizeof(clientName);
-    int retval;
-    static int k = 0;
-    int logFile;
+/**\fn static int checkSequence(struct u_struct *u, const struct timespec *rx_stamp)
+  \brief Put a teleop sample into the reorder window (teleop_jitter.cpp), logging duplicates, late packets and resets
+  \param u the received sample
+  \param rx_stamp its receive time
+  \return 1 if the sample was accepted, 0 otherwise
+*/
+static int checkSequence(struct u_struct *u, const struct timespec *rx_stamp)
+{
     struct timeval tv;
     struct timezone tz;
-    char logbuffer[100];
-    unsigned int seq = 0;
-    volatile int bytesread;
+    struct timespec tnow;
+
+//
+//    if (u->checksum != UDPChecksum(u))   // Check checksum
+//    {
+//        gettimeofday(&tv,&tz);
+//        net_log("%s Bad Checksum -> rejected packet\n", ctime(&(tv.tv_sec)));
+//        ROS_ERROR("%s Bad Checksum -> rejected packet\n", ctime(&(tv.tv_sec)) );
+//
+//    }
+//    else
+    if (u->sequence == 0)        // Zero seqnum means reflect packet to sender
+    {
+        gettimeofday(&tv,&tz);
+        net_log("%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)));
+        log_msg("%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)) );
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    switch (teleopJitterInsert(u, rx_stamp, &tnow))
+    {
+    case TJ_DUPLICATE:     // Repeated sequence number
+        gettimeofday(&tv,&tz);
+        net_log("%s Duplicated packet %d\n", ctime(&(tv.tv_sec)), u->sequence);
+        ROS_ERROR("%s Duplicated packet %d\n", ctime(&(tv.tv_sec)), u->sequence );
+        metricInc(MC_TELEOP_REJECTED);
+        return 0;
+
+    case TJ_LATE:          // Arrived after its slot was released or skipped
+        gettimeofday(&tv,&tz);
+        net_log("%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)), u->sequence);
+        ROS_ERROR("%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)), u->sequence );
+        metricInc(MC_TELEOP_REJECTED);
+        return 0;
+
+    case TJ_RESET:         // reset sequence(skipped more than 1000 packets)
+        gettimeofday(&tv,&tz);
+        net_log("%s Sequence numbering reset to %d\n", ctime(&(tv.tv_sec)), u->sequence);
+        log_msg("%s Sequence numbering reset to %d\n", ctime(&(tv.tv_sec)), u->sequence );
+        return 1;
+    }
+
+    return 1;
+}
+
+
+// Receive state, shared by the network thread and the executor handlers
+static int net_sock = -1;
+static unsigned char rxbufs[NET_RECV_BATCH][TELEOP_MAX_DATAGRAM];  // one recvmmsg() worth of datagrams
+static struct u_struct ubatch[NET_RECV_BATCH*TELEOP_COMPACT_MAX_SAMPLES];   // decoded samples
+static struct mmsghdr msgs[NET_RECV_BATCH];
+static struct iovec iovecs[NET_RECV_BATCH];
+static struct timespec rx_stamps[NET_RECV_BATCH*TELEOP_COMPACT_MAX_SAMPLES];   // receive time of each sample in ubatch
+static char ctrlbufs[NET_RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+static struct sockaddr_in srcaddrs[NET_RECV_BATCH];    // sender of each datagram
+static struct u_struct owned[TS_INPUT_SIZE];            // the owning session's samples
+static struct timespec owned_stamps[TS_INPUT_SIZE];
+static int net_jitter_timer = -1;                       // executor mode: next playout / reorder timeout
+
+/**\fn static int networkOpen(void)
+  \brief open the teleop socket and set up the batched receive buffers
+  \return the socket, exits if it cannot be opened
+*/
+static int networkOpen(void)
+{
+    const char *port = SERVER_PORT;
+    int uSize=sizeof(struct u_struct);
 
     // print some status messages
     log_msg("Starting network services...");
     log_msg("  u_struct size: %i",uSize);
+    log_msg("  compact protocol v%d: up to %d samples, %i bytes",
+            TELEOP_COMPACT_VERSION, TELEOP_COMPACT_MAX_SAMPLES, (int)TELEOP_MAX_DATAGRAM);
     log_msg("  Using default port %s",port);
 
-    ///// open log file
-    logFile = open("err_network.log", O_WRONLY | O_CREAT | O_APPEND  | O_NONBLOCK , 0664);
-    if ( logFile < 0 )
-    {
-        ROS_ERROR("ERROR: could not open log file.\n");
-        exit(1);
-    }
-    gettimeofday(&tv,&tz);
-    sprintf(logbuffer, "\n\nOpened log file at %s\n", ctime(&(tv.tv_sec)) );
-    retval = write(logFile,logbuffer, strlen(logbuffer));
+    // err_network.log is written by net_log_process() (net_log.cpp)
 
     /////  open socket
-    sock = initSock(port);
+    int sock = initSock(port);
     if ( sock <= 0)
     {
-        ROS_ERROR("socket: service failed to initialize socket. (%d)\n",logFile);
+        ROS_ERROR("socket: service failed to initialize socket. (%d)\n",sock);
         exit(1);
     }
 
-    ///// setup sendto address
-    memset(&clientName, 0, sizeof(clientName));
-    clientName.sin_family = AF_INET;
-    inet_aton(SERVER_ADDR, &clientName.sin_addr);
-    clientName.sin_port = htons((u_short)atoi(port));
+    ///// setup batched receive buffers
+    memset(msgs, 0, sizeof(msgs));
+    for (int m = 0; m < NET_RECV_BATCH; m++)
+    {
+        iovecs[m].iov_base = rxbufs[m];
+        iovecs[m].iov_len = sizeof(rxbufs[m]);
+        msgs[m].msg_hdr.msg_iov = &iovecs[m];
+        msgs[m].msg_hdr.msg_iovlen = 1;
+        msgs[m].msg_hdr.msg_control = ctrlbufs[m];
+        msgs[m].msg_hdr.msg_name = &srcaddrs[m];
+    }
+
+    log_msg("Network layer ready.");
+    net_sock = sock;
+    return sock;
+}
+
+/**\fn static int networkReceive(void)
+  \brief drain the socket and file each datagram's samples under its sender's session
+  \return number of datagrams read
+*/
+static int networkReceive(void)
+{
+    static unsigned int bad_crc = 0;
+    struct u_struct samples[TELEOP_COMPACT_MAX_SAMPLES];
+    struct timeval tv;
+    struct timezone tz;
+    struct timespec tnow;
+
+    // Drain everything that is queued in one syscall
+    for (int m = 0; m < NET_RECV_BATCH; m++)
+    {
+        msgs[m].msg_hdr.msg_controllen = sizeof(ctrlbufs[m]);
+        msgs[m].msg_hdr.msg_namelen = sizeof(srcaddrs[m]);
+    }
+    int nrecv = recvmmsg(net_sock, msgs, NET_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (nrecv < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror("recvmmsg");
+        nrecv = 0;
+    }
+
+    for (int m = 0; m < nrecv; m++)
+    {
+        // Legacy u_struct or compact multi-sample packet
+        int nsamples = decodeTeleopPacket(rxbufs[m], msgs[m].msg_len, samples, TELEOP_COMPACT_MAX_SAMPLES);
+        if (nsamples == TELEOP_BAD_CRC){
+            // Corrupted (or unsealed, with /teleop_require_crc) packet: drop it
+            if (bad_crc++ % 100 == 0)
+            {
+                gettimeofday(&tv,&tz);
+                net_log("%s Bad checksum -> rejected packet (%u so far)\n", ctime(&(tv.tv_sec)), bad_crc);
+                ROS_ERROR("%s Bad checksum -> rejected packet (%u so far)\n", ctime(&(tv.tv_sec)), bad_crc );
+            }
+            continue;
+        }
+        if (nsamples < 0){
+            ROS_ERROR("ERROR: Rec'd wrong ustruct size on socket!\n");
+            continue;
+        }
+
+        // File the samples under their sender's session
+        struct timespec stamp;
+        getRxStamp(&msgs[m].msg_hdr, &stamp);
+        clock_gettime(CLOCK_MONOTONIC, &tnow);
+        teleopSessionInput(&srcaddrs[m], samples, nsamples, &stamp, &tnow);
+    }
+    return nrecv;
+}
+
+/**\fn static void networkRelease(void)
+  \brief feed the owning session's samples to the reorder window and apply those that are due
+*/
+static void networkRelease(void)
+{
+    static int k = 0;
+    struct timespec tnow;
+
+    // Only the session that owns the robot feeds the reorder window
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    int nowned = teleopSessionDrain(teleopSessionArbitrate(&tnow), owned, owned_stamps, TS_INPUT_SIZE);
+    for (int n = 0; n < nowned; n++)
+    {
+        if (k++ % 2000 == 0)
+            log_msg(".");
 
-    clientLength=sizeof(clientName);
+        checkSequence(&owned[n], &owned_stamps[n]);
+    }
+
+    // Apply the samples that are in order and due, under a single lock
+    teleopJitterPoll(&tnow);
+    int nready = teleopJitterRelease(ubatch, rx_stamps, NET_RECV_BATCH*TELEOP_COMPACT_MAX_SAMPLES, &tnow);
+    if (nready <= 0)
+        return;
+    receiveUserspaceBatch(ubatch, rx_stamps, nready);   // coordinates transform from ITP frame to robot 0 frame
+
+    // Receive-to-handoff latency of each sample (the kernel stamp is CLOCK_REALTIME)
+    struct timespec twall;
+    clock_gettime(CLOCK_REALTIME, &twall);
+    for (int n = 0; n < nready; n++)
+    {
+        long long ns = (twall.tv_sec - rx_stamps[n].tv_sec) * 1000000000LL + (twall.tv_nsec - rx_stamps[n].tv_nsec);
+        metricObserve(MH_NET_HANDOFF_US, ns > 0 ? ns / 1000 : 0);
+    }
+}
+
+/**\fn static void networkPollLoop(void)
+  \brief poll mode: non-blocking receive, spinning while datagrams keep coming and backing off once they stop
+
+  After the last datagram the thread spins for /net_spin_us, then sleeps
+  1 us, 2 us, ... up to /net_backoff_max_us between tries, never past the
+  next playout or reorder timeout.  A datagram resets the backoff.
+*/
+static void networkPollLoop(void)
+{
+    struct timespec tnow, tlast, twait;
+    long long backoff_ns = 0;
+
+    if (net_rx_priority > 0)
+    {
+        struct sched_param param;
+        param.sched_priority = net_rx_priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            err_msg("Network thread: could not set realtime priority %d", net_rx_priority);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &tlast);
+    while ( ros::ok() )
+    {
+        int nrecv = networkReceive();
+        clock_gettime(CLOCK_MONOTONIC, &tnow);
+
+        int due = teleopJitterNextEvent(&tnow, &twait);
+        long long wait_ns = due ? twait.tv_sec * 1000000000LL + twait.tv_nsec : -1;
+        if (nrecv > 0 || wait_ns == 0)
+            networkRelease();
+        if (nrecv > 0)
+        {
+            tlast = tnow;
+            backoff_ns = 0;
+            continue;
+        }
+
+        long long idle_ns = (tnow.tv_sec - tlast.tv_sec) * 1000000000LL + (tnow.tv_nsec - tlast.tv_nsec);
+        if (idle_ns < net_spin_ns)
+        {
+            spinPause();
+            continue;
+        }
+
+        backoff_ns = backoff_ns ? std::min(2 * backoff_ns, net_backoff_max_ns) : NET_BACKOFF_MIN_NS;
+        long long sleep_ns = (wait_ns > 0) ? std::min(backoff_ns, wait_ns) : backoff_ns;
+        struct timespec ts = { (time_t)(sleep_ns / 1000000000LL), (long)(sleep_ns % 1000000000LL) };
+        nanosleep(&ts, NULL);
+        networkRelease();   // session timeouts, and anything that fell due while asleep
+    }
+}
+
+/**\fn void* network_process(void*)
+  \brief This function receives and reads the udp package from the network in realtime, executed as an rt thread in rt_process_preempt.cpp 
+  \param param1 void pointer
+  \return void 
+*/
+void* network_process(void* param1)
+{
+    int sock;              // sockets.
+    int nfound, maxfd;
+    fd_set rmask, mask;
+    static struct timeval timeout = { 0, 500000 }; // .5 sec //
+    struct timespec tnow, twait;
+
+    if (executorActive())
+        return NULL;        // networkReactorAttach()
+
+    set_thread_affinity(ROLE_NETWORK);
+    sock = networkOpen();
+
+    if (net_rx_poll)
+        networkPollLoop();      // until shutdown
 
     ///// initialize data polling
     FD_ZERO(&mask);            // initialize a descriptor set fdset mask to the null set
     FD_SET(sock, &mask);       // add the descriptor sock in fdset mask
     maxfd=sock;
 
-    log_msg("Network layer ready.");
-
-    ///// Main read/write loop
-    while ( ros::ok() )
+    ///// Main read/write loop, select mode
+    while ( !net_rx_poll && ros::ok() )
     {
         rmask = mask;
         timeout.tv_sec = 2;  // hack:reset timer after timeout event.
         timeout.tv_usec = 0; //        ""
 
+        // Wake up early for the next playout / reorder timeout
+        clock_gettime(CLOCK_MONOTONIC, &tnow);
+        if (teleopJitterNextEvent(&tnow, &twait))
+        {
+            timeout.tv_sec = twait.tv_sec;
+            timeout.tv_usec = (twait.tv_nsec + 999) / 1000;
+        }
+
         // wait for i/o lines to change state //
         // Select() examines the I/O descriptor sets whose addresses are passed in fe_sets and returns the total number of ready descriptors in all the sets
         nfound = select(maxfd+1, &rmask, (fd_set *)0, (fd_set *)0, &timeout);
@@ -233,108 +576,97 @@ void* network_process(void* param1)
             break;
         }
 
-        // Select timeout: nothing to do
+        // Select timeout: nothing to read
         if (nfound == 0)
-        {
             fflush(stdout);
-            continue;
-        }
 
         // Select: data on socket
         if (FD_ISSET( sock, &rmask))   // check whether the diescriptor sock is added to the fdset mask
-        {
-            bytesread = recvfrom(sock,
-                                 &u,
-                                 uSize,
-                                 0,
-                                 NULL,
-                                 NULL);
-            if (bytesread != uSize){
-                ROS_ERROR("ERROR: Rec'd wrong ustruct size on socket!\n");
-                FD_CLR(sock, &rmask);   // remove the descriptor sock from fdset rmask
-                continue;
-            }
+            networkReceive();
 
-            if (k++ % 2000 == 0)
-                log_msg(".");
-
-//
-//            if (u.checksum != UDPChecksum(&u))   // Check checksum
-//            {
-//                gettimeofday(&tv,&tz);
-//                sprintf(logbuffer, "%s Bad Checksum -> rejected packet\n", ctime(&(tv.tv_sec)) );
-//                ROS_ERROR("%s Bad Checksum -> rejected packet\n", ctime(&(tv.tv_sec)) );
-//                retval = write(logFile,logbuffer, strlen(logbuffer));
-//
-//            }
-//            else
-            if (u.sequence == 0)        // Zero seqnum means reflect packet to sender
-            {
-                gettimeofday(&tv,&tz);
-                sprintf(logbuffer, "%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)) );
-                log_msg("%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)) );
-
-                retval = write(logFile,logbuffer, strlen(logbuffer));
-
-            }
-            else if (u.sequence > seq+1)    // Skipping sequence number (dropped)
-            {
-                gettimeofday(&tv,&tz);
-                sprintf(logbuffer, "%s Skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)),seq+1, u.sequence-1 );
-                ROS_ERROR("%s Skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)),seq+1, u.sequence-1 );
-                retval = write(logFile,logbuffer, strlen(logbuffer));
-                seq = u.sequence;
-
-                // TODO:: should this include a "receiveUserspace" call?
-
-            }
-            else if (u.sequence == seq)     // Repeated sequence number
-            {
-                gettimeofday(&tv,&tz);
-                sprintf(logbuffer, "%s Duplicated packet %d - %d\n", ctime(&(tv.tv_sec)),seq, u.sequence );
-                ROS_ERROR("%s Duplicated packet %d - %d\n", ctime(&(tv.tv_sec)),seq, u.sequence );
-                retval = write(logFile,logbuffer, strlen(logbuffer));
-
-            }
-
-            else if (u.sequence > seq)       // Valid packet
-            {
-                seq = u.sequence;
-                receiveUserspace(&u,uSize);   // coordinates transform from ITP frame to robot 0 frame
-            }
-
-
-            // TODO: reset sequence should not be 'else if'  (maybe?)
-            else if (seq > 1000 && u.sequence < seq-1000)       // reset sequence(skipped more than 1000 packets)
-            {
-                gettimeofday(&tv,&tz);
-                sprintf(logbuffer, "%s Sequence numbering reset from %d to %d\n", ctime(&(tv.tv_sec)),seq, u.sequence );
-                log_msg("%s Sequence numbering reset from %d to %d\n", ctime(&(tv.tv_sec)),seq, u.sequence );
-                seq = u.sequence;
-                retval = write(logFile,logbuffer, strlen(logbuffer));
-            }
-            else
-            {
-                gettimeofday(&tv,&tz);
-                sprintf(logbuffer, "%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)),seq );
-                ROS_ERROR("%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)),seq );
-                retval = write(logFile,logbuffer, strlen(logbuffer));
-            }
-        }
+        networkRelease();
 
 #ifdef NET_SEND
+        struct sockaddr_in clientName;
+        memset(&clientName, 0, sizeof(clientName));
+        clientName.sin_family = AF_INET;
+        inet_aton(SERVER_ADDR, &clientName.sin_addr);
+        clientName.sin_port = htons((u_short)atoi(SERVER_PORT));
         sendto ( sock, (void*)&v, vSize, 0,
-                 (struct sockaddr *) &clientName, clientLength);
+                 (struct sockaddr *) &clientName, sizeof(clientName));
 #endif
 
     } // end while(ros::ok())
 
     close(sock);
+    net_sock = -1;
 
     log_msg("Network socket is shutdown.");
     return(NULL);
 } // main - server.c //
 
+/**\fn static void networkArmJitterTimer(void)
+  \brief executor mode: wake for the reorder window's next playout / reorder timeout, if any
+*/
+static void networkArmJitterTimer(void)
+{
+    struct timespec tnow, twait;
+
+    clock_gettime(CLOCK_MONOTONIC, &tnow);
+    if (teleopJitterNextEvent(&tnow, &twait))
+    {
+        long long ns = twait.tv_sec * 1000000000LL + twait.tv_nsec;
+        execTimerArm(net_jitter_timer, ns > 0 ? ns : 1, 0);
+    }
+    else
+        execTimerArm(net_jitter_timer, 0, 0);
+}
+
+/**\fn static void networkReadable(void *)
+  \brief executor mode: datagrams on the socket
+*/
+static void networkReadable(void *)
+{
+    networkReceive();
+    networkRelease();
+    networkArmJitterTimer();
+}
+
+/**\fn static void networkJitterDue(void *)
+  \brief executor mode: a playout or reorder timeout is due
+*/
+static void networkJitterDue(void *)
+{
+    networkRelease();
+    networkArmJitterTimer();
+}
+
+/**\fn int networkReactorAttach(int lane)
+  \brief executor mode: open the teleop socket and receive on a reactor instead of network_process()
+  \param lane executor lane
+  \return 0, -1 on failure
+*/
+int networkReactorAttach(int lane)
+{
+    int sock = networkOpen();
+    net_jitter_timer = execTimer(lane, networkJitterDue, NULL);
+    if (net_jitter_timer < 0 || execWatchFd(lane, sock, networkReadable, NULL) < 0)
+        return -1;
+    return 0;
+}
+
+/**\fn void networkReactorDetach(void)
+  \brief executor mode, once the reactors have stopped: close the socket
+*/
+void networkReactorDetach(void)
+{
+    if (net_sock < 0)
+        return;
+    close(net_sock);
+    net_sock = -1;
+    log_msg("Network socket is shutdown.");
+}
+
 
 
 
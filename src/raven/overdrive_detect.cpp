@@ -27,19 +27,133 @@
  * 5/06 Modified by Hawkeye King
  */
 
+#include <math.h>
 #include "overdrive_detect.h"
+#include "joint_block.h"
+#include "metrics.h"
 
+extern int NUM_MECH; //Defined in globals.cpp
+extern unsigned long int gTime;//Defined in globals.cpp
 extern struct DOF_type DOF_types[];//Defined in globals.cpp
-extern int NUM_MECH; //Defined in rt_process_preempt.cpp
-extern int soft_estopped;//Defined in rt_process_preempt.cpp
-extern unsigned long int gTime;//Defined in rt_process_preempt.cpp
+
+/*
+ * I^2 t protection.  Each joint type's motor heats with the square of its
+ * current and cools with time constant tau, to first order:
+ *
+ *   heat += (i^2 - heat) * dt / tau
+ *
+ * so heat (A^2) is the running mean square current over about tau, and
+ * settles at i^2 under a steady current.  Below thermal_warn * i_cont^2 the
+ * command is limited by DAC_max alone.  From there to i_cont^2 the allowed
+ * current falls smoothly from i_max to i_cont, which the motor can carry
+ * for good, so a motor driven past it settles at the limit instead of
+ * being cut off.  One update per joint and cycle, nothing to rescan.
+ *
+ * Motors are taken to start cold.
+ */
+struct thermal_model
+{
+	double heat[JB_N_JOINTS];       // A^2
+	float alpha[JB_N_JOINTS];       // dt / tau; 0 (no model) until init_thermal_model()
+	int derated[JB_N_JOINTS];       // limited below DAC_max by the model
+};
+
+static struct thermal_model thermal;
+static float thermal_warn = 0.8;    // fraction of i_cont^2 where derating starts
+
+/**\fn static inline int thermalDACLimit(int type)
+ * \brief largest |current_cmd| the I^2 t model allows this cycle
+ */
+static inline int thermalDACLimit(int type)
+{
+	const struct DOF_type *_dof = &DOF_types[type];
+	float i_cont2 = _dof->i_cont * _dof->i_cont;
+
+	if (thermal.alpha[type] == 0 || i_cont2 <= 0)
+		return MAX_INST_DAC;
+	float k = (thermal.heat[type] - thermal_warn * i_cont2) / ((1 - thermal_warn) * i_cont2);
+	if (k <= 0)
+		return MAX_INST_DAC;
+	if (k > 1)
+		k = 1;
+	float s = k * k * (3 - 2 * k);
+	float i_allow = _dof->i_max - (_dof->i_max - _dof->i_cont) * s;
+	return (int)(i_allow * fabsf(_dof->DAC_per_amp));
+}
+
+/**\fn static inline void thermalStep(int type, int cmd)
+ * \brief heat the joint type's motor with this cycle's command
+ */
+static inline void thermalStep(int type, int cmd)
+{
+	float dac_per_amp = DOF_types[type].DAC_per_amp;
+	if (dac_per_amp == 0)
+		return;
+	float i = cmd / dac_per_amp;
+	thermal.heat[type] += thermal.alpha[type] * (i * i - thermal.heat[type]);
+}
+
+/**\fn float thermalLoad(int type)
+ * \brief the joint type's I^2 t heat as a fraction of its continuous rating (1: at the limit)
+ */
+float thermalLoad(int type)
+{
+	float i_cont = DOF_types[type].i_cont;
+	return (i_cont > 0) ? thermal.heat[type] / (i_cont * i_cont) : 0;
+}
+
+/**\fn int init_thermal_model(ros::NodeHandle &n)
+ * \brief read the I^2 t parameters and start the model
+ *
+ *   /thermal_protection   on by default
+ *   /thermal_tau_big_s    thermal time constant of the RE40s (shoulder, elbow, insertion), s
+ *   /thermal_tau_small_s  of the RE30s (tool joints), s
+ *   /thermal_warn         fraction of the continuous rating where derating starts
+ *
+ * \return 0
+ */
+int init_thermal_model(ros::NodeHandle &n)
+{
+	bool on;
+	double tau_big, tau_small, warn;
+	n.param("/thermal_protection", on, true);
+	n.param("/thermal_tau_big_s", tau_big, 41.6);
+	n.param("/thermal_tau_small_s", tau_small, 16.3);
+	n.param("/thermal_warn", warn, 0.8);
+
+	if (warn <= 0 || warn >= 1)
+	{
+		err_msg("Invalid thermal_warn %g.  Using 0.8.", warn);
+		warn = 0.8;
+	}
+	thermal_warn = warn;
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		int j = t % MAX_DOF_PER_MECH;
+		double tau = (j == SHOULDER || j == ELBOW || j == Z_INS) ? tau_big : tau_small;
+		thermal.heat[t] = 0;
+		thermal.derated[t] = 0;
+		thermal.alpha[t] = (on && tau > 0) ? STEP_PERIOD / tau : 0;
+	}
+
+	if (on)
+		log_msg("I2t protection: tau %.1f s / %.1f s, derating from %.0f%% of continuous", tau_big, tau_small, warn * 100);
+	else
+		log_msg("I2t protection: off");
+	return 0;
+}
 
 /**\fn int overdriveDetect(struct device *device0)
- * \brief detect over current
+ * \brief detect over current and assemble the outgoing DAC packets
  * \param device0 pointer to robot_device struct defined in DS0.h
  * This function loops through all active joints to detect currrent situations
  * that could cause overheating, it checks joint current_cmd against MAX_INST_DAC that is
- * defined in defines.h
+ * defined in defines.h, and limits it to DAC_max and to what the I^2 t model
+ * allows.  The model is then stepped with the command that goes out.
+ *
+ * The killed / clipped command is packed (offset to midrange, little endian)
+ * straight into the board's persistent DAC packet (dacPacket()) in the same
+ * pass.  current_cmd itself is left as the controller wrote it.
  */
 int overdriveDetect(struct device *device0)
 {
@@ -49,35 +163,72 @@ int overdriveDetect(struct device *device0)
 
 
     for (i = 0; i < NUM_MECH; i++)
-        for (j = 0; j < (MAX_DOF_PER_MECH-1); j++)
+    {
+        unsigned char *packet = dacPacket(i);
+        packet[0] = DAC;                 //Type of USB packet
+        packet[1] = MAX_DOF_PER_MECH;    //Number of DAC channels
+
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
         {
             _joint = &(device0->mech[i].joint[j]);
-            int _dac_max = DOF_types[_joint->type].DAC_max;
+            int cmd = _joint->current_cmd;
+            int _dac_max = jblock.dac_max[_joint->type];
+            int _therm_max = thermalDACLimit(_joint->type);
 
-            // Kill current if greater than MAX_INST_DAC.  Probably indicates a problem.
-            if (abs(_joint->current_cmd) > MAX_INST_DAC)
+            // The last channel is packed but not checked
+            if (j < MAX_DOF_PER_MECH-1)
             {
-                log_msg("Instant i command too high. Joint type: %d DAC:%d \t tau:%0.3f\n", _joint->type, _joint->current_cmd, _joint->tau_d);
-                _joint->current_cmd = 0;
-                ret = TRUE;
-            }
+                // Kill current if greater than MAX_INST_DAC.  Probably indicates a problem.
+                if (abs(cmd) > MAX_INST_DAC)
+                {
+                    log_msg("Instant i command too high. Joint type: %d DAC:%d \t tau:%0.3f\n", _joint->type, cmd, _joint->tau_d);
+                    cmd = 0;
+                    ret = TRUE;
+                }
 
-            else if ( _joint->current_cmd > _dac_max )
-            {
-                //Clip current to max_torque
-                if (gTime %100 == 0)
-                    err_msg("Joint type %d is current clipped high (%d) at DAC:%d\n", _joint->type, _dac_max, _joint->current_cmd);
-                _joint->current_cmd = _dac_max;
-            }
+                else if ( _therm_max < _dac_max && abs(cmd) > _therm_max )
+                {
+                    // Derated by the I^2 t model
+                    if (!thermal.derated[_joint->type])
+                        err_msg("Joint type %d is thermally derated (I2t at %.0f%% of continuous), DAC limited to %d\n",
+                                _joint->type, thermalLoad(_joint->type) * 100, _therm_max);
+                    thermal.derated[_joint->type] = 1;
+                    cmd = (cmd > 0) ? _therm_max : -_therm_max;
+                }
 
-            else if ( _joint->current_cmd < _dac_max*-1 )
-            {
-                //Clip current to -1*max_torque
-                if (gTime %100 == 0)
-                    err_msg("Joint type %d is current clipped low (%d) at DAC:%d\n", _joint->type, _dac_max*-1,  _joint->current_cmd);
-                _joint->current_cmd = _dac_max*-1;
+                else if ( cmd > _dac_max )
+                {
+                    //Clip current to max_torque
+                    if (gTime % MS_TO_TICKS(100) == 0)
+                        err_msg("Joint type %d is current clipped high (%d) at DAC:%d\n", _joint->type, _dac_max, cmd);
+                    metricInc(MC_CURRENT_CLIPS);
+                    cmd = _dac_max;
+                }
+
+                else if ( cmd < _dac_max*-1 )
+                {
+                    //Clip current to -1*max_torque
+                    if (gTime % MS_TO_TICKS(100) == 0)
+                        err_msg("Joint type %d is current clipped low (%d) at DAC:%d\n", _joint->type, _dac_max*-1,  cmd);
+                    metricInc(MC_CURRENT_CLIPS);
+                    cmd = _dac_max*-1;
+                }
+
+                if (thermal.derated[_joint->type] && _therm_max >= _dac_max)
+                {
+                    log_msg("Joint type %d thermal derating ended (I2t at %.0f%% of continuous)\n",
+                            _joint->type, thermalLoad(_joint->type) * 100);
+                    thermal.derated[_joint->type] = 0;
+                }
+                thermalStep(_joint->type, cmd);
             }
+
+            //Factor in offset since we are in midrange operation
+            unsigned short dac = (unsigned short)(cmd + DAC_OFFSET);
+            packet[2*j+2] = (unsigned char)(dac);
+            packet[2*j+3] = (unsigned char)(dac >> 8);
         }
+    }
 
     return ret;
 }
@@ -37,21 +37,29 @@
 #include "utils.h"
 #include "t_to_DAC_val.h"
 #include "homing.h"
+#include "joint_block.h"
+#include "arm_pipeline.h"
 
-extern struct DOF_type DOF_types[];
 extern unsigned long int gTime;
 
+/**
+ * mpos_PD_control() - PD (plus I) control of one joint's motor position
+ *
+ *  The joint's lane of jointPIDBatch() without feedforward: the gains,
+ * the integral and the anti-windup limit are the ones in jblock.
+ */
 void mpos_PD_control(struct DOF *joint, int reset_I)
 {
     float err=0.0;
     float errVel=0.0;
-    static float errInt[MAX_MECH*MAX_DOF_PER_MECH] = {0};
     float pTerm=0.0, vTerm=0.0, iTerm = 0.0;
     float friction_feedforward = 0.0;
 
-    float kp = DOF_types[joint->type].KP;
-    float kd = DOF_types[joint->type].KD;
-    float ki = DOF_types[joint->type].KI;
+    int t = joint->type;
+    float kp = jblock.kp.s[t];
+    float kd = jblock.kd.s[t];
+    float ki = jblock.ki.s[t];
+    float tau_max = jblock.tau_max.s[t];
 
     /* PD CONTROL LAW */
 
@@ -66,13 +74,22 @@ void mpos_PD_control(struct DOF *joint, int reset_I)
     vTerm = errVel * kd;
 
     //Calculate integral
+    float errInt = jblock.err_int.s[t];
     if (reset_I)
-        errInt[joint->type]= 0;
+        jblock.err_int.s[t] = 0;
     else
-        errInt[joint->type] += err * ONE_MS;
+        jblock.err_int.s[t] += err * STEP_PERIOD;
 
     //Calculate integral term
-    iTerm = errInt[joint->type] * ki;
+    iTerm = jblock.err_int.s[t] * ki;
+
+    //Anti-windup: in saturation, don't integrate further into it
+    float tau = pTerm + vTerm + iTerm;
+    if (!reset_I && tau_max > 0 && tau * tau >= tau_max * tau_max && ki * err * tau > 0)
+    {
+        jblock.err_int.s[t] = errInt;
+        iTerm = errInt * ki;
+    }
 
     //Calculate feedforward friction term
 //    errSign = err < 0 ? -1 : 1;
@@ -87,28 +104,113 @@ void mpos_PD_control(struct DOF *joint, int reset_I)
     joint->tau_d = pTerm + vTerm +iTerm + friction_feedforward;
 }
 
+/**
+ * jointPIDBatch() - PD/PID control law over every lane of a joint block
+ *
+ *   tau_d = kp (mpos_d - mpos) + kd (mvel_d - mvel) + ki err_int [+ tau_ff]
+ *
+ *  All state is in the block: err_int is integrated here, and is held
+ * (conditional integration) on a lane whose command is at the DAC limit
+ * tau_max with the error pushing it further.  Lanes with no joint or no
+ * gains come out as 0 (plus their feedforward).
+ *
+ * \param jb     the block, with mpos, mvel, the setpoints and tau_ff filled in
+ * \param flags  PID_RESET_I to zero the integral, PID_FEEDFORWARD to add tau_ff
+ */
+void jointPIDBatch(struct joint_block *jb, int flags)
+{
+    jb_vf dt = jbSplat(STEP_PERIOD);
+    jb_vf zero = jbSplat(0);
+    for (int v = JB_MECH_VEC(mechFirst()); v < JB_MECH_VEC(mechEnd()); v++)
+    {
+        jb_vf err    = jb->mpos_d.v[v] - jb->mpos.v[v];
+        jb_vf errVel = jb->mvel_d.v[v] - jb->mvel.v[v];
+        jb_vf pd     = err * jb->kp.v[v] + errVel * jb->kd.v[v];
+
+        if (flags & PID_RESET_I)
+        {
+            jb->err_int.v[v] = zero;
+            jb->tau_d.v[v] = pd + jb->err_int.v[v] * jb->ki.v[v];
+        }
+        else
+        {
+            jb_vf errInt = jb->err_int.v[v] + err * dt;
+            jb_vf tau    = pd + errInt * jb->ki.v[v];
+            jb_vf total  = (flags & PID_FEEDFORWARD) ? tau + jb->tau_ff.v[v] : tau;
+            jb_vf lim    = jb->tau_max.v[v];
+
+            jb_vi hold = (lim > zero) & (total * total >= lim * lim) & (jb->ki.v[v] * err * total > zero);
+            jb->err_int.v[v] = jbSelect(hold, jb->err_int.v[v], errInt);
+            jb->tau_d.v[v]   = jbSelect(hold, pd + jb->err_int.v[v] * jb->ki.v[v], tau);
+        }
+
+        if (flags & PID_FEEDFORWARD)
+            jb->tau_d.v[v] += jb->tau_ff.v[v];
+    }
+}
+
+/**
+ * mpos_PD_control_all() - mpos_PD_control() on every joint in one pass
+ *
+ *  Gathers the motor positions and setpoints (and tau_g, as the
+ * feedforward, for add_gravity) from the jblock views of the device,
+ * runs jointPIDBatch(), and writes tau_d back.
+ *
+ * \param device0 pointer to device structure, the one jblock is bound to
+ * \param reset_I zero the integral instead of accumulating it
+ * \param add_gravity add tau_g to tau_d, inside the anti-windup limit
+ */
+void mpos_PD_control_all(struct device *device0, int reset_I, int add_gravity)
+{
+    struct joint_block *jb = &jblock;
+    int t0 = JB_MECH_LANE(mechFirst()), t1 = JB_MECH_LANE(mechEnd());
+
+    for (int t = t0; t < t1; t++)
+    {
+        struct DOF *_joint = jb->dof[t];
+        if (!_joint)
+            continue;
+        jb->mpos.s[t]   = _joint->mpos;
+        jb->mvel.s[t]   = _joint->mvel;
+        jb->mpos_d.s[t] = _joint->mpos_d;
+        jb->mvel_d.s[t] = _joint->mvel_d;
+        jb->tau_ff.s[t] = add_gravity ? _joint->tau_g : 0;
+    }
+
+    jointPIDBatch(jb, (reset_I ? PID_RESET_I : 0) | (add_gravity ? PID_FEEDFORWARD : 0));
+
+    for (int t = t0; t < t1; t++)
+        if (jb->dof[t])
+            jb->dof[t]->tau_d = jb->tau_d.s[t];
+}
+
+// Velocity loop gains of each joint, by position in the mechanism.
+// Gains have been "empirically" tuned.
+static const float jvel_kv[MAX_DOF_PER_MECH] = {
+    (0.528/(15 DEG2RAD)),   // SHOULDER
+    (0.528/(15 DEG2RAD)),   // ELBOW
+    (0.400/0.1),            // Z_INS
+    0,                      // NO_CONNECTION
+    (0.005/(15 DEG2RAD)),   // TOOL_ROT
+    0,                      // WRIST
+    0,                      // GRASP1
+    0                       // GRASP2
+};
+
 /**
 *    jointVelControl()
 *       Move joints at constant rate.
+*
+*  The velocity error integral is the joint's jblock.jvel_int lane.
 */
 float jvel_PI_control(struct DOF *_joint, int resetI){
-    // Set gains.  Gains have been "empirically" tuned.
-    // TODO: move this to a permanent place.
+    int t = _joint->type;
+    float kv = jvel_kv[t % MAX_DOF_PER_MECH];
     float ki;
-    float kv[MAX_MECH * MAX_DOF_PER_MECH]  = {0};
-    kv[SHOULDER_GOLD] = kv[SHOULDER_GREEN] = (0.528/(15 DEG2RAD));
-    kv[ELBOW_GOLD]    = kv[ELBOW_GREEN]    = (0.528/(15 DEG2RAD));
-    kv[Z_INS_GOLD]    = kv[Z_INS_GREEN]    = (0.400/0.1);
-    kv[TOOL_ROT_GOLD] = kv[TOOL_ROT_GREEN] = (0.005/(15 DEG2RAD));
-    kv[WRIST_GOLD]    = kv[WRIST_GREEN]    = 0;
-    kv[GRASP1_GOLD]   = kv[GRASP1_GREEN]   = 0;
-    kv[GRASP2_GREEN]  = kv[GRASP2_GREEN]   = 0;
-
-    static float jVelIntErr[MAX_MECH * MAX_DOF_PER_MECH];  // Integral of velocity error
 
     // Reset integral term
     if (resetI){
-        jVelIntErr[_joint->type] = 0;
+        jblock.jvel_int.s[t] = 0;
         return 0;
     }
     float jVelErr;
@@ -119,13 +221,12 @@ float jvel_PI_control(struct DOF *_joint, int resetI){
     else
         jVelErr = _joint->jvel_d - _joint->jvel;
 
-    // Integrate error over 1ms
-    jVelIntErr[_joint->type] += jVelErr * ONE_MS;
-    ki = kv[_joint->type] * 0.1 * 0;
+    // Integrate error over one control period
+    jblock.jvel_int.s[t] += jVelErr * STEP_PERIOD;
+    ki = kv * 0.1 * 0;
 
     // Calculate PI velocity control
-    _joint->tau_d = ( kv[_joint->type]*jVelErr + ki*jVelIntErr[_joint->type] );
+    _joint->tau_d = ( kv*jVelErr + ki*jblock.jvel_int.s[t] );
 
-    return jVelIntErr[_joint->type];
+    return jblock.jvel_int.s[t];
 }
-
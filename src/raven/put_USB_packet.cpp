@@ -24,12 +24,32 @@
 
 #include "put_USB_packet.h"
 #include "USB_init.h"
+#include "usb_workers.h"
 #include "update_atmel_io.h"
 #include "parallel.h"
+#include "metrics.h"
 
 extern unsigned long int gTime;
 extern USBStruct USBBoards;
 
+// Driver-ready DAC packets, one per board, filled by overdriveDetect()
+struct dac_packet
+{
+    unsigned char buf[OUT_LENGTH];
+} __attribute__((aligned(64)));
+
+static struct dac_packet dac_packets[MAX_MECH];
+
+/**\fn unsigned char *dacPacket(int m)
+  \brief the persistent outgoing packet for mechanism / board index m
+  \param m mechanism index
+  \return pointer to OUT_LENGTH bytes
+*/
+unsigned char *dacPacket(int m)
+{
+    return dac_packets[m].buf;
+}
+
 /**\fn void putUSBPackets(struct device *device0)
   \brief Takes data from robot to send to USB board(s)
   \struct device  
@@ -38,10 +58,16 @@ extern USBStruct USBBoards;
 
 void putUSBPackets(struct device *device0)
 {
+    if (usbWorkersActive())
+    {
+        usbWorkersRun(USB_JOB_WRITE, NULL);
+        return;
+    }
+
     //Loop through all USB Boards
     for (int i = 0; i < USBBoards.activeAtStart; i++)
     {
-        if (putUSBPacket(USBBoards.boards[i], &(device0->mech[i])) == -USB_WRITE_ERROR)
+        if (putUSBPacket(USBBoards.boards[i], &(device0->mech[i]), dacPacket(i)) == -USB_WRITE_ERROR)
 	  {
 	    //            log_msg("Error writing to USB Board %d!\n", USBBoards.boards[i]);
 	  }
@@ -49,41 +75,25 @@ void putUSBPackets(struct device *device0)
 }
 
 
-/**\fn int putUSBPacket(int id, struct mechanism *mech)
-  \brief Takes data from mech struct and uses it to fill a USB
- *   packet on specified board
-  \struct mechanism the data structure to get data from
-  \param mech pointer to mechanism struct
+/**\fn int putUSBPacket(int id, struct mechanism *mech, unsigned char *packet)
+  \brief Sends a board's DAC packet, as assembled by overdriveDetect(),
+ *   with the mechanism's current output pins.
+  \struct mechanism the data structure to get the output pins from
   \param id the usb board id number (serial#)
+  \param mech pointer to mechanism struct
+  \param packet the board's packet (dacPacket())
   \return success of the operation
 */
 
-int putUSBPacket(int id, struct mechanism *mech)
+int putUSBPacket(int id, struct mechanism *mech, unsigned char *packet)
 {
-    int i = 0;
-    unsigned char buffer_out[MAX_OUT_LENGTH];
-
-    buffer_out[0]= DAC;        //Type of USB packet
-    buffer_out[1]= MAX_DOF_PER_MECH; //Number of DAC channels
-
-    for (i = 0; i < MAX_DOF_PER_MECH; i++)
-    {
-        //Factor in offset since we are in midrange operation
-        mech->joint[i].current_cmd += DAC_OFFSET;
-
-        buffer_out[2*i+2] = (char)(mech->joint[i].current_cmd);
-        buffer_out[2*i+3] = (char)(mech->joint[i].current_cmd >> 8);
-
-        //Remove offset
-        mech->joint[i].current_cmd -= DAC_OFFSET;
-    }
-
     // Set PortF outputs
-    buffer_out[OUT_LENGTH-1] = mech->outputs;
+    packet[OUT_LENGTH-1] = mech->outputs;
 
     //Write the packet to the USB Driver
-    if (usb_write(id, &buffer_out, OUT_LENGTH )!= OUT_LENGTH)
+    if (usb_write(id, packet, OUT_LENGTH )!= OUT_LENGTH)
     {
+        metricInc(MC_USB_WRITE_ERRORS);
         return -USB_WRITE_ERROR;
     }
 
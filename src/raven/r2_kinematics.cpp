@@ -28,13 +28,21 @@
 
 #include <iostream>
 #include <math.h>
+#include <cmath>
+#include <string.h>
+#include <algorithm>
+#include <string>
 #include <ros/ros.h>
 
 #include "r2_kinematics.h"
+#include "rigid_math.h"
+#include "workspace_map.h"
 #include "log.h"
 #include "tool.h"
 #include "local_io.h"
 #include "defines.h"
+#include "metrics.h"
+#include "arm_pipeline.h"
 
 extern int NUM_MECH;
 extern struct DOF_type DOF_types[];
@@ -67,9 +75,102 @@ double robot_thetas[2][6] = {{V,    V,    M_PI/2,     V,   V,      V},
 
 
 int printIK = 0;
+__thread int ik_quiet = 0;      // set on threads that solve many poses: no check_solutions() report
+
+// Solve last cycle's IK branch alone while it stays close (see warmStartIK())
+static bool ik_warm_start = true;
+static int  ik_branch[MAX_MECH];         // per mechanism, -1: none yet (init_kinematics())
+
+// Damped least-squares fallback when inv_kin() has no solution near the current joints
+static bool   ik_dls_fallback = false;
+static double ik_dls_damping  = 0.01;
+
+// Reuse last cycle's joint setpoints while the commanded pose holds still
+static bool ik_skip_idle = true;
+#define IK_IDLE_R_EPS 1e-7
+
+// Clip targets to the precomputed workspace (workspace_map.h) before IK
+static bool ik_workspace_clip = true;
+
+// Precision of fwd_kin() and inv_kin_simd(), see validateKinPrecision()
+static kin_precision kin_prec = KIN_DOUBLE;
+#define KIN_VALIDATE_GRID 4     // cells per joint over the limits: 4^6 joint positions per arm
+
 void print_btVector(btVector3 vv);
-int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx, double &out_err);
-int apply_joint_limits(double *Js, double *Js_sat);
+
+/**\fn static void selectKinPrecision(const std::string &mode, double pos_tol, double rot_tol)
+ * \brief validate the float kernels and choose the precision /kin_precision asks for
+ * \param mode "double", "float", or "auto": float if it stays within the tolerances
+ * \param pos_tol worst position error allowed (m)
+ * \param rot_tol worst rotation error allowed (rad)
+ */
+static void selectKinPrecision(const std::string &mode, double pos_tol, double rot_tol)
+{
+	kin_prec = KIN_DOUBLE;
+	if (mode == "double")
+	{
+		log_msg("Kinematics: double precision");
+		return;
+	}
+	if (mode != "float" && mode != "auto")
+		err_msg("Kinematics: unknown kin_precision \"%s\", validating for auto", mode.c_str());
+
+	kin_precision_report r;
+	validateKinPrecision(KIN_VALIDATE_GRID, r);
+	double pos_err = std::max(r.fk_pos_err, r.ik_pos_err);
+	double rot_err = std::max(r.fk_rot_err, r.ik_rot_err);
+	bool fits = (r.ik_mismatch == 0 && pos_err <= pos_tol && rot_err <= rot_tol);
+	log_msg("Kinematics: float vs double over %d joint positions: FK %.3f um %.2e rad, IK %.3f um %.2e rad, %d IK mismatches",
+			r.samples, r.fk_pos_err * 1e6, r.fk_rot_err, r.ik_pos_err * 1e6, r.ik_rot_err, r.ik_mismatch);
+
+	if (mode == "float")
+	{
+		kin_prec = KIN_FLOAT;
+		if (!fits)
+			err_msg("WARNING: kin_precision float is outside the budget (%.3f um, %.2e rad)", pos_tol * 1e6, rot_tol);
+	}
+	else if (fits)
+		kin_prec = KIN_FLOAT;
+	log_msg("Kinematics: %s precision (budget %.3f um, %.2e rad)", kinPrecisionName(kin_prec), pos_tol * 1e6, rot_tol);
+}
+
+/**\fn int init_kinematics(ros::NodeHandle &n)
+ * \brief read the IK fallback and precision parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_kinematics(ros::NodeHandle &n)
+{
+	std::string prec;
+	double pos_tol_um, rot_tol;
+
+	n.param<std::string>("/kin_precision", prec, "auto");
+	n.param("/kin_float_pos_tol_um", pos_tol_um, 1.0);
+	n.param("/kin_float_rot_tol", rot_tol, 1e-5);
+	n.param("/ik_warm_start", ik_warm_start, true);
+	n.param("/ik_dls_fallback", ik_dls_fallback, false);
+	n.param("/ik_dls_damping", ik_dls_damping, 0.01);
+	n.param("/skip_when_idle", ik_skip_idle, true);
+	n.param("/workspace_clip", ik_workspace_clip, true);
+	if (ik_dls_damping < 0)
+		ik_dls_damping = 0;
+	for (int m = 0; m < MAX_MECH; m++)
+		ik_branch[m] = -1;
+
+	log_msg("IK: %s kernel, branch warm start %s, skip when idle %s", invKinSIMDName(),
+			ik_warm_start ? "on" : "off", ik_skip_idle ? "on" : "off");
+	if (ik_dls_fallback)
+		log_msg("IK: damped least-squares fallback on, damping %g", ik_dls_damping);
+	else
+		log_msg("IK: damped least-squares fallback off");
+	if (ik_workspace_clip && initWorkspaceMap() < 0)
+	{
+		log_msg("IK: no workspace map, targets go to IK unclipped");
+		ik_workspace_clip = false;
+	}
+	selectKinPrecision(prec, pos_tol_um * 1e-6, rot_tol);
+	return 0;
+}
 
 //--------------------------------------------------------------------------------
 //  Calculate a transform between two links
@@ -108,6 +209,429 @@ btTransform getFKTransform(int a, int b)
 }
 
 
+//--------------------------------------------------------------------------------
+//  Closed-form forward kinematics and the per-cycle kinematic context
+//--------------------------------------------------------------------------------
+
+/// constant part of one DH link: cos/sin of alpha, a, and d for the revolute links
+struct fk_link_const
+{
+	double ca, sa, a, d;
+};
+
+static fk_link_const fkLinkConst(l_r arm, int i)
+{
+	fk_link_const c = { cos(alphas[arm][i]), sin(alphas[arm][i]), aas[arm][i], ds[arm][i] };
+	return c;
+}
+
+static const fk_link_const fk_consts[2][6] = {
+	{ fkLinkConst(dh_left, 0),  fkLinkConst(dh_left, 1),  fkLinkConst(dh_left, 2),
+	  fkLinkConst(dh_left, 3),  fkLinkConst(dh_left, 4),  fkLinkConst(dh_left, 5) },
+	{ fkLinkConst(dh_right, 0), fkLinkConst(dh_right, 1), fkLinkConst(dh_right, 2),
+	  fkLinkConst(dh_right, 3), fkLinkConst(dh_right, 4), fkLinkConst(dh_right, 5) }
+};
+
+// rotate to match "tilted" base
+static const btTransform fk_zrot[2] = {
+	btTransform( btMatrix3x3 (cos(25*d2r), -sin(25*d2r), 0,  sin(25*d2r), cos(25*d2r), 0,  0,0,1), btVector3 (0,0,0) ),
+	btTransform( btMatrix3x3 (cos(-25*d2r),-sin(-25*d2r),0,  sin(-25*d2r),cos(-25*d2r),0,  0,0,1), btVector3 (0,0,0) )
+};
+
+// the same, for taking r2_inv_kin()'s target out of the tilted base
+static const rm_xform ik_zrot[2] = {
+	rmXform( rmRotZ(25*d2r),  rmVec(0,0,0) ),
+	rmXform( rmRotZ(-25*d2r), rmVec(0,0,0) )
+};
+
+// Kinematic context of each mechanism, see getKinContext().  Per mechanism,
+// not per arm type, so the per-arm pipeline's jobs never share one.
+static kin_context kin_ctx[MAX_MECH];
+
+/**\fn static void fkTrig(const double in_thetas[6], l_r in_arm, double *cth, double *sth)
+ * \brief sin/cos of each link's theta, one call per joint
+ *
+ * Entry 2 holds the fixed theta of the insertion link, since d3 is the variable there.
+ */
+static inline void fkTrig(const double in_thetas[6], l_r in_arm, double *cth, double *sth)
+{
+	for (int i=0; i<6; i++)
+	{
+		double th = (i==2) ? robot_thetas[in_arm][2] : in_thetas[i];
+		cth[i] = cos(th);
+		sth[i] = sin(th);
+	}
+}
+
+/**\fn static void buildFKFrames(const double *cth, const double *sth, const double in_thetas[6], l_r in_arm, fk_frames &out)
+ * \brief link transforms and tilted base frames from a sin/cos table made by fkTrig()
+ */
+static void buildFKFrames(const double *cth, const double *sth, const double in_thetas[6], l_r in_arm, fk_frames &out)
+{
+	const fk_link_const *c = fk_consts[in_arm];
+
+	out.arm = in_arm;
+	for (int i=0; i<6; i++)
+	{
+		out.thetas[i] = in_thetas[i];
+
+		double d  = (i==2) ? in_thetas[2] : c[i].d;
+		double ct = cth[i], st = sth[i];
+
+		out.link[i].setBasis(btMatrix3x3(ct,         -st,          0,
+										 st*c[i].ca,  ct*c[i].ca, -c[i].sa,
+										 st*c[i].sa,  ct*c[i].sa,  c[i].ca));
+		out.link[i].setOrigin(btVector3(c[i].a, -c[i].sa*d, c[i].ca*d));
+	}
+
+	out.base[0] = fk_zrot[in_arm];
+	for (int i=0; i<6; i++)
+		out.base[i+1] = out.base[i] * out.link[i];
+}
+
+/**\fn void computeFKFrames(const double in_thetas[6], l_r in_arm, fk_frames &out)
+ * \brief Closed-form FK: every link transform and every ^0_iT from one pass
+ *
+ * Each joint's sin/cos is taken once; the alpha, a and d terms come from the
+ * fk_consts table.  The chain is the same one getFKTransform() walks, but
+ * multiplied base-first so all intermediate frames fall out on the way.
+ *
+ * \param in_thetas - DH thetas, with d3 (m) in element 2, as for fwd_kin()
+ * \param in_arm - arm type, left / right
+ * \param out - link transforms and tilted base frames
+ */
+void computeFKFrames(const double in_thetas[6], l_r in_arm, fk_frames &out)
+{
+	double cth[6], sth[6];
+	fkTrig(in_thetas, in_arm, cth, sth);
+	buildFKFrames(cth, sth, in_thetas, in_arm, out);
+}
+
+/**\fn template <typename T> static void fkToolPose(const double in_thetas[6], l_r in_arm, T out_R[3][3], T out_p[3])
+ * \brief the tool frame alone, as base[6] of computeFKFrames(), in precision T
+ *
+ * Same link terms, accumulated base-first, but no intermediate transforms
+ * are kept, so a float call stays in float from the trig on.
+ */
+template <typename T>
+static void fkToolPose(const double in_thetas[6], l_r in_arm, T out_R[3][3], T out_p[3])
+{
+	const fk_link_const *c = fk_consts[in_arm];
+	const btMatrix3x3 &Z = fk_zrot[in_arm].getBasis();
+
+	for (int i=0; i<3; i++)
+	{
+		for (int j=0; j<3; j++)
+			out_R[i][j] = (T)Z[i][j];
+		out_p[i] = 0;
+	}
+	for (int i=0; i<6; i++)
+	{
+		T th = (T)((i==2) ? robot_thetas[in_arm][2] : in_thetas[i]);
+		T d  = (T)((i==2) ? in_thetas[2] : c[i].d);
+		T ct = std::cos(th), st = std::sin(th);
+		T ca = (T)c[i].ca, sa = (T)c[i].sa;
+		const T L[3][3] = {{ct,     -st,     0  },
+		                   {st*ca,   ct*ca, -sa },
+		                   {st*sa,   ct*sa,  ca }};
+		const T o[3] = { (T)c[i].a, -sa*d, ca*d };
+
+		T R[3][3];
+		for (int r=0; r<3; r++)
+		{
+			out_p[r] += out_R[r][0]*o[0] + out_R[r][1]*o[1] + out_R[r][2]*o[2];
+			for (int k=0; k<3; k++)
+				R[r][k] = out_R[r][0]*L[0][k] + out_R[r][1]*L[1][k] + out_R[r][2]*L[2][k];
+		}
+		for (int r=0; r<3; r++)
+			for (int k=0; k<3; k++)
+				out_R[r][k] = R[r][k];
+	}
+}
+
+/**\fn static l_r mechArm(struct mechanism &in_mch)
+ * \brief DH arm type of a mechanism
+ */
+static inline l_r mechArm(struct mechanism &in_mch)
+{
+	return (in_mch.type == GOLD_ARM_SERIAL) ? dh_left : dh_right;
+}
+
+/**\fn struct kin_context* getKinContext(struct mechanism &in_mch)
+ * \brief the kinematic context for the mechanism's current joint positions
+ *
+ * r2_fwd_kin() is the first reader each cycle.  Later readers in the same
+ * cycle (r2_inv_kin(), gravity compensation) get the same context back, with
+ * whatever parts are already computed.  If jpos has changed since the
+ * context was filled, every part is invalidated and the thetas recomputed.
+ *
+ * \param in_mch - a reference of one arm
+ * \return context valid until the next call for the same mechanism
+ */
+struct kin_context* getKinContext(struct mechanism &in_mch)
+{
+	l_r arm = mechArm(in_mch);
+	int m = MECH_OF_TYPE(in_mch.joint[SHOULDER].type);
+	kin_context *kc = &kin_ctx[(m >= 0 && m < MAX_MECH) ? m : 0];
+
+	double joints[6] = {
+		in_mch.joint[SHOULDER].jpos,
+		in_mch.joint[ELBOW].jpos,
+		in_mch.joint[Z_INS].jpos,
+		in_mch.joint[TOOL_ROT].jpos,
+		in_mch.joint[WRIST].jpos,
+		(in_mch.joint[GRASP2].jpos - in_mch.joint[GRASP1].jpos) / 2.0
+	};
+
+	bool same = (kc->valid & KC_THETAS) != 0 && kc->arm == arm;
+	for (int i=0; same && i<6; i++)
+		same = (kc->joints[i] == joints[i]);
+	if (same)
+		return kc;
+
+	kc->arm = arm;
+	for (int i=0; i<6; i++)
+		kc->joints[i] = joints[i];
+
+	// convert from joint angle representation to DH theta convention
+	joint2theta(kc->thetas, joints, arm);
+	kc->valid = KC_THETAS;
+	return kc;
+}
+
+/**\fn const fk_frames& kinFrames(struct kin_context *kc)
+ * \brief the context's FK frames, computing the sin/cos table and frames on first use
+ */
+const fk_frames& kinFrames(struct kin_context *kc)
+{
+	if (!(kc->valid & KC_TRIG))
+	{
+		fkTrig(kc->thetas, kc->arm, kc->cth, kc->sth);
+		kc->valid |= KC_TRIG;
+	}
+	if (!(kc->valid & KC_FRAMES))
+	{
+		buildFKFrames(kc->cth, kc->sth, kc->thetas, kc->arm, kc->fk);
+		kc->valid |= KC_FRAMES;
+	}
+	return kc->fk;
+}
+
+/**\fn const double (*kinJacobian(struct kin_context *kc))[6]
+ * \brief the context's geometric Jacobian, computing it (and the frames) on first use
+ *
+ * J[r][i] maps the rate of DH variable i (th1, th2, d3, th4, th5, th6) to the
+ * tool frame origin's velocity (rows 0..2, m/s) and angular velocity (rows
+ * 3..5, rad/s), both in the tilted base frame fwd_kin() reports in.  Joint i
+ * moves about or along the z axis of DH frame i+1.
+ */
+const double (*kinJacobian(struct kin_context *kc))[6]
+{
+	if (!(kc->valid & KC_JACOBIAN))
+	{
+		const fk_frames &fk = kinFrames(kc);
+		btVector3 p_tool = fk.base[6].getOrigin();
+
+		for (int i=0; i<6; i++)
+		{
+			const btMatrix3x3 &R = fk.base[i+1].getBasis();
+			btVector3 z(R[0][2], R[1][2], R[2][2]);
+			btVector3 v = z, w(0, 0, 0);
+
+			if (i != 2)
+			{
+				v = z.cross(p_tool - fk.base[i+1].getOrigin());
+				w = z;
+			}
+			for (int r=0; r<3; r++)
+			{
+				kc->J[r][i]   = v[r];
+				kc->J[r+3][i] = w[r];
+			}
+		}
+		kc->valid |= KC_JACOBIAN;
+	}
+	return kc->J;
+}
+
+
+
+/**\fn void kinJacobianTranspose(struct kin_context *kc, const double in_w[6], double out_tau[6])
+ * \brief map a tool wrench to DH joint efforts, tau = J^T w
+ * \param kc - kinematic context of the arm
+ * \param in_w - force (N) and moment (Nm) at the tool origin, tilted base frame
+ * \param out_tau - torque (Nm) on each revolute joint, force (N) on the insertion axis
+ */
+void kinJacobianTranspose(struct kin_context *kc, const double in_w[6], double out_tau[6])
+{
+	const double (*J)[6] = kinJacobian(kc);
+
+	for (int i=0; i<6; i++)
+	{
+		out_tau[i] = 0;
+		for (int r=0; r<6; r++)
+			out_tau[i] += J[r][i] * in_w[r];
+	}
+}
+
+/**\fn static int choleskySolve(double A[6][6], double b[6])
+ * \brief solve A x = b in place for symmetric positive definite A
+ * \return 0 on success, -1 if A is not positive definite
+ */
+static int choleskySolve(double A[6][6], double b[6])
+{
+	// A = L L^T, L kept in the lower triangle
+	for (int j=0; j<6; j++)
+	{
+		double s = A[j][j];
+		for (int k=0; k<j; k++)
+			s -= A[j][k] * A[j][k];
+		if (s <= 0)
+			return -1;
+		A[j][j] = sqrt(s);
+		for (int i=j+1; i<6; i++)
+		{
+			s = A[i][j];
+			for (int k=0; k<j; k++)
+				s -= A[i][k] * A[j][k];
+			A[i][j] = s / A[j][j];
+		}
+	}
+	for (int i=0; i<6; i++)
+	{
+		for (int k=0; k<i; k++)
+			b[i] -= A[i][k] * b[k];
+		b[i] /= A[i][i];
+	}
+	for (int i=5; i>=0; i--)
+	{
+		for (int k=i+1; k<6; k++)
+			b[i] -= A[k][i] * b[k];
+		b[i] /= A[i][i];
+	}
+	return 0;
+}
+
+/**\fn static int dampedSolve(const double J[6][6], double lambda, double b[6])
+ * \brief b <- (J J^T + lambda^2 I)^-1 b
+ */
+static int dampedSolve(const double J[6][6], double lambda, double b[6])
+{
+	double A[6][6];
+
+	for (int r=0; r<6; r++)
+		for (int c=0; c<=r; c++)
+		{
+			double s = 0;
+			for (int k=0; k<6; k++)
+				s += J[r][k] * J[c][k];
+			A[r][c] = A[c][r] = s;
+		}
+	for (int r=0; r<6; r++)
+		A[r][r] += lambda * lambda;
+
+	return choleskySolve(A, b);
+}
+
+/**\fn int kinDampedInverse(struct kin_context *kc, const double in_dx[6], double lambda, double out_dq[6])
+ * \brief damped least-squares joint step for a tool twist, dq = J^T (J J^T + lambda^2 I)^-1 dx
+ *
+ * lambda trades tracking for bounded joint steps: near a singularity (tool
+ * at the RCM, wrist straight) the step shrinks instead of blowing up.
+ *
+ * \param kc - kinematic context of the arm
+ * \param in_dx - translation (m) and rotation vector (rad) in the tilted base frame
+ * \param lambda - damping, in the Jacobian's units (m); 0 is the plain pseudo-inverse
+ * \param out_dq - DH joint step (th1, th2, d3, th4, th5, th6)
+ * \return 0 on success, -1 if the system is singular and undamped
+ */
+int kinDampedInverse(struct kin_context *kc, const double in_dx[6], double lambda, double out_dq[6])
+{
+	const double (*J)[6] = kinJacobian(kc);
+	double y[6];
+
+	for (int i=0; i<6; i++)
+		y[i] = in_dx[i];
+	if (dampedSolve(J, lambda, y) < 0)
+		return -1;
+
+	for (int i=0; i<6; i++)
+	{
+		out_dq[i] = 0;
+		for (int r=0; r<6; r++)
+			out_dq[i] += J[r][i] * y[r];
+	}
+	return 0;
+}
+
+/**\fn int kinWrenchFromTorque(struct kin_context *kc, const double in_tau[6], double lambda, double out_w[6])
+ * \brief tool wrench that best explains the joint efforts, w = (J J^T + lambda^2 I)^-1 J tau
+ * \param kc - kinematic context of the arm
+ * \param in_tau - DH joint efforts (Nm, N on the insertion axis)
+ * \param lambda - damping, as for kinDampedInverse()
+ * \param out_w - force (N) and moment (Nm) at the tool origin, tilted base frame
+ * \return 0 on success, -1 if the system is singular and undamped
+ */
+int kinWrenchFromTorque(struct kin_context *kc, const double in_tau[6], double lambda, double out_w[6])
+{
+	const double (*J)[6] = kinJacobian(kc);
+
+	for (int r=0; r<6; r++)
+	{
+		out_w[r] = 0;
+		for (int i=0; i<6; i++)
+			out_w[r] += J[r][i] * in_tau[i];
+	}
+	return dampedSolve(J, lambda, out_w);
+}
+
+/**\fn int diff_inv_kin(struct kin_context *kc, btTransform in_xf, double lambda, ik_solution &out_sol)
+ * \brief one damped least-squares IK step from the context's pose toward in_xf
+ *
+ * Cheap next to inv_kin(), and exact only for small moves, which is what a
+ * servo-rate setpoint is.  Used as the fallback when no closed-form solution
+ * is near the current joints.
+ *
+ * \param kc - kinematic context of the arm (current joints)
+ * \param in_xf - target tool frame in the tilted base frame, as fwd_kin() returns
+ * \param lambda - damping, see kinDampedInverse()
+ * \param out_sol - the stepped joints, DH convention
+ * \return 0 on success, -1 on failure (out_sol marked invalid)
+ */
+int diff_inv_kin(struct kin_context *kc, btTransform in_xf, double lambda, ik_solution &out_sol)
+{
+	const fk_frames &fk = kinFrames(kc);
+	const btMatrix3x3 &R  = fk.base[6].getBasis();
+	const btMatrix3x3 &Rd = in_xf.getBasis();
+	btVector3 dp = in_xf.getOrigin() - fk.base[6].getOrigin();
+
+	// rotation error: half the sum of current x desired over the three axes
+	btVector3 dw(0, 0, 0);
+	for (int c=0; c<3; c++)
+		dw += btVector3(R[0][c], R[1][c], R[2][c]).cross(btVector3(Rd[0][c], Rd[1][c], Rd[2][c]));
+	dw *= 0.5;
+
+	double dx[6] = { dp[0], dp[1], dp[2], dw[0], dw[1], dw[2] };
+	double dq[6];
+
+	out_sol = ik_zerosol;
+	out_sol.arm = kc->arm;
+	if (kinDampedInverse(kc, dx, lambda, dq) < 0)
+	{
+		out_sol.invalid = ik_invalid;
+		return -1;
+	}
+
+	out_sol.th1 = kc->thetas[0] + dq[0];
+	out_sol.th2 = kc->thetas[1] + dq[1];
+	out_sol.d3  = kc->thetas[2] + dq[2];
+	out_sol.th4 = kc->thetas[3] + dq[3];
+	out_sol.th5 = kc->thetas[4] + dq[4];
+	out_sol.th6 = kc->thetas[5] + dq[5];
+	return 0;
+}
+
+
 
 //-------------------------------------------------------------------------------
 //  Forward kinematics
@@ -121,36 +645,15 @@ btTransform getFKTransform(int a, int b)
  */
 int r2_fwd_kin(struct device *d0, int runlevel)
 {
-	l_r arm;
 	btTransform xf;
 
 	/// Do FK for each mechanism
-	for (int m=0; m<NUM_MECH; m++)
+	for (int m=mechFirst(); m<mechEnd(); m++)
 	{
-		/// get arm type and wrist actuation angle
-		if (d0->mech[m].type == GOLD_ARM_SERIAL)
-			arm = dh_left;
-		else
-			arm = dh_right;
-
-		double wrist2          = (d0->mech[m].joint[GRASP2].jpos - d0->mech[m].joint[GRASP1].jpos) / 2.0;
 		d0->mech[m].ori.grasp  = (d0->mech[m].joint[GRASP2].jpos + d0->mech[m].joint[GRASP1].jpos) * 1000;
 
-		double joints[6] = {
-				d0->mech[m].joint[SHOULDER].jpos,
-				d0->mech[m].joint[ELBOW].jpos,
-				d0->mech[m].joint[Z_INS].jpos,
-				d0->mech[m].joint[TOOL_ROT].jpos,
-				d0->mech[m].joint[WRIST].jpos,
-				wrist2
-		};
-
-		// convert from joint angle representation to DH theta convention
-		double lo_thetas[6];
-		joint2theta(lo_thetas, joints, arm);
-
-		/// execute FK
-		fwd_kin(lo_thetas, arm, xf);
+		/// execute FK; the frames stay in the kinematic context for the rest of the cycle
+		xf = kinFrames(getKinContext(d0->mech[m])).base[6];
 
 		d0->mech[m].pos.x = xf.getOrigin()[0] * (1000.0*1000.0);
 		d0->mech[m].pos.y = xf.getOrigin()[1] * (1000.0*1000.0);
@@ -167,7 +670,7 @@ int r2_fwd_kin(struct device *d0, int runlevel)
         // That way, if anything wonky happens during state transitions
         // there won't be any discontinuities.
         // Note: in init, this is done in setStartXYZ
-        for (int m = 0; m < NUM_MECH; m++) {
+        for (int m = mechFirst(); m < mechEnd(); m++) {
           d0->mech[m].pos_d.x     = d0->mech[m].pos.x;
           d0->mech[m].pos_d.y     = d0->mech[m].pos.y;
           d0->mech[m].pos_d.z     = d0->mech[m].pos.z;
@@ -195,277 +698,1057 @@ int r2_fwd_kin(struct device *d0, int runlevel)
  */
 int fwd_kin (double in_j[6], l_r in_arm, btTransform &out_xform )
 {
-	dh_alpha = alphas[in_arm];
-	dh_theta = robot_thetas[in_arm];
-	dh_a     = aas[in_arm];
-	dh_d     = ds[in_arm];
+	if (kin_prec == KIN_FLOAT)
+	{
+		float R[3][3], p[3];
+		fkToolPose(in_j, in_arm, R, p);
+		out_xform.setBasis(btMatrix3x3(R[0][0], R[0][1], R[0][2],
+									   R[1][0], R[1][1], R[1][2],
+									   R[2][0], R[2][1], R[2][2]));
+		out_xform.setOrigin(btVector3(p[0], p[1], p[2]));
+		return 0;
+	}
 
-	for (int i=0;i<6;i++)
+	fk_frames fk;
+	computeFKFrames(in_j, in_arm, fk);
+	out_xform = fk.base[6];
+	return 0;
+}
+
+
+
+/**\fn int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA, int frameB)
+ * \brief Runs the Raven II forward kinematics to determine the desired transform from frame A to frame B
+ * \param in_mch - a reference of one arm
+ * \param out_xform - a reference of a btTransform obejct represents the output transfrom
+ * \param frameA - an integer value, starting frame id
+ * \param frameB - an integer value, ending frame id
+ * \return 0 on success, -1 on failure
+ */
+int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA, int frameB)
+{
+	if ( (frameB <= frameA) || frameA < 0 || frameB > 6 )
+	{
+		ROS_ERROR("Invalid start/end indices.");
+		return -1;
+	}
+
+	const fk_frames &fk = kinFrames(getKinContext(in_mch));
+
+	// ^0_xT is taken in the tilted base (instead of rotated 25 degrees to zero angle of shoulder joint)
+	if (frameA == 0)
+	{
+		out_xform = fk.base[frameB];
+		return 0;
+	}
+
+	out_xform = fk.link[frameA];
+	for (int i=frameA+1; i<frameB; i++)
+		out_xform *= fk.link[i];
+	return 0;
+}
+
+
+
+//------------------------------------------------------------------------------/
+//  Inverse kinematics
+//-------------------------------------------------------------------------------
+
+#define IK_WARM_MAX_ERR 0.01    // check_solutions() error above which the warm branch is dropped: about 0.1 rad of motion
+
+/**\fn static int warmStartIK(btTransform in_xf, l_r in_arm, double *in_thetas, int branch, ik_solution iksol[8], double &out_err)
+ * \brief solve only the given branch, and keep it if it lands near the current joints and inside the limits
+ * \param in_xf - tool frame, as for inv_kin()
+ * \param in_thetas - current joints, DH convention
+ * \param branch - the branch chosen last cycle
+ * \param iksol - the solution goes at [branch], the rest are marked invalid
+ * \return branch, or -1 if the caller should enumerate all eight
+ */
+static int warmStartIK(btTransform in_xf, l_r in_arm, double *in_thetas, int branch, ik_solution iksol[8], double &out_err)
+{
+	for (int i=0; i<8; i++)
+	{
+		iksol[i] = ik_zerosol;
+		iksol[i].arm = in_arm;
+		iksol[i].invalid = ik_invalid;
+	}
+	if (inv_kin_branch(in_xf, in_arm, branch, iksol[branch]) < 0)
+		return -1;
+
+	int idx;
+	if (check_solutions(in_thetas, iksol, idx, out_err) < 0 || out_err > IK_WARM_MAX_ERR)
+		return -1;
+
+	double Js[6], Js_sat[6];
+	theta2joint(iksol[branch], Js);
+	if (apply_joint_limits(Js, Js_sat))
+		return -1;
+	return branch;
+}
+
+/// last IK result of a mechanism, see ikCacheHit()
+struct ik_cache
+{
+	int valid;
+	struct position pos_d;      // commanded pose it was solved for (after saturation)
+	float R[3][3];
+	int grasp;
+	float jpos_d[7];
+};
+
+static struct ik_cache ik_last[MAX_MECH];
+
+// the joints r2_inv_kin() sets
+static const int ik_joints[7] = { SHOULDER, ELBOW, Z_INS, TOOL_ROT, WRIST, GRASP1, GRASP2 };
+
+/**\fn static int ikCacheHit(int m, struct mechanism &in_mch)
+ * \brief if the commanded pose is last cycle's, put last cycle's joint setpoints back
+ *
+ * Positions are compared exactly (integer microns), the rotation to
+ * IK_IDLE_R_EPS.  The current joints only pick among the eight branches, so
+ * the answer for an unchanged pose is the same; damped least-squares steps do
+ * depend on them and are never cached.
+ *
+ * \return 1 if jpos_d was restored, 0 if IK must run
+ */
+static int ikCacheHit(int m, struct mechanism &in_mch)
+{
+	const struct ik_cache *c = &ik_last[m];
+	if (!c->valid ||
+		c->pos_d.x != in_mch.pos_d.x || c->pos_d.y != in_mch.pos_d.y || c->pos_d.z != in_mch.pos_d.z ||
+		c->grasp != in_mch.ori_d.grasp)
+		return 0;
+	for (int i=0; i<3; i++)
+		for (int j=0; j<3; j++)
+			if (fabs(c->R[i][j] - in_mch.ori_d.R[i][j]) > IK_IDLE_R_EPS)
+				return 0;
+
+	for (int i=0; i<7; i++)
+		in_mch.joint[ik_joints[i]].jpos_d = c->jpos_d[i];
+	return 1;
+}
+
+/**\fn static void ikCacheStore(int m, struct mechanism &in_mch)
+ * \brief remember this cycle's commanded pose and joint setpoints
+ */
+static void ikCacheStore(int m, struct mechanism &in_mch)
+{
+	struct ik_cache *c = &ik_last[m];
+	c->pos_d = in_mch.pos_d;
+	c->grasp = in_mch.ori_d.grasp;
+	for (int i=0; i<3; i++)
+		for (int j=0; j<3; j++)
+			c->R[i][j] = in_mch.ori_d.R[i][j];
+	for (int i=0; i<7; i++)
+		c->jpos_d[i] = in_mch.joint[ik_joints[i]].jpos_d;
+	c->valid = 1;
+}
+
+static void ikWristPoints(const btTransform &in_T06, btVector3 out_p05[2]);
+
+/**\fn static int workspacePreClip(struct kin_context *kc, btTransform &io_xf)
+ * \brief move a target whose wrist is out of reach onto the edge of the workspace map
+ *
+ * The target keeps its orientation.  Of the two wrist points inv_kin()
+ * considers, the one nearer the current wrist is the one clipped.
+ *
+ * \param kc - kinematic context of the arm (current joints)
+ * \param io_xf - target tool frame in the tilted base frame
+ * \return 1 if io_xf moved, 0 if not
+ */
+static int workspacePreClip(struct kin_context *kc, btTransform &io_xf)
+{
+	btVector3 p05[2], clipped;
+	btVector3 cur = kinFrames(kc).base[5].getOrigin();
+
+	ikWristPoints(io_xf, p05);
+	int w = ((p05[0] - cur).length2() <= (p05[1] - cur).length2()) ? 0 : 1;
+	if (!workspaceClip(kc->arm, p05[w], clipped))
+		return 0;
+
+	io_xf.setOrigin(io_xf.getOrigin() + (clipped - p05[w]));
+	return 1;
+}
+
+/**\fn int r2_inv_kin(struct device *d0, int runlevel)
+ * \brief run the ravenII inverse kinematics from device struct
+ * \param d0  - a pointer points to robot_device struct
+ * \param runlevel - an integer value represents the runlevel
+ * \return 0 on success -1 on failure
+ */
+int r2_inv_kin(struct device *d0, int runlevel)
+{
+	l_r arm;
+	btTransform xf, xf_tilted;
+	rm_xform xd;
+	struct orientation * ori_d;
+	struct position    * pos_d;
+
+	//  Do FK for each mechanism
+	for (int m=mechFirst(); m<mechEnd(); m++)
+	{
+		// get arm type and wrist actuation angle
+		if (d0->mech[m].type == GOLD_ARM_SERIAL)
+			arm = dh_left;
+		else
+			arm = dh_right;
+
+		// Commanded pose unchanged: last cycle's setpoints still hold
+		if (ik_skip_idle && printIK == 0 && ikCacheHit(m, d0->mech[m]))
+			continue;
+		ik_last[m].valid = 0;
+
+		ori_d = &(d0->mech[m].ori_d);
+		pos_d = &(d0->mech[m].pos_d);
+
+		// commanded tool frame, in the tilted base
+		xd = rmXform( rmFromRows(ori_d->R), rmVec(pos_d->x, pos_d->y, pos_d->z) * rmSplat(1 / (1000.0*1000.0)) );
+
+		// Current joint angles, from this cycle's kinematic context
+		struct kin_context *kc = getKinContext(d0->mech[m]);
+		const double *joints   = kc->joints;
+		double *lo_thetas      = kc->thetas;   // DH theta convention
+
+		// A target out of reach goes to the workspace edge first, and the master origin with it
+		xf_tilted = btFromRm(xd);
+		if (ik_workspace_clip && workspacePreClip(kc, xf_tilted))
+		{
+			xd.p = rmFromBt(xf_tilted.getOrigin());
+			pos_d->x = xd.p[0] * (1000.0*1000.0);
+			pos_d->y = xd.p[1] * (1000.0*1000.0);
+			pos_d->z = xd.p[2] * (1000.0*1000.0);
+			updateMasterRelativeOrigin(d0);
+		}
+
+		// the IK kernels work in the untilted base
+		xf = btFromRm( rmMulInv(ik_zrot[arm], xd) );
+
+		//		DO IK: last cycle's branch first, if it still fits
+		ik_solution iksol[8] = {{},{},{},{},{},{},{},{}};
+		int sol_idx = -1;
+		double sol_err;
+		bool dls_step = false;
+		if (ik_warm_start && ik_branch[m] >= 0 && printIK == 0)
+			sol_idx = warmStartIK(xf, arm, lo_thetas, ik_branch[m], iksol, sol_err);
+
+		// Otherwise all eight, checked against the current joint angles in the same pass
+		if (sol_idx < 0)
+		{
+			int ret = inv_kin_simd(xf, arm, lo_thetas, iksol, sol_idx, sol_err);
+			if (ret < 0)
+				log_msg("ik failed gracefully (arm%d ret:%d", arm, ret);
+
+			if ( sol_idx < 0 )
+			{
+				ik_branch[m] = -1;
+				metricInc(MC_IK_FAILURES);
+
+				// No closed-form solution near the current joints: take a damped least-squares step instead, if enabled
+				if ( !ik_dls_fallback || diff_inv_kin(kc, xf_tilted, ik_dls_damping, iksol[0]) < 0 )
+					return -1;
+				sol_idx = 0;
+				dls_step = true;
+			}
+			else
+				ik_branch[m] = sol_idx;
+		}
+
+		double Js[6];
+		double Js_sat[6];
+		double thetas_sat[6];
+		btTransform xf_sat;
+		double gangle = double(d0->mech[m].ori_d.grasp) / 1000.0;
+		theta2joint(iksol[sol_idx], Js);
+
+		int limited = apply_joint_limits(Js,Js_sat);
+		if (limited)
+		{
+			metricInc(MC_JOINT_LIMIT_SATURATIONS);
+			joint2theta(thetas_sat, Js_sat, arm);
+			fwd_kin(thetas_sat, arm, xf_sat);
+			rm_xform sat = rmFromBt(xf_sat);
+			d0->mech[m].pos_d.x = sat.p[0] * (1000.0*1000.0);
+			d0->mech[m].pos_d.y = sat.p[1] * (1000.0*1000.0);
+			d0->mech[m].pos_d.z = sat.p[2] * (1000.0*1000.0);
+			rmToRows(sat.R, d0->mech[m].ori_d.R);
+
+			updateMasterRelativeOrigin(d0);
+		}
+		else
+		{
+			for (int satloop=0; satloop<6; satloop++)
+				Js_sat[satloop] = Js[satloop];
+		}
+
+		d0->mech[m].joint[SHOULDER].jpos_d = Js_sat[0];
+		d0->mech[m].joint[ELBOW   ].jpos_d = Js_sat[1];
+		d0->mech[m].joint[Z_INS   ].jpos_d = Js_sat[2];
+		d0->mech[m].joint[TOOL_ROT].jpos_d = Js_sat[3];
+		d0->mech[m].joint[WRIST   ].jpos_d = Js_sat[4];
+		d0->mech[m].joint[GRASP1  ].jpos_d = -Js[5] +  gangle / 2;
+		d0->mech[m].joint[GRASP2  ].jpos_d =  Js[5] +  gangle / 2;
+
+		if (!dls_step)
+			ikCacheStore(m, d0->mech[m]);
+
+		if (printIK !=0 )// && d0->mech[m].type == GREEN_ARM_SERIAL )
+		{
+			log_msg("All IK solutions for mechanism %d.  Chosen solution:%d:",m, sol_idx);
+			log_msg("Current     :\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f (\t %3f/\t %3f))",
+					joints[0] * r2d,
+					joints[1] * r2d,
+					joints[2],
+					joints[3] * r2d,
+					joints[4] * r2d,
+					joints[5] * r2d,
+					d0->mech[m].joint[GRASP2].jpos  * r2d,
+					d0->mech[m].joint[GRASP2].jpos * r2d
+			);
+			for (int i=0; i<8; i++)
+			{
+				theta2joint(iksol[i], Js);
+				log_msg("ik_joints[%d]:\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f)",i,
+						Js[0] * r2d,
+						Js[1] * r2d,
+						Js[2],
+						Js[3] * r2d,
+						Js[4] * r2d,
+						Js[5] * r2d
+						);
+			}
+		}
+	}
+
+	printIK=0;
+
+	return 0;
+}
+
+// Inverse kinematics tolerances
+#define IK_RCM_TOL    1.0e-6   // m: tool tip within Lw + IK_RCM_TOL of the RCM is singular
+#define IK_AXIS_TOL   1.0e-9   // m: RCM this close to the tool z axis leaves the wrist direction free
+#define IK_COS_TOL    1.0e-5   // |cos th2| up to 1 + IK_COS_TOL is roundoff, clamped to 1
+#define IK_DET_TOL    1.0e-12  // theta 1 system this close to singular has no solution
+#define IK_WRIST_TOL  1.0e-5   // |c5| or |s5| below this: use the other wrist equation
+
+/**\fn static btTransform dhLink(double alpha, double a, double theta, double d)
+ * \brief one link of the modified DH chain, as in getFKTransform()
+ */
+static inline btTransform dhLink(double alpha, double a, double theta, double d)
+{
+	double ct = cos(theta), st = sin(theta);
+	double ca = cos(alpha), sa = sin(alpha);
+	return btTransform(btMatrix3x3(ct,    -st,    0,
+								   st*ca,  ct*ca, -sa,
+								   st*sa,  ct*sa,  ca),
+					   btVector3(a, -sa*d, ca*d));
+}
+
+/**\fn static void ikWristPoints(const btTransform &in_T06, btVector3 out_p05[2])
+ * \brief IK step 1: the two candidate wrist points P5, Lw back from the tip towards the RCM in the tool x-y plane
+ */
+static void ikWristPoints(const btTransform &in_T06, btVector3 out_p05[2])
+{
+	btTransform  T60 = in_T06.inverse();
+	btVector3    p6rcm = T60.getOrigin();
+
+	p6rcm[2]=0;    // take projection onto x-y plane
+	double rxy = p6rcm.length();
+	if (rxy > IK_AXIS_TOL)
+		p6rcm /= rxy;
+	else
+		p6rcm = btVector3(1, 0, 0);   // the wrist can point anywhere: pick the x axis
+	for (int i= 0; i<2; i++)
+	{
+		btVector3 p65 = ((-1+2*i) * Lw) * p6rcm;
+		out_p05[i] = in_T06 * p65;
+	}
+}
+
+/**\fn template <l_r ARM> static int ikSolveArmBranch(const btTransform &in_T06, const btVector3 &p05, double d3, int neg_th2, ik_solution &sol)
+ * \brief IK steps 3 to 5 for one branch: theta 2 of the given sign, then theta 1, theta 4, 5, 6
+ *
+ * One instantiation per arm: the DH alphas and a's are constants, so their
+ * sines and cosines and the left/right branches fold at compile time.
+ *
+ * \param p05 - wrist point of the branch's wrist side
+ * \param d3 - insertion of the branch
+ * \param neg_th2 - take the negative root for theta 2
+ * \param sol - filled in; arm, invalid and d3 are set by the caller
+ * \return 0 on success, -1 if the branch has no solution (sol marked invalid)
+ */
+template <l_r ARM>
+static int ikSolveArmBranch(const btTransform &in_T06, const btVector3 &p05, double d3, int neg_th2, ik_solution &sol)
+{
+	const double *alpha = alphas[ARM];
+	const double *a     = aas[ARM];
+	const double th3    = robot_thetas[ARM][2];
+	double d = d3 + d4;
+
+	//  Step 3, calculate theta 2
+	double cth2;
+	if (ARM == dh_left)
+		cth2 = 1 / (GM1*GM3) * ((-p05[2] / d) - GM2*GM4);
+	else
+		cth2 = 1 / (GM1*GM3) * ((p05[2] / d) + GM2*GM4);
+
+	// Smooth roundoff errors at +/- 1.
+	if (fabs(cth2) > 1 + IK_COS_TOL || cth2 != cth2)
+	{
+		sol.invalid = ik_invalid;
+		return -1;
+	}
+	if (cth2 > 1)
+		cth2 = 1;
+	else if (cth2 < -1)
+		cth2 = -1;
+	sol.th2 = neg_th2 ? -acos( cth2 ) : acos( cth2 );
+
+	//  Step 4: Compute theta 1 from [B](c1 s1)' = xy(p05) / d
+	cth2 = cos(sol.th2);
+	double sth2 = sin(sol.th2);
+	double x    = p05[0] / d;
+	double y    = p05[1] / d;
+	double b1   = sth2*GM3;
+	double b2   = (ARM == dh_left) ? cth2*GM2*GM3 - GM1*GM4 : cth2*GM2*GM3 + GM1*GM4;
+	double det  = b1*b1 + b2*b2;
+	if (det < IK_DET_TOL)
+	{
+		sol.invalid = ik_invalid;
+		return -1;
+	}
+	double c1, s1;
+	if (ARM == dh_left)             // B = [b1 b2; -b2 b1]
+	{
+		c1 = (b1*x - b2*y) / det;
+		s1 = (b2*x + b1*y) / det;
+	}
+	else                            // B = [b1 b2; b2 -b1]
+	{
+		c1 = (b1*x + b2*y) / det;
+		s1 = (b2*x - b1*y) / det;
+	}
+	sol.th1 = atan2(s1, c1);
+
+	//  Step 5: get theta 4, 5, 6
+	// compute T03:
+	btTransform T03 = dhLink(alpha[0], a[0], sol.th1, 0) *
+	                  dhLink(alpha[1], a[1], sol.th2, 0) *
+	                  dhLink(alpha[2], a[2], th3, sol.d3);
+	btTransform T36 = T03.inverse() * in_T06;
+
+	double c5 = -T36.getBasis()[2][2];
+	double s5 = (T36.getOrigin()[2]-d4)/Lw;
+
+	// Compute theta 4:
+	double c4, s4;
+	if (fabs(c5) > IK_WRIST_TOL)
+	{
+		c4 =T36.getOrigin()[0] / (Lw * c5);
+		s4 =T36.getOrigin()[1] / (Lw * c5);
+	}
+	else
 	{
-		if (i==2)
-			dh_d[i] = in_j[i];
-		else
-			dh_theta[i] = in_j[i];// *M_PI/180;
+		c4 = T36.getBasis()[0][2] / s5;
+		s4 = T36.getBasis()[1][2] / s5;
 	}
+	sol.th4 = atan2(s4,c4);
 
-	out_xform = getFKTransform(0,6);
-
-	// rotate to match "tilted" base
-	const static btTransform zrot_l( btMatrix3x3 (cos(25*d2r),-sin(25*d2r),0,  sin(25*d2r),cos(25*d2r),0,  0,0,1), btVector3 (0,0,0) );
-	const static btTransform zrot_r( btMatrix3x3 (cos(-25*d2r),-sin(-25*d2r),0,  sin(-25*d2r),cos(-25*d2r),0,  0,0,1), btVector3 (0,0,0) );
+	// Compute theta 5:
+	sol.th5 = atan2(s5, c5);
 
-
-	if (in_arm == dh_left)
+	// Compute theta 6:
+	double s6, c6;
+	if (fabs(s5) > IK_WRIST_TOL)
 	{
-		out_xform = zrot_l * out_xform;
+		c6 =  T36.getBasis()[2][0] / s5;
+		s6 = -T36.getBasis()[2][1] / s5;
 	}
 	else
 	{
-		out_xform = zrot_r * out_xform;
+		btTransform T05 = T03 * dhLink(alpha[3], a[3], sol.th4, d4) *
+		                        dhLink(alpha[4], a[4], sol.th5, 0);
+		btTransform T56 = T05.inverse() * in_T06;
+		c6 =T56.getBasis()[0][0];
+		s6 =T56.getBasis()[2][0];
 	}
+	sol.th6 = atan2(s6, c6);
+
 	return 0;
 }
 
-
-
-/**\fn int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA, int frameB)
- * \brief Runs the Raven II forward kinematics to determine the desired transform from frame A to frame B
- * \param in_mch - a reference of one arm
- * \param out_xform - a reference of a btTransform obejct represents the output transfrom
- * \param frameA - an integer value, starting frame id
- * \param frameB - an integer value, ending frame id
- * \return 0 on success, -1 on failure
+/**\fn static int ikSolveBranch(const btTransform &in_T06, l_r in_arm, const btVector3 &p05, double d3, int neg_th2, ik_solution &sol)
+ * \brief ikSolveArmBranch() for the arm type
  */
-int getATransform (struct mechanism &in_mch, btTransform &out_xform, int frameA, int frameB)
+static inline int ikSolveBranch(const btTransform &in_T06, l_r in_arm, const btVector3 &p05, double d3, int neg_th2, ik_solution &sol)
 {
-	l_r arm;
-
-	/// get arm type and wrist actuation angle
-	if (in_mch.type == GOLD_ARM_SERIAL)
-			arm = dh_left;
-		else
-			arm = dh_right;
-
-	double wrist2 = (in_mch.joint[GRASP2].jpos - in_mch.joint[GRASP1].jpos) / 2.0;
-
-	double joints[6] = {
-		in_mch.joint[SHOULDER].jpos,
-		in_mch.joint[ELBOW].jpos,
-		in_mch.joint[Z_INS].jpos,
-		in_mch.joint[TOOL_ROT].jpos,
-		in_mch.joint[WRIST].jpos,
-		wrist2
-	};
-
-	// convert from joint angle representation to DH theta convention
-	double lo_thetas[6];
-	joint2theta(lo_thetas, joints, arm);
+	if (in_arm == dh_left)
+		return ikSolveArmBranch<dh_left>(in_T06, p05, d3, neg_th2, sol);
+	return ikSolveArmBranch<dh_right>(in_T06, p05, d3, neg_th2, sol);
+}
 
-	dh_alpha = alphas[arm];
-	dh_theta = robot_thetas[arm];
-	dh_a     = aas[arm];
-	dh_d     = ds[arm];
+/**\fn int inv_kin(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
+ * \brief Runs the Raven II INVERSE kinematics to determine end effector position.
+ *
+ * Re-entrant: works on local copies of the DH table and leaves the dh_*
+ * pointers alone, so it is safe at any optimisation level.  Solutions are
+ * always in the same order, see inv_kin_branch(): [0..3] and [4..7] are the
+ * two wrist sides, in each of which the first pair is the shorter insertion,
+ * and even/odd entries are +th2/-th2.  Near a singularity every solution is
+ * marked invalid, never left as zeros.
+ *
+ * \param in_T06 - a btTransfrom obejct, transforms the end effector frame to zero frame
+ * \param in_arm - Arm type, left / right ( kin.armtype arm = left/right)
+ * \param ik_solution iksol[8] - 8 element array of joint angles ( float j[] = {shoulder, elbow, vacant joint, ins,roll, wrist, grasp1, grasp2} )
+ * \return 0 - success, -1 - bad arm, -2 - too close to RCM.
+ */
+int inv_kin(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
+{
+	for (int i=0;i<8;i++)
+		iksol[i] = ik_zerosol;
 
-	for (int i=0;i<6;i++)
+	if  ( in_arm  >= dh_l_r_last)
 	{
-		if (i==2)
-			dh_d[i] = lo_thetas[i];
-		else
-			dh_theta[i] = lo_thetas[i];// *M_PI/180;
+		ROS_ERROR("BAD ARM IN IK!!!");
+		for (int i=0;i<8;i++)
+			iksol[i].invalid = ik_invalid;
+		return -1;
 	}
 
-	out_xform = getFKTransform(frameA, frameB);
+	for (int i=0;i<8;i++)
+		iksol[i].arm = in_arm;
 
-	// rotate to match "tilted" base
-	// Needed?  Yes, for transform ^0_xT to get a frame aligned with base (instead of rotated 25 degrees to zero angle of shoulder joint)
-	if (frameA == 0)
-	{
-		const static btTransform zrot_l( btMatrix3x3 (cos(25*d2r), -sin(25*d2r), 0,  sin(25*d2r), cos(25*d2r), 0,  0,0,1), btVector3 (0,0,0) );
-		const static btTransform zrot_r( btMatrix3x3 (cos(-25*d2r),-sin(-25*d2r),0,  sin(-25*d2r),cos(-25*d2r),0,  0,0,1), btVector3 (0,0,0) );
+	//  Step 1, Compute P5
+	btVector3 p05[2];
+	ikWristPoints(in_T06, p05);
 
-		if (arm == dh_left)
-		{
-			out_xform = zrot_l * out_xform;
-		}
-		else
+	//  Step 2, compute displacement of prismatic joint d3
+	for (int i=0;i<2;i++)
+	{
+		double insertion = p05[i].length();
+		if (insertion <= Lw + IK_RCM_TOL)
 		{
-			out_xform = zrot_r * out_xform;
+			for (int j=0;j<8;j++)
+				iksol[j].invalid = ik_invalid;
+			return -2;
 		}
+		iksol[4*i + 0].d3 = iksol[4*i + 1].d3 = -d4 - insertion;
+		iksol[4*i + 2].d3 = iksol[4*i + 3].d3 = -d4 + insertion;
 	}
-	return 0;
 
+	//  Steps 3 to 5 for each branch
+	for (int i=0; i<8; i++)
+		ikSolveBranch(in_T06, in_arm, p05[i/4], iksol[i].d3, i%2, iksol[i]);
+
+	return 0;
 }
 
+/**\fn int inv_kin_branch(btTransform in_T06, l_r in_arm, int branch, ik_solution &sol)
+ * \brief solve only one of inv_kin()'s eight branches
+ *
+ * branch is the index the solution has in inv_kin()'s output: wrist side
+ * branch/4, longer insertion if branch%4 >= 2, negative theta 2 if odd.
+ * Gives the same numbers inv_kin() puts there, at about an eighth of the cost.
+ *
+ * \param in_T06 - tool frame, as for inv_kin()
+ * \param in_arm - Arm type, left / right
+ * \param branch - 0..7
+ * \param sol - the solution, marked invalid if the branch has none
+ * \return 0 - success, -1 - bad arm or branch or no solution, -2 - too close to RCM.
+ */
+int inv_kin_branch(btTransform in_T06, l_r in_arm, int branch, ik_solution &sol)
+{
+	sol = ik_zerosol;
+	sol.arm = in_arm;
+	if  ( in_arm  >= dh_l_r_last || branch < 0 || branch > 7 )
+	{
+		sol.invalid = ik_invalid;
+		return -1;
+	}
 
+	btVector3 p05[2];
+	ikWristPoints(in_T06, p05);
 
+	// inv_kin() gives up if either wrist point is at the RCM
+	for (int i=0;i<2;i++)
+		if (p05[i].length() <= Lw + IK_RCM_TOL)
+		{
+			sol.invalid = ik_invalid;
+			return -2;
+		}
 
+	double insertion = p05[branch/4].length();
+	sol.d3 = (branch%4 < 2) ? -d4 - insertion : -d4 + insertion;
 
+	return ikSolveBranch(in_T06, in_arm, p05[branch/4], sol.d3, branch%2, sol);
+}
 
+//--------------------------------------------------------------------------------
+//  Structure-of-arrays IK: all eight branches in lockstep
+//--------------------------------------------------------------------------------
 
+// Lanes per vector, from the instruction set the file is built for (R2_IK_SIMD in CMakeLists.txt)
+#if defined(__AVX__)
+#define IK_VEC_WIDTH 4
+#define IK_VEC_ISA   "AVX"
+#elif defined(__SSE2__)
+#define IK_VEC_WIDTH 2
+#define IK_VEC_ISA   "SSE2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define IK_VEC_WIDTH 2
+#define IK_VEC_ISA   "NEON"
+#else
+#define IK_VEC_WIDTH 1
+#define IK_VEC_ISA   "scalar"
+#endif
+
+/** ik_prec<T>
+ *   Vector type of one precision.  A float vector is the same register as a
+ *   double one, so it carries twice the lanes and IK takes half the passes.
+ *   wrist_rot: always take theta 4 and |s5| from R36.  The wrist point
+ *   terms divide a float's roundoff on 0.5 m by Lw; near c5 = 0 that is
+ *   most of the roll angle.  Double only needs R36 below IK_WRIST_TOL.
+ */
+template <typename T> struct ik_prec;
 
+template <> struct ik_prec<double>
+{
+	typedef double vec __attribute__ ((vector_size (8 * IK_VEC_WIDTH)));
+	enum { width = IK_VEC_WIDTH, nv = 8 / IK_VEC_WIDTH, wrist_rot = 0 };
+};
 
+template <> struct ik_prec<float>
+{
+	typedef float vec __attribute__ ((vector_size (8 * IK_VEC_WIDTH)));
+	enum { width = 2 * IK_VEC_WIDTH, nv = 8 / (2 * IK_VEC_WIDTH), wrist_rot = 1 };
+};
 
+/// one value per branch, in inv_kin() order; v[] for arithmetic, s[] lane by lane
+template <typename T> union ik_lanes
+{
+	typename ik_prec<T>::vec v[ik_prec<T>::nv];
+	T s[8];
+};
 
+template <typename T> static inline typename ik_prec<T>::vec ikSplat(double x)
+{
+	typename ik_prec<T>::vec r;
+	for (int i=0; i<ik_prec<T>::width; i++)
+		r[i] = (T)x;
+	return r;
+}
 
-//------------------------------------------------------------------------------/
-//  Inverse kinematics
-//-------------------------------------------------------------------------------
+/**\fn const char *invKinSIMDName()
+ * \brief instruction set inv_kin_simd() was built for
+ */
+const char *invKinSIMDName()
+{
+	return IK_VEC_ISA;
+}
 
-/**\fn int r2_inv_kin(struct device *d0, int runlevel)
- * \brief run the ravenII inverse kinematics from device struct
- * \param d0  - a pointer points to robot_device struct
- * \param runlevel - an integer value represents the runlevel
- * \return 0 on success -1 on failure
+/**\fn template <typename T> static int invKinSIMD(const btTransform &in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
+ * \brief inv_kin() and check_solutions() in one pass, with the eight branches as vector lanes
+ *
+ * Every branch goes through the same arithmetic at once.  Only the inverse
+ * trig is done lane by lane.  T03 is built from cos/sin of theta 1 and 2 as
+ * they come out of the solve (no trig) and T36 from R03^T instead of a
+ * general inverse, so results agree with inv_kin() to roundoff, not bit for
+ * bit.  The rare lane where the wrist is straight (|s5| < IK_WRIST_TOL) is
+ * redone by the scalar path.
+ *
+ * T is the precision of the lanes.  The wrist points, the straight wrist
+ * and the fused check_solutions() stay in double either way.
+ *
+ * \param in_T06 - tool frame, as for inv_kin()
+ * \param in_arm - Arm type, left / right
+ * \param in_thetas - current joints, DH convention, as for check_solutions()
+ * \param iksol - all eight solutions, wrapped next to in_thetas as check_solutions() leaves them
+ * \param out_idx - the closest solution, or -1 if none is within check_solutions()' bound
+ * \param out_err - its error
+ * \return as inv_kin(): 0 - success, -1 - bad arm, -2 - too close to RCM.
  */
-int r2_inv_kin(struct device *d0, int runlevel)
+template <typename T>
+static int invKinSIMD(const btTransform &in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
 {
-	l_r arm;
-	btTransform xf;
-	struct orientation * ori_d;
-	struct position    * pos_d;
+	typedef typename ik_prec<T>::vec V;
+	const int NV = ik_prec<T>::nv;
 
-	//  Do FK for each mechanism
-	for (int m=0; m<NUM_MECH; m++)
+	out_idx = -1;
+	out_err = 0;
+	for (int l=0; l<8; l++)
 	{
-		// get arm type and wrist actuation angle
-		if (d0->mech[m].type == GOLD_ARM_SERIAL)
-			arm = dh_left;
-		else
-			arm = dh_right;
-
-		ori_d = &(d0->mech[m].ori_d);
-		pos_d = &(d0->mech[m].pos_d);
-
-		// copy R matrix
-		for (int i = 0; i < 3; i++)
-			for (int j = 0; j < 3; j++)
-				(xf.getBasis())[i][j] = ori_d->R[i][j];
+		iksol[l] = ik_zerosol;
+		iksol[l].arm = in_arm;
+	}
+	if  ( in_arm  >= dh_l_r_last)
+	{
+		for (int l=0; l<8; l++)
+			iksol[l].invalid = ik_invalid;
+		return -1;
+	}
 
-		xf.setBasis( btMatrix3x3(   ori_d->R[0][0], ori_d->R[0][1], ori_d->R[0][2],
-									ori_d->R[1][0], ori_d->R[1][1], ori_d->R[1][2],
-									ori_d->R[2][0], ori_d->R[2][1], ori_d->R[2][2]  ) );
-		xf.setOrigin( btVector3(pos_d->x/(1000.0*1000.0),pos_d->y/(1000.0*1000.0), pos_d->z/(1000.0*1000.0)));
+	//  Steps 1 and 2: wrist points and insertions, shared by four lanes each
+	btVector3 p05[2];
+	double insertion[2];
+	ikWristPoints(in_T06, p05);
+	for (int w=0; w<2; w++)
+	{
+		insertion[w] = p05[w].length();
+		if (insertion[w] <= Lw + IK_RCM_TOL)
+		{
+			for (int l=0; l<8; l++)
+				iksol[l].invalid = ik_invalid;
+			return -2;
+		}
+	}
 
-		const static btTransform zrot_l( btMatrix3x3 (cos(25*d2r),-sin(25*d2r),0,  sin(25*d2r),cos(25*d2r),0,  0,0,1), btVector3 (0,0,0) );
-		const static btTransform zrot_r( btMatrix3x3 (cos(-25*d2r),-sin(-25*d2r),0,  sin(-25*d2r),cos(-25*d2r),0,  0,0,1), btVector3 (0,0,0) );
+	ik_lanes<T> d3, px, py, pz, sgn2;
+	int invalid[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for (int l=0; l<8; l++)
+	{
+		d3.s[l]   = (l%4 < 2) ? -d4 - insertion[l/4] : -d4 + insertion[l/4];
+		px.s[l]   = p05[l/4][0];
+		py.s[l]   = p05[l/4][1];
+		pz.s[l]   = p05[l/4][2];
+		sgn2.s[l] = (l%2) ? -1 : 1;
+	}
 
+	const bool left = (in_arm == dh_left);
+	const V zero = ikSplat<T>(0);
 
-		if (arm == dh_left)
+	//  Step 3: cos theta 2
+	ik_lanes<T> c2, s2, d;
+	{
+		const V k = ikSplat<T>(1 / (GM1*GM3)), g24 = ikSplat<T>(GM2*GM4), vd4 = ikSplat<T>(d4);
+		for (int k_=0; k_<NV; k_++)
 		{
-			xf = zrot_l.inverse() * xf;
+			d.v[k_]  = d3.v[k_] + vd4;
+			c2.v[k_] = left ? k * ((zero - pz.v[k_]) / d.v[k_] - g24) : k * (pz.v[k_] / d.v[k_] + g24);
 		}
-		else
+	}
+	for (int l=0; l<8; l++)
+	{
+		T c = c2.s[l];
+		if (std::fabs(c) > 1 + IK_COS_TOL || c != c)
 		{
-			xf = zrot_r.inverse() * xf;
+			invalid[l] = 1;
+			c = 1;
 		}
+		else if (c > 1)
+			c = 1;
+		else if (c < -1)
+			c = -1;
+		c2.s[l] = c;
+		s2.s[l] = sgn2.s[l] * std::sqrt(1 - c*c);
+		iksol[l].th2 = sgn2.s[l] * std::acos(c);
+	}
 
-		//		DO IK
-		ik_solution iksol[8] = {{},{},{},{},{},{},{},{}};
-		int ret = inv_kin(xf, arm, iksol);
-		if (ret < 0)
-			log_msg("ik failed gracefully (arm%d ret:%d", arm, ret);
-
-		// Check solutions - compare IK solutions to current joint angles...
-		double wrist2 = (d0->mech[m].joint[GRASP2].jpos - d0->mech[m].joint[GRASP1].jpos) / 2.0; // grep "
-		double joints[6] = {
-				d0->mech[m].joint[SHOULDER].jpos,
-				d0->mech[m].joint[ELBOW   ].jpos,
-				d0->mech[m].joint[Z_INS   ].jpos,
-				d0->mech[m].joint[TOOL_ROT].jpos,
-				d0->mech[m].joint[WRIST   ].jpos,
-				wrist2
-		};
-
-		// convert from joint angle representation to DH theta convention
-		double lo_thetas[6];
-		joint2theta(lo_thetas, joints, arm);
-		int sol_idx=0;
-		double sol_err;
-		int check_result = 0;
-		if ( (check_result = check_solutions(lo_thetas, iksol, sol_idx, sol_err)) < 0)
+	//  Step 4: theta 1 from [B](c1 s1)' = xy(p05) / d
+	ik_lanes<T> c1, s1, det;
+	{
+		const V g3 = ikSplat<T>(GM3), g23 = ikSplat<T>(GM2*GM3), g14 = ikSplat<T>(left ? -GM1*GM4 : GM1*GM4);
+		for (int k=0; k<NV; k++)
 		{
-//			cout << "IK failed\n";
-			return -1;
+			V x  = px.v[k] / d.v[k];
+			V y  = py.v[k] / d.v[k];
+			V b1 = s2.v[k] * g3;
+			V b2 = c2.v[k] * g23 + g14;
+			det.v[k] = b1*b1 + b2*b2;
+			c1.v[k]  = left ? b1*x - b2*y : b1*x + b2*y;    // times det; the scale drops out below
+			s1.v[k]  = left ? b2*x + b1*y : b2*x - b1*y;
+		}
+	}
+	for (int l=0; l<8; l++)
+	{
+		if (det.s[l] < IK_DET_TOL)
+			invalid[l] = 1;
+		iksol[l].th1 = std::atan2(s1.s[l], c1.s[l]);
+		T r = std::sqrt(c1.s[l]*c1.s[l] + s1.s[l]*s1.s[l]);
+		if (r > 0)
+		{
+			c1.s[l] /= r;
+			s1.s[l] /= r;
 		}
+	}
 
-		double Js[6];
-		double Js_sat[6];
-		double thetas_sat[6];
-		btTransform xf_sat;
-		double gangle = double(d0->mech[m].ori_d.grasp) / 1000.0;
-		theta2joint(iksol[sol_idx], Js);
+	//  Step 5: T03 = L0(th1) L1(th2) L2(th3, d3), T36 = T03^-1 T06
+	const double *alpha = alphas[in_arm];
+	const double th3 = robot_thetas[in_arm][2];
+	const double ca0 = cos(alpha[0]), sa0 = sin(alpha[0]);
+	const double ca1 = cos(alpha[1]), sa1 = sin(alpha[1]);
+	const double ca2 = cos(alpha[2]), sa2 = sin(alpha[2]);
+	const double c3 = cos(th3), s3 = sin(th3);
+	// R2, constant per arm
+	const double R2[3][3] = {{c3,     -s3,     0   },
+	                         {s3*ca2,  c3*ca2, -sa2},
+	                         {s3*sa2,  c3*sa2,  ca2}};
+	const btMatrix3x3 &R06 = in_T06.getBasis();
+	const btVector3   &p06 = in_T06.getOrigin();
+
+	ik_lanes<T> c5, s5, c4, s4, c6, s6;
+	for (int k=0; k<NV; k++)
+	{
+		// R0(th1): [c1 -s1 0; s1 ca0  c1 ca0  -sa0; s1 sa0  c1 sa0  ca0], R1(th2) likewise
+		V R0[3][3] = {{c1.v[k],                 zero - s1.v[k],          zero          },
+		                  {s1.v[k]*ikSplat<T>(ca0),    c1.v[k]*ikSplat<T>(ca0),    ikSplat<T>(-sa0) },
+		                  {s1.v[k]*ikSplat<T>(sa0),    c1.v[k]*ikSplat<T>(sa0),    ikSplat<T>(ca0)  }};
+		V R1[3][3] = {{c2.v[k],                 zero - s2.v[k],          zero          },
+		                  {s2.v[k]*ikSplat<T>(ca1),    c2.v[k]*ikSplat<T>(ca1),    ikSplat<T>(-sa1) },
+		                  {s2.v[k]*ikSplat<T>(sa1),    c2.v[k]*ikSplat<T>(sa1),    ikSplat<T>(ca1)  }};
+		V R01[3][3], R03[3][3];
+		for (int i=0; i<3; i++)
+			for (int j=0; j<3; j++)
+				R01[i][j] = R0[i][0]*R1[0][j] + R0[i][1]*R1[1][j] + R0[i][2]*R1[2][j];
+		for (int i=0; i<3; i++)
+			for (int j=0; j<3; j++)
+				R03[i][j] = R01[i][0]*ikSplat<T>(R2[0][j]) + R01[i][1]*ikSplat<T>(R2[1][j]) + R01[i][2]*ikSplat<T>(R2[2][j]);
 
-		int limited = apply_joint_limits(Js,Js_sat);
-		if (limited)
+		// p03 = R01 (a2, -sa2 d3, ca2 d3); a2 = 0
+		V o1 = ikSplat<T>(-sa2) * d3.v[k], o2 = ikSplat<T>(ca2) * d3.v[k];
+		V dp[3];
+		for (int i=0; i<3; i++)
+			dp[i] = ikSplat<T>(p06[i]) - (R01[i][1]*o1 + R01[i][2]*o2);
+
+		// the parts of T36 the wrist angles need
+		V p36[3], R36_02, R36_12, R36_22, R36_20, R36_21;
+		for (int j=0; j<3; j++)
+			p36[j] = R03[0][j]*dp[0] + R03[1][j]*dp[1] + R03[2][j]*dp[2];
+		R36_02 = R03[0][0]*ikSplat<T>(R06[0][2]) + R03[1][0]*ikSplat<T>(R06[1][2]) + R03[2][0]*ikSplat<T>(R06[2][2]);
+		R36_12 = R03[0][1]*ikSplat<T>(R06[0][2]) + R03[1][1]*ikSplat<T>(R06[1][2]) + R03[2][1]*ikSplat<T>(R06[2][2]);
+		R36_22 = R03[0][2]*ikSplat<T>(R06[0][2]) + R03[1][2]*ikSplat<T>(R06[1][2]) + R03[2][2]*ikSplat<T>(R06[2][2]);
+		R36_20 = R03[0][2]*ikSplat<T>(R06[0][0]) + R03[1][2]*ikSplat<T>(R06[1][0]) + R03[2][2]*ikSplat<T>(R06[2][0]);
+		R36_21 = R03[0][2]*ikSplat<T>(R06[0][1]) + R03[1][2]*ikSplat<T>(R06[1][1]) + R03[2][2]*ikSplat<T>(R06[2][1]);
+
+		c5.v[k] = zero - R36_22;
+		s5.v[k] = (p36[2] - ikSplat<T>(d4)) / ikSplat<T>(Lw);
+		V lwc5 = ikSplat<T>(Lw) * c5.v[k];
+		V c4b  = R36_02 / s5.v[k], s4b = R36_12 / s5.v[k];   // theta 4 when c5 is too small to divide by
+		c4.v[k] = p36[0] / lwc5;
+		s4.v[k] = p36[1] / lwc5;
+		c6.v[k] = R36_20 / s5.v[k];
+		s6.v[k] = (zero - R36_21) / s5.v[k];
+		for (int i=0; i<ik_prec<T>::width; i++)
 		{
-			joint2theta(thetas_sat, Js_sat, arm);
-			fwd_kin(thetas_sat, arm, xf_sat);
-			d0->mech[m].pos_d.x = xf_sat.getOrigin()[0] * (1000.0*1000.0);
-			d0->mech[m].pos_d.y = xf_sat.getOrigin()[1] * (1000.0*1000.0);
-			d0->mech[m].pos_d.z = xf_sat.getOrigin()[2] * (1000.0*1000.0);
-			for (int i=0;i<3;i++)
-				for (int j=0; j<3; j++)
-					d0->mech[m].ori_d.R[i][j] = (xf_sat.getBasis())[i][j];
+			if (ik_prec<T>::wrist_rot || std::fabs(c5.v[k][i]) <= IK_WRIST_TOL)
+			{
+				c4.v[k][i] = c4b[i];
+				s4.v[k][i] = s4b[i];
+			}
+			if (ik_prec<T>::wrist_rot)
+			{
+				// |s5| from R36 as well; the wrist point only gives its sign
+				T r = std::sqrt(R36_02[i]*R36_02[i] + R36_12[i]*R36_12[i]);
+				s5.v[k][i] = (s5.v[k][i] < 0) ? -r : r;
+			}
+		}
+	}
 
-			updateMasterRelativeOrigin(d0);
+	for (int l=0; l<8; l++)
+	{
+		iksol[l].d3 = d3.s[l];
+		if (invalid[l])
+		{
+			iksol[l].invalid = ik_invalid;
+			continue;
 		}
-		else
+		if (std::fabs(s5.s[l]) <= IK_WRIST_TOL)
 		{
-			for (int satloop=0; satloop<6; satloop++)
-				Js_sat[satloop] = Js[satloop];
+			// straight wrist: theta 6 needs the full T56, leave it to the scalar path
+			ikSolveBranch(in_T06, in_arm, p05[l/4], iksol[l].d3, l%2, iksol[l]);
+			continue;
 		}
+		iksol[l].th4 = std::atan2(s4.s[l], c4.s[l]);
+		iksol[l].th5 = std::atan2(s5.s[l], c5.s[l]);
+		iksol[l].th6 = std::atan2(s6.s[l], c6.s[l]);
+	}
 
-		d0->mech[m].joint[SHOULDER].jpos_d = Js_sat[0];
-		d0->mech[m].joint[ELBOW   ].jpos_d = Js_sat[1];
-		d0->mech[m].joint[Z_INS   ].jpos_d = Js_sat[2];
-		d0->mech[m].joint[TOOL_ROT].jpos_d = Js_sat[3];
-		d0->mech[m].joint[WRIST   ].jpos_d = Js_sat[4];
-		d0->mech[m].joint[GRASP1  ].jpos_d = -Js[5] +  gangle / 2;
-		d0->mech[m].joint[GRASP2  ].jpos_d =  Js[5] +  gangle / 2;
+	//  Fused check_solutions(): same wrapping, same error, same tie break
+	double minerr = 32765;
+	for (int l=0; l<8; l++)
+	{
+		ik_solution &sol = iksol[l];
+		if (sol.invalid == ik_invalid)
+			continue;
 
-		if (printIK !=0 )// && d0->mech[m].type == GREEN_ARM_SERIAL )
+		if ( fabs(in_thetas[3] - sol.th4) > 300 * d2r )
+			sol.th4 += (in_thetas[3] > sol.th4) ? 2 * M_PI : -2 * M_PI;
+		sol.th1 = in_thetas[0] + remainder(sol.th1 - in_thetas[0], 2 * M_PI);
+		sol.th2 = in_thetas[1] + remainder(sol.th2 - in_thetas[1], 2 * M_PI);
+		sol.th5 = in_thetas[4] + remainder(sol.th5 - in_thetas[4], 2 * M_PI);
+		sol.th6 = in_thetas[5] + remainder(sol.th6 - in_thetas[5], 2 * M_PI);
+
+		double e0 = in_thetas[0] - sol.th1, e1 = in_thetas[1] - sol.th2, e2 = 100*(in_thetas[2] - sol.d3);
+		double e3 = in_thetas[3] - sol.th4, e4 = in_thetas[4] - sol.th5, e5 = in_thetas[5] - sol.th6;
+		double s2err = e0*e0 + e1*e1 + e2*e2 + e3*e3 + e4*e4 + e5*e5;
+		if (s2err < minerr)      // ties go to the lower index
 		{
-			log_msg("All IK solutions for mechanism %d.  Chosen solution:%d:",m, sol_idx);
-			log_msg("Current     :\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f (\t %3f/\t %3f))",
-					joints[0] * r2d,
-					joints[1] * r2d,
-					joints[2],
-					joints[3] * r2d,
-					joints[4] * r2d,
-					joints[5] * r2d,
-					d0->mech[m].joint[GRASP2].jpos  * r2d,
-					d0->mech[m].joint[GRASP2].jpos * r2d
-			);
-			for (int i=0; i<8; i++)
-			{
-				theta2joint(iksol[i], Js);
-				log_msg("ik_joints[%d]:\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f)",i,
-						Js[0] * r2d,
-						Js[1] * r2d,
-						Js[2],
-						Js[3] * r2d,
-						Js[4] * r2d,
-						Js[5] * r2d
-						);
-			}
+			minerr = s2err;
+			out_idx = l;
 		}
 	}
+	if (out_idx >= 0 && minerr > M_PI)
+		out_idx = -1;
+	if (out_idx >= 0)
+		out_err = minerr;
+	return 0;
+}
 
-	printIK=0;
+/**\fn int inv_kin_simd_prec(kin_precision prec, btTransform in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
+ * \brief inv_kin_simd() in the given precision, whatever init_kinematics() chose
+ */
+int inv_kin_simd_prec(kin_precision prec, btTransform in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
+{
+	if (prec == KIN_FLOAT)
+		return invKinSIMD<float>(in_T06, in_arm, in_thetas, iksol, out_idx, out_err);
+	return invKinSIMD<double>(in_T06, in_arm, in_thetas, iksol, out_idx, out_err);
+}
 
-	return 0;
+/**\fn int inv_kin_simd(btTransform in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
+ * \brief the vector IK kernel in the precision init_kinematics() chose, see invKinSIMD()
+ */
+int inv_kin_simd(btTransform in_T06, l_r in_arm, double *in_thetas, ik_solution iksol[8], int &out_idx, double &out_err)
+{
+	return inv_kin_simd_prec(kin_prec, in_T06, in_arm, in_thetas, iksol, out_idx, out_err);
 }
 
-/**\fn int  __attribute__ ((optimize("0"))) inv_kin(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
- * \brief Runs the Raven II INVERSE kinematics to determine end effector position.
+//--------------------------------------------------------------------------------
+//  Precision policy
+//--------------------------------------------------------------------------------
+
+/**\fn kin_precision kinPrecision()
+ * \brief precision fwd_kin() and inv_kin_simd() run in
+ */
+kin_precision kinPrecision()
+{
+	return kin_prec;
+}
+
+/**\fn const char *kinPrecisionName(kin_precision prec)
+ * \brief "double" or "float"
+ */
+const char *kinPrecisionName(kin_precision prec)
+{
+	return (prec == KIN_FLOAT) ? "float" : "double";
+}
+
+/**\fn static void poseError(const double Ra[3][3], const double pa[3], const double Rb[3][3], const double pb[3], double &pos_err, double &rot_err)
+ * \brief distance (m) and small rotation angle (rad) between two poses; keeps the larger of each
+ */
+static void poseError(const double Ra[3][3], const double pa[3], const double Rb[3][3], const double pb[3], double &pos_err, double &rot_err)
+{
+	double dp[3], M[3][3];
+	for (int i=0; i<3; i++)
+	{
+		dp[i] = pb[i] - pa[i];
+		for (int j=0; j<3; j++)
+			M[i][j] = Ra[0][i]*Rb[0][j] + Ra[1][i]*Rb[1][j] + Ra[2][i]*Rb[2][j];   // Ra^T Rb
+	}
+	// the axis-angle vector of Ra^T Rb, to first order
+	double w0 = M[2][1] - M[1][2], w1 = M[0][2] - M[2][0], w2 = M[1][0] - M[0][1];
+	pos_err = std::max(pos_err, sqrt(dp[0]*dp[0] + dp[1]*dp[1] + dp[2]*dp[2]));
+	rot_err = std::max(rot_err, 0.5 * sqrt(w0*w0 + w1*w1 + w2*w2));
+}
+
+/**\fn template <typename T> static void fkToolPoseD(const double in_thetas[6], l_r in_arm, double R[3][3], double p[3])
+ * \brief fkToolPose() in precision T, widened to double
+ */
+template <typename T>
+static void fkToolPoseD(const double in_thetas[6], l_r in_arm, double R[3][3], double p[3])
+{
+	T Rt[3][3], pt[3];
+	fkToolPose(in_thetas, in_arm, Rt, pt);
+	for (int i=0; i<3; i++)
+	{
+		p[i] = pt[i];
+		for (int j=0; j<3; j++)
+			R[i][j] = Rt[i][j];
+	}
+}
+
+/**\fn int validateKinPrecision(int grid, kin_precision_report &out)
+ * \brief worst-case error of the float kernels against the double ones
+ *
+ * Runs both arms over grid cells per joint inside the joint limits, one
+ * point at a fixed pseudo-random place in each cell.  FK of each point is compared directly.  For IK the pose is
+ * solved both ways with the point as the current joints, and the double
+ * FK of each chosen solution compared, so a float error is measured as
+ * the pose it would command.
+ *
+ * \param grid cells per joint: grid^6 joint positions per arm
+ * \param out the worst errors seen
+ * \return 0 if every float IK matched the double branch, else the number of mismatches
+ */
+int validateKinPrecision(int grid, kin_precision_report &out)
+{
+	const double lo[6] = { SHOULDER_MIN_LIMIT, ELBOW_MIN_LIMIT, Z_INS_MIN_LIMIT, -150 DEG2RAD, WRIST_MIN_LIMIT, -45 DEG2RAD };
+	const double hi[6] = { SHOULDER_MAX_LIMIT, ELBOW_MAX_LIMIT, Z_INS_MAX_LIMIT,  150 DEG2RAD, WRIST_MAX_LIMIT,  45 DEG2RAD };
+	unsigned int seed = 12345;
+	int n = 1;
+
+	memset(&out, 0, sizeof(out));
+	if (grid < 1)
+		grid = 1;
+	for (int i=0; i<6; i++)
+		n *= grid;
+
+	for (int arm_i=0; arm_i<2; arm_i++)
+	{
+		l_r arm = arm_i ? dh_right : dh_left;
+		for (int k=0; k<n; k++)
+		{
+			double J[6], thetas[6];
+			for (int i=0, q=k; i<6; i++, q/=grid)
+			{
+				// anywhere in the grid cell, so conditioning that only goes bad near one value is not stepped over
+				seed = seed * 1103515245 + 12345;
+				J[i] = lo[i] + (hi[i] - lo[i]) * ((q % grid) + (seed >> 8) / 16777216.0) / grid;
+			}
+			joint2theta(thetas, J, arm);
+			out.samples++;
+
+			double Rd[3][3], pd[3], Rf[3][3], pf[3];
+			fkToolPoseD<double>(thetas, arm, Rd, pd);
+			fkToolPoseD<float>(thetas, arm, Rf, pf);
+			poseError(Rd, pd, Rf, pf, out.fk_pos_err, out.fk_rot_err);
+
+			// the pose in the untilted frame inv_kin() takes
+			btTransform xf(btMatrix3x3(Rd[0][0], Rd[0][1], Rd[0][2],
+									   Rd[1][0], Rd[1][1], Rd[1][2],
+									   Rd[2][0], Rd[2][1], Rd[2][2]), btVector3(pd[0], pd[1], pd[2]));
+			xf = fk_zrot[arm].inverse() * xf;
+
+			ik_solution sol_d[8], sol_f[8];
+			int idx_d, idx_f;
+			double err_d, err_f;
+			invKinSIMD<double>(xf, arm, thetas, sol_d, idx_d, err_d);
+			invKinSIMD<float>(xf, arm, thetas, sol_f, idx_f, err_f);
+			if (idx_d < 0)
+				continue;
+			if (idx_f != idx_d)
+			{
+				out.ik_mismatch++;
+				continue;
+			}
+			double th_d[6] = { sol_d[idx_d].th1, sol_d[idx_d].th2, sol_d[idx_d].d3, sol_d[idx_d].th4, sol_d[idx_d].th5, sol_d[idx_d].th6 };
+			double th_f[6] = { sol_f[idx_f].th1, sol_f[idx_f].th2, sol_f[idx_f].d3, sol_f[idx_f].th4, sol_f[idx_f].th5, sol_f[idx_f].th6 };
+			fkToolPoseD<double>(th_d, arm, Rd, pd);
+			fkToolPoseD<double>(th_f, arm, Rf, pf);
+			poseError(Rd, pd, Rf, pf, out.ik_pos_err, out.ik_rot_err);
+		}
+	}
+	return out.ik_mismatch;
+}
+
+/**\fn int  __attribute__ ((optimize("0"))) inv_kin_reference(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
+ * \brief The original inverse kinematics, kept as the reference for r2_kinematics_bench -v.
+ *        Not used by the controller: goes through the shared DH table and needs -O0.
  * \param in_T06 - a btTransfrom obejct, transforms the end effector frame to zero frame
  * \param in_arm - Arm type, left / right ( kin.armtype arm = left/right)
  * \param ik_solution iksol[8] - 8 element array of joint angles ( float j[] = {shoulder, elbow, vacant joint, ins,roll, wrist, grasp1, grasp2} )
  * \return 0 - success, -1 - bad arm, -2 - too close to RCM.
- * \question  why this? attribute optimize(0)
  */
  
-int  __attribute__ ((optimize("0"))) inv_kin(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
+int  __attribute__ ((optimize("0"))) inv_kin_reference(btTransform in_T06, l_r in_arm, ik_solution iksol[8])
 {
 	dh_theta = robot_thetas[in_arm];
 	dh_d     = ds[in_arm];
@@ -760,6 +2043,12 @@ int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx, double
 				iksol[i].th4 -= 2 * M_PI;
 		}
 
+		// atan2() wraps at +/-180: take the other revolute joints within 180 of where they are
+		iksol[i].th1 = in_thetas[0] + remainder(iksol[i].th1 - in_thetas[0], 2 * M_PI);
+		iksol[i].th2 = in_thetas[1] + remainder(iksol[i].th2 - in_thetas[1], 2 * M_PI);
+		iksol[i].th5 = in_thetas[4] + remainder(iksol[i].th5 - in_thetas[4], 2 * M_PI);
+		iksol[i].th6 = in_thetas[5] + remainder(iksol[i].th6 - in_thetas[5], 2 * M_PI);
+
 		double s2err = 0;
 		s2err += pow(in_thetas[0] - iksol[i].th1, 2);
 		s2err += pow(in_thetas[1] - iksol[i].th2, 2);
@@ -767,7 +2056,7 @@ int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx, double
 		s2err += pow(in_thetas[3] - iksol[i].th4, 2);
 		s2err += pow(in_thetas[4] - iksol[i].th5, 2);
 		s2err += pow(in_thetas[5] - iksol[i].th6, 2);
-		if (s2err < minerr)
+		if (s2err < minerr)      // ties go to the lower index
 		{
 			minerr=s2err;
 			minidx=i;
@@ -778,7 +2067,7 @@ int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx, double
 	{
 		minidx=9;
 		minerr = 0;
-		if (gTime %100 == 0 && iksol[minidx].arm == dh_left)
+		if (!ik_quiet && gTime % MS_TO_TICKS(100) == 0 && iksol[0].arm == dh_left)
 		{
 			cout << "failed (err>eps) on j=\t\t(" << in_thetas[0] * r2d << ",\t" << in_thetas[1] *r2d << ",\t" << in_thetas[2] << ",\t" << in_thetas[3] * r2d << ",\t" << in_thetas[4] * r2d << ",\t" << in_thetas[5] * r2d << ")"<<endl;
 			for (int idx=0;idx<8;idx++)
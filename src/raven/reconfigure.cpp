@@ -21,13 +21,95 @@
 #include <raven_2/MyStuffConfig.h>
 #include <ros/ros.h>
 #include "reconfigure.h"
+#include "local_io.h"
+#include "state_estimate.h"
+#include "control_config.h"
+#include "shared_state.h"
 
-struct offsets offsets_l;
-struct offsets offsets_r;
+// Visualisation offsets: written by the ROS spinner, read by the publish
+// thread through the seqlock, on lines of their own
+static struct
+{
+  volatile unsigned int seq __attribute__((aligned(CACHE_LINE)));   // odd while reconfigure_callback() writes
+  struct offsets l;
+  struct offsets r;
+} vis_offsets;
+
+// Position filter settings last seen from dynamic_reconfigure, per joint class
+static struct lpf_setting lpf_seen[2];
+
+/**\fn static void reconfigureLPF(int joint_class, double cutoff_hz, int order, bool bessel, uint32_t level)
+ * \brief Apply one joint class's filter setting if it changed since the last callback
+ *
+ * The first call only records the .cfg defaults, so the parameter server
+ * settings from init_state_lpf() stay until a filter slider is moved.
+ */
+static void reconfigureLPF(int joint_class, double cutoff_hz, int order, bool bessel, uint32_t level)
+{
+  struct lpf_setting s = { bessel ? LPF_BESSEL : LPF_BUTTERWORTH, (float)cutoff_hz, order };
+  struct lpf_setting &seen = lpf_seen[joint_class];
+  bool changed = s.design != seen.design || s.cutoff_hz != seen.cutoff_hz || s.order != seen.order;
+
+  seen = s;
+  if (level == ~0u || !changed)
+    return;
+  if (setStateLPFClass(joint_class, s.design, s.cutoff_hz, s.order) < 0)
+    ROS_WARN("Reconfigure: no order %d filter at %.1f Hz for the %s joints", order, cutoff_hz,
+             joint_class == LPF_CLASS_ARM ? "arm" : "tool");
+}
+
+/**\fn void getVisualOffsets(struct offsets *l, struct offsets *r)
+ * \brief a consistent copy of both arms' visualisation offsets
+ */
+void getVisualOffsets(struct offsets *l, struct offsets *r)
+{
+  unsigned int seq;
+  do
+    {
+      seq = vis_offsets.seq;
+      __sync_synchronize();
+      *l = vis_offsets.l;
+      *r = vis_offsets.r;
+      __sync_synchronize();
+    }
+  while ((seq & 1) || seq != vis_offsets.seq);
+}
+
+/**\fn static void reconfigureGains(raven_2::MyStuffConfig &config, uint32_t level)
+ * \brief Publish new gain scales, or gains and limits re-read from the parameter server
+ *
+ * The new set is built here and swapped in by the control loop at its
+ * next cycle.  reload_gains is cleared once done.
+ */
+static void reconfigureGains(raven_2::MyStuffConfig &config, uint32_t level)
+{
+  struct ctrl_config c;
+  configLatest(&c);
+  bool scaled = c.kp_scale != (float)config.kp_scale || c.kd_scale != (float)config.kd_scale ||
+                c.ki_scale != (float)config.ki_scale;
+
+  c.kp_scale = config.kp_scale;
+  c.kd_scale = config.kd_scale;
+  c.ki_scale = config.ki_scale;
+  if (config.reload_gains)
+    {
+      ros::NodeHandle n;
+      config.reload_gains = false;
+      if (configReadParams(n, &c) < 0)
+        return;
+    }
+  else if (!scaled)
+    return;
+
+  if (configPublish(&c) < 0)
+    ROS_WARN("Reconfigure: gains or joint limits out of range, not changed");
+}
 
 // Dynamic reconfigure callback 
 void reconfigure_callback(raven_2::MyStuffConfig &config, uint32_t level)
 {
+  struct offsets offsets_l, offsets_r;
+
   ROS_INFO("Reconfigure request : %f  ", config.shoulder_l);
   offsets_l.shoulder_off =  config.shoulder_l* M_PI/180.0;
   offsets_l.elbow_off =     config.elbow_l*    M_PI/180.0;
@@ -45,6 +127,31 @@ void reconfigure_callback(raven_2::MyStuffConfig &config, uint32_t level)
   offsets_r.grasp1_off =    config.grasp1_r*   M_PI/180.0;
   offsets_r.grasp2_off =    config.grasp2_r*   M_PI/180.0;
 
+  vis_offsets.seq++;
+  __sync_synchronize();
+  vis_offsets.l = offsets_l;
+  vis_offsets.r = offsets_r;
+  __sync_synchronize();
+  vis_offsets.seq++;
+
+  // Publish rates.  The first call (level ~0) only carries the .cfg defaults;
+  // the rates from the parameter server set in init_ravenstate_publishing() win.
+  if (level != ~0u)
+    {
+      setPublishRate(PUB_RAVENSTATE, config.ravenstate_rate_hz);
+      setPublishRate(PUB_JOINTS,     config.joint_states_rate_hz);
+      setPublishRate(PUB_MARKER,     config.marker_rate_hz);
+      setPublishOnEvent(config.publish_on_event);
+    }
+
+  // Position filters, swapped in at the next cycle
+  reconfigureLPF(LPF_CLASS_ARM,  config.lpf_arm_cutoff_hz,  config.lpf_arm_order,  config.lpf_arm_bessel,  level);
+  reconfigureLPF(LPF_CLASS_TOOL, config.lpf_tool_cutoff_hz, config.lpf_tool_order, config.lpf_tool_bessel, level);
+
+  // Gains and joint limits, likewise; the first call leaves the parameter server's
+  if (level != ~0u)
+    reconfigureGains(config, level);
+
   // do nothing for now
 }
 
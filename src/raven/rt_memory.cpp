@@ -0,0 +1,200 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file rt_memory.cpp
+ * \brief Locked, prefaulted memory arena and heap reserve for the RT path.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h> // Needed for mlockall()
+#include <unistd.h>   // needed for sysconf(int name);
+#include <malloc.h>
+
+#include "rt_memory.h"
+#include "log.h"
+
+static char  *arena_base = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;    // also the high-water mark: the arena never frees
+
+/**\fn int rt_arena_init(size_t size)
+ * \brief map, lock and prefault the RT arena
+ * \param size arena size in bytes
+ * \return 0 on success, -1 on failure
+ */
+int rt_arena_init(size_t size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        perror("rt arena mmap failed:");
+        return -1;
+    }
+    if (mlock(mem, size))
+        perror("rt arena mlock failed:");
+
+    rt_prefault(mem, size);
+    arena_base = (char*)mem;
+    arena_size = size;
+    arena_used = 0;
+    return 0;
+}
+
+/**\fn void* rt_arena_alloc(size_t size, size_t align)
+ * \brief carve a zeroed block out of the RT arena.  Startup only: not thread safe, never freed.
+ * \param size  bytes to allocate
+ * \param align alignment, power of two (default: one cache line)
+ * \return pointer to the block, NULL if the arena is exhausted
+ */
+void* rt_arena_alloc(size_t size, size_t align)
+{
+    size_t off = (arena_used + align - 1) & ~(align - 1);
+    if (arena_base == NULL || off + size > arena_size)
+    {
+        err_msg("ERROR: RT arena exhausted (%lu of %lu bytes used, %lu requested)",
+                (unsigned long)arena_used, (unsigned long)arena_size, (unsigned long)size);
+        return NULL;
+    }
+    arena_used = off + size;
+    memset(arena_base + off, 0, size);
+    return arena_base + off;
+}
+
+/**\fn size_t rt_arena_used()
+ * \return bytes of the RT arena in use
+ */
+size_t rt_arena_used()
+{
+    return arena_used;
+}
+
+/**\fn void rt_prefault(void *mem, size_t size)
+ * \brief touch every page of a block so it is mapped (and locked, after mlockall) before the RT loop runs
+ * \param mem  start of the block
+ * \param size size of the block in bytes
+ */
+void rt_prefault(void *mem, size_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile char *p = (volatile char*)mem;
+    for (size_t i = 0; i < size; i += page_size)
+        p[i] = p[i];
+    if (size > 0)
+        p[size-1] = p[size-1];
+}
+
+/**\fn void rt_prefault_stack()
+ * \brief fault in the top RT_STACK_PREFAULT bytes of the calling thread's stack
+ */
+void rt_prefault_stack()
+{
+    volatile unsigned char dummy[RT_STACK_PREFAULT];
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(dummy); i += page_size)
+        dummy[i] = 0;
+}
+
+/**
+ *  From PREEMPT_RT Dynamic memory allocation tips page.
+ *  This function creates a pool of memory in ram for use with any malloc or new calls so that they do not cause page faults.
+ *  https://rt.wiki.kernel.org/index.php/Dynamic_memory_allocation_example
+ *
+ *  The RT path itself runs out of the RT arena and prefaulted statics, so the
+ *  heap reserve only has to cover library allocations (ROS, libstdc++).
+ */
+int initialize_rt_memory_pool()
+{
+  int i, page_size;
+  char* buffer;
+
+  // Now lock all current and future pages from preventing of being paged
+  if (mlockall(MCL_CURRENT | MCL_FUTURE ))
+    {
+      perror("mlockall failed:");
+      return -1;
+    }
+  mallopt (M_TRIM_THRESHOLD, -1);  // Turn off malloc trimming.
+  mallopt (M_MMAP_MAX, 0);         // Turn off mmap usage.
+
+  page_size = sysconf(_SC_PAGESIZE);
+  buffer = (char *)malloc(RT_HEAP_RESERVE);
+  if (buffer == NULL)
+    {
+      perror("heap reserve malloc failed:");
+      return -1;
+    }
+
+  // Touch each page in this piece of memory to get it mapped into RAM for performance improvement
+  // Once the pagefault is handled a page will be locked in memory and never given back to the system.
+  for (i=0; i < RT_HEAP_RESERVE; i+=page_size)
+    {
+      buffer[i] = 0;
+    }
+  free(buffer);        // buffer is now released but mem is locked to process
+
+  rt_memory_report("startup");
+  return 0;
+}
+
+/**\fn static long proc_status_kb(const char *key)
+ * \brief read a "Key:   N kB" line from /proc/self/status
+ */
+static long proc_status_kb(const char *key)
+{
+    char line[128];
+    long val = -1;
+    size_t keylen = strlen(key);
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, key, keylen) == 0 && line[keylen] == ':')
+        {
+            val = atol(line + keylen + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return val;
+}
+
+/**\fn void rt_memory_report(const char *when)
+ * \brief log the RT arena high-water mark and the locked / resident footprint
+ * \param when label for the report
+ */
+void rt_memory_report(const char *when)
+{
+    unsigned long heap_kb;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();      // mallinfo() is deprecated from glibc 2.33
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    heap_kb = (unsigned long)mi.uordblks / 1024;
+
+    log_msg("RT memory (%s): arena %lu/%lu kB, heap in use %lu kB, locked %ld kB, resident %ld kB (peak %ld kB)",
+            when,
+            (unsigned long)(arena_used / 1024), (unsigned long)(arena_size / 1024),
+            heap_kb,
+            proc_status_kb("VmLck"), proc_status_kb("VmRSS"), proc_status_kb("VmHWM"));
+}
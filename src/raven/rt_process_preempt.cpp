@@ -61,85 +61,101 @@
 #include "console_process.h"
 #include "rt_raven.h"
 #include "r2_kinematics.h"
+#include "cable_coupling.h"
 #include "network_layer.h"
 #include "parallel.h"
 #include "reconfigure.h"
+#include "cycle_timing.h"
+#include "cpu_affinity.h"
+#include "cycle_scheduler.h"
+#include "rt_memory.h"
+#include "usb_workers.h"
+#include "arm_pipeline.h"
+#include "usb_ring.h"
+#include "teleop_jitter.h"
+#include "teleop_protocol.h"
+#include "feedback.h"
+#include "net_log.h"
+#include "teleop_session.h"
+#include "setpoint_interp.h"
+#include "waypoint_stream.h"
+#include "flight_recorder.h"
+#include "blackbox.h"
+#include "usb_replay.h"
+#include "state_shm.h"
+#include "ext_cmd.h"
+#include "kin_service.h"
+#include "rt_watchdog.h"
+#include "executor.h"
+#include "controller.h"
+#include "usb_sim.h"
+#include "control_clock.h"
+#include "velocity_estimate.h"
+#include "grav_comp.h"
+#include "homing.h"
+#include "calibration.h"
+#include "flight_archive.h"
+#include "usb_health.h"
+#include "startup_profile.h"
+#include "control_config.h"
+#include "metrics.h"
+#include "tracepoint.h"
+#include "shared_state.h"
 
 using namespace std;
 
 // Defines
-#define POOLSIZE (200*1024*1024) // 200 MB   Size of mlocked memory pool
-
 #define NS  1
 #define US  (1000 * NS)
 #define MS  (1000 * US)
 #define SEC (1000 * MS)
 
-//Global Variables
-unsigned long int gTime;
-int initialized=0;     // State initialized flag
-int soft_estopped=0;   // Soft estop flag- indicate desired software estop.
-
-int    deviceType = SURGICAL_ROBOT;//PULLEY_BOARD;
-struct device device0 ={0};  //Declaration Moved outside rt loop for access from console thread
-int    mech_gravcomp_done[2]={0};
-
-int NUM_MECH=0;   // Define NUM_MECH as a C variable, not a c++ variable
+//Global Variables from globals.cpp
+extern unsigned long int gTime;
+extern int initialized;
+extern int deviceType;
+extern struct device device0;
+extern int NUM_MECH;
+extern struct cycle_sched rt_sched;
+extern int cycle_overrun_policy;
+extern int cycle_max_backlog;
+extern int cycle_max_consecutive_missed;
+extern int usb_wait_mode;
+extern int usb_wait_timeout_us;
+extern int usb_io_mode;
+extern int usb_backend;
+
+static int rt_start_delay_ms = 100;   // first control cycle this long after the RT thread starts
 
 pthread_t rt_thread;
 pthread_t net_thread;
 pthread_t console_thread;
 pthread_t reconfigure_thread;
+pthread_t publish_thread;
+pthread_t feedback_thread;
+pthread_t net_log_thread;
+pthread_t flight_recorder_thread;
+pthread_t flight_archive_thread;
+pthread_t blackbox_thread;
+pthread_t calibration_thread;
+pthread_t usb_reattach_thread;
+pthread_t metrics_thread;
+pthread_t gravity_thread;
+pthread_t log_thread;
+pthread_t watchdog_thread;
 
-//Global Variables from globals.c
 extern struct DOF_type DOF_types[];
 
-// flag to kill loops and stuff
-int r2_kill = 0;
-
 /**
 * Traps the Ctrl-C Signal
 * \param sig The signal number sent.
 */
 void sigTrap(int sig){
   log_msg("r2_control terminating on signal %d\n", sig);
-  r2_kill = 1;
+  r2Kill();
   if (ros::ok()) ros::shutdown();
 }
 
-/**
- *  From PREEMPT_RT Dynamic memory allocation tips page.
- *  This function creates a pool of memory in ram for use with any malloc or new calls so that they do not cause page faults.
- *  https://rt.wiki.kernel.org/index.php/Dynamic_memory_allocation_example
- */
-int initialize_rt_memory_pool()
-{
-  int i, page_size;
-  char* buffer;
-
-  // Now lock all current and future pages from preventing of being paged
-  if (mlockall(MCL_CURRENT | MCL_FUTURE ))
-    {
-      perror("mlockall failed:");
-      return -1;
-    }
-  mallopt (M_TRIM_THRESHOLD, -1);  // Turn off malloc trimming.
-  mallopt (M_MMAP_MAX, 0);         // Turn off mmap usage.
-
-  page_size = sysconf(_SC_PAGESIZE);
-  buffer = (char *)malloc(POOLSIZE);
-
-  // Touch each page in this piece of memory to get it mapped into RAM for performance improvement
-  // Once the pagefault is handled a page will be locked in memory and never given back to the system.
-  for (i=0; i < POOLSIZE; i+=page_size)
-    {
-      buffer[i] = 0;
-    }
-  free(buffer);        // buffer is now released but mem is locked to process
-
-  return 0;
-}
-
 /**
  * This is the real time thread.
  *
@@ -154,29 +170,35 @@ static void *rt_process(void* )
     {
       0
     };
-  struct timespec t, tnow, t2, tbz;                           // Tracks the timer value
-  int interval= 1 * MS;                        // task period in nanoseconds
-
-  //CPU locking doesn't help timing.  Oh well.
-  //Lock thread to first available CPU
-  // cpu_set_t set;
-  // CPU_ZERO(&set);
-  // CPU_SET(0,&set);
-  // if (sched_setaffinity(0,sizeof(set),&set) < 0)
-  //   {
-  //     perror("sched_setaffinity() failed");
-  //     exit(-1);
-  //   }
+  struct timespec tnow, t2, tbz;                              // Tracks the timer value
+  struct timespec tstage, twake, tlastwake;                   // Per-stage cycle timing
+  int interval= SEC / control_rate_hz;         // task period in nanoseconds
+  int phase = startupPhaseBegin("RT thread setup");
+
+  // Map the stack pages we will use now, not on the first deep call in the loop
+  rt_prefault_stack();
+
+  // Lock thread to the RT cpu (/cpu_rt), if one is configured
+  if (set_thread_affinity(ROLE_RT) < 0)
+    {
+      perror("sched_setaffinity() failed");
+      exit(-1);
+    }
   
-  // set thread priority and stuff
+  // set thread priority and stuff.  A lockstep loop never sleeps: keep it off SCHED_FIFO.
   struct sched_param param;                    // process / thread priority settings
   param.sched_priority = 99;
-  log_msg("Using realtime, priority: %d", param.sched_priority);
-  int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
-  if (ret != 0)
+  if (controlClockLockstep())
+    log_msg("Lockstep: not using realtime priority");
+  else
     {
-      perror("pthread_setscheduler failed");
-      exit(-1);
+      log_msg("Using realtime, priority: %d", param.sched_priority);
+      int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+      if (ret != 0)
+        {
+          perror("pthread_setscheduler failed");
+          exit(-1);
+        }
     }
 
   currParams.runlevel = STOP;
@@ -190,80 +212,128 @@ static void *rt_process(void* )
   // initialize global loop count
   gTime=0;
 
-  // Setup periodic timer
-  clock_gettime(CLOCK_REALTIME,&t);   // get current time
-  t.tv_sec += 1;                      // start after short delay
-  tsnorm(&t);
-  clock_nanosleep(0, TIMER_ABSTIME, &t, NULL);
+  // Setup periodic timer, start after short delay
+  cycleSchedInit(&rt_sched, interval, cycle_overrun_policy, cycle_max_backlog, (long)rt_start_delay_ms * MS);
 
+  startupPhaseEnd(phase);
+  startupProfileReport();
   log_msg("*** Ready to teleoperate ***");
 
+  cycleTimingStart(&tlastwake);
+
 
 
 
   // --- Main robot control loop ---
-  // TODO: Break when board becomes disconnected.
-  while (ros::ok() && !r2_kill)
+  // A board that drops out is given up and reopened by usbHealthCheck()
+  while (ros::ok() && !r2Killed())
     {
       
+      // Replaying a recording: step to its next cycle
+      if (usbReplayActive() && usbReplayNext() < 0)
+	break;
+
       // Initiate USB Read
+      cycleTimingStart(&tstage);
+      traceBegin(TS_USB_INITIATE);
       initiateUSBGet(&device0);
+      traceEnd(TS_USB_INITIATE);
+      cycleTimingMark(CT_USB_INITIATE, &tstage);
 
-      // Set next timer-shot (must be in future)
-      clock_gettime(CLOCK_REALTIME,&tnow);
-      int sleeploops = 0;
-      while (isbefore(t,tnow))
-        {
-	  t.tv_nsec+=interval;
-	  tsnorm(&t);
-	  sleeploops++;
-        }
-      if (sleeploops!=1)
-	std::cout<< "slplup"<< sleeploops <<std::endl;
-
-      parport_out(0x00);
-      /// SLEEP until next timer shot
-      clock_nanosleep(0, TIMER_ABSTIME, &t, NULL);
-      parport_out(0x03);
+      /// SLEEP until next deadline (missed deadlines are counted in rt_sched)
+      traceBegin(TS_SLEEP);
+      cycleSchedWait(&rt_sched);
+      traceEnd(TS_SLEEP);
       gTime++;
 
+      // Gains and limits published since the last cycle
+      configSwap();
+
+      cycleTimingStart(&twake);
+      tstage = tlastwake;
+      cycleTimingMark(CT_PERIOD, &tstage);
+      tlastwake = twake;
+      tstage = twake;
+
       // Get USB data that's been initiated already
       // Get and Process USB Packets
 
-      // HACK HACK HACK
-      // loop until data ready 
-      // better to ensure realtime access to driver
       int loops = 0;
       int ret;
 
-      clock_gettime(CLOCK_REALTIME,&tbz);
-      clock_gettime(CLOCK_REALTIME,&tnow);
-      while ( (ret=getUSBPackets(&device0)) == -EBUSY && loops < 10)
+      traceBegin(TS_USB_WAIT);
+      clock_gettime(CLOCK_MONOTONIC,&tbz);
+      clock_gettime(CLOCK_MONOTONIC,&tnow);
+      if (usb_wait_mode == USB_WAIT_POLL)
         {
-	  tbz.tv_nsec+=10*US; //Update timer count for next clock interrupt
+	  // Block on the board files until every packet lands or the deadline passes
+	  tbz.tv_nsec+=usb_wait_timeout_us*US;
 	  tsnorm(&tbz);
-	  clock_nanosleep(0, TIMER_ABSTIME, &tbz, NULL);
-	  loops++; 
+	  ret = getUSBPacketsWait(&device0, &tbz);
         }
-      clock_gettime(CLOCK_REALTIME,&t2);
+      else
+        {
+	  // HACK HACK HACK
+	  // loop until data ready 
+	  // better to ensure realtime access to driver
+	  while ( (ret=getUSBPackets(&device0)) == -EBUSY && loops < MAX_LOOPS)
+	    {
+	      tbz.tv_nsec+=10*US; //Update timer count for next clock interrupt
+	      tsnorm(&tbz);
+	      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tbz, NULL);
+	      loops++; 
+	    }
+        }
+      traceEnd(TS_USB_WAIT);
+      cycleTimingMark(CT_USB_WAIT, &tstage);
+      for (int m = 0; m < NUM_MECH; m++)
+	{
+	  int fresh = (encPacketAge(m) == 0);
+	  velEstimateStamp(m, fresh ? encPacketInfo(m)->rx_ns : controlClockNs(), fresh);
+	  if (!fresh)
+	    metricInc(MC_ENC_STALE);
+	}
+      clock_gettime(CLOCK_MONOTONIC,&t2);
       t2 = tsSubtract(t2, tnow);
       if (loops!=0) 
 	std::cout<< "bzlup"<<loops<<"0us time:" << (double)t2.tv_sec + (double)t2.tv_nsec/SEC <<std::endl;
+      metricAdd(MC_USB_EBUSY_RETRIES, loops);
+      if (ret == -EBUSY)
+	metricInc(MC_USB_WAIT_TIMEOUTS);
+      else if (ret < 0)
+	metricInc(MC_USB_READ_ERRORS);
+      metricObserve(MH_USB_WAIT_US, cycleTimingLast(CT_USB_WAIT) / 1000);
+
+      // Boards that stopped answering: e-stop now, look for them off this thread
+      usbHealthCheck(&device0);
       
-      //Run Safety State Machine
-      stateMachine(&device0, &currParams, &rcvdParams);
-
       //Update Atmel Input Pins
-      // TODO: deleteme
-      updateAtmelInputs(device0, currParams.runlevel);
+      traceBegin(TS_STATE_MACHINE);
+      updateAtmelInputs(&device0);
 
-      //Get state updates from master
-      if ( checkLocalUpdates() == TRUE)
-	updateDeviceState(&currParams, getRcvdParams(&rcvdParams), &device0);
+      //Run Safety State Machine
+      stateMachine(&device0, &currParams, &rcvdParams, rt_sched.consecutive_missed);
+      metricSet(MG_RUNLEVEL, currParams.runlevel);
+      metricSet(MG_MISSED_IN_A_ROW, rt_sched.consecutive_missed);
+      traceEnd(TS_STATE_MACHINE);
+      cycleTimingMark(CT_STATE_MACHINE, &tstage);
+
+      //Get state updates from master (or from the recording being replayed)
+      struct param_pass *update = NULL;
+      traceBegin(TS_DEVICE_STATE);
+      if (usbReplayActive())
+	update = usbReplayMaster(&rcvdParams);
+      else if ( checkLocalUpdates() == TRUE)
+	update = getRcvdParams(&rcvdParams);
+      if (update)
+	updateDeviceState(&currParams, update, &device0);
       else
 	rcvdParams.runlevel = currParams.runlevel;
+      traceEnd(TS_DEVICE_STATE);
+      cycleTimingMark(CT_DEVICE_STATE, &tstage);
 
       //Clear DAC Values (set current_cmd to zero on all joints)
+      traceBegin(TS_CONTROL);
       clearDACs(&device0);
 
       //////////////// SURGICAL ROBOT CODE //////////////////////////
@@ -273,25 +343,47 @@ static void *rt_process(void* )
 	  controlRaven(&device0, &currParams);
         }
       //////////////// END SURGICAL ROBOT CODE ///////////////////////////
+      traceEnd(TS_CONTROL);
+      cycleTimingMark(CT_CONTROL, &tstage);
 
       // Check for overcurrent and impose safe torque limits
+      traceBegin(TS_OVERDRIVE);
       if (overdriveDetect(&device0))
         {
-	  soft_estopped = TRUE;
-	  showInverseKinematicsSolutions(&device0, currParams.runlevel);
-	  outputRobotState();
+	  softEstop();
+	  blackboxTrigger("overdrive");   // dumped off the RT thread
         }
+      traceEnd(TS_OVERDRIVE);
+      cycleTimingMark(CT_OVERDRIVE, &tstage);
       //Update Atmel Output Pins
+      traceBegin(TS_USB_PUT);
       updateAtmelOutputs(&device0, currParams.runlevel);
 
       //Fill USB Packet and send it out
       putUSBPackets(&device0); //disable usb for par port test
+      teleopLatencyRecord();
+      traceEnd(TS_USB_PUT);
+      cycleTimingMark(CT_USB_PUT, &tstage);
 
       //Publish current raven state
+      traceBegin(TS_PUBLISH);
       publish_ravenstate_ros(&device0,&currParams);   // from local_io
+      traceEnd(TS_PUBLISH);
+      cycleTimingMark(CT_PUBLISH, &tstage);
+      cycleTimingMark(CT_COMPUTE, &twake);
+      metricObserve(MH_CYCLE_COMPUTE_US, cycleTimingLast(CT_COMPUTE) / 1000);
+
+      //Record the cycle (copy into the mapped ring, no I/O)
+      traceBegin(TS_RECORD);
+      flightRecorderCapture(&device0, &currParams, update);
+      blackboxCapture(&device0, &currParams, update);
+      calibrationCapture(&device0);
+      traceEnd(TS_RECORD);
 
       //Done for this cycle
+      rtWatchdogBeat();
     }
+  rtWatchdogIdle();
 
 
   log_msg("Raven Control is shutdown");
@@ -342,11 +434,124 @@ int init_ros(int argc, char **argv)
   /**
    * Initialize ros and rosrt
    */
+  int phase = startupPhaseBegin("ROS init and control parameters");
   ros::init(argc, argv, "r2_control", ros::init_options::NoSigintHandler);
   ros::NodeHandle n;
   //    rosrt::init();
-  init_ravenstate_publishing(n);
+
+  std::string wait_mode;
+  n.param<std::string>("/usb_wait_mode", wait_mode, "poll");
+  n.param("/usb_wait_timeout_us", usb_wait_timeout_us, 100);
+  usb_wait_mode = (wait_mode == "spin") ? USB_WAIT_SPIN : USB_WAIT_POLL;
+  std::string io_mode;
+  n.param<std::string>("/usb_io_mode", io_mode, "serial");
+  usb_io_mode = (io_mode == "parallel") ? USB_IO_PARALLEL : USB_IO_SERIAL;
+  // Control rate.  dt, filter and timeout counts are all derived from it.
+  n.param("/control_rate_hz", control_rate_hz, DEFAULT_CONTROL_RATE);
+  if (control_rate_hz < MIN_CONTROL_RATE || control_rate_hz > MAX_CONTROL_RATE || SEC % control_rate_hz != 0)
+    {
+      err_msg("Invalid control_rate_hz %d.  Using %d Hz.", control_rate_hz, DEFAULT_CONTROL_RATE);
+      control_rate_hz = DEFAULT_CONTROL_RATE;
+    }
+  step_period = 1.0 / control_rate_hz;
+  designStateLPF(control_rate_hz);
+  log_msg("Control rate: %d Hz (%d us period)", control_rate_hz, SEC / control_rate_hz / US);
+
+  std::string overrun_policy;
+  n.param<std::string>("/cycle_overrun_policy", overrun_policy, "skip");
+  n.param("/cycle_max_backlog", cycle_max_backlog, 3);
+  n.param("/cycle_max_consecutive_missed", cycle_max_consecutive_missed, 10);
+  cycle_overrun_policy = (overrun_policy == "compress") ? CYCLE_COMPRESS : CYCLE_SKIP;
+  log_msg("Cycle overrun policy: %s, e-stop after %d missed deadlines in a row", overrun_policy.c_str(), cycle_max_consecutive_missed);
+  n.param("/rt_start_delay_ms", rt_start_delay_ms, 100);
+  if (rt_start_delay_ms < 0)
+    rt_start_delay_ms = 0;
+
+  log_msg("USB read wait mode: %s, timeout %d us", usb_wait_mode == USB_WAIT_POLL ? "poll" : "spin", usb_wait_timeout_us);
+  log_msg("USB I/O mode: %s", usb_io_mode == USB_IO_PARALLEL ? "parallel" : "serial");
+
+  std::string backend;
+  n.param<std::string>("/usb_backend", backend, "boards");
+  if (backend == "sim")
+    usb_backend = USB_BACKEND_SIM;
+  else if (backend == "replay")
+    usb_backend = USB_BACKEND_REPLAY;
+  else
+    usb_backend = USB_BACKEND_BOARDS;
+  log_msg("USB backend: %s", backend.c_str());
+
+  // Boards (or what stands in for them) before anything that sizes itself by NUM_MECH
+  init_arm_boards(n);
+  init_usb_ring(n);
+  if (usb_backend == USB_BACKEND_SIM)
+    init_usb_sim(n);
+  if (usb_backend == USB_BACKEND_REPLAY && init_usb_replay(n) < 0)
+    return -1;
+  init_control_clock(n);
+  startupPhaseEnd(phase);
+
+  // Boards open here; their resets run on while the rest is set up
+  phase = startupPhaseBegin("USB open");
+  if ( init_module() )
+    {
+      cerr << "ERROR! Failed to init module.  Exiting.\n";
+      return -1;
+    }
+  startupPhaseEnd(phase);
+
+  phase = startupPhaseBegin("subsystem parameters");
+
+  if (init_cpu_affinity(n))
+    return -1;
+  init_arm_pipeline(n);
+
+  // Per-arm lists, now the mechanisms' arm types are known
+  init_state_lpf(n);
+  init_velocity_estimate(n);
+  init_network(n);
+  init_teleop_jitter(n);
+  init_teleop_protocol(n);
+  init_teleop_sessions(n);
+  init_setpoint_interp(n);
+  init_waypoint_stream(n);
+  init_kinematics(n);
+  init_kin_service(n);
+  init_rt_watchdog(n);
+  init_executor(n);
+  init_cable_coupling(n);
+  init_grav_comp(n);
+  init_thermal_model(n);
+  init_homing(n);
+  init_calibration(n);
+  init_usb_health(n);
+  init_metrics(n);
+  init_console(n);
+  if (init_tracepoints(n) < 0)
+    return -1;
+  if (init_flight_recorder(n) < 0 || init_blackbox(n) < 0)
+    return -1;
+  init_flight_archive(n);
+  if (init_feedback(n) || init_net_log(n))
+    return -1;
+  init_state_shm(n);   // before the publish streams are set up
+  init_ext_cmd(n);
+
+  if (init_ravenstate_publishing(n) < 0)
+    {
+      ROS_ERROR("Failed to allocate the raven_state publish ring.");
+      return -1;
+    }
+  startupPhaseEnd(phase);
+
+  phase = startupPhaseBegin("gains");
   init_ravengains(n, &device0);
+  init_control_config(n, &device0);
+  init_controllers(n, &device0);
+  startupPhaseEnd(phase);
+
+  // Nothing touches the boards before this
+  if (USBInitWait() > 0)
+    err_msg("Some boards did not reset cleanly, see above.");
 
   return 0;
 }
@@ -361,25 +566,34 @@ int main(int argc, char **argv)
   // set ctrl-C handler (override ROS b/c it's slow to cancel)
   signal( SIGINT,&sigTrap);
 
-  // set parallelport permissions
+  // set parallelport permissions (parport tracepoints)
   ioperm(PARPORT,1,1); 
 
+  startupProfileStart();
+
   // init stuff (usb, local-io, rt-memory, etc.);
-  if ( init_module() )
+  int phase = startupPhaseBegin("RT arena and log");
+  if ( rt_arena_init(RT_ARENA_SIZE) || log_init() )
     {
-      cerr << "ERROR! Failed to init module.  Exiting.\n";
+      cerr << "ERROR! Failed to init RT arena.  Exiting.\n";
       exit(1);
     }
+  startupPhaseEnd(phase);
   if ( init_ros(argc, argv) )
     {
       cerr << "ERROR! Failed to init ROS.  Exiting.\n";
       exit(1);
     }
+  phase = startupPhaseBegin("RT memory pool");
   if ( initialize_rt_memory_pool() )
     {
       cerr << "ERROR! Failed to init memory_pool.  Exiting.\n";
       exit(1);
     }
+  // Statics the RT loop touches: map them now
+  rt_prefault(&device0, sizeof(device0));
+  rt_prefault(DOF_types, sizeof(struct DOF_type) * MAX_MECH * MAX_DOF_PER_MECH);
+  startupPhaseEnd(phase);
 
   // init reconfigure
   dynamic_reconfigure::Server<raven_2::MyStuffConfig> srv;
@@ -388,21 +602,80 @@ int main(int argc, char **argv)
   srv.setCallback(f);
 
 
+  phase = startupPhaseBegin("helper threads");
+  pthread_create(&log_thread, NULL, log_process, NULL); //Start the logging thread first
+  pthread_create(&net_log_thread, NULL, net_log_process, NULL);
   pthread_create(&net_thread, NULL, network_process, NULL); //Start the network thread
   pthread_create(&console_thread, NULL, console_process, NULL);
-  pthread_create(&rt_thread, NULL, rt_process, NULL); 
+  pthread_create(&publish_thread, NULL, ros_publish_process, NULL);
+  pthread_create(&feedback_thread, NULL, feedback_process, NULL);
+  pthread_create(&flight_recorder_thread, NULL, flight_recorder_process, NULL);
+  pthread_create(&flight_archive_thread, NULL, flight_archive_process, NULL);
+  pthread_create(&blackbox_thread, NULL, blackbox_process, NULL);
+  pthread_create(&calibration_thread, NULL, calibration_process, NULL);
+  pthread_create(&usb_reattach_thread, NULL, usb_reattach_process, NULL);
+  pthread_create(&metrics_thread, NULL, metrics_process, NULL);
+  pthread_create(&gravity_thread, NULL, gravity_process, NULL);
+  pthread_create(&watchdog_thread, NULL, rt_watchdog_process, NULL);
+  if (usb_io_mode == USB_IO_PARALLEL && usbWorkersStart(&device0))
+    {
+      cerr << "ERROR! Failed to start USB workers.  Exiting.\n";
+      exit(1);
+    }
+  if (armPipelineStart(&device0))
+    {
+      cerr << "ERROR! Failed to start the arm pipeline workers.  Exiting.\n";
+      exit(1);
+    }
+  if (executorStart())
+    {
+      cerr << "ERROR! Failed to start the executor.  Exiting.\n";
+      exit(1);
+    }
+  startupPhaseEnd(phase);
+  pthread_attr_t rt_attr;
+  pthread_attr_init(&rt_attr);
+  pthread_attr_setstacksize(&rt_attr, RT_STACK_SIZE);
+  pthread_create(&rt_thread, &rt_attr, rt_process, NULL); 
+  pthread_attr_destroy(&rt_attr);
   
-  ros::spin();
+  // The reactors serve the ROS callbacks in executor mode
+  if (executorActive())
+    ros::waitForShutdown();
+  else
+    ros::spin();
 
+  pthread_join(usb_reattach_thread, NULL);   // before the board files close
   USBShutdown();
   //Suspend main until all threads terminate
   pthread_join(rt_thread,NULL);
+  usbWorkersStop();
+  armPipelineStop();
+  extCmdClose();                        // after its only reader, the RT thread
+  kinServiceStop();                     // a later batch runs on its caller alone
   pthread_join(console_thread, NULL);
   pthread_join(net_thread, NULL);
-
+  pthread_join(net_log_thread, NULL);   // after its only producer
+  pthread_join(publish_thread, NULL);
+  executorStop();                       // network, console, publisher and log drain, in executor mode
+  stateShmClose();                      // after its only writer
+  pthread_join(feedback_thread, NULL);
+  pthread_join(flight_archive_thread, NULL);    // takes the last records before the recorder unmaps
+  pthread_join(flight_recorder_thread, NULL);   // after the RT thread: flushes and unmaps
+  pthread_join(blackbox_thread, NULL);
+  pthread_join(calibration_thread, NULL);
+  pthread_join(metrics_thread, NULL);
+  pthread_join(gravity_thread, NULL);
+  pthread_join(watchdog_thread, NULL);
+  pthread_join(log_thread, NULL);    // log_msg prints directly from here on
+
+  // Timing summary for the whole run
+  outputCycleSchedStats(&rt_sched);
+  outputCycleTiming();
+  traceRingDump();
+  rt_memory_report("shutdown");
 
   log_msg("\n\n\nI'm shutting down now... \n\n\n");
-  usleep(1e6); //Sleep for 1 second
 
   exit(0);
 }
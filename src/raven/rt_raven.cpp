@@ -48,9 +48,18 @@
 #include "local_io.h"
 #include "update_device_state.h"
 #include "parallel.h"
-
-extern int NUM_MECH; //Defined in rt_process_preempt.cpp
-extern unsigned long int gTime; //Defined in rt_process_preempt.cpp
+#include "cycle_timing.h"
+#include "setpoint_interp.h"
+#include "waypoint_stream.h"
+#include "tracepoint.h"
+#include "arm_pipeline.h"
+#include "ext_cmd.h"
+#include "controller.h"
+#include "joint_block.h"
+#include "joint_iter.h"
+
+extern int NUM_MECH; //Defined in globals.cpp
+extern unsigned long int gTime; //Defined in globals.cpp
 extern struct DOF_type DOF_types[]; //Defined in DOF_type.h
 extern t_controlmode newRobotControlMode; //Defined in struct.h
 
@@ -60,8 +69,13 @@ int raven_motor_position_control(struct device *device0, struct param_pass *curr
 int raven_homing(struct device *device0, struct param_pass *currParams, int begin_homing=0);
 int applyTorque(struct device *device0, struct param_pass *currParams);
 int raven_sinusoidal_joint_motion(struct device *device0, struct param_pass *currParams);
+int raven_external_control(struct device *device0, struct param_pass *currParams);
+static int raven_gravity_only(struct device *device0, struct param_pass *currParams);
+static int controlArmCycle(struct device *device0, struct param_pass *currParams);
+
+static const struct raven_controller *cycle_ctrl = NULL;   // controller of the pipeline jobs this cycle
 
-extern int initialized; //Defined in rt_process_preempt.cpp
+extern int initialized; //Defined in globals.cpp
 
 /**
 *  \brief Implements control for one loop cycle.
@@ -83,92 +97,136 @@ extern int initialized; //Defined in rt_process_preempt.cpp
 *  -Joint Velocity Control
 *  -Homing mode
 *  -Applying arbitrary torque
+*  -External control, from the shared-memory command channel
+* Each is a raven_controller in the registry (controller.h), with any
+* plugins.  On a mode change the new controller is reset and runs in the
+* same cycle.
+*
+* With the per-arm pipeline running (see arm_pipeline.h), a CTRL_PER_ARM
+* controller gets everything after stateEstimate() in controlArmCycle(),
+* one job per mechanism.  The others write state shared by all arms and
+* stay serial.
 *
 */
 int controlRaven(struct device *device0, struct param_pass *currParams){
+    static const struct raven_controller *active = NULL;
     int ret = 0;
     //Desired control mode
-    t_controlmode controlmode = (t_controlmode)currParams->robotControlMode;
+    const struct raven_controller *ctrl = controllerFor(currParams->robotControlMode);
+
+    struct timespec tstage;
+    cycleTimingStart(&tstage);
 
     //Initialization code
     initRobotData(device0, currParams->runlevel, currParams);
+    cycleTimingMark(CT_INIT_ROBOT, &tstage);
 
     //Compute Mpos & Velocities
     stateEstimate(device0);
+    cycleTimingMark(CT_STATE_ESTIMATE, &tstage);
+
+    if (ctrl == NULL)
+    {
+        ROS_ERROR("Error: unknown control mode %d in controlRaven (rt_raven.cpp)", currParams->robotControlMode);
+        active = NULL;
+        return -1;
+    }
+    if (!(ctrl->flags & CTRL_KEEP_INIT))
+        initialized = false;
+    if (ctrl != active)
+    {
+        if (ctrl->reset)
+            ctrl->reset(device0, currParams);
+        active = ctrl;
+    }
+
+    if (armPipelineActive() && (ctrl->flags & CTRL_PER_ARM))
+    {
+        cycle_ctrl = ctrl;
+        ret = armPipelineRun(controlArmCycle, device0, currParams);
+
+        // What the jobs left for after the join: posts that cover every arm
+        if (armPipelineTakeDeferred() & ARM_DEFER_ORIGIN)
+            updateMasterRelativeOrigin(device0);
+        gravityPostCycle(*device0);
+        if (ctrl->joined)
+            ctrl->joined(device0, currParams);
+
+        return ret;
+    }
 
     //Foward Cable Coupling
     fwdCableCoupling(device0, currParams->runlevel);
+    cycleTimingMark(CT_FWD_CABLE, &tstage);
 
     //Forward kinematics
     r2_fwd_kin(device0, currParams->runlevel);
+    cycleTimingMark(CT_FWD_KIN, &tstage);
 
-    switch (controlmode){
+    ret = ctrl->update(device0, currParams, &jblock);
+    cycleTimingMark(CT_CONTROL_MODE, &tstage);
 
-        //CHECK ME: what is the purpose of this mode?
-        case no_control:
-        {
-            initialized = false;
+    return ret;
+}
 
-            struct DOF *_joint = NULL;
-            struct mechanism* _mech = NULL;
-            int i=0,j=0;
+/**
+*  \brief  One mechanism's share of a CTRL_PER_ARM controller's cycle, run by armPipelineRun()
+*  \param device0 robot_device struct defined in DS0.h
+*  \param currParams param_pass struct defined in DS1.h
+*  \return the controller's result
+*
+* Every stage below only touches mechFirst()..mechEnd()-1.  Mechanism 0's
+* job runs on the RT thread and records the stage timing.
+*/
+static int controlArmCycle(struct device *device0, struct param_pass *currParams){
+    int ret;
+    struct timespec tstage;
+    cycleTimingStart(&tstage);
 
-            // Gravity compensation calculation
-            getGravityTorque(*device0, *currParams);
+    fwdCableCoupling(device0, currParams->runlevel);
+    if (armLeader())
+        cycleTimingMark(CT_FWD_CABLE, &tstage);
 
-            while ( loop_over_joints(device0, _mech, _joint, i,j) )
-                _joint->tau_d = _joint->tau_g;  // Add gravity torque
+    r2_fwd_kin(device0, currParams->runlevel);
+    if (armLeader())
+        cycleTimingMark(CT_FWD_KIN, &tstage);
 
-            TorqueToDAC(device0);
+    ret = cycle_ctrl->update(device0, currParams, &jblock);
+    if (armLeader())
+        cycleTimingMark(CT_CONTROL_MODE, &tstage);
 
-        	break;
-        }
-	//Cartesian Space Control is called to control the robot in cartesian space
-        case cartesian_space_control:
-	  ret = raven_cartesian_space_command(device0,currParams);
-	  break;
-        //Motor PD control runs PD control on motor position
-        case motor_pd_control:
-            initialized = false;
-            ret = raven_motor_position_control(device0,currParams);
-            break;
-	//Runs joint velocity control
-        case joint_velocity_control:
-            initialized = false;
-            ret = raven_joint_velocity_control(device0, currParams);
-            break;
-	//Runs homing mode
-        case homing_mode:
-            initialized = false;
-            //initialized = robot_ready(device0) ? true:false;
-            ret = raven_homing(device0, currParams);
-            set_posd_to_pos(device0);
-            updateMasterRelativeOrigin(device0);
+    return ret;
+}
 
-            if (robot_ready(device0))
-            {
-                currParams->robotControlMode = cartesian_space_control;
-                newRobotControlMode = cartesian_space_control;
-            }
-            break;
-	//Runs applyTorque() to set torque command (tau_d) to a joint for debugging purposes
-        case apply_arbitrary_torque:
-            initialized = false;
-            ret = applyTorque(device0, currParams);
-            break;
-	//Apply sinusoidal trajectory to all joints
-        case multi_dof_sinusoid:
-            initialized = false;
-            ret = raven_sinusoidal_joint_motion(device0, currParams);
-            break;
-
-        default:
-            ROS_ERROR("Error: unknown control mode in controlRaven (rt_raven.cpp)");
-            ret = -1;
-            break;
+/**
+*  \brief  No control: gravity torque on every joint
+*  \param device0 robot_device struct defined in DS0.h
+*  \param currParams param_pass struct defined in DS1.h
+*  \return 0
+*/
+static int raven_gravity_only(struct device *device0, struct param_pass *currParams){
+    struct DOF *_joint = NULL;
+    struct mechanism* _mech = NULL;
+    int i=0,j=0;
+
+    // Gravity compensation calculation
+    getGravityTorque(*device0, *currParams);
+
+    for (i = mechFirst(); i < mechEnd(); i++)
+    {
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+            _joint->tau_d = _joint->tau_g;  // Add gravity torque
+        }
     }
 
-    return ret;
+    TorqueToDAC(device0);
+
+    return 0;
 }
 
 /**
@@ -180,8 +238,8 @@ int controlRaven(struct device *device0, struct param_pass *currParams){
 * This function:
 *  1. calls the r2_inv_kin() to calculate the inverse kinematics
 *  2. call the invCableCoupling() to calculate the inverse cable coupling
-*  3. set all the joints to zero if pedal is not down otherwise it calls mpos_PD_control() to run the PD control law
-*  4. calls getGravityTorque() to calulate gravity torques on each joints.
+*  3. calls getGravityTorque() to calulate gravity torques on each joints.
+*  4. set all the joints to the gravity torque if pedal is not down otherwise it calls mpos_PD_control_all() to run the PD control law, gravity added as feedforward
 *  5. calls TorqueToDAC() to apply write torque value's on DAC
 * 
 */
@@ -201,7 +259,12 @@ int raven_cartesian_space_command(struct device *device0, struct param_pass *cur
     	updateMasterRelativeOrigin(device0);
     }
 
-    parport_out(0x01);
+    if (armLeader())
+        traceBegin(TS_CARTESIAN);
+
+    //Move the setpoints toward the master's target, or the next streamed waypoint
+    waypointStreamStep(device0, currParams->runlevel);
+    setpointInterpStep(device0, currParams->runlevel);
 
     //Inverse kinematics
     r2_inv_kin(device0, currParams->runlevel);
@@ -209,30 +272,37 @@ int raven_cartesian_space_command(struct device *device0, struct param_pass *cur
     //Inverse Cable Coupling
     invCableCoupling(device0, currParams->runlevel);
 
-    // Set all joints to zero torque
-    _mech = NULL;  _joint = NULL;
-    while (loop_over_joints(device0, _mech, _joint, i,j) )
+    // Gravity compensation calculation
+    getGravityTorque(*device0, *currParams);
+
+    // Gravity torque only, or PD control on all joints with gravity as the feedforward
+    if (currParams->runlevel != RL_PEDAL_DN)
     {
-        if (currParams->runlevel != RL_PEDAL_DN)
+        for (i = mechFirst(); i < mechEnd(); i++)
         {
-            _joint->tau_d=0;
-        }
-        else
-        {
-    	    mpos_PD_control(_joint);
+            _mech = &device0->mech[i];
+            for (j = 0; j < MAX_DOF_PER_MECH; j++)
+            {
+                if (!jointActive(j))
+                    continue;
+                _joint = &_mech->joint[j];
+                _joint->tau_d = _joint->tau_g;
+            }
         }
     }
-
-    // Gravity compensation calculation
-    getGravityTorque(*device0, *currParams);
-    _mech = NULL;  _joint = NULL;
-    while ( loop_over_joints(device0, _mech, _joint, i,j) )
+    else
     {
-        _joint->tau_d += _joint->tau_g;  // Add gravity torque
+        mpos_PD_control_all(device0, 0, 1);
     }
 
     TorqueToDAC(device0);
 
+    // This cycle's DAC output carries the master's increment (per-arm: after the join, ctrlCartesianJoined())
+    if (currParams->runlevel == RL_PEDAL_DN && !onArmWorker())
+        teleopLatencyConsume(currParams->last_sequence, &currParams->rx_stamp);
+
+    if (armLeader())
+        traceEnd(TS_CARTESIAN);
     return 0;
 }
 
@@ -278,45 +348,37 @@ int raven_sinusoidal_joint_motion(struct device *device0, struct param_pass *cur
     }
 
     // Wait for amplifiers to power up
-    if (gTime - delay < 800)
+    if (gTime - delay < MS_TO_TICKS(800))
         return 0;
 
     // Set trajectory on all the joints
-    for (int i=0; i < NUM_MECH; i++)
+    if (!controlStart)
     {
-        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        for (int i=0; i < NUM_MECH; i++)
         {
-            struct DOF * _joint =  &(device0->mech[i].joint[j]);
-            int sgn = 1;
+            for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+            {
+                struct DOF * _joint =  &(device0->mech[i].joint[j]);
+                int sgn = 1;
 
-            if (device0->mech[i].type == GREEN_ARM)
-                sgn = -1;
+                if (device0->mech[i].type == GREEN_ARM)
+                    sgn = -1;
 
-            // initialize trajectory
-            if (!controlStart)
+                // initialize trajectory, first update builds its profile
                 start_trajectory(_joint, (_joint->jpos + sgn*f_magnitude[j]), f_period[j]);
-
-            // Get trajectory update
-			update_sinusoid_position_trajectory(_joint);
+                update_sinusoid_position_trajectory(_joint);
+            }
         }
     }
+    else
+        // Get trajectory update
+        trajectoryStep(device0);
 
     //Inverse Cable Coupling
     invCableCoupling(device0, currParams->runlevel);
 
     // Do PD control on all the joints
-    for (int i=0; i < NUM_MECH; i++)
-    {
-        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
-        {
-            struct DOF * _joint =  &(device0->mech[i].joint[j]);
-
-            // Do PD control
-            mpos_PD_control(_joint);
-//            if (is_toolDOF(_joint))
-//            	_joint->tau_d = 0;
-        }
-    }
+    mpos_PD_control_all(device0);
 
 
     TorqueToDAC(device0);
@@ -366,6 +428,103 @@ int applyTorque(struct device *device0, struct param_pass *currParams)
 }
 
 
+/**
+*  \brief Runs each arm on the out-of-process controller's command (ext_cmd_client.h)
+*  \param device0 is robot_device struct defined in DS0.h
+*  \param currParams is param_pass struct defined in DS1.h
+*  \return -1 below pedal up, 0 otherwise
+*
+*  In pedal down each arm follows its ext_cmd_mech.mode:
+*    EXT_CMD_TORQUE     tau_d is the commanded torque (plus gravity, with EXT_CMD_ADD_GRAVITY)
+*    EXT_CMD_JOINT      PD to the commanded joint positions, clamped to the joint limits
+*    EXT_CMD_CARTESIAN  PD to the IK of the commanded pose, as raven_cartesian_space_command()
+*  Arms off (EXT_CMD_OFF), a stale command and pedal up get gravity only,
+*  their setpoints following the measured state so a mode change is bumpless.
+*/
+int raven_external_control(struct device *device0, struct param_pass *currParams)
+{
+    int mode[MAX_MECH];
+    int any_cartesian = 0;
+
+    if (currParams->runlevel < RL_PEDAL_UP)
+    {
+        extCmdPoll(0);
+        return -1;
+    }
+
+    const struct ext_cmd_data *cmd = extCmdPoll(currParams->runlevel == RL_PEDAL_DN);
+    if (currParams->runlevel != RL_PEDAL_DN)
+        cmd = NULL;
+
+    getGravityTorque(*device0, *currParams);
+
+    // Cartesian setpoints: commanded, or where the arm is
+    set_posd_to_pos(device0);
+    for (int m = 0; m < NUM_MECH && m < MAX_MECH; m++)
+    {
+        struct mechanism *mech = &device0->mech[m];
+        mode[m] = cmd ? (int)cmd->mech[m].mode : EXT_CMD_OFF;
+        if (mode[m] != EXT_CMD_CARTESIAN)
+            continue;
+
+        const struct ext_cmd_mech *e = &cmd->mech[m];
+        mech->pos_d.x = e->xd[0];
+        mech->pos_d.y = e->xd[1];
+        mech->pos_d.z = e->xd[2];
+        mech->ori_d.grasp = e->grasp;
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                mech->ori_d.R[j][k] = e->R[j][k];
+        any_cartesian = 1;
+    }
+    if (any_cartesian)
+        r2_inv_kin(device0, currParams->runlevel);
+
+    // Joint setpoints of the arms that are not on IK
+    for (int m = 0; m < NUM_MECH && m < MAX_MECH; m++)
+    {
+        if (mode[m] == EXT_CMD_CARTESIAN)
+            continue;
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            struct DOF *_joint = &device0->mech[m].joint[j];
+            if (mode[m] == EXT_CMD_JOINT)
+            {
+                const struct DOF_type *t = &DOF_types[_joint->type];
+                float q = cmd->mech[m].jpos[j];
+                if (t->max_limit > t->min_limit)
+                    q = q > t->max_limit ? t->max_limit : (q < t->min_limit ? t->min_limit : q);
+                _joint->jpos_d = q;
+            }
+            else
+                _joint->jpos_d = _joint->jpos;
+        }
+    }
+    invCableCoupling(device0, currParams->runlevel);
+
+    // PD on every joint, then torque and gravity-only arms take their own tau_d
+    mpos_PD_control_all(device0, 0, 1);
+    for (int m = 0; m < NUM_MECH && m < MAX_MECH; m++)
+    {
+        if (mode[m] == EXT_CMD_JOINT || mode[m] == EXT_CMD_CARTESIAN)
+            continue;
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            struct DOF *_joint = &device0->mech[m].joint[j];
+            _joint->mpos_d = _joint->mpos;
+            if (mode[m] == EXT_CMD_TORQUE)
+                _joint->tau_d = cmd->mech[m].tau[j] +
+                                ((cmd->mech[m].flags & EXT_CMD_ADD_GRAVITY) ? _joint->tau_g : 0);
+            else
+                _joint->tau_d = _joint->tau_g;
+        }
+    }
+
+    TorqueToDAC(device0);
+    return 0;
+}
+
+
 /**\
 *  \brief This function runs PD control on motor position
 *  \param device0 is robot_device struct defined in DS0.h
@@ -397,43 +556,59 @@ int raven_motor_position_control(struct device *device0, struct param_pass *curr
         delay = gTime;
 
         // Set all joints to zero torque, and mpos_d = mpos
-        _mech = NULL;  _joint = NULL;
-        while (loop_over_joints(device0, _mech, _joint, i,j) )
+        for (i = mechFirst(); i < mechEnd(); i++)
         {
-            _joint->mpos_d = _joint->mpos;
-            _joint->tau_d = 0;
+            _mech = &device0->mech[i];
+            for (j = 0; j < MAX_DOF_PER_MECH; j++)
+            {
+                if (!jointActive(j))
+                    continue;
+                _joint = &_mech->joint[j];
+                _joint->mpos_d = _joint->mpos;
+                _joint->tau_d = 0;
+            }
         }
         return 0;
     }
 
-    if (gTime - delay < 800)
+    if (gTime - delay < MS_TO_TICKS(800))
         return 0;
 
     // Set trajectory on all the joints
-    _mech = NULL;  _joint = NULL;
-    while (loop_over_joints(device0, _mech, _joint, i,j) )
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-        if ( _joint->type == SHOULDER_GOLD || _joint->type == ELBOW_GOLD )
-        	_joint->jpos_d = _joint->jpos;
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+            if ( _joint->type == JOINT_TYPE(0, SHOULDER) || _joint->type == JOINT_TYPE(0, ELBOW) )
+            	_joint->jpos_d = _joint->jpos;
 
-        if (!controlStart)
-            _joint->jpos_d = _joint->jpos;
+            if (!controlStart)
+                _joint->jpos_d = _joint->jpos;
+        }
     }
 
     //Inverse Cable Coupling
     invCableCoupling(device0, currParams->runlevel);
 
     // Do PD control on all the joints
-    _mech = NULL;  _joint = NULL;
-    while (loop_over_joints(device0, _mech, _joint, i,j) )
+    mpos_PD_control_all(device0);
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-        // Do PD control
-        mpos_PD_control(_joint);
-
-        if (_joint->type < Z_INS_GOLD)
-            _joint->tau_d=0;
-        else if (gTime % 500 == 0 && _joint->type == Z_INS_GOLD)
-        	log_msg("zp: %f, \t zp_d: %f, \t mp: %f, \t mp_d:%f", _joint->jpos, _joint->jpos_d, _joint->mpos, _joint->mpos_d);
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+            if (_joint->type < JOINT_TYPE(0, Z_INS))
+                _joint->tau_d=0;
+            else if (gTime % MS_TO_TICKS(500) == 0 && _joint->type == JOINT_TYPE(0, Z_INS))
+            	log_msg("zp: %f, \t zp_d: %f, \t mp: %f, \t mp_d:%f", _joint->jpos, _joint->jpos_d, _joint->mpos, _joint->mpos_d);
+        }
     }
 
     TorqueToDAC(device0);
@@ -468,7 +643,7 @@ int raven_joint_velocity_control(struct device *device0, struct param_pass *curr
               currParams->sublevel == SL_AUTO_INIT ))
     {
         // delay the start of control for 300ms b/c the amps have to turn on.
-        if (gTime - delay < 800)
+        if (gTime - delay < MS_TO_TICKS(800))
             return 0;
 
         for (int i=0; i < NUM_MECH; i++)
@@ -520,6 +695,93 @@ int raven_joint_velocity_control(struct device *device0, struct param_pass *curr
 }
 
 
+///
+/// BUILT-IN CONTROLLERS
+///
+
+static int ctrlNoControl(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_gravity_only(device0, currParams);
+}
+
+static int ctrlCartesian(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_cartesian_space_command(device0, currParams);
+}
+
+/// Start from where the arm is, not from a setpoint left by another mode
+static void ctrlCartesianReset(struct device *device0, struct param_pass *)
+{
+    set_posd_to_pos(device0);
+    updateMasterRelativeOrigin(device0);
+}
+
+/// Per-arm: this cycle's DAC output carries the master's increment
+static void ctrlCartesianJoined(struct device *, struct param_pass *currParams)
+{
+    if (currParams->runlevel == RL_PEDAL_DN)
+        teleopLatencyConsume(currParams->last_sequence, &currParams->rx_stamp);
+}
+
+static int ctrlMotorPD(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_motor_position_control(device0, currParams);
+}
+
+static int ctrlJointVelocity(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_joint_velocity_control(device0, currParams);
+}
+
+/// Homing, then cartesian space control once the robot is ready
+static int ctrlHoming(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    int ret = raven_homing(device0, currParams);
+    set_posd_to_pos(device0);
+    updateMasterRelativeOrigin(device0);
 
+    if (robot_ready(device0))
+    {
+        currParams->robotControlMode = cartesian_space_control;
+        newRobotControlMode = cartesian_space_control;
+    }
+    return ret;
+}
 
+static int ctrlApplyTorque(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return applyTorque(device0, currParams);
+}
 
+static int ctrlSinusoid(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_sinusoidal_joint_motion(device0, currParams);
+}
+
+static int ctrlExternal(struct device *device0, struct param_pass *currParams, struct joint_block *)
+{
+    return raven_external_control(device0, currParams);
+}
+
+static const struct raven_controller builtin_controllers[] = {
+    { RAVEN_CONTROLLER_ABI, "no_control",      no_control,              CTRL_PER_ARM, NULL, ctrlNoControl,     NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "cartesian",       cartesian_space_control, CTRL_PER_ARM | CTRL_KEEP_INIT, NULL, ctrlCartesian,
+      ctrlCartesianReset, ctrlCartesianJoined },
+    { RAVEN_CONTROLLER_ABI, "motor_pd",        motor_pd_control,        0, NULL, ctrlMotorPD,       NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "joint_velocity",  joint_velocity_control,  0, NULL, ctrlJointVelocity, NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "homing",          homing_mode,             0, NULL, ctrlHoming,        NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "apply_torque",    apply_arbitrary_torque,  0, NULL, ctrlApplyTorque,   NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "sinusoid",        multi_dof_sinusoid,      0, NULL, ctrlSinusoid,      NULL, NULL },
+    { RAVEN_CONTROLLER_ABI, "external",        external_control,        0, NULL, ctrlExternal,      NULL, NULL },
+};
+
+/**
+*  \brief Register the control modes above.  Called by init_controllers(), before any plugin.
+*  \return 0
+*/
+int registerBuiltinControllers(void)
+{
+    for (unsigned int i = 0; i < sizeof(builtin_controllers) / sizeof(builtin_controllers[0]); i++)
+        controllerRegister(&builtin_controllers[i], 0);
+    return 0;
+}
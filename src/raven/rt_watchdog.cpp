@@ -0,0 +1,118 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file rt_watchdog.cpp
+ * \brief Deadline watchdog for rt_process(), see rt_watchdog.h
+ *
+ * The watchdog must run while the RT thread holds its core, so it is kept
+ * off /cpu_rt: on the same core a SCHED_FIFO 99 thread could not preempt
+ * it.  Nothing here runs on the RT thread but the two inlines.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "rt_watchdog.h"
+#include "USB_init.h"
+#include "blackbox.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+#define RT_WATCHDOG_PRIORITY 99
+
+
+volatile unsigned long rt_heartbeat = 0;
+static int wd_cycles = 5;
+
+/**\fn int init_rt_watchdog(ros::NodeHandle &n)
+ * \brief read /rt_watchdog_cycles
+ * \param n ROS node handle
+ * \return 0
+ */
+int init_rt_watchdog(ros::NodeHandle &n)
+{
+	n.param("/rt_watchdog_cycles", wd_cycles, 5);
+	if (wd_cycles > 0)
+		log_msg("RT watchdog: safe-stop after %d control periods without a cycle", wd_cycles);
+	else
+		log_msg("RT watchdog: off");
+	return 0;
+}
+
+/**\fn static void watchdogTrip(unsigned long beat, int missed)
+ * \brief the RT thread has stalled: zero the boards, soft estop, dump the black box
+ */
+static void watchdogTrip(unsigned long beat, int missed)
+{
+	int boards = usbEmergencyZero();
+	softEstop();
+	blackboxFreeze("rt watchdog");
+	metricInc(MC_WATCHDOG_TRIPS);
+	err_msg("RT watchdog: no control cycle for %d periods after cycle %lu.  %d boards zeroed, soft estop.",
+			missed, beat, boards);
+}
+
+/**\fn void* rt_watchdog_process(void*)
+ * \brief watchdog thread: one heartbeat check per control period
+ */
+void* rt_watchdog_process(void*)
+{
+	struct timespec next;
+	unsigned long last = 0;
+	int missed = 0, tripped = 0;
+
+	if (wd_cycles <= 0)
+		return NULL;
+
+	set_thread_affinity(ROLE_HOUSEKEEPING);
+	struct sched_param param;
+	param.sched_priority = RT_WATCHDOG_PRIORITY;
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+		err_msg("RT watchdog: could not set realtime priority");
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (ros::ok() && !r2Killed())
+	{
+		next.tv_nsec += NSEC_PER_SEC / control_rate_hz;
+		tsnorm(&next);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		unsigned long beat = rt_heartbeat;
+		if (beat != last)
+		{
+			last = beat;
+			missed = tripped = 0;
+			continue;
+		}
+		if (beat == 0 || tripped)
+			continue;       // not started yet, or already stopped
+
+		if (++missed >= wd_cycles)
+		{
+			watchdogTrip(beat, missed);
+			tripped = 1;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,607 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file setpoint_interp.cpp
+ * \brief Upsampling of master setpoints to the servo rate.
+ *
+ * A master at 100-500 Hz moves the Cartesian setpoint in steps that the
+ * joint PD loops then chase at 1 kHz.  Here each new target starts a
+ * segment from the current setpoint, and every servo cycle in pedal down
+ * writes the point alpha = (t - t0) / horizon along it into pos_d / ori_d.
+ * A target that arrives mid-segment starts a new segment from wherever the
+ * setpoint is, so the motion stays continuous.
+ *
+ * With SI_AUTO the horizon follows a running average of the interval between
+ * targets: one master period of latency in exchange for a step-free setpoint.
+ *
+ * Latency compensation (/teleop_predict_ms) adds a lead to the setpoint:
+ * the master's velocity, from smoothed differences of its targets, times
+ * the delay behind them (the link, receive-to-DAC and the interpolation
+ * horizon).  The lead is latched at each target, bounded, and faded to zero
+ * once targets stop coming.  pos_d / ori_d hold the interpolated setpoint
+ * plus the lead; the lead is taken off again wherever the interpolation
+ * starts from the setpoint.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "setpoint_interp.h"
+#include "rigid_math.h"
+#include "cycle_timing.h"
+#include "metrics.h"
+#include "log.h"
+#include "arm_pipeline.h"
+
+extern unsigned long int gTime;
+
+struct si_segment
+{
+	int active;
+	unsigned long t0;            // gTime at the segment start
+	unsigned long len;           // ticks to the target
+	double p0[3], p1[3];         // microns
+	double q0[4], q1[4];         // w, x, y, z
+	double g0, g1;               // grasp, milliradians
+};
+
+static int si_mode = SI_AUTO;
+static unsigned long si_horizon = 1;           // ticks
+static double si_interval = 0;                 // SI_AUTO: average ticks between targets
+static unsigned long si_last_target = 0;
+static struct si_segment si_seg[MAX_MECH_PER_DEV];
+
+struct si_predict
+{
+	int valid;                   // a target seen since pedal down
+	unsigned long t_last;        // gTime of the last target
+	double interval;             // average ticks between targets
+	double p[3];                 // last target, microns
+	double q[4];                 // its orientation, w, x, y, z
+	double v[3];                 // master velocity, microns per tick
+	double w[3];                 // angular velocity (rotation vector), radians per tick
+	double lead[3];              // position lead latched at the last target, microns
+	double rlead[3];             // rotation lead, rotation vector
+	int off[3];                  // position offset now in pos_d
+	double fade;                 // fraction of the lead now in pos_d / ori_d
+	int fresh;                   // lead latched since it was last applied
+	rm_mat3 Roff;                // rotation offset now in ori_d, on the left
+};
+
+static int sp_mode = SP_OFF;
+static double sp_fixed_ticks = 0;              // lead time if fixed
+static double sp_link_ticks = 0;               // SP_MEASURED: the link delay not seen here
+static double sp_gain = 0.3;                   // weight of the newest velocity difference
+static double sp_max_um = 3000;
+static double sp_max_rad = 10 * M_PI / 180;
+static double sp_fade_ticks = 50;
+static struct si_predict si_pred[MAX_MECH_PER_DEV];
+
+/**\fn int init_setpoint_interp(ros::NodeHandle &n)
+ * \brief read the interpolation horizon
+ * \param n the node handle
+ * \return 0
+ */
+int init_setpoint_interp(ros::NodeHandle &n)
+{
+	int ms, pred_ms;
+	double link_ms, gain, max_um, max_deg, fade_ms;
+
+	n.param("/setpoint_interp_ms", ms, (int)SI_AUTO);
+	if (ms < SI_AUTO)
+		ms = SI_AUTO;
+	si_mode = ms;
+	if (ms > 0)
+		si_horizon = MS_TO_TICKS(ms) > 0 ? MS_TO_TICKS(ms) : 1;
+
+	if (si_mode == SI_OFF)
+		log_msg("Setpoint interpolation: off");
+	else if (si_mode == SI_AUTO)
+		log_msg("Setpoint interpolation: horizon follows the master rate (max %d ms)", SI_AUTO_MAX_MS);
+	else
+		log_msg("Setpoint interpolation: %d ms horizon", ms);
+
+	n.param("/teleop_predict_ms", pred_ms, (int)SP_OFF);
+	n.param("/teleop_predict_link_ms", link_ms, 0.0);
+	n.param("/teleop_predict_gain", gain, 0.3);
+	n.param("/teleop_predict_max_um", max_um, 3000.0);
+	n.param("/teleop_predict_max_deg", max_deg, 10.0);
+	n.param("/teleop_predict_fade_ms", fade_ms, 50.0);
+	if (pred_ms < SP_MEASURED || pred_ms > SP_MAX_MS)
+	{
+		err_msg("teleop_predict_ms %d out of range -1-%d, prediction off", pred_ms, SP_MAX_MS);
+		pred_ms = SP_OFF;
+	}
+	if (!(gain > 0 && gain <= 1))
+	{
+		err_msg("teleop_predict_gain %g out of range (0, 1], using 0.3", gain);
+		gain = 0.3;
+	}
+	sp_mode = pred_ms;
+	sp_fixed_ticks = pred_ms * control_rate_hz / 1000.0;
+	sp_link_ticks = std::max(link_ms, 0.0) * control_rate_hz / 1000.0;
+	sp_gain = gain;
+	sp_max_um = std::max(max_um, 0.0);
+	sp_max_rad = std::max(max_deg, 0.0) * M_PI / 180;
+	sp_fade_ticks = std::max(fade_ms * control_rate_hz / 1000.0, 1.0);
+	for (int m = 0; m < MAX_MECH_PER_DEV; m++)
+	{
+		si_pred[m].valid = 0;
+		si_pred[m].fade = 0;
+		si_pred[m].off[0] = si_pred[m].off[1] = si_pred[m].off[2] = 0;
+		si_pred[m].Roff = rmIdentity();
+	}
+
+	if (sp_mode == SP_OFF)
+		log_msg("Teleop latency compensation: off");
+	else if (sp_mode == SP_MEASURED)
+		log_msg("Teleop latency compensation: measured delay + %.1f ms link, lead at most %.0f um / %.1f deg, %.0f ms fade",
+				link_ms, sp_max_um, max_deg, fade_ms);
+	else
+		log_msg("Teleop latency compensation: %d ms, lead at most %.0f um / %.1f deg, %.0f ms fade",
+				pred_ms, sp_max_um, max_deg, fade_ms);
+	return 0;
+}
+
+/**\fn static void matToQuat(const float R[3][3], double q[4])
+ * \brief rotation matrix to unit quaternion (w, x, y, z)
+ */
+static void matToQuat(const float R[3][3], double q[4])
+{
+	double tr = R[0][0] + R[1][1] + R[2][2];
+	double s;
+
+	if (tr > 0)
+	{
+		s = sqrt(tr + 1.0) * 2;
+		q[0] = 0.25 * s;
+		q[1] = (R[2][1] - R[1][2]) / s;
+		q[2] = (R[0][2] - R[2][0]) / s;
+		q[3] = (R[1][0] - R[0][1]) / s;
+	}
+	else if (R[0][0] > R[1][1] && R[0][0] > R[2][2])
+	{
+		s = sqrt(1.0 + R[0][0] - R[1][1] - R[2][2]) * 2;
+		q[0] = (R[2][1] - R[1][2]) / s;
+		q[1] = 0.25 * s;
+		q[2] = (R[0][1] + R[1][0]) / s;
+		q[3] = (R[0][2] + R[2][0]) / s;
+	}
+	else if (R[1][1] > R[2][2])
+	{
+		s = sqrt(1.0 + R[1][1] - R[0][0] - R[2][2]) * 2;
+		q[0] = (R[0][2] - R[2][0]) / s;
+		q[1] = (R[0][1] + R[1][0]) / s;
+		q[2] = 0.25 * s;
+		q[3] = (R[1][2] + R[2][1]) / s;
+	}
+	else
+	{
+		s = sqrt(1.0 + R[2][2] - R[0][0] - R[1][1]) * 2;
+		q[0] = (R[1][0] - R[0][1]) / s;
+		q[1] = (R[0][2] + R[2][0]) / s;
+		q[2] = (R[1][2] + R[2][1]) / s;
+		q[3] = 0.25 * s;
+	}
+
+	double n = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+	for (int i = 0; i < 4; i++)
+		q[i] /= n;
+}
+
+/**\fn static void quatToMat(const double q[4], float R[3][3])
+ * \brief unit quaternion (w, x, y, z) to rotation matrix
+ */
+static void quatToMat(const double q[4], float R[3][3])
+{
+	double w = q[0], x = q[1], y = q[2], z = q[3];
+
+	R[0][0] = 1 - 2*(y*y + z*z);  R[0][1] = 2*(x*y - w*z);      R[0][2] = 2*(x*z + w*y);
+	R[1][0] = 2*(x*y + w*z);      R[1][1] = 1 - 2*(x*x + z*z);  R[1][2] = 2*(y*z - w*x);
+	R[2][0] = 2*(x*z - w*y);      R[2][1] = 2*(y*z + w*x);      R[2][2] = 1 - 2*(x*x + y*y);
+}
+
+/**\fn static void slerp(const double a[4], const double b[4], double t, double out[4])
+ * \brief spherical interpolation between unit quaternions, the short way round
+ */
+static void slerp(const double a[4], const double b[4], double t, double out[4])
+{
+	double d = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+	double sb = 1;
+	if (d < 0)
+	{
+		d = -d;
+		sb = -1;
+	}
+
+	double ka, kb;
+	if (d > 0.9995)
+	{
+		// nearly parallel: lerp and renormalize
+		ka = 1 - t;
+		kb = t;
+	}
+	else
+	{
+		double th = acos(d);
+		double s = sin(th);
+		ka = sin((1 - t) * th) / s;
+		kb = sin(t * th) / s;
+	}
+
+	double n = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		out[i] = ka * a[i] + sb * kb * b[i];
+		n += out[i] * out[i];
+	}
+	n = sqrt(n);
+	for (int i = 0; i < 4; i++)
+		out[i] /= n;
+}
+
+/**\fn static void quatDelta(const double a[4], const double b[4], double rv[3])
+ * \brief rotation vector of b * inv(a), the short way round: the rotation that takes a to b
+ */
+static void quatDelta(const double a[4], const double b[4], double rv[3])
+{
+	double w =  b[0]*a[0] + b[1]*a[1] + b[2]*a[2] + b[3]*a[3];
+	double x = -b[0]*a[1] + b[1]*a[0] - b[2]*a[3] + b[3]*a[2];
+	double y = -b[0]*a[2] + b[1]*a[3] + b[2]*a[0] - b[3]*a[1];
+	double z = -b[0]*a[3] - b[1]*a[2] + b[2]*a[1] + b[3]*a[0];
+	if (w < 0)
+	{
+		w = -w;  x = -x;  y = -y;  z = -z;
+	}
+
+	double sn = sqrt(x*x + y*y + z*z);
+	double k = sn > 1e-12 ? 2 * atan2(sn, w) / sn : 2;
+	rv[0] = k * x;
+	rv[1] = k * y;
+	rv[2] = k * z;
+}
+
+/**\fn static rm_mat3 rotvecToMat(const double rv[3])
+ * \brief rotation of a rotation vector
+ */
+static rm_mat3 rotvecToMat(const double rv[3])
+{
+	double th = sqrt(rv[0]*rv[0] + rv[1]*rv[1] + rv[2]*rv[2]);
+	if (th < 1e-12)
+		return rmIdentity();
+	return rmAxisAngle(rmVec(rv[0], rv[1], rv[2]), th);
+}
+
+/**\fn static inline double predictLate(const struct si_predict *pr)
+ * \brief ticks after a target at which the next one counts as missing and the lead starts to fade
+ */
+static inline double predictLate(const struct si_predict *pr)
+{
+	return 2 * std::max(pr->interval, 1.0);
+}
+
+/**\fn static double predictDelay()
+ * \brief ticks of delay the lead makes up
+ *
+ * SP_MEASURED: the configured link delay, which cannot be seen from here,
+ * plus the measured receive-to-DAC latency (playout delay included) plus
+ * the interpolation horizon.
+ */
+static double predictDelay()
+{
+	if (sp_mode != SP_MEASURED)
+		return sp_fixed_ticks;
+
+	double t = sp_link_ticks + teleopLatencyAverage() * control_rate_hz / 1e9;
+	if (si_mode != SI_OFF)
+		t += si_horizon;
+	return std::min(t, SP_MAX_MS * control_rate_hz / 1000.0);
+}
+
+/**\fn static void predictTarget(int m, const struct position *xd, const double q[4])
+ * \brief update mechanism m's master velocity with a new target and latch the lead
+ * \param m mechanism index
+ * \param xd target position
+ * \param q target orientation, unit quaternion (w, x, y, z)
+ */
+static void predictTarget(int m, const struct position *xd, const double q[4])
+{
+	struct si_predict *pr = &si_pred[m];
+	double p[3] = { (double)xd->x, (double)xd->y, (double)xd->z };
+	unsigned long dt = gTime - pr->t_last;
+
+	if (!pr->valid || dt > predictLate(pr) + sp_fade_ticks)
+	{
+		// First target, or the first after the lead faded out: nothing to difference against
+		pr->valid = 1;
+		pr->interval = 0;
+		for (int i = 0; i < 3; i++)
+			pr->v[i] = pr->w[i] = 0;
+	}
+	else
+	{
+		if (dt == 0)
+			dt = 1;
+		double rv[3];
+		quatDelta(pr->q, q, rv);
+		for (int i = 0; i < 3; i++)
+		{
+			pr->v[i] += sp_gain * ((p[i] - pr->p[i]) / dt - pr->v[i]);
+			pr->w[i] += sp_gain * (rv[i] / dt - pr->w[i]);
+		}
+		pr->interval = pr->interval > 0 ? pr->interval + 0.1 * (dt - pr->interval) : dt;
+	}
+	for (int i = 0; i < 3; i++)
+		pr->p[i] = p[i];
+	for (int i = 0; i < 4; i++)
+		pr->q[i] = q[i];
+	pr->t_last = gTime;
+
+	// Lead over the delay, each part bounded
+	double tau = predictDelay();
+	double n = 0, rn = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		pr->lead[i] = pr->v[i] * tau;
+		pr->rlead[i] = pr->w[i] * tau;
+		n += pr->lead[i] * pr->lead[i];
+		rn += pr->rlead[i] * pr->rlead[i];
+	}
+	n = sqrt(n);
+	rn = sqrt(rn);
+	int clamped = 0;
+	if (n > sp_max_um)
+	{
+		for (int i = 0; i < 3; i++)
+			pr->lead[i] *= sp_max_um / n;
+		clamped = 1;
+	}
+	if (rn > sp_max_rad)
+	{
+		for (int i = 0; i < 3; i++)
+			pr->rlead[i] *= sp_max_rad / rn;
+		clamped = 1;
+	}
+	if (clamped)
+		metricInc(MC_PREDICT_CLAMPS);
+	pr->fresh = 1;
+}
+
+/**\fn static void predictRaw(int m, const struct mechanism *mech, double p[3], double q[4])
+ * \brief mechanism m's setpoint without the lead now in it: position (microns) and orientation (w, x, y, z)
+ */
+static void predictRaw(int m, const struct mechanism *mech, double p[3], double q[4])
+{
+	const struct si_predict *pr = &si_pred[m];
+
+	p[0] = mech->pos_d.x - pr->off[0];
+	p[1] = mech->pos_d.y - pr->off[1];
+	p[2] = mech->pos_d.z - pr->off[2];
+	if (pr->fade > 0)
+	{
+		float R[3][3];
+		rmToRows(rmMulT(pr->Roff, rmFromRows(mech->ori_d.R)), R);
+		matToQuat(R, q);
+	}
+	else
+		matToQuat(mech->ori_d.R, q);
+}
+
+/**\fn static inline void predictCleared(int m)
+ * \brief mechanism m's pos_d / ori_d were just written without a lead
+ */
+static inline void predictCleared(int m)
+{
+	struct si_predict *pr = &si_pred[m];
+
+	pr->off[0] = pr->off[1] = pr->off[2] = 0;
+	pr->fade = 0;
+	pr->Roff = rmIdentity();
+}
+
+/**\fn static void predictApply(int m, struct mechanism *mech)
+ * \brief put this cycle's share of the lead into mechanism m's pos_d / ori_d, in place of the last one
+ */
+static void predictApply(int m, struct mechanism *mech)
+{
+	struct si_predict *pr = &si_pred[m];
+	double f = 0;
+
+	if (pr->valid)
+	{
+		double late = (double)(gTime - pr->t_last) - predictLate(pr);
+		f = late <= 0 ? 1 : std::max(1 - late / sp_fade_ticks, 0.0);
+	}
+	if (f == pr->fade && !pr->fresh)
+		return;
+	pr->fresh = 0;
+
+	int off[3];
+	double rv[3];
+	for (int i = 0; i < 3; i++)
+	{
+		off[i] = (int)lround(f * pr->lead[i]);
+		rv[i] = f * pr->rlead[i];
+	}
+	mech->pos_d.x += off[0] - pr->off[0];
+	mech->pos_d.y += off[1] - pr->off[1];
+	mech->pos_d.z += off[2] - pr->off[2];
+
+	rm_mat3 Roff = rotvecToMat(rv);
+	rm_mat3 R = rmFromRows(mech->ori_d.R);
+	if (pr->fade > 0)
+		R = rmMulT(pr->Roff, R);
+	rmToRows(rmMul(Roff, R), mech->ori_d.R);
+
+	for (int i = 0; i < 3; i++)
+		pr->off[i] = off[i];
+	pr->Roff = Roff;
+	pr->fade = f;
+}
+
+/**\fn void setpointInterpTarget(struct device *device0, int m, const struct position *xd, const float R[3][3], int grasp)
+ * \brief a new master setpoint for mechanism m (pedal down)
+ * \param device0 robot device; with interpolation off the target goes straight into pos_d / ori_d
+ * \param m mechanism index
+ * \param xd target position
+ * \param R target orientation
+ * \param grasp target grasp
+ */
+void setpointInterpTarget(struct device *device0, int m, const struct position *xd, const float R[3][3], int grasp)
+{
+	struct mechanism *mech = &device0->mech[m];
+	struct si_segment *s = &si_seg[m];
+
+	if (si_mode == SI_OFF)
+	{
+		mech->pos_d = *xd;
+		mech->ori_d.grasp = grasp;
+		for (int j = 0; j < 3; j++)
+			for (int k = 0; k < 3; k++)
+				mech->ori_d.R[j][k] = R[j][k];
+		if (sp_mode != SP_OFF)
+		{
+			double q[4];
+			matToQuat(R, q);
+			predictCleared(m);
+			predictTarget(m, xd, q);
+		}
+		return;
+	}
+
+	if (si_mode == SI_AUTO && m == 0)
+	{
+		unsigned long dt = gTime - si_last_target;
+		unsigned long dt_max = MS_TO_TICKS(SI_AUTO_MAX_MS);
+		if (si_last_target != 0 && dt > 0 && dt <= dt_max)
+		{
+			si_interval = si_interval > 0 ? si_interval + 0.1 * (dt - si_interval) : dt;
+			si_horizon = (unsigned long)(si_interval + 0.5);
+			if (si_horizon < 1)
+				si_horizon = 1;
+		}
+		si_last_target = gTime;
+	}
+
+	// Start from wherever the setpoint is now, less any lead
+	predictRaw(m, mech, s->p0, s->q0);
+	s->g0 = mech->ori_d.grasp;
+
+	s->p1[0] = xd->x;
+	s->p1[1] = xd->y;
+	s->p1[2] = xd->z;
+	s->g1 = grasp;
+	matToQuat(R, s->q1);
+	if (sp_mode != SP_OFF)
+		predictTarget(m, xd, s->q1);
+
+	s->t0 = gTime;
+	s->len = si_horizon;
+	s->active = 1;
+}
+
+/**\fn void setpointInterpWaypoint(struct device *device0, int m, const struct position *xd, const double q[4], int grasp, unsigned long ticks)
+ * \brief a timed setpoint for mechanism m: reached in ticks cycles whatever the horizon.  Used by the waypoint stream.
+ * \param device0 robot device
+ * \param m mechanism index
+ * \param xd target position
+ * \param q target orientation, unit quaternion (w, x, y, z)
+ * \param grasp target grasp
+ * \param ticks cycles to the target, at least 1
+ */
+void setpointInterpWaypoint(struct device *device0, int m, const struct position *xd, const double q[4], int grasp, unsigned long ticks)
+{
+	struct mechanism *mech = &device0->mech[m];
+	struct si_segment *s = &si_seg[m];
+
+	s->p0[0] = mech->pos_d.x;
+	s->p0[1] = mech->pos_d.y;
+	s->p0[2] = mech->pos_d.z;
+	s->g0 = mech->ori_d.grasp;
+	matToQuat(mech->ori_d.R, s->q0);
+
+	s->p1[0] = xd->x;
+	s->p1[1] = xd->y;
+	s->p1[2] = xd->z;
+	s->g1 = grasp;
+	for (int i = 0; i < 4; i++)
+		s->q1[i] = q[i];
+
+	s->t0 = gTime;
+	s->len = ticks > 0 ? ticks : 1;
+	s->active = 1;
+
+	// Waypoints are not extrapolated; the segment takes any lead out smoothly
+	si_pred[m].valid = 0;
+	predictCleared(m);
+}
+
+/**\fn int setpointInterpBusy(int m)
+ * \brief true while mechanism m's setpoint is still moving to its last target
+ */
+int setpointInterpBusy(int m)
+{
+	return si_seg[m].active;
+}
+
+/**\fn void setpointInterpStep(struct device *device0, int runlevel)
+ * \brief advance the setpoints one servo cycle; call before inverse kinematics
+ * \param device0 robot device
+ * \param runlevel current runlevel; segments are dropped outside pedal down
+ */
+void setpointInterpStep(struct device *device0, int runlevel)
+{
+	for (int m = mechFirst(); m < mechEnd(); m++)
+	{
+		struct si_segment *s = &si_seg[m];
+		struct mechanism *mech = &device0->mech[m];
+
+		if (runlevel != RL_PEDAL_DN)
+		{
+			s->active = 0;
+			si_pred[m].valid = 0;
+			predictCleared(m);
+			continue;
+		}
+
+		if (s->active)
+		{
+			double a = (double)(gTime - s->t0 + 1) / s->len;
+			if (a >= 1)
+			{
+				a = 1;
+				s->active = 0;
+			}
+
+			mech->pos_d.x = (int)lround(s->p0[0] + a * (s->p1[0] - s->p0[0]));
+			mech->pos_d.y = (int)lround(s->p0[1] + a * (s->p1[1] - s->p0[1]));
+			mech->pos_d.z = (int)lround(s->p0[2] + a * (s->p1[2] - s->p0[2]));
+			mech->ori_d.grasp = (int)lround(s->g0 + a * (s->g1 - s->g0));
+
+			double q[4];
+			slerp(s->q0, s->q1, a, q);
+			quatToMat(q, mech->ori_d.R);
+			predictCleared(m);
+		}
+
+		if (sp_mode != SP_OFF)
+			predictApply(m, mech);
+	}
+}
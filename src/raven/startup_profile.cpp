@@ -0,0 +1,116 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file startup_profile.cpp
+ * \brief Timed startup phases, reported once the control loop is ready.
+ */
+
+#include <time.h>
+#include <pthread.h>
+
+#include "startup_profile.h"
+#include "log.h"
+
+struct startup_phase
+{
+	const char *name;       // a string literal
+	struct timespec begin;
+	struct timespec end;    // zero while running
+};
+
+static struct timespec startup_t0;
+static struct startup_phase startup_phases[STARTUP_MAX_PHASES];
+static int startup_nphases = 0;
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**\fn static double msSince(const struct timespec &t0, const struct timespec &t)
+ */
+static double msSince(const struct timespec &t0, const struct timespec &t)
+{
+	return (t.tv_sec - t0.tv_sec) * 1e3 + (t.tv_nsec - t0.tv_nsec) * 1e-6;
+}
+
+/**\fn void startupProfileStart(void)
+ * \brief mark launch: phase times are from here
+ */
+void startupProfileStart(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &startup_t0);
+	startup_nphases = 0;
+}
+
+/**\fn int startupPhaseBegin(const char *name)
+ * \brief a startup step begins
+ * \param name a string literal
+ * \return the phase, for startupPhaseEnd(); -1 if the table is full
+ */
+int startupPhaseBegin(const char *name)
+{
+	struct timespec now;
+	int p = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&startup_lock);
+	if (startup_nphases < STARTUP_MAX_PHASES)
+	{
+		p = startup_nphases++;
+		startup_phases[p].name = name;
+		startup_phases[p].begin = now;
+		startup_phases[p].end.tv_sec = startup_phases[p].end.tv_nsec = 0;
+	}
+	pthread_mutex_unlock(&startup_lock);
+	return p;
+}
+
+/**\fn void startupPhaseEnd(int phase)
+ * \brief the step startupPhaseBegin() returned phase for is done
+ */
+void startupPhaseEnd(int phase)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&startup_lock);
+	if (phase >= 0 && phase < startup_nphases)
+		startup_phases[phase].end = now;
+	pthread_mutex_unlock(&startup_lock);
+}
+
+/**\fn void startupProfileReport(void)
+ * \brief log every phase, in the order they began, and the time since launch
+ */
+void startupProfileReport(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&startup_lock);
+	log_msg("Startup: %.1f ms from launch", msSince(startup_t0, now));
+	log_msg("  %9s %9s  %s", "at (ms)", "took (ms)", "phase");
+	for (int p = 0; p < startup_nphases; p++)
+	{
+		const struct startup_phase *s = &startup_phases[p];
+		if (s->end.tv_sec == 0 && s->end.tv_nsec == 0)
+			log_msg("  %9.1f %9s  %s", msSince(startup_t0, s->begin), "running", s->name);
+		else
+			log_msg("  %9.1f %9.1f  %s", msSince(startup_t0, s->begin), msSince(s->begin, s->end), s->name);
+	}
+	pthread_mutex_unlock(&startup_lock);
+}
@@ -27,35 +27,506 @@
  *
  */
 
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ros/ros.h>
 #include "state_estimate.h"
+#include "joint_block.h"
+#include "velocity_estimate.h"
+#include "log.h"
 
-extern struct DOF_type DOF_types[];
+extern struct device device0;
 extern int NUM_MECH;
 
-void getStateLPF(struct DOF *joint);
+// Default motor position LPF: design, cutoff and order of every joint unless set otherwise
+#define LPF_DESIGN    LPF_BUTTERWORTH
+#define LPF_CUTOFF_HZ 120.0
+#define LPF_ORDER     3
+
+// History slot k samples back, k = 0..JB_LPF_RING-1
+#define LPF_SLOT(pos, k) (((pos) - (k)) & (JB_LPF_RING - 1))
+
+//  Per-joint filter coefficients.  Lower orders have their unused terms
+// zero.  a[] holds the negated feedback terms, a[0] is unused.
+struct lpf_bank {
+    union jb_lanes b[LPF_MAX_ORDER+1];
+    union jb_lanes a[LPF_MAX_ORDER+1];
+};
+
+//  Two banks: stateEstimate() reads lpf_banks[lpf_active], taken once at the
+// start of its cycle and acknowledged in lpf_in_use.  lpfPublish() fills the
+// other bank and flips lpf_active, so a new design takes effect at a cycle
+// boundary and never half-written.
+static struct lpf_bank lpf_banks[2];
+static volatile int lpf_active = 0;
+static volatile int lpf_in_use = 0;
+
+// Writer side: what each joint type is set to, under lpf_mutex
+static struct lpf_setting lpf_set[JB_N_JOINTS];
+static struct lpf_setting lpf_class_set[2];
+static float lpf_rate_hz = DEFAULT_CONTROL_RATE;
+static pthread_mutex_t lpf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *lpf_design_names[] = { "butterworth", "bessel" };
+
+/*
+ * lpfPrototype()
+ *
+ *  Denominator of the analog prototype with its -3 dB point at 1 rad/s,
+ * ascending powers of s, d[order] = 1.  The numerator is d[0] (unity DC
+ * gain).  Bessel comes from the delay-normalised reverse Bessel
+ * polynomial, rescaled by its -3 dB frequency.
+ */
+static void lpfPrototype(int design, int order, double *d)
+{
+    static const double butter[LPF_MAX_ORDER+1][LPF_MAX_ORDER+1] = {
+        { 1 },
+        { 1, 1 },
+        { 1, M_SQRT2, 1 },
+        { 1, 2, 2, 1 },
+    };
+    static const double bessel[LPF_MAX_ORDER+1][LPF_MAX_ORDER+1] = {
+        { 1 },
+        { 1, 1 },
+        { 3, 3, 1 },
+        { 15, 15, 6, 1 },
+    };
+    static const double bessel_w3db[LPF_MAX_ORDER+1] = { 1, 1, 1.36165412871613, 1.75567236868121 };
+
+    for (int i = 0; i <= order; i++)
+    {
+        if (design == LPF_BESSEL)
+            d[i] = bessel[order][i] / pow(bessel_w3db[order], order - i);
+        else
+            d[i] = butter[order][i];
+    }
+}
+
+/*
+ * polyMul()
+ *
+ *  p <- p * (1 + sign z^-1), p has n terms before, n+1 after.
+ */
+static inline void polyMul(double *p, int n, int sign)
+{
+    p[n] = 0;
+    for (int i = n; i > 0; i--)
+        p[i] += sign * p[i-1];
+}
+
+/*
+ * designLPF()
+ *
+ *  Bilinear transform of the design's analog prototype with the cutoff
+ * prewarped.  b[] and a[] get order+1 terms, a[] negated and a[0] set to 1.
+ */
+static void designLPF(int design, double cutoff_hz, double rate_hz, int order, double *b, double *a)
+{
+    double k = tan(M_PI * cutoff_hz / rate_hz);
+    double d[LPF_MAX_ORDER+1];
+    double den[LPF_MAX_ORDER+1] = {0}, num[LPF_MAX_ORDER+1] = {0};
+
+    lpfPrototype(design, order, d);
+
+    // s = (1/k)(1-z^-1)/(1+z^-1); times k^n (1+z^-1)^n:
+    //   A(z) = sum d[i] k^(n-i) (1-z^-1)^i (1+z^-1)^(n-i),  B(z) = d[0] k^n (1+z^-1)^n
+    for (int i = 0; i <= order; i++)
+    {
+        double p[LPF_MAX_ORDER+1] = { d[i] * pow(k, order - i) };
+        int n = 1;
+        for (int j = 0; j < i; j++, n++)
+            polyMul(p, n, -1);
+        for (int j = i; j < order; j++, n++)
+            polyMul(p, n, 1);
+        for (int j = 0; j <= order; j++)
+            den[j] += p[j];
+    }
+    num[0] = d[0] * pow(k, order);
+    for (int n = 1; n <= order; n++)
+        polyMul(num, n, 1);
+
+    for (int j = 0; j <= order; j++)
+    {
+        b[j] = num[j] / den[0];
+        a[j] = -den[j] / den[0];
+    }
+    a[0] = 1.0;
+}
+
+/*
+ * lpfSettingOK()
+ *
+ *  Is the design realisable at the control rate?
+ */
+static int lpfSettingOK(const struct lpf_setting &s)
+{
+    return (s.design == LPF_BUTTERWORTH || s.design == LPF_BESSEL) &&
+           s.order >= 1 && s.order <= LPF_MAX_ORDER &&
+           s.cutoff_hz > 0 && s.cutoff_hz < lpf_rate_hz / 2;
+}
+
+/*
+ * lpfPublish()
+ *
+ *  Design every joint's filter from lpf_set[] into the bank stateEstimate()
+ * is not using and make it the active one.  A bank is only reused once the
+ * control loop has moved off it; if the loop is not running it gives up
+ * waiting after LPF_SWAP_WAIT_MS.  Call with lpf_mutex held.
+ */
+#define LPF_SWAP_WAIT_MS 100
+static void lpfPublish()
+{
+    int cur = lpf_active;
+    for (int i = 0; lpf_in_use != cur && i < LPF_SWAP_WAIT_MS * 10; i++)
+        usleep(100);
+
+    struct lpf_bank *bank = &lpf_banks[!cur];
+    for (int t = 0; t < JB_N_JOINTS; t++)
+    {
+        double b[LPF_MAX_ORDER+1] = {0}, a[LPF_MAX_ORDER+1] = {0};
+        designLPF(lpf_set[t].design, lpf_set[t].cutoff_hz, lpf_rate_hz, lpf_set[t].order, b, a);
+        for (int k = 0; k <= LPF_MAX_ORDER; k++)
+        {
+            bank->b[k].s[t] = b[k];
+            bank->a[k].s[t] = a[k];
+        }
+    }
+    __sync_synchronize();
+    lpf_active = !cur;
+}
+
+/*
+ * lpfClassOf()
+ *
+ *  LPF_CLASS_ARM for the shoulder, elbow and insertion, LPF_CLASS_TOOL for the rest.
+ */
+static inline int lpfClassOf(int type)
+{
+    return (type % MAX_DOF_PER_MECH <= Z_INS) ? LPF_CLASS_ARM : LPF_CLASS_TOOL;
+}
+
+/*
+ * setStateLPF()
+ *
+ *  Choose one joint type's position filter: butterworth or bessel of order
+ * 1 to LPF_MAX_ORDER with the cutoff below Nyquist.  Takes effect at the
+ * next cycle.  Returns 0, or -1 (and leaves the filter alone) if the design
+ * is out of range.
+ */
+int setStateLPF(int type, int design, float cutoff_hz, int order)
+{
+    struct lpf_setting s = { design, cutoff_hz, order };
+    if (type < 0 || type >= JB_N_JOINTS || !lpfSettingOK(s))
+        return -1;
+
+    pthread_mutex_lock(&lpf_mutex);
+    lpf_set[type] = s;
+    lpfPublish();
+    pthread_mutex_unlock(&lpf_mutex);
+    return 0;
+}
+
+/*
+ * setStateLPFClass()
+ *
+ *  setStateLPF() for every joint of a class, both arms, in one swap.
+ * Setting a class to what it already is does nothing, so per-joint
+ * choices made since are kept.
+ */
+int setStateLPFClass(int joint_class, int design, float cutoff_hz, int order)
+{
+    struct lpf_setting s = { design, cutoff_hz, order };
+    if ((joint_class != LPF_CLASS_ARM && joint_class != LPF_CLASS_TOOL) || !lpfSettingOK(s))
+        return -1;
+
+    pthread_mutex_lock(&lpf_mutex);
+    struct lpf_setting &c = lpf_class_set[joint_class];
+    if (c.design != s.design || c.cutoff_hz != s.cutoff_hz || c.order != s.order)
+    {
+        c = s;
+        for (int t = 0; t < JB_N_JOINTS; t++)
+            if (lpfClassOf(t) == joint_class)
+                lpf_set[t] = s;
+        lpfPublish();
+        log_msg("State LPF: %s joints %s %.1f Hz order %d", joint_class == LPF_CLASS_ARM ? "arm" : "tool",
+                lpf_design_names[design], cutoff_hz, order);
+    }
+    pthread_mutex_unlock(&lpf_mutex);
+    return 0;
+}
+
+/*
+ * designStateLPF()
+ *
+ *  Design every joint's position filter for the control rate: the
+ * default LPF_CUTOFF_HZ, LPF_ORDER butterworth, or the joint's own choice
+ * if one was already made and still fits the rate.
+ */
+void designStateLPF(float rate_hz)
+{
+    struct lpf_setting def = { LPF_DESIGN, LPF_CUTOFF_HZ, LPF_ORDER };
+
+    pthread_mutex_lock(&lpf_mutex);
+    lpf_rate_hz = rate_hz;
+    for (int t = 0; t < JB_N_JOINTS; t++)
+        if (!lpfSettingOK(lpf_set[t]))
+            lpf_set[t] = def;
+    for (int c = 0; c < 2; c++)
+        if (!lpfSettingOK(lpf_class_set[c]))
+            lpf_class_set[c] = def;
+    lpfPublish();
+    pthread_mutex_unlock(&lpf_mutex);
+
+    const struct lpf_bank *bank = &lpf_banks[lpf_active];
+    log_msg("State LPF: %.0f Hz cutoff at %.0f Hz, B={%.5f %.5f %.5f %.5f} A={1 %.4f %.4f %.4f}",
+            lpf_set[0].cutoff_hz, rate_hz, bank->b[0].s[0], bank->b[1].s[0], bank->b[2].s[0], bank->b[3].s[0],
+            bank->a[1].s[0], bank->a[2].s[0], bank->a[3].s[0]);
+}
+
+/*
+ * lpfDesignByName()
+ *
+ *  LPF_BUTTERWORTH or LPF_BESSEL from a parameter string, -1 if neither.
+ */
+int lpfDesignByName(const std::string &name)
+{
+    for (int i = 0; i < (int)(sizeof(lpf_design_names) / sizeof(lpf_design_names[0])); i++)
+        if (name == lpf_design_names[i])
+            return i;
+    return -1;
+}
+
+/*
+ * readLPFList()
+ *
+ *  One arm's per-joint list from the parameter server, if present.
+ */
+static int readLPFList(ros::NodeHandle &n, const char *name, double out[MAX_DOF_PER_MECH])
+{
+    XmlRpc::XmlRpcValue v;
+    if (!n.hasParam(name) || !n.getParam(name, v) ||
+        v.getType() != XmlRpc::XmlRpcValue::TypeArray || v.size() != MAX_DOF_PER_MECH)
+        return 0;
+
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+    {
+        if (v[j].getType() == XmlRpc::XmlRpcValue::TypeInt)
+            out[j] = (int)v[j];
+        else if (v[j].getType() == XmlRpc::XmlRpcValue::TypeDouble)
+            out[j] = (double)v[j];
+        else
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * init_state_lpf()
+ *
+ *  Filter design of the arm (shoulder, elbow, insertion) and tool joint
+ * classes from state_lpf_{arm,tool}_{design,cutoff_hz,order}.  Then
+ * per-joint cutoffs (Hz) and orders from the optional state_lpf_cutoff_*
+ * and state_lpf_order_* lists, one entry per joint like the gains, with
+ * the design of the joint's class.  Call after designStateLPF().
+ */
+int init_state_lpf(ros::NodeHandle &n)
+{
+    const char *cls[2] = { "arm", "tool" };
+    for (int c = 0; c < 2; c++)
+    {
+        std::string design;
+        double cutoff;
+        int order;
+        char key[64];
+
+        snprintf(key, sizeof(key), "/state_lpf_%s_design", cls[c]);
+        n.param<std::string>(key, design, lpf_design_names[LPF_DESIGN]);
+        snprintf(key, sizeof(key), "/state_lpf_%s_cutoff_hz", cls[c]);
+        n.param(key, cutoff, LPF_CUTOFF_HZ);
+        snprintf(key, sizeof(key), "/state_lpf_%s_order", cls[c]);
+        n.param(key, order, LPF_ORDER);
+
+        int d = lpfDesignByName(design);
+        if (d < 0 || setStateLPFClass(c, d, cutoff, order) < 0)
+            err_msg("State LPF: no %s order %d filter at %.1f Hz for the %s joints, keeping %s %.1f Hz order %d",
+                    design.c_str(), order, cutoff, cls[c], lpf_design_names[lpf_class_set[c].design],
+                    lpf_class_set[c].cutoff_hz, lpf_class_set[c].order);
+    }
+
+    // Per-joint overrides by arm type, onto every mechanism of that type
+    for (int m = 0; m < NUM_MECH; m++)
+    {
+        const char *arm;
+        if (device0.mech[m].type == GOLD_ARM)
+            arm = "gold";
+        else if (device0.mech[m].type == GREEN_ARM)
+            arm = "green";
+        else
+            continue;
+
+        char key[64];
+        double cutoff[MAX_DOF_PER_MECH], order[MAX_DOF_PER_MECH];
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            cutoff[j] = lpf_set[JOINT_TYPE(m, j)].cutoff_hz;
+            order[j]  = lpf_set[JOINT_TYPE(m, j)].order;
+        }
+
+        snprintf(key, sizeof(key), "/state_lpf_cutoff_%s", arm);
+        int have = readLPFList(n, key, cutoff);
+        snprintf(key, sizeof(key), "/state_lpf_order_%s", arm);
+        have |= readLPFList(n, key, order);
+        if (!have)
+            continue;
+
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            int t = JOINT_TYPE(m, j);
+            int d = lpf_class_set[lpfClassOf(t)].design;
+            if (setStateLPF(t, d, cutoff[j], (int)order[j]) < 0)
+                err_msg("State LPF: %s joint %d of %d: no order %d filter at %.1f Hz, keeping %.0f Hz order %d",
+                        arm, j, m, (int)order[j], cutoff[j], lpf_set[t].cutoff_hz, lpf_set[t].order);
+            else
+                log_msg("State LPF: %s joint %d of %d: %s %.1f Hz order %d", arm, j, m, lpf_design_names[d], cutoff[j], (int)order[j]);
+        }
+    }
+    return 0;
+}
+
+/*
+ * motorAngle()
+ *
+ *  Motor angle (rad) from the joint's encoder count and offset.
+ */
+static inline float motorAngle(struct DOF *joint)
+{
+    float f_enc_val = joint->enc_val;
+
+#ifdef RAVEN_II
+    int arm = device0.mech[MECH_OF_TYPE(joint->type)].type;
+    int j   = JOINT_OF_TYPE(joint->type);
+    if ( (arm == GOLD_ARM && j <= Z_INS)
+         ||
+#ifndef RAVEN_II_SQUARE
+
+         DEFINE RII SQUARE, fool!!
+         (arm == GOLD_ARM && j >= TOOL_ROT)
+         ||
+#endif
+         (arm == GREEN_ARM && j >= TOOL_ROT)
+         )
+         f_enc_val *= -1;
+#endif
+
+    // Calculate motor angle from encoder value
+    return (2.0*PI) * (1.0/((float)ENC_CNTS_PER_REV)) * (f_enc_val - (float)joint->enc_offset);
+}
+
+/*
+ * lpfReady()
+ *
+ *  Initialize a joint type's filter to steady state at motorPos.
+ */
+static inline void lpfReady(int t, float motorPos)
+{
+    for (int k = 0; k < JB_LPF_RING; k++)
+    {
+        jblock.lpf_x[k].s[t] = motorPos;
+        jblock.lpf_y[k].s[t] = motorPos;
+    }
+    jblock.filter_rdy[t] = TRUE;
+    velEstimateReset(t, motorPos);
+}
+
+/*
+ * lpfStep()
+ *
+ *  One step of the position filter, for one joint (T = float) or a
+ * vector of them (T = jb_vf).  x[k] and y[k] are the input and output
+ * k samples back, x[0] the new input.
+ */
+template <class T>
+static inline T lpfStep(const T *x, const T *y, const T *b, const T *a)
+{
+    return
+        b[0] * x[0] +
+        b[1] * x[1] +
+        b[2] * x[2] +
+        b[3] * x[3] +
+        a[1] * y[1] +
+        a[2] * y[2] +
+        a[3] * y[3];
+}
 
 /*
  * stateEstimate()
+ *
+ *  Filter every joint's motor position in one pass over jblock.  The
+ * encoders are read and mpos / mvel written through the block's views
+ * of device0, see jointBlockBind().  The history is a ring per joint,
+ * indexed by jblock.lpf_pos, which advances once per call.
  */
 
 void stateEstimate(struct robot_device *device0)
 {
-    struct DOF *_joint;
-    int i,j;
+    struct joint_block *jb = &jblock;
+    unsigned int pos = jb->lpf_pos;
 
-    //Loop through all joints
-    for (i = 0; i < NUM_MECH; i++)
+    // This cycle's coefficients
+    int bank_idx = lpf_active;
+    lpf_in_use = bank_idx;
+    __sync_synchronize();
+    const struct lpf_bank *bank = &lpf_banks[bank_idx];
+
+    // Encoder to motor angle, lane by lane
+    for (int t = 0; t < JB_N_JOINTS; t++)
     {
-        for (j = 0; j < MAX_DOF_PER_MECH; j++)
-        {
-            _joint = &(device0->mech[i].joint[j]);
+        if (!jb->dof[t])
+            continue;
+        jb->mpos_raw.s[t] = motorAngle(jb->dof[t]);
+        if (!jb->filter_rdy[t])
+            lpfReady(t, jb->mpos_raw.s[t]);
+    }
 
-//            if (_joint->type == TOOL_ROT_GOLD || _joint->type == TOOL_ROT_GOLD)
-//                encToMPos(_joint);
-//            else
-                getStateLPF(_joint);
+    jb_vf dt = jbSplat(STEP_PERIOD);
+    for (int v = 0; v < JB_NV; v++)
+    {
+        jb_vf x[LPF_MAX_ORDER+1], y[LPF_MAX_ORDER+1], b[LPF_MAX_ORDER+1], a[LPF_MAX_ORDER+1];
 
+        x[0] = jb->mpos_raw.v[v];
+        for (int k = 0; k <= LPF_MAX_ORDER; k++)
+        {
+            if (k > 0)
+            {
+                x[k] = jb->lpf_x[LPF_SLOT(pos, k)].v[v];
+                y[k] = jb->lpf_y[LPF_SLOT(pos, k)].v[v];
+            }
+            b[k] = bank->b[k].v[v];
+            a[k] = bank->a[k].v[v];
         }
+
+        //Compute filtered motor angle, and velocity from first difference
+        // This is safe b/c noise is removed by LPF
+        jb_vf filtPos = lpfStep(x, y, b, a);
+        jb->mvel.v[v] = (filtPos - y[1]) / dt;
+        jb->mpos.v[v] = filtPos;
+
+        jb->lpf_x[LPF_SLOT(pos, 0)].v[v] = x[0];
+        jb->lpf_y[LPF_SLOT(pos, 0)].v[v] = filtPos;
+    }
+    jb->lpf_pos = pos + 1;
+
+    // Timestamped estimates for the joints that use one
+    velEstimate(jb);
+
+    for (int t = 0; t < JB_N_JOINTS; t++)
+    {
+        if (!jb->dof[t])
+            continue;
+        jb->dof[t]->mpos = jb->mpos.s[t];
+        jb->dof[t]->mvel = jb->mvel.s[t];
     }
 }
 
@@ -66,6 +537,10 @@ void stateEstimate(struct robot_device *device0)
  * high frequency content in the control loop.  The HF
  * will drive the cable transmission unstable.
  *
+ *  One joint's lane of stateEstimate(), for code that
+ * runs joints one at a time (homing).  The ring cursor
+ * is shared by all joints, so the lane's history is
+ * shifted instead.
  */
 void getStateLPF(struct DOF *joint)
 {
@@ -78,78 +553,52 @@ void getStateLPF(struct DOF *joint)
     //  20 Hz 3rd order butterworth
 //    float B[] = {0.0002196,  0.0006588,  0.0006588,  0.0002196};
 //    float A[] = {1.0000,   2.7488, -2.5282,  0.7776};
-    //  120 Hz 3rd order butterworth
-    float B[] = {0.02864,  0.08591,  0.08591,  0.02864};
-    float A[] = {1.0000,   1.5189, -0.9600,  0.2120};
+    //  120 Hz 3rd order butterworth: now designed at startup, see designStateLPF()
 //    float B[] = {1.0, 0,0,0};
 //    float A[] = {0,0,0,0};
 
-    float *oldPos = DOF_types[joint->type].old_mpos;
-    float *oldFiltPos= DOF_types[joint->type].old_filtered_mpos;
-    float filtPos = 0;
-    float f_enc_val = joint->enc_val;
-
-#ifdef RAVEN_II
-    if ( (joint->type == SHOULDER_GOLD) ||
-         (joint->type == ELBOW_GOLD)    ||
-         (joint->type == Z_INS_GOLD)
-         ||
-#ifndef RAVEN_II_SQUARE
-
-         DEFINE RII SQUARE, fool!!
-         (joint->type == TOOL_ROT_GOLD) ||
-         (joint->type == WRIST_GOLD)    ||
-         (joint->type == GRASP1_GOLD)   ||
-         (joint->type == GRASP2_GOLD)
-         ||
-#endif
-         (joint->type == TOOL_ROT_GREEN) ||
-         (joint->type == WRIST_GREEN)    ||
-         (joint->type == GRASP1_GREEN)   ||
-         (joint->type == GRASP2_GREEN)
-         )
-         f_enc_val *= -1;
-#endif
-
-    // Calculate motor angle from encoder value
-    float motorPos = (2.0*PI) * (1.0/((float)ENC_CNTS_PER_REV)) * (f_enc_val - (float)joint->enc_offset);
+    int t = joint->type;
+    unsigned int pos = jblock.lpf_pos;
+    const struct lpf_bank *bank = &lpf_banks[lpf_in_use];
+    float motorPos = motorAngle(joint);
 
     // Initialize filter to steady state
-    if (!DOF_types[joint->type].filterRdy)
+    if (!jblock.filter_rdy[t])
+        lpfReady(t, motorPos);
+
+    float x[LPF_MAX_ORDER+1], y[LPF_MAX_ORDER+1], b[LPF_MAX_ORDER+1], a[LPF_MAX_ORDER+1];
+    x[0] = motorPos;
+    for (int k = 0; k <= LPF_MAX_ORDER; k++)
     {
-        oldPos[2] = motorPos;
-        oldPos[1] = motorPos;
-        oldPos[0] = motorPos;
-        oldFiltPos[2] = motorPos;
-        oldFiltPos[1] = motorPos;
-        oldFiltPos[0] = motorPos;
-        //    rt_printk("FILTER BEING READIED %d\n", gTime);
-        DOF_types[joint->type].filterRdy = TRUE;
+        if (k > 0)
+        {
+            x[k] = jblock.lpf_x[LPF_SLOT(pos, k)].s[t];
+            y[k] = jblock.lpf_y[LPF_SLOT(pos, k)].s[t];
+        }
+        b[k] = bank->b[k].s[t];
+        a[k] = bank->a[k].s[t];
     }
 
-    //Compute filtered motor angle
-    filtPos =
-        B[0] * motorPos  +
-        B[1] * oldPos[0] +
-        B[2] * oldPos[1] +
-        B[3] * oldPos[2] +
-        A[1] * oldFiltPos[0] +
-        A[2] * oldFiltPos[1] +
-        A[3] * oldFiltPos[2];
+    //Compute filtered motor angle and velocity
+    float filtPos = lpfStep(x, y, b, a);
+    float mvel = (filtPos - y[1]) / STEP_PERIOD;
 
-    // Compute velocity from first difference
-    // This is safe b/c noise is removed by LPF
-    joint->mvel = (filtPos - oldFiltPos[0]) / STEP_PERIOD;
-    joint->mpos = filtPos;
+    // Update old values for filter
+    for (int k = LPF_MAX_ORDER; k > 1; k--)
+    {
+        jblock.lpf_x[LPF_SLOT(pos, k)].s[t] = x[k-1];
+        jblock.lpf_y[LPF_SLOT(pos, k)].s[t] = y[k-1];
+    }
+    jblock.lpf_x[LPF_SLOT(pos, 1)].s[t] = motorPos;
+    jblock.lpf_y[LPF_SLOT(pos, 1)].s[t] = filtPos;
 
+    jblock.mpos_raw.s[t] = motorPos;
+    jblock.mpos.s[t] = joint->mpos = filtPos;
+    jblock.mvel.s[t] = joint->mvel = mvel;
 
-    // Update old values for filter
-    oldPos[2] = oldPos[1];
-    oldPos[1] = oldPos[0];
-    oldPos[0] = motorPos;
-    oldFiltPos[2] = oldFiltPos[1];
-    oldFiltPos[1] = oldFiltPos[0];
-    oldFiltPos[0] = filtPos;
+    // Used where the encoder offset has just moved (homing): the
+    // timestamped estimators restart from the new angle
+    velEstimateReset(t, motorPos);
 
     return;
 }
@@ -157,11 +606,27 @@ void getStateLPF(struct DOF *joint)
 void resetFilter(struct DOF* _joint)
 {
     //reset filter
-    for (int i=0;i<=2;i++)
+    int t = _joint->type;
+    for (int k = 0; k < JB_LPF_RING; k++)
     {
-        DOF_types[_joint->type].old_mpos[i] = _joint->mpos_d;
-        DOF_types[_joint->type].old_filtered_mpos[i] = _joint->mpos_d;
+        jblock.lpf_x[k].s[t] = _joint->mpos_d;
+        jblock.lpf_y[k].s[t] = _joint->mpos_d;
     }
+    velEstimateReset(t, _joint->mpos_d);
+}
+
+/*
+ * resetStateFromEncoder()
+ *
+ *  Motor position straight from the encoder count and offset, with the
+ *  filter and velocity estimate restarted there.  For a joint whose offset
+ *  was just set from elsewhere.
+ */
+void resetStateFromEncoder(struct DOF *joint)
+{
+    joint->mpos_d = motorAngle(joint);
+    resetFilter(joint);
+    getStateLPF(joint);
 }
 
 /*
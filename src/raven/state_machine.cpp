@@ -26,48 +26,65 @@
 
 #include "state_machine.h"
 #include "log.h"
+#include "shared_state.h"
 
-extern int initialized;//Defined in rt_process_preempt
-extern int NUM_MECH;//Defined in rt_process_preempt
-extern int soft_estopped; //Defined in rt_process_preempt
+extern int initialized;//Defined in globals.cpp
+extern int NUM_MECH;//Defined in globals.cpp
 extern int globalTime;
+extern int cycle_max_consecutive_missed; //Defined in globals.cpp
 #include <sys/times.h>
 struct tms dummy_times;
 
-/**\fn void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams)
+/**\fn void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams, int missedDeadlines)
  * \brief This function puts data in a state machine
  * \param device0 robot_device struct defined in DS0.h
  * \param currParam param_pass struct defined in DS1.h
  * \param rcvdParams param_pass struct
+ * \param missedDeadlines number of control loop deadlines missed in a row
  * 
+ * Runs after updateAtmelInputs().  Beyond the missed-deadline check it only
+ * does work when the PLC runlevel changes, until the new runlevel is taken.
+ *
  * In SOFTWARE_RUNLEVEL mode, get desired runlevel from the rcvdParams.
  * In PLC_RUNLEVELS mode, get desired runlevel from the PLC via atmel inputs.
  * If the two PLC's give different runlevels, select  the lowest of the two.
+ * If the control loop misses too many deadlines in a row, raise a software e-stop.
  *
  */
-void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams)
+void stateMachine(struct device *device0, struct param_pass *currParams, struct param_pass *rcvdParams, int missedDeadlines)
 {
     static int rlDelayCounter = 0; // This is a software workaround to a PLC switching transient.  Wait two cycles for the delay.
+    static u_08 lastDesired = 9;   // PLC runlevel at the last call, 9: none yet
+    static int rlWaiting = 0;      // the PLC asks for another runlevel: the delay counter is running
 
     u_08 rlDesired;
     u_08 *rl = &(currParams->runlevel);
-    int i;
-    u_08 tmp;
-    rlDesired = 9; // arbitrary large number
 
-    // Checks runlevel of all mechanisms. Lowest runlevel is chosen.
-    for (i=0;i<NUM_MECH;i++)
+    // Control timing lost.  Stop the watchdog so the PLC drops to e-stop.
+    if ( cycle_max_consecutive_missed > 0 &&
+         missedDeadlines >= cycle_max_consecutive_missed &&
+         currParams->runlevel != RL_E_STOP &&
+         !softEstopped() )
     {
-        tmp = ( device0->mech[i].inputs & (PIN_PS0 | PIN_PS1)) >> 6;
-        if ( tmp < rlDesired )
-        {
-            rlDesired = tmp;
-        }
+        softEstop();
+        err_msg("*** %d control deadlines missed in a row.  Software e-stop. ***\n", missedDeadlines);
     }
 
+    // Lowest runlevel of all mechanisms, kept by updateAtmelInputs() as the PLC pins change.
+    // Transition logic only runs on a change of it and while the delay counter runs.
+    rlDesired = atmelPlcRunlevel();
+    if (rlDesired != lastDesired)
+    {
+        lastDesired = rlDesired;
+        rlWaiting = 1;
+    }
+    if (!rlWaiting)
+        return;
+
     // already in desired runlevel.  Exit.
     if ( *rl == rlDesired)
     {
+        rlWaiting = 0;
         return;
     }
     else if (rlDelayCounter < 3)
@@ -77,6 +94,7 @@ void stateMachine(struct device *device0, struct param_pass *currParams, struct
     }
 
     rlDelayCounter = 0;
+    rlWaiting = 0;
     *rl = rlDesired;            // Update Run Level
     device0->runlevel = *rl;    // Log runlevels in DS0.
     log_msg("Entered runlevel %d", *rl);
@@ -84,11 +102,8 @@ void stateMachine(struct device *device0, struct param_pass *currParams, struct
 
     if (*rl == RL_E_STOP)
     {
-        if (soft_estopped)
-        {
+        if (softEstopClear())
             err_msg("Software e-stop.\n");
-            soft_estopped = FALSE;
-        }
 
         err_msg("*** ENTERED E-STOP STATE ***\n");
 
@@ -0,0 +1,139 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file state_shm.cpp
+ * \brief Shared-memory mirror of the robot state (layout in state_shm_client.h).
+ *
+ * The segment is created and locked at startup; stateShmWrite() runs on the
+ * ROS publisher thread and is one ~2 kB copy between two seq increments.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+
+#include "state_shm.h"
+#include "state_shm_client.h"
+#include "utils.h"
+#include "log.h"
+
+static std::string shm_name;
+static struct state_shm *shm = NULL;
+
+/**\fn int init_state_shm(ros::NodeHandle &n)
+ * \brief create the segment named by /state_shm
+ * \return 0, also when the mirror is off or cannot be created (it is not needed to run)
+ */
+int init_state_shm(ros::NodeHandle &n)
+{
+	n.param<std::string>("/state_shm", shm_name, STATE_SHM_NAME);
+	if (shm_name.empty())
+		return 0;
+
+	int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		err_msg("State shm: cannot create %s (%d)", shm_name.c_str(), errno);
+		return 0;
+	}
+	if (ftruncate(fd, sizeof(struct state_shm)) < 0)
+	{
+		err_msg("State shm: cannot size %s (%d)", shm_name.c_str(), errno);
+		close(fd);
+		return 0;
+	}
+	void *p = mmap(NULL, sizeof(struct state_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		err_msg("State shm: cannot map %s (%d)", shm_name.c_str(), errno);
+		return 0;
+	}
+	mlock(p, sizeof(struct state_shm));
+
+	// Readers of an older segment see a bad magic until this one is set up
+	struct state_shm *s = (struct state_shm *)p;
+	s->magic = 0;
+	__sync_synchronize();
+	memset(s, 0, sizeof(*s));
+	s->version = STATE_SHM_VERSION;
+	s->size = sizeof(struct state_shm);
+	s->device_size = sizeof(struct robot_device);
+	s->flags = STATE_SHM_LIVE;
+	__sync_synchronize();
+	s->magic = STATE_SHM_MAGIC;
+	shm = s;
+
+	log_msg("State shm: %s, %lu bytes", shm_name.c_str(), (unsigned long)sizeof(struct state_shm));
+	return 0;
+}
+
+/**\fn int stateShmActive()
+ * \return nonzero if the segment is mapped
+ */
+int stateShmActive()
+{
+	return shm != NULL;
+}
+
+/**\fn void stateShmWrite(struct robot_device *dev, const struct timespec *stamp, unsigned long cycle, int runlevel, int sublevel, int last_sequence)
+ * \brief publish one snapshot to the readers.  Publisher thread only (single writer).
+ * \param stamp CLOCK_REALTIME when the RT thread took the snapshot
+ * \param cycle gTime when the RT thread took the snapshot
+ */
+void stateShmWrite(struct robot_device *dev, const struct timespec *stamp, unsigned long cycle,
+				   int runlevel, int sublevel, int last_sequence)
+{
+	struct timespec now;
+
+	if (!shm)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	shm->seq++;                    // odd: readers retry
+	__sync_synchronize();          // seq visible before the data changes
+	struct state_shm_snapshot *s = &shm->snap;
+	s->cycle = cycle;
+	s->stamp_ns = (u_64)stamp->tv_sec * NSEC_PER_SEC + stamp->tv_nsec;
+	s->write_ns = (u_64)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+	s->runlevel = runlevel;
+	s->sublevel = sublevel;
+	s->last_sequence = last_sequence;
+	memcpy(&s->dev, dev, sizeof(struct robot_device));
+	__sync_synchronize();          // data visible before seq is even again
+	shm->seq++;
+	shm->writes++;
+}
+
+/**\fn void stateShmClose()
+ * \brief mark the segment stale and remove its name.  Readers keep their mapping.
+ */
+void stateShmClose()
+{
+	if (!shm)
+		return;
+	shm->flags &= ~STATE_SHM_LIVE;
+	munmap(shm, sizeof(struct state_shm));
+	shm = NULL;
+	shm_unlink(shm_name.c_str());
+}
@@ -31,12 +31,12 @@
 #include "motor.h"
 #include "utils.h"
 #include "log.h"
+#include "joint_block.h"
+#include "arm_pipeline.h"
+#include "shared_state.h"
 
-extern struct DOF_type DOF_types[];
 extern int NUM_MECH;
 
-extern unsigned int soft_estopped;
-
 
 /**
  * TorqueToDAC() - Converts desired torque on each joint to desired DAC level
@@ -44,24 +44,37 @@ extern unsigned int soft_estopped;
  * Precondition - tau_d has been set for each joint
  *
  * Postcondition - current_cmd is set for each joint
- * \param device0 pointer to device structure
+ *
+ * The conversion runs over all of jblock as vectors, see tToDACVal() for
+ * the per-joint version.
+ * \param device0 pointer to device structure, the one jblock is bound to
  *
  */
 int TorqueToDAC(struct device *device0)
 {
-    int i, j;
+    struct joint_block *jb = &jblock;
+    int t0 = JB_MECH_LANE(mechFirst()), t1 = JB_MECH_LANE(mechEnd());
 
-    // for each arm
-    for (i=0; i < NUM_MECH; i++)
-        for (j=0; j < MAX_DOF_PER_MECH ; j++) {
-            if (device0->mech[i].joint[j].type == NO_CONNECTION_GOLD || device0->mech[i].joint[j].type == NO_CONNECTION_GREEN)
-                continue;
-            device0->mech[i].joint[j].current_cmd = tToDACVal( &(device0->mech[i].joint[j]) );  // Convert torque to DAC value
+    for (int t = t0; t < t1; t++)
+        if (jb->dof[t])
+            jb->tau_d.s[t] = jb->dof[t]->tau_d;
 
-            if ( soft_estopped )
-                device0->mech[i].joint[j].current_cmd = 0;
+    //compute DAC value: DAC=[tau*(amp/torque)*(DACs/amp)], saturated to a short int
+    jb_vf hi = jbSplat(SHORT_MAX), lo = jbSplat(SHORT_MIN);
+    for (int v = JB_MECH_VEC(mechFirst()); v < JB_MECH_VEC(mechEnd()); v++)
+    {
+        jb_vf dac = jb->tau_d.v[v] * jb->tf_motor.v[v] * jb->tf_amp.v[v];
+        dac = (dac > hi) ? hi : dac;
+        dac = (dac < lo) ? lo : dac;
+        jb->dac.v[v] = dac;
+    }
 
-        }
+    for (int t = t0; t < t1; t++)
+    {
+        if (!jb->dof[t] || JOINT_OF_TYPE(t) == NO_CONNECTION)
+            continue;
+        jb->dof[t]->current_cmd = softEstopped() ? 0 : (short int)jb->dac.s[t];
+    }
     return 0;
 }
 
@@ -84,8 +97,8 @@ short int tToDACVal(struct DOF *joint)
 
     int j_index = joint->type;
 
-    TFmotor     = 1 / DOF_types[j_index].tau_per_amp;    // Determine the motor TF  = 1/(tau per amp)
-    TFamplifier =     DOF_types[j_index].DAC_per_amp;    // Determine the amplifier TF = (DAC_per_amp)
+    TFmotor     = jblock.tf_motor.s[j_index];    // Determine the motor TF  = 1/(tau per amp)
+    TFamplifier = jblock.tf_amp.s[j_index];      // Determine the amplifier TF = (DAC_per_amp)
 
     DACVal = (int)(joint->tau_d * TFmotor * TFamplifier);  //compute DAC value: DAC=[tau*(amp/torque)*(DACs/amp)]
 
@@ -0,0 +1,367 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file teleop_jitter.cpp
+ * \brief Reorder window and optional playout buffer for incoming teleop samples.
+ *
+ * Samples go into a sequence-indexed window and come out strictly in
+ * order.  A gap is waited for until the reorder timeout (or until a sample
+ * beyond the window arrives) and then skipped.  Late and duplicate samples
+ * are rejected.
+ *
+ * With a playout delay, in-order samples are then released on a clock
+ * anchored to the master's sequence numbers: sample s plays at
+ * anchor_time + (s - anchor_seq) * period + delay.  A burst that arrives
+ * together is spread back out at the master rate.  The clock re-anchors if a
+ * sample misses its slot or the buffer runs more than one delay ahead.
+ */
+
+#include <string.h>
+
+#include "teleop_jitter.h"
+#include "log.h"
+
+struct tj_slot
+{
+	int valid;
+	struct u_struct u;
+	struct timespec rx_stamp;
+};
+
+struct tj_ready
+{
+	struct u_struct u;
+	struct timespec rx_stamp;
+	long long play_ns;           // CLOCK_MONOTONIC release time
+};
+
+// configuration
+static int tj_window = 8;
+static long long tj_timeout_ns = 2000000;
+static long long tj_delay_ns = 0;
+static long long tj_period_ns = 1000000;
+
+// reorder window
+static struct tj_slot tj_slots[TJ_MAX_WINDOW];
+static unsigned int tj_next_seq = 0;   // next sequence number to release
+static int tj_started = 0;
+static int tj_npending = 0;            // valid slots
+static long long tj_gap_since = -1;    // when the current gap started, -1: no gap
+
+// playout queue
+static struct tj_ready tj_ready_q[TJ_PLAYOUT_SIZE];
+static unsigned int tj_ready_head = 0, tj_ready_tail = 0;
+static int tj_anchored = 0;
+static unsigned int tj_anchor_seq;
+static long long tj_anchor_ns;
+
+// statistics
+static unsigned long tj_accepted = 0, tj_duplicates = 0, tj_late = 0, tj_skipped = 0;
+static unsigned long tj_resets = 0, tj_reanchors = 0, tj_overflows = 0;
+
+/**\fn static inline long long tjNs(const struct timespec *t)
+ * \brief convert a timespec to nanoseconds
+ */
+static inline long long tjNs(const struct timespec *t)
+{
+	return (long long)t->tv_sec * 1000000000LL + t->tv_nsec;
+}
+
+/**\fn int init_teleop_jitter(ros::NodeHandle &n)
+ * \brief read the reorder / playout parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_teleop_jitter(ros::NodeHandle &n)
+{
+	int window, timeout_us, delay_us, period_us;
+
+	n.param("/teleop_reorder_window", window, 8);
+	n.param("/teleop_reorder_timeout_us", timeout_us, 2000);
+	n.param("/teleop_playout_delay_us", delay_us, 0);
+	n.param("/teleop_playout_period_us", period_us, 1000);
+
+	if (window < 1 || window > TJ_MAX_WINDOW)
+	{
+		err_msg("teleop_reorder_window %d out of range 1-%d, using 8", window, TJ_MAX_WINDOW);
+		window = 8;
+	}
+	if (period_us <= 0)
+		period_us = 1000;
+	if (delay_us < 0)
+		delay_us = 0;
+	if (delay_us / period_us > TJ_PLAYOUT_SIZE/2)
+	{
+		delay_us = period_us * (TJ_PLAYOUT_SIZE/2);
+		err_msg("teleop_playout_delay_us limited to %d us", delay_us);
+	}
+
+	tj_window = window;
+	tj_timeout_ns = (long long)timeout_us * 1000;
+	tj_delay_ns = (long long)delay_us * 1000;
+	tj_period_ns = (long long)period_us * 1000;
+
+	log_msg("Teleop reorder window %d samples / %d us, playout delay %d us at %d us per sample",
+			tj_window, timeout_us, delay_us, period_us);
+	return 0;
+}
+
+/**\fn static void tjPushReady(struct tj_slot *s, long long now)
+ * \brief queue an in-order sample for playout
+ */
+static void tjPushReady(struct tj_slot *s, long long now)
+{
+	long long play = now;
+
+	if (tj_delay_ns > 0)
+	{
+		if (tj_anchored)
+			play = tj_anchor_ns + (long long)(int)(s->u.sequence - tj_anchor_seq) * tj_period_ns + tj_delay_ns;
+		if (!tj_anchored || play < now || play > now + 2*tj_delay_ns)
+		{
+			if (tj_anchored)
+				tj_reanchors++;
+			tj_anchored = 1;
+			tj_anchor_seq = s->u.sequence;
+			tj_anchor_ns = now;
+			play = now + tj_delay_ns;
+		}
+	}
+
+	if (tj_ready_tail - tj_ready_head >= TJ_PLAYOUT_SIZE)
+	{
+		tj_overflows++;
+		return;
+	}
+	struct tj_ready *r = &tj_ready_q[tj_ready_tail % TJ_PLAYOUT_SIZE];
+	r->u = s->u;
+	r->rx_stamp = s->rx_stamp;
+	r->play_ns = play;
+	tj_ready_tail++;
+}
+
+/**\fn static void tjAdvance(long long now)
+ * \brief release every sample that is now in order
+ */
+static void tjAdvance(long long now)
+{
+	int progressed = 0;
+
+	while (tj_npending > 0)
+	{
+		struct tj_slot *s = &tj_slots[tj_next_seq % TJ_MAX_WINDOW];
+		if (!s->valid || s->u.sequence != tj_next_seq)
+			break;
+		tjPushReady(s, now);
+		s->valid = 0;
+		tj_npending--;
+		tj_next_seq++;
+		progressed = 1;
+	}
+
+	if (tj_npending == 0)
+		tj_gap_since = -1;
+	else if (progressed || tj_gap_since < 0)
+		tj_gap_since = now;
+}
+
+/**\fn static void tjSkipGap()
+ * \brief give up on the missing samples before the oldest held one
+ */
+static void tjSkipGap()
+{
+	unsigned int from = tj_next_seq;
+
+	while (tj_npending > 0)
+	{
+		struct tj_slot *s = &tj_slots[tj_next_seq % TJ_MAX_WINDOW];
+		if (s->valid && s->u.sequence == tj_next_seq)
+			break;
+		tj_next_seq++;
+		tj_skipped++;
+	}
+	if (tj_next_seq != from)
+		err_msg("Skipped (dropped?) teleop packets %u - %u", from, tj_next_seq-1);
+}
+
+/**\fn int teleopJitterInsert(const struct u_struct *u, const struct timespec *rx_stamp, const struct timespec *now)
+ * \brief add a received sample to the reorder window
+ * \param u the sample
+ * \param rx_stamp its receive time (CLOCK_REALTIME, carried through for latency measurement)
+ * \param now current CLOCK_MONOTONIC time
+ * \return TJ_ACCEPTED, TJ_DUPLICATE, TJ_LATE or TJ_RESET
+ */
+int teleopJitterInsert(const struct u_struct *u, const struct timespec *rx_stamp, const struct timespec *now)
+{
+	long long tnow = tjNs(now);
+	unsigned int seq = u->sequence;
+	int ret = TJ_ACCEPTED;
+
+	if (!tj_started)
+	{
+		tj_next_seq = seq;
+		tj_started = 1;
+	}
+
+	if ((int)(seq - tj_next_seq) < 0)
+	{
+		if (tj_next_seq - seq <= 1000)
+		{
+			if (seq == tj_next_seq-1)
+				tj_duplicates++;
+			else
+				tj_late++;
+			return seq == tj_next_seq-1 ? TJ_DUPLICATE : TJ_LATE;
+		}
+
+		// Sequence numbering restarted (skipped more than 1000 back): flush and start over
+		while (tj_npending > 0)
+		{
+			tjSkipGap();
+			tjAdvance(tnow);
+		}
+		tj_next_seq = seq;
+		tj_anchored = 0;
+		tj_resets++;
+		ret = TJ_RESET;
+	}
+
+	// Beyond the window: stop waiting for what is missing in front of it
+	while (seq - tj_next_seq >= (unsigned int)tj_window)
+	{
+		if (tj_npending == 0)
+		{
+			unsigned int to = seq - (tj_window-1);
+			err_msg("Skipped (dropped?) teleop packets %u - %u", tj_next_seq, to-1);
+			tj_skipped += to - tj_next_seq;
+			tj_next_seq = to;
+			break;
+		}
+		tjSkipGap();
+		tjAdvance(tnow);
+	}
+
+	struct tj_slot *s = &tj_slots[seq % TJ_MAX_WINDOW];
+	if (s->valid && s->u.sequence == seq)
+	{
+		tj_duplicates++;
+		return TJ_DUPLICATE;
+	}
+
+	s->valid = 1;
+	s->u = *u;
+	s->rx_stamp = *rx_stamp;
+	tj_npending++;
+	tj_accepted++;
+	tjAdvance(tnow);
+
+	return ret;
+}
+
+/**\fn void teleopJitterReset()
+ * \brief drop everything pending and restart sequence tracking (the teleop source changed)
+ */
+void teleopJitterReset()
+{
+	for (int i = 0; i < TJ_MAX_WINDOW; i++)
+		tj_slots[i].valid = 0;
+	tj_npending = 0;
+	tj_gap_since = -1;
+	tj_ready_head = tj_ready_tail;
+	tj_started = 0;
+	tj_anchored = 0;
+	tj_resets++;
+}
+
+/**\fn void teleopJitterPoll(const struct timespec *now)
+ * \brief skip a gap that has been waited on for longer than the reorder timeout
+ * \param now current CLOCK_MONOTONIC time
+ */
+void teleopJitterPoll(const struct timespec *now)
+{
+	long long tnow = tjNs(now);
+
+	if (tj_npending > 0 && tnow - tj_gap_since >= tj_timeout_ns)
+	{
+		tjSkipGap();
+		tjAdvance(tnow);
+	}
+}
+
+/**\fn int teleopJitterRelease(struct u_struct *out, struct timespec *rx_stamps, int maxout, const struct timespec *now)
+ * \brief take the samples that are due for playout
+ * \param out filled with samples, oldest first
+ * \param rx_stamps filled with their receive times
+ * \param maxout room in out / rx_stamps
+ * \param now current CLOCK_MONOTONIC time
+ * \return number of samples
+ */
+int teleopJitterRelease(struct u_struct *out, struct timespec *rx_stamps, int maxout, const struct timespec *now)
+{
+	long long tnow = tjNs(now);
+	int n = 0;
+
+	while (n < maxout && tj_ready_head != tj_ready_tail)
+	{
+		struct tj_ready *r = &tj_ready_q[tj_ready_head % TJ_PLAYOUT_SIZE];
+		if (r->play_ns > tnow)
+			break;
+		out[n] = r->u;
+		rx_stamps[n] = r->rx_stamp;
+		n++;
+		tj_ready_head++;
+	}
+	return n;
+}
+
+/**\fn int teleopJitterNextEvent(const struct timespec *now, struct timespec *wait)
+ * \brief how long until the next playout or gap timeout
+ * \param now current CLOCK_MONOTONIC time
+ * \param wait filled with the time to wait (zero if something is already due)
+ * \return 1 if there is a pending event, 0 if nothing is waiting
+ */
+int teleopJitterNextEvent(const struct timespec *now, struct timespec *wait)
+{
+	long long tnow = tjNs(now);
+	long long next = -1;
+
+	if (tj_ready_head != tj_ready_tail)
+		next = tj_ready_q[tj_ready_head % TJ_PLAYOUT_SIZE].play_ns;
+	if (tj_npending > 0 && (next < 0 || tj_gap_since + tj_timeout_ns < next))
+		next = tj_gap_since + tj_timeout_ns;
+	if (next < 0)
+		return 0;
+
+	long long dt = next > tnow ? next - tnow : 0;
+	wait->tv_sec = dt / 1000000000LL;
+	wait->tv_nsec = dt % 1000000000LL;
+	return 1;
+}
+
+/**\fn void outputTeleopJitterStats()
+ * \brief print reorder / playout counters
+ */
+void outputTeleopJitterStats()
+{
+	log_msg("Teleop samples: %lu accepted, %lu duplicate, %lu late, %lu skipped, %lu resets",
+			tj_accepted, tj_duplicates, tj_late, tj_skipped, tj_resets);
+	if (tj_delay_ns > 0)
+		log_msg("Teleop playout: %lu re-anchors, %lu overflows", tj_reanchors, tj_overflows);
+}
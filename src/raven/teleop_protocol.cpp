@@ -0,0 +1,264 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file teleop_protocol.cpp
+ * \brief Teleop packet decoding: legacy u_struct and the compact multi-sample format.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "teleop_protocol.h"
+#include "crc32c.h"
+#include "log.h"
+
+static int require_crc = 0;             // reject u_structs without a CRC-32C
+static unsigned long crc_checked = 0, crc_rejects = 0, crc_missing = 0;
+
+/**\fn int init_teleop_protocol(ros::NodeHandle &n)
+ * \brief read /teleop_require_crc
+ * \param n the node handle
+ * \return 0
+ */
+int init_teleop_protocol(ros::NodeHandle &n)
+{
+    bool req;
+    n.param("/teleop_require_crc", req, false);
+    require_crc = req;
+    log_msg("Teleop CRC-32C (%s): %s", crc32cHardware() ? "hardware" : "software",
+            require_crc ? "required" : "checked when present");
+    return 0;
+}
+
+/**\fn static unsigned int teleopStructCRC(const struct u_struct *u)
+ * \brief CRC-32C of a u_struct with the checksum field taken as zero
+ */
+static unsigned int teleopStructCRC(const struct u_struct *u)
+{
+    const size_t off = offsetof(struct u_struct, checksum);
+    const int zero = 0;
+    unsigned int crc = crc32c(0, u, off);
+    crc = crc32c(crc, &zero, sizeof(zero));
+    return crc32c(crc, (const char*)u + off + sizeof(zero), sizeof(*u) - off - sizeof(zero));
+}
+
+/**\fn void sealTeleopPacket(struct u_struct *u)
+ * \brief Reference for masters: mark a u_struct as CRC protected and fill in its checksum
+ */
+void sealTeleopPacket(struct u_struct *u)
+{
+    u->pactyp = TELEOP_PACTYP_CRC32C;
+    u->checksum = (int)teleopStructCRC(u);
+}
+
+/**\fn void sealFeedbackPacket(struct v_struct *v)
+ * \brief mark a v_struct as CRC protected and fill in its checksum (same scheme as u_struct)
+ */
+void sealFeedbackPacket(struct v_struct *v)
+{
+    const size_t off = offsetof(struct v_struct, checksum);
+    const int zero = 0;
+
+    v->pactyp = TELEOP_PACTYP_CRC32C;
+    unsigned int crc = crc32c(0, v, off);
+    crc = crc32c(crc, &zero, sizeof(zero));
+    v->checksum = (int)crc32c(crc, (const char*)v + off + sizeof(zero), sizeof(*v) - off - sizeof(zero));
+}
+
+/**\fn static unsigned int compactCRC(const void *buf, int len)
+ * \brief CRC-32C of a compact datagram with the header crc taken as zero
+ */
+static unsigned int compactCRC(const void *buf, int len)
+{
+    const size_t off = offsetof(struct u_compact_header, crc);
+    const unsigned int zero = 0;
+    unsigned int crc = crc32c(0, buf, off);
+    crc = crc32c(crc, &zero, sizeof(zero));
+    return crc32c(crc, (const char*)buf + off + sizeof(zero), len - off - sizeof(zero));
+}
+
+/**\fn static short sat16(double v)
+ * \brief round and saturate to int16
+ */
+static short sat16(double v)
+{
+    if (v > 32767.0)
+        return 32767;
+    if (v < -32768.0)
+        return -32768;
+    return (short)lrint(v);
+}
+
+/**\fn static void decodeQuat(const struct u_compact_arm *a, double q[4])
+ * \brief rebuild x,y,z,w from the smallest three components
+ */
+static void decodeQuat(const struct u_compact_arm *a, double q[4])
+{
+    double sum = 0;
+    int k = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == a->qidx)
+            continue;
+        q[i] = a->q[k++] / TELEOP_QUAT_SCALE;
+        sum += q[i]*q[i];
+    }
+    q[a->qidx] = sum < 1.0 ? sqrt(1.0 - sum) : 0.0;
+}
+
+/**\fn int decodeTeleopPacket(const void *buf, int len, struct u_struct *out, int maxout)
+ * \brief Turn a received datagram into u_structs
+ * \param buf datagram
+ * \param len datagram length
+ * \param out filled with the decoded samples, oldest first
+ * \param maxout room in out
+ * \return number of samples decoded, TELEOP_BAD_PACKET or TELEOP_BAD_CRC
+ */
+int decodeTeleopPacket(const void *buf, int len, struct u_struct *out, int maxout)
+{
+    if (len == (int)sizeof(struct u_struct))
+    {
+        if (maxout < 1)
+            return TELEOP_BAD_PACKET;
+        memcpy(out, buf, sizeof(struct u_struct));
+
+        if (out->pactyp == TELEOP_PACTYP_CRC32C)
+        {
+            crc_checked++;
+            if ((unsigned int)out->checksum != teleopStructCRC(out))
+            {
+                crc_rejects++;
+                return TELEOP_BAD_CRC;
+            }
+        }
+        else if (require_crc)
+        {
+            crc_missing++;
+            return TELEOP_BAD_CRC;
+        }
+        return 1;
+    }
+
+    const struct u_compact_header *h = (const struct u_compact_header *)buf;
+    if (len < (int)sizeof(*h) || h->magic != TELEOP_COMPACT_MAGIC || h->version != TELEOP_COMPACT_VERSION)
+        return TELEOP_BAD_PACKET;
+    if (h->nsamples == 0 || h->nsamples > maxout || len != (int)TELEOP_COMPACT_LEN(h->nsamples))
+        return TELEOP_BAD_PACKET;
+
+    crc_checked++;
+    if (h->crc != compactCRC(buf, len))
+    {
+        crc_rejects++;
+        return TELEOP_BAD_CRC;
+    }
+
+    const struct u_compact_sample *s = (const struct u_compact_sample *)(h + 1);
+    for (int n = 0; n < h->nsamples; n++)
+    {
+        struct u_struct *u = &out[n];
+        memset(u, 0, sizeof(*u));
+        u->sequence = h->sequence + n;
+        u->pactyp = TELEOP_COMPACT_MAGIC;
+        u->version = TELEOP_COMPACT_VERSION;
+        u->surgeon_mode = h->surgeon_mode;
+
+        for (int i = 0; i < 2; i++)
+        {
+            const struct u_compact_arm *a = &s[n].arm[i];
+            double q[4];
+
+            u->delx[i] = a->del[0];
+            u->dely[i] = a->del[1];
+            u->delz[i] = a->del[2];
+            if (a->qidx > 3)
+                return TELEOP_BAD_PACKET;
+            decodeQuat(a, q);
+            u->Qx[i] = q[0];
+            u->Qy[i] = q[1];
+            u->Qz[i] = q[2];
+            u->Qw[i] = q[3];
+            u->grasp[i] = a->grasp;
+            u->buttonstate[i] = a->buttonstate;
+        }
+    }
+
+    return h->nsamples;
+}
+
+/**\fn int encodeTeleopCompact(const struct u_struct *in, int count, void *buf, int len)
+ * \brief Reference encoder for masters: pack consecutive samples into one compact datagram
+ * \param in samples, oldest first, with consecutive sequence numbers
+ * \param count number of samples (1..TELEOP_COMPACT_MAX_SAMPLES)
+ * \param buf output datagram
+ * \param len room in buf
+ * \return datagram length, -1 on bad arguments
+ */
+int encodeTeleopCompact(const struct u_struct *in, int count, void *buf, int len)
+{
+    if (count < 1 || count > TELEOP_COMPACT_MAX_SAMPLES || len < (int)TELEOP_COMPACT_LEN(count))
+        return -1;
+
+    struct u_compact_header *h = (struct u_compact_header *)buf;
+    h->magic = TELEOP_COMPACT_MAGIC;
+    h->version = TELEOP_COMPACT_VERSION;
+    h->nsamples = count;
+    h->surgeon_mode = in[count-1].surgeon_mode;
+    h->sequence = in[0].sequence;
+    h->crc = 0;
+
+    struct u_compact_sample *s = (struct u_compact_sample *)(h + 1);
+    for (int n = 0; n < count; n++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            struct u_compact_arm *a = &s[n].arm[i];
+            double q[4] = { in[n].Qx[i], in[n].Qy[i], in[n].Qz[i], in[n].Qw[i] };
+            int big = 0;
+
+            for (int k = 1; k < 4; k++)
+                if (fabs(q[k]) > fabs(q[big]))
+                    big = k;
+            double sign = q[big] < 0 ? -1.0 : 1.0;
+
+            a->del[0] = sat16(in[n].delx[i]);
+            a->del[1] = sat16(in[n].dely[i]);
+            a->del[2] = sat16(in[n].delz[i]);
+            a->qidx = big;
+            for (int k = 0, j = 0; k < 4; k++)
+                if (k != big)
+                    a->q[j++] = sat16(sign * q[k] * TELEOP_QUAT_SCALE);
+            a->grasp = sat16(in[n].grasp[i]);
+            a->buttonstate = in[n].buttonstate[i];
+        }
+    }
+
+    h->crc = compactCRC(buf, TELEOP_COMPACT_LEN(count));
+    return TELEOP_COMPACT_LEN(count);
+}
+
+/**\fn void outputTeleopProtocolStats()
+ * \brief print integrity check counters
+ */
+void outputTeleopProtocolStats()
+{
+    log_msg("Teleop CRC: %lu checked, %lu bad, %lu missing (rejected)", crc_checked, crc_rejects, crc_missing);
+}
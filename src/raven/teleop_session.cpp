@@ -0,0 +1,375 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file teleop_session.cpp
+ * \brief Teleop sessions: one per master (source address and port).
+ *
+ * teleopSessionInput() files each datagram's samples under its source.  A
+ * client that floods the socket only overflows its own input ring.  Once per
+ * network loop teleopSessionArbitrate() closes idle sessions, picks the owner
+ * and empties the other inputs; the owner's samples are then taken with
+ * teleopSessionDrain().  When ownership changes the reorder window is reset,
+ * since the new owner has its own sequence numbering.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <string>
+
+#include "teleop_session.h"
+#include "teleop_jitter.h"
+#include "spsc_ring.h"
+#include "log.h"
+#include "metrics.h"
+
+struct ts_input
+{
+	struct u_struct u;
+	struct timespec rx_stamp;
+};
+
+struct ts_rule
+{
+	struct in_addr addr;
+	unsigned short port;         // network order, 0: any
+	int priority;
+};
+
+struct teleop_session
+{
+	int open;
+	struct sockaddr_in addr;
+	int priority;
+	long long opened_ns;         // CLOCK_MONOTONIC
+	long long last_rx_ns;
+
+	// statistics
+	unsigned long packets, samples, shadowed;
+	unsigned long seq_gaps, seq_reordered;
+	unsigned int last_seq;
+	double rate_hz;              // smoothed sample rate
+
+	spsc_ring<struct ts_input, TS_INPUT_SIZE> input;
+};
+
+// configuration
+static int ts_policy = TS_ARB_PRIORITY;
+static long long ts_timeout_ns = 500000000LL;
+static struct ts_rule ts_rules[TS_MAX_RULES];
+static int ts_nrules = 0;
+
+static struct teleop_session ts_sessions[TS_MAX_SESSIONS];
+static int ts_owner = -1;
+static unsigned long ts_handovers = 0, ts_refused = 0;
+
+/**\fn static inline long long tsNs(const struct timespec *t)
+ * \brief convert a timespec to nanoseconds
+ */
+static inline long long tsNs(const struct timespec *t)
+{
+	return (long long)t->tv_sec * 1000000000LL + t->tv_nsec;
+}
+
+/**\fn static void parseRules(const std::string &spec)
+ * \brief parse /teleop_session_priority ("addr[:port]=prio,...")
+ */
+static void parseRules(const std::string &spec)
+{
+	char buf[512];
+	char *save = NULL;
+
+	strncpy(buf, spec.c_str(), sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	for (char *tok = strtok_r(buf, ", ", &save); tok && ts_nrules < TS_MAX_RULES; tok = strtok_r(NULL, ", ", &save))
+	{
+		struct ts_rule *r = &ts_rules[ts_nrules];
+		char *eq = strchr(tok, '=');
+		if (eq == NULL)
+		{
+			err_msg("teleop_session_priority: missing '=prio' in %s", tok);
+			continue;
+		}
+		*eq = '\0';
+		r->priority = atoi(eq+1);
+		char *colon = strchr(tok, ':');
+		r->port = 0;
+		if (colon)
+		{
+			*colon = '\0';
+			r->port = htons(atoi(colon+1));
+		}
+		if (inet_aton(tok, &r->addr) == 0)
+		{
+			err_msg("teleop_session_priority: bad address %s", tok);
+			continue;
+		}
+		ts_nrules++;
+	}
+}
+
+/**\fn int init_teleop_sessions(ros::NodeHandle &n)
+ * \brief read the session parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_teleop_sessions(ros::NodeHandle &n)
+{
+	std::string policy, rules;
+	int timeout_ms;
+
+	n.param<std::string>("/teleop_arbitration", policy, "priority");
+	n.param<std::string>("/teleop_session_priority", rules, "");
+	n.param("/teleop_session_timeout_ms", timeout_ms, 500);
+
+	if (policy == "first")
+		ts_policy = TS_ARB_FIRST;
+	else if (policy == "priority")
+		ts_policy = TS_ARB_PRIORITY;
+	else
+		err_msg("Unknown teleop_arbitration '%s', using priority", policy.c_str());
+	if (timeout_ms <= 0)
+		timeout_ms = 500;
+	ts_timeout_ns = (long long)timeout_ms * 1000000LL;
+	parseRules(rules);
+
+	log_msg("Teleop sessions: %s arbitration, %d priority rules, %d ms timeout",
+			ts_policy == TS_ARB_FIRST ? "first" : "priority", ts_nrules, timeout_ms);
+	return 0;
+}
+
+/**\fn static int sessionPriority(const struct sockaddr_in *from)
+ * \brief priority of a source, from the first matching rule
+ */
+static int sessionPriority(const struct sockaddr_in *from)
+{
+	for (int i = 0; i < ts_nrules; i++)
+		if (ts_rules[i].addr.s_addr == from->sin_addr.s_addr &&
+			(ts_rules[i].port == 0 || ts_rules[i].port == from->sin_port))
+			return ts_rules[i].priority;
+	return 0;
+}
+
+/**\fn static int findSession(const struct sockaddr_in *from, long long now)
+ * \brief look up the session for a source, opening one if there is room
+ * \return session index, or -1 if the table is full
+ */
+static int findSession(const struct sockaddr_in *from, long long now)
+{
+	int idle = -1;
+
+	for (int i = 0; i < TS_MAX_SESSIONS; i++)
+	{
+		struct teleop_session *s = &ts_sessions[i];
+		if (!s->open)
+		{
+			if (idle < 0)
+				idle = i;
+			continue;
+		}
+		if (s->addr.sin_addr.s_addr == from->sin_addr.s_addr && s->addr.sin_port == from->sin_port)
+			return i;
+	}
+	if (idle < 0)
+		return -1;
+
+	struct teleop_session *s = &ts_sessions[idle];
+	while (s->input.size() > 0)
+	{
+		struct ts_input in;
+		s->input.pop(in);
+	}
+	s->addr = *from;
+	s->priority = sessionPriority(from);
+	s->opened_ns = now;
+	s->last_rx_ns = now;
+	s->packets = s->samples = s->shadowed = 0;
+	s->seq_gaps = s->seq_reordered = 0;
+	s->last_seq = 0;
+	s->rate_hz = 0;
+	__sync_synchronize();
+	s->open = 1;
+	log_msg("Teleop session %d opened: %s:%d priority %d", idle,
+			inet_ntoa(from->sin_addr), ntohs(from->sin_port), s->priority);
+	return idle;
+}
+
+/**\fn int teleopSessionInput(const struct sockaddr_in *from, const struct u_struct *samples, int count, const struct timespec *rx_stamp, const struct timespec *now)
+ * \brief file one datagram's samples under the session of its source
+ * \param from source address
+ * \param samples the decoded samples
+ * \param count number of samples
+ * \param rx_stamp receive time of the datagram
+ * \param now current CLOCK_MONOTONIC time
+ * \return session index, or -1 if the datagram was refused (session table full)
+ */
+int teleopSessionInput(const struct sockaddr_in *from, const struct u_struct *samples, int count,
+					   const struct timespec *rx_stamp, const struct timespec *now)
+{
+	long long tnow = tsNs(now);
+	int id = findSession(from, tnow);
+	if (id < 0)
+	{
+		ts_refused++;
+		return -1;
+	}
+
+	struct teleop_session *s = &ts_sessions[id];
+	if (s->packets > 0 && tnow > s->last_rx_ns)
+	{
+		double inst = count * 1e9 / (tnow - s->last_rx_ns);
+		s->rate_hz += 0.05 * (inst - s->rate_hz);
+	}
+	s->last_rx_ns = tnow;
+	s->packets++;
+	metricInc(MC_TELEOP_PACKETS);
+
+	for (int i = 0; i < count; i++)
+	{
+		struct ts_input in;
+		unsigned int seq = samples[i].sequence;
+
+		if (s->samples > 0)
+		{
+			if ((int)(seq - s->last_seq) > 1)
+			{
+				s->seq_gaps++;
+				metricAdd(MC_TELEOP_LOST, seq - s->last_seq - 1);
+			}
+			else if ((int)(seq - s->last_seq) <= 0)
+				s->seq_reordered++;
+		}
+		if (s->samples == 0 || (int)(seq - s->last_seq) > 0)
+			s->last_seq = seq;
+		s->samples++;
+
+		in.u = samples[i];
+		in.rx_stamp = *rx_stamp;
+		s->input.push(in);        // full: counted by the ring
+	}
+	return id;
+}
+
+/**\fn static int better(int a, int b)
+ * \brief whether session a should own the robot instead of session b
+ */
+static int better(int a, int b)
+{
+	if (b < 0)
+		return 1;
+	if (ts_policy == TS_ARB_PRIORITY && ts_sessions[a].priority != ts_sessions[b].priority)
+		return ts_sessions[a].priority > ts_sessions[b].priority;
+	return ts_sessions[a].opened_ns < ts_sessions[b].opened_ns;
+}
+
+/**\fn int teleopSessionArbitrate(const struct timespec *now)
+ * \brief close idle sessions, choose the owner and discard the others' input
+ * \param now current CLOCK_MONOTONIC time
+ * \return owning session index, or -1 if there is none
+ */
+int teleopSessionArbitrate(const struct timespec *now)
+{
+	long long tnow = tsNs(now);
+	int owner = -1;
+
+	for (int i = 0; i < TS_MAX_SESSIONS; i++)
+	{
+		struct teleop_session *s = &ts_sessions[i];
+		if (!s->open)
+			continue;
+		if (tnow - s->last_rx_ns > ts_timeout_ns)
+		{
+			log_msg("Teleop session %d closed: %s:%d quiet for %lld ms (%lu packets)", i,
+					inet_ntoa(s->addr.sin_addr), ntohs(s->addr.sin_port),
+					(tnow - s->last_rx_ns) / 1000000LL, s->packets);
+			s->open = 0;
+			continue;
+		}
+		if (better(i, owner))
+			owner = i;
+	}
+
+	// "first": the current owner keeps the robot while it is live
+	if (ts_policy == TS_ARB_FIRST && ts_owner >= 0 && ts_sessions[ts_owner].open)
+		owner = ts_owner;
+
+	if (owner != ts_owner)
+	{
+		if (owner >= 0)
+			log_msg("Teleop session %d (%s:%d) now owns the robot", owner,
+					inet_ntoa(ts_sessions[owner].addr.sin_addr), ntohs(ts_sessions[owner].addr.sin_port));
+		teleopJitterReset();
+		ts_owner = owner;
+		ts_handovers++;
+	}
+
+	for (int i = 0; i < TS_MAX_SESSIONS; i++)
+	{
+		struct teleop_session *s = &ts_sessions[i];
+		struct ts_input in;
+		if (i == owner)
+			continue;
+		while (s->input.pop(in))
+			s->shadowed++;
+	}
+	return owner;
+}
+
+/**\fn int teleopSessionDrain(int id, struct u_struct *out, struct timespec *rx_stamps, int maxout)
+ * \brief take the queued samples of a session, oldest first
+ * \param id session index
+ * \param out filled with samples
+ * \param rx_stamps filled with their receive times
+ * \param maxout room in out / rx_stamps
+ * \return number of samples
+ */
+int teleopSessionDrain(int id, struct u_struct *out, struct timespec *rx_stamps, int maxout)
+{
+	struct ts_input in;
+	int n = 0;
+
+	if (id < 0 || id >= TS_MAX_SESSIONS)
+		return 0;
+	while (n < maxout && ts_sessions[id].input.pop(in))
+	{
+		out[n] = in.u;
+		rx_stamps[n] = in.rx_stamp;
+		n++;
+	}
+	return n;
+}
+
+/**\fn void outputTeleopSessionStats()
+ * \brief print per-session counters
+ */
+void outputTeleopSessionStats()
+{
+	log_msg("Teleop sessions: owner %d, %lu handovers, %lu packets refused", ts_owner, ts_handovers, ts_refused);
+	for (int i = 0; i < TS_MAX_SESSIONS; i++)
+	{
+		struct teleop_session *s = &ts_sessions[i];
+		if (!s->open)
+			continue;
+		log_msg("  [%d] %s:%d prio %d: %lu packets, %lu samples at %.0f Hz, %lu gaps, %lu reordered, %lu shadowed, %u overflowed",
+				i, inet_ntoa(s->addr.sin_addr), ntohs(s->addr.sin_port), s->priority,
+				s->packets, s->samples, s->rate_hz, s->seq_gaps, s->seq_reordered,
+				s->shadowed, s->input.droppedCount());
+	}
+}
@@ -0,0 +1,222 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file tracepoint.cpp
+ * \brief Named begin/end spans around the stages of the control loop.
+ *
+ * The marker lines are formatted once at startup, so an enabled marker
+ * tracepoint is a single write() of a constant string.  Ring entries are
+ * claimed with an atomic add and never block; the oldest are overwritten.
+ * Ring stamps are CLOCK_MONOTONIC: record the kernel side with
+ * "trace-cmd record -C mono" to line the two up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+
+#include "tracepoint.h"
+#include "parallel.h"
+#include "rt_memory.h"
+#include "log.h"
+
+extern unsigned long int gTime;
+
+unsigned int trace_backends = 0;
+
+static const char *span_names[TS_NUM_SPANS] = {
+	"usb_initiate",
+	"sleep",
+	"usb_wait",
+	"state_machine",
+	"device_state",
+	"control",
+	"cartesian",
+	"overdrive",
+	"usb_put",
+	"publish",
+	"record",
+};
+
+// trace_marker: "raven B <span>\n" / "raven E <span>\n", preformatted
+#define TRACE_MARKER_LEN 32
+static int marker_fd = -1;
+static char marker_lines[TS_NUM_SPANS][2][TRACE_MARKER_LEN];
+static int marker_lens[TS_NUM_SPANS][2];
+
+struct trace_entry {
+	u_64 ns;
+	u_32 cycle;
+	u_16 span;
+	u_16 begin;
+};
+
+static struct trace_entry *ring = NULL;
+static u_64 ring_mask = 0;
+static u_64 ring_head = 0;
+static std::string ring_file;
+
+/**\fn void traceEmit(int span, int begin)
+ * \brief mark the start or end of a span on every enabled backend
+ * \param span  a trace_span
+ * \param begin 1 at the start of the span, 0 at its end
+ */
+void traceEmit(int span, int begin)
+{
+	unsigned int b = trace_backends;
+
+	// D7 high inside a span, the low bits name it
+	if (b & TRACE_PARPORT)
+		parport_out((unsigned char)((begin ? 0x80 : 0x00) | span));
+
+	if ((b & TRACE_MARKER) && marker_fd >= 0)
+		write(marker_fd, marker_lines[span][begin], marker_lens[span][begin]);
+
+	if (b & TRACE_RING)
+	{
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		u_64 i = __sync_fetch_and_add(&ring_head, 1) & ring_mask;
+		ring[i].ns = (u_64)t.tv_sec * 1000000000ULL + t.tv_nsec;
+		ring[i].cycle = (u_32)gTime;
+		ring[i].span = (u_16)span;
+		ring[i].begin = (u_16)begin;
+	}
+}
+
+/**\fn static int openMarker()
+ * \brief open the ftrace trace_marker, wherever tracefs is mounted
+ */
+static int openMarker()
+{
+	static const char *paths[] = {
+		"/sys/kernel/tracing/trace_marker",
+		"/sys/kernel/debug/tracing/trace_marker",
+	};
+	for (unsigned i = 0; i < sizeof(paths)/sizeof(paths[0]); i++)
+	{
+		int fd = open(paths[i], O_WRONLY);
+		if (fd >= 0)
+		{
+			log_msg("Tracepoints: writing to %s", paths[i]);
+			return fd;
+		}
+	}
+	err_msg("Tracepoints: cannot open trace_marker (%s); marker backend off", strerror(errno));
+	return -1;
+}
+
+/**\fn int init_tracepoints(ros::NodeHandle &n)
+ * \brief read the tracepoint parameters and set up the enabled backends
+ * \param n the node handle
+ * \return 0, or -1 if the ring could not be allocated
+ */
+int init_tracepoints(ros::NodeHandle &n)
+{
+	std::string spec;
+	int entries;
+	char buf[128];
+	char *save = NULL;
+	unsigned int backends = 0;
+
+	n.param<std::string>("/trace_backends", spec, "");
+	n.param("/trace_ring_entries", entries, 65536);
+	n.param<std::string>("/trace_ring_file", ring_file, "raven_trace.txt");
+
+	strncpy(buf, spec.c_str(), sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	for (char *tok = strtok_r(buf, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save))
+	{
+		if (strcmp(tok, "parport") == 0)
+			backends |= TRACE_PARPORT;
+		else if (strcmp(tok, "marker") == 0)
+			backends |= TRACE_MARKER;
+		else if (strcmp(tok, "ring") == 0)
+			backends |= TRACE_RING;
+		else
+			err_msg("trace_backends: unknown backend %s", tok);
+	}
+
+	if (backends & TRACE_MARKER)
+	{
+		for (int s = 0; s < TS_NUM_SPANS; s++)
+			for (int b = 0; b < 2; b++)
+				marker_lens[s][b] = snprintf(marker_lines[s][b], TRACE_MARKER_LEN, "raven %c %s\n", b ? 'B' : 'E', span_names[s]);
+		marker_fd = openMarker();
+		if (marker_fd < 0)
+			backends &= ~TRACE_MARKER;
+	}
+
+	if (backends & TRACE_RING)
+	{
+		u_64 size = 1;
+		while (size < (u_64)entries && size < (1ULL << 24))
+			size <<= 1;
+		ring = (struct trace_entry *)calloc(size, sizeof(struct trace_entry));
+		if (ring == NULL)
+		{
+			err_msg("Tracepoints: cannot allocate a %llu entry ring", size);
+			return -1;
+		}
+		rt_prefault(ring, size * sizeof(struct trace_entry));
+		ring_mask = size - 1;
+	}
+
+	if (backends == 0)
+		log_msg("Tracepoints: off");
+	else
+		log_msg("Tracepoints:%s%s%s", (backends & TRACE_PARPORT) ? " parport" : "",
+		        (backends & TRACE_MARKER) ? " marker" : "", (backends & TRACE_RING) ? " ring" : "");
+	trace_backends = backends;
+	return 0;
+}
+
+/**\fn void traceRingDump(void)
+ * \brief write the ring to /trace_ring_file, oldest entry first.  After the RT thread has stopped.
+ */
+void traceRingDump(void)
+{
+	if (ring == NULL)
+		return;
+
+	FILE *f = fopen(ring_file.c_str(), "w");
+	if (f == NULL)
+	{
+		err_msg("Tracepoints: cannot write %s (%s)", ring_file.c_str(), strerror(errno));
+		return;
+	}
+
+	u_64 head = ring_head;
+	u_64 first = (head > ring_mask + 1) ? head - (ring_mask + 1) : 0;
+	fprintf(f, "# monotonic_ns cycle B|E span\n");
+	for (u_64 i = first; i < head; i++)
+	{
+		const struct trace_entry *e = &ring[i & ring_mask];
+		fprintf(f, "%llu %u %c %s\n", e->ns, e->cycle, e->begin ? 'B' : 'E',
+		        e->span < TS_NUM_SPANS ? span_names[e->span] : "?");
+	}
+	fclose(f);
+	log_msg("Tracepoints: %llu spans written to %s", head - first, ring_file.c_str());
+}
@@ -24,8 +24,18 @@
 *    \ingroup Control
 *    Generate joint and cartesian trajectories.
 *    Internal data structures track trajectory state, and update DOFs as needed upon calling.
+*
+*    Every trajectory is a profile of at most TRAJ_MAX_SEGS polynomial
+*    segments, built once when it starts and timed in control loop ticks
+*    (gTime) from then on.  A cycle's update is a segment lookup (the last
+*    segment used, or the next) and one quintic, so it costs the same for
+*    every shape and gives the same setpoints on every run of a replay.
+*    The sinusoids are sampled into quintic Hermite segments, TRAJ_SEGS_PER_CYCLE
+*    per period, exact in value, slope and curvature at the knots; the
+*    minimum-jerk, trapezoidal and spline profiles are polynomials already.
 */
 
+#include <math.h>
 #include <ros/ros.h>
 
 #include "trajectory.h"
@@ -34,29 +44,306 @@
 #include "defines.h"
 
 extern unsigned long int gTime;
+extern int NUM_MECH;
+
+#define TRAJ_MAX_SEGS        32
+#define TRAJ_SEGS_PER_CYCLE  16             // Hermite segments per sinusoid period
+#define TRAJ_FOREVER         0x7fffffffUL   // ticks: a profile that does not end
+
+/// value = c[0] + c[1] s + ... + c[5] s^5, s = 0..1 over the segment
+struct traj_segment
+{
+    unsigned long t0;       // ticks from the start of the profile
+    float inv_len;          // 1 / length in ticks
+    float c[6];
+};
+
+// What the profile drives
+enum traj_output { TRAJ_OUT_JPOS, TRAJ_OUT_JVEL, TRAJ_OUT_JPOS_RATE };
+
+/// piecewise polynomial, see above
+struct traj_profile
+{
+    int n;                  // segments
+    unsigned long end;      // ticks; past it the profile holds its end value or loops
+    unsigned long loop;     // nonzero: past end, start over at end - loop
+    int output;             // traj_output
+    int hold;               // past the end, keep writing the end value
+    int cur;                // segment of the last evaluation
+    struct traj_segment seg[TRAJ_MAX_SEGS];
+};
+
+// Shapes, one per update_*() and start*Trajectory()
+enum traj_shape {
+    TRAJ_NONE = 0,
+    TRAJ_SIN_VEL,
+    TRAJ_LIN_SIN_VEL,
+    TRAJ_SIN_POS,
+    TRAJ_LIN_SIN_POS,
+    TRAJ_POS,
+    TRAJ_MIN_JERK,
+    TRAJ_TRAPEZOID,
+    TRAJ_SPLINE
+};
 
 // Store trajectory parameters
 /**  \brief A struct to hold trajectory parameters
  *
  *
- *     \var startTime       must be in ROS's ros::Time format
+ *     \var start_tick      gTime when the trajectory started
  *     \var end_pos         Final position (units are context dependent)
  *     \var magnitude       Amplitude of a sinusoidal trajectory
  *     \var period          Period of sinusoid (seconds)
  *     \var startPos        Starting position
  *     \var startVel        Initial velocity
+ *     \var shape           traj_shape the profile was built for, TRAJ_NONE if none yet
+ *     \var profile         the trajectory in ticks from start_tick
  */
 struct _trajectory
 {
-    ros::Time startTime;
+    unsigned long start_tick;
     float end_pos;
     float magnitude;
     float period;
     float startPos;
     float startVel;
+    int shape;
+    struct traj_profile profile;
 };
 struct _trajectory trajectory[MAX_MECH*MAX_DOF_PER_MECH];
 
+/**
+*  \brief seconds to ticks, at least one, at most TRAJ_FOREVER
+*/
+static unsigned long trajTicks(double sec)
+{
+    double t = floor(sec / STEP_PERIOD + 0.5);
+    if (t < 1)
+        return 1;
+    if (t > TRAJ_FOREVER)
+        return TRAJ_FOREVER;
+    return (unsigned long)t;
+}
+
+static void trajClear(struct traj_profile *p, int output, int hold)
+{
+    p->n = 0;
+    p->end = 0;
+    p->loop = 0;
+    p->output = output;
+    p->hold = hold;
+    p->cur = 0;
+}
+
+/**
+*  \brief append the quintic between two states, t0 to t1 ticks into the profile
+*
+*  p, v, a are value, rate and its rate, in seconds.  A polynomial of degree
+*  five or less given its own end states comes out exactly.
+*
+*  \return 0, or -1 if the profile is full
+*/
+static int trajHermite(struct traj_profile *p, unsigned long t0, unsigned long t1,
+                       double p0, double v0, double a0, double p1, double v1, double a1)
+{
+    if (p->n >= TRAJ_MAX_SEGS || t1 <= t0)
+        return -1;
+
+    double h = (t1 - t0) * (double)STEP_PERIOD;
+    double d = p1 - p0;
+    v0 *= h;    v1 *= h;
+    a0 *= h*h;  a1 *= h*h;
+
+    struct traj_segment *s = &p->seg[p->n++];
+    s->t0 = t0;
+    s->inv_len = 1.0 / (t1 - t0);
+    s->c[0] = p0;
+    s->c[1] = v0;
+    s->c[2] = a0 / 2;
+    s->c[3] =  10*d - 6*v0 - 4*v1 - (3*a0 -   a1) / 2;
+    s->c[4] = -15*d + 8*v0 + 7*v1 + (3*a0 - 2*a1) / 2;
+    s->c[5] =   6*d - 3*v0 - 3*v1 - (  a0 -   a1) / 2;
+    p->end = t1;
+    return 0;
+}
+
+/**
+*  \brief append k0 + kc cos(w t) + ks sin(w t), t in seconds from the start of the profile, over ticks t0 to t1
+*/
+static int trajSinusoid(struct traj_profile *p, unsigned long t0, unsigned long t1,
+                        double k0, double kc, double ks, double w)
+{
+    int n = 1;
+    if (w > 0)
+        n = (int)ceil((t1 - t0) * (double)STEP_PERIOD * w / (2*M_PI) * TRAJ_SEGS_PER_CYCLE);
+    if (n < 1)
+        n = 1;
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned long ta = t0 + (t1 - t0) * i / n, tb = t0 + (t1 - t0) * (i+1) / n;
+        double x[2] = { ta * (double)STEP_PERIOD, tb * (double)STEP_PERIOD };
+        double f[2], df[2], ddf[2];
+        for (int k = 0; k < 2; k++)
+        {
+            double c = cos(w * x[k]), s = sin(w * x[k]);
+            f[k]   = k0 + kc*c + ks*s;
+            df[k]  = w * (-kc*s + ks*c);
+            ddf[k] = -w*w * (kc*c + ks*s);
+        }
+        if (tb > ta && trajHermite(p, ta, tb, f[0], df[0], ddf[0], f[1], df[1], ddf[1]) < 0)
+            return -1;
+    }
+    p->end = t1;
+    return 0;
+}
+
+/**
+*  \brief the profile's value at a tick, and whether it is still running
+*  \return 1 while running (or for good, if it loops), 0 past its end; *out is then the end value
+*/
+static inline int trajEval(struct _trajectory *traj, unsigned long tick, float *out)
+{
+    struct traj_profile *p = &traj->profile;
+    unsigned long t = tick - traj->start_tick;
+    int running = 1;
+
+    if (p->n == 0)
+    {
+        *out = 0;
+        return 0;
+    }
+    if (t >= p->end)
+    {
+        if (p->loop)
+            t = p->end - p->loop + (t - p->end) % p->loop;
+        else
+        {
+            t = p->end;
+            running = 0;
+        }
+    }
+
+    int s = p->cur;
+    if (s >= p->n || p->seg[s].t0 > t)
+        s = 0;
+    while (s + 1 < p->n && p->seg[s+1].t0 <= t)
+        s++;
+    p->cur = s;
+
+    const struct traj_segment *g = &p->seg[s];
+    float x = (t - g->t0) * g->inv_len;
+    *out = g->c[0] + x*(g->c[1] + x*(g->c[2] + x*(g->c[3] + x*(g->c[4] + x*g->c[5]))));
+    return running;
+}
+
+/**
+*  \brief write a profile's value to the joint
+*/
+static inline void trajApply(struct DOF *_joint, int output, float v)
+{
+    switch (output)
+    {
+    case TRAJ_OUT_JPOS:
+        _joint->jpos_d = v;
+        break;
+    case TRAJ_OUT_JVEL:
+        _joint->jvel_d = v;
+        break;
+    case TRAJ_OUT_JPOS_RATE:
+        _joint->jpos_d += STEP_PERIOD * v;
+        break;
+    }
+}
+
+/**
+*  \brief build the profile of one of the update_*() shapes from the start_trajectory() parameters
+*/
+static void trajBuild(struct _trajectory *traj, int type, int shape)
+{
+    struct traj_profile *p = &traj->profile;
+    double A = traj->magnitude, T = traj->period;
+
+    traj->shape = shape;
+    switch (shape)
+    {
+    case TRAJ_SIN_VEL:
+    {
+        // Shoulder of mechanism 0 only: -15 deg/s sin(2 pi t / f_period), f_period = 2000
+        const double maxspeed = 15 DEG2RAD, f_period = 2000;
+        trajClear(p, TRAJ_OUT_JVEL, 1);
+        if (type == JOINT_TYPE(0, SHOULDER))
+        {
+            trajSinusoid(p, 0, trajTicks(f_period), 0, 0, -maxspeed, 2*M_PI / f_period);
+            p->loop = p->end;
+        }
+        else
+            trajHermite(p, 0, 1, 0, 0, 0, 0, 0, 0);
+        break;
+    }
+    case TRAJ_LIN_SIN_VEL:
+    {
+        // Mechanism 0 first three joints: maxspeed (1 - cos(2 pi t / f_period)) over the first half period
+        const float maxspeed[8] = {-4 DEG2RAD, 4 DEG2RAD, 0.02, 15 DEG2RAD};
+        const double f_period = 2;
+        double k = (MECH_OF_TYPE(type) == 0 && JOINT_OF_TYPE(type) <= Z_INS) ? maxspeed[type] : 0;
+        trajClear(p, TRAJ_OUT_JVEL, 0);
+        trajSinusoid(p, 0, trajTicks(f_period/2), k, -k, 0, 2*M_PI / f_period);
+        break;
+    }
+    case TRAJ_SIN_POS:
+        // Rising half of a sinusoid at twice the frequency, then -A sin(2 pi t / T) for good
+        trajClear(p, TRAJ_OUT_JPOS, 1);
+        trajSinusoid(p, 0, trajTicks(T/4), traj->startPos - A/2, A/2, 0, 4*M_PI / T);
+        trajSinusoid(p, p->end, p->end + trajTicks(T), traj->startPos, 0, -A, 2*M_PI / T);
+        p->loop = trajTicks(T);
+        break;
+    case TRAJ_LIN_SIN_POS:
+        // jpos_d rate A (1 - cos(2 pi t / T)) over the first half period, then A for good
+        trajClear(p, TRAJ_OUT_JPOS_RATE, 1);
+        trajSinusoid(p, 0, trajTicks(T/2), A, -A, 0, 2*M_PI / T);
+        trajHermite(p, p->end, TRAJ_FOREVER, A, 0, 0, A, 0, 0);
+        break;
+    case TRAJ_POS:
+        // A/2 (1 - cos(pi t / T)) from startPos, over one period
+        trajClear(p, TRAJ_OUT_JPOS, 0);
+        trajSinusoid(p, 0, trajTicks(T), traj->startPos + A/2, -A/2, 0, M_PI / T);
+        break;
+    }
+}
+
+/**
+*  \brief evaluate one joint's profile, of the given update_*() shape, and write it
+*  \return trajEval()'s
+*/
+static int trajUpdate(struct DOF *_joint, int shape)
+{
+    struct _trajectory *traj = &trajectory[_joint->type];
+    float v;
+
+    if (traj->shape != shape)
+        trajBuild(traj, _joint->type, shape);
+    int running = trajEval(traj, gTime, &v);
+    if (running || traj->profile.hold)
+        trajApply(_joint, traj->profile.output, v);
+    return running;
+}
+
+/**
+*  \brief restart a joint's trajectory from its current state
+*/
+static void trajStart(struct DOF *_joint)
+{
+    struct _trajectory *traj = &trajectory[_joint->type];
+
+    traj->start_tick = gTime;
+    traj->startPos = _joint->jpos;
+    traj->startVel = _joint->jvel;
+    traj->shape = TRAJ_NONE;
+    traj->profile.n = 0;
+    _joint->jpos_d = _joint->jpos;
+    _joint->jvel_d = _joint->jvel;
+}
 
 /**
 *    initialize trajectory parameters. Magnitude is set according to difference between _endPos and current joint position.
@@ -72,23 +359,22 @@ struct _trajectory trajectory[MAX_MECH*MAX_DOF_PER_MECH];
 *
 *
 *Then each trajectory is updated at each control cycle  in one of 5 ways;
-*   -# Sinusoidal Velocity    SHOULDER_GOLD only (update_sinusoid_velocity_trajectory())
+*   -# Sinusoidal Velocity    shoulder of mechanism 0 only (update_sinusoid_velocity_trajectory())
 *   -# Sinusoidal Velocity    GOLD arm 1st three joints only (update_linear_sinusoid_velocity_trajectory())
 *   -# Sinusoidal Position    All joints (update_sinusoid_position_trajectory())
 *   -# Single 1/2 cycle           All joints (update_linear_sinusoid_position_trajectory())
 *   -# Single full cycle      All joints (update_position_trajectory())
 *
-* \todo The trajectory generator seems to have a lot of hacks and special cases.  Need more general refactoring.  Also consider polynomial trajectories.
+*  The first update builds the profile for that shape.  trajectoryStep()
+*  then updates every started joint at once.
+*
+*  startMinJerkTrajectory(), startTrapezoidTrajectory() and
+*  startSplineTrajectory() build their profile on the spot.
 *
 */
 int start_trajectory(struct DOF* _joint, float _endPos, float _period)
 {
-    trajectory[_joint->type].startTime = trajectory[_joint->type].startTime.now();
-    trajectory[_joint->type].startPos = _joint->jpos;
-    trajectory[_joint->type].startVel = _joint->jvel;
-    _joint->jpos_d = _joint->jpos;
-    _joint->jvel_d = _joint->jvel;
-
+    trajStart(_joint);
     trajectory[_joint->type].magnitude = _endPos - _joint->jpos;
     trajectory[_joint->type].period = _period;
 //    log_msg("starting trajectory on joint %d to magnitude: %0.3f (%0.3f - %0.3f), period:%0.3f",
@@ -106,12 +392,7 @@ int start_trajectory(struct DOF* _joint, float _endPos, float _period)
 */
 int start_trajectory_mag(struct DOF* _joint, float _mag, float _period)
 {
-    trajectory[_joint->type].startTime = trajectory[_joint->type].startTime.now();
-    trajectory[_joint->type].startPos = _joint->jpos;
-    trajectory[_joint->type].startVel = _joint->jvel;
-    _joint->jpos_d = _joint->jpos;
-    _joint->jvel_d = _joint->jvel;
-
+    trajStart(_joint);
     trajectory[_joint->type].magnitude = _mag;
     trajectory[_joint->type].period = _period;
     return 0;
@@ -127,10 +408,8 @@ int start_trajectory_mag(struct DOF* _joint, float _mag, float _period)
 */
 int stop_trajectory(struct DOF* _joint)
 {
-    trajectory[_joint->type].startTime = trajectory[_joint->type].startTime.now();
-    trajectory[_joint->type].startPos = _joint->jpos;
+    trajStart(_joint);
     trajectory[_joint->type].startVel = 0;
-    _joint->jpos_d = _joint->jpos;
     _joint->jvel_d = 0;
     _joint->tau_d = 0;
     _joint->current_cmd = 0;
@@ -139,31 +418,173 @@ int stop_trajectory(struct DOF* _joint)
 }
 
 /**
-*  update_sinusoid_trajectory()
-*        find next trajectory waypoint
-*        Sinusoid trajectory
+*  startMinJerkTrajectory()
+*     rest to rest from the current position to _endPos in _duration seconds
+*     along the minimum-jerk quintic.  Held at _endPos afterwards.
 *
-* \todo This seems to only work for a single joint of the GOLD arm???
+*  \return 0, or -1 for a duration under one tick
 */
-int update_sinusoid_velocity_trajectory(struct DOF* _joint)
+int startMinJerkTrajectory(struct DOF* _joint, float _endPos, float _duration)
 {
-    const float maxspeed = 15 DEG2RAD;
-    const float f_period = 2000;         // 2 sec
+    struct _trajectory *traj = &trajectory[_joint->type];
+
+    if (!(_duration >= STEP_PERIOD))
+        return -1;
+    trajStart(_joint);
+    traj->end_pos = _endPos;
+    traj->shape = TRAJ_MIN_JERK;
+    trajClear(&traj->profile, TRAJ_OUT_JPOS, 1);
+    trajHermite(&traj->profile, 0, trajTicks(_duration), _joint->jpos, 0, 0, _endPos, 0, 0);
+    return 0;
+}
 
-    ros::Duration t = ros::Time::now() - trajectory[_joint->type].startTime;
+/**
+*  startTrapezoidTrajectory()
+*     rest to rest from the current position to _endPos: constant
+*     acceleration, cruise, constant deceleration, within _vmax and _amax
+*     (a triangle if the move is too short to reach _vmax).  Each phase is
+*     a whole number of ticks, so the peak velocity and acceleration come
+*     out at or a little under the limits.  Held at _endPos afterwards.
+*
+*  \return 0, or -1 for limits that are not positive
+*/
+int startTrapezoidTrajectory(struct DOF* _joint, float _endPos, float _vmax, float _amax)
+{
+    struct _trajectory *traj = &trajectory[_joint->type];
+    double p0 = _joint->jpos, D = fabs(_endPos - p0), sgn = (_endPos >= p0) ? 1 : -1;
+
+    if (!(_vmax > 0 && _amax > 0))
+        return -1;
+    trajStart(_joint);
+    traj->end_pos = _endPos;
+    traj->shape = TRAJ_TRAPEZOID;
+    struct traj_profile *p = &traj->profile;
+    trajClear(p, TRAJ_OUT_JPOS, 1);
+
+    double ta = _vmax / _amax, tc;
+    if (_amax * ta * ta > D)
+    {
+        ta = sqrt(D / _amax);
+        tc = 0;
+    }
+    else
+        tc = (D - _amax * ta * ta) / _vmax;
+
+    // whole ticks, rounded up, then the velocity and acceleration that cover D exactly
+    unsigned long na = (unsigned long)ceil(ta / STEP_PERIOD - 1e-9), nc = (unsigned long)ceil(tc / STEP_PERIOD - 1e-9);
+    if (na < 1)
+        na = 1;
+    double Ta = na * (double)STEP_PERIOD, Tc = nc * (double)STEP_PERIOD;
+    double v = sgn * D / (Ta + Tc), a = v / Ta;
+
+    double p1 = p0 + 0.5 * v * Ta, p2 = p1 + v * Tc;
+    trajHermite(p, 0, na, p0, 0, a, p1, v, a);
+    if (nc > 0)
+        trajHermite(p, na, na + nc, p1, v, 0, p2, v, 0);
+    trajHermite(p, na + nc, 2*na + nc, p2, v, -a, _endPos, 0, -a);
+    return 0;
+}
 
-   if (_joint->type      == SHOULDER_GOLD)
-        _joint->jvel_d = -1 * maxspeed * sin( 2*M_PI * (1/f_period) * t.toSec());
+/**
+*  startSplineTrajectory()
+*     C2 cubic spline from the current position through _n waypoints,
+*     _pos[i] at _t[i] seconds from now, starting and ending at rest.  Held
+*     at the last waypoint afterwards.
+*
+*  \return 0, or -1 for too many waypoints or times that do not increase by at least a tick
+*/
+int startSplineTrajectory(struct DOF* _joint, int _n, const float *_t, const float *_pos)
+{
+    struct _trajectory *traj = &trajectory[_joint->type];
+    double x[TRAJ_MAX_SEGS + 1], y[TRAJ_MAX_SEGS + 1], d[TRAJ_MAX_SEGS + 1];
+    unsigned long tk[TRAJ_MAX_SEGS + 1];
+    int n = _n + 1;         // knots, with the current position
+
+    if (_n < 1 || _n > TRAJ_MAX_SEGS)
+        return -1;
+    tk[0] = 0;
+    x[0] = 0;
+    y[0] = _joint->jpos;
+    for (int i = 1; i < n; i++)
+    {
+        tk[i] = trajTicks(_t[i-1]);
+        if (tk[i] <= tk[i-1])
+            return -1;
+        x[i] = tk[i] * (double)STEP_PERIOD;
+        y[i] = _pos[i-1];
+    }
 
-//    else if (_joint->type == ELBOW_GOLD)
-//        _joint->jvel_d =  maxspeed * sin( 2*M_PI * (1/f_period) * t);
-//
-//    else if (_joint->type == Z_INS_GOLD)
-//        _joint->jvel_d =  0.2 * sin( 2*M_PI * (1/f_period) * t);
+    // Slopes: h[i] d[i-1] + 2 (h[i-1] + h[i]) d[i] + h[i-1] d[i+1] = 3 (h[i] e[i-1] + h[i-1] e[i]),
+    // d = 0 at both ends, solved by forward elimination (Thomas)
+    double cp[TRAJ_MAX_SEGS + 1], dp[TRAJ_MAX_SEGS + 1];
+    d[0] = d[n-1] = 0;
+    cp[0] = 0;
+    dp[0] = 0;
+    for (int i = 1; i < n-1; i++)
+    {
+        double hl = x[i] - x[i-1], hr = x[i+1] - x[i];
+        double el = (y[i] - y[i-1]) / hl, er = (y[i+1] - y[i]) / hr;
+        double a = hr, b = 2 * (hl + hr), c = hl, r = 3 * (hr * el + hl * er);
+        double m = b - a * cp[i-1];
+        cp[i] = c / m;
+        dp[i] = (r - a * dp[i-1]) / m;
+    }
+    for (int i = n-2; i >= 1; i--)
+        d[i] = dp[i] - cp[i] * d[i+1];
+
+    trajStart(_joint);
+    traj->end_pos = y[n-1];
+    traj->shape = TRAJ_SPLINE;
+    trajClear(&traj->profile, TRAJ_OUT_JPOS, 1);
+    for (int i = 0; i < n-1; i++)
+    {
+        // the cubic's curvature at each end, so the quintic is that cubic
+        double h = x[i+1] - x[i], e = (y[i+1] - y[i]) / h;
+        double a0 = (6*e - 4*d[i] - 2*d[i+1]) / h, a1 = (-6*e + 2*d[i] + 4*d[i+1]) / h;
+        trajHermite(&traj->profile, tk[i], tk[i+1], y[i], d[i], a0, y[i+1], d[i+1], a1);
+    }
+    return 0;
+}
 
-    else
-        _joint->jvel_d = 0;
+/**
+*  trajectoryStep()
+*     update every joint with a trajectory in one pass, from its profile at
+*     this tick.  Joints whose profile is not built yet, or was stopped, are
+*     left alone.
+*
+*  \return number of joints still running
+*/
+int trajectoryStep(struct device *device0)
+{
+    int running = 0;
+
+    for (int i = 0; i < NUM_MECH; i++)
+        for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            struct DOF *_joint = &device0->mech[i].joint[j];
+            struct _trajectory *traj = &trajectory[_joint->type];
+            float v;
+
+            if (traj->shape == TRAJ_NONE)
+                continue;
+            int r = trajEval(traj, gTime, &v);
+            if (r || traj->profile.hold)
+                trajApply(_joint, traj->profile.output, v);
+            running += r;
+        }
+    return running;
+}
 
+/**
+*  update_sinusoid_trajectory()
+*        find next trajectory waypoint
+*        Sinusoid trajectory
+*
+* \todo This seems to only work for a single joint of the GOLD arm???
+*/
+int update_sinusoid_velocity_trajectory(struct DOF* _joint)
+{
+    trajUpdate(_joint, TRAJ_SIN_VEL);
     return 0;
 }
 
@@ -177,28 +598,8 @@ int update_sinusoid_velocity_trajectory(struct DOF* _joint)
 */
 int update_linear_sinusoid_velocity_trajectory(struct DOF* _joint)
 {
-    const float maxspeed[8] = {-4 DEG2RAD, 4 DEG2RAD, 0.02, 15 DEG2RAD};
-    const float f_period = 2;         // 2 sec
-
-    ros::Duration t = ros::Time::now() - trajectory[_joint->type].startTime;
-
     // Sinusoid portion complete.  Return without changing velocity.
-    if (t.toSec() >= f_period/2)
-        return 1;
-
-    if (_joint->type      == SHOULDER_GOLD)
-        _joint->jvel_d = maxspeed[0] * (1-cos( 2*M_PI * (1/f_period) * t.toSec()));
-
-    else if (_joint->type == ELBOW_GOLD)
-        _joint->jvel_d = maxspeed[1] * (1-cos( 2*M_PI * (1/f_period) * t.toSec()));
-
-    else if (_joint->type == Z_INS_GOLD)
-        _joint->jvel_d = maxspeed[2] * (1-cos( 2*M_PI * (1/f_period) * t.toSec()));
-
-    else
-        _joint->jvel_d = 0;
-
-    return 0;
+    return trajUpdate(_joint, TRAJ_LIN_SIN_VEL) ? 0 : 1;
 }
 
 /**
@@ -210,18 +611,7 @@ int update_linear_sinusoid_velocity_trajectory(struct DOF* _joint)
 */
 int update_sinusoid_position_trajectory(struct DOF* _joint)
 {
-    struct _trajectory* traj = &(trajectory[_joint->type]);
-    float f_magnitude = traj->magnitude;
-    float f_period    = traj->period;
-
-    ros::Duration t = ros::Time::now() - traj->startTime;
-
-    // Rising sinusoid
-    if ( t.toSec() < f_period/4 )
-        _joint->jpos_d = -f_magnitude * 0.5 * (1-cos( 4 * M_PI * t.toSec() / f_period )) + traj->startPos;
-    else
-        _joint->jpos_d = -f_magnitude * sin( 2*M_PI * t.toSec() / f_period) + traj->startPos;
-
+    trajUpdate(_joint, TRAJ_SIN_POS);
     return 0;
 }
 
@@ -232,18 +622,7 @@ int update_sinusoid_position_trajectory(struct DOF* _joint)
 */
 int update_linear_sinusoid_position_trajectory(struct DOF* _joint)
 {
-//    const float f_magnitude[8] = {-10 DEG2RAD, 10 DEG2RAD, 0.01, 0, 60 DEG2RAD, 60 DEG2RAD, 60 DEG2RAD, 60 DEG2RAD};
-//    const float f_period[8] = {7000, 3200, 7000, 0000, 5000, 5000, 5000, 5000};
-    struct _trajectory* traj = &(trajectory[_joint->type]);
-
-    ros::Duration t = ros::Time::now() - traj->startTime;
-
-    if ( t.toSec() < traj->period/2 )
-//        _joint->jpos_d += ONE_MS * f_magnitude[index] * (1-cos( 2*M_PI * (1/f_period[index]) * t.toSec()));
-        _joint->jpos_d += ONE_MS * traj->magnitude * (1-cos( 2*M_PI * (1/traj->period) * t.toSec()));
-    else
-        _joint->jpos_d += ONE_MS * traj->magnitude;
-
+    trajUpdate(_joint, TRAJ_LIN_SIN_POS);
     return 0;
 }
 
@@ -255,18 +634,5 @@ int update_linear_sinusoid_position_trajectory(struct DOF* _joint)
 */
 int update_position_trajectory(struct DOF* _joint)
 {
-    struct _trajectory* traj = &(trajectory[_joint->type]);
-    float magnitude = traj->magnitude;
-    float period  = traj->period;
-
-    ros::Duration t = ros::Time::now()- traj->startTime;
-
-    if ( t.toSec() < period ){
-        _joint->jpos_d = 0.5*magnitude * (1-cos( 2*M_PI * (1/(2*period)) * t.toSec())) + traj->startPos;
-        return 1;
-    }
-
-    return 0;
+    return trajUpdate(_joint, TRAJ_POS);
 }
-
-
@@ -27,37 +27,56 @@
 
 #include "update_atmel_io.h"
 #include "log.h"
+#include "shared_state.h"
 
 extern int initialized;
-extern int soft_estopped;
 extern int NUM_MECH;
 extern unsigned long int gTime;
 
+static unsigned char out_base = 0x00;       // outputs but the watchdog pin
+static int out_key = -1;                    // runlevel, pedal and ready out_base was built for
+static int in_last[MAX_MECH];               // inputs at the last call
+static int in_valid = 0;                    // in_last was filled
+static u_08 plc_runlevel = RL_E_STOP;       // lowest PLC state of all mechanisms
+
 /**\fn void updateAtmelOutputs(struct device *device0, int runlevel)
- * \brief
+ * \brief set every mechanism's output pins
  * \struct device
  * \param device0 - pointer to device struct
  * \param runlevel - current runlevel
- * \return void 
+ *
+ * The pedal, ready and runlevel pins are only rebuilt when one of their
+ * inputs changes; in between only the watchdog pin toggles.  The
+ * mechanisms' outputs are only written when the pins changed.
  */
 void updateAtmelOutputs(struct device *device0, int runlevel)
 {
-    static int counter;
-    unsigned char i, outputs = 0x00;
+    static unsigned long counter;   // cycles into the watchdog period, like WD_PERIOD
+    static int last = -1;           // outputs written last, -1 before the first call
+    unsigned char i, outputs;
+    int pedal = (runlevel>1) && (device0->surgeon_mode);
+    int key = (runlevel & 0xff) | (pedal << 8) | ((initialized != 0) << 9);
 
-    //Update Foot Pedal
-    if ( (runlevel>1) && (device0->surgeon_mode) )
-        outputs |= PIN_FP;
+    if (key != out_key)
+    {
+        out_key = key;
+        out_base = 0x00;
 
-    //Update Ready
-    if (initialized)
-        outputs |= PIN_READY;
+        //Update Foot Pedal
+        if (pedal)
+            out_base |= PIN_FP;
 
-    //Update Linux State
-    outputs |= (runlevel & (PIN_LS0 | PIN_LS1));
+        //Update Ready
+        if (initialized)
+            out_base |= PIN_READY;
+
+        //Update Linux State
+        out_base |= (runlevel & (PIN_LS0 | PIN_LS1));
+    }
+    outputs = out_base;
 
     //Update WD Timer - if not software triggered
-    if ( !soft_estopped )
+    if ( !softEstopped() )
     {
         if ( counter <= (WD_PERIOD / 2) )
         {
@@ -68,33 +87,59 @@ void updateAtmelOutputs(struct device *device0, int runlevel)
             counter = 0;
         }
     }
+    counter++;
 
     //Write Changes
-    for (i = 0; i < NUM_MECH; i++)
-        device0->mech[i].outputs = outputs;
-
-    counter++;
+    if (outputs != last)
+    {
+        for (i = 0; i < NUM_MECH; i++)
+            device0->mech[i].outputs = outputs;
+        last = outputs;
+    }
 }
 
-/**\fn void updateAtmelInputs(struct device device0, int runlevel)
- * \brief
+/**\fn unsigned char updateAtmelInputs(struct device *device0)
+ * \brief edge-detect the mechanisms' input pins, after getUSBPackets() and before stateMachine()
  * \struct device
- * \param device0 - device struct
- * \param runlevel - current runlevel
- * \return void 
+ * \param device0 - pointer to device struct
+ * \return input bits that changed on any mechanism since the last call
+ *
+ * The PLC state (pedal, e-stop) is only recomputed when its pins move.
+ */
+unsigned char updateAtmelInputs(struct device *device0)
+{
+    unsigned char changed = 0x00;
+
+    for (int i = 0; i < NUM_MECH; i++)
+    {
+        int in = device0->mech[i].inputs;
+        if (!in_valid)
+            changed = 0xff;
+        else
+            changed |= (unsigned char)(in ^ in_last[i]);
+        in_last[i] = in;
+    }
+    in_valid = 1;
+
+    if (changed & (PIN_PS0 | PIN_PS1))
+    {
+        u_08 lowest = 9;   // arbitrary large number
+        for (int i = 0; i < NUM_MECH; i++)
+        {
+            u_08 tmp = (in_last[i] & (PIN_PS0 | PIN_PS1)) >> 6;
+            if (tmp < lowest)
+                lowest = tmp;
+        }
+        plc_runlevel = lowest;
+    }
+
+    return changed;
+}
+
+/**\fn u_08 atmelPlcRunlevel(void)
+ * \brief the lowest PLC state of all mechanisms, as of the last updateAtmelInputs()
  */
-void updateAtmelInputs(struct device device0, int runlevel)
+u_08 atmelPlcRunlevel(void)
 {
-    //unsigned char inputs;
-    int PLCState;
-
-    //Update PLC State
-    PLCState = (device0.mech[0].inputs & (PIN_PS0 | PIN_PS1)) >> 6;
-
-    //  printk("Mech0.inputs: %#x\n",device0.mech[0].inputs);
-    //  static int j;
-    //if (j++ % 1000 == 0)
-    //  printk("PLC State is %d\n",PLCState);
-    //if (PLCState != runlevel)
-    // printk("RunLevels on Linux Box and PLC do not match!!!\n");
+    return plc_runlevel;
 }
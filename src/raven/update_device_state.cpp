@@ -18,24 +18,70 @@
  */
 
 #include "update_device_state.h"
+#include "setpoint_interp.h"
+#include "waypoint_stream.h"
 #include "log.h"
+#include "shared_state.h"
 
 extern struct DOF_type DOF_types[];
 extern struct traj trajectory[];
 extern int NUM_MECH;
-extern volatile int isUpdated;
 extern unsigned long gTime;
 
-unsigned int newDofTorqueSetting = 0;   // for setting torque from console
-unsigned int newDofTorqueMech = 0;      // for setting torque from console
-unsigned int newDofTorqueDof = 0;       //
-int newDofTorqueTorque = 0;             // float for torque value in mNm
-t_controlmode newRobotControlMode = homing_mode;
+// Console requests, as taken by takeConsoleRequest() (RT thread)
+static unsigned int newDofTorqueSetting = 0;   // for setting torque from console
+static unsigned int newDofTorqueMech = 0;      // for setting torque from console
+static unsigned int newDofTorqueDof = 0;       //
+static int newDofTorqueTorque = 0;             // float for torque value in mNm
+t_controlmode newRobotControlMode = homing_mode;   // also set by rt_raven.cpp when homing ends
+
+/**
+ * takeConsoleRequest - copy what the console posted since the last call
+ *
+ * Never waits: a request the console is still writing is taken next cycle.
+ */
+static void takeConsoleRequest()
+{
+    static unsigned int seen_seq = 0, seen_mode = 0, seen_torque = 0;
+    struct console_request *c = &r2_shared.console;
+    unsigned int seq = c->seq;
+
+    if (seq == seen_seq || (seq & 1))
+        return;
+    __sync_synchronize();
+    unsigned int mode_count = c->mode_count, torque_count = c->torque_count;
+    int mode = c->control_mode;
+    unsigned int mech = c->torque_mech, dof = c->torque_dof;
+    int torque = c->torque;
+    __sync_synchronize();
+    if (c->seq != seq)
+        return;
+    seen_seq = seq;
+
+    if (mode_count != seen_mode)
+    {
+        newRobotControlMode = (t_controlmode)mode;
+        seen_mode = mode_count;
+    }
+    if (torque_count != seen_torque)
+    {
+        newDofTorqueMech    = mech;
+        newDofTorqueDof     = dof;
+        newDofTorqueTorque  = torque;
+        newDofTorqueSetting = 1;
+        seen_torque = torque_count;
+    }
+}
 
 /**
  * updateDeviceState - Function that update the device state based on parameters passed from
  *       the user interface
  *
+ * Only the fields marked in rcvdParams->dirty are applied, plus every
+ * arm's setpoint on entering pedal down and an arm's when its waypoint
+ * stream ends.  Control mode and DOF torque changes come from the console,
+ * through takeConsoleRequest().
+ *
  * \param params_current    the current set of parameters
  * \param arams_update      the new set of parameters
  * \param device0           pointer to device informaiton
@@ -43,9 +89,16 @@ t_controlmode newRobotControlMode = homing_mode;
  */
 int updateDeviceState(struct param_pass *currParams, struct param_pass *rcvdParams, struct device *device0)
 {
+    static u_08 last_runlevel = STOP;          // runlevel at the last update
+    static int last_streaming[MAX_MECH];       // waypointStreamActive() at the last update
+    unsigned int dirty = rcvdParams->dirty;
+
 	currParams->last_sequence = rcvdParams->last_sequence;
+	currParams->rx_stamp = rcvdParams->rx_stamp;
     for (int i = 0; i < NUM_MECH; i++)
     {
+        if ( !(dirty & PP_DIRTY_POSE(i)) )
+            continue;
         currParams->xd[i].x = rcvdParams->xd[i].x;
         currParams->xd[i].y = rcvdParams->xd[i].y;
         currParams->xd[i].z = rcvdParams->xd[i].z;
@@ -55,22 +108,22 @@ int updateDeviceState(struct param_pass *currParams, struct param_pass *rcvdPara
         currParams->rd[i].grasp = rcvdParams->rd[i].grasp;
     }
 
-    // set desired mech position in pedal_down runlevel
+    // set desired mech position in pedal_down runlevel (reached over the interpolation horizon),
+    // unless the arm is playing a waypoint stream
     if (currParams->runlevel == RL_PEDAL_DN)
     {
+        int entered = (last_runlevel != RL_PEDAL_DN);
         for (int i = 0; i < NUM_MECH; i++)
         {
-            device0->mech[i].pos_d.x = rcvdParams->xd[i].x;
-            device0->mech[i].pos_d.y = rcvdParams->xd[i].y;
-            device0->mech[i].pos_d.z = rcvdParams->xd[i].z;
-            device0->mech[i].ori_d.grasp  = rcvdParams->rd[i].grasp;
-
-
-            for (int j=0;j<3;j++)
-                for (int k=0;k<3;k++)
-                device0->mech[i].ori_d.R[j][k]  = rcvdParams->rd[i].R[j][k];
+            int streaming = waypointStreamActive(i);
+            if (!streaming && ((dirty & PP_DIRTY_POSE(i)) || entered || last_streaming[i]))
+                setpointInterpTarget(device0, i, &rcvdParams->xd[i], rcvdParams->rd[i].R, rcvdParams->rd[i].grasp);
+            last_streaming[i] = streaming;
         }
     }
+    last_runlevel = currParams->runlevel;
+
+    takeConsoleRequest();
 
     // Switch control modes only in pedal up or init.
     if ( (currParams->runlevel == RL_E_STOP)   &&
@@ -96,7 +149,7 @@ int updateDeviceState(struct param_pass *currParams, struct param_pass *rcvdPara
     }
 
     // Set new surgeon mode
-    if ( device0->surgeon_mode != rcvdParams->surgeon_mode)
+    if ( (dirty & PP_DIRTY_SURGEON) && device0->surgeon_mode != rcvdParams->surgeon_mode)
     {
         device0->surgeon_mode=rcvdParams->surgeon_mode; //store the surgeon_mode to DS0
     }
@@ -110,9 +163,16 @@ int updateDeviceState(struct param_pass *currParams, struct param_pass *rcvdPara
 *   \param t_controlmode    current control mode.
 */
 void setRobotControlMode(t_controlmode in_controlMode){
+    struct console_request *c = &r2_shared.console;
+
     log_msg("Robot control mode: %d",in_controlMode);
-    newRobotControlMode = in_controlMode;
-    isUpdated = TRUE;
+    c->seq = c->seq + 1;
+    __sync_synchronize();
+    c->control_mode = in_controlMode;
+    c->mode_count++;
+    __sync_synchronize();
+    c->seq = c->seq + 1;
+    noteParamUpdate();
 }
 
 /**
@@ -124,13 +184,19 @@ void setRobotControlMode(t_controlmode in_controlMode){
 *   \param in_torque    Torque to set the DOF to (in mNm)
 */
 void setDofTorque(unsigned int in_mech, unsigned int in_dof, int in_torque){
+    struct console_request *c = &r2_shared.console;
+
     if (    ((int)in_mech < NUM_MECH)        &&
             ((int)in_dof  < MAX_DOF_PER_MECH) )
     {
-        newDofTorqueMech    = in_mech;
-        newDofTorqueDof     = in_dof;
-        newDofTorqueTorque  = in_torque;
-        newDofTorqueSetting = 1;
+        c->seq = c->seq + 1;
+        __sync_synchronize();
+        c->torque_mech  = in_mech;
+        c->torque_dof   = in_dof;
+        c->torque       = in_torque;
+        c->torque_count++;
+        __sync_synchronize();
+        c->seq = c->seq + 1;
     }
-    isUpdated = TRUE;
+    noteParamUpdate();
 }
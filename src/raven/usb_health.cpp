@@ -0,0 +1,228 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_health.cpp
+ * \brief Board disconnect detection, and reopening of the lost boards.
+ *
+ * The RT thread and the USB workers count each board's failed calls in
+ * usbHealthIo(), one writer per board at a time.  Only the RT thread moves
+ * a board from up to lost.  No new call starts on a lost board, but a USB
+ * worker whose job overran the cycle may still be in one, so the reattach
+ * thread waits until usbWorkerIdle() before it closes and reopens the board
+ * file, then hands it back (USB_BOARD_BACK) once it is open and reset.
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <semaphore.h>
+
+#include "usb_health.h"
+#include "usb_workers.h"
+#include "USB_init.h"
+#include "get_USB_packet.h"
+#include "blackbox.h"
+#include "cpu_affinity.h"
+#include "metrics.h"
+#include "utils.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern int NUM_MECH;
+extern int usb_backend;
+extern unsigned long int gTime;
+extern USBStruct USBBoards;
+
+volatile unsigned char usb_board_state[MAX_BOARD_SERIAL+1];
+static int io_errors[MAX_BOARD_SERIAL+1];      // failed calls in a row, by board serial
+static unsigned long up_since[MAX_MECH];       // gTime the board was (re)opened
+static sem_t reattach_sem;
+
+static int health_max_errors = 5;
+static unsigned long health_stale = 0;         // cycles
+static int reattach_period_ms = 250;
+
+/**\fn int init_usb_health(ros::NodeHandle &n)
+ * \brief read the parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_usb_health(ros::NodeHandle &n)
+{
+    int stale_ms;
+    n.param("/usb_health_max_errors", health_max_errors, 5);
+    n.param("/usb_health_stale_ms", stale_ms, 50);
+    n.param("/usb_reattach_period_ms", reattach_period_ms, 250);
+
+    if (stale_ms < 0)
+        stale_ms = 0;
+    if (reattach_period_ms < 10)
+        reattach_period_ms = 10;
+    health_stale = MS_TO_TICKS(stale_ms);
+    sem_init(&reattach_sem, 0, 0);
+
+    if (usb_backend != USB_BACKEND_BOARDS || health_max_errors <= 0)
+        log_msg("USB board health: off");
+    else
+        log_msg("USB board health: lost after %d failed calls or %d ms without a packet, looked for every %d ms",
+                health_max_errors, stale_ms, reattach_period_ms);
+    return 0;
+}
+
+/**\fn void usbHealthIo(int id, int ret)
+ * \brief count one USB call's result towards board id's health.  RT safe.
+ * \param id board serial
+ * \param ret what the call returned: a length, 0, or negative errno
+ */
+void usbHealthIo(int id, int ret)
+{
+    if (ret >= 0)
+        io_errors[id] = 0;
+    else if (ret == -ENODEV || ret == -ESHUTDOWN || ret == -ENXIO)
+        io_errors[id] = health_max_errors;      // unplugged: no use waiting for more
+    else if (ret != -EBUSY)
+        io_errors[id]++;
+}
+
+/**\fn static void boardLost(struct device *dev, int m, int id, const char *why)
+ * \brief give up board id of mechanism m: no more I/O, software e-stop, arm unhomed
+ */
+static void boardLost(struct device *dev, int m, int id, const char *why)
+{
+    usb_board_state[id] = USB_BOARD_LOST;
+    __sync_synchronize();
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+        dev->mech[m].joint[j].state = jstate_pos_unknown;
+    softEstop();
+
+    err_msg("*** USB board #%d (arm %d) lost: %s.  Software e-stop. ***", id, m, why);
+    metricInc(MC_USB_BOARDS_LOST);
+    blackboxTrigger("usb board lost");
+    sem_post(&reattach_sem);
+}
+
+/**\fn int usbHealthCheck(struct device *dev)
+ * \brief give up the boards that stopped answering, take back the reopened ones.
+ *        RT thread, after the cycle's USB read.
+ *
+ * The robot stays in software e-stop while a board is missing: homing its
+ * arm on encoder counts that no longer move would find false stops.
+ *
+ * \param dev the robot state
+ * \return number of arm boards lost
+ */
+int usbHealthCheck(struct device *dev)
+{
+    int down = 0;
+
+    if (usb_backend != USB_BACKEND_BOARDS || health_max_errors <= 0)
+        return 0;
+
+    for (int m = 0; m < NUM_MECH; m++)
+    {
+        int id = USBBoards.boards[m];
+        switch (usb_board_state[id])
+        {
+        case USB_BOARD_UP:
+            if (io_errors[id] >= health_max_errors)
+                boardLost(dev, m, id, "USB calls failing");
+            else if (health_stale > 0 && encPacketAge(m) >= health_stale && gTime - up_since[m] >= health_stale)
+                boardLost(dev, m, id, "no encoder packets");
+            break;
+
+        case USB_BOARD_BACK:
+            __sync_synchronize();
+            io_errors[id] = 0;
+            up_since[m] = gTime;
+            usb_board_state[id] = USB_BOARD_UP;
+            metricInc(MC_USB_BOARDS_REOPENED);
+            log_msg("USB board #%d (arm %d) back in use", id, m);
+            break;
+        }
+        if (usb_board_state[id] != USB_BOARD_UP)
+            down++;
+    }
+
+    if (down)
+        softEstop();
+    return down;
+}
+
+/**\fn void* usb_reattach_process(void*)
+ * \brief Reattach thread: looks for the lost boards and reopens them.
+ */
+void* usb_reattach_process(void*)
+{
+    struct timespec timeout, tnow, tlost[MAX_MECH];
+    int looking[MAX_MECH], last_err[MAX_MECH];
+
+    if (usb_backend != USB_BACKEND_BOARDS || health_max_errors <= 0)
+        return NULL;
+
+    set_thread_affinity(ROLE_HOUSEKEEPING);
+    for (int m = 0; m < MAX_MECH; m++)
+        looking[m] = 0;
+
+    while (ros::ok() && !r2Killed())
+    {
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += reattach_period_ms * 1000000L;
+        tsnorm(&timeout);
+        sem_timedwait(&reattach_sem, &timeout);
+
+        for (int m = 0; m < NUM_MECH; m++)
+        {
+            int id = USBBoards.boards[m];
+            if (usb_board_state[id] != USB_BOARD_LOST)
+            {
+                looking[m] = 0;
+                continue;
+            }
+            __sync_synchronize();
+            if (!looking[m])
+            {
+                looking[m] = 1;
+                last_err[m] = 0;
+                clock_gettime(CLOCK_MONOTONIC, &tlost[m]);
+                log_msg("USB board #%d: looking for its board file every %d ms", id, reattach_period_ms);
+            }
+
+            // A late worker job may still be using the old board file
+            if (!usbWorkerIdle(id))
+                continue;
+
+            int err = usbBoardReopen(id);
+            if (err < 0)
+            {
+                if (err != -ENODEV && err != last_err[m])
+                    err_msg("USB board #%d is back but does not open (%d), trying again", id, -err);
+                last_err[m] = err;
+                continue;
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &tnow);
+            tnow = tsSubtract(tnow, tlost[m]);
+            log_msg("USB board #%d reopened after %.1f s.  Its arm homes again, from the kept calibration if the encoders kept counting.",
+                    id, tnow.tv_sec + tnow.tv_nsec * 1e-9);
+            __sync_synchronize();
+            usb_board_state[id] = USB_BOARD_BACK;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,320 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_replay.cpp
+ * \brief Replay USB backend: drive the controller from a flight recording.
+ *
+ * Record k of the recording holds the ENC packet each board returned in
+ * cycle k, the DAC packet written back and, if one arrived, the master
+ * input.  Replaying it through the real read -> state estimate -> kinematics
+ * -> control -> DAC path must reproduce the DAC packet; anything else is a
+ * behaviour change.  A recording that started with the node replays from
+ * power-on; a wrapped ring starts the controller cold, mid-session, so
+ * expect differences until it has homed again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <string>
+#include <iostream>
+
+#include "usb_replay.h"
+#include "flight_reader.h"
+#include "USB_init.h"
+#include "log.h"
+#include "shared_state.h"
+
+extern int NUM_MECH;
+extern USBStruct USBBoards;
+
+struct replay_mech_stats
+{
+	unsigned long compared;        // DAC packets compared
+	unsigned long mismatched;      // packets with a channel beyond tolerance, or different pins
+	int max_diff;                  // largest channel difference, DAC counts
+	int max_diff_dof;
+	unsigned long first_tick;      // recorded tick of the first mismatch
+	int first_dof;                 // its channel (-1: output pins)
+};
+
+static std::string rp_file;
+static int rp_tolerance = 0;
+static FlightReader rp_reader;
+static u_64 rp_next = 0;           // next record index
+static u_64 rp_end = 0;
+static u_64 rp_replayed = 0;
+static struct fr_record rp_rec;    // the record of this cycle
+static unsigned long rp_missing = 0;
+static struct replay_mech_stats rp_stats[MAX_MECH_PER_DEV];
+
+/**\fn int init_usb_replay(ros::NodeHandle &n)
+ * \brief read the replay parameters and open the recording
+ * \param n the node handle
+ * \return 0 on success, negative errno if the recording cannot be used
+ */
+int init_usb_replay(ros::NodeHandle &n)
+{
+	std::string file;
+	int tolerance;
+
+	n.param<std::string>("/usb_replay_file", file, "");
+	n.param("/usb_replay_dac_tolerance", tolerance, 0);
+	if (file.empty())
+	{
+		err_msg("USB replay: no /usb_replay_file");
+		return -EINVAL;
+	}
+	return usbReplayOpen(file.c_str(), tolerance);
+}
+
+/**\fn int usbReplayOpen(const char *path, int dac_tolerance)
+ * \brief open a recording and rewind to its first record, clearing the statistics
+ * \param path the recording
+ * \param dac_tolerance DAC counts a channel may differ without counting as a mismatch
+ * \return 0 on success, negative errno if the recording cannot be used
+ */
+int usbReplayOpen(const char *path, int dac_tolerance)
+{
+	rp_file = path;
+	rp_tolerance = dac_tolerance;
+	rp_replayed = rp_missing = 0;
+	memset(rp_stats, 0, sizeof(rp_stats));
+	memset(&rp_rec, 0, sizeof(rp_rec));
+
+	int err = rp_reader.open(rp_file.c_str());
+	if (err < 0)
+	{
+		err_msg("USB replay: cannot read %s (%d)", rp_file.c_str(), -err);
+		return err;
+	}
+	const struct fr_header *h = rp_reader.header();
+	rp_next = rp_reader.first();
+	rp_end = rp_reader.end();
+	if (rp_end <= rp_next)
+	{
+		err_msg("USB replay: %s has no records", rp_file.c_str());
+		rp_reader.close();
+		return -ENOENT;
+	}
+
+	// The RT thread reads the mapping: fault it in now
+	size_t len = rp_reader.mappedLength();
+	if (mlock(rp_reader.mapping(), len) < 0)
+		err_msg("USB replay: could not lock %lu bytes (%d)", (unsigned long)len, errno);
+
+	if ((int)h->control_rate_hz != control_rate_hz)
+		err_msg("USB replay: recorded at %u Hz, running at %d Hz", h->control_rate_hz, control_rate_hz);
+
+	log_msg("USB replay: %s, %llu records%s, DAC tolerance %d", rp_file.c_str(),
+			(unsigned long long)(rp_end - rp_next), rp_next > 0 ? " (starting mid-session)" : "",
+			rp_tolerance);
+	return 0;
+}
+
+/**\fn int usbReplayActive()
+ * \return nonzero when the USB calls are served from a recording
+ */
+int usbReplayActive()
+{
+	return rp_reader.header() != NULL;
+}
+
+/**\fn int usbReplayInit(struct device *device0)
+ * \brief USBInit() for replay: take the boards from the recording, their arm
+ *        types from /arm_boards
+ * \param device0 pointer to device struct
+ * \return number of boards
+ */
+int usbReplayInit(struct device *device0)
+{
+	const struct fr_header *h = rp_reader.header();
+
+	for (u_32 m = 0; m < h->num_mech && m < MAX_MECH_PER_DEV; m++)
+	{
+		int boardid = h->board_serial[m];
+		usbAddMech(device0, boardid);
+		if (armBoardType(boardid) == 0)
+			log_msg("*** WARNING: recorded board #%d is not in /arm_boards.", boardid);
+		log_msg("  Replaying board #%d as mechanism %u.", boardid, m);
+	}
+	return USBBoards.activeAtStart;
+}
+
+/**\fn int usbReplayNext()
+ * \brief step to the next cycle of the recording.  RT thread, before initiateUSBGet().
+ *        At the end of the recording, logs the summary and stops the node.
+ * \return 0, or -ENOENT at the end of the recording
+ */
+int usbReplayNext()
+{
+	while (rp_next < rp_end)
+	{
+		if (rp_reader.read(rp_next++, &rp_rec) == 0)
+		{
+			rp_replayed++;
+			return 0;
+		}
+		rp_missing++;       // only if the file is still being written
+	}
+	usbReplaySummary();
+	r2Kill();
+	return -ENOENT;
+}
+
+/**\fn struct param_pass *usbReplayMaster(struct param_pass *rcvdParams)
+ * \brief the recorded master input of this cycle, in place of getRcvdParams()
+ * \param rcvdParams updated with the recorded input
+ * \return rcvdParams, or NULL if no master input was taken in this cycle
+ */
+struct param_pass *usbReplayMaster(struct param_pass *rcvdParams)
+{
+	if (!(rp_rec.flags & FR_MASTER_FRESH))
+		return NULL;
+
+	rcvdParams->last_sequence = rp_rec.last_sequence;
+	rcvdParams->surgeon_mode = rp_rec.surgeon_mode;
+	rcvdParams->dirty = PP_DIRTY_ALL;
+	for (int m = 0; m < MAX_MECH_PER_DEV; m++)
+	{
+		const struct fr_master *fm = &rp_rec.mech[m].master;
+		rcvdParams->xd[m].x = fm->xd[0];
+		rcvdParams->xd[m].y = fm->xd[1];
+		rcvdParams->xd[m].z = fm->xd[2];
+		memcpy(rcvdParams->rd[m].R, fm->R, sizeof(fm->R));
+		rcvdParams->rd[m].yaw = fm->yaw;
+		rcvdParams->rd[m].pitch = fm->pitch;
+		rcvdParams->rd[m].roll = fm->roll;
+		rcvdParams->rd[m].grasp = fm->grasp;
+	}
+	return rcvdParams;
+}
+
+/**\fn static int boardMech(int id)
+ * \return the mechanism index of board id, or -1
+ */
+static int boardMech(int id)
+{
+	for (int m = 0; m < USBBoards.activeAtStart && m < MAX_MECH_PER_DEV; m++)
+		if (USBBoards.boards[m] == id)
+			return m;
+	return -1;
+}
+
+/**\fn int usbReplayRead(int id, void *buffer, size_t len)
+ * \brief usb_read(): the ENC packet board id sent in this cycle
+ * \return bytes read, or -ENODEV for a board that is not in the recording
+ */
+int usbReplayRead(int id, void *buffer, size_t len)
+{
+	int m = boardMech(id);
+	if (m < 0)
+		return -ENODEV;
+	if (len > FR_IN_LEN)
+		len = FR_IN_LEN;
+	memcpy(buffer, rp_rec.mech[m].enc_packet, len);
+	return len;
+}
+
+/**\fn int usbReplayWrite(int id, const void *buffer, size_t len)
+ * \brief usb_write(): compare the DAC packet against the recorded one
+ * \return len, or -ENODEV for a board that is not in the recording
+ */
+int usbReplayWrite(int id, const void *buffer, size_t len)
+{
+	int m = boardMech(id);
+	if (m < 0)
+		return -ENODEV;
+	if (len != FR_OUT_LEN)
+		return len;         // not a DAC packet (encoder reset)
+
+	const unsigned char *out = (const unsigned char *)buffer;
+	const unsigned char *rec = rp_rec.mech[m].dac_packet;
+	struct replay_mech_stats *st = &rp_stats[m];
+	int bad = -2;
+
+	st->compared++;
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+	{
+		int a = out[2*j+2] | (out[2*j+3] << 8);      // offset binary: compare unsigned
+		int b = rec[2*j+2] | (rec[2*j+3] << 8);
+		int d = abs(a - b);
+		if (d > st->max_diff)
+		{
+			st->max_diff = d;
+			st->max_diff_dof = j;
+		}
+		if (d > rp_tolerance && bad == -2)
+			bad = j;
+	}
+	if (bad == -2 && out[FR_OUT_LEN-1] != rec[FR_OUT_LEN-1])
+		bad = -1;
+	if (bad != -2)
+	{
+		if (st->mismatched++ == 0)
+		{
+			st->first_tick = rp_rec.tick;
+			st->first_dof = bad;
+		}
+	}
+	return len;
+}
+
+/**\fn void usbReplaySummary()
+ * \brief log how the replayed DAC stream compared against the recording
+ */
+void usbReplaySummary()
+{
+	log_msg("USB replay: %llu records replayed, %lu missing", (unsigned long long)rp_replayed, rp_missing);
+	for (int m = 0; m < NUM_MECH && m < MAX_MECH_PER_DEV; m++)
+	{
+		struct replay_mech_stats *st = &rp_stats[m];
+		if (st->mismatched == 0)
+			log_msg("  mech %d: %lu DAC packets identical (max diff %d)", m, st->compared, st->max_diff);
+		else
+			log_msg("  mech %d: %lu of %lu DAC packets differ, first at tick %lu on %s %d; max diff %d on dof %d",
+					m, st->mismatched, st->compared, st->first_tick,
+					st->first_dof < 0 ? "pins" : "dof", st->first_dof < 0 ? 0 : st->first_dof,
+					st->max_diff, st->max_diff_dof);
+	}
+}
+
+/**\fn void outputUsbReplayStats()
+ * \brief print replay progress and differences, for the console
+ */
+void outputUsbReplayStats()
+{
+	if (!usbReplayActive())
+		return;
+
+	std::cout << "USB replay: " << rp_replayed << " of " << (rp_end - rp_reader.first())
+			  << " records, tick " << rp_rec.tick << std::endl;
+	for (int m = 0; m < NUM_MECH && m < MAX_MECH_PER_DEV; m++)
+	{
+		struct replay_mech_stats *st = &rp_stats[m];
+		std::cout << "   mech " << m << ": " << st->mismatched << " / " << st->compared
+				  << " DAC packets differ, max diff " << st->max_diff;
+		if (st->mismatched)
+			std::cout << ", first at tick " << st->first_tick;
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,240 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_ring.cpp
+ * \brief User side of the brl_usb packet rings.
+ *
+ * Each board's ring has one user-space reader and writer: the RT thread,
+ * or that board's USB worker.  A read only looks at the newest completed
+ * IN slot.  One request is outstanding per cycle, so the driver never
+ * comes back round to the slot being decoded.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <string>
+
+#include "usb_ring.h"
+#include "brl_usb_ring.h"
+#include "USB_init.h"
+#include "rt_memory.h"
+#include "log.h"
+
+struct usb_ring
+{
+    struct brl_ring *ring;
+    size_t map_size;
+    uint32_t mask;              // nslots - 1
+    uint32_t in_seen;           // in_head at the last packet taken
+    int kick_fd;                // eventfd doorbell, -1 if the driver polls
+};
+
+unsigned char usb_ring_mapped[MAX_BOARD_SERIAL+1];
+static struct usb_ring rings[MAX_BOARD_SERIAL+1];
+static int ring_enabled = 0;
+
+/**\fn int init_usb_ring(ros::NodeHandle &n)
+ * \brief read /usb_ring ("off" (default) or "on").  Call before USBInit().
+ * \param n ROS node handle
+ * \return 0
+ */
+int init_usb_ring(ros::NodeHandle &n)
+{
+    std::string mode;
+    n.param<std::string>("/usb_ring", mode, "off");
+    ring_enabled = (mode == "on");
+    log_msg("USB packet ring: %s", ring_enabled ? "on where the driver has it" : "off");
+    return 0;
+}
+
+/**\fn static inline void ringKick(struct usb_ring *r)
+ * \brief ring the doorbell, if the driver does not poll
+ */
+static inline void ringKick(struct usb_ring *r)
+{
+    if (r->kick_fd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(r->kick_fd, &one, sizeof(one));   // EAGAIN: a kick is pending anyway
+        (void)ret;
+    }
+}
+
+/**\fn static inline struct brl_ring_slot *ringSlot(struct usb_ring *r, int out, uint32_t seq)
+ * \brief IN (out = 0) or OUT (out = 1) slot for packet seq
+ */
+static inline struct brl_ring_slot *ringSlot(struct usb_ring *r, int out, uint32_t seq)
+{
+    return &r->ring->slots[(out ? r->mask + 1 : 0) + (seq & r->mask)];
+}
+
+/**\fn int usbRingAttach(int id, int fd)
+ * \brief map board id's ring, if /usb_ring is on and its driver has one
+ * \param id board serial
+ * \param fd open board file
+ * \return 1 if mapped, 0 if the board stays on the syscalls
+ */
+int usbRingAttach(int id, int fd)
+{
+    struct usb_ring *r = &rings[id];
+    struct brl_ring_info info;
+
+    usb_ring_mapped[id] = 0;
+    if (!ring_enabled)
+        return 0;
+
+    memset(&info, 0, sizeof(info));
+    if (ioctl(fd, BRL_RING_INFO, &info) != 0)
+    {
+        log_msg("  Board #%d: driver has no packet ring (%s), using read/write", id, strerror(errno));
+        return 0;
+    }
+    if (info.version != BRL_RING_VERSION || info.nslots == 0 || (info.nslots & (info.nslots - 1)) ||
+        info.map_size < sizeof(struct brl_ring) + 2 * info.nslots * sizeof(struct brl_ring_slot) ||
+        !(info.flags & (BRL_RING_KICK_POLL | BRL_RING_KICK_EVENTFD)))
+    {
+        err_msg("Board #%d: unusable packet ring (version %u, %u slots, flags 0x%x), using read/write",
+                id, info.version, info.nslots, info.flags);
+        return 0;
+    }
+
+    void *p = mmap(NULL, info.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        err_msg("Board #%d: cannot map the packet ring (%s), using read/write", id, strerror(errno));
+        return 0;
+    }
+    struct brl_ring *ring = (struct brl_ring *)p;
+    if (ring->magic != BRL_RING_MAGIC || ring->version != BRL_RING_VERSION || ring->nslots != info.nslots)
+    {
+        err_msg("Board #%d: bad packet ring header, using read/write", id);
+        munmap(p, info.map_size);
+        return 0;
+    }
+
+    r->kick_fd = -1;
+    if (!(info.flags & BRL_RING_KICK_POLL))
+    {
+        r->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (r->kick_fd < 0 || ioctl(fd, BRL_RING_SET_KICK, r->kick_fd) != 0)
+        {
+            err_msg("Board #%d: cannot set the ring doorbell (%s), using read/write", id, strerror(errno));
+            if (r->kick_fd >= 0)
+                close(r->kick_fd);
+            munmap(p, info.map_size);
+            return 0;
+        }
+    }
+
+    rt_prefault(p, info.map_size);
+    r->ring = ring;
+    r->map_size = info.map_size;
+    r->mask = info.nslots - 1;
+    r->in_seen = ring->in_head;
+    usb_ring_mapped[id] = 1;
+    log_msg("  Board #%d: packet ring mapped, %u slots, %s doorbell", id, info.nslots,
+            r->kick_fd >= 0 ? "eventfd" : "polled");
+    return 1;
+}
+
+/**\fn void usbRingDetach(int id)
+ * \brief unmap board id's ring.  Before the board file is closed.
+ */
+void usbRingDetach(int id)
+{
+    struct usb_ring *r = &rings[id];
+
+    if (!usb_ring_mapped[id])
+        return;
+    usb_ring_mapped[id] = 0;
+    if (r->kick_fd >= 0)
+        close(r->kick_fd);
+    munmap(r->ring, r->map_size);
+    r->ring = NULL;
+}
+
+/**\fn int usbRingRequest(int id)
+ * \brief ask for the board's next encoder packet: the ring's BRL_START_READ
+ * \return 0
+ */
+int usbRingRequest(int id)
+{
+    struct usb_ring *r = &rings[id];
+
+    __sync_synchronize();
+    r->ring->in_req = r->ring->in_req + 1;
+    ringKick(r);
+    return 0;
+}
+
+/**\fn int usbRingRead(int id, unsigned char **packet, uint64_t *stamp_ns)
+ * \brief the board's newest encoder packet, in place
+ * \param id board serial
+ * \param packet set to the packet in the mapped slot, valid until the next request completes
+ * \param stamp_ns if not NULL, set to the driver's completion time (CLOCK_MONOTONIC)
+ * \return packet length, -EBUSY if nothing completed since the last read, -EIO on a torn slot
+ */
+int usbRingRead(int id, unsigned char **packet, uint64_t *stamp_ns)
+{
+    struct usb_ring *r = &rings[id];
+    uint32_t head = r->ring->in_head;
+
+    if (head == r->in_seen)
+        return -EBUSY;
+    __sync_synchronize();
+
+    struct brl_ring_slot *s = ringSlot(r, 0, head - 1);
+    r->in_seen = head;
+    if (s->seq != head - 1 || s->len > BRL_RING_SLOT_DATA)
+        return -EIO;
+
+    *packet = s->data;
+    if (stamp_ns)
+        *stamp_ns = s->stamp_ns;
+    return s->len;
+}
+
+/**\fn int usbRingWrite(int id, const void *buffer, size_t len)
+ * \brief post a DAC packet: the ring's write()
+ * \return len, -EAGAIN if the driver is nslots packets behind, -EINVAL if it does not fit a slot
+ */
+int usbRingWrite(int id, const void *buffer, size_t len)
+{
+    struct usb_ring *r = &rings[id];
+    uint32_t head = r->ring->out_head;
+
+    if (len > BRL_RING_SLOT_DATA)
+        return -EINVAL;
+    if (head - r->ring->out_done > r->mask)
+        return -EAGAIN;
+
+    struct brl_ring_slot *s = ringSlot(r, 1, head);
+    memcpy(s->data, buffer, len);
+    s->len = len;
+    s->seq = head;
+    __sync_synchronize();
+    r->ring->out_head = head + 1;
+    ringKick(r);
+    return len;
+}
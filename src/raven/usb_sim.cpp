@@ -0,0 +1,382 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_sim.cpp
+ * \brief Simulated BRL USB boards with a motor plant (/usb_backend: sim).
+ *
+ * The plant is stepped when a read completes, over the time since the last
+ * step, so it follows the wall clock whatever the control rate.  Each motor
+ * is integrated on its own (semi-implicit Euler, 50 us substeps):
+ *   J w' = i * tau_per_amp - b w - k_stop * (penetration of a hard stop)
+ * with i = (DAC - DAC_OFFSET) / DAC_per_amp.  The cable coupling between
+ * joints is not modelled: each channel sees its own motor and load.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <iostream>
+
+#include "usb_sim.h"
+#include "control_clock.h"
+#include "USB_init.h"
+#include "get_USB_packet.h"
+#include "update_atmel_io.h"
+#include "motor.h"
+#include "utils.h"
+#include "USB_packets.h"
+#include "log.h"
+
+extern int NUM_MECH;
+extern USBStruct USBBoards;
+extern struct DOF_type DOF_types[];
+extern struct device device0;
+
+#define SIM_SUBSTEP_NS   50000
+#define SIM_MAX_STEP_NS  10000000       // longer gaps (startup, stalls) are not integrated
+#define SIM_STOP_K       5.0            // hard stop stiffness at the motor (Nm/rad)
+#define SIM_STOP_B       0.005          // hard stop damping (Nm s/rad)
+#define SIM_WD_TIMEOUT_NS 200000000LL   // watchdog pin stuck this long: PLC e-stop
+
+struct sim_motor
+{
+	double theta, omega;          // motor angle (rad) and speed (rad/s)
+	double enc_zero;              // angle at the last encoder reset
+	short dac;                    // last command, DAC counts from midrange
+};
+
+struct sim_board
+{
+	int id;                       // board serial
+	int mech;                     // mechanism index
+	int tfd;                      // timerfd: readable when the read completes
+	int reading;                  // a read was started
+	long long done_ns;            // completion time
+	long long stepped_ns;         // plant integrated up to here
+	unsigned int seed;
+	struct sim_motor motor[MAX_DOF_PER_MECH];
+	unsigned long reads, busy, stops;
+};
+
+static int sim_nboards = 2;
+static int sim_latency_us = 100;
+static int sim_jitter_us = 20;
+static int sim_runlevel = RL_PEDAL_UP;
+static double sim_inertia = 5e-5;
+static double sim_damping = 1e-3;
+static double sim_travel = 1.0;
+
+static struct sim_board sim_boards[MAX_MECH_PER_DEV];
+
+// Simulated PLC, shared by all boards
+static volatile int sim_plc_runlevel = RL_INIT;
+static volatile int sim_wd_lost = 0;
+static unsigned char sim_last_outputs = 0;
+static long long sim_wd_ns = 0;
+
+static long long simNow()
+{
+	return controlClockNs();     // virtual in lockstep
+}
+
+/**\fn int init_usb_sim(ros::NodeHandle &n)
+ * \brief read the simulation parameters
+ * \param n the node handle
+ * \return 0
+ */
+int init_usb_sim(ros::NodeHandle &n)
+{
+	n.param("/usb_sim_boards", sim_nboards, 2);
+	n.param("/usb_sim_latency_us", sim_latency_us, 100);
+	n.param("/usb_sim_jitter_us", sim_jitter_us, 20);
+	n.param("/usb_sim_runlevel", sim_runlevel, (int)RL_PEDAL_UP);
+	n.param("/usb_sim_inertia", sim_inertia, 5e-5);
+	n.param("/usb_sim_damping", sim_damping, 1e-3);
+	n.param("/usb_sim_travel", sim_travel, 1.0);
+
+	if (sim_nboards < 1 || sim_nboards > MAX_MECH_PER_DEV)
+	{
+		err_msg("usb_sim_boards must be 1 - %d.  Using %d.", MAX_MECH_PER_DEV, MAX_MECH_PER_DEV);
+		sim_nboards = MAX_MECH_PER_DEV;
+	}
+	if (sim_inertia <= 0)
+		sim_inertia = 5e-5;
+
+	log_msg("USB sim: %d boards, read latency %d +%d us, PLC runlevel %d", sim_nboards,
+			sim_latency_us, sim_jitter_us, sim_runlevel);
+	return 0;
+}
+
+/**\fn int usbSimInit(struct device *device0)
+ * \brief USBInit() for the simulation: create the boards, the first
+ *        /usb_sim_boards of /arm_boards
+ * \param device0 pointer to device struct
+ * \return number of boards, 0 on failure
+ */
+int usbSimInit(struct device *device0)
+{
+	if (sim_nboards > armBoardCount())
+	{
+		err_msg("USB sim: only %d boards in /arm_boards, simulating those", armBoardCount());
+		sim_nboards = armBoardCount();
+	}
+
+	for (int i = 0; i < sim_nboards; i++)
+	{
+		struct sim_board *b = &sim_boards[i];
+		memset(b, 0, sizeof(*b));
+		b->id = armBoardSerial(i);
+		b->mech = usbAddMech(device0, b->id);
+		b->seed = b->id;
+		b->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (b->tfd < 0)
+		{
+			err_msg("USB sim: timerfd_create failed (%d)", errno);
+			return 0;
+		}
+		log_msg("  Simulated %s Arm on board #%d.", device0->mech[b->mech].type == GOLD_ARM ? "Gold" : "Green", b->id);
+	}
+	return USBBoards.activeAtStart;
+}
+
+/**\fn void usbSimShutdown()
+ * \brief USBShutdown() for the simulation
+ */
+void usbSimShutdown()
+{
+	for (int i = 0; i < USBBoards.activeAtStart && i < MAX_MECH_PER_DEV; i++)
+		if (sim_boards[i].tfd > 0)
+		{
+			close(sim_boards[i].tfd);
+			sim_boards[i].tfd = -1;
+		}
+}
+
+/**\fn static struct sim_board *simBoard(int id)
+ * \return the simulated board with serial id, or NULL
+ */
+static struct sim_board *simBoard(int id)
+{
+	for (int i = 0; i < USBBoards.activeAtStart && i < MAX_MECH_PER_DEV; i++)
+		if (sim_boards[i].id == id)
+			return &sim_boards[i];
+	return NULL;
+}
+
+/**\fn static void simStep(struct sim_board *b, long long now)
+ * \brief integrate the board's motors up to now
+ */
+static void simStep(struct sim_board *b, long long now)
+{
+	long long span = now - b->stepped_ns;
+	b->stepped_ns = now;
+	if (span <= 0 || span > SIM_MAX_STEP_NS)
+		return;
+
+	int nsub = (int)((span + SIM_SUBSTEP_NS - 1) / SIM_SUBSTEP_NS);
+	double h = span * 1e-9 / nsub;
+
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+	{
+		struct DOF_type *t = &DOF_types[device0.mech[b->mech].joint[j].type];
+		struct sim_motor *mo = &b->motor[j];
+		double tau = 0, limit = sim_travel * fabs(t->TR);
+
+		if (t->DAC_per_amp != 0)
+			tau = mo->dac / t->DAC_per_amp * t->tau_per_amp;
+		for (int k = 0; k < nsub; k++)
+		{
+			double f = tau - sim_damping * mo->omega;
+			if (mo->theta > limit)
+				f -= SIM_STOP_K * (mo->theta - limit) + SIM_STOP_B * mo->omega;
+			else if (mo->theta < -limit)
+				f -= SIM_STOP_K * (mo->theta + limit) + SIM_STOP_B * mo->omega;
+			mo->omega += h * f / sim_inertia;
+			mo->theta += h * mo->omega;
+		}
+		if (fabs(mo->theta) > limit)
+			b->stops++;
+	}
+}
+
+/**\fn static void simPacket(struct sim_board *b, unsigned char *buf)
+ * \brief build the ENC packet: inputs, then 24 bit counts per channel
+ */
+static void simPacket(struct sim_board *b, unsigned char *buf)
+{
+	buf[0] = ENC;
+	buf[1] = MAX_DOF_PER_MECH;
+	buf[2] = (unsigned char)(sim_plc_runlevel << 6) & (PIN_PS0 | PIN_PS1);
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+	{
+		struct sim_motor *mo = &b->motor[j];
+		int counts = (int)lround((mo->theta - mo->enc_zero) * ENC_CNTS_PER_REV / (2*M_PI));
+#ifndef RAVEN_I
+		counts = -counts;     // processEncVal() flips the sign on RAVEN II boards
+#endif
+		buf[3*j+3] = (unsigned char)(counts);
+		buf[3*j+4] = (unsigned char)(counts >> 8);
+		buf[3*j+5] = (unsigned char)(counts >> 16);
+	}
+}
+
+/**\fn int usbSimStartRead(int id)
+ * \brief BRL_START_READ: the read completes latency (+ jitter) from now
+ * \return 0, or -ENODEV
+ */
+int usbSimStartRead(int id)
+{
+	struct sim_board *b = simBoard(id);
+	if (b == NULL)
+		return -ENODEV;
+
+	long long lat = (long long)sim_latency_us * 1000;
+	if (sim_jitter_us > 0)
+		lat += (long long)(rand_r(&b->seed) % (sim_jitter_us + 1)) * 1000;
+	b->done_ns = simNow() + lat;
+	b->reading = 1;
+	if (controlClockLockstep())
+		return 0;            // no wall clock to wake a poll() on: reads resolve in virtual time
+
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = b->done_ns / NSEC_PER_SEC;
+	its.it_value.tv_nsec = b->done_ns % NSEC_PER_SEC;
+	timerfd_settime(b->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+	return 0;
+}
+
+/**\fn int usbSimRead(int id, void *buffer, size_t len)
+ * \brief read the ENC packet once the read has completed
+ * \return bytes read, -EBUSY before completion, -EIO with no read started, -ENODEV
+ */
+int usbSimRead(int id, void *buffer, size_t len)
+{
+	struct sim_board *b = simBoard(id);
+	if (b == NULL)
+		return -ENODEV;
+	if (!b->reading)
+		return -EIO;
+
+	long long now = simNow();
+	if (now < b->done_ns)
+	{
+		b->busy++;
+		return -EBUSY;
+	}
+	u_64 expirations;
+	if (read(b->tfd, &expirations, sizeof(expirations)) < 0)
+		errno = 0;            // already drained
+	b->reading = 0;
+	b->reads++;
+
+	unsigned char packet[IN_LENGTH];
+	simStep(b, b->done_ns);   // the board sampled its encoders at completion
+	simPacket(b, packet);
+	if (len > IN_LENGTH)
+		len = IN_LENGTH;
+	memcpy(buffer, packet, len);
+	return len;
+}
+
+/**\fn static void simPLC(unsigned char outputs, long long now)
+ * \brief the PLC: e-stop when the watchdog pin stops toggling, hold INIT until Linux is ready
+ */
+static void simPLC(unsigned char outputs, long long now)
+{
+	if (sim_wd_ns == 0 || ((outputs ^ sim_last_outputs) & PIN_WD))
+		sim_wd_ns = now;
+	sim_last_outputs = outputs;
+	if (now - sim_wd_ns > SIM_WD_TIMEOUT_NS)
+		sim_wd_lost = 1;      // latched, like the real e-stop chain
+
+	int rl = sim_runlevel;
+	if (sim_wd_lost)
+		rl = RL_E_STOP;
+	else if (rl > RL_INIT && !(outputs & PIN_READY))
+		rl = RL_INIT;
+	sim_plc_runlevel = rl;
+}
+
+/**\fn int usbSimWrite(int id, const void *buffer, size_t len)
+ * \brief take a DAC packet: new motor commands and Linux output pins
+ * \return len, or -ENODEV
+ */
+int usbSimWrite(int id, const void *buffer, size_t len)
+{
+	struct sim_board *b = simBoard(id);
+	if (b == NULL)
+		return -ENODEV;
+
+	const unsigned char *p = (const unsigned char *)buffer;
+	if (len != OUT_LENGTH || p[0] != DAC)
+		return len;
+
+	long long now = simNow();
+	simStep(b, now);          // the old command held until now
+	for (int j = 0; j < MAX_DOF_PER_MECH && j < p[1]; j++)
+		b->motor[j].dac = (short)((p[2*j+2] | (p[2*j+3] << 8)) - DAC_OFFSET);
+	simPLC(p[OUT_LENGTH-1], now);
+	return len;
+}
+
+/**\fn int usbSimBoardFd(int id)
+ * \return the board's completion timerfd, or -1
+ */
+int usbSimBoardFd(int id)
+{
+	struct sim_board *b = simBoard(id);
+	return b ? b->tfd : -1;
+}
+
+/**\fn int usbSimResetEncoders(int id)
+ * \brief zero the board's encoder counts at the current motor angles
+ * \return 0, or -ENODEV
+ */
+int usbSimResetEncoders(int id)
+{
+	struct sim_board *b = simBoard(id);
+	if (b == NULL)
+		return -ENODEV;
+	for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		b->motor[j].enc_zero = b->motor[j].theta;
+	return 0;
+}
+
+/**\fn void outputUsbSimStats()
+ * \brief print simulated board counters, for the console
+ */
+void outputUsbSimStats()
+{
+	if (USBBoards.activeAtStart == 0 || sim_boards[0].id == 0)
+		return;
+
+	std::cout << "USB sim: PLC runlevel " << sim_plc_runlevel << (sim_wd_lost ? " (watchdog lost)" : "") << std::endl;
+	for (int i = 0; i < USBBoards.activeAtStart && i < MAX_MECH_PER_DEV; i++)
+	{
+		struct sim_board *b = &sim_boards[i];
+		std::cout << "   board " << b->id << ": " << b->reads << " reads, " << b->busy
+				  << " busy, " << b->stops << " steps at a hard stop" << std::endl;
+	}
+}
@@ -0,0 +1,309 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file usb_workers.cpp
+ * \brief Per-board USB I/O helper threads.
+ *
+ * One thread per board, created at startup, on its core of
+ * /cpus_usb_workers.  Each cycle the RT thread sets the job, wakes every
+ * worker and sleeps until the last one finishes, so the boards'
+ * ioctl/read/write syscalls run concurrently.  The workers only touch their
+ * own board and mechanism while the RT thread is blocked, so no other
+ * locking is needed.
+ *
+ * The RT thread waits no longer than the cycle deadline.  A job that
+ * overruns it breaks that rule, since its worker is still in the board's
+ * syscalls and writing its mechanism's encoder fields, so an overrun is a
+ * fault: the DACs are zeroed, the robot soft e-stopped, and no new job
+ * starts until every worker is idle again.  usbWorkerIdle() tells the
+ * reattach thread when a lost board's worker is out of its calls.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+
+#include "usb_workers.h"
+#include "USB_init.h"
+#include "cycle_scheduler.h"
+#include "utils.h"
+#include "get_USB_packet.h"
+#include "put_USB_packet.h"
+#include "cpu_affinity.h"
+#include "rt_memory.h"
+#include "log.h"
+#include "metrics.h"
+#include "blackbox.h"
+#include "shared_state.h"
+
+extern USBStruct USBBoards;
+extern struct cycle_sched rt_sched;
+
+#define USB_WORKER_PRIORITY 98   // just below rt_process
+
+struct usb_worker
+{
+    pthread_t thread;
+    sem_t go;                    // posted by usbWorkersRun() to start a job
+    int board;                   // board serial number
+    int index;                   // board / mechanism index
+    struct mechanism *mech;      // mechanism driven by this board
+    int result;                  // result of the last job
+    volatile int busy;           // set by the RT thread when it posts a job, cleared by the worker when done
+};
+
+static struct usb_worker workers[MAX_BOARD_COUNT];
+static int num_workers = 0;
+static volatile int workers_quit = 0;
+static volatile int workers_remaining = 0;
+static sem_t workers_done;               // posted by the last worker to finish
+static int workers_overrun = 0;          // a job missed its cycle and is still running (RT thread)
+
+// Current job.  Written by the RT thread before the workers are woken.
+static int worker_job = USB_JOB_START_READ;
+static int worker_has_deadline = 0;
+static struct timespec worker_deadline;
+
+/**\fn static void *usb_worker_process(void *arg)
+ * \brief helper thread for one board
+ */
+static void *usb_worker_process(void *arg)
+{
+    struct usb_worker *w = (struct usb_worker *)arg;
+
+    rt_prefault_stack();
+    if (usb_worker_cpu(w->index) >= 0)
+        set_thread_cpu(usb_worker_cpu(w->index));
+
+    struct sched_param param;
+    param.sched_priority = USB_WORKER_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        err_msg("USB worker %d: could not set realtime priority", w->board);
+
+    while (1)
+    {
+        while (sem_wait(&w->go) != 0 && errno == EINTR)
+            ;
+        if (workers_quit)
+            break;
+
+        switch (worker_job)
+        {
+        case USB_JOB_START_READ:
+            w->result = startUSBRead(w->board);
+            break;
+        case USB_JOB_READ:
+            if (worker_has_deadline)
+                w->result = getUSBPacketWait(w->board, w->mech, &worker_deadline);
+            else
+                w->result = getUSBPacket(w->board, w->mech);
+            break;
+        case USB_JOB_WRITE:
+            w->result = putUSBPacket(w->board, w->mech, dacPacket(w->index));
+            break;
+        }
+
+        __sync_synchronize();
+        w->busy = 0;
+        if (__sync_sub_and_fetch(&workers_remaining, 1) == 0)
+            sem_post(&workers_done);
+    }
+
+    return 0;
+}
+
+/**\fn int usbWorkersStart(struct device *device0)
+ * \brief start one helper thread per active board.  Call after USBInit().
+ * \param device0 pointer to device struct
+ * \return 0 on success, -1 on failure
+ */
+int usbWorkersStart(struct device *device0)
+{
+    int count = USBBoards.activeAtStart;
+    if (count > MAX_BOARD_COUNT)
+        count = MAX_BOARD_COUNT;
+
+    sem_init(&workers_done, 0, 0);
+    workers_quit = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct usb_worker *w = &workers[i];
+        w->board = USBBoards.boards[i];
+        w->index = i;
+        w->mech = &(device0->mech[i]);
+        w->result = 0;
+        w->busy = 0;
+        sem_init(&w->go, 0, 0);
+        if (pthread_create(&w->thread, NULL, usb_worker_process, w) != 0)
+        {
+            err_msg("Could not start USB worker for board %d", w->board);
+            usbWorkersStop();
+            return -1;
+        }
+        num_workers = i + 1;
+    }
+
+    if (usb_worker_cpu(num_workers-1) < 0)
+        log_msg("USB I/O: %d parallel board workers, %s", num_workers,
+                usb_worker_cpu(0) < 0 ? "unpinned" : "not all pinned (cpus_usb_workers is short)");
+    else
+        log_msg("USB I/O: %d parallel board workers, pinned", num_workers);
+    return 0;
+}
+
+/**\fn void usbWorkersStop(void)
+ * \brief stop and join the helper threads.  The RT thread must not be in usbWorkersRun().
+ */
+void usbWorkersStop(void)
+{
+    int count = num_workers;
+
+    num_workers = 0;
+    workers_quit = 1;
+    for (int i = 0; i < count; i++)
+        sem_post(&workers[i].go);
+    for (int i = 0; i < count; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        sem_destroy(&workers[i].go);
+    }
+}
+
+/**\fn int usbWorkersActive(void)
+ * \brief true if the helper threads are running
+ */
+int usbWorkersActive(void)
+{
+    return num_workers > 0;
+}
+
+/**\fn int usbWorkerIdle(int board)
+ * \brief true if no job is in flight on a board.  Any thread.
+ * \param board board serial number
+ */
+int usbWorkerIdle(int board)
+{
+    for (int i = 0; i < num_workers; i++)
+        if (workers[i].board == board)
+            return !workers[i].busy;
+    return 1;
+}
+
+/**\fn static int workersWait(void)
+ * \brief wait for the last worker, until the cycle deadline.  RT thread.
+ * \return 0, or -ETIMEDOUT
+ */
+static int workersWait(void)
+{
+    struct timespec t;
+    int ret;
+
+    // The current cycle's deadline, or a period from now if it is past (lockstep, overrun)
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    if (isbefore(t, rt_sched.next))
+        t = rt_sched.next;
+    else
+    {
+        t.tv_nsec += rt_sched.period_ns;
+        tsnorm(&t);
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    while ((ret = sem_clockwait(&workers_done, CLOCK_MONOTONIC, &t)) != 0 && errno == EINTR)
+        ;
+#else
+    // sem_clockwait() is glibc 2.30; sem_timedwait() takes CLOCK_REALTIME
+    struct timespec tmono, treal;
+    long long left_ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &tmono);
+    left_ns = (long long)(t.tv_sec - tmono.tv_sec) * NSEC_PER_SEC + (t.tv_nsec - tmono.tv_nsec);
+    clock_gettime(CLOCK_REALTIME, &treal);
+    left_ns += treal.tv_nsec;
+    treal.tv_sec += left_ns / NSEC_PER_SEC;
+    treal.tv_nsec = left_ns % NSEC_PER_SEC;
+    while ((ret = sem_timedwait(&workers_done, &treal)) != 0 && errno == EINTR)
+        ;
+#endif
+    return ret == 0 ? 0 : -ETIMEDOUT;
+}
+
+/**\fn int usbWorkersRun(int job, const struct timespec *deadline)
+ * \brief run a job on every board at once and wait for all of them
+ * \param job USB_JOB_START_READ, USB_JOB_READ or USB_JOB_WRITE
+ * \param deadline USB_JOB_READ: absolute CLOCK_MONOTONIC time to stop waiting, or NULL for a single attempt
+ * \return zero on success, -EBUSY if any board's read was not complete or a job missed the cycle deadline, else the first error
+ */
+int usbWorkersRun(int job, const struct timespec *deadline)
+{
+    int ret = 0;
+
+    // A job that overran its cycle must finish before the workers get another.
+    // The robot stays soft e-stopped meanwhile.
+    if (workers_overrun)
+    {
+        if (sem_trywait(&workers_done) != 0)
+        {
+            softEstop();
+            return -EBUSY;
+        }
+        workers_overrun = 0;
+        log_msg("USB workers caught up");
+    }
+
+    worker_job = job;
+    worker_has_deadline = (deadline != NULL);
+    if (deadline)
+        worker_deadline = *deadline;
+    workers_remaining = num_workers;
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        workers[i].busy = 1;
+        __sync_synchronize();
+        sem_post(&workers[i].go);
+    }
+    if (workersWait() != 0)
+    {
+        // Straight to the board files: the late worker may be the one that hung
+        workers_overrun = 1;
+        softEstop();
+        usbEmergencyZero();
+        metricInc(MC_USB_WORKER_OVERRUNS);
+        blackboxTrigger("usb worker overrun");
+        for (int i = 0; i < num_workers; i++)
+            if (workers[i].busy)
+                err_msg("USB worker for board %d missed the cycle deadline (job %d), soft e-stop", workers[i].board, job);
+        return -EBUSY;
+    }
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        if (workers[i].result == -EBUSY || ret == -EBUSY)
+            ret = -EBUSY;
+        else if (workers[i].result < 0 && ret == 0)
+            ret = workers[i].result;
+    }
+
+    return ret;
+}
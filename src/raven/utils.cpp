@@ -31,6 +31,7 @@
 #include "utils.h"
 #include "DS0.h"
 #include "defines.h"
+#include "joint_iter.h"
 
 extern int NUM_MECH;
 /**\fn int toShort(int value, short int *target)
@@ -63,103 +64,6 @@ int toShort(int value, short int *target)
 }
 
 
-/**\fn int loop_over_joints(struct robot_device* device0, struct mechanism*& _mech, struct DOF*& _joint, int& mechnum, int& jnum)
- * \brief Iterate over all joints of all mechanisms
- *  To start iteration, call function with _joint == _mech == NULL
- *  Function iterates by incrementing jnum and mnum from zero and returning the appropriate mech and joint.
- *  Iteration terminates when function is called with jnum == MAX_DOF-1 and mnum = NUM_MECH-1.
- *  In the terminating case, mnum and jnum are not modified.  _joint and _mech are also unmodified in that case.
- *
- *  Precondition:  mechnum and jnum point to _previous_ joint.
- *                   At start of iteration _mech == _joint == NULL
- *
- *  Postcondition: jnum and mnum are incremented or reset as necessary
- *                   _mech points to device0.mech[mechnum]
- *                   _joint points to device0.mech[mechnum].joint[jnum+1]
- * \param device0 a pointer points to the robot_device struct
- * \param _mech   a pointer points to the mechanism struct, and it is updated at the end of the function
- * \param _joint  a pointer points to the DOF struct, and it is updated at the end of the function
- * \param mechnum integer value represents the mechanism id, and it is updated at the end of the function
- * \param jnum    integer value represents the joint id, and it is updated at the end of the function
- * \return 0 if reaches to last joint index; 1 elsewise
- */
-int loop_over_joints(struct robot_device* device0, struct mechanism*& _mech, struct DOF*& _joint, int& mechnum, int& jnum)
-{
-    // Initialize iterators
-    if (_mech == NULL || _joint == NULL)
-    {
-        mechnum = 0;
-        jnum = 0;
-    }
-
-    // Terminating condition
-    else if ( mechnum >= (NUM_MECH-1) && jnum >= (MAX_DOF_PER_MECH-1) )
-        return 0;
-
-    // Joint rollover
-    else if ( jnum >= (MAX_DOF_PER_MECH-1) )
-    {
-        mechnum++;
-        jnum=0;
-    }
-
-    // Joint increment
-    else
-    {
-        jnum++;
-        if (jnum == NO_CONNECTION) jnum++;
-    }
-
-    // Set return structs
-    _mech = &(device0->mech[mechnum]);
-    _joint =&(device0->mech[mechnum].joint[jnum]);
-
-    return 1;
-}
-
-/**\fn loop_over_joints(struct mechanism* _mech, struct DOF*& _joint, int& jnum)
- * \brief Iterate over all joints of one mechanism.
- *  To start iteration, call function with _joint == NULL
- *  Function iterates by incrementing jnum from zero and returning the appropriate joint.
- *  Iteration terminates when function is called with jnum == MAX_DOF-1.
- *  In the terminating case, jnum is not modified.  _joint is also unmodified in that case.
- *
- *  Precondition:  jnum point to _previous_ joint.
- *                   At start of iteration _joint == NULL
- *
- *  Postcondition: jnum is incremented or reset as necessary
- *                   _joint points to mech->joint[jnum+1]
- * \param _mech   a pointer points to the mechanism struct, and it is updated at the end of the function
- * \param _joint  a pointer points to the DOF struct, and it is updated at the end of the function
- * \param jnum    integer value represents the joint id, and it is updated at the end of the function
- * \return 0 if reaches to last joint index; 1 elsewise
- */
-int loop_over_joints(struct mechanism* _mech, struct DOF*& _joint, int& jnum)
-{
-    // Initialize iterators
-    if (_joint == NULL)
-    {
-        jnum = 0;
-    }
-
-    // Terminating condition
-    else if ( jnum >= (MAX_DOF_PER_MECH-1) )
-        return 0;
-
-    // Joint increment
-    else
-    {
-        jnum++;
-        if (jnum == NO_CONNECTION) jnum++;
-    }
-
-    // Set return structs
-    _joint =&(_mech->joint[jnum]);
-
-    return 1;
-}
-
-
 /**\fn int is_toolDOF(struct DOF *_joint)
  * \brief check if the current joint is a toolDOF
  * \param _joint a DOF struct 
@@ -176,16 +80,9 @@ int is_toolDOF(struct DOF *_joint){
  */
 int is_toolDOF(int jointType)
 {
-    if ( jointType == TOOL_ROT_GOLD || jointType == TOOL_ROT_GREEN)
-        return 1;
-    if ( jointType == WRIST_GOLD    || jointType == WRIST_GREEN)
-        return 1;
-    if ( jointType == GRASP1_GOLD   || jointType == GRASP1_GREEN)
-        return 1;
-    if ( jointType == GRASP2_GOLD   || jointType == GRASP2_GREEN)
-        return 1;
-
-    return 0;
+    int j = JOINT_OF_TYPE(jointType);
+
+    return j == TOOL_ROT || j == WRIST || j == GRASP1 || j == GRASP2;
 }
 
 
@@ -221,10 +118,17 @@ int robot_ready(struct robot_device* device0)
     struct DOF* _joint = NULL;
     int i, j;
 
-    while ( loop_over_joints(device0, _mech, _joint, i, j) )
+    for (i = mechFirst(); i < mechEnd(); i++)
     {
-        if (_joint->state != jstate_ready)
-            return 0;
+        _mech = &device0->mech[i];
+        for (j = 0; j < MAX_DOF_PER_MECH; j++)
+        {
+            if (!jointActive(j))
+                continue;
+            _joint = &_mech->joint[j];
+            if (_joint->state != jstate_ready)
+                return 0;
+        }
     }
     return 1;
 }
@@ -354,7 +258,7 @@ void getQuaternion(float* Q, float mat[3][3])
  */
 void set_posd_to_pos(struct robot_device* device0)
 {
-    for (int m = 0; m < NUM_MECH; m++) {
+    for (int m = mechFirst(); m < mechEnd(); m++) {
         device0->mech[m].pos_d.x     = device0->mech[m].pos.x;
         device0->mech[m].pos_d.y     = device0->mech[m].pos.y;
         device0->mech[m].pos_d.z     = device0->mech[m].pos.z;
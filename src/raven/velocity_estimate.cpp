@@ -0,0 +1,338 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file velocity_estimate.cpp
+ * \brief Timestamped motor velocity estimation, see velocity_estimate.h
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "velocity_estimate.h"
+#include "defines.h"
+#include "motor.h"
+#include "log.h"
+
+extern struct device device0;
+extern int NUM_MECH;
+
+// A gap between samples outside (0, VE_MAX_GAP periods] is taken as the nominal period
+#define VE_MAX_GAP 50
+
+// Initial velocity variance of the Kalman filter ((rad/s)^2)
+#define VE_KF_P0_VEL 100.0
+
+// One encoder count in motor radians
+#define VE_COUNT_RAD ((2.0*PI) / ENC_CNTS_PER_REV)
+
+// Kalman filter of one joint: motor angle and velocity, covariance
+struct vel_kalman {
+	double p, v;
+	double P00, P01, P11;
+};
+
+// M/T estimate of one joint: sample of the last count change used, last sample
+struct vel_mt {
+	double anchor_t, anchor_pos;
+	double prev_pos;
+	double v;
+};
+
+static int ve_method[JB_N_JOINTS];             // set by setVelEstimator()
+static int ve_running[JB_N_JOINTS];            // what velEstimate() last ran
+static int ve_n_active = 0;                    // joints not on VEL_DIFF
+static struct vel_kalman ve_kf[JB_N_JOINTS];
+static struct vel_mt     ve_mt[JB_N_JOINTS];
+
+// By mechanism: each board's packet has its own arrival time
+static volatile long long ve_stamp_ns[MAX_MECH];   // this cycle's sample, from the loop
+static volatile int ve_fresh[MAX_MECH];            // 0: no new packet this cycle
+static int ve_stamped = 0;                         // the loop stamps samples
+static long long ve_last_ns[MAX_MECH];             // time the estimators are at
+static double ve_t[MAX_MECH];                      // seconds of samples seen, for the M/T anchors
+
+// Tuning, see init_velocity_estimate()
+static double ve_kf_q = 200.0;                 // white acceleration PSD (rad^2/s^3)
+static double ve_kf_r = VE_COUNT_RAD * VE_COUNT_RAD / 12;   // quantisation noise (rad^2)
+static double ve_mt_window = 0.004;            // s
+static double ve_mt_timeout = 0.100;           // s
+
+static const char *ve_names[] = { "diff", "kalman", "mt" };
+
+/**\fn void velEstimateStamp(int m, long long ns, int fresh)
+ * \brief record when mechanism m's encoder values were sampled (controlClockNs() time)
+ * \param m mechanism index
+ * \param ns arrival time of the packet the values came from
+ * \param fresh 0 if no packet came this cycle and the values are the last one's
+ */
+void velEstimateStamp(int m, long long ns, int fresh)
+{
+	if (m < 0 || m >= MAX_MECH)
+		return;
+	ve_stamp_ns[m] = ns;
+	ve_fresh[m] = fresh;
+	ve_stamped = 1;
+}
+
+/**\fn static void resetJoint(int t, int method, double pos)
+ * \brief start joint t's estimator at rest at pos
+ */
+static void resetJoint(int t, int method, double pos)
+{
+	struct vel_kalman &kf = ve_kf[t];
+	kf.p = pos;
+	kf.v = 0;
+	kf.P00 = ve_kf_r;
+	kf.P01 = 0;
+	kf.P11 = VE_KF_P0_VEL;
+
+	struct vel_mt &mt = ve_mt[t];
+	mt.anchor_t = ve_t[MECH_OF_TYPE(t)];
+	mt.anchor_pos = mt.prev_pos = pos;
+	mt.v = 0;
+
+	ve_running[t] = method;
+}
+
+/**\fn void velEstimateReset(int type, float mpos)
+ * \brief restart a joint's estimator at rest, e.g. when its filter history is reset
+ */
+void velEstimateReset(int type, float mpos)
+{
+	if (type >= 0 && type < JB_N_JOINTS)
+		resetJoint(type, ve_method[type], mpos);
+}
+
+/**\fn static double kalmanStep(struct vel_kalman &kf, double z, double dt, int fresh)
+ * \brief one predict / update of the constant-velocity filter with measurement z
+ * \param fresh 0: z is a sample already used, predict only
+ * \return the velocity estimate
+ */
+static double kalmanStep(struct vel_kalman &kf, double z, double dt, int fresh)
+{
+	// Predict: x = F x, P = F P F' + Q, F = [1 dt; 0 1], Q from white acceleration
+	double dt2 = dt * dt;
+	kf.p += kf.v * dt;
+	kf.P00 += dt * (2 * kf.P01 + dt * kf.P11) + ve_kf_q * dt2 * dt / 3;
+	kf.P01 += dt * kf.P11 + ve_kf_q * dt2 / 2;
+	kf.P11 += ve_kf_q * dt;
+	if (!fresh)
+		return kf.v;
+
+	// Update with the motor angle
+	double S  = kf.P00 + ve_kf_r;
+	double K0 = kf.P00 / S;
+	double K1 = kf.P01 / S;
+	double e  = z - kf.p;
+	kf.p += K0 * e;
+	kf.v += K1 * e;
+	kf.P11 -= K1 * kf.P01;
+	kf.P00 *= 1 - K0;
+	kf.P01 *= 1 - K0;
+
+	return kf.v;
+}
+
+/**\fn static double mtStep(struct vel_mt &mt, double z, double t)
+ * \brief M/T estimate at sample time t (s) with motor angle z
+ *
+ * On a count change at least ve_mt_window after the anchor, the velocity is
+ * the angle moved over the time since, and the anchor moves here.  Without
+ * a count the estimate can only shrink: the next count is at least one
+ * count away, so |v| <= (moved + 1 count) / time since the anchor.
+ *
+ * \return the velocity estimate
+ */
+static double mtStep(struct vel_mt &mt, double z, double t)
+{
+	double win = t - mt.anchor_t;
+
+	if (z != mt.prev_pos)
+	{
+		if (win >= ve_mt_window)
+		{
+			mt.v = (z - mt.anchor_pos) / win;
+			mt.anchor_t = t;
+			mt.anchor_pos = z;
+		}
+		mt.prev_pos = z;
+	}
+	else if (win > ve_mt_timeout)
+	{
+		mt.v = 0;
+		mt.anchor_t = t;
+		mt.anchor_pos = z;
+	}
+	else if (win > 0)
+	{
+		double bound = (fabs(z - mt.anchor_pos) + VE_COUNT_RAD) / win;
+		if (fabs(mt.v) > bound)
+			mt.v = copysign(bound, mt.v);
+	}
+	return mt.v;
+}
+
+/**\fn void velEstimate(struct joint_block *jb)
+ * \brief replace mvel of the joints not on VEL_DIFF with their estimate
+ *
+ * Call from stateEstimate() once mpos_raw and the differenced mvel are in
+ * the block, before they are scattered to the joints.
+ *
+ * A mechanism's step is the time between its packets' arrivals.  On a
+ * cycle without a new packet the Kalman filter only predicts, a nominal
+ * period on, and the M/T estimate holds; the next packet is then measured
+ * from where the filter got to.
+ */
+void velEstimate(struct joint_block *jb)
+{
+	double dt[MAX_MECH];
+	int fresh[MAX_MECH];
+	const long long period_ns = (long long)(STEP_PERIOD * 1e9);
+
+	for (int m = 0; m < MAX_MECH; m++)
+	{
+		long long now = ve_stamp_ns[m];
+		fresh[m] = ve_stamped ? ve_fresh[m] : 1;
+		dt[m] = STEP_PERIOD;
+		if (!fresh[m])
+		{
+			if (ve_last_ns[m] != 0)
+				ve_last_ns[m] += period_ns;
+			continue;
+		}
+		if (ve_last_ns[m] != 0 && now > ve_last_ns[m] && now - ve_last_ns[m] <= VE_MAX_GAP * period_ns)
+			dt[m] = (now - ve_last_ns[m]) * 1e-9;
+		ve_last_ns[m] = now;
+		ve_t[m] += dt[m];
+	}
+
+	if (ve_n_active == 0)
+		return;
+
+	for (int t = 0; t < JB_N_JOINTS; t++)
+	{
+		int method = ve_method[t];
+		if (method == VEL_DIFF || !jb->dof[t])
+			continue;
+
+		int m = MECH_OF_TYPE(t);
+		double z = jb->mpos_raw.s[t];
+		if (ve_running[t] != method)
+			resetJoint(t, method, z);
+
+		if (method == VEL_KALMAN)
+			jb->mvel.s[t] = kalmanStep(ve_kf[t], z, dt[m], fresh[m]);
+		else if (fresh[m])
+			jb->mvel.s[t] = mtStep(ve_mt[t], z, ve_t[m]);
+		else
+			jb->mvel.s[t] = ve_mt[t].v;
+	}
+}
+
+/**\fn int setVelEstimator(int type, int method)
+ * \brief choose a joint type's velocity estimator, from the next cycle on
+ * \return 0, or -1 for a bad type or method
+ */
+int setVelEstimator(int type, int method)
+{
+	if (type < 0 || type >= JB_N_JOINTS || method < VEL_DIFF || method > VEL_MT)
+		return -1;
+
+	ve_method[type] = method;
+	int n = 0;
+	for (int t = 0; t < JB_N_JOINTS; t++)
+		n += (ve_method[t] != VEL_DIFF);
+	ve_n_active = n;
+	return 0;
+}
+
+/**\fn static int velEstimatorByName(const std::string &name)
+ * \brief VEL_DIFF, VEL_KALMAN or VEL_MT from a parameter string, -1 if none
+ */
+static int velEstimatorByName(const std::string &name)
+{
+	for (int i = 0; i < (int)(sizeof(ve_names) / sizeof(ve_names[0])); i++)
+		if (name == ve_names[i])
+			return i;
+	return -1;
+}
+
+/**\fn int init_velocity_estimate(ros::NodeHandle &n)
+ * \brief estimator of each joint and their tuning from the parameter server
+ *
+ * vel_estimator_gold / _green list one of "diff", "kalman" or "mt" per
+ * joint, in the same joint order as the gains.  vel_kalman_accel_psd
+ * (rad^2/s^3) sets the Kalman filter's bandwidth, about
+ * (psd / quantisation noise)^(1/4) rad/s; vel_mt_window_ms and
+ * vel_mt_timeout_ms the M/T window and the time without a count after
+ * which the joint is at rest.
+ *
+ * \return 0
+ */
+int init_velocity_estimate(ros::NodeHandle &n)
+{
+	double window_ms, timeout_ms;
+	n.param("/vel_kalman_accel_psd", ve_kf_q, ve_kf_q);
+	n.param("/vel_mt_window_ms", window_ms, ve_mt_window * 1000);
+	n.param("/vel_mt_timeout_ms", timeout_ms, ve_mt_timeout * 1000);
+	if (ve_kf_q <= 0)
+	{
+		err_msg("vel_kalman_accel_psd %g must be positive, using 200", ve_kf_q);
+		ve_kf_q = 200.0;
+	}
+	if (window_ms > 0)
+		ve_mt_window = window_ms / 1000;
+	if (timeout_ms > window_ms)
+		ve_mt_timeout = timeout_ms / 1000;
+
+	// By arm type, onto every mechanism of that type
+	for (int m = 0; m < NUM_MECH; m++)
+	{
+		const char *arm;
+		if (device0.mech[m].type == GOLD_ARM)
+			arm = "gold";
+		else if (device0.mech[m].type == GREEN_ARM)
+			arm = "green";
+		else
+			continue;
+
+		char key[64];
+		XmlRpc::XmlRpcValue v;
+		snprintf(key, sizeof(key), "/vel_estimator_%s", arm);
+		if (!n.hasParam(key) || !n.getParam(key, v))
+			continue;
+		if (v.getType() != XmlRpc::XmlRpcValue::TypeArray || v.size() != MAX_DOF_PER_MECH)
+		{
+			err_msg("%s: need a list of %d estimators", key, MAX_DOF_PER_MECH);
+			continue;
+		}
+
+		for (int j = 0; j < MAX_DOF_PER_MECH; j++)
+		{
+			int method = -1;
+			if (v[j].getType() == XmlRpc::XmlRpcValue::TypeString)
+				method = velEstimatorByName((std::string)v[j]);
+			if (setVelEstimator(JOINT_TYPE(m, j), method) < 0)
+				err_msg("%s[%d]: not diff, kalman or mt, keeping %s", key, j, ve_names[ve_method[JOINT_TYPE(m, j)]]);
+			else if (method != VEL_DIFF)
+				log_msg("Velocity: %s joint %d of %d: %s", arm, j, m, ve_names[method]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,195 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file waypoint_stream.cpp
+ * \brief Timed Cartesian waypoints for autonomous motion, see waypoint_stream.h
+ *
+ * The ROS callback is the only producer of each mechanism's ring, and the
+ * thread running that mechanism's control stages (the RT thread, or its arm
+ * worker) the only consumer.  Waypoint times are converted to gTime ticks
+ * on arrival.
+ */
+
+#include <math.h>
+#include <raven_2/raven_waypoints.h>
+
+#include "waypoint_stream.h"
+#include "setpoint_interp.h"
+#include "spsc_ring.h"
+#include "arm_pipeline.h"
+#include "local_io.h"
+#include "metrics.h"
+#include "log.h"
+
+extern unsigned long int gTime;
+extern int NUM_MECH;
+
+#define WS_RING_SIZE 256     // waypoints queued per arm
+
+struct waypoint
+{
+	unsigned long due;       // gTime at which the arm is there
+	struct position xd;
+	double q[4];             // w, x, y, z
+	int grasp;
+	int keep_grasp;          // no grasp given: hold the current one
+};
+
+struct wp_stream
+{
+	spsc_ring<struct waypoint, WS_RING_SIZE> ring;
+	struct waypoint next;    // consumer: taken from the ring, not yet started
+	int have_next;
+	volatile int active;     // consumer: the stream owns the arm's setpoint
+	unsigned long last_due;  // producer: due time of the last waypoint queued
+};
+
+static struct wp_stream streams[MAX_MECH];
+static double ws_max_lead = 10.0;     // s
+static ros::Subscriber sub_waypoints;
+
+/**\fn static void waypointsCallback(const raven_2::raven_waypoints::ConstPtr &msg)
+ * \brief queue a batch of waypoints for one arm
+ */
+static void waypointsCallback(const raven_2::raven_waypoints::ConstPtr &msg)
+{
+	int m = msg->arm;
+	size_t n = msg->t.size();
+
+	if (m < 0 || m >= NUM_MECH || m >= MAX_MECH || msg->pose.size() != n ||
+	    (!msg->grasp.empty() && msg->grasp.size() != n))
+	{
+		ROS_WARN_THROTTLE(1.0, "raven_waypoints: bad arm %d or array sizes (%zu t, %zu pose, %zu grasp)",
+		                  m, n, msg->pose.size(), msg->grasp.size());
+		return;
+	}
+
+	struct wp_stream *ws = &streams[m];
+	unsigned long now = gTime;
+	long long base = now;
+	if (!msg->hdr.stamp.isZero())
+		base += llround((msg->hdr.stamp - ros::Time::now()).toSec() * control_rate_hz);
+	long long max_due = now + (long long)(ws_max_lead * control_rate_hz);
+
+	int dropped = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		long long due = base + llround(msg->t[i] * control_rate_hz);
+		const geometry_msgs::Quaternion &r = msg->pose[i].rotation;
+		double qn = sqrt(r.w*r.w + r.x*r.x + r.y*r.y + r.z*r.z);
+		if (due <= (long long)now || due <= (long long)ws->last_due || due > max_due || !(qn > 0))
+		{
+			dropped++;
+			continue;
+		}
+
+		struct waypoint wp;
+		wp.due = (unsigned long)due;
+		wp.xd.x = (int)msg->pose[i].translation.x;
+		wp.xd.y = (int)msg->pose[i].translation.y;
+		wp.xd.z = (int)msg->pose[i].translation.z;
+		wp.q[0] = r.w / qn;
+		wp.q[1] = r.x / qn;
+		wp.q[2] = r.y / qn;
+		wp.q[3] = r.z / qn;
+		wp.keep_grasp = msg->grasp.empty();
+		wp.grasp = wp.keep_grasp ? 0 : msg->grasp[i];
+
+		if (!ws->ring.push(wp))
+		{
+			dropped++;
+			continue;
+		}
+		ws->last_due = wp.due;
+	}
+	if (dropped > 0)
+		metricAdd(MC_WAYPOINTS_DROPPED, dropped);
+}
+
+/**\fn int init_waypoint_stream(ros::NodeHandle &n)
+ * \brief subscribe to raven_waypoints
+ * \param n the node handle
+ * \return 0
+ */
+int init_waypoint_stream(ros::NodeHandle &n)
+{
+	n.param("/waypoint_max_lead_s", ws_max_lead, ws_max_lead);
+	sub_waypoints = n.subscribe<raven_2::raven_waypoints>("raven_waypoints", 16, waypointsCallback,
+	                                                     ros::TransportHints().tcpNoDelay());
+	log_msg("Waypoint stream: raven_waypoints, %d queued per arm, up to %g s ahead", WS_RING_SIZE, ws_max_lead);
+	return 0;
+}
+
+/**\fn void waypointStreamStep(struct device *device0, int runlevel)
+ * \brief start each arm's next waypoint segment when the last one is reached; call before setpointInterpStep()
+ * \param device0 robot device
+ * \param runlevel current runlevel; the queues are dropped outside pedal down
+ */
+void waypointStreamStep(struct device *device0, int runlevel)
+{
+	for (int m = mechFirst(); m < mechEnd(); m++)
+	{
+		struct wp_stream *ws = &streams[m];
+		struct waypoint wp;
+
+		if (runlevel != RL_PEDAL_DN)
+		{
+			while (ws->ring.pop(wp))
+				;
+			ws->have_next = 0;
+			ws->active = 0;
+			continue;
+		}
+
+		if (!ws->have_next)
+			ws->have_next = ws->ring.pop(ws->next);
+		// Behind: skip the waypoints already due while later ones are queued
+		while (ws->have_next && ws->next.due <= gTime && ws->ring.pop(wp))
+			ws->next = wp;
+
+		if (ws->active && setpointInterpBusy(m))
+			continue;
+		if (!ws->have_next)
+		{
+			if (ws->active)
+			{
+				// Dry: master deltas carry on from where the arm stopped
+				ws->active = 0;
+				updateMasterRelativeOrigin(device0);
+			}
+			continue;
+		}
+
+		// Arrive at the due tick; the interpolator steps once per tick from this one
+		unsigned long ticks = ws->next.due >= gTime ? ws->next.due - gTime + 1 : 1;
+		int grasp = ws->next.keep_grasp ? device0->mech[m].ori_d.grasp : ws->next.grasp;
+		setpointInterpWaypoint(device0, m, &ws->next.xd, ws->next.q, grasp, ticks);
+		ws->have_next = 0;
+		ws->active = 1;
+	}
+}
+
+/**\fn int waypointStreamActive(int m)
+ * \brief true while mechanism m plays a waypoint stream; master targets are ignored
+ */
+int waypointStreamActive(int m)
+{
+	return m >= 0 && m < MAX_MECH && streams[m].active;
+}
@@ -0,0 +1,277 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file workspace_map.cpp
+ * \brief Reachable wrist directions of each arm, see workspace_map.h
+ */
+
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "workspace_map.h"
+#include "struct.h"
+#include "defines.h"
+#include "tool.h"
+#include "log.h"
+
+extern struct DOF_type DOF_types[];
+
+#define WS_SAMPLE_DEG  0.2     // shoulder / elbow step while building, a fraction of a cell
+#define WS_R_TOL       1e-6    // (m) slack on the insertion range, the limits are floats
+
+// Per arm and cell: the cell itself if reachable, else the nearest reachable cell
+static int ws_nearest[2][WS_N_CELLS];
+static bool ws_ready = false;
+
+// sin/cos of the cell centres
+static double ws_sin_polar[WS_N_POLAR], ws_cos_polar[WS_N_POLAR];
+static double ws_sin_az[WS_N_AZIMUTH], ws_cos_az[WS_N_AZIMUTH];
+
+/**\fn static int wsCell(const btVector3 &u)
+ * \brief the cell of a unit direction
+ */
+static inline int wsCell(const btVector3 &u)
+{
+	double z = u[2];
+	if (z > 1)
+		z = 1;
+	else if (z < -1)
+		z = -1;
+	int ip = (int)(acos(z) * (180 / M_PI) / WS_CELL_DEG);
+	int ia = (int)((atan2(u[1], u[0]) * (180 / M_PI) + 180) / WS_CELL_DEG);
+	if (ip >= WS_N_POLAR)
+		ip = WS_N_POLAR - 1;
+	if (ia >= WS_N_AZIMUTH)
+		ia -= WS_N_AZIMUTH;
+	return ip * WS_N_AZIMUTH + ia;
+}
+
+/**\fn static btVector3 wsCellDir(int c)
+ * \brief unit direction of a cell's centre
+ */
+static inline btVector3 wsCellDir(int c)
+{
+	int ip = c / WS_N_AZIMUTH, ia = c % WS_N_AZIMUTH;
+	return btVector3(ws_sin_polar[ip] * ws_cos_az[ia], ws_sin_polar[ip] * ws_sin_az[ia], ws_cos_polar[ip]);
+}
+
+/**\fn static void insertionRange(l_r in_arm, double &lo, double &hi)
+ * \brief RCM to wrist distance over the insertion limits in use
+ */
+static void insertionRange(l_r in_arm, double &lo, double &hi)
+{
+	double J[6] = { 0, 0, DOF_types[Z_INS].min_limit, 0, 0, 0 };
+	double th_lo[6], th_hi[6];
+
+	joint2theta(th_lo, J, in_arm);
+	J[2] = DOF_types[Z_INS].max_limit;
+	joint2theta(th_hi, J, in_arm);
+
+	double a = th_lo[2] + d4, b = th_hi[2] + d4;
+	lo = std::min(fabs(a), fabs(b));
+	hi = std::max(fabs(a), fabs(b));
+	if (a * b < 0)
+		lo = 0;
+}
+
+/**\fn static int buildArm(l_r in_arm)
+ * \brief mark the reachable cells of one arm and point the others at the nearest
+ * \return number of reachable cells
+ */
+static int buildArm(l_r in_arm)
+{
+	int *nearest = ws_nearest[in_arm];
+	for (int c = 0; c < WS_N_CELLS; c++)
+		nearest[c] = -1;
+
+	// The wrist direction depends on the shoulder and elbow only, as long as
+	// d3 + d4 keeps its sign over the insertion range (it does for every tool)
+	double J[6] = { 0, 0, (Z_INS_MIN_LIMIT + Z_INS_MAX_LIMIT) / 2, 0, 0, 0 };
+	double thetas[6];
+	fk_frames fk;
+	int n1 = (int)((SHOULDER_MAX_LIMIT - SHOULDER_MIN_LIMIT) / (WS_SAMPLE_DEG DEG2RAD)) + 1;
+	int n2 = (int)((ELBOW_MAX_LIMIT - ELBOW_MIN_LIMIT) / (WS_SAMPLE_DEG DEG2RAD)) + 1;
+	int reachable = 0;
+
+	for (int i = 0; i <= n1; i++)
+		for (int k = 0; k <= n2; k++)
+		{
+			J[0] = std::min(SHOULDER_MIN_LIMIT + i * (WS_SAMPLE_DEG DEG2RAD), (double)SHOULDER_MAX_LIMIT);
+			J[1] = std::min(ELBOW_MIN_LIMIT + k * (WS_SAMPLE_DEG DEG2RAD), (double)ELBOW_MAX_LIMIT);
+			joint2theta(thetas, J, in_arm);
+			computeFKFrames(thetas, in_arm, fk);
+			int c = wsCell(fk.base[5].getOrigin().normalized());
+			if (nearest[c] < 0)
+			{
+				nearest[c] = c;
+				reachable++;
+			}
+		}
+	if (reachable == 0)
+		return 0;
+
+	// Reachable cells next to an unreachable one
+	std::vector<int> edge;
+	for (int c = 0; c < WS_N_CELLS; c++)
+	{
+		if (nearest[c] != c)
+			continue;
+		int ip = c / WS_N_AZIMUTH, ia = c % WS_N_AZIMUTH;
+		int w = ip * WS_N_AZIMUTH + (ia + WS_N_AZIMUTH - 1) % WS_N_AZIMUTH;
+		int e = ip * WS_N_AZIMUTH + (ia + 1) % WS_N_AZIMUTH;
+		if (nearest[w] != w || nearest[e] != e ||
+			(ip > 0 && nearest[c - WS_N_AZIMUTH] < 0) ||
+			(ip < WS_N_POLAR - 1 && nearest[c + WS_N_AZIMUTH] < 0))
+			edge.push_back(c);
+	}
+
+	// Everything else: the edge cell at the smallest angle
+	for (int c = 0; c < WS_N_CELLS; c++)
+	{
+		if (nearest[c] == c)
+			continue;
+		btVector3 u = wsCellDir(c);
+		double best = -2;
+		for (size_t j = 0; j < edge.size(); j++)
+		{
+			double d = u.dot(wsCellDir(edge[j]));
+			if (d > best)
+			{
+				best = d;
+				nearest[c] = edge[j];
+			}
+		}
+	}
+	return reachable;
+}
+
+/**\fn int initWorkspaceMap()
+ * \brief build the map of both arms.  Not RT safe (tens of ms).
+ * \return 0 on success, -1 if an arm reaches no cell
+ */
+int initWorkspaceMap()
+{
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (int i = 0; i < WS_N_POLAR; i++)
+	{
+		double th = (i + 0.5) * WS_CELL_DEG DEG2RAD;
+		ws_sin_polar[i] = sin(th);
+		ws_cos_polar[i] = cos(th);
+	}
+	for (int i = 0; i < WS_N_AZIMUTH; i++)
+	{
+		double ph = (i + 0.5) * WS_CELL_DEG DEG2RAD - M_PI;
+		ws_sin_az[i] = sin(ph);
+		ws_cos_az[i] = cos(ph);
+	}
+
+	int n_left = buildArm(dh_left);
+	int n_right = buildArm(dh_right);
+	ws_ready = (n_left > 0 && n_right > 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	log_msg("Workspace map: %d (gold) / %d (green) of %d cells reachable, built in %.0f ms",
+			n_left, n_right, WS_N_CELLS,
+			(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+	return ws_ready ? 0 : -1;
+}
+
+/**\fn int workspaceMapReady()
+ * \return nonzero once initWorkspaceMap() has built both arms
+ */
+int workspaceMapReady()
+{
+	return ws_ready;
+}
+
+/**\fn int workspaceReachable(l_r in_arm, const btVector3 &in_p05)
+ * \brief can the arm put its wrist at in_p05?
+ * \param in_arm - arm type
+ * \param in_p05 - wrist point in the tilted base frame, as computeFKFrames() base[5]
+ * \return 1 if reachable (or no map was built), 0 if not
+ */
+int workspaceReachable(l_r in_arm, const btVector3 &in_p05)
+{
+	if (!ws_ready)
+		return 1;
+
+	double r = in_p05.length();
+	if (r <= 0)
+		return 0;
+	int c = wsCell(in_p05 / r);
+	if (ws_nearest[in_arm][c] != c)
+		return 0;
+
+	double lo, hi;
+	insertionRange(in_arm, lo, hi);
+	return r >= lo - WS_R_TOL && r <= hi + WS_R_TOL;
+}
+
+/**\fn int workspaceClip(l_r in_arm, const btVector3 &in_p05, btVector3 &out_p05)
+ * \brief nearest reachable wrist point
+ *
+ * An unreachable direction moves to the centre of the nearest reachable
+ * cell, so the result is only as close as the cell size; apply_joint_limits()
+ * stays the exact limit.
+ *
+ * \param in_arm - arm type
+ * \param in_p05 - wrist point in the tilted base frame
+ * \param out_p05 - the reachable wrist point (in_p05 if it is reachable)
+ * \return 1 if the point moved, 0 if not
+ */
+int workspaceClip(l_r in_arm, const btVector3 &in_p05, btVector3 &out_p05)
+{
+	out_p05 = in_p05;
+	if (!ws_ready)
+		return 0;
+
+	double r = in_p05.length();
+	if (r <= 0)
+		return 0;
+
+	btVector3 u = in_p05 / r;
+	int c = wsCell(u);
+	int n = ws_nearest[in_arm][c];
+	int moved = 0;
+	if (n != c)
+	{
+		u = wsCellDir(n);
+		moved = 1;
+	}
+
+	double lo, hi;
+	insertionRange(in_arm, lo, hi);
+	if (r < lo - WS_R_TOL)
+	{
+		r = lo;
+		moved = 1;
+	}
+	else if (r > hi + WS_R_TOL)
+	{
+		r = hi;
+		moved = 1;
+	}
+
+	if (moved)
+		out_p05 = u * r;
+	return moved;
+}